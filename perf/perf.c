@@ -18,6 +18,13 @@
 
 #include "supplemental/util/platform.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 #if defined(NNG_HAVE_PAIR1)
 #include "protocol/pair1/pair.h"
 
@@ -37,6 +44,26 @@ nng_pair_open(nng_socket *arg)
 }
 #endif // NNG_ENABLE_PAIR
 
+#if defined(NNG_HAVE_SUB0)
+#include "protocol/pubsub0/sub.h"
+#endif
+
+#if defined(NNG_HAVE_SURVEYOR0) && defined(NNG_HAVE_RESPONDENT0)
+#include "protocol/survey0/respond.h"
+#include "protocol/survey0/survey.h"
+#endif
+
+// Some of the benchmarks (sub_filter, task_dispatch) measure internal
+// facilities directly, so they need the internal interfaces.
+#include "core/nng_impl.h"
+
+#if defined(NNG_TRANSPORT_WS) || defined(NNG_TRANSPORT_WSS)
+#include "supplemental/http/http_api.h"
+#include "supplemental/tls/tls_api.h"
+#include "supplemental/websocket/websocket.h"
+#define PERF_HAVE_WEBSOCKET
+#endif
+
 static void latency_client(const char *, size_t, int);
 static void latency_server(const char *, size_t, int);
 static void throughput_client(const char *, size_t, int);
@@ -47,6 +74,14 @@ static void do_remote_thr(int argc, char **argv);
 static void do_local_thr(int argc, char **argv);
 static void do_inproc_thr(int argc, char **argv);
 static void do_inproc_lat(int argc, char **argv);
+static void do_tcp_lat(int argc, char **argv);
+static void do_sub_filter(int argc, char **argv);
+static void do_task_dispatch(int argc, char **argv);
+static void do_random(int argc, char **argv);
+static void do_wsmask(int argc, char **argv);
+static void do_survey(int argc, char **argv);
+static void do_udp_thr(int argc, char **argv);
+static void do_device_thr(int argc, char **argv);
 static void die(const char *, ...);
 
 // perf implements the same performance tests found in the standard
@@ -62,6 +97,14 @@ static void die(const char *, ...);
 // - remote_thr - remote throughput side
 // - inproc_lat - inproc latency
 // - inproc_thr - inproc throughput
+// - tcp_lat    - loopback TCP latency, with and without TCP_NODELAY
+// - sub_filter - SUB topic filtering cost
+// - task_dispatch - task queue dispatch throughput
+// - random_thr - random number generation, with contending threads
+// - wsmask_thr - websocket masking and UTF-8 validation speed
+// - survey_thr - concurrent survey throughput, using contexts
+// - udp_thr    - loopback UDP datagram throughput, with aios in flight
+// - device_thr - throughput through nng_device, for several windows
 //
 
 int
@@ -101,6 +144,22 @@ main(int argc, char **argv)
 		do_inproc_thr(argc, argv);
 	} else if ((strcmp(prog, "inproc_lat") == 0)) {
 		do_inproc_lat(argc, argv);
+	} else if ((strcmp(prog, "tcp_lat") == 0)) {
+		do_tcp_lat(argc, argv);
+	} else if ((strcmp(prog, "sub_filter") == 0)) {
+		do_sub_filter(argc, argv);
+	} else if ((strcmp(prog, "task_dispatch") == 0)) {
+		do_task_dispatch(argc, argv);
+	} else if ((strcmp(prog, "random_thr") == 0)) {
+		do_random(argc, argv);
+	} else if ((strcmp(prog, "wsmask_thr") == 0)) {
+		do_wsmask(argc, argv);
+	} else if ((strcmp(prog, "survey_thr") == 0)) {
+		do_survey(argc, argv);
+	} else if ((strcmp(prog, "udp_thr") == 0)) {
+		do_udp_thr(argc, argv);
+	} else if ((strcmp(prog, "device_thr") == 0)) {
+		do_device_thr(argc, argv);
 	} else {
 		die("Unknown program mode? Use -m <mode>.");
 	}
@@ -138,6 +197,52 @@ parse_int(const char *arg, const char *what)
 	return ((int) val);
 }
 
+// perf_usec returns a monotonic time in microseconds.  nng_clock() only
+// has millisecond resolution, which is too coarse to time single trips.
+static uint64_t
+perf_usec(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return ((uint64_t)(now.QuadPart / (freq.QuadPart / 1000000)));
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+#endif
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return ((x < y) ? -1 : (x > y) ? 1 : 0);
+}
+
+// Value for NNG_OPT_TCP_NODELAY on the latency sockets; tcp_lat runs
+// with it both ways.  Negative leaves the transport default alone.
+static int lat_nodelay = -1;
+
+static void
+lat_setopts(nng_socket s)
+{
+	int rv;
+
+	if (lat_nodelay < 0) {
+		return;
+	}
+	if ((rv = nng_setopt_int(s, NNG_OPT_TCP_NODELAY, lat_nodelay)) != 0) {
+		die("nng_setopt(nodelay): %s", nng_strerror(rv));
+	}
+}
+
 void
 do_local_lat(int argc, char **argv)
 {
@@ -244,6 +349,41 @@ do_inproc_lat(int argc, char **argv)
 	nng_thread_destroy(thr);
 }
 
+// do_tcp_lat runs the latency test over loopback TCP twice, first with
+// Nagle's algorithm disabled (the default) and then with it enabled, so
+// that the effect on the tail latency can be compared.
+void
+do_tcp_lat(int argc, char **argv)
+{
+	static const char *addrs[] = { "tcp://127.0.0.1:13580",
+		"tcp://127.0.0.1:13581" };
+	nng_thread *       thr;
+	struct inproc_args ia;
+	int                rv;
+
+	if (argc != 2) {
+		die("Usage: tcp_lat <msg-size> <count>");
+	}
+
+	ia.msgsize = parse_int(argv[0], "message size");
+	ia.count   = parse_int(argv[1], "count");
+	ia.func    = latency_server;
+
+	for (int i = 0; i < 2; i++) {
+		lat_nodelay = (i == 0) ? 1 : 0;
+		ia.addr     = addrs[i];
+
+		if ((rv = nng_thread_create(&thr, do_inproc, &ia)) != 0) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+		nng_msleep(100);
+
+		printf("\nTCP_NODELAY %s:\n", lat_nodelay ? "on" : "off");
+		latency_client(ia.addr, ia.msgsize, ia.count);
+		nng_thread_destroy(thr);
+	}
+}
+
 void
 do_inproc_thr(int argc, char **argv)
 {
@@ -273,6 +413,7 @@ latency_client(const char *addr, size_t msgsize, int trips)
 	nng_socket s;
 	nng_msg *  msg;
 	nng_time   start, end;
+	uint64_t * trip;
 	int        rv;
 	int        i;
 	float      total;
@@ -281,9 +422,12 @@ latency_client(const char *addr, size_t msgsize, int trips)
 	if ((rv = nng_pair_open(&s)) != 0) {
 		die("nng_socket: %s", nng_strerror(rv));
 	}
+	if ((trip = calloc(trips > 0 ? trips : 1, sizeof(uint64_t))) == NULL) {
+		die("calloc: out of memory");
+	}
 
-	// XXX: set no delay
 	// XXX: other options (TLS in the future?, Linger?)
+	lat_setopts(s);
 
 	if ((rv = nng_dial(s, addr, NULL, 0)) != 0) {
 		die("nng_dial: %s", nng_strerror(rv));
@@ -295,6 +439,8 @@ latency_client(const char *addr, size_t msgsize, int trips)
 
 	start = nng_clock();
 	for (i = 0; i < trips; i++) {
+		uint64_t t0 = perf_usec();
+
 		if ((rv = nng_sendmsg(s, msg, 0)) != 0) {
 			die("nng_sendmsg: %s", nng_strerror(rv));
 		}
@@ -302,6 +448,7 @@ latency_client(const char *addr, size_t msgsize, int trips)
 		if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
 			die("nng_recvmsg: %s", nng_strerror(rv));
 		}
+		trip[i] = perf_usec() - t0;
 	}
 	end = nng_clock();
 
@@ -314,6 +461,15 @@ latency_client(const char *addr, size_t msgsize, int trips)
 	printf("message size: %d [B]\n", (int) msgsize);
 	printf("round trip count: %d\n", trips);
 	printf("average latency: %.3f [us]\n", latency);
+
+	// Like the average, the percentiles are half of the round trip.
+	if (trips > 0) {
+		qsort(trip, trips, sizeof(uint64_t), cmp_u64);
+		printf("p50 latency: %.3f [us]\n", trip[trips / 2] / 2.0);
+		printf("p99 latency: %.3f [us]\n",
+		    trip[(int) ((trips - 1) * 0.99)] / 2.0);
+	}
+	free(trip);
 }
 
 void
@@ -328,8 +484,8 @@ latency_server(const char *addr, size_t msgsize, int trips)
 		die("nng_socket: %s", nng_strerror(rv));
 	}
 
-	// XXX: set no delay
 	// XXX: other options (TLS in the future?, Linger?)
+	lat_setopts(s);
 
 	if ((rv = nng_listen(s, addr, NULL, 0)) != 0) {
 		die("nng_listen: %s", nng_strerror(rv));
@@ -460,3 +616,964 @@ throughput_client(const char *addr, size_t msgsize, int count)
 	nng_msleep(100);
 	nng_close(s);
 }
+
+#if defined(NNG_HAVE_SUB0)
+
+// sub_filter_run pushes count messages through a SUB socket's receive
+// queue, where the subscription filter runs, and returns the elapsed time
+// in msec.  Each message matches one of the subscriptions, spread evenly
+// across all of them.
+static uint64_t
+sub_filter_run(nng_socket s, int nsubs, int count)
+{
+	nni_sock *sock;
+	nni_msgq *urq;
+	nng_msg * msg;
+	uint64_t  start, end;
+	char      topic[64];
+	int       rv;
+	int       i;
+
+	if ((rv = nni_sock_find(&sock, s)) != 0) {
+		die("nni_sock_find: %s", nng_strerror(rv));
+	}
+	urq   = nni_sock_recvq(sock);
+	start = nng_clock();
+	for (i = 0; i < count; i++) {
+		(void) snprintf(topic, sizeof(topic), "/sensor/%08d/reading",
+		    (int) (((unsigned) i * 7919u) % (unsigned) nsubs));
+		if ((rv = nng_msg_alloc(&msg, 0)) != 0) {
+			die("nng_msg_alloc: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_msg_append(msg, topic, strlen(topic))) != 0) {
+			die("nng_msg_append: %s", nng_strerror(rv));
+		}
+		if ((rv = nni_msgq_tryput(urq, msg)) != 0) {
+			die("nni_msgq_tryput: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
+			die("nng_recvmsg: %s", nng_strerror(rv));
+		}
+		nng_msg_free(msg);
+	}
+	end = nng_clock();
+	nni_sock_rele(sock);
+	return (end - start);
+}
+
+static void
+sub_filter(int nsubs, int count)
+{
+	nng_socket s;
+	uint64_t   start, end;
+	uint64_t   raw, cooked;
+	char       topic[64];
+	int        rv;
+	int        i;
+
+	if ((rv = nng_sub_open(&s)) != 0) {
+		die("nng_socket: %s", nng_strerror(rv));
+	}
+	// We need room to queue the message before receiving it.
+	if ((rv = nng_setopt_int(s, NNG_OPT_RECVBUF, 1)) != 0) {
+		die("nng_setopt(nng_opt_recvbuf): %s", nng_strerror(rv));
+	}
+
+	// Subscriptions share a long common prefix, as real topic
+	// hierarchies tend to.
+	start = nng_clock();
+	for (i = 0; i < nsubs; i++) {
+		(void) snprintf(topic, sizeof(topic), "/sensor/%08d/", i);
+		rv = nng_setopt(s, NNG_OPT_SUB_SUBSCRIBE, topic, strlen(topic));
+		if (rv != 0) {
+			die("nng_setopt(subscribe): %s", nng_strerror(rv));
+		}
+	}
+	end = nng_clock();
+
+	// Raw mode bypasses the filter, giving us a baseline for the
+	// cost of everything else.
+	if ((rv = nng_setopt_int(s, NNG_OPT_RAW, 1)) != 0) {
+		die("nng_setopt(raw): %s", nng_strerror(rv));
+	}
+	raw = sub_filter_run(s, nsubs, count);
+	if ((rv = nng_setopt_int(s, NNG_OPT_RAW, 0)) != 0) {
+		die("nng_setopt(raw): %s", nng_strerror(rv));
+	}
+	cooked = sub_filter_run(s, nsubs, count);
+	nng_close(s);
+
+	printf("subscriptions: %d\n", nsubs);
+	printf("subscribe time: %.3f [s]\n", (float) (end - start) / 1000);
+	printf("message count: %d\n", count);
+	printf("time per message: %.3f [us]\n",
+	    (float) (cooked * 1000) / (float) count);
+	printf("filter cost: %.3f [us]\n",
+	    cooked > raw ? (float) ((cooked - raw) * 1000) / (float) count
+	                 : 0.0f);
+}
+
+void
+do_sub_filter(int argc, char **argv)
+{
+	int count;
+
+	if (argc != 1) {
+		die("Usage: sub_filter <count>");
+	}
+	count = parse_int(argv[0], "count");
+
+	// Measure against a handful of subscription table sizes.
+	sub_filter(1, count);
+	sub_filter(1000, count);
+	sub_filter(100000, count);
+}
+
+#else
+
+void
+do_sub_filter(int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+	die("No sub protocol enabled in this build!");
+}
+
+#endif // NNG_HAVE_SUB0
+
+// The task dispatch benchmark has a number of producer threads, each
+// dispatching a batch of tasks to the system task queue and waiting for
+// them, over and over.  This is the pattern of aio completions.
+#define TASK_BATCH 16
+
+typedef struct {
+	nni_task    tasks[TASK_BATCH];
+	int         runs[TASK_BATCH];
+	int         count;
+	nng_thread *thr;
+} task_producer;
+
+static void
+task_run(void *arg)
+{
+	int *runs = arg;
+	(*runs)++;
+}
+
+static void
+task_produce(void *arg)
+{
+	task_producer *tp = arg;
+
+	for (int n = 0; n < tp->count; n += TASK_BATCH) {
+		for (int i = 0; i < TASK_BATCH; i++) {
+			nni_task_dispatch(&tp->tasks[i]);
+		}
+		for (int i = 0; i < TASK_BATCH; i++) {
+			nni_task_wait(&tp->tasks[i]);
+		}
+	}
+}
+
+static void
+task_dispatch(int nprod, int count)
+{
+	task_producer *prods;
+	uint64_t       start, end;
+	int            rv;
+	int            total;
+
+	if ((prods = calloc(nprod, sizeof(*prods))) == NULL) {
+		die("calloc: %s", nng_strerror(NNG_ENOMEM));
+	}
+	total = 0;
+	for (int p = 0; p < nprod; p++) {
+		task_producer *tp = &prods[p];
+		tp->count         = count / nprod;
+		for (int i = 0; i < TASK_BATCH; i++) {
+			nni_task_init(
+			    NULL, &tp->tasks[i], task_run, &tp->runs[i]);
+		}
+	}
+	start = nng_clock();
+	for (int p = 0; p < nprod; p++) {
+		rv = nng_thread_create(&prods[p].thr, task_produce, &prods[p]);
+		if (rv != 0) {
+			die("nng_thread_create: %s", nng_strerror(rv));
+		}
+	}
+	for (int p = 0; p < nprod; p++) {
+		nng_thread_destroy(prods[p].thr);
+		for (int i = 0; i < TASK_BATCH; i++) {
+			total += prods[p].runs[i];
+		}
+	}
+	end = nng_clock();
+	free(prods);
+
+	if (end == start) {
+		end++;
+	}
+	printf("producers: %d\n", nprod);
+	printf("tasks run: %d\n", total);
+	printf("total time: %.3f [s]\n", (float) (end - start) / 1000);
+	printf("throughput: %.0f [tasks/s]\n",
+	    (float) total * 1000 / (float) (end - start));
+}
+
+void
+do_task_dispatch(int argc, char **argv)
+{
+	int count;
+	int rv;
+
+	if (argc != 1) {
+		die("Usage: task_dispatch <count>");
+	}
+	count = parse_int(argv[0], "count");
+	if ((rv = nni_init()) != 0) {
+		die("nni_init: %s", nng_strerror(rv));
+	}
+	for (int nprod = 1; nprod <= 64; nprod *= 2) {
+		task_dispatch(nprod, count);
+	}
+}
+
+// The random benchmark has a number of threads all drawing random numbers
+// at once, either one at a time, or (as for websocket masks) in batches.
+#define RANDOM_BATCH 64 // bytes
+
+typedef struct {
+	int         count;
+	bool        bulk;
+	uint32_t    sum; // so the work is not optimized away
+	nng_thread *thr;
+} random_worker;
+
+static void
+random_work(void *arg)
+{
+	random_worker *rw = arg;
+	uint32_t       buf[RANDOM_BATCH / sizeof(uint32_t)];
+
+	for (int n = 0; n < rw->count; n++) {
+		if (rw->bulk) {
+			nni_random_fill(buf, sizeof(buf));
+			rw->sum += buf[0];
+		} else {
+			rw->sum += nni_random();
+		}
+	}
+}
+
+static void
+random_bench(int nthr, int count, bool bulk)
+{
+	random_worker *workers;
+	uint64_t       start, end;
+	int            rv;
+
+	if ((workers = calloc(nthr, sizeof(*workers))) == NULL) {
+		die("calloc: %s", nng_strerror(NNG_ENOMEM));
+	}
+	for (int i = 0; i < nthr; i++) {
+		workers[i].count = count / nthr;
+		workers[i].bulk  = bulk;
+	}
+	start = nng_clock();
+	for (int i = 0; i < nthr; i++) {
+		rv = nng_thread_create(&workers[i].thr, random_work, &workers[i]);
+		if (rv != 0) {
+			die("nng_thread_create: %s", nng_strerror(rv));
+		}
+	}
+	for (int i = 0; i < nthr; i++) {
+		nng_thread_destroy(workers[i].thr);
+	}
+	end = nng_clock();
+	free(workers);
+
+	if (end == start) {
+		end++;
+	}
+	printf("%-10s threads: %2d  time: %.3f [s]  rate: %.0f [calls/s]\n",
+	    bulk ? "fill(64)" : "random", nthr, (float) (end - start) / 1000,
+	    (float) (count / nthr) * nthr * 1000 / (float) (end - start));
+}
+
+void
+do_random(int argc, char **argv)
+{
+	int count;
+	int rv;
+
+	if (argc != 1) {
+		die("Usage: random_thr <count>");
+	}
+	count = parse_int(argv[0], "count");
+	if ((rv = nni_init()) != 0) {
+		die("nni_init: %s", nng_strerror(rv));
+	}
+	for (int nthr = 1; nthr <= 32; nthr *= 2) {
+		random_bench(nthr, count, false);
+	}
+	for (int nthr = 1; nthr <= 32; nthr *= 2) {
+		random_bench(nthr, count / 16, true);
+	}
+}
+
+#if defined(PERF_HAVE_WEBSOCKET)
+
+// The websocket benchmark runs the frame masking and UTF-8 validation
+// kernels over a buffer in memory, and reports the rate in GB/s.  The
+// byte at a time masking loop that these replaced is shown for reference.
+
+static void
+wsmask_bytewise(uint8_t *buf, size_t len, const uint8_t *mask)
+{
+	for (size_t i = 0; i < len; i++) {
+		buf[i] ^= mask[i % 4];
+	}
+}
+
+static void
+wsmask_report(const char *what, size_t size, int count, uint64_t usec)
+{
+	if (usec == 0) {
+		usec = 1;
+	}
+	printf("%-10s size: %8zu  time: %.3f [s]  rate: %.2f [GB/s]\n", what,
+	    size, (double) usec / 1000000,
+	    (double) size * count / ((double) usec * 1000));
+}
+
+void
+do_wsmask(int argc, char **argv)
+{
+	static const uint8_t mask[4] = { 0xde, 0xad, 0xbe, 0xef };
+	size_t               size;
+	int                  count;
+	uint8_t *            buf;
+	uint64_t             start;
+	bool                 valid = true;
+
+	if (argc != 2) {
+		die("Usage: wsmask_thr <msg-size> <count>");
+	}
+	size  = parse_int(argv[0], "message size");
+	count = parse_int(argv[1], "count");
+	if ((buf = malloc(size)) == NULL) {
+		die("malloc: %s", nng_strerror(NNG_ENOMEM));
+	}
+
+	// Mostly ASCII, with a multibyte character every so often, which
+	// is typical of JSON and other text payloads.
+	for (size_t i = 0; i < size; i++) {
+		buf[i] = 'a' + (i % 26);
+	}
+	for (size_t i = 0; i + 3 <= size; i += 1000) {
+		memcpy(buf + i, "\xe2\x82\xac", 3);
+	}
+
+	start = perf_usec();
+	for (int i = 0; i < count; i++) {
+		wsmask_bytewise(buf, size, mask);
+	}
+	wsmask_report("bytewise", size, count, perf_usec() - start);
+
+	start = perf_usec();
+	for (int i = 0; i < count; i++) {
+		nni_ws_mask(buf, size, mask);
+	}
+	wsmask_report("mask", size, count, perf_usec() - start);
+
+	// An even number of rounds of each leaves the text unmasked.
+	if ((count % 2) != 0) {
+		nni_ws_mask(buf, size, mask);
+		wsmask_bytewise(buf, size, mask);
+	}
+
+	start = perf_usec();
+	for (int i = 0; i < count; i++) {
+		valid &= nni_ws_utf8_valid(buf, size);
+	}
+	wsmask_report("utf8", size, count, perf_usec() - start);
+	if (!valid) {
+		die("UTF-8 validation failed");
+	}
+	free(buf);
+}
+
+#else
+
+void
+do_wsmask(int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+	die("No websocket support in this build!");
+}
+
+#endif // PERF_HAVE_WEBSOCKET
+
+#if defined(NNG_HAVE_SURVEYOR0) && defined(NNG_HAVE_RESPONDENT0)
+
+// The survey benchmark keeps a number of surveys running at once on a
+// single SURVEYOR socket, each in its own context, against a number of
+// respondents that just echo each survey back.  As soon as a survey has
+// all of its responses, its context starts another one.
+
+typedef struct survey_bench survey_bench;
+
+typedef struct {
+	survey_bench *bench;
+	nng_ctx       ctx;
+	nng_aio *     aio;
+	bool          sending;
+	int           nresp; // responses received for this survey
+} survey_ctx;
+
+struct survey_bench {
+	nng_mtx *mtx;
+	nng_cv * cv;
+	int      nresp;  // respondents, i.e. responses expected per survey
+	int      count;  // surveys to run in total
+	int      issued; // surveys started so far
+	int      done;   // surveys finished so far
+	int      lost;   // surveys that timed out with responses missing
+};
+
+static void
+survey_start(survey_ctx *sc)
+{
+	nng_msg *msg;
+	int      rv;
+
+	if ((rv = nng_msg_alloc(&msg, 8)) != 0) {
+		die("nng_msg_alloc: %s", nng_strerror(rv));
+	}
+	sc->sending = true;
+	sc->nresp   = 0;
+	nng_aio_set_msg(sc->aio, msg);
+	nng_ctx_send(sc->ctx, sc->aio);
+}
+
+static void
+survey_cb(void *arg)
+{
+	survey_ctx *  sc = arg;
+	survey_bench *b  = sc->bench;
+	bool          again;
+	int           rv;
+
+	rv = nng_aio_result(sc->aio);
+	if (sc->sending) {
+		if (rv != 0) {
+			die("nng_ctx_send: %s", nng_strerror(rv));
+		}
+		sc->sending = false;
+		nng_ctx_recv(sc->ctx, sc->aio);
+		return;
+	}
+	if (rv == 0) {
+		nng_msg_free(nng_aio_get_msg(sc->aio));
+		if (++sc->nresp < b->nresp) {
+			nng_ctx_recv(sc->ctx, sc->aio);
+			return;
+		}
+	} else if (rv != NNG_ETIMEDOUT) {
+		die("nng_ctx_recv: %s", nng_strerror(rv));
+	}
+
+	nng_mtx_lock(b->mtx);
+	if (rv != 0) {
+		b->lost++;
+	}
+	b->done++;
+	if ((again = (b->issued < b->count)) != false) {
+		b->issued++;
+	}
+	if (b->done == b->count) {
+		nng_cv_wake(b->cv);
+	}
+	nng_mtx_unlock(b->mtx);
+
+	if (again) {
+		survey_start(sc);
+	}
+}
+
+static void
+survey_respond(void *arg)
+{
+	nng_socket *s = arg;
+	nng_msg *   msg;
+
+	// This runs until the socket is closed.
+	while (nng_recvmsg(*s, &msg, 0) == 0) {
+		if (nng_sendmsg(*s, msg, 0) != 0) {
+			nng_msg_free(msg);
+		}
+	}
+}
+
+static void
+survey_run(const char *addr, int nctx, int nresp, int count)
+{
+	survey_bench  b;
+	survey_ctx *  ctxs;
+	nng_socket    surv;
+	nng_socket *  resps;
+	nng_thread ** thrs;
+	uint64_t      start, end;
+	int           rv;
+
+	memset(&b, 0, sizeof(b));
+	b.nresp = nresp;
+	b.count = count;
+	if (((rv = nng_mtx_alloc(&b.mtx)) != 0) ||
+	    ((rv = nng_cv_alloc(&b.cv, b.mtx)) != 0)) {
+		die("nng_mtx_alloc: %s", nng_strerror(rv));
+	}
+	if (((ctxs = calloc(nctx, sizeof(*ctxs))) == NULL) ||
+	    ((resps = calloc(nresp, sizeof(*resps))) == NULL) ||
+	    ((thrs = calloc(nresp, sizeof(*thrs))) == NULL)) {
+		die("calloc: %s", nng_strerror(NNG_ENOMEM));
+	}
+
+	if ((rv = nng_surveyor0_open(&surv)) != 0) {
+		die("nng_surveyor0_open: %s", nng_strerror(rv));
+	}
+	// Surveys are only lost if a queue somewhere overflows, so this
+	// is just to keep us from waiting forever for those.
+	rv = nng_setopt_ms(surv, NNG_OPT_SURVEYOR_SURVEYTIME, 1000);
+	if (rv != 0) {
+		die("nng_setopt(survey-time): %s", nng_strerror(rv));
+	}
+	if ((rv = nng_listen(surv, addr, NULL, 0)) != 0) {
+		die("nng_listen: %s", nng_strerror(rv));
+	}
+	for (int i = 0; i < nresp; i++) {
+		if ((rv = nng_respondent0_open(&resps[i])) != 0) {
+			die("nng_respondent0_open: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_dial(resps[i], addr, NULL, 0)) != 0) {
+			die("nng_dial: %s", nng_strerror(rv));
+		}
+		rv = nng_thread_create(&thrs[i], survey_respond, &resps[i]);
+		if (rv != 0) {
+			die("nng_thread_create: %s", nng_strerror(rv));
+		}
+	}
+	for (int i = 0; i < nctx; i++) {
+		survey_ctx *sc = &ctxs[i];
+		sc->bench      = &b;
+		if ((rv = nng_ctx_open(&sc->ctx, surv)) != 0) {
+			die("nng_ctx_open: %s", nng_strerror(rv));
+		}
+		if ((rv = nng_aio_alloc(&sc->aio, survey_cb, sc)) != 0) {
+			die("nng_aio_alloc: %s", nng_strerror(rv));
+		}
+	}
+
+	// Give the connections a chance to come up.
+	nng_msleep(100);
+
+	start = nng_clock();
+	nng_mtx_lock(b.mtx);
+	for (int i = 0; (i < nctx) && (b.issued < count); i++) {
+		b.issued++;
+		survey_start(&ctxs[i]);
+	}
+	while (b.done < count) {
+		nng_cv_wait(b.cv);
+	}
+	nng_mtx_unlock(b.mtx);
+	end = nng_clock();
+
+	for (int i = 0; i < nctx; i++) {
+		nng_aio_stop(ctxs[i].aio);
+		nng_ctx_close(ctxs[i].ctx);
+		nng_aio_free(ctxs[i].aio);
+	}
+	// Closing the respondents (the dialing side) first leaves the
+	// listening port free for the next run.
+	for (int i = 0; i < nresp; i++) {
+		nng_close(resps[i]);
+		nng_thread_destroy(thrs[i]);
+	}
+	nng_close(surv);
+	free(thrs);
+	free(resps);
+	free(ctxs);
+	nng_cv_free(b.cv);
+	nng_mtx_free(b.mtx);
+
+	if (end == start) {
+		end++;
+	}
+	printf("%s: %d overlapping, %d respondents\n", addr, nctx, nresp);
+	printf("surveys: %d (%d incomplete)\n", count, b.lost);
+	printf("total time: %.3f [s]\n", (float) (end - start) / 1000);
+	printf("throughput: %.0f [surveys/s]\n",
+	    (float) count * 1000 / (float) (end - start));
+	printf("responses: %.0f [msgs/s]\n",
+	    (float) (count - b.lost) * nresp * 1000 / (float) (end - start));
+}
+
+void
+do_survey(int argc, char **argv)
+{
+	static const char *addrs[] = {
+		"inproc://survey_perf",
+		"tcp://127.0.0.1:13579",
+	};
+	int count;
+
+	if (argc != 1) {
+		die("Usage: survey_thr <count>");
+	}
+	count = parse_int(argv[0], "count");
+
+	for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); i++) {
+		for (int nresp = 1; nresp <= 8; nresp *= 8) {
+			// Surveys are sent best effort, so much more than
+			// 16 at once (the depth of the per pipe queues) will
+			// see some of them dropped, and time out.
+			for (int nctx = 1; nctx <= 16; nctx *= 4) {
+				survey_run(addrs[i], nctx, nresp, count);
+			}
+		}
+	}
+}
+
+#else
+
+void
+do_survey(int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+	die("No survey protocols enabled in this build!");
+}
+
+#endif // NNG_HAVE_SURVEYOR0 && NNG_HAVE_RESPONDENT0
+
+// The UDP benchmark measures the platform datagram layer directly, as
+// used by the ZeroTier transport.  It keeps a number of sends and
+// receives outstanding on a pair of loopback sockets; with more than one
+// in flight the platform can move several datagrams per system call.
+// UDP is not reliable, so the receiver reports what actually arrived.
+
+typedef struct udp_bench udp_bench;
+
+typedef struct {
+	udp_bench *   bench;
+	nni_plat_udp *udp;
+	nng_aio *     aio;
+	nng_sockaddr  sa;
+	nng_iov       iov;
+} udp_op;
+
+struct udp_bench {
+	nng_mtx *mtx;
+	nng_cv * cv;
+	int      count;  // datagrams to send
+	int      issued; // sends started so far
+	int      sent;   // sends completed so far
+	int      recvd;  // datagrams received so far
+	uint64_t last;   // time of the last receive
+};
+
+static void
+udp_send_cb(void *arg)
+{
+	udp_op *   op = arg;
+	udp_bench *b  = op->bench;
+	bool       again;
+	int        rv;
+
+	if ((rv = nng_aio_result(op->aio)) != 0) {
+		die("udp send: %s", nng_strerror(rv));
+	}
+	nng_mtx_lock(b->mtx);
+	b->sent++;
+	if ((again = (b->issued < b->count)) != false) {
+		b->issued++;
+	}
+	if (b->sent == b->count) {
+		nng_cv_wake(b->cv);
+	}
+	nng_mtx_unlock(b->mtx);
+	if (again) {
+		nni_plat_udp_send(op->udp, op->aio);
+	}
+}
+
+static void
+udp_recv_cb(void *arg)
+{
+	udp_op *   op = arg;
+	udp_bench *b  = op->bench;
+
+	if (nng_aio_result(op->aio) != 0) {
+		// Closed at the end of the run.
+		return;
+	}
+	nng_mtx_lock(b->mtx);
+	b->recvd++;
+	b->last = perf_usec();
+	if (b->recvd == b->count) {
+		nng_cv_wake(b->cv);
+	}
+	nng_mtx_unlock(b->mtx);
+	nni_plat_udp_recv(op->udp, op->aio);
+}
+
+static void
+udp_ops_init(udp_op *ops, int n, udp_bench *b, nni_plat_udp *udp,
+    char *buf, size_t size, nng_sockaddr *sa, void (*cb)(void *))
+{
+	for (int i = 0; i < n; i++) {
+		udp_op *op = &ops[i];
+		int     rv;
+
+		op->bench       = b;
+		op->udp         = udp;
+		op->iov.iov_buf = buf + i * size;
+		op->iov.iov_len = size;
+		if (sa != NULL) {
+			op->sa = *sa;
+		}
+		if (((rv = nng_aio_alloc(&op->aio, cb, op)) != 0) ||
+		    ((rv = nng_aio_set_iov(op->aio, 1, &op->iov)) != 0)) {
+			die("nng_aio_alloc: %s", nng_strerror(rv));
+		}
+		nng_aio_set_input(op->aio, 0, &op->sa);
+	}
+}
+
+static void
+udp_run(size_t size, int count, int depth)
+{
+	udp_bench     b;
+	udp_op *      sops;
+	udp_op *      rops;
+	char *        sbuf;
+	char *        rbuf;
+	nni_plat_udp *su;
+	nni_plat_udp *ru;
+	nng_sockaddr  sa;
+	uint64_t      start, end;
+	int           rv;
+
+	memset(&b, 0, sizeof(b));
+	b.count = count;
+	if (((rv = nng_mtx_alloc(&b.mtx)) != 0) ||
+	    ((rv = nng_cv_alloc(&b.cv, b.mtx)) != 0)) {
+		die("nng_mtx_alloc: %s", nng_strerror(rv));
+	}
+	if (((sops = calloc(depth, sizeof(*sops))) == NULL) ||
+	    ((rops = calloc(depth, sizeof(*rops))) == NULL) ||
+	    ((sbuf = calloc(depth, size)) == NULL) ||
+	    ((rbuf = calloc(depth, size)) == NULL)) {
+		die("calloc: %s", nng_strerror(NNG_ENOMEM));
+	}
+
+	// Let the system pick the ports.
+	memset(&sa, 0, sizeof(sa));
+	sa.s_un.s_in.sa_family = NNG_AF_INET;
+	NNI_PUT32((uint8_t *) &sa.s_un.s_in.sa_addr, 0x7f000001);
+	if (((rv = nni_plat_udp_open(&su, &sa)) != 0) ||
+	    ((rv = nni_plat_udp_open(&ru, &sa)) != 0) ||
+	    ((rv = nni_plat_udp_sockname(ru, &sa)) != 0)) {
+		die("nni_plat_udp_open: %s", nng_strerror(rv));
+	}
+	udp_ops_init(sops, depth, &b, su, sbuf, size, &sa, udp_send_cb);
+	udp_ops_init(rops, depth, &b, ru, rbuf, size, NULL, udp_recv_cb);
+
+	for (int i = 0; i < depth; i++) {
+		nni_plat_udp_recv(ru, rops[i].aio);
+	}
+
+	start = perf_usec();
+	nng_mtx_lock(b.mtx);
+	for (int i = 0; (i < depth) && (b.issued < count); i++) {
+		b.issued++;
+		nni_plat_udp_send(su, sops[i].aio);
+	}
+	while (b.sent < count) {
+		nng_cv_wait(b.cv);
+	}
+	end = perf_usec();
+	// Give any stragglers a moment to arrive.
+	while (b.recvd < count) {
+		if (nng_cv_until(b.cv, nng_clock() + 100) == NNG_ETIMEDOUT) {
+			break;
+		}
+	}
+	if (b.last > end) {
+		end = b.last;
+	}
+	nng_mtx_unlock(b.mtx);
+
+	nni_plat_udp_close(su);
+	nni_plat_udp_close(ru);
+	for (int i = 0; i < depth; i++) {
+		nng_aio_free(sops[i].aio);
+		nng_aio_free(rops[i].aio);
+	}
+	free(rbuf);
+	free(sbuf);
+	free(rops);
+	free(sops);
+	nng_cv_free(b.cv);
+	nng_mtx_free(b.mtx);
+
+	if (end == start) {
+		end++;
+	}
+	printf("size: %zu  depth: %2d  sent: %.0f [msgs/s]  "
+	       "received: %d (%.1f%%)  %.3f [Mb/s]\n",
+	    size, depth, (double) count * 1000000 / (end - start), b.recvd,
+	    (double) b.recvd * 100 / count,
+	    (double) b.recvd * size * 8 / (end - start));
+}
+
+void
+do_udp_thr(int argc, char **argv)
+{
+	size_t size;
+	int    count;
+	int    rv;
+
+	if (argc != 2) {
+		die("Usage: udp_thr <msg-size> <count>");
+	}
+	size  = parse_int(argv[0], "message size");
+	count = parse_int(argv[1], "count");
+	if ((rv = nni_init()) != 0) {
+		die("nni_init: %s", nng_strerror(rv));
+	}
+	for (int depth = 1; depth <= 64; depth *= 4) {
+		udp_run(size, count, depth);
+	}
+}
+
+// The device benchmark measures the throughput of a broker: messages are
+// sent to one side of a device (between two raw sockets), and received
+// from the other, with different numbers of messages allowed in flight
+// (NNG_OPT_DEVICE_WINDOW) through the device.
+
+struct device_args {
+	nng_socket s1;
+	nng_socket s2;
+};
+
+static void
+device_thr_dev(void *arg)
+{
+	struct device_args *da = arg;
+
+	// This returns once the sockets are closed.
+	(void) nng_device(da->s1, da->s2);
+}
+
+static void
+device_thr_run(const char *in, const char *out, int window, size_t msgsize,
+    int count)
+{
+	struct device_args da;
+	struct inproc_args ia;
+	nng_thread *       dthr;
+	nng_thread *       sthr;
+	nng_socket         s;
+	nng_msg *          msg;
+	uint64_t           start, end;
+	int                rv;
+
+	if (((rv = nng_pair_open(&da.s1)) != 0) ||
+	    ((rv = nng_pair_open(&da.s2)) != 0) ||
+	    ((rv = nng_setopt_int(da.s1, NNG_OPT_RAW, 1)) != 0) ||
+	    ((rv = nng_setopt_int(da.s2, NNG_OPT_RAW, 1)) != 0) ||
+	    ((rv = nng_setopt_int(da.s1, NNG_OPT_DEVICE_WINDOW, window)) !=
+	        0) ||
+	    ((rv = nng_setopt_int(da.s2, NNG_OPT_DEVICE_WINDOW, window)) !=
+	        0)) {
+		die("nng_socket: %s", nng_strerror(rv));
+	}
+	if (((rv = nng_listen(da.s1, in, NULL, 0)) != 0) ||
+	    ((rv = nng_listen(da.s2, out, NULL, 0)) != 0)) {
+		die("nng_listen: %s", nng_strerror(rv));
+	}
+	if ((rv = nng_thread_create(&dthr, device_thr_dev, &da)) != 0) {
+		die("Cannot create thread: %s", nng_strerror(rv));
+	}
+
+	if (((rv = nng_pair_open(&s)) != 0) ||
+	    ((rv = nng_setopt_int(s, NNG_OPT_RECVBUF, 128)) != 0)) {
+		die("nng_socket: %s", nng_strerror(rv));
+	}
+	if ((rv = nng_dial(s, out, NULL, 0)) != 0) {
+		die("nng_dial: %s", nng_strerror(rv));
+	}
+
+	ia.addr    = in;
+	ia.msgsize = (int) msgsize;
+	ia.count   = count;
+	ia.func    = throughput_client;
+	if ((rv = nng_thread_create(&sthr, do_inproc, &ia)) != 0) {
+		die("Cannot create thread: %s", nng_strerror(rv));
+	}
+
+	// Receive first synchronization message.
+	if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
+		die("nng_recvmsg: %s", nng_strerror(rv));
+	}
+	nng_msg_free(msg);
+	start = perf_usec();
+	for (int i = 0; i < count; i++) {
+		if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
+			die("nng_recvmsg: %s", nng_strerror(rv));
+		}
+		nng_msg_free(msg);
+	}
+	end = perf_usec();
+
+	nng_thread_destroy(sthr);
+	nng_close(s);
+	nng_close(da.s1);
+	nng_close(da.s2);
+	nng_thread_destroy(dthr);
+
+	if (end == start) {
+		end++;
+	}
+	printf("%s  window: %2d  %.0f [msgs/s]  %.3f [Mb/s]\n", in, window,
+	    (double) count * 1000000 / (end - start),
+	    (double) count * msgsize * 8 / (end - start));
+}
+
+void
+do_device_thr(int argc, char **argv)
+{
+	static const char *addrs[][2] = {
+		{ "inproc://device_in", "inproc://device_out" },
+		{ "tcp://127.0.0.1:13582", "tcp://127.0.0.1:13583" },
+	};
+	size_t msgsize;
+	int    count;
+
+	if (argc != 2) {
+		die("Usage: device_thr <msg-size> <count>");
+	}
+	msgsize = parse_int(argv[0], "message size");
+	count   = parse_int(argv[1], "count");
+
+	for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); i++) {
+		for (int window = 1; window <= 64; window *= 8) {
+			device_thr_run(
+			    addrs[i][0], addrs[i][1], window, msgsize, count);
+		}
+	}
+}
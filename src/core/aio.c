@@ -11,12 +11,24 @@
 #include "core/nng_impl.h"
 #include <string.h>
 
-static nni_mtx nni_aio_lk;
-// These are used for expiration.
-static nni_cv   nni_aio_expire_cv;
-static int      nni_aio_expire_run;
-static nni_thr  nni_aio_expire_thr;
-static nni_list nni_aio_expire_aios;
+// Expiration is sharded across several queues, each with its own lock,
+// thread, and timing wheel.  Each aio is assigned to one queue for its
+// whole life, and the queue's lock also protects the aio's flags.
+typedef struct nni_aio_expire_q {
+	nni_mtx   eq_mtx;
+	nni_cv    eq_cv;
+	nni_wheel eq_wheel;
+	nni_time  eq_next; // when the expire thread will next wake
+	nni_thr   eq_thr;
+	bool      eq_run;
+} nni_aio_expire_q;
+
+// Expiration threads are mostly idle, so there is no point in having
+// more of them than this, however many processors there are.
+#define NNI_AIO_MAX_EXPIRE_QS 64
+
+static nni_aio_expire_q *nni_aio_expire_qs;
+static int               nni_aio_expire_nqs;
 
 // Design notes.
 //
@@ -32,9 +44,10 @@ static nni_list nni_aio_expire_aios;
 // free to examine the aio for list membership, etc.  The provider must
 // not call finish more than once though.
 //
-// A single lock, nni_aio_lk, is used to protect the flags on the AIO,
-// as well as the expire list on the AIOs.  We will not permit an AIO
-// to be marked done if an expiration is outstanding.
+// The lock of the aio's expire queue (a_expq) is used to protect the
+// flags on the AIO, as well as the expire wheel holding the AIO.  We
+// will not permit an AIO to be marked done if an expiration is
+// outstanding.
 //
 // In order to synchronize with the expiration, we set a flag when we
 // are going to cancel due to expiration, and then let the expiration
@@ -99,8 +112,9 @@ struct nng_aio {
 	nni_list_node    a_prov_node;
 	void *           a_prov_extra[4]; // Extra data used by provider
 
-	// Expire node.
-	nni_list_node a_expire_node;
+	// Expiration.
+	nni_aio_expire_q *a_expq;
+	nni_wheel_node    a_expire_node;
 };
 
 static void nni_aio_expire_add(nni_aio *);
@@ -114,7 +128,12 @@ nni_aio_init(nni_aio **aiop, nni_cb cb, void *arg)
 		return (NNG_ENOMEM);
 	}
 	memset(aio, 0, sizeof(*aio));
-	nni_cv_init(&aio->a_cv, &nni_aio_lk);
+
+	// Spread the aios over the expire queues.  Allocations are
+	// distinct, and at least this far apart, so this is a fair spread.
+	aio->a_expq = &nni_aio_expire_qs[((uintptr_t) aio / sizeof(*aio)) %
+	    (uintptr_t) nni_aio_expire_nqs];
+	nni_cv_init(&aio->a_cv, &aio->a_expq->eq_mtx);
 	aio->a_expire    = NNI_TIME_NEVER;
 	aio->a_timeout   = NNG_DURATION_INFINITE;
 	aio->a_iov       = aio->a_iovinl;
@@ -187,9 +206,9 @@ void
 nni_aio_stop(nni_aio *aio)
 {
 	if (aio != NULL) {
-		nni_mtx_lock(&nni_aio_lk);
+		nni_mtx_lock(&aio->a_expq->eq_mtx);
 		aio->a_fini = 1;
-		nni_mtx_unlock(&nni_aio_lk);
+		nni_mtx_unlock(&aio->a_expq->eq_mtx);
 
 		nni_aio_abort(aio, NNG_ECANCELED);
 
@@ -287,38 +306,55 @@ nni_aio_set_synch(nni_aio *aio)
 void
 nni_aio_wait(nni_aio *aio)
 {
-	nni_mtx_lock(&nni_aio_lk);
+	nni_mtx_lock(&aio->a_expq->eq_mtx);
 	// Wait until we're done, and the synchronous completion flag
 	// is cleared (meaning any synch completion is finished).
 	while ((aio->a_active) && ((!aio->a_done) || (aio->a_synch))) {
 		aio->a_waiting = 1;
 		nni_cv_wait(&aio->a_cv);
 	}
-	nni_mtx_unlock(&nni_aio_lk);
+	nni_mtx_unlock(&aio->a_expq->eq_mtx);
 	nni_task_wait(&aio->a_task);
 }
 
-int
-nni_aio_start(nni_aio *aio, nni_aio_cancelfn cancelfn, void *data)
+static int
+nni_aio_begin_locked(nni_aio *aio)
 {
-	nni_mtx_lock(&nni_aio_lk);
 	if (aio->a_fini) {
 		// We should not reschedule anything at this point.
 		aio->a_active = 0;
 		aio->a_result = NNG_ECANCELED;
-		nni_mtx_unlock(&nni_aio_lk);
 		return (NNG_ECANCELED);
 	}
 	aio->a_done        = 0;
 	aio->a_pend        = 0;
 	aio->a_result      = 0;
 	aio->a_count       = 0;
-	aio->a_prov_cancel = cancelfn;
-	aio->a_prov_data   = data;
+	aio->a_prov_cancel = NULL;
+	aio->a_prov_data   = NULL;
 	aio->a_active      = 1;
 	for (unsigned i = 0; i < NNI_NUM_ELEMENTS(aio->a_outputs); i++) {
 		aio->a_outputs[i] = NULL;
 	}
+	return (0);
+}
+
+static int
+nni_aio_schedule_locked(nni_aio *aio, nni_aio_cancelfn cancelfn, void *data)
+{
+	if (aio->a_fini) {
+		// Stopped since nni_aio_begin; there was nothing for
+		// nni_aio_stop to cancel, so it may be waiting on us.
+		aio->a_active = 0;
+		aio->a_result = NNG_ECANCELED;
+		if (aio->a_waiting) {
+			aio->a_waiting = 0;
+			nni_cv_wake(&aio->a_cv);
+		}
+		return (NNG_ECANCELED);
+	}
+	aio->a_prov_cancel = cancelfn;
+	aio->a_prov_data   = data;
 
 	// Convert the relative timeout to an absolute timeout.
 	if (aio->a_sleep) {
@@ -340,10 +376,44 @@ nni_aio_start(nni_aio *aio, nni_aio_cancelfn cancelfn, void *data)
 			break;
 		}
 	}
-	nni_mtx_unlock(&nni_aio_lk);
 	return (0);
 }
 
+int
+nni_aio_begin(nni_aio *aio)
+{
+	int rv;
+
+	nni_mtx_lock(&aio->a_expq->eq_mtx);
+	rv = nni_aio_begin_locked(aio);
+	nni_mtx_unlock(&aio->a_expq->eq_mtx);
+	return (rv);
+}
+
+int
+nni_aio_schedule(nni_aio *aio, nni_aio_cancelfn cancelfn, void *data)
+{
+	int rv;
+
+	nni_mtx_lock(&aio->a_expq->eq_mtx);
+	rv = nni_aio_schedule_locked(aio, cancelfn, data);
+	nni_mtx_unlock(&aio->a_expq->eq_mtx);
+	return (rv);
+}
+
+int
+nni_aio_start(nni_aio *aio, nni_aio_cancelfn cancelfn, void *data)
+{
+	int rv;
+
+	nni_mtx_lock(&aio->a_expq->eq_mtx);
+	if ((rv = nni_aio_begin_locked(aio)) == 0) {
+		rv = nni_aio_schedule_locked(aio, cancelfn, data);
+	}
+	nni_mtx_unlock(&aio->a_expq->eq_mtx);
+	return (rv);
+}
+
 // nni_aio_abort is called by a consumer which guarantees that the aio
 // is still valid.
 void
@@ -351,9 +421,9 @@ nni_aio_abort(nni_aio *aio, int rv)
 {
 	nni_aio_cancelfn cancelfn;
 
-	nni_mtx_lock(&nni_aio_lk);
+	nni_mtx_lock(&aio->a_expq->eq_mtx);
 	cancelfn = aio->a_prov_cancel;
-	nni_mtx_unlock(&nni_aio_lk);
+	nni_mtx_unlock(&aio->a_expq->eq_mtx);
 
 	// Stop any I/O at the provider level.
 	if (cancelfn != NULL) {
@@ -366,11 +436,11 @@ nni_aio_abort(nni_aio *aio, int rv)
 static void
 nni_aio_finish_impl(nni_aio *aio, int rv, size_t count, nni_msg *msg)
 {
-	nni_mtx_lock(&nni_aio_lk);
+	nni_mtx_lock(&aio->a_expq->eq_mtx);
 
 	NNI_ASSERT(aio->a_pend == 0); // provider only calls us *once*
 
-	nni_list_node_remove(&aio->a_expire_node);
+	nni_wheel_remove(&aio->a_expq->eq_wheel, aio);
 
 	aio->a_pend        = 1;
 	aio->a_result      = rv;
@@ -394,7 +464,7 @@ nni_aio_finish_impl(nni_aio *aio, int rv, size_t count, nni_msg *msg)
 		}
 		nni_task_dispatch(&aio->a_task);
 	}
-	nni_mtx_unlock(&nni_aio_lk);
+	nni_mtx_unlock(&aio->a_expq->eq_mtx);
 }
 
 void
@@ -451,62 +521,48 @@ nni_aio_list_active(nni_aio *aio)
 static void
 nni_aio_expire_add(nni_aio *aio)
 {
-	nni_list *list = &nni_aio_expire_aios;
-	nni_aio * naio;
+	nni_aio_expire_q *eq = aio->a_expq;
 
-	// This is a reverse walk of the list.  We're more likely to find
-	// a match at the end of the list.
-	for (naio = nni_list_last(list); naio != NULL;
-	     naio = nni_list_prev(list, naio)) {
-		if (aio->a_expire >= naio->a_expire) {
-			nni_list_insert_after(list, aio, naio);
-			break;
-		}
-	}
-	if (naio == NULL) {
-		// This has the shortest time, so insert at the start.
-		nni_list_prepend(list, aio);
-		// And, as we are the latest, kick the thing.
-		nni_cv_wake(&nni_aio_expire_cv);
+	nni_wheel_add(&eq->eq_wheel, aio, aio->a_expire);
+	if (aio->a_expire < eq->eq_next) {
+		// We are due before the thread would otherwise wake.
+		nni_cv_wake(&eq->eq_cv);
 	}
 }
 
 static void
 nni_aio_expire_loop(void *arg)
 {
-	nni_list *       aios = &nni_aio_expire_aios;
-	nni_aio *        aio;
-	nni_time         now;
-	nni_aio_cancelfn cancelfn;
-	int              rv;
-
-	NNI_ARG_UNUSED(arg);
+	nni_aio_expire_q *eq = arg;
+	nni_aio *         aio;
+	nni_aio_cancelfn  cancelfn;
+	int               rv;
 
 	for (;;) {
-		nni_mtx_lock(&nni_aio_lk);
+		nni_mtx_lock(&eq->eq_mtx);
 
-		if (nni_aio_expire_run == 0) {
-			nni_mtx_unlock(&nni_aio_lk);
+		if (!eq->eq_run) {
+			nni_mtx_unlock(&eq->eq_mtx);
 			return;
 		}
 
-		if ((aio = nni_list_first(aios)) == NULL) {
-			nni_cv_wait(&nni_aio_expire_cv);
-			nni_mtx_unlock(&nni_aio_lk);
-			continue;
-		}
-
-		now = nni_clock();
-		if (now < aio->a_expire) {
-			// Unexpired; the list is ordered, so we just wait.
-			nni_cv_until(&nni_aio_expire_cv, aio->a_expire);
-			nni_mtx_unlock(&nni_aio_lk);
+		if ((aio = nni_wheel_expire(&eq->eq_wheel, nni_clock())) ==
+		    NULL) {
+			// Nothing has expired; wait until the wheel needs
+			// attention, or something sooner is added.
+			eq->eq_next = nni_wheel_next(&eq->eq_wheel);
+			if (eq->eq_next == NNI_TIME_NEVER) {
+				nni_cv_wait(&eq->eq_cv);
+			} else {
+				(void) nni_cv_until(&eq->eq_cv, eq->eq_next);
+			}
+			eq->eq_next = NNI_TIME_NEVER;
+			nni_mtx_unlock(&eq->eq_mtx);
 			continue;
 		}
 
 		// This aio's time has come.  Expire it, canceling any
 		// outstanding I/O.
-		nni_list_remove(aios, aio);
 
 		// Mark it as expiring.  This acts as a hold on
 		// the aio, similar to the consumers.  The actual taskq
@@ -521,9 +577,9 @@ nni_aio_expire_loop(void *arg)
 		// for a valid aio, and becomes NULL only when an AIO is
 		// already being canceled or finished.
 		if (cancelfn != NULL) {
-			nni_mtx_unlock(&nni_aio_lk);
+			nni_mtx_unlock(&eq->eq_mtx);
 			cancelfn(aio, rv);
-			nni_mtx_lock(&nni_aio_lk);
+			nni_mtx_lock(&eq->eq_mtx);
 		} else {
 			aio->a_pend   = 1;
 			aio->a_result = rv;
@@ -536,16 +592,16 @@ nni_aio_expire_loop(void *arg)
 		if (!aio->a_synch) {
 			nni_task_dispatch(&aio->a_task);
 		} else {
-			nni_mtx_unlock(&nni_aio_lk);
+			nni_mtx_unlock(&eq->eq_mtx);
 			aio->a_task.task_cb(aio->a_task.task_arg);
-			nni_mtx_lock(&nni_aio_lk);
+			nni_mtx_lock(&eq->eq_mtx);
 			aio->a_synch = 0;
 		}
 		if (aio->a_waiting) {
 			aio->a_waiting = 0;
 			nni_cv_wake(&aio->a_cv);
 		}
-		nni_mtx_unlock(&nni_aio_lk);
+		nni_mtx_unlock(&eq->eq_mtx);
 	}
 }
 
@@ -649,40 +705,65 @@ nni_sleep_aio(nng_duration ms, nng_aio *aio)
 void
 nni_aio_sys_fini(void)
 {
-	nni_mtx *mtx = &nni_aio_lk;
-	nni_cv * cv  = &nni_aio_expire_cv;
-	nni_thr *thr = &nni_aio_expire_thr;
+	int nqs = nni_aio_expire_nqs;
 
-	if (nni_aio_expire_run) {
-		nni_mtx_lock(mtx);
-		nni_aio_expire_run = 0;
-		nni_cv_wake(cv);
-		nni_mtx_unlock(mtx);
+	if (nni_aio_expire_qs == NULL) {
+		return;
 	}
-
-	nni_thr_fini(thr);
-	nni_cv_fini(cv);
-	nni_mtx_fini(mtx);
+	for (int i = 0; i < nqs; i++) {
+		nni_aio_expire_q *eq = &nni_aio_expire_qs[i];
+
+		if (eq->eq_run) {
+			nni_mtx_lock(&eq->eq_mtx);
+			eq->eq_run = false;
+			nni_cv_wake(&eq->eq_cv);
+			nni_mtx_unlock(&eq->eq_mtx);
+		}
+		nni_thr_fini(&eq->eq_thr);
+		nni_cv_fini(&eq->eq_cv);
+		nni_mtx_fini(&eq->eq_mtx);
+	}
+	NNI_FREE_STRUCTS(nni_aio_expire_qs, nqs);
+	nni_aio_expire_qs  = NULL;
+	nni_aio_expire_nqs = 0;
 }
 
 int
 nni_aio_sys_init(void)
 {
-	int      rv;
-	nni_mtx *mtx = &nni_aio_lk;
-	nni_cv * cv  = &nni_aio_expire_cv;
-	nni_thr *thr = &nni_aio_expire_thr;
+	int rv;
+	int nqs;
 
-	NNI_LIST_INIT(&nni_aio_expire_aios, nni_aio, a_expire_node);
-	nni_mtx_init(mtx);
-	nni_cv_init(cv, mtx);
-
-	if ((rv = nni_thr_init(thr, nni_aio_expire_loop, NULL)) != 0) {
-		nni_aio_sys_fini();
-		return (rv);
+	if ((nqs = nni_plat_ncpu()) > NNI_AIO_MAX_EXPIRE_QS) {
+		nqs = NNI_AIO_MAX_EXPIRE_QS;
+	}
+	if ((nni_aio_expire_qs = NNI_ALLOC_STRUCTS(nni_aio_expire_qs, nqs)) ==
+	    NULL) {
+		return (NNG_ENOMEM);
 	}
+	nni_aio_expire_nqs = nqs;
+
+	// Set up all the queues first, so that a failure part way
+	// through leaves everything in a state fini can clean up.
+	for (int i = 0; i < nqs; i++) {
+		nni_aio_expire_q *eq = &nni_aio_expire_qs[i];
+
+		nni_mtx_init(&eq->eq_mtx);
+		nni_cv_init(&eq->eq_cv, &eq->eq_mtx);
+		NNI_WHEEL_INIT(
+		    &eq->eq_wheel, nni_aio, a_expire_node, nni_clock());
+		eq->eq_next = NNI_TIME_NEVER;
+	}
+	for (int i = 0; i < nqs; i++) {
+		nni_aio_expire_q *eq = &nni_aio_expire_qs[i];
 
-	nni_aio_expire_run = 1;
-	nni_thr_run(thr);
+		if ((rv = nni_thr_init(&eq->eq_thr, nni_aio_expire_loop, eq)) !=
+		    0) {
+			nni_aio_sys_fini();
+			return (rv);
+		}
+		eq->eq_run = true;
+		nni_thr_run(&eq->eq_thr);
+	}
 	return (0);
 }
@@ -136,6 +136,17 @@ extern void *nni_aio_get_prov_data(nni_aio *);
 extern void  nni_aio_set_prov_data(nni_aio *, void *);
 extern void *nni_aio_get_prov_extra(nni_aio *, unsigned);
 extern void  nni_aio_set_prov_extra(nni_aio *, unsigned, void *);
+
+// nni_aio_begin and nni_aio_schedule split nni_aio_start in two, for
+// providers that can often complete an operation at once.  nni_aio_begin
+// prepares the aio, but arranges for no cancellation or timeout; if the
+// provider completes the operation immediately, that is all it needs.
+// Otherwise it must call nni_aio_schedule (which can fail just as
+// nni_aio_start can) before it waits.  Both return NNG_ECANCELED if the
+// aio has been stopped, in which case the provider must not finish it.
+extern int nni_aio_begin(nni_aio *);
+extern int nni_aio_schedule(nni_aio *, nni_aio_cancelfn, void *);
+
 // nni_aio_advance_iov moves up the iov, reflecting that some I/O as
 // been performed.  It returns the amount of data remaining in the argument;
 // i.e. if the count refers to more data than the iov can support, then
@@ -41,8 +41,10 @@ typedef struct nng_aio      nni_aio;
 
 // These are our own names.
 typedef struct nni_socket           nni_sock;
+typedef struct nni_ctx              nni_ctx;
 typedef struct nni_ep               nni_ep;
 typedef struct nni_pipe             nni_pipe;
+typedef struct nni_pipe_sender      nni_pipe_sender;
 typedef struct nni_tran             nni_tran;
 typedef struct nni_tran_ep          nni_tran_ep;
 typedef struct nni_tran_ep_option   nni_tran_ep_option;
@@ -52,12 +54,15 @@ typedef struct nni_tran_pipe_option nni_tran_pipe_option;
 typedef struct nni_proto_sock_ops    nni_proto_sock_ops;
 typedef struct nni_proto_pipe_ops    nni_proto_pipe_ops;
 typedef struct nni_proto_sock_option nni_proto_sock_option;
+typedef struct nni_proto_ctx_ops     nni_proto_ctx_ops;
+typedef struct nni_proto_ctx_option  nni_proto_ctx_option;
 typedef struct nni_proto             nni_proto;
 
 typedef struct nni_plat_mtx nni_mtx;
 typedef struct nni_plat_cv  nni_cv;
 typedef struct nni_idhash   nni_idhash;
 typedef struct nni_thr      nni_thr;
+typedef struct nni_tlocal   nni_tlocal;
 typedef void (*nni_thr_func)(void *);
 
 typedef int      nni_signal;   // Wakeup channel.
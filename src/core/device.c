@@ -12,18 +12,50 @@
 
 #include <string.h>
 
-typedef struct nni_device_path {
-	nni_aio * user; // user aio
-	nni_aio * aio;
-	nni_sock *src;
-	nni_sock *dst;
-	int       state;
-} nni_device_path;
+// Each path (direction) keeps a window of forwarders, each of which
+// loops receiving a message from the source and sending it on to the
+// destination.  Having several of them means that a message can be
+// received while others are still being sent, rather than paying for a
+// full round trip through the task queue for each message.
+//
+// To avoid reordering, messages are sent in the order they were received.
+// Receives are posted in order (under the path lock), and the socket
+// completes them in that order, so each forwarder is given a sequence
+// number when its receive is posted; a forwarder that has its message
+// waits (in the ready state) until all those before it have been sent.
+
+typedef struct nni_device_path nni_device_path;
+
+typedef struct nni_device_fwd {
+	nni_device_path *path;
+	nni_aio *        aio;
+	int              state;
+	uint64_t         seq; // order of the receive
+	size_t           len; // bytes being sent
+} nni_device_fwd;
 
 #define NNI_DEVICE_STATE_INIT 0
 #define NNI_DEVICE_STATE_RECV 1
-#define NNI_DEVICE_STATE_SEND 2
-#define NNI_DEVICE_STATE_FINI 3
+#define NNI_DEVICE_STATE_READY 2
+#define NNI_DEVICE_STATE_SEND 3
+
+struct nni_device_path {
+	nni_mtx          mtx;
+	nni_aio *        user; // user aio
+	nni_sock *       src;
+	nni_sock *       dst;
+	nni_device_fwd * fwds;
+	nni_device_fwd **ring; // by sequence number, modulo nfwd
+	int              nfwd;
+	uint64_t         recv_seq; // next receive to post
+	uint64_t         send_seq; // next message to send
+	bool             stopped;
+
+	nni_stat_item stats;
+	nni_stat_item fwd_msgs;
+	nni_stat_item fwd_bytes;
+	nni_stat_item drops;
+};
 
 typedef struct nni_device_data {
 	nni_aio *       user;
@@ -54,33 +86,170 @@ nni_device_cancel(nni_aio *aio, int rv)
 	nni_aio_finish_error(dd->user, rv);
 }
 
+static void
+nni_device_free_msg(nni_aio *aio)
+{
+	nni_msg *msg;
+
+	if ((msg = nni_aio_get_msg(aio)) != NULL) {
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(msg);
+	}
+}
+
+// nni_device_recv posts a receive.  The path lock must be held.
+static void
+nni_device_recv(nni_device_path *p, nni_device_fwd *f)
+{
+	f->state                   = NNI_DEVICE_STATE_RECV;
+	f->seq                     = p->recv_seq++;
+	p->ring[f->seq % p->nfwd] = f;
+	nni_sock_recv(p->src, f->aio);
+}
+
+// nni_device_send sends any messages that are next in line.  The path
+// lock must be held.
+static void
+nni_device_send(nni_device_path *p)
+{
+	nni_device_fwd *f;
+
+	while (p->send_seq != p->recv_seq) {
+		f = p->ring[p->send_seq % p->nfwd];
+		if (f->state != NNI_DEVICE_STATE_READY) {
+			break;
+		}
+		// Leave the message where it is.
+		f->state = NNI_DEVICE_STATE_SEND;
+		f->len   = nni_msg_len(nni_aio_get_msg(f->aio)) +
+		    nni_msg_header_len(nni_aio_get_msg(f->aio));
+		p->send_seq++;
+		nni_sock_send(p->dst, f->aio);
+	}
+}
+
 static void
 nni_device_cb(void *arg)
 {
-	nni_device_path *p   = arg;
-	nni_aio *        aio = p->aio;
+	nni_device_fwd * f   = arg;
+	nni_device_path *p   = f->path;
+	nni_aio *        aio = f->aio;
 	int              rv;
 
-	if ((rv = nni_aio_result(aio)) != 0) {
-		p->state = NNI_DEVICE_STATE_FINI;
-		nni_aio_abort(p->user, rv);
+	nni_mtx_lock(&p->mtx);
+	rv = nni_aio_result(aio);
+	if (p->stopped) {
+		nni_device_free_msg(aio);
+		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
-	switch (p->state) {
-	case NNI_DEVICE_STATE_INIT:
-	case NNI_DEVICE_STATE_SEND:
-		p->state = NNI_DEVICE_STATE_RECV;
-		nni_sock_recv(p->src, aio);
-		break;
+	switch (f->state) {
 	case NNI_DEVICE_STATE_RECV:
-		// Leave the message where it is.
-		p->state = NNI_DEVICE_STATE_SEND;
-		nni_sock_send(p->dst, aio);
-		break;
-	case NNI_DEVICE_STATE_FINI:
+		if (rv != 0) {
+			break;
+		}
+		f->state = NNI_DEVICE_STATE_READY;
+		nni_device_send(p);
+		nni_mtx_unlock(&p->mtx);
+		return;
+
+	case NNI_DEVICE_STATE_SEND:
+		if (rv == 0) {
+			nni_stat_inc(&p->fwd_msgs, 1);
+			nni_stat_inc(&p->fwd_bytes, f->len);
+		} else {
+			// The message is still ours.
+			nni_device_free_msg(aio);
+			nni_stat_inc(&p->drops, 1);
+			if ((rv == NNG_ECLOSED) || (rv == NNG_ECANCELED)) {
+				break;
+			}
+			// Otherwise the destination refused this message,
+			// but may yet take others.
+		}
+		nni_device_recv(p, f);
+		nni_mtx_unlock(&p->mtx);
+		return;
+
+	default:
 		break;
 	}
+
+	p->stopped = true;
+	nni_mtx_unlock(&p->mtx);
+	nni_aio_abort(p->user, rv);
+}
+
+static void
+nni_device_path_fini(nni_device_path *p)
+{
+	if (p->fwds == NULL) {
+		return;
+	}
+	for (int i = 0; i < p->nfwd; i++) {
+		nni_aio_stop(p->fwds[i].aio);
+	}
+	for (int i = 0; i < p->nfwd; i++) {
+		if (p->fwds[i].aio != NULL) {
+			nni_device_free_msg(p->fwds[i].aio);
+			nni_aio_fini(p->fwds[i].aio);
+		}
+	}
+	nni_stat_remove(&p->stats);
+	NNI_FREE_STRUCTS(p->ring, p->nfwd);
+	NNI_FREE_STRUCTS(p->fwds, p->nfwd);
+	nni_mtx_fini(&p->mtx);
+}
+
+static int
+nni_device_path_init(nni_device_path *p, nni_sock *src, nni_sock *dst)
+{
+	int    nfwd;
+	size_t sz = sizeof(nfwd);
+	int    rv;
+
+	// The window belongs to the receiving side.
+	if ((rv = nni_sock_getopt(src, NNG_OPT_DEVICE_WINDOW, &nfwd, &sz)) !=
+	    0) {
+		return (rv);
+	}
+	nni_mtx_init(&p->mtx);
+	p->src  = src;
+	p->dst  = dst;
+	p->nfwd = nfwd;
+	if (((p->fwds = NNI_ALLOC_STRUCTS(p->fwds, nfwd)) == NULL) ||
+	    ((p->ring = NNI_ALLOC_STRUCTS(p->ring, nfwd)) == NULL)) {
+		NNI_FREE_STRUCTS(p->fwds, nfwd);
+		p->fwds = NULL;
+		nni_mtx_fini(&p->mtx);
+		return (NNG_ENOMEM);
+	}
+
+	nni_stat_init_group(&p->stats, "device");
+	nni_stat_init(&p->fwd_msgs, "fwd_msgs", "messages forwarded",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_init(&p->fwd_bytes, "fwd_bytes", "bytes forwarded",
+	    NNG_STAT_COUNTER, NNG_UNIT_BYTES);
+	nni_stat_init(&p->drops, "drops", "messages not forwarded",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_append(&p->stats, &p->fwd_msgs);
+	nni_stat_append(&p->stats, &p->fwd_bytes);
+	nni_stat_append(&p->stats, &p->drops);
+	nni_sock_stats_append(src, &p->stats);
+
+	for (int i = 0; i < nfwd; i++) {
+		nni_device_fwd *f = &p->fwds[i];
+
+		f->path  = p;
+		f->state = NNI_DEVICE_STATE_INIT;
+		if ((rv = nni_aio_init(&f->aio, nni_device_cb, f)) != 0) {
+			nni_device_path_fini(p);
+			return (rv);
+		}
+		nni_aio_set_timeout(f->aio, NNG_DURATION_INFINITE);
+	}
+	return (0);
 }
 
 void
@@ -88,12 +257,7 @@ nni_device_fini(nni_device_data *dd)
 {
 	int i;
 	for (i = 0; i < dd->npath; i++) {
-		nni_device_path *p = &dd->paths[i];
-		nni_aio_stop(p->aio);
-	}
-	for (i = 0; i < dd->npath; i++) {
-		nni_device_path *p = &dd->paths[i];
-		nni_aio_fini(p->aio);
+		nni_device_path_fini(&dd->paths[i]);
 	}
 	nni_mtx_fini(&dd->mtx);
 	NNI_FREE_STRUCT(dd);
@@ -148,21 +312,18 @@ nni_device_init(nni_device_data **dp, nni_sock *s1, nni_sock *s2)
 	nni_mtx_init(&dd->mtx);
 
 	for (i = 0; i < npath; i++) {
-		int              rv;
-		nni_device_path *p = &dd->paths[i];
-		p->src             = i == 0 ? s1 : s2;
-		p->dst             = i == 0 ? s2 : s1;
-		p->state           = NNI_DEVICE_STATE_INIT;
+		int rv;
 
-		if ((rv = nni_aio_init(&p->aio, nni_device_cb, p)) != 0) {
+		rv = nni_device_path_init(
+		    &dd->paths[i], i == 0 ? s1 : s2, i == 0 ? s2 : s1);
+		if (rv != 0) {
 			nni_device_fini(dd);
 			return (rv);
 		}
-
-		nni_aio_set_timeout(p->aio, NNG_DURATION_INFINITE);
+		// Count it now, so that fini cleans it up.
+		dd->npath = i + 1;
 	}
-	dd->npath = npath;
-	*dp       = dd;
+	*dp = dd;
 	return (0);
 }
 
@@ -179,13 +340,13 @@ nni_device_start(nni_device_data *dd, nni_aio *user)
 	}
 	for (i = 0; i < dd->npath; i++) {
 		nni_device_path *p = &dd->paths[i];
-		p->user            = user;
-		p->state           = NNI_DEVICE_STATE_INIT;
-	}
-	for (i = 0; i < dd->npath; i++) {
-		nni_device_path *p = &dd->paths[i];
-		p->state           = NNI_DEVICE_STATE_RECV;
-		nni_sock_recv(p->src, p->aio);
+
+		nni_mtx_lock(&p->mtx);
+		p->user = user;
+		for (int j = 0; j < p->nfwd; j++) {
+			nni_device_recv(p, &p->fwds[j]);
+		}
+		nni_mtx_unlock(&p->mtx);
 	}
 	dd->running = 1;
 	nni_mtx_unlock(&dd->mtx);
@@ -201,7 +362,7 @@ nni_device(nni_sock *s1, nni_sock *s2)
 	if ((rv = nni_aio_init(&aio, NULL, NULL)) != 0) {
 		return (rv);
 	}
-	if (nni_device_init(&dd, s1, s2) != 0) {
+	if ((rv = nni_device_init(&dd, s1, s2)) != 0) {
 		nni_aio_fini(aio);
 		return (rv);
 	}
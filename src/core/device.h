@@ -16,4 +16,10 @@
 // filtering functions.
 extern int nni_device(nni_sock *, nni_sock *);
 
+// NNI_DEVICE_WINDOW is the default number of messages a device may have
+// in flight in each direction (NNG_OPT_DEVICE_WINDOW), and
+// NNI_DEVICE_MAXWINDOW is the largest permitted.
+#define NNI_DEVICE_WINDOW 8
+#define NNI_DEVICE_MAXWINDOW 256
+
 #endif // CORE_DEVICE_H
@@ -15,30 +15,33 @@
 #include <string.h>
 
 struct nni_ep {
-	nni_tran_ep   ep_ops;  // transport ops
-	nni_tran *    ep_tran; // transport pointer
-	void *        ep_data; // transport private
-	uint64_t      ep_id;   // endpoint id
-	nni_list_node ep_node; // per socket list
-	nni_sock *    ep_sock;
-	nni_url *     ep_url;
-	int           ep_mode;
-	int           ep_started;
-	int           ep_closed;  // full shutdown
-	int           ep_closing; // close pending (waiting on refcnt)
-	int           ep_refcnt;
-	int           ep_tmo_run;
-	nni_mtx       ep_mtx;
-	nni_cv        ep_cv;
-	nni_list      ep_pipes;
-	nni_aio *     ep_acc_aio;
-	nni_aio *     ep_con_aio;
-	nni_aio *     ep_con_syn;  // used for sync connect
-	nni_aio *     ep_tmo_aio;  // backoff timer
-	nni_duration  ep_maxrtime; // maximum time for reconnect
-	nni_duration  ep_currtime; // current time for reconnect
-	nni_duration  ep_inirtime; // initial time for reconnect
-	nni_time      ep_conntime; // time of last good connect
+	nni_tran_ep    ep_ops;  // transport ops
+	nni_tran *     ep_tran; // transport pointer
+	void *         ep_data; // transport private
+	uint64_t       ep_id;   // endpoint id
+	nni_list_node  ep_node; // per socket list
+	nni_sock *     ep_sock;
+	nni_url *      ep_url;
+	int            ep_mode;
+	int            ep_started;
+	int            ep_closed;  // full shutdown
+	int            ep_closing; // close pending (waiting on refcnt)
+	int            ep_refcnt;  // protected by ep_mtx
+	int            ep_tmo_run;
+	nni_mtx        ep_mtx;
+	nni_cv         ep_cv;
+	nni_list       ep_pipes;
+	nni_aio *      ep_acc_aio;
+	nni_aio *      ep_con_aio;
+	nni_aio *      ep_con_syn;  // used for sync connect
+	nni_aio *      ep_tmo_aio;  // backoff timer
+	nni_duration   ep_maxrtime; // maximum time for reconnect
+	nni_duration   ep_currtime; // current time for reconnect
+	nni_duration   ep_inirtime; // initial time for reconnect
+	nni_time       ep_conntime; // time of last good connect
+	nni_stat_item  ep_stats;    // group, named for mode and id
+	nni_stat_item  ep_conns;    // pipes established
+	nni_stat_item  ep_errors;   // failed connect or accept attempts
 };
 
 // Functionality related to end points.
@@ -50,19 +53,17 @@ static void nni_ep_con_cb(void *);
 static void nni_ep_tmo_start(nni_ep *);
 static void nni_ep_tmo_cb(void *);
 
-static nni_idhash *nni_eps;
-static nni_mtx     nni_ep_lk;
+static nni_hdltab *nni_eps;
 
 int
 nni_ep_sys_init(void)
 {
 	int rv;
 
-	if ((rv = nni_idhash_init(&nni_eps)) != 0) {
+	if ((rv = nni_hdltab_init(&nni_eps)) != 0) {
 		return (rv);
 	}
-	nni_mtx_init(&nni_ep_lk);
-	nni_idhash_set_limits(
+	nni_hdltab_set_limits(
 	    nni_eps, 1, 0x7fffffff, nni_random() & 0x7fffffff);
 
 	return (0);
@@ -71,8 +72,7 @@ nni_ep_sys_init(void)
 void
 nni_ep_sys_fini(void)
 {
-	nni_mtx_fini(&nni_ep_lk);
-	nni_idhash_fini(nni_eps);
+	nni_hdltab_fini(nni_eps);
 	nni_eps = NULL;
 }
 
@@ -89,11 +89,13 @@ nni_ep_destroy(nni_ep *ep)
 		return;
 	}
 
-	// Remove us from the table so we cannot be found.
+	// Remove us from the table so we cannot be found.  This also
+	// waits for any lookups that found us to finish with us.
 	if (ep->ep_id != 0) {
-		nni_idhash_remove(nni_eps, ep->ep_id);
+		nni_hdltab_remove(nni_eps, ep->ep_id);
 	}
 
+	nni_stat_remove(&ep->ep_stats);
 	nni_sock_ep_remove(ep->ep_sock, ep);
 
 	nni_aio_stop(ep->ep_acc_aio);
@@ -117,6 +119,42 @@ nni_ep_destroy(nni_ep *ep)
 	NNI_FREE_STRUCT(ep);
 }
 
+static void
+nni_ep_stats_init(nni_ep *ep)
+{
+	char name[NNI_STAT_NAMELEN];
+
+	(void) snprintf(name, sizeof(name), "%s.%u",
+	    ep->ep_mode == NNI_EP_MODE_DIAL ? "dialer" : "listener",
+	    (unsigned) ep->ep_id);
+	nni_stat_init_group(&ep->ep_stats, name);
+	nni_stat_init(&ep->ep_conns,
+	    ep->ep_mode == NNI_EP_MODE_DIAL ? "connects" : "accepts",
+	    "pipes established", NNG_STAT_COUNTER, NNG_UNIT_EVENTS);
+	nni_stat_init(&ep->ep_errors, "errors", "failed attempts",
+	    NNG_STAT_COUNTER, NNG_UNIT_EVENTS);
+	nni_stat_append(&ep->ep_stats, &ep->ep_conns);
+	nni_stat_append(&ep->ep_stats, &ep->ep_errors);
+}
+
+// nni_ep_stat_result accounts for the result of a connect or accept.
+// Cancellation and closure are not failures of the endpoint.
+static void
+nni_ep_stat_result(nni_ep *ep, int rv)
+{
+	switch (rv) {
+	case 0:
+		nni_stat_inc(&ep->ep_conns, 1);
+		break;
+	case NNG_ECLOSED:
+	case NNG_ECANCELED:
+		break;
+	default:
+		nni_stat_inc(&ep->ep_errors, 1);
+		break;
+	}
+}
+
 static int
 nni_ep_create(nni_ep **epp, nni_sock *s, const char *urlstr, int mode)
 {
@@ -141,7 +179,6 @@ nni_ep_create(nni_ep **epp, nni_sock *s, const char *urlstr, int mode)
 	ep->ep_closed  = 0;
 	ep->ep_started = 0;
 	ep->ep_data    = NULL;
-	ep->ep_refcnt  = 1;
 	ep->ep_sock    = s;
 	ep->ep_tran    = tran;
 	ep->ep_mode    = mode;
@@ -155,16 +192,24 @@ nni_ep_create(nni_ep **epp, nni_sock *s, const char *urlstr, int mode)
 
 	nni_pipe_ep_list_init(&ep->ep_pipes);
 
+	ep->ep_refcnt = 1;
 	nni_mtx_init(&ep->ep_mtx);
 	nni_cv_init(&ep->ep_cv, &ep->ep_mtx);
+	nni_stat_init_group(&ep->ep_stats, "ep");
 
 	if (((rv = nni_aio_init(&ep->ep_acc_aio, nni_ep_acc_cb, ep)) != 0) ||
 	    ((rv = nni_aio_init(&ep->ep_con_aio, nni_ep_con_cb, ep)) != 0) ||
 	    ((rv = nni_aio_init(&ep->ep_tmo_aio, nni_ep_tmo_cb, ep)) != 0) ||
 	    ((rv = nni_aio_init(&ep->ep_con_syn, NULL, NULL)) != 0) ||
 	    ((rv = ep->ep_ops.ep_init(&ep->ep_data, url, s, mode)) != 0) ||
-	    ((rv = nni_idhash_alloc(nni_eps, &ep->ep_id, ep)) != 0) ||
-	    ((rv = nni_sock_ep_add(s, ep)) != 0)) {
+	    ((rv = nni_hdltab_alloc(nni_eps, &ep->ep_id, ep)) != 0)) {
+		nni_ep_destroy(ep);
+		return (rv);
+	}
+	nni_ep_stats_init(ep);
+	nni_sock_stats_append(s, &ep->ep_stats);
+
+	if ((rv = nni_sock_ep_add(s, ep)) != 0) {
 		nni_ep_destroy(ep);
 		return (rv);
 	}
@@ -185,6 +230,12 @@ nni_ep_create_listener(nni_ep **epp, nni_sock *s, const char *urlstr)
 	return (nni_ep_create(epp, s, urlstr, NNI_EP_MODE_LISTEN));
 }
 
+static int
+nni_ep_hold_cb(void *arg)
+{
+	return (nni_ep_hold(arg));
+}
+
 int
 nni_ep_find(nni_ep **epp, uint32_t id)
 {
@@ -195,43 +246,41 @@ nni_ep_find(nni_ep **epp, uint32_t id)
 		return (rv);
 	}
 
-	nni_mtx_lock(&nni_ep_lk);
-	if ((rv = nni_idhash_find(nni_eps, id, (void **) &ep)) == 0) {
-		if (ep->ep_closed) {
-			rv = NNG_ECLOSED;
-		} else {
-			ep->ep_refcnt++;
-			*epp = ep;
-		}
+	rv = nni_hdltab_find(nni_eps, id, nni_ep_hold_cb, (void **) &ep);
+	if (rv == 0) {
+		*epp = ep;
 	}
-	nni_mtx_unlock(&nni_ep_lk);
 	return (rv);
 }
 
+// nni_ep_hold takes a reference, unless the endpoint is closed.  This
+// and the release are done under the endpoint's own lock, which is
+// also held when close marks the endpoint and waits for the count.
 int
 nni_ep_hold(nni_ep *ep)
 {
 	int rv;
-	nni_mtx_lock(&nni_ep_lk);
+
+	nni_mtx_lock(&ep->ep_mtx);
 	if (ep->ep_closed) {
 		rv = NNG_ECLOSED;
 	} else {
 		ep->ep_refcnt++;
 		rv = 0;
 	}
-	nni_mtx_unlock(&nni_ep_lk);
+	nni_mtx_unlock(&ep->ep_mtx);
 	return (rv);
 }
 
 void
 nni_ep_rele(nni_ep *ep)
 {
-	nni_mtx_lock(&nni_ep_lk);
+	nni_mtx_lock(&ep->ep_mtx);
 	ep->ep_refcnt--;
 	if (ep->ep_closing) {
 		nni_cv_wake(&ep->ep_cv);
 	}
-	nni_mtx_unlock(&nni_ep_lk);
+	nni_mtx_unlock(&ep->ep_mtx);
 }
 
 int
@@ -366,6 +415,7 @@ nni_ep_con_cb(void *arg)
 	if ((rv = nni_aio_result(aio)) == 0) {
 		rv = nni_pipe_create(ep, nni_aio_get_output(aio, 0));
 	}
+	nni_ep_stat_result(ep, rv);
 	nni_mtx_lock(&ep->ep_mtx);
 	switch (rv) {
 	case 0:
@@ -453,6 +503,7 @@ nni_ep_dial(nni_ep *ep, int flags)
 		ep->ep_started = 0;
 		nni_mtx_unlock(&ep->ep_mtx);
 	}
+	nni_ep_stat_result(ep, rv);
 	return (rv);
 }
 
@@ -467,6 +518,7 @@ nni_ep_acc_cb(void *arg)
 		NNI_ASSERT(nni_aio_get_output(aio, 0) != NULL);
 		rv = nni_pipe_create(ep, nni_aio_get_output(aio, 0));
 	}
+	nni_ep_stat_result(ep, rv);
 
 	nni_mtx_lock(&ep->ep_mtx);
 	switch (rv) {
@@ -156,4 +156,46 @@ nni_file_unlock(nni_file_lockh *h)
 {
 	nni_plat_file_unlock(&h->lk);
 	NNI_FREE_STRUCT(h);
-}
\ No newline at end of file
+}
+
+struct nni_file_reader {
+	nni_plat_file f;
+};
+
+int
+nni_file_open(const char *path, nni_file_reader **rp, uint64_t *sizep,
+    uint64_t *mtimep)
+{
+	nni_file_reader *r;
+	int              rv;
+
+	if ((r = NNI_ALLOC_STRUCT(r)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_plat_file_open(path, &r->f, sizep, mtimep)) != 0) {
+		NNI_FREE_STRUCT(r);
+		return (rv);
+	}
+	*rp = r;
+	return (0);
+}
+
+int
+nni_file_read(
+    nni_file_reader *r, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	return (nni_plat_file_read(&r->f, buf, len, off, np));
+}
+
+void
+nni_file_close(nni_file_reader *r)
+{
+	nni_plat_file_close(&r->f);
+	NNI_FREE_STRUCT(r);
+}
+
+int
+nni_file_stat(const char *path, uint64_t *sizep, uint64_t *mtimep)
+{
+	return (nni_plat_file_stat(path, sizep, mtimep));
+}
@@ -84,6 +84,30 @@ extern bool nni_file_is_file(const char *);
 // false if an error occurs, or the path references something else.
 extern bool nni_file_is_dir(const char *);
 
+// nni_file_reader is used to read a file a piece at a time, for files
+// that are too large to load all at once with nni_file_get.
+typedef struct nni_file_reader nni_file_reader;
+
+// nni_file_open opens the named file for reading.  The size of the file,
+// and its last modification time (as seconds since the UNIX epoch) are
+// also returned.  Only regular files can be opened.
+extern int nni_file_open(
+    const char *, nni_file_reader **, uint64_t *, uint64_t *);
+
+// nni_file_read reads up to the given size from the file, starting at
+// the given offset.  The amount read is returned in the last argument,
+// and will be short only at the end of the file.
+extern int nni_file_read(
+    nni_file_reader *, void *, size_t, uint64_t, size_t *);
+
+// nni_file_close closes a file opened with nni_file_open.
+extern void nni_file_close(nni_file_reader *);
+
+// nni_file_stat returns the size and modification time of the named
+// regular file, as nni_file_open does, but without opening it.  This
+// is useful for checking whether a copy of the file is still current.
+extern int nni_file_stat(const char *, uint64_t *, uint64_t *);
+
 typedef struct nni_file_lockh nni_file_lockh;
 
 extern int nni_file_lock(const char *, nni_file_lockh **);
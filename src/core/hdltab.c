@@ -0,0 +1,388 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+// The table is open addressed, with linear probing; the IDs are mostly
+// allocated consecutively, so they spread well by themselves.  A slot's
+// key is written once, and never changes after that (until the whole
+// table is replaced), so a reader that finds its key in a slot knows
+// the value there is for that key.  Removing an ID just clears the
+// value, leaving the key behind as a tombstone.  When there are too
+// many of those, or the table is too full or too empty, a new table is
+// built and swapped in, and the old one freed once no readers can be
+// looking at it.
+//
+// Readers announce themselves by bumping a counter.  To keep readers
+// on different CPUs from fighting over one counter, there are several,
+// chosen by the address of the reader's stack.  To keep a stream of
+// new readers from holding off a writer forever, each has two counters,
+// for alternating epochs.  A writer that must wait for readers starts
+// a new epoch, then waits only for the counters of the old one to drain.
+// That wait is done without the table lock, so that other changes to
+// the table are not held up behind a slow reader.
+
+#define NNI_HDLTAB_NRDR 16
+#define NNI_HDLTAB_MINCAP 8
+
+typedef struct {
+	nni_atomic_u64 hs_key; // 0 if never used
+	nni_atomic_u64 hs_val; // 0 if unused or removed
+} nni_hdltab_slot;
+
+typedef struct {
+	size_t           ht_cap;  // always a power of two
+	size_t           ht_used; // slots with keys, including tombstones
+	nni_hdltab_slot *ht_slots;
+} nni_hdltab_tbl;
+
+// Each reader counter pair gets its own cache line.
+typedef union {
+	nni_atomic_u64 hr_count[2];
+	char           hr_pad[64];
+} nni_hdltab_rdr;
+
+struct nni_hdltab {
+	nni_hdltab_rdr h_rdrs[NNI_HDLTAB_NRDR];
+	nni_atomic_u64 h_tbl;   // current table
+	nni_atomic_u64 h_epoch; // low bit selects the reader counters
+	nni_mtx        h_mtx;   // serializes changes
+	nni_mtx        h_smtx;  // serializes epoch changes
+	size_t         h_count;
+	uint64_t       h_minval;
+	uint64_t       h_maxval;
+	uint64_t       h_dynval;
+};
+
+static nni_hdltab_tbl *
+nni_hdltab_tbl_alloc(size_t cap)
+{
+	nni_hdltab_tbl *t;
+
+	if ((t = NNI_ALLOC_STRUCT(t)) == NULL) {
+		return (NULL);
+	}
+	if ((t->ht_slots = NNI_ALLOC_STRUCTS(t->ht_slots, cap)) == NULL) {
+		NNI_FREE_STRUCT(t);
+		return (NULL);
+	}
+	for (size_t i = 0; i < cap; i++) {
+		nni_atomic_init64(&t->ht_slots[i].hs_key);
+		nni_atomic_init64(&t->ht_slots[i].hs_val);
+	}
+	t->ht_cap  = cap;
+	t->ht_used = 0;
+	return (t);
+}
+
+static void
+nni_hdltab_tbl_free(nni_hdltab_tbl *t)
+{
+	if (t != NULL) {
+		NNI_FREE_STRUCTS(t->ht_slots, t->ht_cap);
+		NNI_FREE_STRUCT(t);
+	}
+}
+
+static nni_hdltab_tbl *
+nni_hdltab_tbl_get(nni_hdltab *h)
+{
+	return ((nni_hdltab_tbl *) (uintptr_t) nni_atomic_get64(&h->h_tbl));
+}
+
+// nni_hdltab_tbl_find returns the slot holding the live ID, or NULL.
+static nni_hdltab_slot *
+nni_hdltab_tbl_find(nni_hdltab_tbl *t, uint64_t id)
+{
+	size_t mask = t->ht_cap - 1;
+	size_t i;
+
+	for (i = (size_t) id & mask;; i = (i + 1) & mask) {
+		nni_hdltab_slot *s = &t->ht_slots[i];
+		uint64_t         k = nni_atomic_get64(&s->hs_key);
+
+		if (k == 0) {
+			return (NULL);
+		}
+		if ((k == id) && (nni_atomic_get64(&s->hs_val) != 0)) {
+			return (s);
+		}
+	}
+}
+
+static void
+nni_hdltab_tbl_put(nni_hdltab_tbl *t, uint64_t id, uint64_t val)
+{
+	size_t mask = t->ht_cap - 1;
+	size_t i;
+
+	for (i = (size_t) id & mask;; i = (i + 1) & mask) {
+		nni_hdltab_slot *s = &t->ht_slots[i];
+
+		if (nni_atomic_get64(&s->hs_key) == 0) {
+			// Value first, so that readers matching the key
+			// see it.
+			nni_atomic_set64(&s->hs_val, val);
+			nni_atomic_set64(&s->hs_key, id);
+			t->ht_used++;
+			return;
+		}
+	}
+}
+
+static nni_hdltab_rdr *
+nni_hdltab_enter(nni_hdltab *h, uint64_t *ep)
+{
+	uintptr_t       x = (uintptr_t) &x;
+	nni_hdltab_rdr *r;
+	uint64_t        e;
+
+	// Threads have separate stacks, so this spreads them out.
+	x = (uintptr_t)(((uint64_t)(x >> 12) * 0x9e3779b97f4a7c15ull) >> 32);
+	r = &h->h_rdrs[x % NNI_HDLTAB_NRDR];
+
+	for (;;) {
+		e = nni_atomic_get64(&h->h_epoch) & 1;
+		nni_atomic_inc64(&r->hr_count[e]);
+		if ((nni_atomic_get64(&h->h_epoch) & 1) == e) {
+			break;
+		}
+		// A writer started a new epoch under us; join that one.
+		(void) nni_atomic_dec64_nv(&r->hr_count[e]);
+	}
+	*ep = e;
+	return (r);
+}
+
+static void
+nni_hdltab_leave(nni_hdltab_rdr *r, uint64_t e)
+{
+	(void) nni_atomic_dec64_nv(&r->hr_count[e]);
+}
+
+// nni_hdltab_sync waits for all readers that might have seen the table
+// as it was before the caller changed it.  The caller must not hold the
+// table lock.  Epoch changes are serialized, as a second writer flipping
+// the epoch would otherwise let readers of the first one go unnoticed.
+static void
+nni_hdltab_sync(nni_hdltab *h)
+{
+	uint64_t e;
+
+	nni_mtx_lock(&h->h_smtx);
+	e = nni_atomic_get64(&h->h_epoch) & 1;
+	nni_atomic_inc64(&h->h_epoch);
+	for (int i = 0; i < NNI_HDLTAB_NRDR; i++) {
+		while (nni_atomic_get64(&h->h_rdrs[i].hr_count[e]) != 0) {
+			// Readers are very brief, so this is too.
+			nni_msleep(0);
+		}
+	}
+	nni_mtx_unlock(&h->h_smtx);
+}
+
+// nni_hdltab_rebuild replaces the table with a fresh one, sized for
+// the live entries, plus one more.  The old table is returned in oldp,
+// to be freed by the caller once it has dropped the lock and synced.
+static int
+nni_hdltab_rebuild(nni_hdltab *h, nni_hdltab_tbl **oldp)
+{
+	nni_hdltab_tbl *old = nni_hdltab_tbl_get(h);
+	nni_hdltab_tbl *t;
+	size_t          cap = NNI_HDLTAB_MINCAP;
+
+	while (cap < (h->h_count + 1) * 2) {
+		cap *= 2;
+	}
+	if ((t = nni_hdltab_tbl_alloc(cap)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if (old != NULL) {
+		for (size_t i = 0; i < old->ht_cap; i++) {
+			nni_hdltab_slot *s = &old->ht_slots[i];
+			uint64_t         v = nni_atomic_get64(&s->hs_val);
+
+			if (v != 0) {
+				nni_hdltab_tbl_put(
+				    t, nni_atomic_get64(&s->hs_key), v);
+			}
+		}
+	}
+	nni_atomic_set64(&h->h_tbl, (uint64_t)(uintptr_t) t);
+	*oldp = old;
+	return (0);
+}
+
+int
+nni_hdltab_init(nni_hdltab **hp)
+{
+	nni_hdltab *h;
+
+	if ((h = NNI_ALLOC_STRUCT(h)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (int i = 0; i < NNI_HDLTAB_NRDR; i++) {
+		nni_atomic_init64(&h->h_rdrs[i].hr_count[0]);
+		nni_atomic_init64(&h->h_rdrs[i].hr_count[1]);
+	}
+	nni_atomic_init64(&h->h_tbl);
+	nni_atomic_init64(&h->h_epoch);
+	nni_mtx_init(&h->h_mtx);
+	nni_mtx_init(&h->h_smtx);
+	h->h_count  = 0;
+	h->h_minval = 1;
+	h->h_maxval = 0xffffffff;
+	h->h_dynval = 1;
+	*hp         = h;
+	return (0);
+}
+
+void
+nni_hdltab_fini(nni_hdltab *h)
+{
+	if (h != NULL) {
+		nni_hdltab_tbl_free(nni_hdltab_tbl_get(h));
+		nni_mtx_fini(&h->h_smtx);
+		nni_mtx_fini(&h->h_mtx);
+		NNI_FREE_STRUCT(h);
+	}
+}
+
+void
+nni_hdltab_set_limits(
+    nni_hdltab *h, uint64_t minval, uint64_t maxval, uint64_t start)
+{
+	// Zero marks unused slots, so it cannot be an ID.
+	NNI_ASSERT(minval > 0);
+	NNI_ASSERT(minval < maxval);
+	if (start < minval) {
+		start = minval;
+	}
+	if (start > maxval) {
+		start = maxval;
+	}
+
+	nni_mtx_lock(&h->h_mtx);
+	h->h_minval = minval;
+	h->h_maxval = maxval;
+	h->h_dynval = start;
+	nni_mtx_unlock(&h->h_mtx);
+}
+
+int
+nni_hdltab_alloc(nni_hdltab *h, uint64_t *idp, void *val)
+{
+	nni_hdltab_tbl *t;
+	nni_hdltab_tbl *old = NULL;
+	uint64_t        id;
+	int             rv;
+
+	NNI_ASSERT(val != NULL);
+
+	nni_mtx_lock(&h->h_mtx);
+	if (h->h_count > (h->h_maxval - h->h_minval)) {
+		nni_mtx_unlock(&h->h_mtx);
+		return (NNG_ENOMEM);
+	}
+
+	t = nni_hdltab_tbl_get(h);
+	if ((t == NULL) || ((t->ht_used + 1) * 4 > t->ht_cap * 3)) {
+		if ((rv = nni_hdltab_rebuild(h, &old)) != 0) {
+			nni_mtx_unlock(&h->h_mtx);
+			return (rv);
+		}
+		t = nni_hdltab_tbl_get(h);
+	}
+
+	for (;;) {
+		id = h->h_dynval;
+		h->h_dynval++;
+		if (h->h_dynval > h->h_maxval) {
+			h->h_dynval = h->h_minval;
+		}
+		if (nni_hdltab_tbl_find(t, id) == NULL) {
+			break;
+		}
+	}
+
+	nni_hdltab_tbl_put(t, id, (uint64_t)(uintptr_t) val);
+	h->h_count++;
+	nni_mtx_unlock(&h->h_mtx);
+	if (old != NULL) {
+		nni_hdltab_sync(h);
+		nni_hdltab_tbl_free(old);
+	}
+	*idp = id;
+	return (0);
+}
+
+int
+nni_hdltab_remove(nni_hdltab *h, uint64_t id)
+{
+	nni_hdltab_tbl * t;
+	nni_hdltab_tbl * old = NULL;
+	nni_hdltab_slot *s;
+
+	nni_mtx_lock(&h->h_mtx);
+	if (((t = nni_hdltab_tbl_get(h)) == NULL) ||
+	    ((s = nni_hdltab_tbl_find(t, id)) == NULL)) {
+		nni_mtx_unlock(&h->h_mtx);
+		return (NNG_ENOENT);
+	}
+	nni_atomic_set64(&s->hs_val, 0);
+	h->h_count--;
+
+	// Shrink if mostly empty.
+	if ((t->ht_cap > NNI_HDLTAB_MINCAP) && (h->h_count * 8 < t->ht_cap)) {
+		(void) nni_hdltab_rebuild(h, &old);
+	}
+	nni_mtx_unlock(&h->h_mtx);
+
+	// Once readers that could have seen the ID are gone, nobody can
+	// take a new reference through it.
+	nni_hdltab_sync(h);
+	nni_hdltab_tbl_free(old);
+	return (0);
+}
+
+int
+nni_hdltab_find(nni_hdltab *h, uint64_t id, int (*hold)(void *), void **vp)
+{
+	nni_hdltab_rdr * r;
+	nni_hdltab_tbl * t;
+	nni_hdltab_slot *s;
+	uint64_t         e;
+	void *           v;
+	int              rv;
+
+	r = nni_hdltab_enter(h, &e);
+	if (((t = nni_hdltab_tbl_get(h)) == NULL) ||
+	    ((s = nni_hdltab_tbl_find(t, id)) == NULL) ||
+	    ((v = (void *) (uintptr_t) nni_atomic_get64(&s->hs_val)) ==
+	        NULL)) {
+		rv = NNG_ENOENT;
+	} else if ((hold == NULL) || ((rv = hold(v)) == 0)) {
+		*vp = v;
+		rv  = 0;
+	}
+	nni_hdltab_leave(r, e);
+	return (rv);
+}
+
+size_t
+nni_hdltab_count(nni_hdltab *h)
+{
+	size_t count;
+
+	nni_mtx_lock(&h->h_mtx);
+	count = h->h_count;
+	nni_mtx_unlock(&h->h_mtx);
+	return (count);
+}
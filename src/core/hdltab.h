@@ -0,0 +1,53 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_HDLTAB_H
+#define CORE_HDLTAB_H
+
+#include "core/defs.h"
+
+// Handle tables map the numeric IDs we hand out to applications (for
+// sockets, pipes, and endpoints) to the objects themselves.  They are
+// like ID hashes, except that lookups take no lock at all, so that
+// threads using different sockets do not contend with one another.
+//
+// Changes are serialized by an internal lock.  Removal waits until no
+// lookup that might have seen the removed object is still running, so
+// once nni_hdltab_remove returns, the only references left are those
+// that lookups already took.  The object itself keeps its own reference
+// count; nni_hdltab_find calls the supplied hold function to take one.
+// That function runs while removals wait, so it must be brief, and must
+// not take any lock that is held while changing the table.  It may refuse
+// (e.g. if the object is closing) by returning an error, which is passed
+// back to the caller.
+
+typedef struct nni_hdltab nni_hdltab;
+
+extern int  nni_hdltab_init(nni_hdltab **);
+extern void nni_hdltab_fini(nni_hdltab *);
+
+// nni_hdltab_set_limits sets the range of IDs nni_hdltab_alloc may
+// assign, and the first one to try.
+extern void nni_hdltab_set_limits(nni_hdltab *, uint64_t, uint64_t, uint64_t);
+
+// nni_hdltab_alloc assigns an unused ID to the (non-NULL) value.
+extern int nni_hdltab_alloc(nni_hdltab *, uint64_t *, void *);
+
+// nni_hdltab_remove removes the ID, and waits for any lookups still
+// running to finish.  It must not be called from a hold function.
+extern int nni_hdltab_remove(nni_hdltab *, uint64_t);
+
+// nni_hdltab_find looks up the ID, and if found, calls the hold function
+// on the value before returning it.
+extern int nni_hdltab_find(nni_hdltab *, uint64_t, int (*)(void *), void **);
+
+extern size_t nni_hdltab_count(nni_hdltab *);
+
+#endif // CORE_HDLTAB_H
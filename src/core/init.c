@@ -27,7 +27,10 @@ nni_init_helper(void)
 	NNI_LIST_INIT(&nni_init_list, nni_initializer, i_node);
 	nni_inited = true;
 
-	if (((rv = nni_taskq_sys_init()) != 0) ||
+	if (((rv = nni_stat_sys_init()) != 0) ||
+	    ((rv = nni_msgpool_sys_init()) != 0) ||
+	    ((rv = nni_msg_sys_init()) != 0) ||
+	    ((rv = nni_taskq_sys_init()) != 0) ||
 	    ((rv = nni_reap_sys_init()) != 0) ||
 	    ((rv = nni_timer_sys_init()) != 0) ||
 	    ((rv = nni_aio_sys_init()) != 0) ||
@@ -78,6 +81,9 @@ nni_fini(void)
 	nni_aio_sys_fini();
 	nni_timer_sys_fini();
 	nni_taskq_sys_fini();
+	nni_msg_sys_fini();
+	nni_msgpool_sys_fini();
+	nni_stat_sys_fini();
 
 	nni_mtx_fini(&nni_init_mtx);
 	nni_plat_fini();
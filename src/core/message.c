@@ -8,6 +8,7 @@
 // found online at https://opensource.org/licenses/MIT.
 //
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -15,12 +16,21 @@
 
 // Message API.
 
+// Shared chunk storage.  Message bodies are shared, rather than copied,
+// by nni_msg_dup.  The first time storage is shared, one of these is
+// allocated to hold the count of chunks referencing it.  Storage that
+// has never been shared has no reference object at all.
+typedef struct {
+	nni_atomic_u64 cr_refcnt;
+} nni_chunk_ref;
+
 // Message chunk, internal to the message implementation.
 typedef struct {
-	size_t   ch_cap; // allocated size
-	size_t   ch_len; // length in use
-	uint8_t *ch_buf; // underlying buffer
-	uint8_t *ch_ptr; // pointer to actual data
+	size_t         ch_cap; // allocated size
+	size_t         ch_len; // length in use
+	uint8_t *      ch_buf; // underlying buffer
+	uint8_t *      ch_ptr; // pointer to actual data
+	nni_chunk_ref *ch_ref; // non-NULL if storage is shared
 } nni_chunk;
 
 // Underlying message structure.
@@ -89,6 +99,65 @@ nni_msg_dump(const char *banner, const nni_msg *msg)
 }
 #endif
 
+// nni_chunk_release drops this chunk's use of its storage, freeing the
+// storage only if no other chunk references it.  The caller is
+// responsible for resetting the other chunk fields.
+static void
+nni_chunk_release(nni_chunk *ch)
+{
+	nni_chunk_ref *ref;
+
+	if ((ref = ch->ch_ref) != NULL) {
+		ch->ch_ref = NULL;
+		if (nni_atomic_dec64_nv(&ref->cr_refcnt) != 0) {
+			// Someone else is still using it.
+			return;
+		}
+		nni_msgpool_free(ref, sizeof(*ref));
+	}
+	if ((ch->ch_cap != 0) && (ch->ch_buf != NULL)) {
+		nni_msgpool_free(ch->ch_buf, ch->ch_cap);
+	}
+}
+
+// nni_chunk_unshare ensures that the chunk has exclusive use of its
+// storage, copying the referenced data if necessary.  This must be done
+// before anything is written into the storage.  Operations that only
+// adjust the pointer or length (trim, chop, clear) do not need it.
+static int
+nni_chunk_unshare(nni_chunk *ch)
+{
+	nni_chunk_ref *ref;
+	uint8_t *      newbuf;
+	size_t         off;
+
+	if ((ref = ch->ch_ref) == NULL) {
+		return (0);
+	}
+
+	// If everyone else has let go, the storage is ours.  Nobody can
+	// take a new reference behind our back, because only the holder
+	// of a message may duplicate it.
+	if (nni_atomic_get64(&ref->cr_refcnt) == 1) {
+		nni_msgpool_free(ref, sizeof(*ref));
+		ch->ch_ref = NULL;
+		return (0);
+	}
+
+	if ((newbuf = nni_msgpool_alloc(ch->ch_cap)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	// Preserve the headroom, but only copy the referenced data.
+	off = (ch->ch_ptr != NULL) ? (size_t)(ch->ch_ptr - ch->ch_buf) : 0;
+	if (ch->ch_len != 0) {
+		memcpy(newbuf + off, ch->ch_ptr, ch->ch_len);
+	}
+	nni_chunk_release(ch);
+	ch->ch_buf = newbuf;
+	ch->ch_ptr = newbuf + off;
+	return (0);
+}
+
 // nni_chunk_grow increases the underlying space for a chunk.  It ensures
 // that the desired amount of trailing space (including the length)
 // and headroom (excluding the length) are available.  It also copies
@@ -99,10 +168,15 @@ nni_msg_dump(const char *banner, const nni_msg *msg)
 // Note that having some headroom is useful when data must be prepended
 // to a message - it avoids having to perform extra data copies, so we
 // encourage initial allocations to start with sufficient room.
+//
+// Storage comes from the message pool, which rounds the size up to its
+// size class; the extra space becomes additional tail room.  The new
+// storage is not zeroed.
 static int
 nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 {
 	size_t   headroom = 0;
+	size_t   newcap;
 	uint8_t *newbuf;
 
 	// We assume that if the pointer is a valid pointer, and inside
@@ -137,15 +211,16 @@ nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 			newsz = ch->ch_cap - headroom;
 		}
 
-		if ((newbuf = nni_alloc(newsz + headwanted)) == NULL) {
+		newcap = nni_msgpool_size(newsz + headwanted);
+		if ((newbuf = nni_msgpool_alloc(newcap)) == NULL) {
 			return (NNG_ENOMEM);
 		}
 		// Copy all the data, but not header or trailer.
 		memcpy(newbuf + headwanted, ch->ch_ptr, ch->ch_len);
-		nni_free(ch->ch_buf, ch->ch_cap);
+		nni_chunk_release(ch);
 		ch->ch_buf = newbuf;
 		ch->ch_ptr = newbuf + headwanted;
-		ch->ch_cap = newsz + headwanted;
+		ch->ch_cap = newcap;
 		return (0);
 	}
 
@@ -153,11 +228,12 @@ nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 	// the backing store.  In this case, we just check against the
 	// allocated capacity and grow, or don't grow.
 	if ((newsz + headwanted) >= ch->ch_cap) {
-		if ((newbuf = nni_alloc(newsz + headwanted)) == NULL) {
+		newcap = nni_msgpool_size(newsz + headwanted);
+		if ((newbuf = nni_msgpool_alloc(newcap)) == NULL) {
 			return (NNG_ENOMEM);
 		}
-		nni_free(ch->ch_buf, ch->ch_cap);
-		ch->ch_cap = newsz + headwanted;
+		nni_chunk_release(ch);
+		ch->ch_cap = newcap;
 		ch->ch_buf = newbuf;
 	}
 
@@ -168,9 +244,7 @@ nni_chunk_grow(nni_chunk *ch, size_t newsz, size_t headwanted)
 static void
 nni_chunk_free(nni_chunk *ch)
 {
-	if ((ch->ch_cap != 0) && (ch->ch_buf != NULL)) {
-		nni_free(ch->ch_buf, ch->ch_cap);
-	}
+	nni_chunk_release(ch);
 	ch->ch_ptr = NULL;
 	ch->ch_buf = NULL;
 	ch->ch_len = 0;
@@ -216,16 +290,42 @@ nni_chunk_trim(nni_chunk *ch, size_t len)
 static int
 nni_chunk_dup(nni_chunk *dst, const nni_chunk *src)
 {
-	if ((dst->ch_buf = nni_alloc(src->ch_cap)) == NULL) {
+	if ((dst->ch_buf = nni_msgpool_alloc(src->ch_cap)) == NULL) {
 		return (NNG_ENOMEM);
 	}
 	dst->ch_cap = src->ch_cap;
 	dst->ch_len = src->ch_len;
 	dst->ch_ptr = dst->ch_buf + (src->ch_ptr - src->ch_buf);
+	dst->ch_ref = NULL;
 	memcpy(dst->ch_ptr, src->ch_ptr, dst->ch_len);
 	return (0);
 }
 
+// nni_chunk_share makes the destination chunk reference the same storage
+// as the source, without copying any data.  Whichever of them is written
+// to first gets its own copy at that time (see nni_chunk_unshare).
+static int
+nni_chunk_share(nni_chunk *dst, nni_chunk *src)
+{
+	if ((src->ch_cap == 0) || (src->ch_buf == NULL)) {
+		memset(dst, 0, sizeof(*dst));
+		return (0);
+	}
+	if (src->ch_ref == NULL) {
+		nni_chunk_ref *ref;
+
+		if ((ref = nni_msgpool_alloc(sizeof(*ref))) == NULL) {
+			return (NNG_ENOMEM);
+		}
+		nni_atomic_init64(&ref->cr_refcnt);
+		nni_atomic_set64(&ref->cr_refcnt, 1);
+		src->ch_ref = ref;
+	}
+	nni_atomic_inc64(&src->ch_ref->cr_refcnt);
+	*dst = *src;
+	return (0);
+}
+
 // nni_chunk_append appends the data to the chunk, growing as necessary.
 // If the data pointer is NULL, then the chunk data region is allocated,
 // but uninitialized.
@@ -237,7 +337,8 @@ nni_chunk_append(nni_chunk *ch, const void *data, size_t len)
 	if (len == 0) {
 		return (0);
 	}
-	if ((rv = nni_chunk_grow(ch, len + ch->ch_len, 0)) != 0) {
+	if (((rv = nni_chunk_unshare(ch)) != 0) ||
+	    ((rv = nni_chunk_grow(ch, len + ch->ch_len, 0)) != 0)) {
 		return (rv);
 	}
 	if (ch->ch_ptr == NULL) {
@@ -258,6 +359,9 @@ nni_chunk_insert(nni_chunk *ch, const void *data, size_t len)
 {
 	int rv;
 
+	if ((rv = nni_chunk_unshare(ch)) != 0) {
+		return (rv);
+	}
 	if (ch->ch_ptr == NULL) {
 		ch->ch_ptr = ch->ch_buf;
 	}
@@ -322,20 +426,41 @@ nni_chunk_chop_u32(nni_chunk *ch)
 	return (v);
 }
 
-int
-nni_msg_alloc(nni_msg **mp, size_t sz)
+// Message structures come from the message pool too, which does not
+// zero them for us.
+static nni_msg *
+nni_msg_struct_alloc(void)
+{
+	nni_msg *m;
+
+	if ((m = nni_msgpool_alloc(sizeof(*m))) != NULL) {
+		memset(m, 0, sizeof(*m));
+	}
+	return (m);
+}
+
+static void
+nni_msg_struct_free(nni_msg *m)
+{
+	nni_msgpool_free(m, sizeof(*m));
+}
+
+// nni_msg_alloc_common allocates a message.  The body is zeroed only if
+// asked; the transports skip that, as they overwrite it immediately.
+static int
+nni_msg_alloc_common(nni_msg **mp, size_t sz, bool zero)
 {
 	nni_msg *m;
 	int      rv;
 
-	if ((m = NNI_ALLOC_STRUCT(m)) == NULL) {
+	if ((m = nni_msg_struct_alloc()) == NULL) {
 		return (NNG_ENOMEM);
 	}
 
 	// 64-bytes of header, including room for 32 bytes
 	// of headroom and 32 bytes of trailer.
 	if ((rv = nni_chunk_grow(&m->m_header, 32, 32)) != 0) {
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 		return (rv);
 	}
 
@@ -351,18 +476,34 @@ nni_msg_alloc(nni_msg **mp, size_t sz)
 	}
 	if (rv != 0) {
 		nni_chunk_free(&m->m_header);
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
+		return (rv);
 	}
 	if ((rv = nni_chunk_append(&m->m_body, NULL, sz)) != 0) {
 		// Should not happen since we just grew it to fit.
 		nni_panic("chunk_append failed");
 	}
+	if (zero && (sz > 0)) {
+		memset(m->m_body.ch_ptr, 0, sz);
+	}
 
 	NNI_LIST_INIT(&m->m_options, nni_msgopt, mo_node);
 	*mp = m;
 	return (0);
 }
 
+int
+nni_msg_alloc(nni_msg **mp, size_t sz)
+{
+	return (nni_msg_alloc_common(mp, sz, true));
+}
+
+int
+nni_msg_alloc_nz(nni_msg **mp, size_t sz)
+{
+	return (nni_msg_alloc_common(mp, sz, false));
+}
+
 int
 nni_msg_dup(nni_msg **dup, const nni_msg *src)
 {
@@ -371,19 +512,24 @@ nni_msg_dup(nni_msg **dup, const nni_msg *src)
 	nni_msgopt *newmo;
 	int         rv;
 
-	if ((m = NNI_ALLOC_STRUCT(m)) == NULL) {
+	if ((m = nni_msg_struct_alloc()) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	memset(m, 0, sizeof(*m));
 	NNI_LIST_INIT(&m->m_options, nni_msgopt, mo_node);
 
 	if ((rv = nni_chunk_dup(&m->m_header, &src->m_header)) != 0) {
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 		return (rv);
 	}
-	if ((rv = nni_chunk_dup(&m->m_body, &src->m_body)) != 0) {
+	// The body is shared rather than copied, which is what makes
+	// fan-out in PUB, BUS and SURVEYOR cheap.  The header is small and
+	// usually rewritten per pipe, so it is just copied.  Sharing only
+	// touches the source's reference bookkeeping, not its contents,
+	// so casting away const here is safe.
+	if ((rv = nni_chunk_share(&m->m_body, (nni_chunk *) &src->m_body)) !=
+	    0) {
 		nni_chunk_free(&m->m_header);
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 		return (rv);
 	}
 
@@ -416,7 +562,7 @@ nni_msg_free(nni_msg *m)
 			nni_list_remove(&m->m_options, mo);
 			nni_free(mo, sizeof(*mo) + mo->mo_sz);
 		}
-		NNI_FREE_STRUCT(m);
+		nni_msg_struct_free(m);
 	}
 }
 
@@ -506,6 +652,12 @@ nni_msg_body(nni_msg *m)
 	return (m->m_body.ch_ptr);
 }
 
+int
+nni_msg_unshare(nni_msg *m)
+{
+	return (nni_chunk_unshare(&m->m_body));
+}
+
 size_t
 nni_msg_len(const nni_msg *m)
 {
@@ -629,4 +781,140 @@ uint32_t
 nni_msg_get_pipe(const nni_msg *m)
 {
 	return (m->m_pipe);
-}
\ No newline at end of file
+}
+// Loaned message bodies.  When nng_recv gives a message body to the
+// application (NNG_FLAG_ALLOC), the pointer it hands out is usually some
+// way into the storage, because of the headroom we keep in front of the
+// data.  We remember where each such loan really starts, so that nng_free
+// can release it properly.  Only bodies too large for the message pool
+// are loaned, as smaller ones are cheap enough to copy.
+typedef struct {
+	void * ml_buf; // start of the storage
+	size_t ml_cap; // size of the storage
+} nni_msg_loan;
+
+static nni_idhash *   nni_msg_loans;
+static nni_atomic_u64 nni_msg_nloans;
+
+// nni_msg_loan_key turns a pointer into a hash key.  The hash only uses
+// the low order bits, and large allocations are usually page aligned, so
+// fold the upper bits down.  (Each step can be undone, so distinct
+// pointers still get distinct keys.)
+static uint64_t
+nni_msg_loan_key(void *ptr)
+{
+	uint64_t k = (uint64_t)(uintptr_t) ptr;
+
+	k ^= k >> 12;
+	k ^= k >> 24;
+	return (k);
+}
+
+// nni_msg_loan_take removes the loan record for the pointer, if there
+// is one.
+static bool
+nni_msg_loan_take(void *ptr, void **bufp, size_t *capp)
+{
+	nni_msg_loan *ml;
+	uint64_t      key;
+
+	if ((ptr == NULL) || (nni_atomic_get64(&nni_msg_nloans) == 0)) {
+		return (false);
+	}
+	key = nni_msg_loan_key(ptr);
+	if ((nni_idhash_find(nni_msg_loans, key, (void **) &ml) != 0) ||
+	    (nni_idhash_remove(nni_msg_loans, key) != 0)) {
+		return (false);
+	}
+	nni_atomic_dec64_nv(&nni_msg_nloans);
+	*bufp = ml->ml_buf;
+	*capp = ml->ml_cap;
+	NNI_FREE_STRUCT(ml);
+	return (true);
+}
+
+void *
+nni_msg_body_loan(nni_msg *m)
+{
+	nni_chunk *   ch = &m->m_body;
+	nni_msg_loan *ml;
+	void *        ptr;
+
+	if ((nni_msg_loans == NULL) || (ch->ch_len == 0) ||
+	    nni_msgpool_pooled(ch->ch_cap) || (nni_chunk_unshare(ch) != 0)) {
+		return (NULL);
+	}
+	if ((ml = NNI_ALLOC_STRUCT(ml)) == NULL) {
+		return (NULL);
+	}
+	ml->ml_buf = ch->ch_buf;
+	ml->ml_cap = ch->ch_cap;
+	ptr        = ch->ch_ptr;
+	if (nni_idhash_insert(nni_msg_loans, nni_msg_loan_key(ptr), ml) != 0) {
+		NNI_FREE_STRUCT(ml);
+		return (NULL);
+	}
+	nni_atomic_inc64(&nni_msg_nloans);
+
+	ch->ch_buf = NULL;
+	ch->ch_ptr = NULL;
+	ch->ch_cap = 0;
+	ch->ch_len = 0;
+	return (ptr);
+}
+
+bool
+nni_msg_loan_free(void *ptr)
+{
+	void * buf;
+	size_t cap;
+
+	if (!nni_msg_loan_take(ptr, &buf, &cap)) {
+		return (false);
+	}
+	nni_msgpool_free(buf, cap);
+	return (true);
+}
+
+int
+nni_msg_body_adopt(nni_msg *m, void *ptr, size_t len)
+{
+	nni_chunk *ch = &m->m_body;
+	void *     buf;
+	size_t     cap;
+
+	if (!nni_msg_loan_take(ptr, &buf, &cap)) {
+		// Plain nng_alloc memory.  We only know how much of it is
+		// in use, but that is also all that nng_free is told.
+		if (nni_msgpool_pooled(len)) {
+			return (NNG_ENOTSUP);
+		}
+		buf = ptr;
+		cap = len;
+	}
+	nni_chunk_free(ch);
+	ch->ch_buf = buf;
+	ch->ch_cap = cap;
+	ch->ch_ptr = ptr;
+	ch->ch_len = len;
+	return (0);
+}
+
+int
+nni_msg_sys_init(void)
+{
+	nni_atomic_init64(&nni_msg_nloans);
+	return (nni_idhash_init(&nni_msg_loans));
+}
+
+void
+nni_msg_sys_fini(void)
+{
+	// Anything still on loan is forgotten (and leaked); applications
+	// must free their buffers before finalizing the library.
+	if (nni_msg_loans != NULL) {
+		nni_atomic_set64(&nni_msg_nloans, 0);
+		nni_idhash_fini(nni_msg_loans);
+		nni_msg_loans = NULL;
+	}
+}
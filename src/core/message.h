@@ -13,14 +13,24 @@
 
 // Internally used message API.  Again, this is not part of our public API.
 // "trim" operations work from the front, and "chop" work from the end.
+// nni_msg_alloc_nz is like nni_msg_alloc, but leaves the body contents
+// uninitialized; it is meant for transports about to fill the body.
+//
+// Message bodies may be shared between a message and its duplicates
+// (see nni_msg_dup), so code must not write through the pointer from
+// nni_msg_body unless it first calls nni_msg_unshare, which gives the
+// message its own private copy of the body if it needs one.  The other
+// modifying functions (append, insert, etc.) take care of this already.
 
 extern int      nni_msg_alloc(nni_msg **, size_t);
+extern int      nni_msg_alloc_nz(nni_msg **, size_t);
 extern void     nni_msg_free(nni_msg *);
 extern int      nni_msg_realloc(nni_msg *, size_t);
 extern int      nni_msg_dup(nni_msg **, const nni_msg *);
 extern void *   nni_msg_header(nni_msg *);
 extern size_t   nni_msg_header_len(const nni_msg *);
 extern void *   nni_msg_body(nni_msg *);
+extern int      nni_msg_unshare(nni_msg *);
 extern size_t   nni_msg_len(const nni_msg *);
 extern int      nni_msg_append(nni_msg *, const void *, size_t);
 extern int      nni_msg_insert(nni_msg *, const void *, size_t);
@@ -46,4 +56,18 @@ extern uint32_t nni_msg_header_chop_u32(nni_msg *);
 extern void     nni_msg_set_pipe(nni_msg *, uint32_t);
 extern uint32_t nni_msg_get_pipe(const nni_msg *);
 
+// Zero copy support for nng_send and nng_recv.  nni_msg_body_loan takes
+// the body storage out of a message (leaving it empty), so that it can be
+// given to the application, which returns it with nng_free; that calls
+// nni_msg_loan_free, which returns false for memory that is not a loan.
+// nni_msg_body_adopt makes storage from nng_alloc (or a loan) the body of
+// a message.  Only large bodies are handled this way; for small ones these
+// fail (NULL, or NNG_ENOTSUP), and the caller should copy the data.
+extern void *nni_msg_body_loan(nni_msg *);
+extern bool  nni_msg_loan_free(void *);
+extern int   nni_msg_body_adopt(nni_msg *, void *, size_t);
+
+extern int  nni_msg_sys_init(void);
+extern void nni_msg_sys_fini(void);
+
 #endif // CORE_SOCKET_H
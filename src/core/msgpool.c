@@ -0,0 +1,283 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+// Message memory pool.  This is a simple magazine style allocator.  Each
+// thread has a small stack (magazine) of free buffers for every size
+// class, which it can use without any locking.  When a magazine runs dry
+// it is refilled from a global depot, and when it overflows, half of it
+// is returned to the depot.  The depots are bounded; anything beyond that
+// goes back to the platform allocator.  Both magazines and depots are
+// sized in bytes, so that large classes hold fewer buffers.
+
+#define NNI_MSGPOOL_MINSHIFT 6  // 64 bytes
+#define NNI_MSGPOOL_MAXSHIFT 16 // 64 KB
+#define NNI_MSGPOOL_NCLASS (NNI_MSGPOOL_MAXSHIFT - NNI_MSGPOOL_MINSHIFT + 1)
+
+#define NNI_MSGPOOL_MAGMAX 32           // most buffers per magazine
+#define NNI_MSGPOOL_MAGBYTES (32 * 1024) // most bytes per magazine
+#define NNI_MSGPOOL_DEPOTMAX 1024        // most buffers per depot
+#define NNI_MSGPOOL_DEPOTBYTES (1024 * 1024)
+
+// Hits are counted locally, and published in batches, to avoid
+// bouncing a shared cache line on every allocation.
+#define NNI_MSGPOOL_STATBATCH 64
+
+typedef struct {
+	int   mg_num;
+	int   mg_max;
+	void *mg_bufs[NNI_MSGPOOL_MAGMAX];
+} nni_msgpool_mag;
+
+typedef struct {
+	nni_msgpool_mag mc_mags[NNI_MSGPOOL_NCLASS];
+	uint64_t        mc_hits;
+	nni_tlocal_node mc_node;
+} nni_msgpool_cache;
+
+typedef struct {
+	nni_mtx d_mtx;
+	int     d_num;
+	int     d_max;
+	void ** d_bufs;
+} nni_msgpool_depot;
+
+static nni_msgpool_depot nni_msgpool_depots[NNI_MSGPOOL_NCLASS];
+static nni_tlocal        nni_msgpool_tls;
+
+static nni_stat_item nni_msgpool_stats;
+static nni_stat_item nni_msgpool_hits;
+static nni_stat_item nni_msgpool_misses;
+
+static int
+nni_msgpool_class(size_t sz)
+{
+	size_t csz = (size_t) 1 << NNI_MSGPOOL_MINSHIFT;
+	int    c   = 0;
+
+	while (csz < sz) {
+		csz <<= 1;
+		c++;
+	}
+	return (c < NNI_MSGPOOL_NCLASS ? c : -1);
+}
+
+static size_t
+nni_msgpool_class_size(int c)
+{
+	return ((size_t) 1 << (c + NNI_MSGPOOL_MINSHIFT));
+}
+
+size_t
+nni_msgpool_size(size_t sz)
+{
+	int c;
+
+	if ((c = nni_msgpool_class(sz)) < 0) {
+		return (sz);
+	}
+	return (nni_msgpool_class_size(c));
+}
+
+static void *
+nni_msgpool_cache_alloc(void)
+{
+	nni_msgpool_cache *mc;
+
+	if ((mc = NNI_ALLOC_STRUCT(mc)) == NULL) {
+		return (NULL);
+	}
+	for (int c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		size_t n = NNI_MSGPOOL_MAGBYTES / nni_msgpool_class_size(c);
+		if (n > NNI_MSGPOOL_MAGMAX) {
+			n = NNI_MSGPOOL_MAGMAX;
+		}
+		mc->mc_mags[c].mg_max = n > 0 ? (int) n : 1;
+	}
+	return (mc);
+}
+
+static void
+nni_msgpool_cache_free(void *arg)
+{
+	nni_msgpool_cache *mc = arg;
+
+	// Buffers go straight back to the platform, rather than to the
+	// depots, as the latter may be going away.
+	for (int c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		nni_msgpool_mag *mag = &mc->mc_mags[c];
+		while (mag->mg_num > 0) {
+			mag->mg_num--;
+			nni_free(mag->mg_bufs[mag->mg_num],
+			    nni_msgpool_class_size(c));
+		}
+	}
+	nni_stat_inc(&nni_msgpool_hits, mc->mc_hits);
+	NNI_FREE_STRUCT(mc);
+}
+
+// nni_msgpool_refill moves up to half a magazine from the depot.
+static void
+nni_msgpool_refill(int c, nni_msgpool_mag *mag)
+{
+	nni_msgpool_depot *d    = &nni_msgpool_depots[c];
+	int                want = (mag->mg_max + 1) / 2;
+
+	nni_mtx_lock(&d->d_mtx);
+	while ((want > 0) && (d->d_num > 0)) {
+		mag->mg_bufs[mag->mg_num++] = d->d_bufs[--d->d_num];
+		want--;
+	}
+	nni_mtx_unlock(&d->d_mtx);
+}
+
+// nni_msgpool_flush moves half a magazine to the depot, releasing
+// whatever does not fit.
+static void
+nni_msgpool_flush(int c, nni_msgpool_mag *mag)
+{
+	nni_msgpool_depot *d    = &nni_msgpool_depots[c];
+	int                want = (mag->mg_max + 1) / 2;
+
+	nni_mtx_lock(&d->d_mtx);
+	while ((want > 0) && (d->d_num < d->d_max)) {
+		d->d_bufs[d->d_num++] = mag->mg_bufs[--mag->mg_num];
+		want--;
+	}
+	nni_mtx_unlock(&d->d_mtx);
+
+	while (want > 0) {
+		mag->mg_num--;
+		nni_free(mag->mg_bufs[mag->mg_num], nni_msgpool_class_size(c));
+		want--;
+	}
+}
+
+bool
+nni_msgpool_pooled(size_t sz)
+{
+	return (nni_msgpool_class(sz) >= 0);
+}
+
+void *
+nni_msgpool_alloc(size_t sz)
+{
+	nni_msgpool_cache *mc;
+	nni_msgpool_mag *  mag;
+	int                c;
+
+	if ((c = nni_msgpool_class(sz)) < 0) {
+		return (nni_alloc_nz(sz));
+	}
+	if ((mc = nni_tlocal_get(&nni_msgpool_tls)) != NULL) {
+		mag = &mc->mc_mags[c];
+		if (mag->mg_num == 0) {
+			nni_msgpool_refill(c, mag);
+		}
+		if (mag->mg_num > 0) {
+			if (++mc->mc_hits == NNI_MSGPOOL_STATBATCH) {
+				nni_stat_inc(&nni_msgpool_hits, mc->mc_hits);
+				mc->mc_hits = 0;
+			}
+			return (mag->mg_bufs[--mag->mg_num]);
+		}
+	}
+	nni_stat_inc(&nni_msgpool_misses, 1);
+	return (nni_alloc_nz(nni_msgpool_class_size(c)));
+}
+
+void
+nni_msgpool_free(void *buf, size_t sz)
+{
+	nni_msgpool_cache *mc;
+	nni_msgpool_mag *  mag;
+	int                c;
+
+	if (buf == NULL) {
+		return;
+	}
+	if ((c = nni_msgpool_class(sz)) < 0) {
+		nni_free(buf, sz);
+		return;
+	}
+	if ((mc = nni_tlocal_get(&nni_msgpool_tls)) == NULL) {
+		nni_free(buf, nni_msgpool_class_size(c));
+		return;
+	}
+	mag = &mc->mc_mags[c];
+	if (mag->mg_num == mag->mg_max) {
+		nni_msgpool_flush(c, mag);
+	}
+	mag->mg_bufs[mag->mg_num++] = buf;
+}
+
+int
+nni_msgpool_sys_init(void)
+{
+	int rv;
+
+	for (int c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		nni_msgpool_depot *d = &nni_msgpool_depots[c];
+		size_t n = NNI_MSGPOOL_DEPOTBYTES / nni_msgpool_class_size(c);
+
+		d->d_max = n > NNI_MSGPOOL_DEPOTMAX ? NNI_MSGPOOL_DEPOTMAX
+		                                    : (int) n;
+		d->d_num = 0;
+		if ((d->d_bufs = nni_alloc(d->d_max * sizeof(void *))) ==
+		    NULL) {
+			nni_msgpool_sys_fini();
+			return (NNG_ENOMEM);
+		}
+		nni_mtx_init(&d->d_mtx);
+	}
+	nni_stat_init_group(&nni_msgpool_stats, "msgpool");
+	nni_stat_init(&nni_msgpool_hits, "hits",
+	    "allocations satisfied from cache", NNG_STAT_COUNTER,
+	    NNG_UNIT_EVENTS);
+	nni_stat_init(&nni_msgpool_misses, "misses",
+	    "allocations not satisfied from cache", NNG_STAT_COUNTER,
+	    NNG_UNIT_EVENTS);
+	nni_stat_append(&nni_msgpool_stats, &nni_msgpool_hits);
+	nni_stat_append(&nni_msgpool_stats, &nni_msgpool_misses);
+	nni_stat_append(nni_stat_global(), &nni_msgpool_stats);
+
+	if ((rv = NNI_TLOCAL_INIT(&nni_msgpool_tls, nni_msgpool_cache,
+	         mc_node, nni_msgpool_cache_alloc, nni_msgpool_cache_free)) !=
+	    0) {
+		nni_msgpool_sys_fini();
+		return (rv);
+	}
+	return (0);
+}
+
+void
+nni_msgpool_sys_fini(void)
+{
+	// The caches publish their hits as they go, so they are released
+	// before the statistics.
+	nni_tlocal_fini(&nni_msgpool_tls);
+	nni_stat_remove(&nni_msgpool_stats);
+
+	for (int c = 0; c < NNI_MSGPOOL_NCLASS; c++) {
+		nni_msgpool_depot *d = &nni_msgpool_depots[c];
+
+		if (d->d_bufs == NULL) {
+			continue;
+		}
+		while (d->d_num > 0) {
+			d->d_num--;
+			nni_free(d->d_bufs[d->d_num], nni_msgpool_class_size(c));
+		}
+		nni_free(d->d_bufs, d->d_max * sizeof(void *));
+		d->d_bufs = NULL;
+		nni_mtx_fini(&d->d_mtx);
+	}
+}
@@ -0,0 +1,48 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_MSGPOOL_H
+#define CORE_MSGPOOL_H
+
+#include "core/defs.h"
+
+// The message pool caches the memory used for message structures and
+// message bodies.  Requests are rounded up to power of two size classes
+// (from 64 bytes up to 64 KB), and freed buffers are kept in small
+// per-thread caches, backed by a bounded global depot for each class.
+// Larger requests bypass the pool.  Pool memory is *not* zeroed.
+//
+// The pool is safe to use before the library is initialized, or after it
+// is finalized; in that case it simply falls back to the platform
+// allocator.
+
+// nni_msgpool_size returns the capacity that will actually be allocated
+// for a request of the given size.  Callers may use all of it.
+extern size_t nni_msgpool_size(size_t);
+
+// nni_msgpool_alloc allocates at least the given size.  The contents
+// are uninitialized.
+extern void *nni_msgpool_alloc(size_t);
+
+// nni_msgpool_free returns memory to the pool.  The size must be the same
+// as was passed to nni_msgpool_alloc (or the value returned by
+// nni_msgpool_size for it).  NULL is ignored.
+extern void nni_msgpool_free(void *, size_t);
+
+// nni_msgpool_pooled returns true if requests of the given size are
+// served from the pool.  Larger ones come straight from nni_alloc_nz and
+// go back to nni_free, so such storage may move freely between the pool
+// and other owners.
+extern bool nni_msgpool_pooled(size_t);
+
+extern int  nni_msgpool_sys_init(void);
+extern void nni_msgpool_sys_fini(void);
+
+#endif // CORE_MSGPOOL_H
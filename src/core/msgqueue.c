@@ -14,21 +14,57 @@
 // but as we have access to the internals, we have made some fundamental
 // differences and improvements.  For example, these can grow, and either
 // side can close, and they may be closed more than once.
+//
+// The messages themselves are held in a bounded lock-free ring, so that
+// in the common case -- a buffered queue with nobody waiting on it -- a
+// put or get need never take the lock.  Everything else (waiters, filters,
+// notification callbacks, errors and closing) is handled under the lock.
+// To keep the two apart, mq_gate holds a count of fast operations in
+// progress, together with flag bits, maintained under the lock, that send
+// new operations down the slow path:
+//
+// - NNI_MSGQ_SLOW_PUT: puts must take the lock (e.g. readers are waiting)
+// - NNI_MSGQ_SLOW_GET: gets must take the lock (e.g. there is a filter)
+// - NNI_MSGQ_HELP: a fast operation that changed the ring must take the
+//   lock afterwards, to let waiters and callbacks see the change.
+// - NNI_MSGQ_QUIESCE: the ring is about to be resized, and the last fast
+//   operation to leave must wake the resizer.
+//
+// A waiter sets the flags before it looks at the ring for the last time,
+// and a fast operation looks at the flags after it has changed the ring,
+// so one of them always notices the other.
+
+#define NNI_MSGQ_QUIESCE (1ull << 60)
+#define NNI_MSGQ_SLOW_PUT (1ull << 61)
+#define NNI_MSGQ_SLOW_GET (1ull << 62)
+#define NNI_MSGQ_HELP (1ull << 63)
+#define NNI_MSGQ_ACTIVE (NNI_MSGQ_QUIESCE - 1)
+
+// Each ring cell carries a sequence number, which says whether it is
+// ready to be written (seq == pos) or read (seq == pos + 1) at a given
+// ring position.  Positions only ever increase.
+typedef struct {
+	nni_atomic_u64 mc_seq;
+	nni_msg *      mc_msg;
+} nni_msgq_cell;
 
 struct nni_msgq {
-	nni_mtx   mq_lock;
-	nni_cv    mq_drained;
-	int       mq_cap;
-	int       mq_alloc; // alloc is cap + 2...
-	int       mq_len;
-	int       mq_get;
-	int       mq_put;
-	int       mq_closed;
-	int       mq_puterr;
-	int       mq_geterr;
-	int       mq_draining;
-	int       mq_besteffort;
-	nni_msg **mq_msgs;
+	nni_mtx        mq_lock;
+	nni_cv         mq_drained;
+	nni_cv         mq_quiet; // fast operations finished, or resize done
+	int            mq_cap;
+	int            mq_alloc; // alloc is cap + 2...
+	int            mq_closed;
+	int            mq_puterr;
+	int            mq_geterr;
+	int            mq_draining;
+	int            mq_besteffort;
+	int            mq_resizing;
+	uint64_t       mq_drops; // messages discarded, for statistics
+	nni_msgq_cell *mq_cells;
+	nni_atomic_u64 mq_gate;
+	nni_atomic_u64 mq_put; // next position to put to
+	nni_atomic_u64 mq_get; // next position to get from
 
 	nni_list mq_aio_putq;
 	nni_list mq_aio_getq;
@@ -44,6 +80,206 @@ struct nni_msgq {
 	void *          mq_filter_arg;
 };
 
+static nni_msgq_cell *
+nni_msgq_cells_alloc(int alloc)
+{
+	nni_msgq_cell *cells;
+
+	if ((cells = nni_alloc(sizeof(*cells) * alloc)) == NULL) {
+		return (NULL);
+	}
+	for (int i = 0; i < alloc; i++) {
+		nni_atomic_init64(&cells[i].mc_seq);
+		nni_atomic_set64(&cells[i].mc_seq, (uint64_t) i);
+		cells[i].mc_msg = NULL;
+	}
+	return (cells);
+}
+
+// nni_msgq_ring_len returns the number of messages in the ring.  Puts and
+// gets that are still in progress are counted as done.
+static int
+nni_msgq_ring_len(nni_msgq *mq)
+{
+	uint64_t get = nni_atomic_get64(&mq->mq_get);
+	uint64_t put = nni_atomic_get64(&mq->mq_put);
+
+	return (put > get ? (int) (put - get) : 0);
+}
+
+// nni_msgq_ring_put adds the message to the ring, if it holds fewer than
+// cap messages.  This is safe to call concurrently with anything except
+// a resize.
+static bool
+nni_msgq_ring_put(nni_msgq *mq, nni_msg *msg, int cap)
+{
+	nni_msgq_cell *cell;
+	uint64_t       pos;
+	int64_t        len;
+	int64_t        dif;
+
+	pos = nni_atomic_get64(&mq->mq_put);
+	for (;;) {
+		len = (int64_t)(pos - nni_atomic_get64(&mq->mq_get));
+		if (len < 0) {
+			// Stale position, others have moved on.
+			pos = nni_atomic_get64(&mq->mq_put);
+			continue;
+		}
+		if (len >= cap) {
+			return (false);
+		}
+		cell = &mq->mq_cells[pos % (uint64_t) mq->mq_alloc];
+		dif  = (int64_t)(nni_atomic_get64(&cell->mc_seq) - pos);
+		if (dif == 0) {
+			if (nni_atomic_cas64(&mq->mq_put, pos, pos + 1)) {
+				break;
+			}
+		} else if (dif < 0) {
+			// A get of this cell is still finishing up.
+			return (false);
+		}
+		pos = nni_atomic_get64(&mq->mq_put);
+	}
+	cell->mc_msg = msg;
+	nni_atomic_set64(&cell->mc_seq, pos + 1);
+	return (true);
+}
+
+// nni_msgq_ring_get removes the oldest message from the ring, returning
+// NULL if there are none.  This is safe to call concurrently with
+// anything except a resize.
+static nni_msg *
+nni_msgq_ring_get(nni_msgq *mq)
+{
+	nni_msgq_cell *cell;
+	nni_msg *      msg;
+	uint64_t       pos;
+	int64_t        dif;
+
+	pos = nni_atomic_get64(&mq->mq_get);
+	for (;;) {
+		cell = &mq->mq_cells[pos % (uint64_t) mq->mq_alloc];
+		dif  = (int64_t)(nni_atomic_get64(&cell->mc_seq) - (pos + 1));
+		if (dif == 0) {
+			if (nni_atomic_cas64(&mq->mq_get, pos, pos + 1)) {
+				break;
+			}
+		} else if (dif < 0) {
+			// Empty, or a put to this cell is still finishing.
+			return (NULL);
+		}
+		pos = nni_atomic_get64(&mq->mq_get);
+	}
+	msg          = cell->mc_msg;
+	cell->mc_msg = NULL;
+	nni_atomic_set64(&cell->mc_seq, pos + (uint64_t) mq->mq_alloc);
+	return (msg);
+}
+
+// nni_msgq_update_gate recomputes the gate flags from the queue state.
+// This must be called, with the lock held, after anything that might
+// change them.
+static void
+nni_msgq_update_gate(nni_msgq *mq)
+{
+	uint64_t flags = 0;
+	uint64_t old;
+
+	if (mq->mq_closed || mq->mq_resizing || (mq->mq_cb_fn != NULL)) {
+		flags |= NNI_MSGQ_SLOW_PUT | NNI_MSGQ_SLOW_GET | NNI_MSGQ_HELP;
+	}
+	if (mq->mq_resizing) {
+		flags |= NNI_MSGQ_QUIESCE;
+	}
+	if (mq->mq_puterr || !nni_list_empty(&mq->mq_aio_getq)) {
+		flags |= NNI_MSGQ_SLOW_PUT;
+	}
+	if (mq->mq_geterr || (mq->mq_filter_fn != NULL) ||
+	    !nni_list_empty(&mq->mq_aio_putq)) {
+		flags |= NNI_MSGQ_SLOW_GET;
+	}
+	if ((!nni_list_empty(&mq->mq_aio_getq)) ||
+	    (!nni_list_empty(&mq->mq_aio_putq))) {
+		flags |= NNI_MSGQ_HELP;
+	}
+	do {
+		old = nni_atomic_get64(&mq->mq_gate);
+		if ((old & ~NNI_MSGQ_ACTIVE) == flags) {
+			break;
+		}
+	} while (!nni_atomic_cas64(
+	    &mq->mq_gate, old, (old & NNI_MSGQ_ACTIVE) | flags));
+}
+
+static void nni_msgq_leave(nni_msgq *, bool);
+
+// nni_msgq_enter starts a fast operation, returning false if the
+// operation must take the slow path instead.
+static bool
+nni_msgq_enter(nni_msgq *mq, uint64_t slow)
+{
+	if ((nni_atomic_get64(&mq->mq_gate) & slow) != 0) {
+		return (false); // don't bother
+	}
+	nni_atomic_inc64(&mq->mq_gate);
+	if ((nni_atomic_get64(&mq->mq_gate) & slow) != 0) {
+		// A resize may have seen us, so we must leave properly.
+		nni_msgq_leave(mq, false);
+		return (false);
+	}
+	return (true);
+}
+
+static void nni_msgq_help(nni_msgq *);
+
+// nni_msgq_leave finishes a fast operation.  If it changed the ring and
+// the slow path needs to know, it helps.  If it was the last one that a
+// resize is waiting for, it wakes the resizer.
+static void
+nni_msgq_leave(nni_msgq *mq, bool changed)
+{
+	uint64_t gate = nni_atomic_dec64_nv(&mq->mq_gate);
+
+	if (((gate & NNI_MSGQ_HELP) != 0) && changed) {
+		nni_msgq_help(mq);
+	}
+	if (((gate & NNI_MSGQ_QUIESCE) != 0) &&
+	    ((gate & NNI_MSGQ_ACTIVE) == 0)) {
+		nni_mtx_lock(&mq->mq_lock);
+		nni_cv_wake(&mq->mq_quiet);
+		nni_mtx_unlock(&mq->mq_lock);
+	}
+}
+
+// nni_msgq_quiesce waits for all fast operations to finish, and keeps new
+// ones from starting until mq_resizing is cleared again, so that the ring
+// can be changed wholesale.  The caller must hold the lock, which is
+// released while waiting.
+static void
+nni_msgq_quiesce(nni_msgq *mq)
+{
+	// Only one resize at a time.
+	while (mq->mq_resizing) {
+		nni_cv_wait(&mq->mq_quiet);
+	}
+	mq->mq_resizing = 1;
+	nni_msgq_update_gate(mq);
+	while ((nni_atomic_get64(&mq->mq_gate) & NNI_MSGQ_ACTIVE) != 0) {
+		nni_cv_wait(&mq->mq_quiet);
+	}
+}
+
+static void
+nni_msgq_ring_flush(nni_msgq *mq)
+{
+	nni_msg *msg;
+
+	while ((msg = nni_msgq_ring_get(mq)) != NULL) {
+		nni_msg_free(msg);
+	}
+}
+
 int
 nni_msgq_init(nni_msgq **mqp, unsigned cap)
 {
@@ -60,7 +296,7 @@ nni_msgq_init(nni_msgq **mqp, unsigned cap)
 	if ((mq = NNI_ALLOC_STRUCT(mq)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	if ((mq->mq_msgs = nni_alloc(sizeof(nng_msg *) * alloc)) == NULL) {
+	if ((mq->mq_cells = nni_msgq_cells_alloc(alloc)) == NULL) {
 		NNI_FREE_STRUCT(mq);
 		return (NNG_ENOMEM);
 	}
@@ -69,16 +305,18 @@ nni_msgq_init(nni_msgq **mqp, unsigned cap)
 	nni_aio_list_init(&mq->mq_aio_getq);
 	nni_mtx_init(&mq->mq_lock);
 	nni_cv_init(&mq->mq_drained, &mq->mq_lock);
+	nni_cv_init(&mq->mq_quiet, &mq->mq_lock);
+	nni_atomic_init64(&mq->mq_gate);
+	nni_atomic_init64(&mq->mq_put);
+	nni_atomic_init64(&mq->mq_get);
 
 	mq->mq_cap      = cap;
 	mq->mq_alloc    = alloc;
-	mq->mq_len      = 0;
-	mq->mq_get      = 0;
-	mq->mq_put      = 0;
 	mq->mq_closed   = 0;
 	mq->mq_puterr   = 0;
 	mq->mq_geterr   = 0;
 	mq->mq_draining = 0;
+	mq->mq_drops    = 0;
 	*mqp            = mq;
 
 	return (0);
@@ -87,26 +325,17 @@ nni_msgq_init(nni_msgq **mqp, unsigned cap)
 void
 nni_msgq_fini(nni_msgq *mq)
 {
-	nni_msg *msg;
-
 	if (mq == NULL) {
 		return;
 	}
+	nni_cv_fini(&mq->mq_quiet);
 	nni_cv_fini(&mq->mq_drained);
 	nni_mtx_fini(&mq->mq_lock);
 
 	/* Free any orphaned messages. */
-	while (mq->mq_len > 0) {
-		msg = mq->mq_msgs[mq->mq_get];
-		mq->mq_get++;
-		if (mq->mq_get >= mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
-		nni_msg_free(msg);
-	}
+	nni_msgq_ring_flush(mq);
 
-	nni_free(mq->mq_msgs, mq->mq_alloc * sizeof(nng_msg *));
+	nni_free(mq->mq_cells, mq->mq_alloc * sizeof(nni_msgq_cell));
 	NNI_FREE_STRUCT(mq);
 }
 
@@ -124,6 +353,7 @@ nni_msgq_set_get_error(nni_msgq *mq, int error)
 		}
 	}
 	mq->mq_geterr = error;
+	nni_msgq_update_gate(mq);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -141,6 +371,7 @@ nni_msgq_set_put_error(nni_msgq *mq, int error)
 		}
 	}
 	mq->mq_puterr = error;
+	nni_msgq_update_gate(mq);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -160,14 +391,18 @@ nni_msgq_set_error(nni_msgq *mq, int error)
 	}
 	mq->mq_puterr = error;
 	mq->mq_geterr = error;
+	nni_msgq_update_gate(mq);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
 void
 nni_msgq_set_filter(nni_msgq *mq, nni_msgq_filter filter, void *arg)
 {
+	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_filter_fn  = filter;
 	mq->mq_filter_arg = arg;
+	nni_msgq_update_gate(mq);
+	nni_mtx_unlock(&mq->mq_lock);
 }
 
 static void
@@ -196,6 +431,8 @@ nni_msgq_run_putq(nni_msgq *mq)
 			if (msg != NULL) {
 				nni_aio_list_remove(raio);
 				nni_aio_finish_msg(raio, msg);
+			} else {
+				mq->mq_drops++;
 			}
 
 			nni_aio_finish(waio, 0, len);
@@ -203,13 +440,8 @@ nni_msgq_run_putq(nni_msgq *mq)
 		}
 
 		// Otherwise if we have room in the buffer, just queue it.
-		if (mq->mq_len < mq->mq_cap) {
+		if (nni_msgq_ring_put(mq, msg, mq->mq_cap)) {
 			nni_list_remove(&mq->mq_aio_putq, waio);
-			mq->mq_msgs[mq->mq_put++] = msg;
-			if (mq->mq_put == mq->mq_alloc) {
-				mq->mq_put = 0;
-			}
-			mq->mq_len++;
 			nni_aio_set_msg(waio, NULL);
 			nni_aio_finish(waio, 0, len);
 			continue;
@@ -221,6 +453,7 @@ nni_msgq_run_putq(nni_msgq *mq)
 			nni_list_remove(&mq->mq_aio_putq, waio);
 			nni_aio_set_msg(waio, NULL);
 			nni_msg_free(msg);
+			mq->mq_drops++;
 			nni_aio_finish(waio, 0, len);
 			continue;
 		}
@@ -237,6 +470,7 @@ nni_msgq_set_best_effort(nni_msgq *mq, int on)
 	mq->mq_besteffort = on;
 	if (on) {
 		nni_msgq_run_putq(mq);
+		nni_msgq_update_gate(mq);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 }
@@ -248,28 +482,25 @@ nni_msgq_run_getq(nni_msgq *mq)
 	nni_aio *waio;
 
 	while ((raio = nni_list_first(&mq->mq_aio_getq)) != NULL) {
-		// If anything is waiting in the queue, get it first.
-		if (mq->mq_len != 0) {
-			nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-			if (mq->mq_get == mq->mq_alloc) {
-				mq->mq_get = 0;
-			}
-			mq->mq_len--;
+		nni_msg *msg;
 
+		// If anything is waiting in the queue, get it first.
+		if ((msg = nni_msgq_ring_get(mq)) != NULL) {
 			if (mq->mq_filter_fn != NULL) {
 				msg = mq->mq_filter_fn(mq->mq_filter_arg, msg);
 			}
 			if (msg != NULL) {
 				nni_aio_list_remove(raio);
 				nni_aio_finish_msg(raio, msg);
+			} else {
+				mq->mq_drops++;
 			}
 			continue;
 		}
 
 		// Nothing queued (unbuffered?), maybe a writer is waiting.
 		if ((waio = nni_list_first(&mq->mq_aio_putq)) != NULL) {
-			nni_msg *msg;
-			size_t   len;
+			size_t len;
 			msg = nni_aio_get_msg(waio);
 			len = nni_msg_len(msg);
 
@@ -282,6 +513,8 @@ nni_msgq_run_getq(nni_msgq *mq)
 			if (msg != NULL) {
 				nni_aio_list_remove(raio);
 				nni_aio_finish_msg(raio, msg);
+			} else {
+				mq->mq_drops++;
 			}
 
 			nni_aio_finish(waio, 0, len);
@@ -297,34 +530,55 @@ nni_msgq_run_getq(nni_msgq *mq)
 static void
 nni_msgq_run_notify(nni_msgq *mq)
 {
+	int len = nni_msgq_ring_len(mq);
+
 	if (mq->mq_cb_fn != NULL) {
 		int flags = 0;
 
 		if (mq->mq_closed) {
 			flags |= nni_msgq_f_closed;
 		}
-		if (mq->mq_len == 0) {
+		if (len == 0) {
 			flags |= nni_msgq_f_empty;
-		} else if (mq->mq_len == mq->mq_cap) {
+		} else if (len == mq->mq_cap) {
 			flags |= nni_msgq_f_full;
 		}
-		if (mq->mq_len < mq->mq_cap ||
-		    !nni_list_empty(&mq->mq_aio_getq)) {
+		if (len < mq->mq_cap || !nni_list_empty(&mq->mq_aio_getq)) {
 			flags |= nni_msgq_f_can_put;
 		}
-		if ((mq->mq_len != 0) || !nni_list_empty(&mq->mq_aio_putq)) {
+		if ((len != 0) || !nni_list_empty(&mq->mq_aio_putq)) {
 			flags |= nni_msgq_f_can_get;
 		}
 		mq->mq_cb_fn(mq->mq_cb_arg, flags);
 	}
 
 	if (mq->mq_draining) {
-		if ((mq->mq_len == 0) && !nni_list_empty(&mq->mq_aio_putq)) {
+		if ((len == 0) && !nni_list_empty(&mq->mq_aio_putq)) {
 			nni_cv_wake(&mq->mq_drained);
 		}
 	}
 }
 
+// nni_msgq_help runs the slow path on behalf of a fast operation that
+// changed the ring while someone else was waiting on it.
+static void
+nni_msgq_help(nni_msgq *mq)
+{
+	nni_mtx_lock(&mq->mq_lock);
+	if (mq->mq_closed) {
+		// We lost a race with close; nobody can get this now.
+		if (!mq->mq_draining) {
+			nni_msgq_ring_flush(mq);
+		}
+	} else {
+		nni_msgq_run_putq(mq);
+		nni_msgq_run_getq(mq);
+	}
+	nni_msgq_run_notify(mq);
+	nni_msgq_update_gate(mq);
+	nni_mtx_unlock(&mq->mq_lock);
+}
+
 void
 nni_msgq_set_cb(nni_msgq *mq, nni_msgq_cb fn, void *arg)
 {
@@ -332,6 +586,7 @@ nni_msgq_set_cb(nni_msgq *mq, nni_msgq_cb fn, void *arg)
 	mq->mq_cb_fn  = fn;
 	mq->mq_cb_arg = arg;
 	nni_msgq_run_notify(mq);
+	nni_msgq_update_gate(mq);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -344,59 +599,125 @@ nni_msgq_cancel(nni_aio *aio, int rv)
 	if (nni_aio_list_active(aio)) {
 		nni_aio_list_remove(aio);
 		nni_aio_finish_error(aio, rv);
+		nni_msgq_update_gate(mq);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
-void
-nni_msgq_aio_put(nni_msgq *mq, nni_aio *aio)
+static void
+nni_msgq_aio_put_locked(nni_msgq *mq, nni_aio *aio)
 {
-	nni_mtx_lock(&mq->mq_lock);
-	if (nni_aio_start(aio, nni_msgq_cancel, mq) != 0) {
-		nni_mtx_unlock(&mq->mq_lock);
-		return;
-	}
 	if (mq->mq_closed) {
 		nni_aio_finish_error(aio, NNG_ECLOSED);
-		nni_mtx_unlock(&mq->mq_lock);
 		return;
 	}
 	if (mq->mq_puterr) {
 		nni_aio_finish_error(aio, mq->mq_puterr);
-		nni_mtx_unlock(&mq->mq_lock);
 		return;
 	}
 
 	nni_aio_list_append(&mq->mq_aio_putq, aio);
+	nni_msgq_update_gate(mq);
 	nni_msgq_run_putq(mq);
 	nni_msgq_run_notify(mq);
-
-	nni_mtx_unlock(&mq->mq_lock);
+	nni_msgq_update_gate(mq);
 }
 
 void
-nni_msgq_aio_get(nni_msgq *mq, nni_aio *aio)
+nni_msgq_aio_put(nni_msgq *mq, nni_aio *aio)
 {
-	nni_mtx_lock(&mq->mq_lock);
-	if (nni_aio_start(aio, nni_msgq_cancel, mq) != 0) {
-		nni_mtx_unlock(&mq->mq_lock);
-		return;
+	// We only try the fast path if it looks like there is room; only
+	// then do we commit to it by starting the aio.
+	if ((nni_msgq_ring_len(mq) < mq->mq_cap) &&
+	    nni_msgq_enter(mq, NNI_MSGQ_SLOW_PUT)) {
+		nni_msg *msg;
+		size_t   len;
+		bool     ok;
+
+		if (nni_aio_begin(aio) != 0) {
+			nni_msgq_leave(mq, false);
+			return;
+		}
+		msg = nni_aio_get_msg(aio);
+		len = nni_msg_len(msg);
+		ok  = nni_msgq_ring_put(mq, msg, mq->mq_cap);
+		nni_msgq_leave(mq, ok);
+		if (ok) {
+			nni_aio_set_msg(aio, NULL);
+			nni_aio_finish(aio, 0, len);
+			return;
+		}
+
+		// Someone beat us to the room; wait in the usual way.
+		nni_mtx_lock(&mq->mq_lock);
+		if (nni_aio_schedule(aio, nni_msgq_cancel, mq) != 0) {
+			nni_mtx_unlock(&mq->mq_lock);
+			return;
+		}
+	} else {
+		nni_mtx_lock(&mq->mq_lock);
+		if (nni_aio_start(aio, nni_msgq_cancel, mq) != 0) {
+			nni_mtx_unlock(&mq->mq_lock);
+			return;
+		}
 	}
+	nni_msgq_aio_put_locked(mq, aio);
+	nni_mtx_unlock(&mq->mq_lock);
+}
+
+static void
+nni_msgq_aio_get_locked(nni_msgq *mq, nni_aio *aio)
+{
 	if (mq->mq_closed) {
 		nni_aio_finish_error(aio, NNG_ECLOSED);
-		nni_mtx_unlock(&mq->mq_lock);
 		return;
 	}
 	if (mq->mq_geterr) {
 		nni_aio_finish_error(aio, mq->mq_geterr);
-		nni_mtx_unlock(&mq->mq_lock);
 		return;
 	}
 
 	nni_aio_list_append(&mq->mq_aio_getq, aio);
+	nni_msgq_update_gate(mq);
 	nni_msgq_run_getq(mq);
 	nni_msgq_run_notify(mq);
+	nni_msgq_update_gate(mq);
+}
+
+void
+nni_msgq_aio_get(nni_msgq *mq, nni_aio *aio)
+{
+	// As with put, only commit to the fast path if there is a message
+	// there for us to take.
+	if ((nni_msgq_ring_len(mq) > 0) &&
+	    nni_msgq_enter(mq, NNI_MSGQ_SLOW_GET)) {
+		nni_msg *msg;
+
+		if (nni_aio_begin(aio) != 0) {
+			nni_msgq_leave(mq, false);
+			return;
+		}
+		msg = nni_msgq_ring_get(mq);
+		nni_msgq_leave(mq, msg != NULL);
+		if (msg != NULL) {
+			nni_aio_finish_msg(aio, msg);
+			return;
+		}
 
+		// Someone beat us to the message; wait in the usual way.
+		nni_mtx_lock(&mq->mq_lock);
+		if (nni_aio_schedule(aio, nni_msgq_cancel, mq) != 0) {
+			nni_mtx_unlock(&mq->mq_lock);
+			return;
+		}
+	} else {
+		nni_mtx_lock(&mq->mq_lock);
+		if (nni_aio_start(aio, nni_msgq_cancel, mq) != 0) {
+			nni_mtx_unlock(&mq->mq_lock);
+			return;
+		}
+	}
+	nni_msgq_aio_get_locked(mq, aio);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -405,11 +726,23 @@ nni_msgq_tryput(nni_msgq *mq, nni_msg *msg)
 {
 	nni_aio *raio;
 
+	if (nni_msgq_enter(mq, NNI_MSGQ_SLOW_PUT)) {
+		bool ok = nni_msgq_ring_put(mq, msg, mq->mq_cap);
+
+		nni_msgq_leave(mq, ok);
+		return (ok ? 0 : NNG_EAGAIN);
+	}
+
 	nni_mtx_lock(&mq->mq_lock);
 	if (mq->mq_closed) {
 		nni_mtx_unlock(&mq->mq_lock);
 		return (NNG_ECLOSED);
 	}
+	if (mq->mq_puterr) {
+		int rv = mq->mq_puterr;
+		nni_mtx_unlock(&mq->mq_lock);
+		return (rv);
+	}
 
 	// The presence of any blocked reader indicates that
 	// the queue is empty, otherwise it would have just taken
@@ -418,17 +751,15 @@ nni_msgq_tryput(nni_msgq *mq, nni_msg *msg)
 		nni_list_remove(&mq->mq_aio_getq, raio);
 
 		nni_aio_finish_msg(raio, msg);
+		nni_msgq_run_notify(mq);
+		nni_msgq_update_gate(mq);
 		nni_mtx_unlock(&mq->mq_lock);
 		return (0);
 	}
 
 	// Otherwise if we have room in the buffer, just queue it.
-	if (mq->mq_len < mq->mq_cap) {
-		mq->mq_msgs[mq->mq_put++] = msg;
-		if (mq->mq_put == mq->mq_alloc) {
-			mq->mq_put = 0;
-		}
-		mq->mq_len++;
+	if (nni_msgq_ring_put(mq, msg, mq->mq_cap)) {
+		nni_msgq_run_notify(mq);
 		nni_mtx_unlock(&mq->mq_lock);
 		return (0);
 	}
@@ -437,6 +768,64 @@ nni_msgq_tryput(nni_msgq *mq, nni_msg *msg)
 	return (NNG_EAGAIN);
 }
 
+int
+nni_msgq_tryget(nni_msgq *mq, nni_msg **msgp)
+{
+	nni_aio *waio;
+	nni_msg *msg;
+	int      rv;
+
+	if (nni_msgq_enter(mq, NNI_MSGQ_SLOW_GET)) {
+		msg = nni_msgq_ring_get(mq);
+		nni_msgq_leave(mq, msg != NULL);
+		if (msg == NULL) {
+			return (NNG_EAGAIN);
+		}
+		*msgp = msg;
+		return (0);
+	}
+
+	nni_mtx_lock(&mq->mq_lock);
+	if (mq->mq_closed) {
+		nni_mtx_unlock(&mq->mq_lock);
+		return (NNG_ECLOSED);
+	}
+	if (mq->mq_geterr) {
+		rv = mq->mq_geterr;
+		nni_mtx_unlock(&mq->mq_lock);
+		return (rv);
+	}
+
+	rv = NNG_EAGAIN;
+	for (;;) {
+		if ((msg = nni_msgq_ring_get(mq)) != NULL) {
+			// We made room, so a blocked writer may proceed.
+			nni_msgq_run_putq(mq);
+		} else if ((waio = nni_list_first(&mq->mq_aio_putq)) != NULL) {
+			// Unbuffered, take it straight from the writer.
+			msg = nni_aio_get_msg(waio);
+			nni_aio_set_msg(waio, NULL);
+			nni_aio_list_remove(waio);
+			nni_aio_finish(waio, 0, nni_msg_len(msg));
+		} else {
+			break;
+		}
+		if (mq->mq_filter_fn != NULL) {
+			msg = mq->mq_filter_fn(mq->mq_filter_arg, msg);
+		}
+		if (msg != NULL) {
+			*msgp = msg;
+			rv    = 0;
+			break;
+		}
+		mq->mq_drops++;
+	}
+	nni_msgq_run_notify(mq);
+	nni_msgq_update_gate(mq);
+	nni_mtx_unlock(&mq->mq_lock);
+	return (rv);
+}
+
 void
 nni_msgq_drain(nni_msgq *mq, nni_time expire)
 {
@@ -445,7 +834,9 @@ nni_msgq_drain(nni_msgq *mq, nni_time expire)
 	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_closed   = 1;
 	mq->mq_draining = 1;
-	while ((mq->mq_len > 0) || !nni_list_empty(&mq->mq_aio_putq)) {
+	nni_msgq_update_gate(mq);
+	while ((nni_msgq_ring_len(mq) > 0) ||
+	    !nni_list_empty(&mq->mq_aio_putq)) {
 		if (nni_cv_until(&mq->mq_drained, expire) != 0) {
 			break;
 		}
@@ -460,14 +851,8 @@ nni_msgq_drain(nni_msgq *mq, nni_time expire)
 	}
 
 	// Free any remaining messages in the queue.
-	while (mq->mq_len > 0) {
-		nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get >= mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
-		nni_msg_free(msg);
-	}
+	nni_msgq_ring_flush(mq);
+	nni_msgq_update_gate(mq);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -478,16 +863,10 @@ nni_msgq_close(nni_msgq *mq)
 
 	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_closed = 1;
+	nni_msgq_update_gate(mq);
 
 	// Free the messages orphaned in the queue.
-	while (mq->mq_len > 0) {
-		nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get >= mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
-		nni_msg_free(msg);
-	}
+	nni_msgq_ring_flush(mq);
 
 	// Let all pending blockers know we are closing the queue.
 	while (((aio = nni_list_first(&mq->mq_aio_getq)) != NULL) ||
@@ -502,10 +881,16 @@ nni_msgq_close(nni_msgq *mq)
 int
 nni_msgq_len(nni_msgq *mq)
 {
-	int rv;
+	return (nni_msgq_ring_len(mq));
+}
+
+uint64_t
+nni_msgq_drops(nni_msgq *mq)
+{
+	uint64_t rv;
 
 	nni_mtx_lock(&mq->mq_lock);
-	rv = mq->mq_len;
+	rv = mq->mq_drops;
 	nni_mtx_unlock(&mq->mq_lock);
 	return (rv);
 }
@@ -524,18 +909,17 @@ nni_msgq_cap(nni_msgq *mq)
 int
 nni_msgq_resize(nni_msgq *mq, int cap)
 {
-	int       alloc;
-	nni_msg * msg;
-	nni_msg **newq, **oldq;
-	int       oldget;
-	int       oldlen;
-	int       oldalloc;
+	int            alloc;
+	nni_msg *      msg;
+	nni_msgq_cell *newq, *oldq;
+	uint64_t       oldget;
+	uint64_t       oldput;
+	int            oldalloc;
 
 	alloc = cap + 2;
 
 	if (alloc > mq->mq_alloc) {
-		newq = nni_alloc(sizeof(nni_msg *) * alloc);
-		if (newq == NULL) {
+		if ((newq = nni_msgq_cells_alloc(alloc)) == NULL) {
 			return (NNG_ENOMEM);
 		}
 	} else {
@@ -543,16 +927,20 @@ nni_msgq_resize(nni_msgq *mq, int cap)
 	}
 
 	nni_mtx_lock(&mq->mq_lock);
-	while (mq->mq_len > (cap + 1)) {
+	// We need the ring to ourselves for this.  Another resize may have
+	// run while we waited, so the new cells might not be needed now.
+	nni_msgq_quiesce(mq);
+	if ((newq != NULL) && (alloc <= mq->mq_alloc)) {
+		nni_free(newq, sizeof(nni_msgq_cell) * alloc);
+		newq = NULL;
+	}
+	while (nni_msgq_ring_len(mq) > (cap + 1)) {
 		// too many messages -- we allow that one for
 		// the case of pushback or cap == 0.
 		// we delete the oldest messages first
-		msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get > mq->mq_alloc) {
-			mq->mq_get = 0;
-		}
-		mq->mq_len--;
+		msg = nni_msgq_ring_get(mq);
 		nni_msg_free(msg);
+		mq->mq_drops++;
 	}
 	if (newq == NULL) {
 		// Just shrinking the queue, no changes
@@ -560,32 +948,31 @@ nni_msgq_resize(nni_msgq *mq, int cap)
 		goto out;
 	}
 
-	oldq     = mq->mq_msgs;
-	oldget   = mq->mq_get;
+	oldq     = mq->mq_cells;
 	oldalloc = mq->mq_alloc;
-	oldlen   = mq->mq_len;
-
-	mq->mq_msgs = newq;
-	mq->mq_len = mq->mq_get = mq->mq_put = 0;
-	mq->mq_cap                           = cap;
-	mq->mq_alloc                         = alloc;
-
-	while (oldlen) {
-		mq->mq_msgs[mq->mq_put++] = oldq[oldget++];
-		if (oldget == oldalloc) {
-			oldget = 0;
-		}
-		if (mq->mq_put == mq->mq_alloc) {
-			mq->mq_put = 0;
-		}
-		mq->mq_len++;
-		oldlen--;
+	oldget   = nni_atomic_get64(&mq->mq_get);
+	oldput   = nni_atomic_get64(&mq->mq_put);
+
+	// Nothing else is touching the ring, so we can just lay the
+	// messages out again from the start.
+	mq->mq_cells = newq;
+	mq->mq_cap   = cap;
+	mq->mq_alloc = alloc;
+	nni_atomic_set64(&mq->mq_get, 0);
+	nni_atomic_set64(&mq->mq_put, 0);
+	while (oldget != oldput) {
+		msg = oldq[oldget % (uint64_t) oldalloc].mc_msg;
+		(void) nni_msgq_ring_put(mq, msg, alloc);
+		oldget++;
 	}
-	nni_free(oldq, sizeof(nni_msg *) * oldalloc);
+	nni_free(oldq, sizeof(nni_msgq_cell) * oldalloc);
 
 out:
+	mq->mq_resizing = 0;
+	nni_msgq_update_gate(mq);
 	// Wake everyone up -- we changed everything.
 	nni_cv_wake(&mq->mq_drained);
+	nni_cv_wake(&mq->mq_quiet);
 	nni_mtx_unlock(&mq->mq_lock);
 	return (0);
 }
@@ -44,6 +44,11 @@ extern void nni_msgq_aio_get(nni_msgq *, nni_aio *);
 // a zero time.
 extern int nni_msgq_tryput(nni_msgq *, nni_msg *);
 
+// nni_msgq_tryget performs a non-blocking attempt to get a message from
+// the message queue, returning NNG_EAGAIN if none is available.  Any
+// filter is applied as usual; filtered messages are not returned.
+extern int nni_msgq_tryget(nni_msgq *, nni_msg **);
+
 // nni_msgq_set_error sets an error condition on the message queue,
 // which causes all current and future readers/writes to return the
 // given error condition (if non-zero).  Threads waiting to put or get
@@ -129,4 +134,9 @@ extern int nni_msgq_cap(nni_msgq *mq);
 // nni_msgq_len returns the number of messages currently in the queue.
 extern int nni_msgq_len(nni_msgq *mq);
 
+// nni_msgq_drops returns the number of messages the queue has discarded,
+// whether rejected by the filter, lost in best effort mode, or removed
+// by a resize.  Messages freed when the queue is closed are not counted.
+extern uint64_t nni_msgq_drops(nni_msgq *mq);
+
 #endif // CORE_MSQUEUE_H
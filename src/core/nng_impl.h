@@ -30,16 +30,19 @@
 #include "core/clock.h"
 #include "core/device.h"
 #include "core/file.h"
+#include "core/hdltab.h"
 #include "core/idhash.h"
 #include "core/init.h"
 #include "core/list.h"
 #include "core/message.h"
+#include "core/msgpool.h"
 #include "core/msgqueue.h"
 #include "core/options.h"
 #include "core/panic.h"
 #include "core/protocol.h"
 #include "core/random.h"
 #include "core/reap.h"
+#include "core/stats.h"
 #include "core/strs.h"
 #include "core/taskq.h"
 #include "core/thread.h"
@@ -10,6 +10,7 @@
 
 #include "core/nng_impl.h"
 
+#include <stdio.h>
 #include <string.h>
 
 // This file contains functions relating to pipes.
@@ -18,25 +19,53 @@
 // performed in the context of the protocol.
 
 struct nni_pipe {
-	uint64_t      p_id;
-	nni_tran_pipe p_tran_ops;
-	void *        p_tran_data;
-	void *        p_proto_data;
-	nni_list_node p_sock_node;
-	nni_list_node p_ep_node;
-	nni_sock *    p_sock;
-	nni_ep *      p_ep;
-	int           p_reap;
-	int           p_stop;
-	int           p_refcnt;
-	nni_mtx       p_mtx;
-	nni_cv        p_cv;
-	nni_list_node p_reap_node;
-	nni_aio *     p_start_aio;
+	uint64_t       p_id;
+	nni_tran_pipe  p_tran_ops;
+	void *         p_tran_data;
+	void *         p_proto_data;
+	nni_list_node  p_sock_node;
+	nni_list_node  p_ep_node;
+	nni_sock *     p_sock;
+	nni_ep *       p_ep;
+	int            p_reap;
+	int            p_stop;
+	nni_atomic_u64 p_refcnt; // lookups, plus one held by the pipe itself
+	nni_mtx        p_mtx;
+	nni_list_node  p_reap_node;
+	nni_aio *      p_start_aio;
+
+	nni_stat_item p_stats; // group, named for the pipe id
+	nni_stat_item p_txmsgs;
+	nni_stat_item p_rxmsgs;
+	nni_stat_item p_txbytes;
+	nni_stat_item p_rxbytes;
+	nni_stat_item p_drops;
 };
 
-static nni_idhash *nni_pipes;
+// Each send in an nni_pipe_sender's window has one of these, so that its
+// callback knows which one completed.
+typedef struct {
+	nni_list_node    ss_node; // on ps_idle while not in use
+	nni_pipe_sender *ss_sender;
+	nni_aio *        ss_aio;
+} nni_pipe_send_slot;
+
+struct nni_pipe_sender {
+	nni_pipe *          ps_pipe;
+	nni_msgq *          ps_mq;
+	nni_aio *           ps_getq;
+	bool                ps_getting; // ps_getq is scheduled
+	nni_pipe_send_slot *ps_slots;
+	int                 ps_nslots;
+	nni_list            ps_idle;
+	nni_mtx             ps_mtx;
+	int (*ps_prep)(void *, nni_msg *);
+	void *ps_arg;
+};
+
+static nni_hdltab *nni_pipes;
 static nni_mtx     nni_pipe_lk;
+static nni_cv      nni_pipe_cv; // wakes destroy when references drain
 
 static nni_list nni_pipe_reap_list;
 static nni_mtx  nni_pipe_reap_lk;
@@ -53,10 +82,11 @@ nni_pipe_sys_init(void)
 
 	NNI_LIST_INIT(&nni_pipe_reap_list, nni_pipe, p_reap_node);
 	nni_mtx_init(&nni_pipe_lk);
+	nni_cv_init(&nni_pipe_cv, &nni_pipe_lk);
 	nni_mtx_init(&nni_pipe_reap_lk);
 	nni_cv_init(&nni_pipe_reap_cv, &nni_pipe_reap_lk);
 
-	if (((rv = nni_idhash_init(&nni_pipes)) != 0) ||
+	if (((rv = nni_hdltab_init(&nni_pipes)) != 0) ||
 	    ((rv = nni_thr_init(&nni_pipe_reap_thr, nni_pipe_reaper, 0)) !=
 	        0)) {
 		return (rv);
@@ -67,7 +97,7 @@ nni_pipe_sys_init(void)
 	// if we supply an out of range value (0).  (Consequently the
 	// value "1" has a bias -- its roughly twice as likely to be
 	// chosen as any other value.  This does not mater.)
-	nni_idhash_set_limits(
+	nni_hdltab_set_limits(
 	    nni_pipes, 1, 0x7fffffff, nni_random() & 0x7fffffff);
 
 	nni_pipe_reap_run = 1;
@@ -89,9 +119,10 @@ nni_pipe_sys_fini(void)
 	nni_thr_fini(&nni_pipe_reap_thr);
 	nni_cv_fini(&nni_pipe_reap_cv);
 	nni_mtx_fini(&nni_pipe_reap_lk);
+	nni_cv_fini(&nni_pipe_cv);
 	nni_mtx_fini(&nni_pipe_lk);
 	if (nni_pipes != NULL) {
-		nni_idhash_fini(nni_pipes);
+		nni_hdltab_fini(nni_pipes);
 		nni_pipes = NULL;
 	}
 }
@@ -107,16 +138,24 @@ nni_pipe_destroy(nni_pipe *p)
 	nni_aio_stop(p->p_start_aio);
 
 	// Make sure any unlocked holders are done with this.
-	// This happens during initialization for example.
-	nni_mtx_lock(&nni_pipe_lk);
+	// This happens during initialization for example.  Once removed
+	// from the table, no new references can be taken.
 	if (p->p_id != 0) {
-		nni_idhash_remove(nni_pipes, p->p_id);
+		nni_hdltab_remove(nni_pipes, p->p_id);
 	}
-	while (p->p_refcnt != 0) {
-		nni_cv_wait(&p->p_cv);
+	// Drop the pipe's own reference, then wait for the count to
+	// drain.  Only once that reference is gone can the count reach
+	// zero, so the final release knows a destroy is waiting.
+	nni_mtx_lock(&nni_pipe_lk);
+	(void) nni_atomic_dec64_nv(&p->p_refcnt);
+	while (nni_atomic_get64(&p->p_refcnt) != 0) {
+		nni_cv_wait(&nni_pipe_cv);
 	}
 	nni_mtx_unlock(&nni_pipe_lk);
 
+	// Detach statistics so snapshots no longer see us.
+	nni_stat_remove(&p->p_stats);
+
 	// We have exclusive access at this point, so we can check if
 	// we are still on any lists.
 
@@ -135,29 +174,39 @@ nni_pipe_destroy(nni_pipe *p)
 	NNI_FREE_STRUCT(p);
 }
 
+static int
+nni_pipe_hold(void *arg)
+{
+	nni_pipe *p = arg;
+
+	nni_atomic_inc64(&p->p_refcnt);
+	return (0);
+}
+
 int
 nni_pipe_find(nni_pipe **pp, uint32_t id)
 {
 	int       rv;
 	nni_pipe *p;
-	nni_mtx_lock(&nni_pipe_lk);
-	if ((rv = nni_idhash_find(nni_pipes, id, (void **) &p)) == 0) {
-		p->p_refcnt++;
+
+	rv = nni_hdltab_find(nni_pipes, id, nni_pipe_hold, (void **) &p);
+	if (rv == 0) {
 		*pp = p;
 	}
-	nni_mtx_unlock(&nni_pipe_lk);
 	return (rv);
 }
 
 void
 nni_pipe_rele(nni_pipe *p)
 {
-	nni_mtx_lock(&nni_pipe_lk);
-	p->p_refcnt--;
-	if (p->p_refcnt == 0) {
-		nni_cv_wake(&p->p_cv);
+	// The count only reaches zero after destroy has dropped the
+	// pipe's own reference, and destroy may free the pipe as soon as
+	// it sees that, so we must not touch the pipe afterwards.
+	if (nni_atomic_dec64_nv(&p->p_refcnt) == 0) {
+		nni_mtx_lock(&nni_pipe_lk);
+		nni_cv_wake(&nni_pipe_cv);
+		nni_mtx_unlock(&nni_pipe_lk);
 	}
-	nni_mtx_unlock(&nni_pipe_lk);
 }
 
 // nni_pipe_id returns the 32-bit pipe id, which can be used in backtraces.
@@ -176,9 +225,79 @@ nni_pipe_recv(nni_pipe *p, nni_aio *aio)
 void
 nni_pipe_send(nni_pipe *p, nni_aio *aio)
 {
+	nni_msg *msg = nni_aio_get_msg(aio);
+	uint64_t sz  = nni_msg_len(msg) + nni_msg_header_len(msg);
+
+	// We count the message when it is handed to the transport; a
+	// failure to send it will close the pipe anyway.
+	nni_stat_inc(&p->p_txmsgs, 1);
+	nni_stat_inc(&p->p_txbytes, sz);
+	nni_sock_bump_tx(p->p_sock, sz);
 	p->p_tran_ops.p_send(p->p_tran_data, aio);
 }
 
+int
+nni_pipe_sendwin(nni_pipe *p)
+{
+	int n = 1;
+
+	if (p->p_tran_ops.p_sendwin != NULL) {
+		n = p->p_tran_ops.p_sendwin(p->p_tran_data);
+	}
+	return (n > 0 ? n : 1);
+}
+
+void
+nni_pipe_bump_rx(nni_pipe *p, size_t sz)
+{
+	nni_stat_inc(&p->p_rxmsgs, 1);
+	nni_stat_inc(&p->p_rxbytes, sz);
+	nni_sock_bump_rx(p->p_sock, sz);
+}
+
+void
+nni_pipe_bump_drop(nni_pipe *p)
+{
+	nni_stat_inc(&p->p_drops, 1);
+	nni_sock_bump_drop(p->p_sock);
+}
+
+nni_stat_item *
+nni_pipe_stats(nni_pipe *p)
+{
+	return (&p->p_stats);
+}
+
+static void
+nni_pipe_stats_init(nni_pipe *p)
+{
+	char name[NNI_STAT_NAMELEN];
+
+	(void) snprintf(name, sizeof(name), "pipe.%u", (unsigned) p->p_id);
+	nni_stat_init_group(&p->p_stats, name);
+
+	nni_stat_init(&p->p_txmsgs, "tx_msgs", "messages sent",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_init(&p->p_rxmsgs, "rx_msgs", "messages received",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_init(&p->p_txbytes, "tx_bytes", "bytes sent",
+	    NNG_STAT_COUNTER, NNG_UNIT_BYTES);
+	nni_stat_init(&p->p_rxbytes, "rx_bytes", "bytes received",
+	    NNG_STAT_COUNTER, NNG_UNIT_BYTES);
+	nni_stat_init(&p->p_drops, "drops", "messages dropped",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+
+	nni_stat_append(&p->p_stats, &p->p_txmsgs);
+	nni_stat_append(&p->p_stats, &p->p_rxmsgs);
+	nni_stat_append(&p->p_stats, &p->p_txbytes);
+	nni_stat_append(&p->p_stats, &p->p_rxbytes);
+	nni_stat_append(&p->p_stats, &p->p_drops);
+
+	if (p->p_tran_ops.p_stats != NULL) {
+		p->p_tran_ops.p_stats(p->p_tran_data, &p->p_stats);
+	}
+}
+
 // nni_pipe_close closes the underlying connection.  It is expected that
 // subsequent attempts receive or send (including any waiting receive) will
 // simply return NNG_ECLOSED.
@@ -272,12 +391,15 @@ nni_pipe_create(nni_ep *ep, void *tdata)
 	NNI_LIST_NODE_INIT(&p->p_sock_node);
 	NNI_LIST_NODE_INIT(&p->p_ep_node);
 
+	nni_atomic_init64(&p->p_refcnt);
+	nni_atomic_set64(&p->p_refcnt, 1);
 	nni_mtx_init(&p->p_mtx);
-	nni_cv_init(&p->p_cv, &nni_pipe_lk);
+	nni_stat_init_group(&p->p_stats, "pipe");
 	if ((rv = nni_aio_init(&p->p_start_aio, nni_pipe_start_cb, p)) == 0) {
-		nni_mtx_lock(&nni_pipe_lk);
-		rv = nni_idhash_alloc(nni_pipes, &p->p_id, p);
-		nni_mtx_unlock(&nni_pipe_lk);
+		rv = nni_hdltab_alloc(nni_pipes, &p->p_id, p);
+	}
+	if (rv == 0) {
+		nni_pipe_stats_init(p);
 	}
 
 	if ((rv != 0) || ((rv = nni_ep_pipe_add(ep, p)) != 0) ||
@@ -363,3 +485,154 @@ nni_pipe_reaper(void *notused)
 	}
 	nni_mtx_unlock(&nni_pipe_reap_lk);
 }
+
+static void
+nni_pipe_sender_getq_cb(void *arg)
+{
+	nni_pipe_sender *   ps = arg;
+	nni_pipe_send_slot *ss;
+	nni_msg *           msg;
+	bool                more = true;
+
+	if (nni_aio_result(ps->ps_getq) != 0) {
+		nni_pipe_stop(ps->ps_pipe);
+		return;
+	}
+	msg = nni_aio_get_msg(ps->ps_getq);
+	nni_aio_set_msg(ps->ps_getq, NULL);
+
+	// Messages already waiting are taken as well, while the window
+	// has room, so that the transport is handed them together.  Each
+	// is with the transport before the next is taken, so that they
+	// stay in order.
+	do {
+		if ((ps->ps_prep != NULL) &&
+		    (ps->ps_prep(ps->ps_arg, msg) != 0)) {
+			nni_msg_free(msg);
+			continue;
+		}
+
+		// We only take a message while a send is idle.
+		nni_mtx_lock(&ps->ps_mtx);
+		ss = nni_list_first(&ps->ps_idle);
+		nni_list_remove(&ps->ps_idle, ss);
+		nni_mtx_unlock(&ps->ps_mtx);
+
+		nni_aio_set_msg(ss->ss_aio, msg);
+		nni_pipe_send(ps->ps_pipe, ss->ss_aio);
+
+		// If the window is full, the next send to complete starts
+		// the next get instead.
+		nni_mtx_lock(&ps->ps_mtx);
+		if (!(more = !nni_list_empty(&ps->ps_idle))) {
+			ps->ps_getting = false;
+		}
+		nni_mtx_unlock(&ps->ps_mtx);
+	} while (more && (nni_msgq_tryget(ps->ps_mq, &msg) == 0));
+
+	if (more) {
+		nni_msgq_aio_get(ps->ps_mq, ps->ps_getq);
+	}
+}
+
+static void
+nni_pipe_sender_send_cb(void *arg)
+{
+	nni_pipe_send_slot *ss  = arg;
+	nni_pipe_sender *   ps  = ss->ss_sender;
+	nni_aio *           aio = ss->ss_aio;
+	bool                get;
+
+	if (nni_aio_result(aio) != 0) {
+		nni_msg_free(nni_aio_get_msg(aio));
+		nni_aio_set_msg(aio, NULL);
+		nni_pipe_stop(ps->ps_pipe);
+		return;
+	}
+
+	nni_mtx_lock(&ps->ps_mtx);
+	nni_list_append(&ps->ps_idle, ss);
+	if ((get = !ps->ps_getting)) {
+		ps->ps_getting = true;
+	}
+	nni_mtx_unlock(&ps->ps_mtx);
+	if (get) {
+		nni_msgq_aio_get(ps->ps_mq, ps->ps_getq);
+	}
+}
+
+int
+nni_pipe_sender_init(nni_pipe_sender **psp, nni_pipe *p,
+    int (*prep)(void *, nni_msg *), void *arg)
+{
+	nni_pipe_sender *ps;
+	int              n = nni_pipe_sendwin(p);
+	int              rv;
+
+	if ((ps = NNI_ALLOC_STRUCT(ps)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_init(&ps->ps_mtx);
+	NNI_LIST_INIT(&ps->ps_idle, nni_pipe_send_slot, ss_node);
+	ps->ps_pipe = p;
+	ps->ps_prep = prep;
+	ps->ps_arg  = arg;
+
+	if ((ps->ps_slots = NNI_ALLOC_STRUCTS(ps->ps_slots, n)) == NULL) {
+		nni_pipe_sender_fini(ps);
+		return (NNG_ENOMEM);
+	}
+	ps->ps_nslots = n;
+	if ((rv = nni_aio_init(&ps->ps_getq, nni_pipe_sender_getq_cb, ps)) !=
+	    0) {
+		nni_pipe_sender_fini(ps);
+		return (rv);
+	}
+	for (int i = 0; i < n; i++) {
+		nni_pipe_send_slot *ss = &ps->ps_slots[i];
+
+		ss->ss_sender = ps;
+		if ((rv = nni_aio_init(
+		         &ss->ss_aio, nni_pipe_sender_send_cb, ss)) != 0) {
+			nni_pipe_sender_fini(ps);
+			return (rv);
+		}
+		nni_list_append(&ps->ps_idle, ss);
+	}
+	*psp = ps;
+	return (0);
+}
+
+void
+nni_pipe_sender_fini(nni_pipe_sender *ps)
+{
+	if (ps == NULL) {
+		return;
+	}
+	nni_aio_fini(ps->ps_getq);
+	for (int i = 0; i < ps->ps_nslots; i++) {
+		nni_aio_fini(ps->ps_slots[i].ss_aio);
+	}
+	if (ps->ps_slots != NULL) {
+		NNI_FREE_STRUCTS(ps->ps_slots, ps->ps_nslots);
+	}
+	nni_mtx_fini(&ps->ps_mtx);
+	NNI_FREE_STRUCT(ps);
+}
+
+void
+nni_pipe_sender_start(nni_pipe_sender *ps, nni_msgq *mq)
+{
+	ps->ps_mq      = mq;
+	ps->ps_getting = true;
+	nni_msgq_aio_get(mq, ps->ps_getq);
+}
+
+void
+nni_pipe_sender_stop(nni_pipe_sender *ps)
+{
+	nni_aio_stop(ps->ps_getq);
+	for (int i = 0; i < ps->ps_nslots; i++) {
+		nni_aio_stop(ps->ps_slots[i].ss_aio);
+	}
+}
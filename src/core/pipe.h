@@ -26,6 +26,23 @@ extern void nni_pipe_sys_fini(void);
 extern void nni_pipe_recv(nni_pipe *, nni_aio *);
 extern void nni_pipe_send(nni_pipe *, nni_aio *);
 
+// nni_pipe_sendwin returns how many sends the transport accepts on the
+// pipe at once.  This is at least one.
+extern int nni_pipe_sendwin(nni_pipe *);
+
+// nni_pipe_sender moves messages from a message queue to a pipe, for
+// protocols that do nothing else with them.  It keeps as many sends
+// outstanding as the transport accepts, so that a transport which can
+// write several messages at once gets the chance to.  Messages are sent
+// in the order they are taken from the queue.  The prep function, which
+// may be NULL, is called on each message first; if it fails, the
+// message is discarded.  A failure to get or to send stops the pipe.
+extern int  nni_pipe_sender_init(
+    nni_pipe_sender **, nni_pipe *, int (*)(void *, nni_msg *), void *);
+extern void nni_pipe_sender_fini(nni_pipe_sender *);
+extern void nni_pipe_sender_start(nni_pipe_sender *, nni_msgq *);
+extern void nni_pipe_sender_stop(nni_pipe_sender *);
+
 // Pipe operations that protocols use.
 extern uint32_t nni_pipe_id(nni_pipe *);
 
@@ -79,4 +96,16 @@ extern int nni_pipe_find(nni_pipe **, uint32_t);
 // nni_pipe_rele releases the hold on the pipe placed by nni_pipe_find.
 extern void nni_pipe_rele(nni_pipe *);
 
+// nni_pipe_stats returns the statistics group for the pipe, which the
+// socket attaches to its own tree.
+extern nni_stat_item *nni_pipe_stats(nni_pipe *);
+
+// nni_pipe_bump_rx is called by protocols when a message has been
+// received on the pipe.  nni_pipe_bump_drop is called when the protocol
+// discards a message it was unable to deliver, for example because the
+// pipe's send queue was full.  Both also update the socket's totals.
+// Transmit statistics are collected by nni_pipe_send.
+extern void nni_pipe_bump_rx(nni_pipe *, size_t);
+extern void nni_pipe_bump_drop(nni_pipe *);
+
 #endif // CORE_PIPE_H
@@ -17,6 +17,7 @@
 // MS Studio have a functional <stdint.h>.  If this impacts you, just upgrade
 // your tool chain.
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -77,9 +78,15 @@ extern void *nni_alloc(size_t);
 // Most implementations can just call free() here.
 extern void nni_free(void *, size_t);
 
+// nni_alloc_nz is like nni_alloc, but the memory is not zeroed.  This is
+// used for buffers that are about to be completely overwritten, such as
+// message bodies being filled from the network.  Free with nni_free.
+extern void *nni_alloc_nz(size_t);
+
 typedef struct nni_plat_mtx nni_plat_mtx;
 typedef struct nni_plat_cv  nni_plat_cv;
 typedef struct nni_plat_thr nni_plat_thr;
+typedef struct nni_plat_tls nni_plat_tls;
 
 //
 // Threading & Synchronization Support
@@ -141,6 +148,69 @@ extern int nni_plat_thr_init(nni_plat_thr *, void (*)(void *), void *);
 // is an error to reference the thread in any further way.
 extern void nni_plat_thr_fini(nni_plat_thr *);
 
+// nni_plat_ncpu returns the number of processors available to run our
+// threads.  This is only a sizing hint, and is always at least one.
+extern int nni_plat_ncpu(void);
+
+// nni_plat_tls_init creates a thread local storage key.  Every thread
+// sees its own value, which is initially NULL.  If the destructor is not
+// NULL, it is called with the value when a thread having a non-NULL value
+// exits.  Whether destructors are called for values remaining when the
+// key is destroyed with nni_plat_tls_fini depends on the platform, so
+// destructors must be safe either way.
+extern int  nni_plat_tls_init(nni_plat_tls *, void (*)(void *));
+extern void nni_plat_tls_fini(nni_plat_tls *);
+
+// nni_plat_tls_get returns the calling thread's value for the key.
+extern void *nni_plat_tls_get(nni_plat_tls *);
+
+// nni_plat_tls_set sets the calling thread's value for the key.
+extern int nni_plat_tls_set(nni_plat_tls *, void *);
+
+//
+// Atomics Support
+//
+
+// nni_atomic_u64 is a 64-bit unsigned value that may be read and updated
+// without holding a lock.  These are used for statistics and reference
+// counts on hot paths, where a mutex would be too expensive.  All
+// operations are sequentially consistent.  The structure is supplied by
+// the platform, so that it can be embedded directly in other structures.
+typedef struct nni_atomic_u64 nni_atomic_u64;
+
+// nni_atomic_init64 initializes the value to zero.  Zeroed memory is
+// also a valid, initialized value.
+extern void nni_atomic_init64(nni_atomic_u64 *);
+
+// nni_atomic_add64 adds the value.  nni_atomic_sub64 subtracts it.
+extern void nni_atomic_add64(nni_atomic_u64 *, uint64_t);
+extern void nni_atomic_sub64(nni_atomic_u64 *, uint64_t);
+
+// nni_atomic_inc64 increments the value by one.
+extern void nni_atomic_inc64(nni_atomic_u64 *);
+
+// nni_atomic_inc64_nv increments the value by one, and returns the
+// new value.  Unlike a separate get, no other change can come between.
+extern uint64_t nni_atomic_inc64_nv(nni_atomic_u64 *);
+
+// nni_atomic_dec64_nv decrements the value by one, and returns the
+// new value.  This is useful for reference counting.
+extern uint64_t nni_atomic_dec64_nv(nni_atomic_u64 *);
+
+// nni_atomic_get64 returns the current value.
+extern uint64_t nni_atomic_get64(nni_atomic_u64 *);
+
+// nni_atomic_set64 stores the value.
+extern void nni_atomic_set64(nni_atomic_u64 *, uint64_t);
+
+// nni_atomic_swap64 stores the new value, returning the old value.
+extern uint64_t nni_atomic_swap64(nni_atomic_u64 *, uint64_t);
+
+// nni_atomic_cas64 stores the new value (third argument) only if the
+// current value matches the old value (second argument).  It returns
+// non-zero if the swap was performed.
+extern int nni_atomic_cas64(nni_atomic_u64 *, uint64_t, uint64_t);
+
 //
 // Clock Support
 //
@@ -209,6 +279,13 @@ extern void nni_plat_tcp_ep_close(nni_plat_tcp_ep *);
 // to the specified path.
 extern int nni_plat_tcp_ep_listen(nni_plat_tcp_ep *, nni_sockaddr *);
 
+// nni_plat_tcp_ep_set_listen sets the listen backlog, and the number of
+// listening sockets to open.  With more than one, the sockets share the
+// port (SO_REUSEPORT), and the system spreads connections between them.
+// Platforms without that facility use a single socket.  Zero for either
+// selects the default.  This must be called before listening.
+extern void nni_plat_tcp_ep_set_listen(nni_plat_tcp_ep *, int, int);
+
 // nni_plat_tcp_ep_accept starts an accept to receive an incoming connection.
 // An accepted connection will be passed back in the a_pipe member.
 extern void nni_plat_tcp_ep_accept(nni_plat_tcp_ep *, nni_aio *);
@@ -248,6 +325,25 @@ extern int nni_plat_tcp_pipe_peername(nni_plat_tcp_pipe *, nni_sockaddr *);
 // nni_plat_tcp_pipe_sockname gets the local name.
 extern int nni_plat_tcp_pipe_sockname(nni_plat_tcp_pipe *, nni_sockaddr *);
 
+// nni_plat_tcp_opts holds the socket level options for a TCP connection.
+// Zero keepalive timings and buffer sizes leave the system defaults alone.
+typedef struct nni_plat_tcp_opts {
+	bool         nodelay;   // TCP_NODELAY (disable Nagle)
+	bool         quickack;  // TCP_QUICKACK (no delayed ACKs)
+	bool         keepalive; // SO_KEEPALIVE
+	nni_duration keepidle;  // idle time before the first probe
+	nni_duration keepintvl; // time between probes
+	int          keepcnt;   // probes before the connection is dropped
+	size_t       sndbuf;    // SO_SNDBUF
+	size_t       rcvbuf;    // SO_RCVBUF
+} nni_plat_tcp_opts;
+
+// nni_plat_tcp_pipe_setopts applies the options to the connection.  This
+// is done on a best effort basis; options the platform lacks are ignored.
+// Note that new connections always start with TCP_NODELAY set.
+extern void nni_plat_tcp_pipe_setopts(
+    nni_plat_tcp_pipe *, const nni_plat_tcp_opts *);
+
 // nni_plat_tcp_ntop obtains the IP address for the socket (enclosing it
 // in brackets if it is IPv6) and port.  Enough space for both must
 // be present (48 bytes and 6 bytes each), although if either is NULL then
@@ -343,6 +439,12 @@ extern void nni_plat_udp_send(nni_plat_udp *, nni_aio *);
 // NNG_EMSGSIZE results.
 extern void nni_plat_udp_recv(nni_plat_udp *, nni_aio *);
 
+// nni_plat_udp_connect fixes the peer of the socket.  Thereafter only
+// datagrams from that peer are received, the destination in send aios
+// is ignored, and errors reported by the network (such as ICMP port
+// unreachable, which is NNG_ECONNREFUSED) fail later sends or receives.
+extern int nni_plat_udp_connect(nni_plat_udp *, const nni_sockaddr *);
+
 //
 // Notification Pipe Pairs
 //
@@ -448,6 +550,28 @@ extern int nni_plat_file_lock(const char *path, nni_plat_flock *);
 // nni_plat_file_unlock unlocks the previously locked file.
 extern void nni_plat_file_unlock(nni_plat_flock *);
 
+typedef struct nni_plat_file nni_plat_file;
+
+// nni_plat_file_open opens a regular file for reading, so that it can be
+// read a piece at a time rather than all at once.  The size of the file,
+// and the time it was last modified (in seconds since the UNIX epoch), are
+// returned as well.
+extern int nni_plat_file_open(
+    const char *, nni_plat_file *, uint64_t *, uint64_t *);
+
+// nni_plat_file_read reads up to the given number of bytes from the file,
+// starting at the given offset.  The number of bytes read is returned in
+// the last argument; this is only short at the end of the file.
+extern int nni_plat_file_read(
+    nni_plat_file *, void *, size_t, uint64_t, size_t *);
+
+// nni_plat_file_close closes a file opened with nni_plat_file_open.
+extern void nni_plat_file_close(nni_plat_file *);
+
+// nni_plat_file_stat returns the size and modification time (as for
+// nni_plat_file_open) of the named regular file, without opening it.
+extern int nni_plat_file_stat(const char *, uint64_t *, uint64_t *);
+
 // nni_plat_dir_open attempts to "open a directory" for listing.  The
 // handle for further operations is returned in the first argument, and
 // the directory name is supplied in the second.
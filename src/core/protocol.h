@@ -90,6 +90,37 @@ struct nni_proto_sock_ops {
 	nni_proto_sock_option *sock_options;
 };
 
+struct nni_proto_ctx_option {
+	const char *co_name;
+	int (*co_getopt)(void *, void *, size_t *);
+	int (*co_setopt)(void *, const void *, size_t);
+};
+
+// Context operations are optional; protocols that support them allow
+// applications to run many independent streams of operations on a single
+// socket, each with its own protocol state.  (For example, each REQ
+// context has its own outstanding request.)  The socket itself normally
+// behaves as if it had a single built-in context.
+struct nni_proto_ctx_ops {
+	// ctx_init creates a new context.  The last argument is the
+	// per-socket protocol private data.  This is called with the
+	// global socket lock held, and may not block.
+	int (*ctx_init)(void **, void *);
+
+	// ctx_fini destroys the context.  Any operations still pending on
+	// it must be completed (with NNG_ECLOSED) by this call.
+	void (*ctx_fini)(void *);
+
+	// Send a message on the context.
+	void (*ctx_send)(void *, nni_aio *);
+
+	// Receive a message on the context.
+	void (*ctx_recv)(void *, nni_aio *);
+
+	// Options. Must not be NULL. Final entry should have NULL name.
+	nni_proto_ctx_option *ctx_options;
+};
+
 typedef struct nni_proto_id {
 	uint16_t    p_id;
 	const char *p_name;
@@ -102,6 +133,7 @@ struct nni_proto {
 	uint32_t                  proto_flags;    // Protocol flags
 	const nni_proto_sock_ops *proto_sock_ops; // Per-socket opeations
 	const nni_proto_pipe_ops *proto_pipe_ops; // Per-pipe operations.
+	const nni_proto_ctx_ops * proto_ctx_ops;  // Contexts (may be NULL)
 
 	// proto_init, if not NULL, provides a function that initializes
 	// global values.  The main purpose of this may be to initialize
@@ -131,6 +163,13 @@ struct nni_proto {
 #define NNI_PROTO_FLAG_SND 2    // Protocol can send
 #define NNI_PROTO_FLAG_SNDRCV 3 // Protocol can both send & recv
 
+// These flags indicate that the protocol's sock_send (or sock_recv) does
+// nothing more than pass the aio to the socket's upper write (or read)
+// queue.  This lets synchronous sends and receives go to the queue
+// directly, without an aio, when they would not have to wait.
+#define NNI_PROTO_FLAG_SNDQ 4 // sock_send just uses the upper write queue
+#define NNI_PROTO_FLAG_RCVQ 8 // sock_recv just uses the upper read queue
+
 // nni_proto_open is called by the protocol to create a socket instance
 // with its ops vector.  The intent is that applications will only see
 // the single protocol-specific constructure, like nng_pair_v0_open(),
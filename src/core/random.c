@@ -9,6 +9,8 @@
 
 #include "core/nng_impl.h"
 
+#include <string.h>
+
 // This is ISAAC, a (reputedly) cryptographically secure PRNG that is also
 // quite efficient.  While the particular adjustments to fit in our code
 // base are under our copyright, the actual algorithm itself, as well as
@@ -17,6 +19,12 @@
 //
 // Our changes include making this code thread safe/reentrant, and naming
 // and style changes, to fit C99.
+//
+// Each thread has its own generator, so that callers never contend on a
+// lock.  The per-thread generators are seeded from the platform entropy
+// source, mixed with output from a shared generator, so that threads
+// never share a seed even where the platform entropy is weak.  The shared
+// one (which is locked) is also used if a thread cannot get its own.
 
 typedef struct {
 	// the rsl is the actual results, and the randcnt is the length
@@ -24,14 +32,13 @@ typedef struct {
 	uint32_t randrsl[256];
 	uint32_t randcnt;
 
-	// lock to protect concurrent access
-	nni_mtx mx;
-
 	// more or less internal state
 	uint32_t mm[256];
 	uint32_t aa;
 	uint32_t bb;
 	uint32_t cc;
+
+	nni_tlocal_node node; // per-thread generators only
 } nni_isaac_ctx;
 
 static void
@@ -163,40 +170,128 @@ nni_isaac_randinit(nni_isaac_ctx *ctx, int flag)
 	ctx->randcnt = 256; // prepare to use the first set of results
 }
 
-static nni_isaac_ctx nni_random_ctx;
+// nni_isaac_fill copies random bytes out, generating more as needed.
+static void
+nni_isaac_fill(nni_isaac_ctx *ctx, uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		size_t n;
+		size_t nw;
+
+		if (ctx->randcnt < 1) {
+			nni_isaac(ctx);
+			ctx->randcnt = 256;
+		}
+		// Results are taken from the end of randrsl, as by
+		// nni_random, so that both may be mixed freely.
+		nw = (len + 3) / 4;
+		if (nw > ctx->randcnt) {
+			nw = ctx->randcnt;
+		}
+		n = nw * 4 < len ? nw * 4 : len;
+		ctx->randcnt -= nw;
+		memcpy(buf, &ctx->randrsl[ctx->randcnt], n);
+		buf += n;
+		len -= n;
+	}
+}
+
+static uint32_t
+nni_isaac_next(nni_isaac_ctx *ctx)
+{
+	if (ctx->randcnt < 1) {
+		nni_isaac(ctx);
+		ctx->randcnt = 256;
+	}
+	ctx->randcnt--;
+	return (ctx->randrsl[ctx->randcnt]);
+}
+
+static nni_isaac_ctx nni_random_ctx; // shared, protected by nni_random_mtx
+static nni_mtx       nni_random_mtx;
+static nni_tlocal    nni_random_tls;
+
+static void
+nni_random_ctx_free(void *arg)
+{
+	nni_isaac_ctx *ctx = arg;
+
+	// Don't leave the generator state lying around.
+	memset(ctx, 0, sizeof(*ctx));
+	NNI_FREE_STRUCT(ctx);
+}
+
+// nni_random_ctx_alloc creates a generator for the calling thread.
+static void *
+nni_random_ctx_alloc(void)
+{
+	nni_isaac_ctx *ctx;
+	uint32_t       mix[256];
+
+	if ((ctx = NNI_ALLOC_STRUCT(ctx)) == NULL) {
+		return (NULL);
+	}
+	nni_plat_seed_prng(ctx->randrsl, sizeof(ctx->randrsl));
+	nni_mtx_lock(&nni_random_mtx);
+	nni_isaac_fill(&nni_random_ctx, (void *) mix, sizeof(mix));
+	nni_mtx_unlock(&nni_random_mtx);
+	for (int i = 0; i < 256; i++) {
+		ctx->randrsl[i] ^= mix[i];
+	}
+	nni_isaac_randinit(ctx, 1);
+	return (ctx);
+}
 
 int
 nni_random_sys_init(void)
 {
-	// minimally, grab the system clock
 	nni_isaac_ctx *ctx = &nni_random_ctx;
+	int            rv;
 
-	nni_mtx_init(&ctx->mx);
+	nni_mtx_init(&nni_random_mtx);
 	nni_plat_seed_prng(ctx->randrsl, sizeof(ctx->randrsl));
 	nni_isaac_randinit(ctx, 1);
+
+	if ((rv = NNI_TLOCAL_INIT(&nni_random_tls, nni_isaac_ctx, node,
+	         nni_random_ctx_alloc, nni_random_ctx_free)) != 0) {
+		nni_mtx_fini(&nni_random_mtx);
+		return (rv);
+	}
 	return (0);
 }
 
 uint32_t
 nni_random(void)
 {
+	nni_isaac_ctx *ctx;
 	uint32_t       rv;
-	nni_isaac_ctx *ctx = &nni_random_ctx;
 
-	nni_mtx_lock(&ctx->mx);
-	if (ctx->randcnt < 1) {
-		nni_isaac(ctx);
-		ctx->randcnt = 256;
+	if ((ctx = nni_tlocal_get(&nni_random_tls)) != NULL) {
+		return (nni_isaac_next(ctx));
 	}
-	ctx->randcnt--;
-	rv = ctx->randrsl[ctx->randcnt];
-	nni_mtx_unlock(&ctx->mx);
-
+	nni_mtx_lock(&nni_random_mtx);
+	rv = nni_isaac_next(&nni_random_ctx);
+	nni_mtx_unlock(&nni_random_mtx);
 	return (rv);
 }
 
+void
+nni_random_fill(void *buf, size_t len)
+{
+	nni_isaac_ctx *ctx;
+
+	if ((ctx = nni_tlocal_get(&nni_random_tls)) != NULL) {
+		nni_isaac_fill(ctx, buf, len);
+		return;
+	}
+	nni_mtx_lock(&nni_random_mtx);
+	nni_isaac_fill(&nni_random_ctx, buf, len);
+	nni_mtx_unlock(&nni_random_mtx);
+}
+
 void
 nni_random_sys_fini(void)
 {
-	nni_mtx_fini(&nni_random_ctx.mx);
+	nni_tlocal_fini(&nni_random_tls);
+	nni_mtx_fini(&nni_random_mtx);
 }
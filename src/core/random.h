@@ -18,9 +18,15 @@ extern int nni_random_sys_init(void);
 extern void nni_random_sys_fini(void);
 
 // nni_random returns a random 32-bit integer.  Note that this routine is
-// thread-safe/reentrant.  The pRNG is very robust, should be of crypto
-// quality.  However, its usefulness for cryptography will be determined
-// by the quality of the seeding material provided by the platform.
+// thread-safe/reentrant, and each thread uses its own generator, so that
+// callers do not contend with one another.  The pRNG is very robust,
+// should be of crypto quality.  However, its usefulness for cryptography
+// will be determined by the quality of the seeding material provided by
+// the platform.
 extern uint32_t nni_random(void);
 
+// nni_random_fill fills the buffer with random bytes.  This is much
+// cheaper than calling nni_random repeatedly when many are needed.
+extern void nni_random_fill(void *, size_t);
+
 #endif // CORE_RANDOM_H
@@ -16,8 +16,19 @@
 // Socket implementation.
 
 static nni_list    nni_sock_list;
-static nni_idhash *nni_sock_hash;
+static nni_hdltab *nni_sock_hdls;
+static nni_idhash *nni_ctx_hash;
 static nni_mtx     nni_sock_lk;
+static nni_cv      nni_sock_rele_cv; // wakes close when references drain
+
+// Each thread keeps one aio for synchronous sends and receives that
+// must wait, so that these do not allocate one every time.
+typedef struct {
+	nni_aio *       ac_aio; // NULL while in use
+	nni_tlocal_node ac_node;
+} nni_sock_aio_cache;
+
+static nni_tlocal nni_sock_aio_tls;
 
 typedef struct nni_socket_option {
 	const char *so_name;
@@ -32,6 +43,24 @@ typedef struct nni_sockopt {
 	void *        data;
 } nni_sockopt;
 
+// Socket statistics.  The root is unnamed, so that socket level
+// statistics appear without any prefix.  Pipes and endpoints attach
+// their own named groups beneath it.
+typedef struct nni_sock_statset {
+	nni_stat_item s_root;
+	nni_stat_item s_npipes;  // active pipes
+	nni_stat_item s_neps;    // active endpoints
+	nni_stat_item s_txmsgs;  // messages handed to transports
+	nni_stat_item s_rxmsgs;  // messages received from transports
+	nni_stat_item s_txbytes; // bytes handed to transports
+	nni_stat_item s_rxbytes; // bytes received from transports
+	nni_stat_item s_drops;   // messages dropped by the protocol
+	nni_stat_item s_rejects; // pipes rejected at start
+	nni_stat_item s_sendq;   // upper write queue depth
+	nni_stat_item s_recvq;   // upper read queue depth
+	nni_stat_item s_qdrops;  // messages dropped by the upper queues
+} nni_sock_statset;
+
 struct nni_socket {
 	nni_list_node s_node;
 	nni_mtx       s_mx;
@@ -39,10 +68,10 @@ struct nni_socket {
 	nni_cv        s_close_cv;
 	int           s_raw;
 
-	uint64_t s_id;
-	uint32_t s_flags;
-	unsigned s_refcnt; // protected by global lock
-	void *   s_data;   // Protocol private
+	uint64_t       s_id;
+	uint32_t       s_flags;
+	nni_atomic_u64 s_refcnt;
+	void *         s_data; // Protocol private
 
 	nni_msgq *s_uwq; // Upper write queue
 	nni_msgq *s_urq; // Upper read queue
@@ -52,6 +81,7 @@ struct nni_socket {
 
 	nni_proto_pipe_ops s_pipe_ops;
 	nni_proto_sock_ops s_sock_ops;
+	nni_proto_ctx_ops  s_ctx_ops;
 
 	// options
 	nni_duration s_linger;    // linger time
@@ -60,11 +90,13 @@ struct nni_socket {
 	nni_duration s_reconn;    // reconnect time
 	nni_duration s_reconnmax; // max reconnect time
 	size_t       s_rcvmaxsz;  // max receive size
+	int          s_devwin;    // device window, when receiving
 	nni_list     s_options;   // opts not handled by sock/proto
 	char         s_name[64];  // socket name (legacy compat)
 
 	nni_list s_eps;   // active endpoints
 	nni_list s_pipes; // active pipes
+	nni_list s_ctxs;  // active contexts, protected by global lock
 
 	int s_ep_pend; // EP dial/listen in progress
 	int s_closing; // Socket is closing
@@ -72,6 +104,24 @@ struct nni_socket {
 
 	nni_notifyfd s_send_fd;
 	nni_notifyfd s_recv_fd;
+
+	nni_sock_statset s_stats;
+};
+
+// Contexts are protocol state (such as an outstanding request) that
+// would otherwise be associated with the socket itself.  They live
+// until they are closed, either explicitly or by closing the socket,
+// and the last reference to them is dropped.
+struct nni_ctx {
+	nni_list_node     c_node;
+	nni_sock *        c_sock;
+	nni_proto_ctx_ops c_ops;
+	void *            c_data;
+	uint32_t          c_id;
+	unsigned          c_refcnt; // protected by global lock
+	bool              c_closed; // protected by global lock
+	nni_duration      c_sndtimeo;
+	nni_duration      c_rcvtimeo;
 };
 
 static void
@@ -233,6 +283,18 @@ nni_sock_getopt_sendbuf(nni_sock *s, void *buf, size_t *szp)
 	return (nni_getopt_buf(s->s_uwq, buf, szp));
 }
 
+static int
+nni_sock_setopt_devwin(nni_sock *s, const void *buf, size_t sz)
+{
+	return (nni_setopt_int(&s->s_devwin, buf, sz, 1, NNI_DEVICE_MAXWINDOW));
+}
+
+static int
+nni_sock_getopt_devwin(nni_sock *s, void *buf, size_t *szp)
+{
+	return (nni_getopt_int(s->s_devwin, buf, szp));
+}
+
 static int
 nni_sock_getopt_sockname(nni_sock *s, void *buf, size_t *szp)
 {
@@ -296,6 +358,11 @@ static const nni_socket_option nni_sock_options[] = {
 	    .so_getopt = nni_sock_getopt_reconnmaxt,
 	    .so_setopt = nni_sock_setopt_reconnmaxt,
 	},
+	{
+	    .so_name   = NNG_OPT_DEVICE_WINDOW,
+	    .so_getopt = nni_sock_getopt_devwin,
+	    .so_setopt = nni_sock_setopt_devwin,
+	},
 	{
 	    .so_name   = NNG_OPT_SOCKNAME,
 	    .so_getopt = nni_sock_getopt_sockname,
@@ -326,6 +393,108 @@ nni_sock_id(nni_sock *s)
 
 // nni_sock_sendq and nni_sock_recvq are called by the protocol to obtain
 // the upper read and write queues.
+static void
+nni_sock_stat_qlen(nni_stat_item *item, void *arg)
+{
+	nni_stat_set(item, (uint64_t) nni_msgq_len(arg));
+}
+
+static void
+nni_sock_stat_qdrops(nni_stat_item *item, void *arg)
+{
+	nni_sock *s = arg;
+	nni_stat_set(item,
+	    nni_msgq_drops(s->s_urq) + nni_msgq_drops(s->s_uwq));
+}
+
+static void
+nni_sock_stats_init(nni_sock *s)
+{
+	nni_sock_statset *st = &s->s_stats;
+
+	nni_stat_init_group(&st->s_root, "");
+
+	nni_stat_init(&st->s_npipes, "pipes", "active pipes",
+	    NNG_STAT_LEVEL, NNG_UNIT_NONE);
+	nni_stat_init(&st->s_neps, "endpoints", "active endpoints",
+	    NNG_STAT_LEVEL, NNG_UNIT_NONE);
+	nni_stat_init(&st->s_txmsgs, "tx_msgs", "messages sent",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_init(&st->s_rxmsgs, "rx_msgs", "messages received",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_init(&st->s_txbytes, "tx_bytes", "bytes sent",
+	    NNG_STAT_COUNTER, NNG_UNIT_BYTES);
+	nni_stat_init(&st->s_rxbytes, "rx_bytes", "bytes received",
+	    NNG_STAT_COUNTER, NNG_UNIT_BYTES);
+	nni_stat_init(&st->s_drops, "drops", "messages dropped",
+	    NNG_STAT_COUNTER, NNG_UNIT_MESSAGES);
+	nni_stat_init(&st->s_rejects, "rejects", "pipes rejected",
+	    NNG_STAT_COUNTER, NNG_UNIT_EVENTS);
+	nni_stat_init(&st->s_sendq, "sendq", "send queue depth",
+	    NNG_STAT_LEVEL, NNG_UNIT_MESSAGES);
+	nni_stat_init(&st->s_recvq, "recvq", "receive queue depth",
+	    NNG_STAT_LEVEL, NNG_UNIT_MESSAGES);
+	nni_stat_init(&st->s_qdrops, "queue_drops",
+	    "messages dropped by socket queues", NNG_STAT_COUNTER,
+	    NNG_UNIT_MESSAGES);
+
+	nni_stat_append(&st->s_root, &st->s_npipes);
+	nni_stat_append(&st->s_root, &st->s_neps);
+	nni_stat_append(&st->s_root, &st->s_txmsgs);
+	nni_stat_append(&st->s_root, &st->s_rxmsgs);
+	nni_stat_append(&st->s_root, &st->s_txbytes);
+	nni_stat_append(&st->s_root, &st->s_rxbytes);
+	nni_stat_append(&st->s_root, &st->s_drops);
+	nni_stat_append(&st->s_root, &st->s_rejects);
+	nni_stat_append(&st->s_root, &st->s_sendq);
+	nni_stat_append(&st->s_root, &st->s_recvq);
+	nni_stat_append(&st->s_root, &st->s_qdrops);
+}
+
+// nni_sock_stats_start hooks up the queue statistics, once the queues
+// exist.
+static void
+nni_sock_stats_start(nni_sock *s)
+{
+	nni_sock_statset *st = &s->s_stats;
+
+	nni_stat_set_update(&st->s_sendq, nni_sock_stat_qlen, s->s_uwq);
+	nni_stat_set_update(&st->s_recvq, nni_sock_stat_qlen, s->s_urq);
+	nni_stat_set_update(&st->s_qdrops, nni_sock_stat_qdrops, s);
+}
+
+nni_stat_item *
+nni_sock_stats(nni_sock *s)
+{
+	return (&s->s_stats.s_root);
+}
+
+void
+nni_sock_stats_append(nni_sock *s, nni_stat_item *item)
+{
+	nni_stat_append(&s->s_stats.s_root, item);
+}
+
+void
+nni_sock_bump_tx(nni_sock *s, uint64_t sz)
+{
+	nni_stat_inc(&s->s_stats.s_txmsgs, 1);
+	nni_stat_inc(&s->s_stats.s_txbytes, sz);
+}
+
+void
+nni_sock_bump_rx(nni_sock *s, uint64_t sz)
+{
+	nni_stat_inc(&s->s_stats.s_rxmsgs, 1);
+	nni_stat_inc(&s->s_stats.s_rxbytes, sz);
+}
+
+void
+nni_sock_bump_drop(nni_sock *s)
+{
+	nni_stat_inc(&s->s_stats.s_drops, 1);
+}
+
 nni_msgq *
 nni_sock_sendq(nni_sock *s)
 {
@@ -338,6 +507,18 @@ nni_sock_recvq(nni_sock *s)
 	return (s->s_urq);
 }
 
+// nni_sock_hold is called by lookups, without any lock held.  Once
+// close has removed the socket from the table, it cannot be looked up
+// any more; close waits for the lookups that did find it to release it.
+static int
+nni_sock_hold(void *arg)
+{
+	nni_sock *s = arg;
+
+	nni_atomic_inc64(&s->s_refcnt);
+	return (0);
+}
+
 int
 nni_sock_find(nni_sock **sockp, uint32_t id)
 {
@@ -347,33 +528,26 @@ nni_sock_find(nni_sock **sockp, uint32_t id)
 	if ((rv = nni_init()) != 0) {
 		return (rv);
 	}
-	nni_mtx_lock(&nni_sock_lk);
-	if ((rv = nni_idhash_find(nni_sock_hash, id, (void **) &s)) == 0) {
-		if (s->s_closed) {
-			rv = NNG_ECLOSED;
-		} else {
-			s->s_refcnt++;
-			*sockp = s;
-		}
-	}
-	nni_mtx_unlock(&nni_sock_lk);
-
-	if (rv == NNG_ENOENT) {
+	rv = nni_hdltab_find(nni_sock_hdls, id, nni_sock_hold, (void **) &s);
+	if (rv == 0) {
+		*sockp = s;
+	} else if (rv == NNG_ENOENT) {
 		rv = NNG_ECLOSED;
 	}
-
 	return (rv);
 }
 
 void
 nni_sock_rele(nni_sock *s)
 {
-	nni_mtx_lock(&nni_sock_lk);
-	s->s_refcnt--;
-	if (s->s_closed && (s->s_refcnt < 2)) {
-		nni_cv_wake(&s->s_close_cv);
+	// The socket holds a reference on itself until close drops it,
+	// so only a closing socket can see the count reach zero.  Close
+	// may free the socket as soon as it does, so do not touch it.
+	if (nni_atomic_dec64_nv(&s->s_refcnt) == 0) {
+		nni_mtx_lock(&nni_sock_lk);
+		nni_cv_wake(&nni_sock_rele_cv);
+		nni_mtx_unlock(&nni_sock_lk);
 	}
-	nni_mtx_unlock(&nni_sock_lk);
 }
 
 int
@@ -394,6 +568,9 @@ nni_sock_pipe_start(nni_sock *s, nni_pipe *pipe)
 		// Protocol can reject for other reasons.
 		rv = s->s_pipe_ops.pipe_start(pdata);
 	}
+	if ((rv != 0) && (rv != NNG_ECLOSED)) {
+		nni_stat_inc(&s->s_stats.s_rejects, 1);
+	}
 	nni_mtx_unlock(&s->s_mx);
 	return (rv);
 }
@@ -412,11 +589,17 @@ nni_sock_pipe_add(nni_sock *s, nni_pipe *p)
 	// Initialize protocol pipe data.
 	nni_mtx_lock(&s->s_mx);
 	if (s->s_closing) {
+		// The pipe is not on our list, so nni_sock_pipe_remove
+		// will not be called for it; release the data here.
+		nni_pipe_set_proto_data(p, NULL);
 		nni_mtx_unlock(&s->s_mx);
+		s->s_pipe_ops.pipe_fini(pdata);
 		return (NNG_ECLOSED);
 	}
 
 	nni_list_append(&s->s_pipes, p);
+	nni_stat_inc(&s->s_stats.s_npipes, 1);
+	nni_sock_stats_append(s, nni_pipe_stats(p));
 
 	// Start the initial negotiation I/O...
 	nni_pipe_start(p);
@@ -437,6 +620,7 @@ nni_sock_pipe_remove(nni_sock *sock, nni_pipe *pipe)
 		nni_pipe_set_proto_data(pipe, NULL);
 		if (nni_list_active(&sock->s_pipes, pipe)) {
 			nni_list_remove(&sock->s_pipes, pipe);
+			nni_stat_dec(&sock->s_stats.s_npipes, 1);
 		}
 		sock->s_pipe_ops.pipe_fini(pdata);
 	}
@@ -497,8 +681,10 @@ nni_sock_create(nni_sock **sp, const nni_proto *proto)
 	s->s_reconn          = NNI_SECOND;
 	s->s_reconnmax       = 0;
 	s->s_rcvmaxsz        = 1024 * 1024; // 1 MB by default
+	s->s_devwin          = NNI_DEVICE_WINDOW;
 	s->s_id              = 0;
-	s->s_refcnt          = 0;
+	nni_atomic_init64(&s->s_refcnt);
+	nni_atomic_set64(&s->s_refcnt, 1);
 	s->s_send_fd.sn_init = 0;
 	s->s_recv_fd.sn_init = 0;
 	s->s_self_id         = proto->proto_self;
@@ -506,6 +692,9 @@ nni_sock_create(nni_sock **sp, const nni_proto *proto)
 	s->s_flags           = proto->proto_flags;
 	s->s_sock_ops        = *proto->proto_sock_ops;
 	s->s_pipe_ops        = *proto->proto_pipe_ops;
+	if (proto->proto_ctx_ops != NULL) {
+		s->s_ctx_ops = *proto->proto_ctx_ops;
+	}
 
 	NNI_ASSERT(s->s_sock_ops.sock_open != NULL);
 	NNI_ASSERT(s->s_sock_ops.sock_close != NULL);
@@ -517,9 +706,11 @@ nni_sock_create(nni_sock **sp, const nni_proto *proto)
 	NNI_LIST_INIT(&s->s_options, nni_sockopt, node);
 	nni_pipe_sock_list_init(&s->s_pipes);
 	nni_ep_list_init(&s->s_eps);
+	NNI_LIST_INIT(&s->s_ctxs, nni_ctx, c_node);
 	nni_mtx_init(&s->s_mx);
 	nni_cv_init(&s->s_cv, &s->s_mx);
 	nni_cv_init(&s->s_close_cv, &nni_sock_lk);
+	nni_sock_stats_init(s);
 
 	if (((rv = nni_msgq_init(&s->s_uwq, 0)) != 0) ||
 	    ((rv = nni_msgq_init(&s->s_urq, 0)) != 0) ||
@@ -539,6 +730,7 @@ nni_sock_create(nni_sock **sp, const nni_proto *proto)
 		nni_sock_destroy(s);
 		return (rv);
 	}
+	nni_sock_stats_start(s);
 
 	if (s->s_sock_ops.sock_filter != NULL) {
 		nni_msgq_set_filter(
@@ -549,6 +741,25 @@ nni_sock_create(nni_sock **sp, const nni_proto *proto)
 	return (rv);
 }
 
+static void *
+nni_sock_aio_cache_alloc(void)
+{
+	nni_sock_aio_cache *ac;
+
+	return (NNI_ALLOC_STRUCT(ac));
+}
+
+static void
+nni_sock_aio_cache_free(void *arg)
+{
+	nni_sock_aio_cache *ac = arg;
+
+	if (ac->ac_aio != NULL) {
+		nni_aio_fini(ac->ac_aio);
+	}
+	NNI_FREE_STRUCT(ac);
+}
+
 int
 nni_sock_sys_init(void)
 {
@@ -556,11 +767,17 @@ nni_sock_sys_init(void)
 
 	NNI_LIST_INIT(&nni_sock_list, nni_sock, s_node);
 	nni_mtx_init(&nni_sock_lk);
+	nni_cv_init(&nni_sock_rele_cv, &nni_sock_lk);
 
-	if ((rv = nni_idhash_init(&nni_sock_hash)) != 0) {
+	if (((rv = nni_hdltab_init(&nni_sock_hdls)) != 0) ||
+	    ((rv = nni_idhash_init(&nni_ctx_hash)) != 0) ||
+	    ((rv = NNI_TLOCAL_INIT(&nni_sock_aio_tls, nni_sock_aio_cache,
+	          ac_node, nni_sock_aio_cache_alloc,
+	          nni_sock_aio_cache_free)) != 0)) {
 		nni_sock_sys_fini();
 	} else {
-		nni_idhash_set_limits(nni_sock_hash, 1, 0x7fffffff, 1);
+		nni_hdltab_set_limits(nni_sock_hdls, 1, 0x7fffffff, 1);
+		nni_idhash_set_limits(nni_ctx_hash, 1, 0x7fffffff, 1);
 	}
 	return (rv);
 }
@@ -568,8 +785,12 @@ nni_sock_sys_init(void)
 void
 nni_sock_sys_fini(void)
 {
-	nni_idhash_fini(nni_sock_hash);
-	nni_sock_hash = NULL;
+	nni_tlocal_fini(&nni_sock_aio_tls);
+	nni_idhash_fini(nni_ctx_hash);
+	nni_ctx_hash = NULL;
+	nni_hdltab_fini(nni_sock_hdls);
+	nni_sock_hdls = NULL;
+	nni_cv_fini(&nni_sock_rele_cv);
 	nni_mtx_fini(&nni_sock_lk);
 }
 
@@ -590,7 +811,7 @@ nni_sock_open(nni_sock **sockp, const nni_proto *proto)
 	}
 
 	nni_mtx_lock(&nni_sock_lk);
-	if ((rv = nni_idhash_alloc(nni_sock_hash, &s->s_id, s)) != 0) {
+	if ((rv = nni_hdltab_alloc(nni_sock_hdls, &s->s_id, s)) != 0) {
 		nni_sock_destroy(s);
 	} else {
 		nni_list_append(&nni_sock_list, s);
@@ -615,6 +836,9 @@ nni_sock_shutdown(nni_sock *sock)
 	nni_pipe *pipe;
 	nni_ep *  ep;
 	nni_ep *  nep;
+	nni_ctx * ctx;
+	nni_ctx * nctx;
+	nni_list  idle;
 	nni_time  linger;
 
 	nni_mtx_lock(&sock->s_mx);
@@ -624,6 +848,40 @@ nni_sock_shutdown(nni_sock *sock)
 	}
 	// Mark us closing, so no more EPs or changes can occur.
 	sock->s_closing = 1;
+	nni_mtx_unlock(&sock->s_mx);
+
+	// Close the contexts.  Those not in use are destroyed now, which
+	// fails any operations pending on them; the rest go as soon as the
+	// threads using them are done.  The protocol's finalizer may have
+	// to wait (for a timer callback, say), so it is not called with
+	// the global lock held.
+	NNI_LIST_INIT(&idle, nni_ctx, c_node);
+	nni_mtx_lock(&nni_sock_lk);
+	nctx = nni_list_first(&sock->s_ctxs);
+	while ((ctx = nctx) != NULL) {
+		nctx          = nni_list_next(&sock->s_ctxs, ctx);
+		ctx->c_closed = true;
+		if (ctx->c_refcnt == 0) {
+			nni_idhash_remove(nni_ctx_hash, ctx->c_id);
+			nni_list_remove(&sock->s_ctxs, ctx);
+			nni_list_append(&idle, ctx);
+		}
+	}
+	nni_mtx_unlock(&nni_sock_lk);
+
+	while ((ctx = nni_list_first(&idle)) != NULL) {
+		nni_list_remove(&idle, ctx);
+		ctx->c_ops.ctx_fini(ctx->c_data);
+		NNI_FREE_STRUCT(ctx);
+	}
+
+	nni_mtx_lock(&nni_sock_lk);
+	while (!nni_list_empty(&sock->s_ctxs)) {
+		nni_cv_wait(&sock->s_close_cv);
+	}
+	nni_mtx_unlock(&nni_sock_lk);
+
+	nni_mtx_lock(&sock->s_mx);
 
 	// Special optimization; if there are no pipes connected,
 	// then there is no reason to linger since there's nothing that
@@ -726,16 +984,19 @@ nni_sock_close(nni_sock *s)
 		return;
 	}
 	s->s_closed = 1;
-	nni_idhash_remove(nni_sock_hash, s->s_id);
+
+	// Once this returns, lookups can no longer take references.
+	nni_hdltab_remove(nni_sock_hdls, s->s_id);
 
 	// We might have been removed from the list already, e.g. by
 	// nni_sock_closeall.  This is idempotent.
 	nni_list_node_remove(&s->s_node);
 
-	// Wait for all other references to drop.  Note that we
-	// have a reference already (from our caller).
-	while (s->s_refcnt > 1) {
-		nni_cv_wait(&s->s_close_cv);
+	// Drop both the socket's own reference and the one our caller
+	// gave us, and wait for all other references to drop.
+	nni_atomic_sub64(&s->s_refcnt, 2);
+	while (nni_atomic_get64(&s->s_refcnt) != 0) {
+		nni_cv_wait(&nni_sock_rele_cv);
 	}
 	nni_mtx_unlock(&nni_sock_lk);
 
@@ -755,7 +1016,7 @@ nni_sock_closeall(void)
 {
 	nni_sock *s;
 
-	if (nni_sock_hash == NULL) {
+	if (nni_sock_hdls == NULL) {
 		return;
 	}
 	for (;;) {
@@ -766,7 +1027,7 @@ nni_sock_closeall(void)
 		}
 		// Bump the reference count.  The close call below will
 		// drop it.
-		s->s_refcnt++;
+		nni_atomic_inc64(&s->s_refcnt);
 		nni_list_node_remove(&s->s_node);
 		nni_mtx_unlock(&nni_sock_lk);
 		nni_sock_close(s);
@@ -787,6 +1048,307 @@ nni_sock_recv(nni_sock *sock, nni_aio *aio)
 	sock->s_sock_ops.sock_recv(sock->s_data, aio);
 }
 
+// nni_sock_aio_get takes the calling thread's cached aio, allocating
+// one if needed.  The slot is left empty while the aio is in use, so
+// that a nested call (from a signal handler, say) gets its own.
+static int
+nni_sock_aio_get(nni_aio **aiop, int flags)
+{
+	nni_sock_aio_cache *ac;
+	nni_aio *           aio;
+	int                 rv;
+
+	if (((ac = nni_tlocal_get(&nni_sock_aio_tls)) != NULL) &&
+	    (ac->ac_aio != NULL)) {
+		aio        = ac->ac_aio;
+		ac->ac_aio = NULL;
+	} else if ((rv = nni_aio_init(&aio, NULL, NULL)) != 0) {
+		return (rv);
+	}
+	if (flags & NNG_FLAG_NONBLOCK) {
+		nni_aio_set_timeout(aio, NNG_DURATION_ZERO);
+	} else {
+		nni_aio_set_timeout(aio, NNG_DURATION_DEFAULT);
+	}
+	*aiop = aio;
+	return (0);
+}
+
+static void
+nni_sock_aio_put(nni_aio *aio)
+{
+	nni_sock_aio_cache *ac;
+
+	nni_aio_set_msg(aio, NULL);
+	if (((ac = nni_tlocal_get(&nni_sock_aio_tls)) == NULL) ||
+	    (ac->ac_aio != NULL)) {
+		nni_aio_fini(aio);
+		return;
+	}
+	ac->ac_aio = aio;
+}
+
+// nni_sock_sendmsg sends synchronously.  If the protocol just queues
+// sends, and there is room, the message goes straight onto the queue.
+// Otherwise we wait on the thread's cached aio.  On failure the message
+// still belongs to the caller.
+int
+nni_sock_sendmsg(nni_sock *sock, nni_msg *msg, int flags)
+{
+	nni_aio *aio;
+	int      rv;
+
+	if ((sock->s_flags & NNI_PROTO_FLAG_SNDQ) != 0) {
+		rv = nni_msgq_tryput(sock->s_uwq, msg);
+		if ((rv != NNG_EAGAIN) || (flags & NNG_FLAG_NONBLOCK)) {
+			return (rv);
+		}
+	}
+
+	if ((rv = nni_sock_aio_get(&aio, flags)) != 0) {
+		return (rv);
+	}
+	nni_aio_set_msg(aio, msg);
+	nni_sock_send(sock, aio);
+	nni_aio_wait(aio);
+	rv = nni_aio_result(aio);
+	nni_sock_aio_put(aio);
+
+	// Nonblocking attempts that could not be satisfied at once
+	// report timing out; the caller expects to hear "try again".
+	if ((rv == NNG_ETIMEDOUT) && (flags & NNG_FLAG_NONBLOCK)) {
+		rv = NNG_EAGAIN;
+	}
+	return (rv);
+}
+
+// nni_sock_recvmsg is the receive side counterpart of nni_sock_sendmsg.
+int
+nni_sock_recvmsg(nni_sock *sock, nni_msg **msgp, int flags)
+{
+	nni_aio *aio;
+	int      rv;
+
+	if ((sock->s_flags & NNI_PROTO_FLAG_RCVQ) != 0) {
+		rv = nni_msgq_tryget(sock->s_urq, msgp);
+		if ((rv != NNG_EAGAIN) || (flags & NNG_FLAG_NONBLOCK)) {
+			return (rv);
+		}
+	}
+
+	if ((rv = nni_sock_aio_get(&aio, flags)) != 0) {
+		return (rv);
+	}
+	nni_sock_recv(sock, aio);
+	nni_aio_wait(aio);
+	if ((rv = nni_aio_result(aio)) == 0) {
+		*msgp = nni_aio_get_msg(aio);
+	}
+	nni_sock_aio_put(aio);
+
+	if ((rv == NNG_ETIMEDOUT) && (flags & NNG_FLAG_NONBLOCK)) {
+		rv = NNG_EAGAIN;
+	}
+	return (rv);
+}
+
+int
+nni_ctx_open(nni_ctx **ctxp, nni_sock *sock)
+{
+	nni_ctx *ctx;
+	uint64_t id;
+	int      rv;
+
+	if (sock->s_ctx_ops.ctx_init == NULL) {
+		return (NNG_ENOTSUP);
+	}
+	if ((ctx = NNI_ALLOC_STRUCT(ctx)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+
+	nni_mtx_lock(&nni_sock_lk);
+	nni_mtx_lock(&sock->s_mx);
+	if (sock->s_closed || sock->s_closing) {
+		nni_mtx_unlock(&sock->s_mx);
+		nni_mtx_unlock(&nni_sock_lk);
+		NNI_FREE_STRUCT(ctx);
+		return (NNG_ECLOSED);
+	}
+	ctx->c_sndtimeo = sock->s_sndtimeo;
+	ctx->c_rcvtimeo = sock->s_rcvtimeo;
+	nni_mtx_unlock(&sock->s_mx);
+
+	if ((rv = nni_idhash_alloc(nni_ctx_hash, &id, ctx)) != 0) {
+		nni_mtx_unlock(&nni_sock_lk);
+		NNI_FREE_STRUCT(ctx);
+		return (rv);
+	}
+	if ((rv = sock->s_ctx_ops.ctx_init(&ctx->c_data, sock->s_data)) != 0) {
+		nni_idhash_remove(nni_ctx_hash, id);
+		nni_mtx_unlock(&nni_sock_lk);
+		NNI_FREE_STRUCT(ctx);
+		return (rv);
+	}
+	ctx->c_id     = (uint32_t) id;
+	ctx->c_sock   = sock;
+	ctx->c_ops    = sock->s_ctx_ops;
+	ctx->c_refcnt = 1;
+	ctx->c_closed = false;
+	nni_list_append(&sock->s_ctxs, ctx);
+	nni_mtx_unlock(&nni_sock_lk);
+
+	*ctxp = ctx;
+	return (0);
+}
+
+// nni_ctx_find looks up the context, and takes a reference on it.  Closed
+// contexts are not found unless closing is true; this allows a context
+// that the socket has closed to still be closed explicitly.
+int
+nni_ctx_find(nni_ctx **ctxp, uint32_t id, bool closing)
+{
+	nni_ctx *ctx;
+	int      rv;
+
+	if ((rv = nni_init()) != 0) {
+		return (rv);
+	}
+	nni_mtx_lock(&nni_sock_lk);
+	if ((rv = nni_idhash_find(nni_ctx_hash, id, (void **) &ctx)) == 0) {
+		if (ctx->c_closed && !closing) {
+			rv = NNG_ECLOSED;
+		} else {
+			ctx->c_refcnt++;
+			*ctxp = ctx;
+		}
+	}
+	nni_mtx_unlock(&nni_sock_lk);
+
+	if (rv == NNG_ENOENT) {
+		rv = NNG_ECLOSED;
+	}
+	return (rv);
+}
+
+void
+nni_ctx_rele(nni_ctx *ctx)
+{
+	nni_sock *sock = ctx->c_sock;
+
+	nni_mtx_lock(&nni_sock_lk);
+	if ((ctx->c_refcnt > 1) || (!ctx->c_closed)) {
+		ctx->c_refcnt--;
+		nni_mtx_unlock(&nni_sock_lk);
+		return;
+	}
+
+	// Last reference to a closed context; destroy it.  We keep our
+	// reference, and the context on the socket's list, until the
+	// protocol is done with it, so that a socket being closed leaves
+	// it to us and waits.  The protocol's finalizer may block, so it
+	// is called without the lock.
+	nni_idhash_remove(nni_ctx_hash, ctx->c_id);
+	nni_mtx_unlock(&nni_sock_lk);
+
+	ctx->c_ops.ctx_fini(ctx->c_data);
+
+	nni_mtx_lock(&nni_sock_lk);
+	nni_list_remove(&sock->s_ctxs, ctx);
+	nni_cv_wake(&sock->s_close_cv);
+	nni_mtx_unlock(&nni_sock_lk);
+
+	NNI_FREE_STRUCT(ctx);
+}
+
+// nni_ctx_close marks the context closed, and drops the caller's
+// reference.  Operations pending on it fail with NNG_ECLOSED.
+void
+nni_ctx_close(nni_ctx *ctx)
+{
+	nni_mtx_lock(&nni_sock_lk);
+	ctx->c_closed = true;
+	nni_mtx_unlock(&nni_sock_lk);
+	nni_ctx_rele(ctx);
+}
+
+uint32_t
+nni_ctx_id(nni_ctx *ctx)
+{
+	return (ctx->c_id);
+}
+
+void
+nni_ctx_send(nni_ctx *ctx, nni_aio *aio)
+{
+	nni_aio_normalize_timeout(aio, ctx->c_sndtimeo);
+	ctx->c_ops.ctx_send(ctx->c_data, aio);
+}
+
+void
+nni_ctx_recv(nni_ctx *ctx, nni_aio *aio)
+{
+	nni_aio_normalize_timeout(aio, ctx->c_rcvtimeo);
+	ctx->c_ops.ctx_recv(ctx->c_data, aio);
+}
+
+int
+nni_ctx_setopt(nni_ctx *ctx, const char *name, const void *val, size_t sz)
+{
+	nni_sock *            sock = ctx->c_sock;
+	nni_proto_ctx_option *co;
+	int                   rv = NNG_ENOTSUP;
+
+	nni_mtx_lock(&sock->s_mx);
+	if (strcmp(name, NNG_OPT_RECVTIMEO) == 0) {
+		rv = nni_setopt_ms(&ctx->c_rcvtimeo, val, sz);
+	} else if (strcmp(name, NNG_OPT_SENDTIMEO) == 0) {
+		rv = nni_setopt_ms(&ctx->c_sndtimeo, val, sz);
+	} else {
+		for (co = ctx->c_ops.ctx_options; co->co_name != NULL; co++) {
+			if (strcmp(name, co->co_name) != 0) {
+				continue;
+			}
+			if (co->co_setopt == NULL) {
+				rv = NNG_EREADONLY;
+			} else {
+				rv = co->co_setopt(ctx->c_data, val, sz);
+			}
+			break;
+		}
+	}
+	nni_mtx_unlock(&sock->s_mx);
+	return (rv);
+}
+
+int
+nni_ctx_getopt(nni_ctx *ctx, const char *name, void *val, size_t *szp)
+{
+	nni_sock *            sock = ctx->c_sock;
+	nni_proto_ctx_option *co;
+	int                   rv = NNG_ENOTSUP;
+
+	nni_mtx_lock(&sock->s_mx);
+	if (strcmp(name, NNG_OPT_RECVTIMEO) == 0) {
+		rv = nni_getopt_ms(ctx->c_rcvtimeo, val, szp);
+	} else if (strcmp(name, NNG_OPT_SENDTIMEO) == 0) {
+		rv = nni_getopt_ms(ctx->c_sndtimeo, val, szp);
+	} else {
+		for (co = ctx->c_ops.ctx_options; co->co_name != NULL; co++) {
+			if (strcmp(name, co->co_name) != 0) {
+				continue;
+			}
+			if (co->co_getopt == NULL) {
+				rv = NNG_EWRITEONLY;
+			} else {
+				rv = co->co_getopt(ctx->c_data, val, szp);
+			}
+			break;
+		}
+	}
+	nni_mtx_unlock(&sock->s_mx);
+	return (rv);
+}
+
 // nni_sock_protocol returns the socket's 16-bit protocol number.
 uint16_t
 nni_sock_proto(nni_sock *sock)
@@ -843,6 +1405,7 @@ nni_sock_ep_add(nni_sock *s, nni_ep *ep)
 	}
 
 	nni_list_append(&s->s_eps, ep);
+	nni_stat_inc(&s->s_stats.s_neps, 1);
 	nni_mtx_unlock(&s->s_mx);
 	return (0);
 }
@@ -853,6 +1416,7 @@ nni_sock_ep_remove(nni_sock *sock, nni_ep *ep)
 	nni_mtx_lock(&sock->s_mx);
 	if (nni_list_active(&sock->s_eps, ep)) {
 		nni_list_remove(&sock->s_eps, ep);
+		nni_stat_dec(&sock->s_stats.s_neps, 1);
 		if ((sock->s_closing) && (nni_list_empty(&sock->s_eps))) {
 			nni_cv_wake(&sock->s_cv);
 		}
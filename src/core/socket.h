@@ -58,7 +58,33 @@ extern nni_msgq *nni_sock_recvq(nni_sock *);
 
 extern void nni_sock_reconntimes(nni_sock *, nni_duration *, nni_duration *);
 
+// Contexts.  nni_ctx_open fails with NNG_ENOTSUP if the protocol does not
+// support them.  The context returned from nni_ctx_open or nni_ctx_find
+// holds a reference, which must be dropped with nni_ctx_rele (or, to also
+// close the context, nni_ctx_close).
+extern int      nni_ctx_open(nni_ctx **, nni_sock *);
+extern int      nni_ctx_find(nni_ctx **, uint32_t, bool);
+extern void     nni_ctx_rele(nni_ctx *);
+extern void     nni_ctx_close(nni_ctx *);
+extern uint32_t nni_ctx_id(nni_ctx *);
+extern void     nni_ctx_send(nni_ctx *, nni_aio *);
+extern void     nni_ctx_recv(nni_ctx *, nni_aio *);
+extern int nni_ctx_getopt(nni_ctx *, const char *, void *, size_t *);
+extern int nni_ctx_setopt(nni_ctx *, const char *, const void *, size_t);
+
 // nni_sock_flags returns the socket flags, used to indicate whether read
 // and or write are appropriate for the protocol.
 extern uint32_t nni_sock_flags(nni_sock *);
+
+// nni_sock_stats returns the root of the socket's statistics tree.
+// nni_sock_stats_append attaches a child group (for a pipe or endpoint)
+// beneath it; the owner must nni_stat_remove it before freeing it.
+extern nni_stat_item *nni_sock_stats(nni_sock *);
+extern void           nni_sock_stats_append(nni_sock *, nni_stat_item *);
+
+// These update the socket-wide aggregate statistics.  Normally they are
+// called via the pipe equivalents, which update both.
+extern void nni_sock_bump_tx(nni_sock *, uint64_t);
+extern void nni_sock_bump_rx(nni_sock *, uint64_t);
+extern void nni_sock_bump_drop(nni_sock *);
 #endif // CORE_SOCKET_H
@@ -0,0 +1,174 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "core/nng_impl.h"
+
+static nni_mtx       nni_stat_lk;
+static nni_stat_item nni_stat_global_root;
+
+// Longest dotted name we will construct.  Trees are shallow (socket,
+// then pipe or endpoint, then leaf) so this is plenty.
+#define NNI_STAT_PATHLEN (NNI_STAT_NAMELEN * 4)
+
+static void
+nni_stat_init_common(nni_stat_item *item, const char *name)
+{
+	NNI_LIST_NODE_INIT(&item->si_node);
+	NNI_LIST_INIT(&item->si_children, nni_stat_item, si_node);
+	item->si_parent = NULL;
+	item->si_group  = false;
+	(void) snprintf(item->si_name, sizeof(item->si_name), "%s", name);
+	item->si_desc    = NULL;
+	item->si_type    = NNG_STAT_LEVEL;
+	item->si_unit    = NNG_UNIT_NONE;
+	item->si_update  = NULL;
+	item->si_private = NULL;
+	nni_atomic_init64(&item->si_value);
+}
+
+void
+nni_stat_init(nni_stat_item *item, const char *name, const char *desc,
+    int type, int unit)
+{
+	nni_stat_init_common(item, name);
+	item->si_desc = desc;
+	item->si_type = type;
+	item->si_unit = unit;
+}
+
+void
+nni_stat_init_group(nni_stat_item *item, const char *name)
+{
+	nni_stat_init_common(item, name);
+	item->si_group = true;
+}
+
+void
+nni_stat_set_update(nni_stat_item *item, nni_stat_update cb, void *arg)
+{
+	item->si_update  = cb;
+	item->si_private = arg;
+}
+
+void
+nni_stat_append(nni_stat_item *parent, nni_stat_item *child)
+{
+	nni_mtx_lock(&nni_stat_lk);
+	child->si_parent = parent;
+	nni_list_append(&parent->si_children, child);
+	nni_mtx_unlock(&nni_stat_lk);
+}
+
+void
+nni_stat_remove(nni_stat_item *item)
+{
+	nni_mtx_lock(&nni_stat_lk);
+	if (item->si_parent != NULL) {
+		nni_list_remove(&item->si_parent->si_children, item);
+		item->si_parent = NULL;
+	}
+	nni_mtx_unlock(&nni_stat_lk);
+}
+
+void
+nni_stat_inc(nni_stat_item *item, uint64_t v)
+{
+	nni_atomic_add64(&item->si_value, v);
+}
+
+void
+nni_stat_dec(nni_stat_item *item, uint64_t v)
+{
+	nni_atomic_sub64(&item->si_value, v);
+}
+
+void
+nni_stat_set(nni_stat_item *item, uint64_t v)
+{
+	nni_atomic_set64(&item->si_value, v);
+}
+
+uint64_t
+nni_stat_get(nni_stat_item *item)
+{
+	return (nni_atomic_get64(&item->si_value));
+}
+
+static int
+nni_stat_walk_locked(
+    nni_stat_item *item, char *path, size_t len, nni_stat_walker fn, void *arg)
+{
+	nni_stat_item *child;
+	size_t         n;
+	int            rv;
+
+	// Groups contribute their name as a prefix; only leaves are
+	// reported.
+	n = len;
+	if (item->si_name[0] != '\0') {
+		n += snprintf(path + len, NNI_STAT_PATHLEN - len, "%s%s",
+		    len > 0 ? "." : "", item->si_name);
+		if (n >= NNI_STAT_PATHLEN) {
+			n = NNI_STAT_PATHLEN - 1;
+		}
+	}
+	if (!item->si_group) {
+		if (item->si_update != NULL) {
+			item->si_update(item, item->si_private);
+		}
+		rv = fn(item, path, arg);
+	} else {
+		rv = 0;
+		NNI_LIST_FOREACH (&item->si_children, child) {
+			if ((rv = nni_stat_walk_locked(
+			         child, path, n, fn, arg)) != 0) {
+				break;
+			}
+		}
+	}
+	path[len] = '\0';
+	return (rv);
+}
+
+int
+nni_stat_walk(nni_stat_item *root, nni_stat_walker fn, void *arg)
+{
+	char path[NNI_STAT_PATHLEN];
+	int  rv;
+
+	path[0] = '\0';
+	nni_mtx_lock(&nni_stat_lk);
+	rv = nni_stat_walk_locked(root, path, 0, fn, arg);
+	nni_mtx_unlock(&nni_stat_lk);
+	return (rv);
+}
+
+nni_stat_item *
+nni_stat_global(void)
+{
+	return (&nni_stat_global_root);
+}
+
+int
+nni_stat_sys_init(void)
+{
+	nni_mtx_init(&nni_stat_lk);
+	nni_stat_init_group(&nni_stat_global_root, "");
+	return (0);
+}
+
+void
+nni_stat_sys_fini(void)
+{
+	nni_mtx_fini(&nni_stat_lk);
+}
@@ -0,0 +1,94 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_STATS_H
+#define CORE_STATS_H
+
+#include <stdbool.h>
+
+#include "core/defs.h"
+#include "core/list.h"
+
+// Statistics support.  Statistics are organized as a tree of items.
+// Each socket owns a root, and pipes and endpoints hang their own
+// groups beneath it.  Leaf values are updated with atomics, so that
+// bumping a counter never requires a lock.  The tree structure itself
+// is protected by a single global lock, which is only taken when items
+// are added or removed, or when a snapshot walks the tree.
+//
+// nni_stat_item is defined here so that it can be inlined into
+// structures.  Callers should use the functions below rather than
+// accessing members directly.
+
+typedef struct nni_stat_item nni_stat_item;
+
+// nni_stat_update is an optional callback used to refresh the value of
+// a level just before it is read, such as the depth of a queue.
+typedef void (*nni_stat_update)(nni_stat_item *, void *);
+
+// NNI_STAT_NAMELEN is the maximum length of a single name component,
+// including the terminating NUL.  The full name reported to the user
+// is the dotted concatenation of the components from the root.
+#define NNI_STAT_NAMELEN 32
+
+struct nni_stat_item {
+	nni_list_node   si_node;
+	nni_list        si_children;
+	nni_stat_item * si_parent;
+	char            si_name[NNI_STAT_NAMELEN];
+	const char *    si_desc;
+	bool            si_group;
+	int             si_type; // NNG_STAT_LEVEL, etc.
+	int             si_unit; // NNG_UNIT_BYTES, etc.
+	nni_atomic_u64  si_value;
+	nni_stat_update si_update;
+	void *          si_private;
+};
+
+// nni_stat_init initializes an item.  A group is just an item that has
+// children; its own value is not reported.  The name is copied, but the
+// description must have static storage.
+extern void nni_stat_init(
+    nni_stat_item *, const char *, const char *, int, int);
+extern void nni_stat_init_group(nni_stat_item *, const char *);
+
+// nni_stat_set_update registers a callback for refreshing the value
+// when a snapshot is taken.
+extern void nni_stat_set_update(nni_stat_item *, nni_stat_update, void *);
+
+// nni_stat_append adds a child to a parent group.  The child must be
+// removed before either is destroyed.  Removing a group removes its
+// children from view as well.
+extern void nni_stat_append(nni_stat_item *, nni_stat_item *);
+extern void nni_stat_remove(nni_stat_item *);
+
+// Value updates.  These are lock free.
+extern void     nni_stat_inc(nni_stat_item *, uint64_t);
+extern void     nni_stat_dec(nni_stat_item *, uint64_t);
+extern void     nni_stat_set(nni_stat_item *, uint64_t);
+extern uint64_t nni_stat_get(nni_stat_item *);
+
+// nni_stat_global returns the root for statistics that are not tied
+// to any socket, such as those of the message pool.  These are included
+// in every socket snapshot.
+extern nni_stat_item *nni_stat_global(void);
+
+// nni_stat_walk visits every leaf item beneath (and including) the given
+// root, with the global tree lock held.  The name passed to the callback
+// is the dotted path relative to the root.  If the callback returns
+// non-zero, the walk is stopped and that value returned.  Groups are
+// never reported, even if they are empty.
+typedef int (*nni_stat_walker)(nni_stat_item *, const char *, void *);
+extern int nni_stat_walk(nni_stat_item *, nni_stat_walker, void *);
+
+extern int  nni_stat_sys_init(void);
+extern void nni_stat_sys_fini(void);
+
+#endif // CORE_STATS_H
@@ -1,6 +1,6 @@
 //
-// Copyright 2017 Garrett D'Amore <garrett@damore.org>
-// Copyright 2017 Capitar IT Group BV <info@capitar.com>
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
 //
 // This software is supplied under the terms of the MIT License, a
 // copy of which should be located in the distribution where this
@@ -10,26 +10,183 @@
 
 #include "core/nng_impl.h"
 
-typedef struct nni_taskq_thr nni_taskq_thr;
+#include <stdlib.h>
+
+// Each worker thread has its own queue and lock, so that dispatching
+// tasks to different workers never contends.  A task always belongs to
+// exactly one worker (task_thr), whose lock protects the task's state: it
+// is either on that worker's queue, running on that worker, or idle.  A
+// task dispatched from a worker (i.e. a completion dispatched by another
+// completion) moves to that worker, so that it runs while the caches are
+// still warm.  Other dispatches leave the task with the worker it last
+// ran on.
+//
+// Workers that run out of work steal queued tasks from the others.
+// Stealing moves ownership, so it locks both workers, always in array
+// order to avoid deadlock.  Nothing else ever holds more than one worker
+// lock, except nni_taskq_drain, which locks all of them in the same order.
+//
+// Note that once a task's callback has been run, the task itself may have
+// been freed, so after that we only ever touch the worker.
+
 struct nni_taskq_thr {
 	nni_taskq *tqt_tq;
 	nni_thr    tqt_thread;
+	nni_mtx    tqt_mtx;
+	nni_cv     tqt_sched_cv;
+	nni_cv     tqt_wait_cv;
+	nni_list   tqt_tasks;
 	nni_task * tqt_running;
-	int        tqt_wait;
+	int        tqt_waiting;
+	bool       tqt_idle;
+	bool       tqt_wake;
 };
+
 struct nni_taskq {
-	nni_list       tq_tasks;
-	nni_mtx        tq_mtx;
-	nni_cv         tq_sched_cv;
-	nni_cv         tq_wait_cv;
 	nni_taskq_thr *tq_threads;
 	int            tq_nthreads;
-	int            tq_run;
-	int            tq_waiting;
+	bool           tq_run;
+	nni_atomic_u64 tq_nidle; // workers that are idle (or about to be)
+	nni_atomic_u64 tq_next;  // spreads new tasks over the workers
 };
 
 static nni_taskq *nni_taskq_systq = NULL;
 
+// The worker running on the calling thread, if any.  This is shared by
+// all task queues, so we keep a count of them to know when to release it.
+// The first task queue is made while nng is initialized, and the last is
+// destroyed when it is finalized, which never overlap anything else, so
+// only the count itself has to be safe to change from any thread.
+static nni_plat_tls   nni_taskq_tls;
+static nni_atomic_u64 nni_taskq_count;
+
+static int
+nni_taskq_tls_hold(void)
+{
+	int rv;
+
+	if ((nni_atomic_get64(&nni_taskq_count) == 0) &&
+	    ((rv = nni_plat_tls_init(&nni_taskq_tls, NULL)) != 0)) {
+		return (rv);
+	}
+	nni_atomic_inc64(&nni_taskq_count);
+	return (0);
+}
+
+static void
+nni_taskq_tls_rele(void)
+{
+	if (nni_atomic_dec64_nv(&nni_taskq_count) == 0) {
+		nni_plat_tls_fini(&nni_taskq_tls);
+	}
+}
+
+// nni_taskq_lock_pair locks two different workers, in array order.
+static void
+nni_taskq_lock_pair(nni_taskq_thr *t1, nni_taskq_thr *t2)
+{
+	if (t1 > t2) {
+		nni_taskq_thr *t = t1;
+		t1               = t2;
+		t2               = t;
+	}
+	nni_mtx_lock(&t1->tqt_mtx);
+	nni_mtx_lock(&t2->tqt_mtx);
+}
+
+// nni_taskq_lock_task locks the worker that owns the task, and returns it.
+static nni_taskq_thr *
+nni_taskq_lock_task(nni_task *task)
+{
+	nni_taskq_thr *thr;
+
+	for (;;) {
+		thr = task->task_thr;
+		nni_mtx_lock(&thr->tqt_mtx);
+		if (task->task_thr == thr) {
+			return (thr);
+		}
+		// It was stolen while we were waiting for the lock.
+		nni_mtx_unlock(&thr->tqt_mtx);
+	}
+}
+
+static bool
+nni_taskq_busy(nni_taskq_thr *thr, nni_task *task)
+{
+	return (nni_list_node_active(&task->task_node) ||
+	    (thr->tqt_running == task));
+}
+
+// nni_taskq_wake_idle wakes one idle worker, other than the one given,
+// so that it can come steal work.
+static void
+nni_taskq_wake_idle(nni_taskq *tq, nni_taskq_thr *busy)
+{
+	int start = (int) (busy - tq->tq_threads);
+
+	for (int i = 1; i < tq->tq_nthreads; i++) {
+		nni_taskq_thr *thr;
+
+		thr = &tq->tq_threads[(start + i) % tq->tq_nthreads];
+		if ((!thr->tqt_idle) || (thr->tqt_wake)) {
+			continue;
+		}
+		nni_mtx_lock(&thr->tqt_mtx);
+		if (thr->tqt_idle && !thr->tqt_wake) {
+			thr->tqt_wake = true;
+			nni_cv_wake1(&thr->tqt_sched_cv);
+			nni_mtx_unlock(&thr->tqt_mtx);
+			return;
+		}
+		nni_mtx_unlock(&thr->tqt_mtx);
+	}
+}
+
+// nni_taskq_steal looks for a queued task on the other workers.  If it
+// finds one, it takes ownership of it, and marks it running.  This is
+// called without any locks held, and returns with the worker's own lock
+// held.
+static nni_task *
+nni_taskq_steal(nni_taskq_thr *self)
+{
+	nni_taskq *tq    = self->tqt_tq;
+	int        start = (int) (self - tq->tq_threads);
+
+	for (int i = 1; i < tq->tq_nthreads; i++) {
+		nni_taskq_thr *victim;
+		nni_task *     task;
+
+		victim = &tq->tq_threads[(start + i) % tq->tq_nthreads];
+		if (nni_list_empty(&victim->tqt_tasks)) {
+			continue; // cheap unlocked peek
+		}
+		nni_taskq_lock_pair(self, victim);
+		NNI_LIST_FOREACH (&victim->tqt_tasks, task) {
+			// A task that is already running must stay where
+			// it is, so that it never runs twice at once.
+			if (task != victim->tqt_running) {
+				break;
+			}
+		}
+		if (task != NULL) {
+			nni_list_remove(&victim->tqt_tasks, task);
+			task->task_thr    = self;
+			self->tqt_running = task;
+			if (victim->tqt_waiting) {
+				// Waiters need to follow the task.
+				nni_cv_wake(&victim->tqt_wait_cv);
+			}
+			nni_mtx_unlock(&victim->tqt_mtx);
+			return (task);
+		}
+		nni_mtx_unlock(&victim->tqt_mtx);
+		nni_mtx_unlock(&self->tqt_mtx);
+	}
+	nni_mtx_lock(&self->tqt_mtx);
+	return (NULL);
+}
+
 static void
 nni_taskq_thread(void *self)
 {
@@ -37,34 +194,45 @@ nni_taskq_thread(void *self)
 	nni_taskq *    tq  = thr->tqt_tq;
 	nni_task *     task;
 
-	nni_mtx_lock(&tq->tq_mtx);
+	(void) nni_plat_tls_set(&nni_taskq_tls, thr);
+
+	nni_mtx_lock(&thr->tqt_mtx);
 	for (;;) {
-		if ((task = nni_list_first(&tq->tq_tasks)) != NULL) {
-			nni_list_remove(&tq->tq_tasks, task);
+		if ((task = nni_list_first(&thr->tqt_tasks)) != NULL) {
+			nni_list_remove(&thr->tqt_tasks, task);
 			thr->tqt_running = task;
-			nni_mtx_unlock(&tq->tq_mtx);
-			task->task_cb(task->task_arg);
-			nni_mtx_lock(&tq->tq_mtx);
-			thr->tqt_running = NULL;
-			if (thr->tqt_wait || tq->tq_waiting) {
-				thr->tqt_wait  = 0;
-				tq->tq_waiting = 0;
-				nni_cv_wake(&tq->tq_wait_cv);
-			}
+		} else if (tq->tq_run) {
+			// Advertise ourself as idle before looking for
+			// work elsewhere, so that anything queued after we
+			// have looked will wake us.
+			thr->tqt_idle = true;
+			thr->tqt_wake = false;
+			nni_atomic_inc64(&tq->tq_nidle);
+			nni_mtx_unlock(&thr->tqt_mtx);
 
-			continue;
+			task = nni_taskq_steal(thr);
+			if ((task == NULL) && (!thr->tqt_wake) &&
+			    nni_list_empty(&thr->tqt_tasks) && tq->tq_run) {
+				nni_cv_wait(&thr->tqt_sched_cv);
+			}
+			thr->tqt_idle = false;
+			(void) nni_atomic_dec64_nv(&tq->tq_nidle);
+			if (task == NULL) {
+				continue;
+			}
+		} else {
+			break;
 		}
 
-		if (tq->tq_waiting) {
-			tq->tq_waiting = 0;
-			nni_cv_wake(&tq->tq_wait_cv);
-		}
-		if (!tq->tq_run) {
-			break;
+		nni_mtx_unlock(&thr->tqt_mtx);
+		task->task_cb(task->task_arg);
+		nni_mtx_lock(&thr->tqt_mtx);
+		thr->tqt_running = NULL;
+		if (thr->tqt_waiting) {
+			nni_cv_wake(&thr->tqt_wait_cv);
 		}
-		nni_cv_wait(&tq->tq_sched_cv);
 	}
-	nni_mtx_unlock(&tq->tq_mtx);
+	nni_mtx_unlock(&thr->tqt_mtx);
 }
 
 int
@@ -74,24 +242,34 @@ nni_taskq_init(nni_taskq **tqp, int nthr)
 	nni_taskq *tq;
 	int        i;
 
+	if ((rv = nni_taskq_tls_hold()) != 0) {
+		return (rv);
+	}
 	if ((tq = NNI_ALLOC_STRUCT(tq)) == NULL) {
+		nni_taskq_tls_rele();
 		return (NNG_ENOMEM);
 	}
 	if ((tq->tq_threads = NNI_ALLOC_STRUCTS(tq->tq_threads, nthr)) ==
 	    NULL) {
 		NNI_FREE_STRUCT(tq);
+		nni_taskq_tls_rele();
 		return (NNG_ENOMEM);
 	}
 	tq->tq_nthreads = nthr;
-	NNI_LIST_INIT(&tq->tq_tasks, nni_task, task_node);
+	nni_atomic_init64(&tq->tq_nidle);
+	nni_atomic_init64(&tq->tq_next);
 
-	nni_mtx_init(&tq->tq_mtx);
-	nni_cv_init(&tq->tq_sched_cv, &tq->tq_mtx);
-	nni_cv_init(&tq->tq_wait_cv, &tq->tq_mtx);
+	for (i = 0; i < nthr; i++) {
+		nni_taskq_thr *thr = &tq->tq_threads[i];
 
+		thr->tqt_tq      = tq;
+		thr->tqt_running = NULL;
+		NNI_LIST_INIT(&thr->tqt_tasks, nni_task, task_node);
+		nni_mtx_init(&thr->tqt_mtx);
+		nni_cv_init(&thr->tqt_sched_cv, &thr->tqt_mtx);
+		nni_cv_init(&thr->tqt_wait_cv, &thr->tqt_mtx);
+	}
 	for (i = 0; i < nthr; i++) {
-		tq->tq_threads[i].tqt_tq      = tq;
-		tq->tq_threads[i].tqt_running = NULL;
 		rv = nni_thr_init(&tq->tq_threads[i].tqt_thread,
 		    nni_taskq_thread, &tq->tq_threads[i]);
 		if (rv != 0) {
@@ -99,7 +277,7 @@ nni_taskq_init(nni_taskq **tqp, int nthr)
 			return (rv);
 		}
 	}
-	tq->tq_run = 1;
+	tq->tq_run = true;
 	for (i = 0; i < tq->tq_nthreads; i++) {
 		nni_thr_run(&tq->tq_threads[i].tqt_thread);
 	}
@@ -107,39 +285,38 @@ nni_taskq_init(nni_taskq **tqp, int nthr)
 	return (0);
 }
 
-static void
-nni_taskq_drain_locked(nni_taskq *tq)
+void
+nni_taskq_drain(nni_taskq *tq)
 {
-	// We need to first let the taskq completely drain.
+	// We need to let the taskq completely drain.  Tasks can move
+	// between workers, so we can only be sure by looking at all of
+	// them at once.
 	for (;;) {
-		int busy = 0;
-		if (!nni_list_empty(&tq->tq_tasks)) {
-			busy = 1;
-		} else {
-			int i;
-			for (i = 0; i < tq->tq_nthreads; i++) {
-				if (tq->tq_threads[i].tqt_running != 0) {
-					busy = 1;
-					break;
-				}
+		nni_taskq_thr *busy = NULL;
+
+		for (int i = 0; i < tq->tq_nthreads; i++) {
+			nni_mtx_lock(&tq->tq_threads[i].tqt_mtx);
+		}
+		for (int i = 0; i < tq->tq_nthreads; i++) {
+			nni_taskq_thr *thr = &tq->tq_threads[i];
+			if ((busy == NULL) &&
+			    ((!nni_list_empty(&thr->tqt_tasks)) ||
+			        (thr->tqt_running != NULL))) {
+				busy = thr;
+				continue;
 			}
+			nni_mtx_unlock(&thr->tqt_mtx);
 		}
-		if (!busy) {
+		if (busy == NULL) {
 			break;
 		}
-		tq->tq_waiting++;
-		nni_cv_wait(&tq->tq_wait_cv);
+		busy->tqt_waiting++;
+		nni_cv_wait(&busy->tqt_wait_cv);
+		busy->tqt_waiting--;
+		nni_mtx_unlock(&busy->tqt_mtx);
 	}
 }
 
-void
-nni_taskq_drain(nni_taskq *tq)
-{
-	nni_mtx_lock(&tq->tq_mtx);
-	nni_taskq_drain_locked(tq);
-	nni_mtx_unlock(&tq->tq_mtx);
-}
-
 void
 nni_taskq_fini(nni_taskq *tq)
 {
@@ -150,126 +327,181 @@ nni_taskq_fini(nni_taskq *tq)
 		return;
 	}
 	if (tq->tq_run) {
-		nni_mtx_lock(&tq->tq_mtx);
-		nni_taskq_drain_locked(tq);
-
-		tq->tq_run = 0;
-		nni_cv_wake(&tq->tq_sched_cv);
-		nni_mtx_unlock(&tq->tq_mtx);
+		nni_taskq_drain(tq);
+		tq->tq_run = false;
+		for (int i = 0; i < tq->tq_nthreads; i++) {
+			nni_taskq_thr *thr = &tq->tq_threads[i];
+			nni_mtx_lock(&thr->tqt_mtx);
+			nni_cv_wake(&thr->tqt_sched_cv);
+			nni_mtx_unlock(&thr->tqt_mtx);
+		}
 	}
 	for (int i = 0; i < tq->tq_nthreads; i++) {
-		nni_thr_fini(&tq->tq_threads[i].tqt_thread);
+		nni_taskq_thr *thr = &tq->tq_threads[i];
+		nni_thr_fini(&thr->tqt_thread);
+		nni_cv_fini(&thr->tqt_wait_cv);
+		nni_cv_fini(&thr->tqt_sched_cv);
+		nni_mtx_fini(&thr->tqt_mtx);
 	}
-	nni_cv_fini(&tq->tq_wait_cv);
-	nni_cv_fini(&tq->tq_sched_cv);
-	nni_mtx_fini(&tq->tq_mtx);
 	NNI_FREE_STRUCTS(tq->tq_threads, tq->tq_nthreads);
 	NNI_FREE_STRUCT(tq);
+	nni_taskq_tls_rele();
 }
 
 void
 nni_task_dispatch(nni_task *task)
 {
-	nni_taskq *tq = task->task_tq;
+	nni_taskq *    tq = task->task_tq;
+	nni_taskq_thr *self;
+	nni_taskq_thr *thr;
 
 	// If there is no callback to perform, then do nothing!
 	// The user will be none the wiser.
 	if (task->task_cb == NULL) {
 		return;
 	}
-	nni_mtx_lock(&tq->tq_mtx);
-	// It might already be scheduled... if so don't redo it.
-	if (!nni_list_active(&tq->tq_tasks, task)) {
-		nni_list_append(&tq->tq_tasks, task);
+
+	if (((self = nni_plat_tls_get(&nni_taskq_tls)) != NULL) &&
+	    (self->tqt_tq != tq)) {
+		self = NULL;
+	}
+	for (;;) {
+		thr = task->task_thr;
+		if ((self == NULL) || (self == thr)) {
+			nni_mtx_lock(&thr->tqt_mtx);
+			if (task->task_thr == thr) {
+				break;
+			}
+			nni_mtx_unlock(&thr->tqt_mtx);
+			continue;
+		}
+
+		// Try to bring the task over to our own worker.
+		nni_taskq_lock_pair(self, thr);
+		if (task->task_thr != thr) {
+			nni_mtx_unlock(&thr->tqt_mtx);
+			nni_mtx_unlock(&self->tqt_mtx);
+			continue;
+		}
+		if (nni_taskq_busy(thr, task)) {
+			// Leave it where it is.
+			nni_mtx_unlock(&self->tqt_mtx);
+			break;
+		}
+		task->task_thr = self;
+		nni_mtx_unlock(&thr->tqt_mtx);
+		thr = self;
+		break;
+	}
+
+	// It might already be scheduled... if so don't redo it.  If it is
+	// running, it goes to the back of the same worker's queue, and
+	// will only be run again once the current run finishes.
+	if (nni_list_node_active(&task->task_node)) {
+		nni_mtx_unlock(&thr->tqt_mtx);
+		return;
+	}
+	nni_list_append(&thr->tqt_tasks, task);
+	if (thr->tqt_idle) {
+		if (!thr->tqt_wake) {
+			thr->tqt_wake = true;
+			nni_cv_wake1(&thr->tqt_sched_cv);
+		}
+		nni_mtx_unlock(&thr->tqt_mtx);
+		return;
+	}
+	nni_mtx_unlock(&thr->tqt_mtx);
+
+	// The worker is busy.  If someone else is idle, let them know there
+	// is work to steal, in case the busy worker is busy for a long time.
+	if (nni_atomic_get64(&tq->tq_nidle) != 0) {
+		nni_taskq_wake_idle(tq, thr);
 	}
-	nni_cv_wake1(&tq->tq_sched_cv); // waking just one waiter is adequate
-	nni_mtx_unlock(&tq->tq_mtx);
 }
 
 void
 nni_task_wait(nni_task *task)
 {
-	nni_taskq *tq = task->task_tq;
-	int        running;
+	nni_taskq_thr *thr;
 
 	if (task->task_cb == NULL) {
 		return;
 	}
-	nni_mtx_lock(&tq->tq_mtx);
-	for (;;) {
-		running = 0;
-		if (nni_list_active(&tq->tq_tasks, task)) {
-			running = 1;
-		} else {
-			for (int i = 0; i < tq->tq_nthreads; i++) {
-				if (tq->tq_threads[i].tqt_running == task) {
-					running = 1;
-					break;
-				}
-			}
-		}
-		if (!running) {
-			break;
+	thr = nni_taskq_lock_task(task);
+	while (nni_taskq_busy(thr, task)) {
+		thr->tqt_waiting++;
+		nni_cv_wait(&thr->tqt_wait_cv);
+		thr->tqt_waiting--;
+		if (task->task_thr != thr) {
+			nni_mtx_unlock(&thr->tqt_mtx);
+			thr = nni_taskq_lock_task(task);
 		}
-
-		tq->tq_waiting = 1;
-		nni_cv_wait(&tq->tq_wait_cv);
 	}
-	nni_mtx_unlock(&tq->tq_mtx);
+	nni_mtx_unlock(&thr->tqt_mtx);
 }
 
 int
 nni_task_cancel(nni_task *task)
 {
-	nni_taskq *tq = task->task_tq;
-	int        running;
+	nni_taskq_thr *thr;
 
-	nni_mtx_lock(&tq->tq_mtx);
-	running = 1;
+	thr = nni_taskq_lock_task(task);
 	for (;;) {
-		running = 0;
-		for (int i = 0; i < tq->tq_nthreads; i++) {
-			if (tq->tq_threads[i].tqt_running == task) {
-				running = 1;
-				break;
-			}
+		if (nni_list_node_active(&task->task_node)) {
+			nni_list_remove(&thr->tqt_tasks, task);
 		}
-
-		if (!running) {
+		if (thr->tqt_running != task) {
 			break;
 		}
-		// tq->tq_threads[i].tqt_wait = 1;
-		tq->tq_waiting++;
-		nni_cv_wait(&tq->tq_wait_cv);
-	}
-
-	if (nni_list_active(&tq->tq_tasks, task)) {
-		nni_list_remove(&tq->tq_tasks, task);
+		thr->tqt_waiting++;
+		nni_cv_wait(&thr->tqt_wait_cv);
+		thr->tqt_waiting--;
+		if (task->task_thr != thr) {
+			nni_mtx_unlock(&thr->tqt_mtx);
+			thr = nni_taskq_lock_task(task);
+		}
 	}
-	nni_mtx_unlock(&tq->tq_mtx);
+	nni_mtx_unlock(&thr->tqt_mtx);
 	return (0);
 }
 
 void
 nni_task_init(nni_taskq *tq, nni_task *task, nni_cb cb, void *arg)
 {
+	uint64_t n;
+
 	if (tq == NULL) {
 		tq = nni_taskq_systq;
 	}
+	n = nni_atomic_inc64_nv(&tq->tq_next);
+
 	NNI_LIST_NODE_INIT(&task->task_node);
 	task->task_cb  = cb;
 	task->task_arg = arg;
 	task->task_tq  = tq;
+	task->task_thr = &tq->tq_threads[n % (uint64_t) tq->tq_nthreads];
 }
 
 int
 nni_taskq_sys_init(void)
 {
-	int rv;
+	int   nthr;
+	char *env;
 
-	// XXX: Make the "16" = NCPUs * 2
-	rv = nni_taskq_init(&nni_taskq_systq, 16);
-	return (rv);
+	// By default we use two threads per CPU, as tasks may block.  This
+	// can be overridden with the NNG_TASKQ_THREADS environment variable,
+	// but we always want at least two, as some tasks wait for others.
+	nthr = nni_plat_ncpu() * 2;
+	if ((env = getenv("NNG_TASKQ_THREADS")) != NULL) {
+		long n = strtol(env, NULL, 10);
+		if ((n > 0) && (n <= 1024)) {
+			nthr = (int) n;
+		}
+	}
+	if (nthr < 2) {
+		nthr = 2;
+	}
+	return (nni_taskq_init(&nni_taskq_systq, nthr));
 }
 
 void
@@ -1,6 +1,6 @@
 //
-// Copyright 2017 Garrett D'Amore <garrett@damore.org>
-// Copyright 2017 Capitar IT Group BV <info@capitar.com>
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
 //
 // This software is supplied under the terms of the MIT License, a
 // copy of which should be located in the distribution where this
@@ -14,24 +14,33 @@
 #include "core/defs.h"
 #include "core/list.h"
 
-typedef struct nni_taskq nni_taskq;
-typedef struct nni_task  nni_task;
+typedef struct nni_taskq     nni_taskq;
+typedef struct nni_taskq_thr nni_taskq_thr;
+typedef struct nni_task      nni_task;
 
 // nni_task is a structure representing a task.  Its intended to inlined
 // into structures so that taskq_dispatch can be a guaranteed operation.
+// Each task belongs to one of the queue's worker threads at a time (the
+// task_thr), and that thread's lock protects it.
 struct nni_task {
-	nni_list_node task_node;
-	void *        task_arg;
-	nni_cb        task_cb;
-	nni_taskq *   task_tq;
+	nni_list_node  task_node;
+	void *         task_arg;
+	nni_cb         task_cb;
+	nni_taskq *    task_tq;
+	nni_taskq_thr *task_thr;
 };
 
+// nni_taskq_init creates a task queue with the given number of worker
+// threads.  Each worker has its own queue of tasks, and idle workers
+// steal from busy ones.
 extern int  nni_taskq_init(nni_taskq **, int);
 extern void nni_taskq_fini(nni_taskq *);
 extern void nni_taskq_drain(nni_taskq *);
 
 // nni_task_dispatch sends the task to the queue.  It is guaranteed to
 // succeed.  (If the queue is shutdown, then the behavior is undefined.)
+// When called from one of the queue's own workers (that is, from another
+// task), the task is run on that same worker if it is not stolen first.
 extern void nni_task_dispatch(nni_task *);
 
 // nni_task_cancel cancels the task.  It will wait for the task to complete
@@ -173,3 +173,87 @@ nni_thr_fini(nni_thr *thr)
 	nni_plat_mtx_fini(&thr->mtx);
 	thr->init = 0;
 }
+
+// nni_tlocal_destroy is called when a thread exits.  This only happens
+// while the key exists; values left at nni_tlocal_fini are released from
+// the list instead.
+static void
+nni_tlocal_destroy(void *arg)
+{
+	nni_tlocal_node *tn = arg;
+	nni_tlocal *     tl = tn->tn_tl;
+
+	nni_mtx_lock(&tl->mtx);
+	nni_list_remove(&tl->vals, tn);
+	nni_mtx_unlock(&tl->mtx);
+	tl->free_fn(((char *) tn) - tl->offset);
+}
+
+int
+nni_tlocal_init_offset(nni_tlocal *tl, size_t offset,
+    void *(*alloc_fn)(void), void (*free_fn)(void *))
+{
+	int rv;
+
+	nni_list_init_offset(&tl->vals, offsetof(nni_tlocal_node, tn_node));
+	nni_mtx_init(&tl->mtx);
+	tl->offset   = offset;
+	tl->alloc_fn = alloc_fn;
+	tl->free_fn  = free_fn;
+	if ((rv = nni_plat_tls_init(&tl->key, nni_tlocal_destroy)) != 0) {
+		nni_mtx_fini(&tl->mtx);
+		return (rv);
+	}
+	tl->init = 1;
+	return (0);
+}
+
+void
+nni_tlocal_fini(nni_tlocal *tl)
+{
+	nni_tlocal_node *tn;
+
+	if (!tl->init) {
+		return;
+	}
+	// Deleting the key does not run the destructors, so the values of
+	// threads still running are released here.  The key goes first, so
+	// that no thread exiting meanwhile can release them as well.
+	(void) nni_plat_tls_set(&tl->key, NULL);
+	tl->init = 0;
+	nni_plat_tls_fini(&tl->key);
+	nni_mtx_lock(&tl->mtx);
+	while ((tn = nni_list_first(&tl->vals)) != NULL) {
+		nni_list_remove(&tl->vals, tn);
+		tl->free_fn(((char *) tn) - tl->offset);
+	}
+	nni_mtx_unlock(&tl->mtx);
+	nni_mtx_fini(&tl->mtx);
+}
+
+void *
+nni_tlocal_get(nni_tlocal *tl)
+{
+	nni_tlocal_node *tn;
+	void *           val;
+
+	if (!tl->init) {
+		return (NULL);
+	}
+	if ((tn = nni_plat_tls_get(&tl->key)) != NULL) {
+		return (((char *) tn) - tl->offset);
+	}
+	if ((val = tl->alloc_fn()) == NULL) {
+		return (NULL);
+	}
+	tn        = (nni_tlocal_node *) (((char *) val) + tl->offset);
+	tn->tn_tl = tl;
+	if (nni_plat_tls_set(&tl->key, tn) != 0) {
+		tl->free_fn(val);
+		return (NULL);
+	}
+	nni_mtx_lock(&tl->mtx);
+	nni_list_append(&tl->vals, tn);
+	nni_mtx_unlock(&tl->mtx);
+	return (val);
+}
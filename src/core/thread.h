@@ -12,6 +12,7 @@
 #define CORE_THREAD_H
 
 #include "core/defs.h"
+#include "core/list.h"
 #include "core/platform.h"
 
 struct nni_thr {
@@ -26,6 +27,22 @@ struct nni_thr {
 	int          init;
 };
 
+// Each value kept in an nni_tlocal embeds one of these.
+typedef struct nni_tlocal_node {
+	nni_list_node tn_node;
+	nni_tlocal *  tn_tl;
+} nni_tlocal_node;
+
+struct nni_tlocal {
+	nni_plat_tls key;
+	nni_mtx      mtx;    // protects vals
+	nni_list     vals;   // values of all threads
+	size_t       offset; // of the nni_tlocal_node within each value
+	void *(*alloc_fn)(void);
+	void (*free_fn)(void *);
+	int init;
+};
+
 // nni_mtx_init initializes the mutex.
 extern void nni_mtx_init(nni_mtx *mtx);
 
@@ -82,4 +99,25 @@ extern void nni_thr_run(nni_thr *thr);
 // at all.
 extern void nni_thr_wait(nni_thr *thr);
 
+// nni_tlocal_init_offset creates a slot holding a value per thread.
+// Values are made by alloc_fn on first use, and released by free_fn,
+// either when their thread exits or, for threads still running, at
+// nni_tlocal_fini.  Use NNI_TLOCAL_INIT to give the offset of the
+// nni_tlocal_node in the value.
+extern int nni_tlocal_init_offset(
+    nni_tlocal *, size_t, void *(*alloc_fn)(void), void (*free_fn)(void *));
+
+#define NNI_TLOCAL_INIT(tl, type, field, alloc_fn, free_fn) \
+	nni_tlocal_init_offset(tl, offsetof(type, field), alloc_fn, free_fn)
+
+// nni_tlocal_fini releases the values of all threads.  The slot must not
+// be used concurrently; after this nni_tlocal_get returns NULL.  It is
+// safe to call this on a slot that failed to initialize.
+extern void nni_tlocal_fini(nni_tlocal *);
+
+// nni_tlocal_get returns the calling thread's value, creating it if
+// needed, or NULL if there is none (because of a failure to allocate,
+// or because the slot is finalized).
+extern void *nni_tlocal_get(nni_tlocal *);
+
 #endif // CORE_THREAD_H
@@ -15,12 +15,251 @@
 
 static void nni_timer_loop(void *);
 
-// XXX: replace this timer list with a minHeap based priority queue.
+// Timing wheel implementation.  See timer.h for an overview.
+//
+// An item lives at the lowest level whose slot, together with the levels
+// above it, describes its expiration time relative to the current time.
+// Put another way, the level is chosen by the most significant bits in
+// which the expiration and the current time differ.  This means that an
+// item on level L always lies in a later slot of that level than the
+// current time, and that it needs no attention until the current time
+// reaches the start of that slot.
+
+#define NNI_WHEEL_MASK (NNI_WHEEL_SLOTS - 1)
+#define NNI_WHEEL_SPAN ((nni_time) 1 << (NNI_WHEEL_BITS * NNI_WHEEL_LEVELS))
+#define NNI_WHEEL_FAR (NNI_WHEEL_LEVELS * NNI_WHEEL_SLOTS)
+#define NNI_WHEEL_READY (NNI_WHEEL_FAR + 1)
+
+#define NNI_WHEEL_NODE(w, item) \
+	((nni_wheel_node *) (((char *) (item)) + (w)->w_offset))
+
+void
+nni_wheel_init_offset(nni_wheel *w, size_t offset, nni_time now)
+{
+	size_t noff = offset + offsetof(nni_wheel_node, wn_node);
+
+	w->w_now    = now;
+	w->w_offset = offset;
+	for (int l = 0; l < NNI_WHEEL_LEVELS; l++) {
+		w->w_bits[l] = 0;
+		for (unsigned i = 0; i < NNI_WHEEL_SLOTS; i++) {
+			nni_list_init_offset(&w->w_slots[l][i], noff);
+		}
+	}
+	nni_list_init_offset(&w->w_far, noff);
+	nni_list_init_offset(&w->w_ready, noff);
+}
+
+// nni_wheel_ffs returns the index of the lowest bit set.
+static unsigned
+nni_wheel_ffs(uint64_t bits)
+{
+	unsigned i = 0;
+
+	NNI_ASSERT(bits != 0);
+	while ((bits & 0xff) == 0) {
+		bits >>= 8;
+		i += 8;
+	}
+	while ((bits & 1) == 0) {
+		bits >>= 1;
+		i++;
+	}
+	return (i);
+}
+
+static void
+nni_wheel_place(nni_wheel *w, void *item)
+{
+	nni_wheel_node *node = NNI_WHEEL_NODE(w, item);
+	nni_time        when;
+	nni_time        diff;
+	unsigned        level;
+	unsigned        idx;
+
+	// Things already due go into the current slot.
+	when = node->wn_expire < w->w_now ? w->w_now : node->wn_expire;
+	diff = when ^ w->w_now;
+
+	if (diff >= NNI_WHEEL_SPAN) {
+		node->wn_slot = NNI_WHEEL_FAR;
+		nni_list_append(&w->w_far, item);
+		return;
+	}
+	level = 0;
+	while ((diff >> ((level + 1) * NNI_WHEEL_BITS)) != 0) {
+		level++;
+	}
+	idx = (unsigned) (when >> (level * NNI_WHEEL_BITS)) & NNI_WHEEL_MASK;
+	node->wn_slot = level * NNI_WHEEL_SLOTS + idx;
+	nni_list_append(&w->w_slots[level][idx], item);
+	w->w_bits[level] |= ((uint64_t) 1 << idx);
+}
+
+void
+nni_wheel_remove(nni_wheel *w, void *item)
+{
+	nni_wheel_node *node = NNI_WHEEL_NODE(w, item);
+	unsigned        level;
+	unsigned        idx;
+
+	if (!nni_list_node_active(&node->wn_node)) {
+		return;
+	}
+	nni_list_node_remove(&node->wn_node);
+	if (node->wn_slot < NNI_WHEEL_FAR) {
+		level = node->wn_slot / NNI_WHEEL_SLOTS;
+		idx   = node->wn_slot % NNI_WHEEL_SLOTS;
+		if (nni_list_empty(&w->w_slots[level][idx])) {
+			w->w_bits[level] &= ~((uint64_t) 1 << idx);
+		}
+	}
+}
+
+bool
+nni_wheel_active(nni_wheel *w, void *item)
+{
+	return (nni_list_node_active(&NNI_WHEEL_NODE(w, item)->wn_node));
+}
+
+void
+nni_wheel_add(nni_wheel *w, void *item, nni_time when)
+{
+	nni_wheel_remove(w, item);
+	NNI_WHEEL_NODE(w, item)->wn_expire = when;
+	nni_wheel_place(w, item);
+}
+
+// nni_wheel_event returns the next time at which the wheel needs to
+// do something: either expire the items in a level 0 slot, or cascade
+// a slot at a higher level.
+static nni_time
+nni_wheel_event(nni_wheel *w)
+{
+	for (unsigned l = 0; l < NNI_WHEEL_LEVELS; l++) {
+		unsigned shift = l * NNI_WHEEL_BITS;
+		unsigned cur   = (unsigned) (w->w_now >> shift) & NNI_WHEEL_MASK;
+		uint64_t bits  = w->w_bits[l];
+		nni_time base;
+
+		// Level 0 includes the current slot, which holds anything
+		// that is already due.  Higher levels never use theirs.
+		if (l > 0) {
+			cur++;
+		}
+		if (cur >= NNI_WHEEL_SLOTS) {
+			continue;
+		}
+		if ((bits &= (~(uint64_t) 0) << cur) == 0) {
+			continue;
+		}
+		base = w->w_now & ~(((nni_time) 1 << (shift + NNI_WHEEL_BITS)) - 1);
+		return (base | ((nni_time) nni_wheel_ffs(bits) << shift));
+	}
+	if (!nni_list_empty(&w->w_far)) {
+		// Start of the next turn of the top level.
+		return ((w->w_now | (NNI_WHEEL_SPAN - 1)) + 1);
+	}
+	return (NNI_TIME_NEVER);
+}
+
+// nni_wheel_cascade redistributes the slots that start at the current
+// time, from the top down, so that items reach level 0 by the time they
+// are due.
+static void
+nni_wheel_cascade(nni_wheel *w)
+{
+	nni_list *list;
+	nni_list  far;
+	void *    item;
+
+	if ((w->w_now & (NNI_WHEEL_SPAN - 1)) == 0) {
+		// Some of these may well go right back on the far list,
+		// so take them all off it first.
+		nni_list_init_offset(&far, w->w_far.ll_offset);
+		while ((item = nni_list_first(&w->w_far)) != NULL) {
+			nni_list_remove(&w->w_far, item);
+			nni_list_append(&far, item);
+		}
+		while ((item = nni_list_first(&far)) != NULL) {
+			nni_list_remove(&far, item);
+			nni_wheel_place(w, item);
+		}
+	}
+	for (unsigned l = NNI_WHEEL_LEVELS - 1; l > 0; l--) {
+		unsigned shift = l * NNI_WHEEL_BITS;
+		unsigned idx;
+
+		if ((w->w_now & (((nni_time) 1 << shift) - 1)) != 0) {
+			continue;
+		}
+		idx  = (unsigned) (w->w_now >> shift) & NNI_WHEEL_MASK;
+		list = &w->w_slots[l][idx];
+		while ((item = nni_list_first(list)) != NULL) {
+			nni_list_remove(list, item);
+			nni_wheel_place(w, item);
+		}
+		w->w_bits[l] &= ~((uint64_t) 1 << idx);
+	}
+}
+
+static void
+nni_wheel_advance(nni_wheel *w, nni_time now)
+{
+	for (;;) {
+		unsigned  idx  = (unsigned) w->w_now & NNI_WHEEL_MASK;
+		nni_list *list = &w->w_slots[0][idx];
+		void *    item;
+		nni_time  next;
+
+		while ((item = nni_list_first(list)) != NULL) {
+			nni_list_remove(list, item);
+			NNI_WHEEL_NODE(w, item)->wn_slot = NNI_WHEEL_READY;
+			nni_list_append(&w->w_ready, item);
+		}
+		w->w_bits[0] &= ~((uint64_t) 1 << idx);
+
+		if (w->w_now >= now) {
+			return;
+		}
+		if ((next = nni_wheel_event(w)) > now) {
+			// Nothing happens between here and now, so we can
+			// skip straight there.
+			w->w_now = now;
+			return;
+		}
+		w->w_now = next;
+		nni_wheel_cascade(w);
+	}
+}
+
+void *
+nni_wheel_expire(nni_wheel *w, nni_time now)
+{
+	void *item;
+
+	nni_wheel_advance(w, now);
+	if ((item = nni_list_first(&w->w_ready)) != NULL) {
+		nni_list_remove(&w->w_ready, item);
+	}
+	return (item);
+}
+
+nni_time
+nni_wheel_next(nni_wheel *w)
+{
+	if (!nni_list_empty(&w->w_ready)) {
+		return (w->w_now);
+	}
+	return (nni_wheel_event(w));
+}
+
 struct nni_timer {
 	nni_mtx         t_mx;
 	nni_cv          t_wait_cv;
 	nni_cv          t_sched_cv;
-	nni_list        t_entries;
+	nni_wheel       t_wheel;
+	nni_time        t_next; // when the timer thread will wake
 	nni_thr         t_thr;
 	int             t_run;
 	int             t_waiting;
@@ -38,7 +277,8 @@ nni_timer_sys_init(void)
 	nni_timer *timer = &nni_global_timer;
 
 	memset(timer, 0, sizeof(*timer));
-	NNI_LIST_INIT(&timer->t_entries, nni_timer_node, t_node);
+	NNI_WHEEL_INIT(&timer->t_wheel, nni_timer_node, t_wnode, nni_clock());
+	timer->t_next = NNI_TIME_NEVER;
 
 	nni_mtx_init(&timer->t_mx);
 	nni_cv_init(&timer->t_sched_cv, &timer->t_mx);
@@ -76,6 +316,7 @@ nni_timer_init(nni_timer_node *node, nni_cb cb, void *arg)
 {
 	node->t_cb  = cb;
 	node->t_arg = arg;
+	NNI_LIST_NODE_INIT(&node->t_wnode.wn_node);
 }
 
 void
@@ -94,35 +335,18 @@ nni_timer_cancel(nni_timer_node *node)
 		timer->t_waiting = 1;
 		nni_cv_wait(&timer->t_wait_cv);
 	}
-	if (nni_list_active(&timer->t_entries, node)) {
-		nni_list_remove(&timer->t_entries, node);
-	}
+	nni_wheel_remove(&timer->t_wheel, node);
 	nni_mtx_unlock(&timer->t_mx);
 }
 
 void
 nni_timer_schedule(nni_timer_node *node, nni_time when)
 {
-	nni_timer *     timer = &nni_global_timer;
-	nni_timer_node *srch;
+	nni_timer *timer = &nni_global_timer;
 
 	nni_mtx_lock(&timer->t_mx);
-	node->t_expire = when;
-
-	if (nni_list_active(&timer->t_entries, node)) {
-		nni_list_remove(&timer->t_entries, node);
-	}
-
-	srch = nni_list_first(&timer->t_entries);
-	while ((srch != NULL) && (srch->t_expire < node->t_expire)) {
-		srch = nni_list_next(&timer->t_entries, srch);
-	}
-	if (srch != NULL) {
-		nni_list_insert_before(&timer->t_entries, node, srch);
-	} else {
-		nni_list_append(&timer->t_entries, node);
-	}
-	if (nni_list_first(&timer->t_entries) == node) {
+	nni_wheel_add(&timer->t_wheel, node, when);
+	if (when < timer->t_next) {
 		nni_cv_wake1(&timer->t_sched_cv);
 	}
 	nni_mtx_unlock(&timer->t_mx);
@@ -132,7 +356,6 @@ static void
 nni_timer_loop(void *arg)
 {
 	nni_timer *     timer = arg;
-	nni_time        now;
 	nni_timer_node *node;
 
 	for (;;) {
@@ -147,20 +370,21 @@ nni_timer_loop(void *arg)
 			break;
 		}
 
-		now = nni_clock();
-		if ((node = nni_list_first(&timer->t_entries)) == NULL) {
-			nni_cv_wait(&timer->t_sched_cv);
+		node = nni_wheel_expire(&timer->t_wheel, nni_clock());
+		if (node == NULL) {
+			// Nothing due yet; sleep until the wheel needs us,
+			// or until something sooner is scheduled.
+			timer->t_next = nni_wheel_next(&timer->t_wheel);
+			if (timer->t_next == NNI_TIME_NEVER) {
+				nni_cv_wait(&timer->t_sched_cv);
+			} else {
+				(void) nni_cv_until(
+				    &timer->t_sched_cv, timer->t_next);
+			}
+			timer->t_next = NNI_TIME_NEVER;
 			nni_mtx_unlock(&timer->t_mx);
 			continue;
 		}
-		if (now < node->t_expire) {
-			// End of run, we have to wait for next.
-			nni_cv_until(&timer->t_sched_cv, node->t_expire);
-			nni_mtx_unlock(&timer->t_mx);
-			continue;
-		}
-
-		nni_list_remove(&timer->t_entries, node);
 
 		// Save the active node.  Note that the timer callback can
 		// free this memory or do something else with it, so it is
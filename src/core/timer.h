@@ -1,5 +1,6 @@
 //
-// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
 //
 // This software is supplied under the terms of the MIT License, a
 // copy of which should be located in the distribution where this
@@ -10,16 +11,78 @@
 #ifndef CORE_TIMER_H
 #define CORE_TIMER_H
 
+#include <stdbool.h>
+
 #include "core/defs.h"
 #include "core/list.h"
 
+// Timing wheels.  A wheel holds items, each with an expiration time, and
+// hands them back once that time has been reached.  Adding and removing
+// items are O(1), as is finding the next time that needs attention.
+//
+// The wheel is hierarchical: level 0 has one slot per millisecond, and
+// each higher level has slots covering a full turn of the level below
+// it.  Items are moved down ("cascaded") as time approaches them.  Items
+// further out than the top level covers are parked on a separate list,
+// and reconsidered each time the top level comes around (about every 12
+// days).  Empty stretches are skipped, so a long idle period costs no
+// more than a short one.
+//
+// Wheels do no locking of their own; the owner must provide that.  Items
+// embed an nni_wheel_node, and the wheel is told where, in the same way
+// as lists (see NNI_LIST_INIT).
+
+#define NNI_WHEEL_BITS 6
+#define NNI_WHEEL_SLOTS (1U << NNI_WHEEL_BITS)
+#define NNI_WHEEL_LEVELS 5
+
+typedef struct nni_wheel_node {
+	nni_list_node wn_node;
+	nni_time      wn_expire;
+	unsigned      wn_slot; // valid only when on a list
+} nni_wheel_node;
+
+typedef struct nni_wheel {
+	nni_time w_now;
+	size_t   w_offset;
+	uint64_t w_bits[NNI_WHEEL_LEVELS]; // non-empty slots
+	nni_list w_slots[NNI_WHEEL_LEVELS][NNI_WHEEL_SLOTS];
+	nni_list w_far;   // beyond the top level
+	nni_list w_ready; // expired, but not yet collected
+} nni_wheel;
+
+extern void nni_wheel_init_offset(nni_wheel *, size_t, nni_time);
+
+#define NNI_WHEEL_INIT(wheel, type, field, now) \
+	nni_wheel_init_offset(wheel, offsetof(type, field), now)
+
+// nni_wheel_add adds the item, to expire at the given time.  If the item
+// is already on the wheel, it is rescheduled.  Times in the past expire
+// at the next call to nni_wheel_expire.
+extern void nni_wheel_add(nni_wheel *, void *, nni_time);
+
+// nni_wheel_remove removes the item from the wheel, if it is present.
+extern void nni_wheel_remove(nni_wheel *, void *);
+
+// nni_wheel_active returns true if the item is on the wheel.
+extern bool nni_wheel_active(nni_wheel *, void *);
+
+// nni_wheel_expire advances the wheel to the given time, and then removes
+// and returns one expired item, or NULL if there are none.
+extern void *nni_wheel_expire(nni_wheel *, nni_time);
+
+// nni_wheel_next returns the time at which nni_wheel_expire should next
+// be called.  Nothing will expire before then, but it may be that nothing
+// expires then either, as the wheel may just need to cascade.  If the
+// wheel is empty, NNI_TIME_NEVER is returned.
+extern nni_time nni_wheel_next(nni_wheel *);
+
 // For the sake of simplicity, we just maintain a single global timer thread.
 
 struct nni_timer_node {
-	nni_time      t_expire;
-	nni_cb        t_cb;
-	void *        t_arg;
-	nni_list_node t_node;
+	nni_cb         t_cb;
+	void *         t_arg;
+	nni_wheel_node t_wnode;
 };
 
 typedef struct nni_timer_node nni_timer_node;
@@ -13,6 +13,7 @@
 #include "transport/ipc/ipc.h"
 #include "transport/tcp/tcp.h"
 #include "transport/tls/tls.h"
+#include "transport/udp/udp.h"
 #include "transport/ws/websocket.h"
 #include "transport/zerotier/zerotier.h"
 
@@ -148,6 +149,9 @@ static nni_tran_ctor nni_tran_ctors[] = {
 #ifdef NNG_TRANSPORT_TLS
 	nng_tls_register,
 #endif
+#ifdef NNG_TRANSPORT_UDP
+	nng_udp_register,
+#endif
 #ifdef NNG_TRANSPORT_WS
 	nng_ws_register,
 #endif
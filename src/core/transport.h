@@ -143,6 +143,12 @@ struct nni_tran_pipe {
 	// it is finished with it.
 	void (*p_send)(void *, nni_aio *);
 
+	// p_sendwin returns how many sends the pipe accepts at once.  Sends
+	// beyond the first wait in the transport, which completes them in
+	// order, and may write them together.  If this member is NULL, then
+	// only one send may be outstanding at a time.
+	int (*p_sendwin)(void *);
+
 	// p_recv schedules a message receive. This will be performed even for
 	// cases where no data is expected, to allow detection of a remote
 	// disconnect.
@@ -160,6 +166,11 @@ struct nni_tran_pipe {
 	// a NULL name. If this member is NULL, then no transport specific
 	// options are available.
 	nni_tran_pipe_option *p_options;
+
+	// p_stats adds any transport specific statistics to the pipe's
+	// group, which is supplied.  The items must remain valid until the
+	// pipe is finalized.  This member may be NULL.
+	void (*p_stats)(void *, nni_stat_item *);
 };
 
 // These APIs are used by the framework internally, and not for use by
@@ -61,7 +61,10 @@ nng_alloc(size_t sz)
 void
 nng_free(void *buf, size_t sz)
 {
-	nni_free(buf, sz);
+	// Buffers from nng_recv may be message bodies on loan.
+	if (!nni_msg_loan_free(buf)) {
+		nni_free(buf, sz);
+	}
 }
 
 int
@@ -80,21 +83,22 @@ nng_recv(nng_socket sid, void *buf, size_t *szp, int flags)
 		    *szp > nng_msg_len(msg) ? nng_msg_len(msg) : *szp);
 		*szp = nng_msg_len(msg);
 	} else {
-		// We'd really like to avoid a separate data copy, but since
-		// we have allocated messages with headroom, we can't really
-		// make free() work on the base pointer.  We'd have to have
-		// some other API for this.  Folks that want zero copy had
-		// better use nng_recvmsg() instead.
-		void *nbuf;
-
-		if ((nbuf = nni_alloc(nng_msg_len(msg))) == NULL) {
-			nng_msg_free(msg);
-			return (NNG_ENOMEM);
+		// Large bodies are handed over as they are, without a copy;
+		// nng_free knows how to release them despite the headroom.
+		// Small ones are copied, which is cheap, and lets their
+		// storage go back to the message pool.
+		size_t len = nni_msg_len(msg);
+		void * nbuf;
+
+		if ((nbuf = nni_msg_body_loan(msg)) == NULL) {
+			if ((nbuf = nni_alloc(len)) == NULL) {
+				nng_msg_free(msg);
+				return (NNG_ENOMEM);
+			}
+			memcpy(nbuf, nni_msg_body(msg), len);
 		}
-
 		*(void **) buf = nbuf;
-		memcpy(nbuf, nni_msg_body(msg), nni_msg_len(msg));
-		*szp = nng_msg_len(msg);
+		*szp           = len;
 	}
 	nni_msg_free(msg);
 	return (0);
@@ -103,29 +107,14 @@ nng_recv(nng_socket sid, void *buf, size_t *szp, int flags)
 int
 nng_recvmsg(nng_socket sid, nng_msg **msgp, int flags)
 {
-	int      rv;
-	nng_aio *ap;
+	nni_sock *sock;
+	int       rv;
 
-	if ((rv = nng_aio_alloc(&ap, NULL, NULL)) != 0) {
+	if ((rv = nni_sock_find(&sock, sid)) != 0) {
 		return (rv);
 	}
-	if (flags & NNG_FLAG_NONBLOCK) {
-		nng_aio_set_timeout(ap, NNG_DURATION_ZERO);
-	} else {
-		nng_aio_set_timeout(ap, NNG_DURATION_DEFAULT);
-	}
-
-	nng_recv_aio(sid, ap);
-	nng_aio_wait(ap);
-
-	if ((rv = nng_aio_result(ap)) == 0) {
-		*msgp = nng_aio_get_msg(ap);
-
-	} else if ((rv == NNG_ETIMEDOUT) && (flags == NNG_FLAG_NONBLOCK)) {
-		rv = NNG_EAGAIN;
-	}
-	nng_aio_free(ap);
-
+	rv = nni_sock_recvmsg(sock, msgp, flags);
+	nni_sock_rele(sock);
 	return (rv);
 }
 
@@ -135,6 +124,21 @@ nng_send(nng_socket sid, void *buf, size_t len, int flags)
 	nng_msg *msg;
 	int      rv;
 
+	// With NNG_FLAG_ALLOC, large buffers become the message body
+	// directly, rather than being copied and then freed.
+	if ((flags & NNG_FLAG_ALLOC) && (len > 0)) {
+		if ((rv = nni_msg_alloc(&msg, 0)) != 0) {
+			return (rv);
+		}
+		if (nni_msg_body_adopt(msg, buf, len) == 0) {
+			if ((rv = nng_sendmsg(sid, msg, flags)) != 0) {
+				nng_msg_free(msg); // frees buf too
+			}
+			return (rv);
+		}
+		nni_msg_free(msg);
+	}
+
 	if ((rv = nng_msg_alloc(&msg, len)) != 0) {
 		return (rv);
 	}
@@ -143,7 +147,7 @@ nng_send(nng_socket sid, void *buf, size_t len, int flags)
 		nng_msg_free(msg);
 	}
 	if (flags & NNG_FLAG_ALLOC) {
-		nni_free(buf, len);
+		nng_free(buf, len);
 	}
 	return (rv);
 }
@@ -151,31 +155,14 @@ nng_send(nng_socket sid, void *buf, size_t len, int flags)
 int
 nng_sendmsg(nng_socket sid, nng_msg *msg, int flags)
 {
-	int      rv;
-	nng_aio *ap;
+	nni_sock *sock;
+	int       rv;
 
-	if ((rv = nng_aio_alloc(&ap, NULL, NULL)) != 0) {
+	if ((rv = nni_sock_find(&sock, sid)) != 0) {
 		return (rv);
 	}
-	if (flags & NNG_FLAG_NONBLOCK) {
-		nng_aio_set_timeout(ap, NNG_DURATION_ZERO);
-	} else {
-		nng_aio_set_timeout(ap, NNG_DURATION_DEFAULT);
-	}
-
-	nng_aio_set_msg(ap, msg);
-	nng_send_aio(sid, ap);
-	nng_aio_wait(ap);
-
-	rv = nng_aio_result(ap);
-	nng_aio_free(ap);
-
-	// Possibly massage nonblocking attempt.  Note that nonblocking is
-	// still done asynchronously, and the calling thread loses context.
-	if ((rv == NNG_ETIMEDOUT) && (flags == NNG_FLAG_NONBLOCK)) {
-		rv = NNG_EAGAIN;
-	}
-
+	rv = nni_sock_sendmsg(sock, msg, flags);
+	nni_sock_rele(sock);
 	return (rv);
 }
 
@@ -207,6 +194,119 @@ nng_send_aio(nng_socket sid, nng_aio *aio)
 	nni_sock_rele(sock);
 }
 
+int
+nng_ctx_open(nng_ctx *idp, nng_socket sid)
+{
+	nni_sock *sock;
+	nni_ctx * ctx;
+	int       rv;
+
+	if ((rv = nni_sock_find(&sock, sid)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_ctx_open(&ctx, sock)) == 0) {
+		*idp = nni_ctx_id(ctx);
+		nni_ctx_rele(ctx);
+	}
+	nni_sock_rele(sock);
+	return (rv);
+}
+
+int
+nng_ctx_close(nng_ctx id)
+{
+	nni_ctx *ctx;
+	int      rv;
+
+	if ((rv = nni_ctx_find(&ctx, id, true)) != 0) {
+		return (rv);
+	}
+	nni_ctx_close(ctx);
+	return (0);
+}
+
+void
+nng_ctx_recv(nng_ctx id, nng_aio *aio)
+{
+	nni_ctx *ctx;
+	int      rv;
+
+	if ((rv = nni_ctx_find(&ctx, id, false)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_ctx_recv(ctx, aio);
+	nni_ctx_rele(ctx);
+}
+
+void
+nng_ctx_send(nng_ctx id, nng_aio *aio)
+{
+	nni_ctx *ctx;
+	int      rv;
+
+	if ((rv = nni_ctx_find(&ctx, id, false)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_ctx_send(ctx, aio);
+	nni_ctx_rele(ctx);
+}
+
+int
+nng_ctx_getopt(nng_ctx id, const char *name, void *val, size_t *szp)
+{
+	nni_ctx *ctx;
+	int      rv;
+
+	if ((rv = nni_ctx_find(&ctx, id, false)) != 0) {
+		return (rv);
+	}
+	rv = nni_ctx_getopt(ctx, name, val, szp);
+	nni_ctx_rele(ctx);
+	return (rv);
+}
+
+int
+nng_ctx_getopt_int(nng_ctx id, const char *name, int *valp)
+{
+	size_t sz = sizeof(*valp);
+	return (nng_ctx_getopt(id, name, valp, &sz));
+}
+
+int
+nng_ctx_getopt_ms(nng_ctx id, const char *name, nng_duration *valp)
+{
+	size_t sz = sizeof(*valp);
+	return (nng_ctx_getopt(id, name, valp, &sz));
+}
+
+int
+nng_ctx_setopt(nng_ctx id, const char *name, const void *val, size_t sz)
+{
+	nni_ctx *ctx;
+	int      rv;
+
+	if ((rv = nni_ctx_find(&ctx, id, false)) != 0) {
+		return (rv);
+	}
+	rv = nni_ctx_setopt(ctx, name, val, sz);
+	nni_ctx_rele(ctx);
+	return (rv);
+}
+
+int
+nng_ctx_setopt_int(nng_ctx id, const char *name, int val)
+{
+	return (nng_ctx_setopt(id, name, &val, sizeof(val)));
+}
+
+int
+nng_ctx_setopt_ms(nng_ctx id, const char *name, nng_duration val)
+{
+	return (nng_ctx_setopt(id, name, &val, sizeof(val)));
+}
+
 int
 nng_dial(nng_socket sid, const char *addr, nng_dialer *dp, int flags)
 {
@@ -848,6 +948,11 @@ nng_msg_free(nng_msg *msg)
 void *
 nng_msg_body(nng_msg *msg)
 {
+	// Applications are free to modify the body through the pointer
+	// we hand back, so make sure it isn't shared with another message.
+	if (nni_msg_unshare(msg) != 0) {
+		return (NULL);
+	}
 	return (nni_msg_body(msg));
 }
 
@@ -1151,56 +1256,174 @@ nng_aio_finish(nng_aio *aio, int rv)
 	nni_aio_finish(aio, rv, nni_aio_count(aio));
 }
 
-#if 0
+struct nng_stat {
+	char *  s_name;
+	int     s_type;
+	int     s_unit;
+	int64_t s_value;
+};
+
+struct nng_snapshot {
+	uint32_t  sn_sock;
+	nng_stat *sn_stats;
+	size_t    sn_num;
+	size_t    sn_cap;
+};
+
+static void
+nng_snapshot_clear(nng_stat *stats, size_t num, size_t cap)
+{
+	for (size_t i = 0; i < num; i++) {
+		nni_strfree(stats[i].s_name);
+	}
+	if (cap > 0) {
+		nni_free(stats, cap * sizeof(nng_stat));
+	}
+}
+
+static int
+nng_snapshot_add(nni_stat_item *item, const char *name, void *arg)
+{
+	nng_snapshot *snap = arg;
+	nng_stat *    stat;
+
+	if (snap->sn_num == snap->sn_cap) {
+		size_t    ncap = snap->sn_cap ? snap->sn_cap * 2 : 32;
+		nng_stat *nstats;
+
+		if ((nstats = nni_alloc(ncap * sizeof(nng_stat))) == NULL) {
+			return (NNG_ENOMEM);
+		}
+		if (snap->sn_num > 0) {
+			memcpy(nstats, snap->sn_stats,
+			    snap->sn_num * sizeof(nng_stat));
+			nni_free(snap->sn_stats, snap->sn_cap * sizeof(nng_stat));
+		}
+		snap->sn_stats = nstats;
+		snap->sn_cap   = ncap;
+	}
+	stat = &snap->sn_stats[snap->sn_num];
+	if ((stat->s_name = nni_strdup(name)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	stat->s_type  = item->si_type;
+	stat->s_unit  = item->si_unit;
+	stat->s_value = (int64_t) nni_stat_get(item);
+	snap->sn_num++;
+	return (0);
+}
+
 int
-nng_snapshot_create(nng_socket sock, nng_snapshot **snapp)
+nng_snapshot_create(nng_socket sid, nng_snapshot **snapp)
 {
-	// Stats TBD.
-	return (NNG_ENOTSUP);
+	nng_snapshot *snap;
+	nni_sock *    sock;
+	int           rv;
+
+	if ((rv = nni_sock_find(&sock, sid)) != 0) {
+		return (rv);
+	}
+	nni_sock_rele(sock);
+
+	if ((snap = NNI_ALLOC_STRUCT(snap)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	snap->sn_sock  = sid;
+	snap->sn_stats = NULL;
+	snap->sn_num   = 0;
+	snap->sn_cap   = 0;
+	*snapp         = snap;
+	return (0);
 }
 
 void
-nng_snapshot_destroy(nng_snapshot *snap)
+nng_snapshot_free(nng_snapshot *snap)
 {
-	// Stats TBD.
+	if (snap == NULL) {
+		return;
+	}
+	nng_snapshot_clear(snap->sn_stats, snap->sn_num, snap->sn_cap);
+	NNI_FREE_STRUCT(snap);
 }
 
 int
 nng_snapshot_update(nng_snapshot *snap)
 {
-	// Stats TBD.
-	return (NNG_ENOTSUP);
+	nni_sock *sock;
+	nng_stat *ostats;
+	size_t    onum;
+	size_t    ocap;
+	int       rv;
+
+	if ((rv = nni_sock_find(&sock, snap->sn_sock)) != 0) {
+		return (rv);
+	}
+
+	// Collect into a fresh array, so that a failure leaves the
+	// previous contents intact.
+	ostats         = snap->sn_stats;
+	onum           = snap->sn_num;
+	ocap           = snap->sn_cap;
+	snap->sn_stats = NULL;
+	snap->sn_num   = 0;
+	snap->sn_cap   = 0;
+
+	if ((rv = nni_stat_walk(nni_sock_stats(sock), nng_snapshot_add,
+	         snap)) == 0) {
+		rv = nni_stat_walk(nni_stat_global(), nng_snapshot_add, snap);
+	}
+	nni_sock_rele(sock);
+
+	if (rv != 0) {
+		nng_snapshot_clear(snap->sn_stats, snap->sn_num, snap->sn_cap);
+		snap->sn_stats = ostats;
+		snap->sn_num   = onum;
+		snap->sn_cap   = ocap;
+		return (rv);
+	}
+	nng_snapshot_clear(ostats, onum, ocap);
+	return (0);
 }
 
 int
 nng_snapshot_next(nng_snapshot *snap, nng_stat **statp)
 {
-	// Stats TBD.
-	*statp = NULL;
-	return (NNG_ENOTSUP);
+	nng_stat *stat = *statp;
+
+	if (stat == NULL) {
+		stat = snap->sn_num > 0 ? &snap->sn_stats[0] : NULL;
+	} else if ((size_t)(stat - snap->sn_stats) + 1 < snap->sn_num) {
+		stat++;
+	} else {
+		stat = NULL;
+	}
+	*statp = stat;
+	return (0);
 }
 
 const char *
 nng_stat_name(nng_stat *stat)
 {
-	// Stats TBD.
-	return (NULL);
+	return (stat->s_name);
 }
 
 int
 nng_stat_type(nng_stat *stat)
 {
-	// Stats TBD.
-	return (0);
+	return (stat->s_type);
+}
+
+int
+nng_stat_unit(nng_stat *stat)
+{
+	return (stat->s_unit);
 }
 
 int64_t
 nng_stat_value(nng_stat *stat)
 {
-	// Stats TBD.
-	return (0);
+	return (stat->s_value);
 }
-#endif
 
 int
 nng_url_parse(nng_url **result, const char *ustr)
@@ -53,6 +53,7 @@ extern "C" {
 
 // Types common to nng.
 typedef uint32_t            nng_socket;
+typedef uint32_t            nng_ctx;
 typedef uint32_t            nng_dialer;
 typedef uint32_t            nng_listener;
 typedef uint32_t            nng_pipe;
@@ -244,6 +245,35 @@ NNG_DECL void nng_send_aio(nng_socket, nng_aio *);
 // this point.
 NNG_DECL void nng_recv_aio(nng_socket, nng_aio *);
 
+// Contexts.  A context is an independent stream of operations on a socket,
+// with its own protocol state.  For example, each context on a REQ socket
+// has its own outstanding request, so that one socket can have many
+// requests in flight at once.  Not all protocols support contexts; for
+// those that don't, nng_ctx_open returns NNG_ENOTSUP.  Contexts are
+// closed automatically when their socket is closed.
+
+// nng_ctx_open creates a new context on the socket.
+NNG_DECL int nng_ctx_open(nng_ctx *, nng_socket);
+
+// nng_ctx_close closes the context.  Operations pending on it are
+// aborted with NNG_ECLOSED.
+NNG_DECL int nng_ctx_close(nng_ctx);
+
+// nng_ctx_send and nng_ctx_recv are like nng_send_aio and nng_recv_aio,
+// but operate on the context rather than the socket.
+NNG_DECL void nng_ctx_send(nng_ctx, nng_aio *);
+NNG_DECL void nng_ctx_recv(nng_ctx, nng_aio *);
+
+// Contexts have their own copies of NNG_OPT_SENDTIMEO and NNG_OPT_RECVTIMEO,
+// initialized from the socket, as well as any protocol specific options
+// that apply to contexts.
+NNG_DECL int nng_ctx_getopt(nng_ctx, const char *, void *, size_t *);
+NNG_DECL int nng_ctx_getopt_int(nng_ctx, const char *, int *);
+NNG_DECL int nng_ctx_getopt_ms(nng_ctx, const char *, nng_duration *);
+NNG_DECL int nng_ctx_setopt(nng_ctx, const char *, const void *, size_t);
+NNG_DECL int nng_ctx_setopt_int(nng_ctx, const char *, int);
+NNG_DECL int nng_ctx_setopt_ms(nng_ctx, const char *, nng_duration);
+
 // nng_alloc is used to allocate memory.  It's intended purpose is for
 // allocating memory suitable for message buffers with nng_send().
 // Applications that need memory for other purposes should use their platform
@@ -427,6 +457,61 @@ enum nng_flag_enum {
 #define NNG_OPT_RECONNMINT "reconnect-time-min"
 #define NNG_OPT_RECONNMAXT "reconnect-time-max"
 
+// NNG_OPT_DEVICE_WINDOW is the number (int) of messages that nng_device
+// may have in flight from this socket to its peer at once.  Higher
+// values help throughput; messages are still forwarded in order.
+#define NNG_OPT_DEVICE_WINDOW "device-window"
+
+// NNG_OPT_SENDCOALESCE is the size (size_t) of the buffer that stream
+// transports such as TCP and IPC use to gather small messages, so that
+// several can be sent with a single write.  While it is enabled, several
+// messages may be handed to each connection at once.  Zero disables
+// this, so that each message is written by itself.  Either way, a send
+// only completes once its message has been written.
+#define NNG_OPT_SENDCOALESCE "send-coalesce"
+
+// TCP options.  These may be set on TCP dialers and listeners (or on
+// sockets, to apply to all of those), and are applied to each connection
+// as it is established.
+
+// NNG_OPT_TCP_NODELAY (int, 0 or 1) disables Nagle's algorithm, so that
+// small messages are not held back waiting for earlier data to be
+// acknowledged.  This is on by default.  It is also available on pipes.
+#define NNG_OPT_TCP_NODELAY "tcp-nodelay"
+
+// NNG_OPT_TCP_QUICKACK (int, 0 or 1) asks the peer's data to be
+// acknowledged at once, rather than delayed.  This costs an extra system
+// call for each read, and is only supported on Linux.  Off by default.
+#define NNG_OPT_TCP_QUICKACK "tcp-quickack"
+
+// NNG_OPT_TCP_KEEPALIVE (int, 0 or 1) enables TCP keep-alive probes, so
+// that dead peers are noticed even on idle connections.  Off by default.
+// It is also available on pipes.  The timing of the probes may be set
+// with the following options; zero (the default) leaves the system's
+// settings in place.
+#define NNG_OPT_TCP_KEEPALIVE "tcp-keepalive"
+#define NNG_OPT_TCP_KEEPALIVE_IDLE "tcp-keepalive-idle"         // duration
+#define NNG_OPT_TCP_KEEPALIVE_INTERVAL "tcp-keepalive-interval" // duration
+#define NNG_OPT_TCP_KEEPALIVE_COUNT "tcp-keepalive-count"       // int
+
+// NNG_OPT_TCP_SENDBUF and NNG_OPT_TCP_RECVBUF (size_t) are the sizes of
+// the kernel's socket buffers (SO_SNDBUF and SO_RCVBUF).  Zero (the
+// default) leaves the system's automatic sizing in place.
+#define NNG_OPT_TCP_SENDBUF "tcp-send-buffer"
+#define NNG_OPT_TCP_RECVBUF "tcp-recv-buffer"
+
+// NNG_OPT_TCP_LISTEN_BACKLOG (int) is the number of connections the
+// system will queue for a listener before they are accepted.  The default
+// is 128; the system may impose a lower limit.
+#define NNG_OPT_TCP_LISTEN_BACKLOG "tcp-listen-backlog"
+
+// NNG_OPT_TCP_LISTEN_SHARDS (int) is the number of sockets a listener
+// opens on its port.  With more than one, the system spreads incoming
+// connections across them (SO_REUSEPORT), and they are accepted by
+// different threads, which helps when very many clients connect at once.
+// Where this is not supported a single socket is used.  Default 1.
+#define NNG_OPT_TCP_LISTEN_SHARDS "tcp-listen-shards"
+
 // TLS options are only used when the underlying transport supports TLS.
 
 // NNG_OPT_TLS_CONFIG is a pointer to an nng_tls_config object.  Generally
@@ -494,13 +579,18 @@ NNG_DECL void nng_snapshot_free(nng_snapshot *);
 
 // nng_snapshot_update updates a snapshot of all the statistics
 // relevant to a particular socket.  All prior values are overwritten.
+// Socket level statistics (such as "tx_msgs") are always present.  Pipes
+// and endpoints contribute statistics with a prefix identifying them,
+// such as "pipe.<id>.rx_bytes" or "dialer.<id>.connects", and these come
+// and go as the pipes and endpoints do.  Consequently, any statistic
+// objects obtained from the snapshot before the update are invalidated.
+// Library wide statistics, such as "msgpool.hits", are included as well.
 NNG_DECL int nng_snapshot_update(nng_snapshot *);
 
 // nng_snapshot_next is used to iterate over the individual statistic
-// objects inside the snapshot. Note that the statistic object, and the
-// meta-data for the object (name, type, units) is fixed, and does not
-// change for the entire life of the snapshot.  Only the value
-// is subject to change, and then only when a snapshot is updated.
+// objects inside the snapshot.  The statistic objects, including their
+// meta-data (name, type, units) and value, remain valid and unchanged
+// until the snapshot is next updated or freed.
 //
 // Iteration begins by providing NULL in the value referenced. Successive
 // calls will update this value, returning NULL when no more statistics
@@ -548,6 +638,8 @@ NNG_DECL int64_t nng_stat_value(nng_stat *);
 
 // Device functionality.  This connects two sockets together in a device,
 // which means that messages from one side are forwarded to the other.
+// The messages forwarded from each socket are counted in its statistics,
+// as "device.fwd_msgs", "device.fwd_bytes", and "device.drops".
 NNG_DECL int nng_device(nng_socket, nng_socket);
 
 // Symbol name and visibility.  TBD.  The only symbols that really should
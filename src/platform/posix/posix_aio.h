@@ -31,6 +31,8 @@ extern void nni_posix_pipedesc_send(nni_posix_pipedesc *, nni_aio *);
 extern void nni_posix_pipedesc_close(nni_posix_pipedesc *);
 extern int  nni_posix_pipedesc_peername(nni_posix_pipedesc *, nni_sockaddr *);
 extern int  nni_posix_pipedesc_sockname(nni_posix_pipedesc *, nni_sockaddr *);
+extern int  nni_posix_pipedesc_fd(nni_posix_pipedesc *);
+extern void nni_posix_pipedesc_set_quickack(nni_posix_pipedesc *, bool);
 
 extern int  nni_posix_epdesc_init(nni_posix_epdesc **);
 extern void nni_posix_epdesc_set_local(nni_posix_epdesc *, void *, size_t);
@@ -39,6 +41,7 @@ extern void nni_posix_epdesc_fini(nni_posix_epdesc *);
 extern void nni_posix_epdesc_close(nni_posix_epdesc *);
 extern void nni_posix_epdesc_connect(nni_posix_epdesc *, nni_aio *);
 extern int  nni_posix_epdesc_listen(nni_posix_epdesc *);
+extern void nni_posix_epdesc_set_listen(nni_posix_epdesc *, int, int);
 extern void nni_posix_epdesc_accept(nni_posix_epdesc *, nni_aio *);
 extern int  nni_posix_epdesc_sockname(nni_posix_epdesc *, nni_sockaddr *);
 
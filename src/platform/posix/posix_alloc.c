@@ -20,6 +20,12 @@ nni_alloc(size_t sz)
 	return (calloc(1, sz));
 }
 
+void *
+nni_alloc_nz(size_t sz)
+{
+	return (malloc(sz));
+}
+
 void
 nni_free(void *ptr, size_t size)
 {
@@ -0,0 +1,182 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+#ifdef NNG_PLATFORM_POSIX_ATOMIC
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// GCC (4.7 and newer) and Clang both supply the __atomic builtins,
+// which is what we use on practically every POSIX system.
+
+void
+nni_atomic_init64(nni_atomic_u64 *a)
+{
+	__atomic_store_n(&a->v, 0, __ATOMIC_SEQ_CST);
+}
+
+void
+nni_atomic_add64(nni_atomic_u64 *a, uint64_t bump)
+{
+	(void) __atomic_fetch_add(&a->v, bump, __ATOMIC_SEQ_CST);
+}
+
+void
+nni_atomic_sub64(nni_atomic_u64 *a, uint64_t bump)
+{
+	(void) __atomic_fetch_sub(&a->v, bump, __ATOMIC_SEQ_CST);
+}
+
+void
+nni_atomic_inc64(nni_atomic_u64 *a)
+{
+	(void) __atomic_fetch_add(&a->v, 1, __ATOMIC_SEQ_CST);
+}
+
+uint64_t
+nni_atomic_inc64_nv(nni_atomic_u64 *a)
+{
+	return (__atomic_add_fetch(&a->v, 1, __ATOMIC_SEQ_CST));
+}
+
+uint64_t
+nni_atomic_dec64_nv(nni_atomic_u64 *a)
+{
+	return (__atomic_sub_fetch(&a->v, 1, __ATOMIC_SEQ_CST));
+}
+
+uint64_t
+nni_atomic_get64(nni_atomic_u64 *a)
+{
+	return (__atomic_load_n(&a->v, __ATOMIC_SEQ_CST));
+}
+
+void
+nni_atomic_set64(nni_atomic_u64 *a, uint64_t u)
+{
+	__atomic_store_n(&a->v, u, __ATOMIC_SEQ_CST);
+}
+
+uint64_t
+nni_atomic_swap64(nni_atomic_u64 *a, uint64_t u)
+{
+	return (__atomic_exchange_n(&a->v, u, __ATOMIC_SEQ_CST));
+}
+
+int
+nni_atomic_cas64(nni_atomic_u64 *a, uint64_t old, uint64_t nv)
+{
+	return (__atomic_compare_exchange_n(
+	    &a->v, &old, nv, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+}
+
+#else
+
+#include <pthread.h>
+
+// Without compiler support we fall back to a single global lock.  This
+// is slow, but it is correct, and such compilers are rare.
+
+static pthread_mutex_t nni_atomic_lk = PTHREAD_MUTEX_INITIALIZER;
+
+void
+nni_atomic_init64(nni_atomic_u64 *a)
+{
+	nni_atomic_set64(a, 0);
+}
+
+void
+nni_atomic_add64(nni_atomic_u64 *a, uint64_t bump)
+{
+	pthread_mutex_lock(&nni_atomic_lk);
+	a->v += bump;
+	pthread_mutex_unlock(&nni_atomic_lk);
+}
+
+void
+nni_atomic_sub64(nni_atomic_u64 *a, uint64_t bump)
+{
+	pthread_mutex_lock(&nni_atomic_lk);
+	a->v -= bump;
+	pthread_mutex_unlock(&nni_atomic_lk);
+}
+
+void
+nni_atomic_inc64(nni_atomic_u64 *a)
+{
+	nni_atomic_add64(a, 1);
+}
+
+uint64_t
+nni_atomic_inc64_nv(nni_atomic_u64 *a)
+{
+	uint64_t v;
+	pthread_mutex_lock(&nni_atomic_lk);
+	v = ++a->v;
+	pthread_mutex_unlock(&nni_atomic_lk);
+	return (v);
+}
+
+uint64_t
+nni_atomic_dec64_nv(nni_atomic_u64 *a)
+{
+	uint64_t v;
+	pthread_mutex_lock(&nni_atomic_lk);
+	v = --a->v;
+	pthread_mutex_unlock(&nni_atomic_lk);
+	return (v);
+}
+
+uint64_t
+nni_atomic_get64(nni_atomic_u64 *a)
+{
+	uint64_t v;
+	pthread_mutex_lock(&nni_atomic_lk);
+	v = a->v;
+	pthread_mutex_unlock(&nni_atomic_lk);
+	return (v);
+}
+
+void
+nni_atomic_set64(nni_atomic_u64 *a, uint64_t u)
+{
+	pthread_mutex_lock(&nni_atomic_lk);
+	a->v = u;
+	pthread_mutex_unlock(&nni_atomic_lk);
+}
+
+uint64_t
+nni_atomic_swap64(nni_atomic_u64 *a, uint64_t u)
+{
+	uint64_t v;
+	pthread_mutex_lock(&nni_atomic_lk);
+	v    = a->v;
+	a->v = u;
+	pthread_mutex_unlock(&nni_atomic_lk);
+	return (v);
+}
+
+int
+nni_atomic_cas64(nni_atomic_u64 *a, uint64_t old, uint64_t nv)
+{
+	int rv = 0;
+	pthread_mutex_lock(&nni_atomic_lk);
+	if (a->v == old) {
+		a->v = nv;
+		rv   = 1;
+	}
+	pthread_mutex_unlock(&nni_atomic_lk);
+	return (rv);
+}
+
+#endif
+
+#endif // NNG_PLATFORM_POSIX_ATOMIC
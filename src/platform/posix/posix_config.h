@@ -39,6 +39,11 @@
 //	Thesse are options for obtaining entropy to seed the pRNG.
 //	All known modern UNIX variants can support NNG_USE_DEVURANDOM,
 //	but the other options are better still, but not portable.
+//
+// #define NNG_HAVE_KQUEUE
+// #define NNG_HAVE_EPOLL
+//	These select the kqueue() or epoll() based pollq backends.  If
+//	neither is available, we fall back to a single poll() thread.
 
 #include <time.h>
 
@@ -62,6 +67,8 @@
 
 #if defined(NNG_HAVE_KQUEUE)
 // pass
+#elif defined(NNG_HAVE_EPOLL)
+// pass
 #else
 // fallback to poll(2)
 #define NNG_USE_POSIX_POLLQ_POLL 1
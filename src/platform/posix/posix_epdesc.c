@@ -17,6 +17,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -33,6 +35,21 @@
 #define NNI_STREAM_SOCKTYPE SOCK_STREAM
 #endif
 
+// When a listening socket becomes readable, we accept every connection
+// that is waiting (up to this many), not just those we have been asked
+// for.  The extras are handed out to later accepts without another trip
+// through the poller, which matters when many clients connect at once.
+#define NNI_POSIX_ACCEPT_BATCH 32
+
+// nni_posix_epshard is an additional listening socket, bound to the same
+// address as the main one with SO_REUSEPORT.  The kernel spreads incoming
+// connections across them, and as each has its own descriptor they are
+// generally watched by different pollq threads.
+typedef struct nni_posix_epshard {
+	nni_posix_pollq_node node;
+	nni_posix_epdesc *   ed;
+} nni_posix_epshard;
+
 struct nni_posix_epdesc {
 	nni_posix_pollq_node    node;
 	nni_list                connectq;
@@ -42,6 +59,11 @@ struct nni_posix_epdesc {
 	struct sockaddr_storage remaddr;
 	socklen_t               loclen;
 	socklen_t               remlen;
+	int                     backlog;
+	int                     nshards; // listening sockets wanted
+	nni_posix_epshard *     shards;  // all but the main one
+	int                     accfds[NNI_POSIX_ACCEPT_BATCH];
+	int                     naccfds;
 	nni_mtx                 mtx;
 };
 
@@ -59,6 +81,25 @@ nni_posix_epdesc_cancel(nni_aio *aio, int rv)
 	nni_mtx_unlock(&ed->mtx);
 }
 
+// nni_posix_epdesc_sockinit sets up a newly connected socket.  TCP
+// connections have Nagle's algorithm disabled, as we are careful to group
+// our writes, and latency is king for most of our users.  (Transports can
+// turn it back on.)
+static void
+nni_posix_epdesc_sockinit(nni_posix_epdesc *ed, int fd)
+{
+	int family = ed->remaddr.ss_family;
+	int one    = 1;
+
+	if (ed->remlen == 0) {
+		family = ed->locaddr.ss_family; // accepted
+	}
+	if ((family == AF_INET) || (family == AF_INET6)) {
+		(void) setsockopt(
+		    fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+}
+
 static void
 nni_posix_epdesc_finish(nni_aio *aio, int rv, int newfd)
 {
@@ -104,6 +145,7 @@ nni_posix_epdesc_doconnect(nni_posix_epdesc *ed)
 		case 0:
 			// Success!
 			nni_posix_pollq_remove(&ed->node);
+			nni_posix_epdesc_sockinit(ed, ed->node.fd);
 			nni_posix_epdesc_finish(aio, 0, ed->node.fd);
 			ed->node.fd = -1;
 			continue;
@@ -125,26 +167,48 @@ nni_posix_epdesc_doconnect(nni_posix_epdesc *ed)
 	}
 }
 
+// nni_posix_epdesc_popfd removes the oldest accepted connection.
+static int
+nni_posix_epdesc_popfd(nni_posix_epdesc *ed)
+{
+	int fd = ed->accfds[0];
+
+	ed->naccfds--;
+	memmove(&ed->accfds[0], &ed->accfds[1], ed->naccfds * sizeof(int));
+	return (fd);
+}
+
 static void
-nni_posix_epdesc_doaccept(nni_posix_epdesc *ed)
+nni_posix_epdesc_doaccept(nni_posix_epdesc *ed, int fd)
 {
 	nni_aio *aio;
 	int      newfd;
-
-	while ((aio = nni_list_first(&ed->acceptq)) != NULL) {
+	int      rv;
+
+	for (;;) {
+		// Hand out the connections we already have first.
+		while ((ed->naccfds > 0) &&
+		    ((aio = nni_list_first(&ed->acceptq)) != NULL)) {
+			nni_posix_epdesc_finish(
+			    aio, 0, nni_posix_epdesc_popfd(ed));
+		}
+		if (ed->naccfds == NNI_POSIX_ACCEPT_BATCH) {
+			return;
+		}
 
 #ifdef NNG_USE_ACCEPT4
-		newfd = accept4(ed->node.fd, NULL, NULL, SOCK_CLOEXEC);
+		newfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
 		if ((newfd < 0) && ((errno == ENOSYS) || (errno == ENOTSUP))) {
-			newfd = accept(ed->node.fd, NULL, NULL);
+			newfd = accept(fd, NULL, NULL);
 		}
 #else
-		newfd = accept(ed->node.fd, NULL, NULL);
+		newfd = accept(fd, NULL, NULL);
 #endif
 
 		if (newfd >= 0) {
 			// successful connection request!
-			nni_posix_epdesc_finish(aio, 0, newfd);
+			nni_posix_epdesc_sockinit(ed, newfd);
+			ed->accfds[ed->naccfds++] = newfd;
 			continue;
 		}
 
@@ -165,7 +229,11 @@ nni_posix_epdesc_doaccept(nni_posix_epdesc *ed)
 			continue;
 		}
 
-		nni_posix_epdesc_finish(aio, nni_plat_errno(errno), 0);
+		rv = nni_plat_errno(errno);
+		if ((aio = nni_list_first(&ed->acceptq)) == NULL) {
+			return;
+		}
+		nni_posix_epdesc_finish(aio, rv, 0);
 	}
 }
 
@@ -206,6 +274,17 @@ nni_posix_epdesc_doclose(nni_posix_epdesc *ed)
 	while ((aio = nni_list_first(&ed->connectq)) != NULL) {
 		nni_posix_epdesc_finish(aio, NNG_ECLOSED, 0);
 	}
+	while (ed->naccfds > 0) {
+		(void) close(nni_posix_epdesc_popfd(ed));
+	}
+
+	// The shards stop listening now, but stay registered with their
+	// pollqs until nni_posix_epdesc_fini can wait for their callbacks.
+	for (int i = 0; (ed->shards != NULL) && (i < ed->nshards - 1); i++) {
+		if (ed->shards[i].node.fd != -1) {
+			(void) shutdown(ed->shards[i].node.fd, SHUT_RDWR);
+		}
+	}
 
 	nni_posix_pollq_remove(&ed->node);
 
@@ -229,7 +308,7 @@ nni_posix_epdesc_cb(void *arg)
 	nni_mtx_lock(&ed->mtx);
 
 	if (ed->node.revents & POLLIN) {
-		nni_posix_epdesc_doaccept(ed);
+		nni_posix_epdesc_doaccept(ed, ed->node.fd);
 	}
 	if (ed->node.revents & POLLOUT) {
 		nni_posix_epdesc_doconnect(ed);
@@ -254,6 +333,24 @@ nni_posix_epdesc_cb(void *arg)
 	nni_mtx_unlock(&ed->mtx);
 }
 
+static void
+nni_posix_epshard_cb(void *arg)
+{
+	nni_posix_epshard *sh = arg;
+	nni_posix_epdesc * ed = sh->ed;
+
+	nni_mtx_lock(&ed->mtx);
+	if ((!ed->closed) && (sh->node.revents & POLLIN)) {
+		nni_posix_epdesc_doaccept(ed, sh->node.fd);
+	}
+	// Errors on the shards are not reported; the main socket will
+	// see the same ones.
+	if ((!ed->closed) && (!nni_list_empty(&ed->acceptq))) {
+		nni_posix_pollq_arm(&sh->node, POLLIN);
+	}
+	nni_mtx_unlock(&ed->mtx);
+}
+
 void
 nni_posix_epdesc_close(nni_posix_epdesc *ed)
 {
@@ -262,21 +359,16 @@ nni_posix_epdesc_close(nni_posix_epdesc *ed)
 	nni_mtx_unlock(&ed->mtx);
 }
 
-int
-nni_posix_epdesc_listen(nni_posix_epdesc *ed)
+// nni_posix_epdesc_mksock creates a nonblocking listening socket bound to
+// the given address.
+static int
+nni_posix_epdesc_mksock(nni_posix_epdesc *ed, struct sockaddr_storage *ss,
+    socklen_t len, bool reuseport, int *fdp)
 {
-	int                      len;
-	struct sockaddr_storage *ss;
-	int                      rv;
-	int                      fd;
-
-	nni_mtx_lock(&ed->mtx);
-
-	ss  = &ed->locaddr;
-	len = ed->loclen;
+	int rv;
+	int fd;
 
 	if ((fd = socket(ss->ss_family, NNI_STREAM_SOCKTYPE, 0)) < 0) {
-		nni_mtx_unlock(&ed->mtx);
 		return (nni_plat_errno(errno));
 	}
 	(void) fcntl(fd, F_SETFD, FD_CLOEXEC);
@@ -287,29 +379,128 @@ nni_posix_epdesc_listen(nni_posix_epdesc *ed)
 	(void) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
 #endif
 
-	if (bind(fd, (struct sockaddr *) ss, len) < 0) {
-		nni_mtx_unlock(&ed->mtx);
+#ifdef SO_REUSEPORT
+	if (reuseport) {
+		int on = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) !=
+		    0) {
+			rv = nni_plat_errno(errno);
+			(void) close(fd);
+			return (rv);
+		}
+	}
+#else
+	NNI_ARG_UNUSED(reuseport);
+#endif
+
+	if ((bind(fd, (struct sockaddr *) ss, len) < 0) ||
+	    (listen(fd, ed->backlog) != 0)) {
 		rv = nni_plat_errno(errno);
 		(void) close(fd);
 		return (rv);
 	}
 
-	// Listen -- 128 depth is probably sufficient.  If it isn't, other
-	// bad things are going to happen.
-	if (listen(fd, 128) != 0) {
+	(void) fcntl(fd, F_SETFL, O_NONBLOCK);
+	*fdp = fd;
+	return (0);
+}
+
+// nni_posix_epdesc_mkshards opens the additional listening sockets.  The
+// main socket must already be bound, so that a wild card port has been
+// resolved to the real one.
+static int
+nni_posix_epdesc_mkshards(nni_posix_epdesc *ed, int fd)
+{
+	struct sockaddr_storage ss;
+	socklen_t               len = sizeof(ss);
+	int                     rv;
+
+	if (getsockname(fd, (void *) &ss, &len) != 0) {
+		return (nni_plat_errno(errno));
+	}
+	ed->shards = NNI_ALLOC_STRUCTS(ed->shards, ed->nshards - 1);
+	if (ed->shards == NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (int i = 0; i < ed->nshards - 1; i++) {
+		nni_posix_epshard *sh = &ed->shards[i];
+
+		sh->ed         = ed;
+		sh->node.fd    = -1;
+		sh->node.cb    = nni_posix_epshard_cb;
+		sh->node.data  = sh;
+		sh->node.index = 0;
+		(void) nni_posix_pollq_init(&sh->node);
+	}
+	for (int i = 0; i < ed->nshards - 1; i++) {
+		nni_posix_epshard *sh = &ed->shards[i];
+
+		rv = nni_posix_epdesc_mksock(ed, &ss, len, true, &sh->node.fd);
+		if (rv != 0) {
+			return (rv);
+		}
+		if ((rv = nni_posix_pollq_add(&sh->node)) != 0) {
+			return (rv);
+		}
+	}
+	return (0);
+}
+
+static void
+nni_posix_epdesc_freeshards(nni_posix_epdesc *ed)
+{
+	if (ed->shards == NULL) {
+		return;
+	}
+	for (int i = 0; i < ed->nshards - 1; i++) {
+		nni_posix_epshard *sh = &ed->shards[i];
+
+		nni_posix_pollq_fini(&sh->node);
+		if (sh->node.fd != -1) {
+			(void) close(sh->node.fd);
+		}
+	}
+	NNI_FREE_STRUCTS(ed->shards, ed->nshards - 1);
+	ed->shards = NULL;
+}
+
+int
+nni_posix_epdesc_listen(nni_posix_epdesc *ed)
+{
+	int rv;
+	int fd;
+
+	nni_mtx_lock(&ed->mtx);
+
+	// Only TCP can share a port between several sockets.
+	if ((ed->locaddr.ss_family != AF_INET) &&
+	    (ed->locaddr.ss_family != AF_INET6)) {
+		ed->nshards = 1;
+	}
+#ifndef SO_REUSEPORT
+	ed->nshards = 1;
+#endif
+
+	rv = nni_posix_epdesc_mksock(
+	    ed, &ed->locaddr, ed->loclen, ed->nshards > 1, &fd);
+	if (rv != 0) {
 		nni_mtx_unlock(&ed->mtx);
-		rv = nni_plat_errno(errno);
+		return (rv);
+	}
+	if ((ed->nshards > 1) &&
+	    ((rv = nni_posix_epdesc_mkshards(ed, fd)) != 0)) {
+		nni_mtx_unlock(&ed->mtx);
+		nni_posix_epdesc_freeshards(ed);
 		(void) close(fd);
 		return (rv);
 	}
 
-	(void) fcntl(fd, F_SETFL, O_NONBLOCK);
-
 	ed->node.fd = fd;
 	if ((rv = nni_posix_pollq_add(&ed->node)) != 0) {
 		(void) close(fd);
 		ed->node.fd = -1;
 		nni_mtx_unlock(&ed->mtx);
+		nni_posix_epdesc_freeshards(ed);
 		return (rv);
 	}
 	nni_mtx_unlock(&ed->mtx);
@@ -339,7 +530,15 @@ nni_posix_epdesc_accept(nni_posix_epdesc *ed, nni_aio *aio)
 	}
 
 	nni_aio_list_append(&ed->acceptq, aio);
+	if (ed->naccfds > 0) {
+		nni_posix_epdesc_finish(aio, 0, nni_posix_epdesc_popfd(ed));
+		nni_mtx_unlock(&ed->mtx);
+		return;
+	}
 	nni_posix_pollq_arm(&ed->node, POLLIN);
+	for (int i = 0; (ed->shards != NULL) && (i < ed->nshards - 1); i++) {
+		nni_posix_pollq_arm(&ed->shards[i].node, POLLIN);
+	}
 	nni_mtx_unlock(&ed->mtx);
 }
 
@@ -395,6 +594,7 @@ nni_posix_epdesc_connect(nni_posix_epdesc *ed, nni_aio *aio)
 		// Immediate connect, cool!  This probably only happens on
 		// loopback, and probably not on every platform.
 
+		nni_posix_epdesc_sockinit(ed, fd);
 		nni_posix_epdesc_finish(aio, 0, fd);
 		nni_mtx_unlock(&ed->mtx);
 		return;
@@ -437,16 +637,19 @@ nni_posix_epdesc_init(nni_posix_epdesc **edp)
 
 	nni_mtx_init(&ed->mtx);
 
-	// We could randomly choose a different pollq, or for efficiencies
-	// sake we could take a modulo of the file desc number to choose
-	// one.  For now we just have a global pollq.  Note that by tying
-	// the ed to a single pollq we may get some kind of cache warmth.
+	// The pollq is chosen by the backend from the file descriptor
+	// number (see nni_posix_pollq_get).  Note that by tying the ed
+	// to a single pollq we may get some kind of cache warmth.
 
 	ed->node.index = 0;
 	ed->node.cb    = nni_posix_epdesc_cb;
 	ed->node.data  = ed;
 	ed->node.fd    = -1;
 	ed->closed     = false;
+	ed->backlog    = 128;
+	ed->nshards    = 1;
+	ed->shards     = NULL;
+	ed->naccfds    = 0;
 
 	nni_aio_list_init(&ed->connectq);
 	nni_aio_list_init(&ed->acceptq);
@@ -484,15 +687,33 @@ nni_posix_epdesc_set_remote(nni_posix_epdesc *ed, void *sa, size_t len)
 	nni_mtx_unlock(&ed->mtx);
 }
 
+void
+nni_posix_epdesc_set_listen(nni_posix_epdesc *ed, int backlog, int nshards)
+{
+	nni_mtx_lock(&ed->mtx);
+	if (ed->shards == NULL) { // the shards cannot be resized
+		ed->backlog = backlog > 0 ? backlog : 128;
+		ed->nshards = nshards > 0 ? nshards : 1;
+	}
+	nni_mtx_unlock(&ed->mtx);
+}
+
 void
 nni_posix_epdesc_fini(nni_posix_epdesc *ed)
 {
 	int fd;
+
+	// Make sure no shard callbacks are still running.
+	nni_posix_epdesc_freeshards(ed);
+
 	nni_mtx_lock(&ed->mtx);
 	if ((fd = ed->node.fd) != -1) {
 		(void) close(ed->node.fd);
 		nni_posix_epdesc_doclose(ed);
 	}
+	while (ed->naccfds > 0) {
+		(void) close(nni_posix_epdesc_popfd(ed));
+	}
 	nni_mtx_unlock(&ed->mtx);
 	nni_posix_pollq_fini(&ed->node);
 	nni_mtx_fini(&ed->mtx);
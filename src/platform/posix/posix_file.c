@@ -287,6 +287,82 @@ nni_plat_file_unlock(nni_plat_flock *lk)
 	(void) close(fd);
 }
 
+int
+nni_plat_file_open(
+    const char *path, nni_plat_file *f, uint64_t *sizep, uint64_t *mtimep)
+{
+	int         fd;
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return (nni_plat_errno(errno));
+	}
+	if (fstat(fd, &st) != 0) {
+		int rv = errno;
+		(void) close(fd);
+		return (nni_plat_errno(rv));
+	}
+	if (!S_ISREG(st.st_mode)) {
+		(void) close(fd);
+		return (NNG_EINVAL);
+	}
+	(void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+	f->fd   = fd;
+	*sizep  = (uint64_t) st.st_size;
+	*mtimep = (uint64_t) st.st_mtime;
+	return (0);
+}
+
+int
+nni_plat_file_read(
+    nni_plat_file *f, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	size_t resid = len;
+
+	while (resid > 0) {
+		ssize_t n;
+		n = pread(f->fd, buf, resid, (off_t) off);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (nni_plat_errno(errno));
+		}
+		if (n == 0) {
+			break; // end of file
+		}
+		buf = ((uint8_t *) buf) + n;
+		off += (uint64_t) n;
+		resid -= (size_t) n;
+	}
+	*np = len - resid;
+	return (0);
+}
+
+void
+nni_plat_file_close(nni_plat_file *f)
+{
+	int fd = f->fd;
+	f->fd  = -1;
+	(void) close(fd);
+}
+
+int
+nni_plat_file_stat(const char *path, uint64_t *sizep, uint64_t *mtimep)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0) {
+		return (nni_plat_errno(errno));
+	}
+	if (!S_ISREG(st.st_mode)) {
+		return (NNG_EINVAL);
+	}
+	*sizep  = (uint64_t) st.st_size;
+	*mtimep = (uint64_t) st.st_mtime;
+	return (0);
+}
+
 char *
 nni_plat_temp_dir(void)
 {
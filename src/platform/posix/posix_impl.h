@@ -19,6 +19,7 @@
 // together.  Almost everything depends on NNG_PLATFORM_POSIX_DEBUG.
 #ifdef NNG_PLATFORM_POSIX
 #define NNG_PLATFORM_POSIX_ALLOC
+#define NNG_PLATFORM_POSIX_ATOMIC
 #define NNG_PLATFORM_POSIX_DEBUG
 #define NNG_PLATFORM_POSIX_CLOCK
 #define NNG_PLATFORM_POSIX_IPC
@@ -46,6 +47,15 @@ extern int nni_plat_errno(int);
 
 #endif
 
+#ifdef NNG_PLATFORM_POSIX_ATOMIC
+// With GCC or Clang we use the compiler builtins, which are lock-free
+// on all platforms we care about.  Otherwise we fall back to a lock,
+// which is correct but slower.
+struct nni_atomic_u64 {
+	uint64_t v;
+};
+#endif
+
 // Define types that this platform uses.
 #ifdef NNG_PLATFORM_POSIX_THREAD
 
@@ -80,6 +90,14 @@ struct nni_plat_flock {
 	int fd;
 };
 
+struct nni_plat_file {
+	int fd;
+};
+
+struct nni_plat_tls {
+	pthread_key_t key;
+};
+
 #define NNG_PLATFORM_DIR_SEP "/"
 
 #endif
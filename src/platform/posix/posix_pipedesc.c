@@ -16,6 +16,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -33,6 +35,7 @@ struct nni_posix_pipedesc {
 	nni_list             readq;
 	nni_list             writeq;
 	bool                 closed;
+	bool                 quickack; // rearm TCP_QUICKACK after reads
 	nni_mtx              mtx;
 };
 
@@ -184,6 +187,16 @@ nni_posix_pipedesc_doread(nni_posix_pipedesc *pd)
 
 		nni_aio_bump_count(aio, n);
 
+#ifdef TCP_QUICKACK
+		// Linux drops out of quick ACK mode on its own, so it has
+		// to be asked again each time.
+		if (pd->quickack) {
+			int one = 1;
+			(void) setsockopt(pd->node.fd, IPPROTO_TCP,
+			    TCP_QUICKACK, &one, sizeof(one));
+		}
+#endif
+
 		// We completed the entire operation on this aioq.
 		nni_posix_pipedesc_finish(aio, 0);
 
@@ -327,6 +340,20 @@ nni_posix_pipedesc_sockname(nni_posix_pipedesc *pd, nni_sockaddr *sa)
 	return (nni_posix_sockaddr2nn(sa, &ss));
 }
 
+int
+nni_posix_pipedesc_fd(nni_posix_pipedesc *pd)
+{
+	return (pd->node.fd);
+}
+
+void
+nni_posix_pipedesc_set_quickack(nni_posix_pipedesc *pd, bool on)
+{
+	nni_mtx_lock(&pd->mtx);
+	pd->quickack = on;
+	nni_mtx_unlock(&pd->mtx);
+}
+
 int
 nni_posix_pipedesc_init(nni_posix_pipedesc **pdp, int fd)
 {
@@ -337,12 +364,12 @@ nni_posix_pipedesc_init(nni_posix_pipedesc **pdp, int fd)
 		return (NNG_ENOMEM);
 	}
 
-	// We could randomly choose a different pollq, or for efficiencies
-	// sake we could take a modulo of the file desc number to choose
-	// one.  For now we just have a global pollq.  Note that by tying
-	// the pd to a single pollq we may get some kind of cache warmth.
+	// The pollq is chosen by the backend from the file descriptor
+	// number (see nni_posix_pollq_get).  Note that by tying the pd
+	// to a single pollq we may get some kind of cache warmth.
 
 	pd->closed    = false;
+	pd->quickack  = false;
 	pd->node.fd   = fd;
 	pd->node.cb   = nni_posix_pipedesc_cb;
 	pd->node.data = pd;
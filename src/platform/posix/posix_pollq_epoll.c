@@ -0,0 +1,512 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifdef NNG_HAVE_EPOLL
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "core/nng_impl.h"
+#include "platform/posix/posix_pollq.h"
+
+// POSIX AIO using Linux epoll().  Unlike the poll() backend, the cost of
+// a wakeup here is proportional to the number of descriptors that are
+// actually ready, not the number that are registered, so this scales to
+// very large numbers of mostly idle connections.
+//
+// We run one poller thread per CPU (each with its own epoll instance),
+// and descriptors are assigned to a poller by file descriptor number.
+// All registrations use EPOLLONESHOT, so that once an event fires the
+// descriptor is disabled in the kernel until the consumer explicitly
+// re-arms it.  This matches the semantics of the other backends, where
+// events are cleared when the callback is run.
+//
+// The kernel is not given pointers to our nodes, as a batch of events
+// returned by epoll_wait may still refer to a node that was removed (and
+// freed) while we were waiting.  Instead each node gets an ID, and the
+// events are looked up by ID, under the lock, before dispatch.  A node
+// that is gone, or no longer armed for the event, is skipped.
+
+#define NNI_MAX_EPOLL_EVENTS 64
+
+// Upper bound on the number of pollers we will create.  Past this point
+// additional threads just add context switches.
+#define NNI_MAX_EPOLL_POLLERS 64
+
+// nni_posix_pollq is a work structure that manages state for the epoll-based
+// pollq implementation.  There is one of these per poller thread.
+struct nni_posix_pollq {
+	nni_mtx               mtx;
+	nni_cv                cv;
+	int                   epfd;    // epoll handle
+	int                   wakewfd; // write side of waker
+	int                   wakerfd; // read side of waker
+	bool                  close;   // request for worker to exit
+	bool                  started;
+	nni_thr               thr;    // worker thread
+	nni_posix_pollq_node *wait;   // cancel waiting on this
+	nni_posix_pollq_node *active; // active node (in callback)
+	nni_idhash *          nodes;  // registered nodes, by ID
+	struct epoll_event    events[NNI_MAX_EPOLL_EVENTS];
+};
+
+static nni_posix_pollq *nni_posix_pollqs;
+static int              nni_posix_npollqs;
+
+static uint32_t
+nni_posix_pollq_epoll_events(int events)
+{
+	uint32_t ev = EPOLLONESHOT;
+
+	if (events & POLLIN) {
+		ev |= EPOLLIN;
+	}
+	if (events & POLLOUT) {
+		ev |= EPOLLOUT;
+	}
+	return (ev);
+}
+
+static int
+nni_posix_pollq_poll_events(uint32_t ev)
+{
+	int events = 0;
+
+	if (ev & EPOLLIN) {
+		events |= POLLIN;
+	}
+	if (ev & EPOLLOUT) {
+		events |= POLLOUT;
+	}
+	if (ev & EPOLLERR) {
+		events |= POLLERR;
+	}
+	if (ev & (EPOLLHUP | EPOLLRDHUP)) {
+		events |= POLLHUP;
+	}
+	return (events);
+}
+
+int
+nni_posix_pollq_add(nni_posix_pollq_node *node)
+{
+	nni_posix_pollq *  pq;
+	struct epoll_event ev;
+	uint64_t           id;
+	int                rv;
+
+	pq = nni_posix_pollq_get(node->fd);
+	if (pq == NULL) {
+		return (NNG_EINVAL);
+	}
+
+	// ensure node was not previously associated with a pollq
+	if (node->pq != NULL) {
+		return (NNG_ESTATE);
+	}
+
+	nni_mtx_lock(&pq->mtx);
+	if (pq->close) {
+		// This shouldn't happen!
+		nni_mtx_unlock(&pq->mtx);
+		return (NNG_ECLOSED);
+	}
+
+	if ((rv = nni_idhash_alloc(pq->nodes, &id, node)) != 0) {
+		nni_mtx_unlock(&pq->mtx);
+		return (rv);
+	}
+
+	// We register with no events enabled; the first arm will enable them.
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLONESHOT;
+	ev.data.u64 = id;
+
+	if (epoll_ctl(pq->epfd, EPOLL_CTL_ADD, node->fd, &ev) != 0) {
+		rv = nni_plat_errno(errno);
+		(void) nni_idhash_remove(pq->nodes, id);
+		nni_mtx_unlock(&pq->mtx);
+		return (rv);
+	}
+
+	node->index  = (int) id;
+	node->pq     = pq;
+	node->events = 0;
+	nni_mtx_unlock(&pq->mtx);
+	return (0);
+}
+
+// common functionality for nni_posix_pollq_remove() and nni_posix_pollq_fini()
+// called while pq's lock is held
+static void
+nni_posix_pollq_remove_helper(nni_posix_pollq *pq, nni_posix_pollq_node *node)
+{
+	struct epoll_event ev;
+
+	node->events = 0;
+	node->pq     = NULL;
+
+	// The descriptor may already have been closed, in which case the
+	// kernel has already dropped it from the epoll set.  We need a
+	// non-NULL event pointer for the benefit of old kernels.
+	memset(&ev, 0, sizeof(ev));
+	(void) epoll_ctl(pq->epfd, EPOLL_CTL_DEL, node->fd, &ev);
+
+	// Any events for it that are still in flight will not find it.
+	(void) nni_idhash_remove(pq->nodes, (uint64_t) node->index);
+}
+
+// nni_posix_pollq_remove removes the node from the pollq, but
+// does not ensure that the pollq node is safe to destroy.  In particular,
+// this function can be called from a callback (the callback may be active).
+void
+nni_posix_pollq_remove(nni_posix_pollq_node *node)
+{
+	nni_posix_pollq *pq = node->pq;
+
+	if (pq == NULL) {
+		return;
+	}
+
+	nni_mtx_lock(&pq->mtx);
+	nni_posix_pollq_remove_helper(pq, node);
+
+	if (pq->close) {
+		nni_cv_wake(&pq->cv);
+	}
+	nni_mtx_unlock(&pq->mtx);
+}
+
+// nni_posix_pollq_init merely ensures that the node is ready for use.
+// It does not register the node with any pollq in particular.
+int
+nni_posix_pollq_init(nni_posix_pollq_node *node)
+{
+	NNI_ARG_UNUSED(node);
+	return (0);
+}
+
+// nni_posix_pollq_fini does everything that nni_posix_pollq_remove does,
+// but it also ensures that the callback is not active, so that the node
+// may be deallocated.  This function must not be called in a callback.
+void
+nni_posix_pollq_fini(nni_posix_pollq_node *node)
+{
+	nni_posix_pollq *pq = node->pq;
+
+	if (pq == NULL) {
+		return;
+	}
+
+	nni_mtx_lock(&pq->mtx);
+	while (pq->active == node) {
+		pq->wait = node;
+		nni_cv_wait(&pq->cv);
+	}
+
+	nni_posix_pollq_remove_helper(pq, node);
+
+	if (pq->close) {
+		nni_cv_wake(&pq->cv);
+	}
+	nni_mtx_unlock(&pq->mtx);
+}
+
+void
+nni_posix_pollq_arm(nni_posix_pollq_node *node, int events)
+{
+	nni_posix_pollq *pq = node->pq;
+
+	NNI_ASSERT(pq != NULL);
+	if (events == 0) {
+		return;
+	}
+
+	nni_mtx_lock(&pq->mtx);
+	if ((node->events & events) != events) {
+		struct epoll_event ev;
+		int                rv;
+
+		node->events |= events;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events   = nni_posix_pollq_epoll_events(node->events);
+		ev.data.u64 = (uint64_t) node->index;
+		rv          = epoll_ctl(pq->epfd, EPOLL_CTL_MOD, node->fd, &ev);
+		// This can only fail if the descriptor was closed underneath
+		// us, in which case the owner is tearing down anyway.
+		NNI_ARG_UNUSED(rv);
+	}
+	nni_mtx_unlock(&pq->mtx);
+}
+
+void
+nni_posix_pollq_disarm(nni_posix_pollq_node *node, int events)
+{
+	nni_posix_pollq *pq = node->pq;
+
+	if (pq == NULL) {
+		return;
+	}
+
+	nni_mtx_lock(&pq->mtx);
+	if ((node->events & events) != 0) {
+		struct epoll_event ev;
+
+		node->events &= ~events;
+
+		// Leaving EPOLLONESHOT alone with no other events set
+		// disables the descriptor without removing it.
+		memset(&ev, 0, sizeof(ev));
+		ev.events   = nni_posix_pollq_epoll_events(node->events);
+		ev.data.u64 = (uint64_t) node->index;
+		(void) epoll_ctl(pq->epfd, EPOLL_CTL_MOD, node->fd, &ev);
+	}
+	nni_mtx_unlock(&pq->mtx);
+}
+
+static void
+nni_posix_poll_thr(void *arg)
+{
+	nni_posix_pollq *pq = arg;
+
+	nni_mtx_lock(&pq->mtx);
+
+	while (!pq->close) {
+		int i;
+		int n;
+
+		// block indefinitely, timers are handled separately
+		nni_mtx_unlock(&pq->mtx);
+		n = epoll_wait(pq->epfd, pq->events, NNI_MAX_EPOLL_EVENTS, -1);
+		nni_mtx_lock(&pq->mtx);
+
+		if (n < 0) {
+			// EINTR is the only reasonable failure here.
+			continue;
+		}
+
+		// dispatch events
+		for (i = 0; i < n; i++) {
+			nni_posix_pollq_node *node;
+			uint64_t              id;
+			int                   revents;
+
+			// ID zero is our waker.  Otherwise the node may have
+			// been removed since the event was collected, either
+			// while we were waiting or running another callback.
+			id = pq->events[i].data.u64;
+			if ((id == 0) ||
+			    (nni_idhash_find(pq->nodes, id, (void **) &node) !=
+			        0)) {
+				continue;
+			}
+
+			// It may also have been disarmed since.  Only the
+			// events it is still armed for are delivered.
+			if (node->events == 0) {
+				continue;
+			}
+			revents =
+			    nni_posix_pollq_poll_events(pq->events[i].events);
+			revents &= node->events | POLLERR | POLLHUP;
+			if (revents & (POLLERR | POLLHUP)) {
+				// The kernel disabled everything; the
+				// callback is expected to deal with it.
+				node->events = 0;
+			} else {
+				node->events &= ~revents;
+			}
+
+			// Because of EPOLLONESHOT, any events the node is
+			// still interested in have to be re-enabled.
+			if (node->events != 0) {
+				struct epoll_event rearm;
+
+				memset(&rearm, 0, sizeof(rearm));
+				rearm.events =
+				    nni_posix_pollq_epoll_events(node->events);
+				rearm.data.u64 = id;
+				(void) epoll_ctl(pq->epfd, EPOLL_CTL_MOD,
+				    node->fd, &rearm);
+			}
+			if (revents == 0) {
+				continue;
+			}
+			node->revents = revents;
+
+			// Save the active node; we can notice this way
+			// when it is busy, and avoid freeing it until
+			// we are sure that it is not in use.
+			pq->active = node;
+
+			// Execute the callback with lock released
+			nni_mtx_unlock(&pq->mtx);
+			node->cb(node->data);
+			nni_mtx_lock(&pq->mtx);
+
+			// We finished with this node.  If something
+			// was blocked waiting for that, wake it up.
+			pq->active = NULL;
+			if (pq->wait == node) {
+				pq->wait = NULL;
+				nni_cv_wake(&pq->cv);
+			}
+		}
+	}
+
+	nni_mtx_unlock(&pq->mtx);
+}
+
+static void
+nni_posix_pollq_destroy(nni_posix_pollq *pq)
+{
+	if (pq->started) {
+		nni_mtx_lock(&pq->mtx);
+		pq->close   = true;
+		pq->started = false;
+		nni_plat_pipe_raise(pq->wakewfd);
+		nni_mtx_unlock(&pq->mtx);
+	}
+	nni_thr_fini(&pq->thr);
+
+	if (pq->wakewfd >= 0) {
+		nni_plat_pipe_close(pq->wakewfd, pq->wakerfd);
+		pq->wakewfd = pq->wakerfd = -1;
+	}
+	if (pq->epfd >= 0) {
+		close(pq->epfd);
+		pq->epfd = -1;
+	}
+
+	nni_idhash_fini(pq->nodes);
+	nni_cv_fini(&pq->cv);
+	nni_mtx_fini(&pq->mtx);
+}
+
+static int
+nni_posix_pollq_add_wake_evt(nni_posix_pollq *pq)
+{
+	struct epoll_event ev;
+	int                rv;
+
+	if ((rv = nni_plat_pipe_open(&pq->wakewfd, &pq->wakerfd)) != 0) {
+		return (rv);
+	}
+
+	// The waker is level triggered and never cleared; it is only
+	// ever raised to tell the thread to exit.
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN;
+	ev.data.u64 = 0;
+	if (epoll_ctl(pq->epfd, EPOLL_CTL_ADD, pq->wakerfd, &ev) != 0) {
+		return (nni_plat_errno(errno));
+	}
+	return (0);
+}
+
+static int
+nni_posix_pollq_create(nni_posix_pollq *pq)
+{
+	int rv;
+
+	pq->wakewfd = -1;
+	pq->wakerfd = -1;
+	pq->close   = false;
+
+	nni_mtx_init(&pq->mtx);
+	nni_cv_init(&pq->cv, &pq->mtx);
+
+	// IDs have to fit in the node's index.
+	if ((rv = nni_idhash_init(&pq->nodes)) != 0) {
+		pq->epfd = -1;
+		nni_posix_pollq_destroy(pq);
+		return (rv);
+	}
+	nni_idhash_set_limits(pq->nodes, 1, 0x7fffffff, 1);
+
+	if ((pq->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		rv = nni_plat_errno(errno);
+		nni_posix_pollq_destroy(pq);
+		return (rv);
+	}
+
+	if (((rv = nni_thr_init(&pq->thr, nni_posix_poll_thr, pq)) != 0) ||
+	    ((rv = nni_posix_pollq_add_wake_evt(pq)) != 0)) {
+		nni_posix_pollq_destroy(pq);
+		return (rv);
+	}
+
+	pq->started = true;
+	nni_thr_run(&pq->thr);
+	return (0);
+}
+
+nni_posix_pollq *
+nni_posix_pollq_get(int fd)
+{
+	if ((fd < 0) || (nni_posix_npollqs == 0)) {
+		return (NULL);
+	}
+	// Descriptor numbers are allocated densely by the kernel, so a
+	// simple modulo gives us a reasonably even spread.
+	return (&nni_posix_pollqs[fd % nni_posix_npollqs]);
+}
+
+int
+nni_posix_pollq_sysinit(void)
+{
+	int rv;
+	int i;
+	int ncpu;
+
+	ncpu = nni_plat_ncpu();
+	if (ncpu > NNI_MAX_EPOLL_POLLERS) {
+		ncpu = NNI_MAX_EPOLL_POLLERS;
+	}
+
+	nni_posix_pollqs = NNI_ALLOC_STRUCTS(nni_posix_pollqs, ncpu);
+	if (nni_posix_pollqs == NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (i = 0; i < ncpu; i++) {
+		if ((rv = nni_posix_pollq_create(&nni_posix_pollqs[i])) != 0) {
+			while (--i >= 0) {
+				nni_posix_pollq_destroy(&nni_posix_pollqs[i]);
+			}
+			NNI_FREE_STRUCTS(nni_posix_pollqs, ncpu);
+			nni_posix_pollqs = NULL;
+			return (rv);
+		}
+	}
+	nni_posix_npollqs = ncpu;
+	return (0);
+}
+
+void
+nni_posix_pollq_sysfini(void)
+{
+	int i;
+
+	for (i = 0; i < nni_posix_npollqs; i++) {
+		nni_posix_pollq_destroy(&nni_posix_pollqs[i]);
+	}
+	if (nni_posix_pollqs != NULL) {
+		NNI_FREE_STRUCTS(nni_posix_pollqs, nni_posix_npollqs);
+		nni_posix_pollqs  = NULL;
+		nni_posix_npollqs = 0;
+	}
+}
+
+#endif // NNG_HAVE_EPOLL
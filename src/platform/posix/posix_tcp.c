@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -76,6 +77,12 @@ nni_plat_tcp_ep_listen(nni_plat_tcp_ep *ep, nng_sockaddr *bsa)
 	return (rv);
 }
 
+void
+nni_plat_tcp_ep_set_listen(nni_plat_tcp_ep *ep, int backlog, int nshards)
+{
+	nni_posix_epdesc_set_listen((void *) ep, backlog, nshards);
+}
+
 void
 nni_plat_tcp_ep_connect(nni_plat_tcp_ep *ep, nni_aio *aio)
 {
@@ -124,6 +131,70 @@ nni_plat_tcp_pipe_sockname(nni_plat_tcp_pipe *p, nni_sockaddr *sa)
 	return (nni_posix_pipedesc_sockname((void *) p, sa));
 }
 
+// nni_posix_tcp_secs converts a duration to whole seconds, as needed by
+// the keepalive options, rounding up.
+static int
+nni_posix_tcp_secs(nni_duration d)
+{
+	return ((int) ((d + 999) / 1000));
+}
+
+void
+nni_plat_tcp_pipe_setopts(nni_plat_tcp_pipe *p, const nni_plat_tcp_opts *o)
+{
+	nni_posix_pipedesc *pd = (void *) p;
+	int                 fd = nni_posix_pipedesc_fd(pd);
+	int                 val;
+
+	val = o->nodelay ? 1 : 0;
+	(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+	val = o->keepalive ? 1 : 0;
+	(void) setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+	if (o->keepalive) {
+		if (o->keepidle > 0) {
+			val = nni_posix_tcp_secs(o->keepidle);
+#if defined(TCP_KEEPIDLE)
+			(void) setsockopt(
+			    fd, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val));
+#elif defined(TCP_KEEPALIVE)
+			// Darwin calls it this.
+			(void) setsockopt(
+			    fd, IPPROTO_TCP, TCP_KEEPALIVE, &val, sizeof(val));
+#endif
+		}
+#ifdef TCP_KEEPINTVL
+		if (o->keepintvl > 0) {
+			val = nni_posix_tcp_secs(o->keepintvl);
+			(void) setsockopt(
+			    fd, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val));
+		}
+#endif
+#ifdef TCP_KEEPCNT
+		if (o->keepcnt > 0) {
+			val = o->keepcnt;
+			(void) setsockopt(
+			    fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
+		}
+#endif
+	}
+
+	if (o->sndbuf > 0) {
+		val = (int) o->sndbuf;
+		(void) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val));
+	}
+	if (o->rcvbuf > 0) {
+		val = (int) o->rcvbuf;
+		(void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+	}
+
+#ifdef TCP_QUICKACK
+	val = o->quickack ? 1 : 0;
+	(void) setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &val, sizeof(val));
+	nni_posix_pipedesc_set_quickack(pd, o->quickack);
+#endif
+}
+
 int
 nni_plat_tcp_ntop(const nni_sockaddr *sa, char *ipstr, char *portstr)
 {
@@ -422,6 +422,51 @@ nni_plat_thr_fini(nni_plat_thr *thr)
 	}
 }
 
+int
+nni_plat_ncpu(void)
+{
+	long n;
+
+	if ((n = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+		n = 1;
+	}
+	return ((int) n);
+}
+
+int
+nni_plat_tls_init(nni_plat_tls *tls, void (*dtor)(void *))
+{
+	int rv;
+
+	if ((rv = pthread_key_create(&tls->key, dtor)) != 0) {
+		return (nni_plat_errno(rv));
+	}
+	return (0);
+}
+
+void
+nni_plat_tls_fini(nni_plat_tls *tls)
+{
+	(void) pthread_key_delete(tls->key);
+}
+
+void *
+nni_plat_tls_get(nni_plat_tls *tls)
+{
+	return (pthread_getspecific(tls->key));
+}
+
+int
+nni_plat_tls_set(nni_plat_tls *tls, void *val)
+{
+	int rv;
+
+	if ((rv = pthread_setspecific(tls->key, val)) != 0) {
+		return (nni_plat_errno(rv));
+	}
+	return (0);
+}
+
 void
 nni_atfork_child(void)
 {
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,14 +35,99 @@
 #define NNI_MSG_NOSIGNAL 0
 #endif
 
+// Where the platform has them, we use recvmmsg and sendmmsg to service
+// every queued aio with a single system call, instead of one call per
+// datagram.  Elsewhere we just loop over recvmsg and sendmsg.
+#if defined(NNG_HAVE_RECVMMSG) || defined(NNG_HAVE_SENDMMSG)
+typedef struct mmsghdr nni_udp_mmsg;
+#else
+typedef struct {
+	struct msghdr msg_hdr;
+	unsigned      msg_len;
+} nni_udp_mmsg;
+#endif
+
+// On Linux, UDP generic segmentation offload lets us hand the kernel a
+// run of equal sized datagrams to the same peer as a single buffer, which
+// it splits (in hardware if it can) into separate datagrams on the wire.
+#if defined(UDP_SEGMENT) && defined(NNG_HAVE_MSG_CONTROL)
+#define NNI_UDP_GSO
+#define NNI_UDP_GSO_SEGS 64     // most segments the kernel accepts
+#define NNI_UDP_GSO_MAXLEN 65507 // largest payload of one IP packet
+#endif
+
+#define NNI_UDP_BATCH 32 // datagrams per system call
+#define NNI_UDP_IOVS 64  // iovs per system call, over all datagrams
+
+// Scratch space for building a batch.  This is only used with the lock
+// held, and each batch is finished before the lock is dropped, so one
+// of these serves for both directions.
+typedef struct {
+	nni_udp_mmsg            ub_msgs[NNI_UDP_BATCH];
+	struct sockaddr_storage ub_addrs[NNI_UDP_BATCH];
+	struct iovec            ub_iovs[NNI_UDP_IOVS];
+	nni_aio *               ub_aios[NNI_UDP_IOVS];
+	size_t                  ub_lens[NNI_UDP_IOVS];   // bytes in each aio
+	unsigned                ub_first[NNI_UDP_BATCH]; // first aio of msg
+	unsigned                ub_naios[NNI_UDP_BATCH]; // aios in msg
+#ifdef NNI_UDP_GSO
+	union {
+		char           buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} ub_cmsgs[NNI_UDP_BATCH];
+#endif
+} nni_udp_batch;
+
 struct nni_plat_udp {
 	nni_posix_pollq_node udp_pitem;
 	int                  udp_fd;
+	bool                 udp_gso;       // kernel supports UDP_SEGMENT
+	bool                 udp_connected; // peer fixed by connect()
 	nni_list             udp_recvq;
 	nni_list             udp_sendq;
 	nni_mtx              udp_mtx;
+	nni_udp_batch        udp_batch;
 };
 
+// nni_posix_udp_recvmmsg receives up to n datagrams, returning the number
+// received, or -1 (with errno set) if none could be.
+static int
+nni_posix_udp_recvmmsg(int fd, nni_udp_mmsg *msgs, unsigned n)
+{
+#ifdef NNG_HAVE_RECVMMSG
+	return (recvmmsg(fd, msgs, n, 0, NULL));
+#else
+	for (unsigned i = 0; i < n; i++) {
+		ssize_t len;
+		if ((len = recvmsg(fd, &msgs[i].msg_hdr, 0)) < 0) {
+			return (i > 0 ? (int) i : -1);
+		}
+		msgs[i].msg_len = (unsigned) len;
+	}
+	return ((int) n);
+#endif
+}
+
+// nni_posix_udp_sendmmsg sends up to n datagrams, returning the number
+// sent, or -1 (with errno set) if the first could not be.
+static int
+nni_posix_udp_sendmmsg(int fd, nni_udp_mmsg *msgs, unsigned n)
+{
+#ifdef NNG_HAVE_SENDMMSG
+	return (sendmmsg(fd, msgs, n, NNI_MSG_NOSIGNAL));
+#else
+	for (unsigned i = 0; i < n; i++) {
+		ssize_t len;
+		len = sendmsg(fd, &msgs[i].msg_hdr, NNI_MSG_NOSIGNAL);
+		if (len < 0) {
+			return (i > 0 ? (int) i : -1);
+		}
+		msgs[i].msg_len = (unsigned) len;
+	}
+	return ((int) n);
+#endif
+}
+
 static void
 nni_posix_udp_doclose(nni_plat_udp *udp)
 {
@@ -58,115 +144,271 @@ nni_posix_udp_doclose(nni_plat_udp *udp)
 static void
 nni_posix_udp_dorecv(nni_plat_udp *udp)
 {
-	nni_aio * aio;
-	nni_list *q = &udp->udp_recvq;
-	// While we're able to recv, do so.
+	nni_udp_batch *b = &udp->udp_batch;
+	nni_list *     q = &udp->udp_recvq;
+	nni_aio *      aio;
+
+	// While we're able to recv, do so, filling as many of the waiting
+	// aios as we can with each call.
 	while ((aio = nni_list_first(q)) != NULL) {
-		struct iovec            iov[4];
-		unsigned                niov;
-		nni_iov *               aiov;
-		struct sockaddr_storage ss;
-		nng_sockaddr *          sa;
-		struct msghdr           hdr;
-		int                     rv  = 0;
-		int                     cnt = 0;
-
-		nni_aio_get_iov(aio, &niov, &aiov);
-
-		for (unsigned i = 0; i < niov; i++) {
-			iov[i].iov_base = aiov[i].iov_buf;
-			iov[i].iov_len  = aiov[i].iov_len;
+		unsigned n    = 0;
+		unsigned niov = 0;
+		int      cnt;
+
+		while ((aio != NULL) && (n < NNI_UDP_BATCH)) {
+			struct msghdr *hdr = &b->ub_msgs[n].msg_hdr;
+			struct iovec * iov = &b->ub_iovs[niov];
+			unsigned       naiov;
+			nni_iov *      aiov;
+
+			nni_aio_get_iov(aio, &naiov, &aiov);
+			if (naiov > (NNI_UDP_IOVS - niov)) {
+				break;
+			}
+			for (unsigned i = 0; i < naiov; i++) {
+				iov[i].iov_base = aiov[i].iov_buf;
+				iov[i].iov_len  = aiov[i].iov_len;
+			}
+			hdr->msg_iov        = iov;
+			hdr->msg_iovlen     = naiov;
+			hdr->msg_name       = &b->ub_addrs[n];
+			hdr->msg_namelen    = sizeof(b->ub_addrs[n]);
+			hdr->msg_flags      = 0;
+			hdr->msg_control    = NULL;
+			hdr->msg_controllen = 0;
+			b->ub_aios[n]       = aio;
+			niov += naiov;
+			n++;
+			aio = nni_list_next(q, aio);
+		}
+		if (n == 0) {
+			// The aio at the head has more iovs than we can
+			// ever pass down.
+			nni_list_remove(q, aio);
+			nni_aio_finish_error(aio, NNG_EINVAL);
+			continue;
 		}
-		hdr.msg_iov        = iov;
-		hdr.msg_iovlen     = niov;
-		hdr.msg_name       = &ss;
-		hdr.msg_namelen    = sizeof(ss);
-		hdr.msg_flags      = 0;
-		hdr.msg_control    = NULL;
-		hdr.msg_controllen = 0;
-
-		if ((cnt = recvmsg(udp->udp_fd, &hdr, 0)) < 0) {
+
+		cnt = nni_posix_udp_recvmmsg(udp->udp_fd, b->ub_msgs, n);
+		if (cnt < 0) {
 			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
 				// No data available at socket.  Leave
 				// the AIO at the head of the queue.
 				return;
 			}
-			rv = nni_plat_errno(errno);
-		} else if ((sa = nni_aio_get_input(aio, 0)) != NULL) {
-			// We need to store the address information.
-			// It is incumbent on the AIO submitter to supply
-			// storage for the address.
-			nni_posix_sockaddr2nn(sa, (void *) &ss);
+			// Errors (such as ICMP port unreachable) are
+			// reported to the first waiter.
+			aio = b->ub_aios[0];
+			nni_list_remove(q, aio);
+			nni_aio_finish_error(aio, nni_plat_errno(errno));
+			continue;
+		}
+		for (int i = 0; i < cnt; i++) {
+			nng_sockaddr *sa;
+
+			aio = b->ub_aios[i];
+			if ((sa = nni_aio_get_input(aio, 0)) != NULL) {
+				// We need to store the address information.
+				// It is incumbent on the AIO submitter to
+				// supply storage for the address.
+				nni_posix_sockaddr2nn(
+				    sa, (void *) &b->ub_addrs[i]);
+			}
+			nni_list_remove(q, aio);
+			nni_aio_finish(aio, 0, b->ub_msgs[i].msg_len);
+		}
+		if ((unsigned) cnt < n) {
+			// Socket is drained; wait for the poller.
+			return;
 		}
-		nni_list_remove(q, aio);
-		nni_aio_finish(aio, rv, cnt);
 	}
 }
 
+#ifdef NNI_UDP_GSO
+// nni_posix_udp_gso_join returns true if a datagram of the given size, to
+// the given address, can be sent as another segment of message m.  Every
+// segment but the last must be the same size as the first.
+static bool
+nni_posix_udp_gso_join(nni_plat_udp *udp, unsigned m,
+    struct sockaddr_storage *ss, socklen_t sslen, size_t len)
+{
+	nni_udp_batch *b = &udp->udp_batch;
+	struct msghdr *hdr;
+	unsigned       first;
+	unsigned       naios;
+	size_t         seg;
+
+	if (!udp->udp_gso) {
+		return (false);
+	}
+	hdr   = &b->ub_msgs[m].msg_hdr;
+	first = b->ub_first[m];
+	naios = b->ub_naios[m];
+	seg   = b->ub_lens[first];
+	if ((len == 0) || (len > seg) || (naios >= NNI_UDP_GSO_SEGS) ||
+	    (b->ub_lens[first + naios - 1] != seg) ||
+	    ((seg * naios + len) > NNI_UDP_GSO_MAXLEN)) {
+		return (false);
+	}
+	if (udp->udp_connected) {
+		// Everything goes to the one peer.
+		return (true);
+	}
+	return ((hdr->msg_namelen == sslen) &&
+	    (memcmp(hdr->msg_name, ss, sslen) == 0));
+}
+
 static void
-nni_posix_udp_dosend(nni_plat_udp *udp)
+nni_posix_udp_gso_set(nni_plat_udp *udp, unsigned m)
 {
-	nni_aio * aio;
-	nni_list *q = &udp->udp_sendq;
+	nni_udp_batch * b   = &udp->udp_batch;
+	struct msghdr * hdr = &b->ub_msgs[m].msg_hdr;
+	struct cmsghdr *cm;
+	uint16_t        seg;
 
-	// While we're able to send, do so.
-	while ((aio = nni_list_first(q)) != NULL) {
-		struct sockaddr_storage ss;
-
-		int len;
-		int rv  = 0;
-		int cnt = 0;
-
-		len = nni_posix_nn2sockaddr(&ss, nni_aio_get_input(aio, 0));
-		if (len < 1) {
-			rv = NNG_EADDRINVAL;
-		} else {
-			struct msghdr hdr;
-			unsigned      niov;
-			nni_iov *     aiov;
-#ifdef NNG_HAVE_ALLOCA
-			struct iovec *iov;
-#else
-			struct iovec iov[16];
+	if (b->ub_naios[m] < 2) {
+		return;
+	}
+	seg                 = (uint16_t) b->ub_lens[b->ub_first[m]];
+	hdr->msg_control    = b->ub_cmsgs[m].buf;
+	hdr->msg_controllen = sizeof(b->ub_cmsgs[m].buf);
+	cm                  = CMSG_FIRSTHDR(hdr);
+	cm->cmsg_level      = IPPROTO_UDP;
+	cm->cmsg_type       = UDP_SEGMENT;
+	cm->cmsg_len        = CMSG_LEN(sizeof(seg));
+	memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+}
 #endif
 
-			nni_aio_get_iov(aio, &niov, &aiov);
-#ifdef NNG_HAVE_ALLOCA
-			if (niov > 64) {
-				rv = NNG_EINVAL;
-			} else {
-				iov = alloca(niov * sizeof(*iov));
+static void
+nni_posix_udp_dosend(nni_plat_udp *udp)
+{
+	nni_udp_batch *b = &udp->udp_batch;
+	nni_list *     q = &udp->udp_sendq;
+	nni_aio *      aio;
+
+	// While we're able to send, do so, passing as many of the waiting
+	// aios as we can with each call.
+	while ((aio = nni_list_first(q)) != NULL) {
+		unsigned n    = 0; // messages
+		unsigned na   = 0; // aios
+		unsigned niov = 0;
+		int      cnt;
+
+		while ((aio != NULL) && (n < NNI_UDP_BATCH) &&
+		    (na < NNI_UDP_IOVS)) {
+			struct sockaddr_storage ss;
+			struct msghdr *         hdr;
+			struct iovec *          iov = &b->ub_iovs[niov];
+			nni_aio *               next;
+			unsigned                naiov;
+			nni_iov *               aiov;
+			size_t                  len;
+			int                     sslen;
+
+			next = nni_list_next(q, aio);
+			nni_aio_get_iov(aio, &naiov, &aiov);
+			sslen = nni_posix_nn2sockaddr(
+			    &ss, nni_aio_get_input(aio, 0));
+			if ((sslen < 1) || (naiov > NNI_UDP_IOVS)) {
+				nni_list_remove(q, aio);
+				nni_aio_finish_error(aio,
+				    sslen < 1 ? NNG_EADDRINVAL : NNG_EINVAL);
+				aio = next;
+				continue;
 			}
-#else
-			if (niov > NNI_NUM_ELEMENTS(iov)) {
-				rv = NNG_EINVAL;
+			if (naiov > (NNI_UDP_IOVS - niov)) {
+				break;
 			}
-#endif
-
-			for (unsigned i = 0; i < niov; i++) {
+			len = 0;
+			for (unsigned i = 0; i < naiov; i++) {
 				iov[i].iov_base = aiov[i].iov_buf;
 				iov[i].iov_len  = aiov[i].iov_len;
+				len += aiov[i].iov_len;
 			}
-			hdr.msg_iov        = iov;
-			hdr.msg_iovlen     = niov;
-			hdr.msg_name       = &ss;
-			hdr.msg_namelen    = len;
-			hdr.msg_flags      = NNI_MSG_NOSIGNAL;
-			hdr.msg_control    = NULL;
-			hdr.msg_controllen = 0;
-
-			if ((cnt = sendmsg(udp->udp_fd, &hdr, 0)) < 0) {
-				if ((errno == EAGAIN) ||
-				    (errno == EWOULDBLOCK)) {
-					// Cannot send now, leave at head.
-					return;
-				}
-				rv = nni_plat_errno(errno);
+			b->ub_aios[na] = aio;
+			b->ub_lens[na] = len;
+
+#ifdef NNI_UDP_GSO
+			if ((n > 0) && nni_posix_udp_gso_join(
+			                   udp, n - 1, &ss, sslen, len)) {
+				// Our iovs follow those of the previous
+				// message, so it just gets longer.
+				hdr = &b->ub_msgs[n - 1].msg_hdr;
+				hdr->msg_iovlen += naiov;
+				b->ub_naios[n - 1]++;
+				niov += naiov;
+				na++;
+				aio = next;
+				continue;
 			}
+#endif
+			memcpy(&b->ub_addrs[n], &ss, sslen);
+			hdr             = &b->ub_msgs[n].msg_hdr;
+			hdr->msg_iov    = iov;
+			hdr->msg_iovlen = naiov;
+			if (udp->udp_connected) {
+				// Some systems refuse an address on a
+				// connected socket, even the same one.
+				hdr->msg_name    = NULL;
+				hdr->msg_namelen = 0;
+			} else {
+				hdr->msg_name    = &b->ub_addrs[n];
+				hdr->msg_namelen = sslen;
+			}
+			hdr->msg_flags      = 0;
+			hdr->msg_control    = NULL;
+			hdr->msg_controllen = 0;
+			b->ub_first[n]      = na;
+			b->ub_naios[n]      = 1;
+			niov += naiov;
+			na++;
+			n++;
+			aio = next;
+		}
+		if (n == 0) {
+			// Everything we looked at was bad, and has been
+			// completed already.
+			continue;
 		}
+#ifdef NNI_UDP_GSO
+		for (unsigned i = 0; i < n; i++) {
+			nni_posix_udp_gso_set(udp, i);
+		}
+#endif
 
-		nni_list_remove(q, aio);
-		nni_aio_finish(aio, rv, cnt);
+		cnt = nni_posix_udp_sendmmsg(udp->udp_fd, b->ub_msgs, n);
+		if (cnt < 0) {
+			int rv;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				// Cannot send now, leave at head.
+				return;
+			}
+			rv = nni_plat_errno(errno);
+#ifdef NNI_UDP_GSO
+			if (b->ub_naios[0] > 1) {
+				// The kernel would not segment this (e.g. the
+				// segment size exceeds the path MTU, or the
+				// device cannot checksum), so go back to
+				// sending datagrams separately.
+				udp->udp_gso = false;
+				continue;
+			}
+#endif
+			aio = b->ub_aios[0];
+			nni_list_remove(q, aio);
+			nni_aio_finish_error(aio, rv);
+			continue;
+		}
+		for (int i = 0; i < cnt; i++) {
+			unsigned first = b->ub_first[i];
+			for (unsigned j = first; j < first + b->ub_naios[i];
+			     j++) {
+				aio = b->ub_aios[j];
+				nni_list_remove(q, aio);
+				nni_aio_finish(aio, 0, b->ub_lens[j]);
+			}
+		}
 	}
 }
 
@@ -180,13 +422,16 @@ nni_posix_udp_cb(void *arg)
 
 	nni_mtx_lock(&udp->udp_mtx);
 	revents = udp->udp_pitem.revents;
-	if (revents & POLLIN) {
+	// A pending socket error (such as an ICMP port unreachable on a
+	// connected socket) raises POLLERR, and is returned by the next
+	// receive or send, so let those report it rather than closing.
+	if (revents & (POLLIN | POLLERR)) {
 		nni_posix_udp_dorecv(udp);
 	}
-	if (revents & POLLOUT) {
+	if (revents & (POLLOUT | POLLERR)) {
 		nni_posix_udp_dosend(udp);
 	}
-	if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+	if (revents & (POLLHUP | POLLNVAL)) {
 		nni_posix_udp_doclose(udp);
 	} else {
 		if (!nni_list_empty(&udp->udp_sendq)) {
@@ -241,6 +486,17 @@ nni_plat_udp_open(nni_plat_udp **upp, nni_sockaddr *bindaddr)
 
 	(void) fcntl(udp->udp_fd, F_SETFL, O_NONBLOCK);
 
+#ifdef NNI_UDP_GSO
+	{
+		// Older kernels do not know the option at all.
+		int       gso = 0;
+		socklen_t sz  = sizeof(gso);
+
+		udp->udp_gso = (getsockopt(udp->udp_fd, IPPROTO_UDP,
+		                    UDP_SEGMENT, &gso, &sz) == 0);
+	}
+#endif
+
 	nni_aio_list_init(&udp->udp_recvq);
 	nni_aio_list_init(&udp->udp_sendq);
 
@@ -306,6 +562,26 @@ nni_plat_udp_send(nni_plat_udp *udp, nni_aio *aio)
 	nni_mtx_unlock(&udp->udp_mtx);
 }
 
+int
+nni_plat_udp_connect(nni_plat_udp *udp, const nni_sockaddr *sa)
+{
+	struct sockaddr_storage ss;
+	int                     sslen;
+	int                     rv = 0;
+
+	if ((sslen = nni_posix_nn2sockaddr(&ss, sa)) < 1) {
+		return (NNG_EADDRINVAL);
+	}
+	nni_mtx_lock(&udp->udp_mtx);
+	if (connect(udp->udp_fd, (void *) &ss, sslen) != 0) {
+		rv = nni_plat_errno(errno);
+	} else {
+		udp->udp_connected = true;
+	}
+	nni_mtx_unlock(&udp->udp_mtx);
+	return (rv);
+}
+
 int
 nni_plat_udp_sockname(nni_plat_udp *udp, nni_sockaddr *sa)
 {
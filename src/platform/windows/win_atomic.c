@@ -0,0 +1,78 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+#ifdef NNG_PLATFORM_WINDOWS
+
+void
+nni_atomic_init64(nni_atomic_u64 *a)
+{
+	InterlockedExchange64(&a->v, 0);
+}
+
+void
+nni_atomic_add64(nni_atomic_u64 *a, uint64_t bump)
+{
+	(void) InterlockedExchangeAdd64(&a->v, (LONGLONG) bump);
+}
+
+void
+nni_atomic_sub64(nni_atomic_u64 *a, uint64_t bump)
+{
+	// Windows lacks a subtract, so we add the two's complement.
+	(void) InterlockedExchangeAdd64(&a->v, 0ll - (LONGLONG) bump);
+}
+
+void
+nni_atomic_inc64(nni_atomic_u64 *a)
+{
+	(void) InterlockedIncrement64(&a->v);
+}
+
+uint64_t
+nni_atomic_inc64_nv(nni_atomic_u64 *a)
+{
+	return ((uint64_t) InterlockedIncrement64(&a->v));
+}
+
+uint64_t
+nni_atomic_dec64_nv(nni_atomic_u64 *a)
+{
+	return ((uint64_t) InterlockedDecrement64(&a->v));
+}
+
+uint64_t
+nni_atomic_get64(nni_atomic_u64 *a)
+{
+	return ((uint64_t) InterlockedExchangeAdd64(&a->v, 0));
+}
+
+void
+nni_atomic_set64(nni_atomic_u64 *a, uint64_t u)
+{
+	(void) InterlockedExchange64(&a->v, (LONGLONG) u);
+}
+
+uint64_t
+nni_atomic_swap64(nni_atomic_u64 *a, uint64_t u)
+{
+	return ((uint64_t) InterlockedExchange64(&a->v, (LONGLONG) u));
+}
+
+int
+nni_atomic_cas64(nni_atomic_u64 *a, uint64_t old, uint64_t nv)
+{
+	LONGLONG prev;
+	prev = InterlockedCompareExchange64(&a->v, (LONGLONG) nv, (LONGLONG) old);
+	return (prev == (LONGLONG) old);
+}
+
+#endif // NNG_PLATFORM_WINDOWS
@@ -366,4 +366,98 @@ nni_plat_file_unlock(nni_plat_flock *lk)
 	lk->h = INVALID_HANDLE_VALUE;
 }
 
+int
+nni_plat_file_open(
+    const char *path, nni_plat_file *f, uint64_t *sizep, uint64_t *mtimep)
+{
+	HANDLE                     h;
+	BY_HANDLE_FILE_INFORMATION info;
+	ULARGE_INTEGER             ft;
+	int                        rv;
+
+	h = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+	    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE) {
+		return (nni_win_error(GetLastError()));
+	}
+	if (!GetFileInformationByHandle(h, &info)) {
+		rv = nni_win_error(GetLastError());
+		(void) CloseHandle(h);
+		return (rv);
+	}
+	if ((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+		(void) CloseHandle(h);
+		return (NNG_EINVAL);
+	}
+
+	// FILETIME counts 100ns intervals since 1601; convert to the
+	// UNIX epoch.
+	ft.LowPart  = info.ftLastWriteTime.dwLowDateTime;
+	ft.HighPart = info.ftLastWriteTime.dwHighDateTime;
+	*mtimep     = (ft.QuadPart - 116444736000000000ULL) / 10000000;
+	*sizep      = ((uint64_t) info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	f->h        = h;
+	return (0);
+}
+
+int
+nni_plat_file_read(
+    nni_plat_file *f, void *buf, size_t len, uint64_t off, size_t *np)
+{
+	size_t resid = len;
+
+	while (resid > 0) {
+		OVERLAPPED ov;
+		DWORD      n;
+		DWORD      want;
+
+		want = resid > 0x40000000 ? 0x40000000 : (DWORD) resid;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset     = (DWORD)(off & 0xffffffff);
+		ov.OffsetHigh = (DWORD)(off >> 32);
+		if (!ReadFile(f->h, buf, want, &n, &ov)) {
+			int rv = GetLastError();
+			if (rv == ERROR_HANDLE_EOF) {
+				break;
+			}
+			return (nni_win_error(rv));
+		}
+		if (n == 0) {
+			break; // end of file
+		}
+		buf = ((uint8_t *) buf) + n;
+		off += n;
+		resid -= n;
+	}
+	*np = len - resid;
+	return (0);
+}
+
+void
+nni_plat_file_close(nni_plat_file *f)
+{
+	HANDLE h = f->h;
+	(void) CloseHandle(h);
+	f->h = INVALID_HANDLE_VALUE;
+}
+
+int
+nni_plat_file_stat(const char *path, uint64_t *sizep, uint64_t *mtimep)
+{
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	ULARGE_INTEGER            ft;
+
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &info)) {
+		return (nni_win_error(GetLastError()));
+	}
+	if ((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+		return (NNG_EINVAL);
+	}
+	ft.LowPart  = info.ftLastWriteTime.dwLowDateTime;
+	ft.HighPart = info.ftLastWriteTime.dwHighDateTime;
+	*mtimep     = (ft.QuadPart - 116444736000000000ULL) / 10000000;
+	*sizep      = ((uint64_t) info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	return (0);
+}
+
 #endif // NNG_PLATFORM_WINDOWS
\ No newline at end of file
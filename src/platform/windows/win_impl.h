@@ -79,6 +79,22 @@ struct nni_plat_flock {
 	HANDLE h;
 };
 
+struct nni_plat_file {
+	HANDLE h;
+};
+
+// Fiber local storage is used, because unlike TLS it supports a
+// destructor.  The value stored holds the destructor along with the
+// user data.
+struct nni_plat_tls {
+	DWORD idx;
+	void (*dtor)(void *);
+};
+
+struct nni_atomic_u64 {
+	LONGLONG volatile v;
+};
+
 extern int nni_win_error(int);
 
 extern int  nni_win_event_init(nni_win_event *, nni_win_event_ops *, void *);
@@ -13,6 +13,7 @@
 #ifdef NNG_PLATFORM_WINDOWS
 
 #include <malloc.h>
+#include <mstcpip.h>
 #include <stdio.h>
 
 struct nni_plat_tcp_pipe {
@@ -30,6 +31,7 @@ struct nni_plat_tcp_ep {
 	nni_win_event acc_ev;
 	int           started;
 	int           bound;
+	int           backlog;
 
 	SOCKADDR_STORAGE remaddr;
 	int              remlen;
@@ -225,6 +227,52 @@ nni_plat_tcp_pipe_close(nni_plat_tcp_pipe *pipe)
 	}
 }
 
+void
+nni_plat_tcp_pipe_setopts(nni_plat_tcp_pipe *pipe, const nni_plat_tcp_opts *o)
+{
+	SOCKET s = pipe->s;
+	BOOL   b;
+	int    val;
+
+	b = o->nodelay ? TRUE : FALSE;
+	(void) setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *) &b, sizeof(b));
+
+	if (o->keepalive &&
+	    ((o->keepidle > 0) || (o->keepintvl > 0))) {
+		// Windows sets both timings at once; there is no way to
+		// leave just one at the default, so we use the documented
+		// defaults (2 hours and 1 second) for the other.  The probe
+		// count cannot be changed on older versions, so we don't.
+		struct tcp_keepalive ka;
+		DWORD                nbytes;
+
+		ka.onoff = 1;
+		ka.keepalivetime =
+		    o->keepidle > 0 ? (ULONG) o->keepidle : 7200000;
+		ka.keepaliveinterval =
+		    o->keepintvl > 0 ? (ULONG) o->keepintvl : 1000;
+		(void) WSAIoctl(s, SIO_KEEPALIVE_VALS, &ka, sizeof(ka), NULL, 0,
+		    &nbytes, NULL, NULL);
+	} else {
+		b = o->keepalive ? TRUE : FALSE;
+		(void) setsockopt(
+		    s, SOL_SOCKET, SO_KEEPALIVE, (char *) &b, sizeof(b));
+	}
+
+	if (o->sndbuf > 0) {
+		val = (int) o->sndbuf;
+		(void) setsockopt(
+		    s, SOL_SOCKET, SO_SNDBUF, (char *) &val, sizeof(val));
+	}
+	if (o->rcvbuf > 0) {
+		val = (int) o->rcvbuf;
+		(void) setsockopt(
+		    s, SOL_SOCKET, SO_RCVBUF, (char *) &val, sizeof(val));
+	}
+
+	// TCP_QUICKACK has no Windows equivalent.
+}
+
 int
 nni_plat_tcp_pipe_peername(nni_plat_tcp_pipe *pipe, nni_sockaddr *sa)
 {
@@ -272,7 +320,8 @@ nni_plat_tcp_ep_init(nni_plat_tcp_ep **epp, const nni_sockaddr *lsa,
 	}
 	ZeroMemory(ep, sizeof(*ep));
 
-	ep->s = INVALID_SOCKET;
+	ep->s       = INVALID_SOCKET;
+	ep->backlog = SOMAXCONN;
 
 	if ((rsa != NULL) && (rsa->s_un.s_family != NNG_AF_UNSPEC)) {
 		ep->remlen = nni_win_nn2sockaddr(&ep->remaddr, rsa);
@@ -403,7 +452,7 @@ nni_win_tcp_listen(nni_plat_tcp_ep *ep, nni_sockaddr *bsa)
 		nni_win_sockaddr2nn(bsa, &bound);
 	}
 
-	if (listen(s, SOMAXCONN) != 0) {
+	if (listen(s, ep->backlog) != 0) {
 		rv = nni_win_error(GetLastError());
 		goto fail;
 	}
@@ -420,6 +469,19 @@ fail:
 	return (rv);
 }
 
+// Windows has no equivalent of SO_REUSEPORT load balancing (and we use
+// SO_EXCLUSIVEADDRUSE), so we always listen on a single socket.  Accepts
+// complete through the completion port, which is already multithreaded.
+void
+nni_plat_tcp_ep_set_listen(nni_plat_tcp_ep *ep, int backlog, int nshards)
+{
+	NNI_ARG_UNUSED(nshards);
+
+	nni_mtx_lock(&ep->acc_ev.mtx);
+	ep->backlog = backlog > 0 ? backlog : SOMAXCONN;
+	nni_mtx_unlock(&ep->acc_ev.mtx);
+}
+
 int
 nni_plat_tcp_ep_listen(nni_plat_tcp_ep *ep, nng_sockaddr *bsa)
 {
@@ -22,6 +22,12 @@ nni_alloc(size_t sz)
 	return (calloc(sz, 1));
 }
 
+void *
+nni_alloc_nz(size_t sz)
+{
+	return (malloc(sz));
+}
+
 void
 nni_free(void *b, size_t z)
 {
@@ -138,6 +144,82 @@ nni_plat_thr_fini(nni_plat_thr *thr)
 	}
 }
 
+int
+nni_plat_ncpu(void)
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	if (info.dwNumberOfProcessors < 1) {
+		return (1);
+	}
+	return ((int) info.dwNumberOfProcessors);
+}
+
+typedef struct {
+	void (*dtor)(void *);
+	void *val;
+} nni_win_tls_val;
+
+static VOID NTAPI
+nni_win_tls_dtor(PVOID arg)
+{
+	nni_win_tls_val *v = arg;
+
+	if (v != NULL) {
+		if ((v->val != NULL) && (v->dtor != NULL)) {
+			v->dtor(v->val);
+		}
+		free(v);
+	}
+}
+
+int
+nni_plat_tls_init(nni_plat_tls *tls, void (*dtor)(void *))
+{
+	if ((tls->idx = FlsAlloc(nni_win_tls_dtor)) == FLS_OUT_OF_INDEXES) {
+		return (NNG_ENOMEM);
+	}
+	tls->dtor = dtor;
+	return (0);
+}
+
+void
+nni_plat_tls_fini(nni_plat_tls *tls)
+{
+	(void) FlsFree(tls->idx);
+}
+
+void *
+nni_plat_tls_get(nni_plat_tls *tls)
+{
+	nni_win_tls_val *v;
+
+	if ((v = FlsGetValue(tls->idx)) == NULL) {
+		return (NULL);
+	}
+	return (v->val);
+}
+
+int
+nni_plat_tls_set(nni_plat_tls *tls, void *val)
+{
+	nni_win_tls_val *v;
+
+	if ((v = FlsGetValue(tls->idx)) == NULL) {
+		if ((v = malloc(sizeof(*v))) == NULL) {
+			return (NNG_ENOMEM);
+		}
+		if (!FlsSetValue(tls->idx, v)) {
+			free(v);
+			return (nni_win_error(GetLastError()));
+		}
+	}
+	v->dtor = tls->dtor;
+	v->val  = val;
+	return (0);
+}
+
 static LONG plat_inited = 0;
 
 int
@@ -27,6 +27,7 @@ struct nni_plat_udp {
 	SOCKADDR_STORAGE txsa;
 	int              rxsalen;
 	int              txsalen;
+	bool             connected;
 };
 
 static int  nni_win_udp_start_rx(nni_win_event *, nni_aio *);
@@ -227,8 +228,13 @@ nni_win_udp_start_tx(nni_win_event *evt, nni_aio *aio)
 
 	evt->count = 0;
 
-	rv = WSASendTo(u->s, iov, (DWORD) naiov, NULL, 0,
-	    (struct sockaddr *) &u->txsa, salen, &evt->olpd, NULL);
+	if (u->connected) {
+		rv = WSASendTo(u->s, iov, (DWORD) naiov, NULL, 0, NULL, 0,
+		    &evt->olpd, NULL);
+	} else {
+		rv = WSASendTo(u->s, iov, (DWORD) naiov, NULL, 0,
+		    (struct sockaddr *) &u->txsa, salen, &evt->olpd, NULL);
+	}
 
 	_freea(iov);
 
@@ -289,6 +295,22 @@ nni_win_udp_finish_tx(nni_win_event *evt, nni_aio *aio)
 	nni_aio_finish(aio, rv, cnt);
 }
 
+int
+nni_plat_udp_connect(nni_plat_udp *u, const nni_sockaddr *sa)
+{
+	SOCKADDR_STORAGE ss;
+	int              sslen;
+
+	if ((sslen = nni_win_nn2sockaddr(&ss, sa)) < 0) {
+		return (NNG_EADDRINVAL);
+	}
+	if (connect(u->s, (struct sockaddr *) &ss, sslen) == SOCKET_ERROR) {
+		return (nni_win_error(GetLastError()));
+	}
+	u->connected = true;
+	return (0);
+}
+
 int
 nni_plat_udp_sockname(nni_plat_udp *udp, nni_sockaddr *sa)
 {
@@ -30,12 +30,9 @@ static void bus0_sock_getq(bus0_sock *);
 static void bus0_sock_send(void *, nni_aio *);
 static void bus0_sock_recv(void *, nni_aio *);
 
-static void bus0_pipe_getq(bus0_pipe *);
 static void bus0_pipe_recv(bus0_pipe *);
 
 static void bus0_sock_getq_cb(void *);
-static void bus0_pipe_getq_cb(void *);
-static void bus0_pipe_send_cb(void *);
 static void bus0_pipe_recv_cb(void *);
 static void bus0_pipe_putq_cb(void *);
 
@@ -51,15 +48,14 @@ struct bus0_sock {
 
 // bus0_pipe is our per-pipe protocol private structure.
 struct bus0_pipe {
-	nni_pipe *    npipe;
-	bus0_sock *   psock;
-	nni_msgq *    sendq;
-	nni_list_node node;
-	nni_aio *     aio_getq;
-	nni_aio *     aio_recv;
-	nni_aio *     aio_send;
-	nni_aio *     aio_putq;
-	nni_mtx       mtx;
+	nni_pipe *       npipe;
+	bus0_sock *      psock;
+	nni_msgq *       sendq;
+	nni_list_node    node;
+	nni_pipe_sender *sender;
+	nni_aio *        aio_recv;
+	nni_aio *        aio_putq;
+	nni_mtx          mtx;
 };
 
 static void
@@ -117,8 +113,7 @@ bus0_pipe_fini(void *arg)
 {
 	bus0_pipe *p = arg;
 
-	nni_aio_fini(p->aio_getq);
-	nni_aio_fini(p->aio_send);
+	nni_pipe_sender_fini(p->sender);
 	nni_aio_fini(p->aio_recv);
 	nni_aio_fini(p->aio_putq);
 	nni_msgq_fini(p->sendq);
@@ -138,8 +133,7 @@ bus0_pipe_init(void **pp, nni_pipe *npipe, void *s)
 	NNI_LIST_NODE_INIT(&p->node);
 	nni_mtx_init(&p->mtx);
 	if (((rv = nni_msgq_init(&p->sendq, 16)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_getq, bus0_pipe_getq_cb, p)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_send, bus0_pipe_send_cb, p)) != 0) ||
+	    ((rv = nni_pipe_sender_init(&p->sender, npipe, NULL, NULL)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_recv, bus0_pipe_recv_cb, p)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_putq, bus0_pipe_putq_cb, p)) != 0)) {
 		bus0_pipe_fini(p);
@@ -163,7 +157,7 @@ bus0_pipe_start(void *arg)
 	nni_mtx_unlock(&s->mtx);
 
 	bus0_pipe_recv(p);
-	bus0_pipe_getq(p);
+	nni_pipe_sender_start(p->sender, p->sendq);
 
 	return (0);
 }
@@ -176,8 +170,7 @@ bus0_pipe_stop(void *arg)
 
 	nni_msgq_close(p->sendq);
 
-	nni_aio_stop(p->aio_getq);
-	nni_aio_stop(p->aio_send);
+	nni_pipe_sender_stop(p->sender);
 	nni_aio_stop(p->aio_recv);
 	nni_aio_stop(p->aio_putq);
 
@@ -188,38 +181,6 @@ bus0_pipe_stop(void *arg)
 	nni_mtx_unlock(&s->mtx);
 }
 
-static void
-bus0_pipe_getq_cb(void *arg)
-{
-	bus0_pipe *p = arg;
-
-	if (nni_aio_result(p->aio_getq) != 0) {
-		// closed?
-		nni_pipe_stop(p->npipe);
-		return;
-	}
-	nni_aio_set_msg(p->aio_send, nni_aio_get_msg(p->aio_getq));
-	nni_aio_set_msg(p->aio_getq, NULL);
-
-	nni_pipe_send(p->npipe, p->aio_send);
-}
-
-static void
-bus0_pipe_send_cb(void *arg)
-{
-	bus0_pipe *p = arg;
-
-	if (nni_aio_result(p->aio_send) != 0) {
-		// closed?
-		nni_msg_free(nni_aio_get_msg(p->aio_send));
-		nni_aio_set_msg(p->aio_send, NULL);
-		nni_pipe_stop(p->npipe);
-		return;
-	}
-
-	bus0_pipe_getq(p);
-}
-
 static void
 bus0_pipe_recv_cb(void *arg)
 {
@@ -232,6 +193,7 @@ bus0_pipe_recv_cb(void *arg)
 		return;
 	}
 	msg = nni_aio_get_msg(p->aio_recv);
+	nni_pipe_bump_rx(p->npipe, nni_msg_len(msg));
 
 	if (nni_msg_header_insert_u32(msg, nni_pipe_id(p->npipe)) != 0) {
 		// XXX: bump a nomemory stat
@@ -295,6 +257,8 @@ bus0_sock_getq_cb(void *arg)
 			continue;
 		}
 		if (p != lastp) {
+			// Duplicates share the body with the original, so this
+			// does not copy the payload.
 			if (nni_msg_dup(&dup, msg) != 0) {
 				continue;
 			}
@@ -302,6 +266,7 @@ bus0_sock_getq_cb(void *arg)
 			dup = msg;
 		}
 		if (nni_msgq_tryput(p->sendq, dup) != 0) {
+			nni_pipe_bump_drop(p->npipe);
 			nni_msg_free(dup);
 		}
 	}
@@ -320,12 +285,6 @@ bus0_sock_getq(bus0_sock *s)
 	nni_msgq_aio_get(s->uwq, s->aio_getq);
 }
 
-static void
-bus0_pipe_getq(bus0_pipe *p)
-{
-	nni_msgq_aio_get(p->sendq, p->aio_getq);
-}
-
 static void
 bus0_pipe_recv(bus0_pipe *p)
 {
@@ -393,7 +352,8 @@ static nni_proto bus0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_BUS_V0, "bus" },
 	.proto_peer     = { NNI_PROTO_BUS_V0, "bus" },
-	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
+	.proto_flags    = NNI_PROTO_FLAG_SNDRCV | NNI_PROTO_FLAG_SNDQ |
+	    NNI_PROTO_FLAG_RCVQ,
 	.proto_sock_ops = &bus0_sock_ops,
 	.proto_pipe_ops = &bus0_pipe_ops,
 };
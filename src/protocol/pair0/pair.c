@@ -25,9 +25,7 @@
 typedef struct pair0_pipe pair0_pipe;
 typedef struct pair0_sock pair0_sock;
 
-static void pair0_send_cb(void *);
 static void pair0_recv_cb(void *);
-static void pair0_getq_cb(void *);
 static void pair0_putq_cb(void *);
 static void pair0_pipe_fini(void *);
 
@@ -45,12 +43,11 @@ struct pair0_sock {
 // pipe.  The separate data structure is more like other protocols that do
 // manage multiple pipes.
 struct pair0_pipe {
-	nni_pipe *  npipe;
-	pair0_sock *psock;
-	nni_aio *   aio_send;
-	nni_aio *   aio_recv;
-	nni_aio *   aio_getq;
-	nni_aio *   aio_putq;
+	nni_pipe *       npipe;
+	pair0_sock *     psock;
+	nni_pipe_sender *sender;
+	nni_aio *        aio_recv;
+	nni_aio *        aio_putq;
 };
 
 static int
@@ -84,10 +81,9 @@ pair0_pipe_fini(void *arg)
 {
 	pair0_pipe *p = arg;
 
-	nni_aio_fini(p->aio_send);
+	nni_pipe_sender_fini(p->sender);
 	nni_aio_fini(p->aio_recv);
 	nni_aio_fini(p->aio_putq);
-	nni_aio_fini(p->aio_getq);
 	NNI_FREE_STRUCT(p);
 }
 
@@ -100,9 +96,9 @@ pair0_pipe_init(void **pp, nni_pipe *npipe, void *psock)
 	if ((p = NNI_ALLOC_STRUCT(p)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	if (((rv = nni_aio_init(&p->aio_send, pair0_send_cb, p)) != 0) ||
+	if (((rv = nni_pipe_sender_init(&p->sender, npipe, NULL, NULL)) !=
+	        0) ||
 	    ((rv = nni_aio_init(&p->aio_recv, pair0_recv_cb, p)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_getq, pair0_getq_cb, p)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_putq, pair0_putq_cb, p)) != 0)) {
 		pair0_pipe_fini(p);
 		return (rv);
@@ -130,7 +126,7 @@ pair0_pipe_start(void *arg)
 
 	// Schedule a getq on the upper, and a read from the pipe.
 	// Each of these also sets up another hold on the pipe itself.
-	nni_msgq_aio_get(s->uwq, p->aio_getq);
+	nni_pipe_sender_start(p->sender, s->uwq);
 	nni_pipe_recv(p->npipe, p->aio_recv);
 
 	return (0);
@@ -142,10 +138,9 @@ pair0_pipe_stop(void *arg)
 	pair0_pipe *p = arg;
 	pair0_sock *s = p->psock;
 
-	nni_aio_stop(p->aio_send);
+	nni_pipe_sender_stop(p->sender);
 	nni_aio_stop(p->aio_recv);
 	nni_aio_stop(p->aio_putq);
-	nni_aio_stop(p->aio_getq);
 
 	nni_mtx_lock(&s->mtx);
 	if (s->ppipe == p) {
@@ -171,6 +166,7 @@ pair0_recv_cb(void *arg)
 	nni_aio_set_msg(p->aio_recv, NULL);
 
 	nni_msg_set_pipe(msg, nni_pipe_id(p->npipe));
+	nni_pipe_bump_rx(p->npipe, nni_msg_len(msg));
 	nni_msgq_aio_put(s->urq, p->aio_putq);
 }
 
@@ -188,37 +184,6 @@ pair0_putq_cb(void *arg)
 	nni_pipe_recv(p->npipe, p->aio_recv);
 }
 
-static void
-pair0_getq_cb(void *arg)
-{
-	pair0_pipe *p = arg;
-
-	if (nni_aio_result(p->aio_getq) != 0) {
-		nni_pipe_stop(p->npipe);
-		return;
-	}
-
-	nni_aio_set_msg(p->aio_send, nni_aio_get_msg(p->aio_getq));
-	nni_aio_set_msg(p->aio_getq, NULL);
-	nni_pipe_send(p->npipe, p->aio_send);
-}
-
-static void
-pair0_send_cb(void *arg)
-{
-	pair0_pipe *p = arg;
-	pair0_sock *s = p->psock;
-
-	if (nni_aio_result(p->aio_send) != 0) {
-		nni_msg_free(nni_aio_get_msg(p->aio_send));
-		nni_aio_set_msg(p->aio_send, NULL);
-		nni_pipe_stop(p->npipe);
-		return;
-	}
-
-	nni_msgq_aio_get(s->uwq, p->aio_getq);
-}
-
 static void
 pair0_sock_open(void *arg)
 {
@@ -293,7 +258,8 @@ static nni_proto pair0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_PAIR_V0, "pair" },
 	.proto_peer     = { NNI_PROTO_PAIR_V0, "pair" },
-	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
+	.proto_flags    = NNI_PROTO_FLAG_SNDRCV | NNI_PROTO_FLAG_SNDQ |
+	    NNI_PROTO_FLAG_RCVQ,
 	.proto_sock_ops = &pair0_sock_ops,
 	.proto_pipe_ops = &pair0_pipe_ops,
 };
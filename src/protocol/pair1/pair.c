@@ -27,10 +27,9 @@ typedef struct pair1_pipe pair1_pipe;
 typedef struct pair1_sock pair1_sock;
 
 static void pair1_sock_getq_cb(void *);
-static void pair1_pipe_send_cb(void *);
 static void pair1_pipe_recv_cb(void *);
-static void pair1_pipe_getq_cb(void *);
 static void pair1_pipe_putq_cb(void *);
+static int  pair1_pipe_prep(void *, nni_msg *);
 static void pair1_pipe_fini(void *);
 
 // pair1_sock is our per-socket protocol private structure.
@@ -49,14 +48,13 @@ struct pair1_sock {
 
 // pair1_pipe is our per-pipe protocol private structure.
 struct pair1_pipe {
-	nni_pipe *    npipe;
-	pair1_sock *  psock;
-	nni_msgq *    sendq;
-	nni_aio *     aio_send;
-	nni_aio *     aio_recv;
-	nni_aio *     aio_getq;
-	nni_aio *     aio_putq;
-	nni_list_node node;
+	nni_pipe *       npipe;
+	pair1_sock *     psock;
+	nni_msgq *       sendq;
+	nni_pipe_sender *sender;
+	nni_aio *        aio_recv;
+	nni_aio *        aio_putq;
+	nni_list_node    node;
 };
 
 static void
@@ -108,10 +106,9 @@ static void
 pair1_pipe_fini(void *arg)
 {
 	pair1_pipe *p = arg;
-	nni_aio_fini(p->aio_send);
+	nni_pipe_sender_fini(p->sender);
 	nni_aio_fini(p->aio_recv);
 	nni_aio_fini(p->aio_putq);
-	nni_aio_fini(p->aio_getq);
 	nni_msgq_fini(p->sendq);
 	NNI_FREE_STRUCT(p);
 }
@@ -126,9 +123,9 @@ pair1_pipe_init(void **pp, nni_pipe *npipe, void *psock)
 		return (NNG_ENOMEM);
 	}
 	if (((rv = nni_msgq_init(&p->sendq, 2)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_send, pair1_pipe_send_cb, p)) != 0) ||
+	    ((rv = nni_pipe_sender_init(
+	          &p->sender, npipe, pair1_pipe_prep, p)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_recv, pair1_pipe_recv_cb, p)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_getq, pair1_pipe_getq_cb, p)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_putq, pair1_pipe_putq_cb, p)) != 0)) {
 		pair1_pipe_fini(p);
 		return (NNG_ENOMEM);
@@ -170,15 +167,11 @@ pair1_pipe_start(void *arg)
 	s->started = 1;
 	nni_mtx_unlock(&s->mtx);
 
-	// Schedule a getq.  In polyamorous mode we get on the per pipe
+	// Start sending.  In polyamorous mode we get on the per pipe
 	// sendq, as the socket distributes to us. In monogamous mode
 	// we bypass and get from the upper writeq directly (saving a
 	// set of context switches).
-	if (s->poly) {
-		nni_msgq_aio_get(p->sendq, p->aio_getq);
-	} else {
-		nni_msgq_aio_get(s->uwq, p->aio_getq);
-	}
+	nni_pipe_sender_start(p->sender, s->poly ? p->sendq : s->uwq);
 	// And the pipe read of course.
 	nni_pipe_recv(p->npipe, p->aio_recv);
 
@@ -197,10 +190,9 @@ pair1_pipe_stop(void *arg)
 	nni_mtx_unlock(&s->mtx);
 
 	nni_msgq_close(p->sendq);
-	nni_aio_stop(p->aio_send);
+	nni_pipe_sender_stop(p->sender);
 	nni_aio_stop(p->aio_recv);
 	nni_aio_stop(p->aio_putq);
-	nni_aio_stop(p->aio_getq);
 }
 
 static void
@@ -223,6 +215,7 @@ pair1_pipe_recv_cb(void *arg)
 
 	// Store the pipe ID.
 	nni_msg_set_pipe(msg, nni_pipe_id(p->npipe));
+	nni_pipe_bump_rx(p->npipe, nni_msg_len(msg));
 
 	// If the message is missing the hop count header, scrap it.
 	if (nni_msg_len(msg) < sizeof(uint32_t)) {
@@ -298,6 +291,7 @@ pair1_sock_getq_cb(void *arg)
 	// for messages sent to other pipes.  Note that there is some
 	// buffering in the sendq.
 	if (nni_msgq_tryput(p->sendq, msg) != 0) {
+		nni_pipe_bump_drop(p->npipe);
 		nni_msg_free(msg);
 	}
 
@@ -319,28 +313,20 @@ pair1_pipe_putq_cb(void *arg)
 	nni_pipe_recv(p->npipe, p->aio_recv);
 }
 
-static void
-pair1_pipe_getq_cb(void *arg)
+// pair1_pipe_prep gives each message our hop count before it is sent.
+static int
+pair1_pipe_prep(void *arg, nni_msg *msg)
 {
 	pair1_pipe *p = arg;
 	pair1_sock *s = p->psock;
-	nni_msg *   msg;
 	uint32_t    hops;
 
-	if (nni_aio_result(p->aio_getq) != 0) {
-		nni_pipe_stop(p->npipe);
-		return;
-	}
-
-	msg = nni_aio_get_msg(p->aio_getq);
-	nni_aio_set_msg(p->aio_getq, NULL);
-
 	// Raw mode messages have the header already formed, with
 	// a hop count.  Cooked mode messages have no
 	// header so we have to add one.
 	if (s->raw) {
 		if (nni_msg_header_len(msg) != sizeof(uint32_t)) {
-			goto badmsg;
+			return (NNG_EINVAL);
 		}
 		hops = nni_msg_header_trim_u32(msg);
 	} else {
@@ -353,35 +339,7 @@ pair1_pipe_getq_cb(void *arg)
 	hops++;
 
 	// Insert the hops header.
-	if (nni_msg_header_append_u32(msg, hops) != 0) {
-		goto badmsg;
-	}
-
-	nni_aio_set_msg(p->aio_send, msg);
-	nni_pipe_send(p->npipe, p->aio_send);
-	return;
-
-badmsg:
-	nni_msg_free(msg);
-	nni_msgq_aio_get(s->poly ? p->sendq : s->uwq, p->aio_getq);
-}
-
-static void
-pair1_pipe_send_cb(void *arg)
-{
-	pair1_pipe *p = arg;
-	pair1_sock *s = p->psock;
-
-	if (nni_aio_result(p->aio_send) != 0) {
-		nni_msg_free(nni_aio_get_msg(p->aio_send));
-		nni_aio_set_msg(p->aio_send, NULL);
-		nni_pipe_stop(p->npipe);
-		return;
-	}
-
-	// In polyamorous mode, we want to get from the sendq; in
-	// monogamous we get from upper writeq.
-	nni_msgq_aio_get(s->poly ? p->sendq : s->uwq, p->aio_getq);
+	return (nni_msg_header_append_u32(msg, hops));
 }
 
 static void
@@ -507,7 +465,8 @@ static nni_proto pair1_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_PAIR_V1, "pair1" },
 	.proto_peer     = { NNI_PROTO_PAIR_V1, "pair1" },
-	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
+	.proto_flags    = NNI_PROTO_FLAG_SNDRCV | NNI_PROTO_FLAG_SNDQ |
+	    NNI_PROTO_FLAG_RCVQ,
 	.proto_sock_ops = &pair1_sock_ops,
 	.proto_pipe_ops = &pair1_pipe_ops,
 };
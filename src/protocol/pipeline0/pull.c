@@ -135,6 +135,7 @@ pull0_recv_cb(void *arg)
 	// Got a message... start the put to send it up to the application.
 	msg = nni_aio_get_msg(aio);
 	nni_msg_set_pipe(msg, nni_pipe_id(p->pipe));
+	nni_pipe_bump_rx(p->pipe, nni_msg_len(msg));
 	nni_aio_set_msg(aio, NULL);
 	pull0_putq(p, msg);
 }
@@ -198,7 +199,9 @@ static void
 pull0_sock_send(void *arg, nni_aio *aio)
 {
 	NNI_ARG_UNUSED(arg);
-	nni_aio_finish_error(aio, NNG_ENOTSUP);
+	if (nni_aio_begin(aio) == 0) {
+		nni_aio_finish_error(aio, NNG_ENOTSUP);
+	}
 }
 
 static void
@@ -240,7 +243,7 @@ static nni_proto pull0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_PULL_V0, "pull" },
 	.proto_peer     = { NNI_PROTO_PUSH_V0, "push" },
-	.proto_flags    = NNI_PROTO_FLAG_RCV,
+	.proto_flags    = NNI_PROTO_FLAG_RCV | NNI_PROTO_FLAG_RCVQ,
 	.proto_pipe_ops = &pull0_pipe_ops,
 	.proto_sock_ops = &pull0_sock_ops,
 };
@@ -29,9 +29,7 @@
 typedef struct push0_pipe push0_pipe;
 typedef struct push0_sock push0_sock;
 
-static void push0_send_cb(void *);
 static void push0_recv_cb(void *);
-static void push0_getq_cb(void *);
 
 // push0_sock is our per-socket protocol private structure.
 struct push0_sock {
@@ -45,9 +43,8 @@ struct push0_pipe {
 	push0_sock *  push;
 	nni_list_node node;
 
-	nni_aio *aio_recv;
-	nni_aio *aio_send;
-	nni_aio *aio_getq;
+	nni_aio *        aio_recv;
+	nni_pipe_sender *sender;
 };
 
 static int
@@ -90,8 +87,7 @@ push0_pipe_fini(void *arg)
 	push0_pipe *p = arg;
 
 	nni_aio_fini(p->aio_recv);
-	nni_aio_fini(p->aio_send);
-	nni_aio_fini(p->aio_getq);
+	nni_pipe_sender_fini(p->sender);
 	NNI_FREE_STRUCT(p);
 }
 
@@ -105,8 +101,7 @@ push0_pipe_init(void **pp, nni_pipe *pipe, void *s)
 		return (NNG_ENOMEM);
 	}
 	if (((rv = nni_aio_init(&p->aio_recv, push0_recv_cb, p)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_send, push0_send_cb, p)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_getq, push0_getq_cb, p)) != 0)) {
+	    ((rv = nni_pipe_sender_init(&p->sender, pipe, NULL, NULL)) != 0)) {
 		push0_pipe_fini(p);
 		return (rv);
 	}
@@ -132,7 +127,7 @@ push0_pipe_start(void *arg)
 	nni_pipe_recv(p->pipe, p->aio_recv);
 
 	// Schedule a sender.
-	nni_msgq_aio_get(s->uwq, p->aio_getq);
+	nni_pipe_sender_start(p->sender, s->uwq);
 
 	return (0);
 }
@@ -143,8 +138,7 @@ push0_pipe_stop(void *arg)
 	push0_pipe *p = arg;
 
 	nni_aio_stop(p->aio_recv);
-	nni_aio_stop(p->aio_send);
-	nni_aio_stop(p->aio_getq);
+	nni_pipe_sender_stop(p->sender);
 }
 
 static void
@@ -163,40 +157,6 @@ push0_recv_cb(void *arg)
 	nni_pipe_recv(p->pipe, p->aio_recv);
 }
 
-static void
-push0_send_cb(void *arg)
-{
-	push0_pipe *p = arg;
-	push0_sock *s = p->push;
-
-	if (nni_aio_result(p->aio_send) != 0) {
-		nni_msg_free(nni_aio_get_msg(p->aio_send));
-		nni_aio_set_msg(p->aio_send, NULL);
-		nni_pipe_stop(p->pipe);
-		return;
-	}
-
-	nni_msgq_aio_get(s->uwq, p->aio_getq);
-}
-
-static void
-push0_getq_cb(void *arg)
-{
-	push0_pipe *p   = arg;
-	nni_aio *   aio = p->aio_getq;
-
-	if (nni_aio_result(aio) != 0) {
-		// If the socket is closing, nothing else we can do.
-		nni_pipe_stop(p->pipe);
-		return;
-	}
-
-	nni_aio_set_msg(p->aio_send, nni_aio_get_msg(aio));
-	nni_aio_set_msg(aio, NULL);
-
-	nni_pipe_send(p->pipe, p->aio_send);
-}
-
 static int
 push0_sock_setopt_raw(void *arg, const void *buf, size_t sz)
 {
@@ -223,7 +183,9 @@ static void
 push0_sock_recv(void *arg, nni_aio *aio)
 {
 	NNI_ARG_UNUSED(arg);
-	nni_aio_finish_error(aio, NNG_ENOTSUP);
+	if (nni_aio_begin(aio) == 0) {
+		nni_aio_finish_error(aio, NNG_ENOTSUP);
+	}
 }
 
 static nni_proto_pipe_ops push0_pipe_ops = {
@@ -257,7 +219,7 @@ static nni_proto push0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_PUSH_V0, "push" },
 	.proto_peer     = { NNI_PROTO_PULL_V0, "pull" },
-	.proto_flags    = NNI_PROTO_FLAG_SND,
+	.proto_flags    = NNI_PROTO_FLAG_SND | NNI_PROTO_FLAG_SNDQ,
 	.proto_pipe_ops = &push0_pipe_ops,
 	.proto_sock_ops = &push0_sock_ops,
 };
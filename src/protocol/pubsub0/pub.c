@@ -31,8 +31,6 @@ typedef struct pub0_pipe pub0_pipe;
 typedef struct pub0_sock pub0_sock;
 
 static void pub0_pipe_recv_cb(void *);
-static void pub0_pipe_send_cb(void *);
-static void pub0_pipe_getq_cb(void *);
 static void pub0_sock_getq_cb(void *);
 static void pub0_sock_fini(void *);
 static void pub0_pipe_fini(void *);
@@ -48,13 +46,12 @@ struct pub0_sock {
 
 // pub0_pipe is our per-pipe protocol private structure.
 struct pub0_pipe {
-	nni_pipe *    pipe;
-	pub0_sock *   pub;
-	nni_msgq *    sendq;
-	nni_aio *     aio_getq;
-	nni_aio *     aio_send;
-	nni_aio *     aio_recv;
-	nni_list_node node;
+	nni_pipe *       pipe;
+	pub0_sock *      pub;
+	nni_msgq *       sendq;
+	nni_pipe_sender *sender;
+	nni_aio *        aio_recv;
+	nni_list_node    node;
 };
 
 static void
@@ -112,8 +109,7 @@ static void
 pub0_pipe_fini(void *arg)
 {
 	pub0_pipe *p = arg;
-	nni_aio_fini(p->aio_getq);
-	nni_aio_fini(p->aio_send);
+	nni_pipe_sender_fini(p->sender);
 	nni_aio_fini(p->aio_recv);
 	nni_msgq_fini(p->sendq);
 	NNI_FREE_STRUCT(p);
@@ -131,8 +127,7 @@ pub0_pipe_init(void **pp, nni_pipe *pipe, void *s)
 
 	// XXX: consider making this depth tunable
 	if (((rv = nni_msgq_init(&p->sendq, 16)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_getq, pub0_pipe_getq_cb, p)) != 0) ||
-	    ((rv = nni_aio_init(&p->aio_send, pub0_pipe_send_cb, p)) != 0) ||
+	    ((rv = nni_pipe_sender_init(&p->sender, pipe, NULL, NULL)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_recv, pub0_pipe_recv_cb, p)) != 0)) {
 
 		pub0_pipe_fini(p);
@@ -160,7 +155,7 @@ pub0_pipe_start(void *arg)
 
 	// Start the receiver and the queue reader.
 	nni_pipe_recv(p->pipe, p->aio_recv);
-	nni_msgq_aio_get(p->sendq, p->aio_getq);
+	nni_pipe_sender_start(p->sender, p->sendq);
 
 	return (0);
 }
@@ -171,8 +166,7 @@ pub0_pipe_stop(void *arg)
 	pub0_pipe *p = arg;
 	pub0_sock *s = p->pub;
 
-	nni_aio_stop(p->aio_getq);
-	nni_aio_stop(p->aio_send);
+	nni_pipe_sender_stop(p->sender);
 	nni_aio_stop(p->aio_recv);
 
 	nni_msgq_close(p->sendq);
@@ -206,6 +200,8 @@ pub0_sock_getq_cb(void *arg)
 	last = nni_list_last(&s->pipes);
 	NNI_LIST_FOREACH (&s->pipes, p) {
 		if (p != last) {
+			// Duplicates share the body with the original, so this
+			// does not copy the payload.
 			rv = nni_msg_dup(&dup, msg);
 			if (rv != 0) {
 				continue;
@@ -214,6 +210,7 @@ pub0_sock_getq_cb(void *arg)
 			dup = msg;
 		}
 		if ((rv = nni_msgq_tryput(p->sendq, dup)) != 0) {
+			nni_pipe_bump_drop(p->pipe);
 			nni_msg_free(dup);
 		}
 	}
@@ -241,38 +238,6 @@ pub0_pipe_recv_cb(void *arg)
 	nni_pipe_recv(p->pipe, p->aio_recv);
 }
 
-static void
-pub0_pipe_getq_cb(void *arg)
-{
-	pub0_pipe *p = arg;
-
-	if (nni_aio_result(p->aio_getq) != 0) {
-		nni_pipe_stop(p->pipe);
-		return;
-	}
-
-	nni_aio_set_msg(p->aio_send, nni_aio_get_msg(p->aio_getq));
-	nni_aio_set_msg(p->aio_getq, NULL);
-
-	nni_pipe_send(p->pipe, p->aio_send);
-}
-
-static void
-pub0_pipe_send_cb(void *arg)
-{
-	pub0_pipe *p = arg;
-
-	if (nni_aio_result(p->aio_send) != 0) {
-		nni_msg_free(nni_aio_get_msg(p->aio_send));
-		nni_aio_set_msg(p->aio_send, NULL);
-		nni_pipe_stop(p->pipe);
-		return;
-	}
-
-	nni_aio_set_msg(p->aio_send, NULL);
-	nni_msgq_aio_get(p->sendq, p->aio_getq);
-}
-
 static int
 pub0_sock_setopt_raw(void *arg, const void *buf, size_t sz)
 {
@@ -291,7 +256,9 @@ static void
 pub0_sock_recv(void *arg, nni_aio *aio)
 {
 	NNI_ARG_UNUSED(arg);
-	nni_aio_finish_error(aio, NNG_ENOTSUP);
+	if (nni_aio_begin(aio) == 0) {
+		nni_aio_finish_error(aio, NNG_ENOTSUP);
+	}
 }
 
 static void
@@ -333,7 +300,7 @@ static nni_proto pub0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_PUB_V0, "pub" },
 	.proto_peer     = { NNI_PROTO_SUB_V0, "sub" },
-	.proto_flags    = NNI_PROTO_FLAG_SND,
+	.proto_flags    = NNI_PROTO_FLAG_SND | NNI_PROTO_FLAG_SNDQ,
 	.proto_sock_ops = &pub0_sock_ops,
 	.proto_pipe_ops = &pub0_pipe_ops,
 };
@@ -8,6 +8,7 @@
 // found online at https://opensource.org/licenses/MIT.
 //
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -26,23 +27,38 @@
 #define NNI_PROTO_PUB_V0 NNI_PROTO(2, 0)
 #endif
 
-typedef struct sub0_pipe  sub0_pipe;
-typedef struct sub0_sock  sub0_sock;
-typedef struct sub0_topic sub0_topic;
+typedef struct sub0_pipe sub0_pipe;
+typedef struct sub0_sock sub0_sock;
+typedef struct sub0_node sub0_node;
 
 static void sub0_recv_cb(void *);
 static void sub0_putq_cb(void *);
 static void sub0_pipe_fini(void *);
 
-struct sub0_topic {
-	nni_list_node node;
-	size_t        len;
-	void *        buf;
+// Subscriptions are kept in a radix tree (a trie where chains of nodes
+// with only a single child are collapsed).  Each node carries the bytes
+// on the edge leading to it from its parent; the root's edge is empty.
+// A node is a member if a subscription ends exactly there.  Children
+// are kept in an array sorted by the first byte of their edge, so no
+// two children share a first byte, and lookup is a binary search.  Those
+// first bytes are also kept in a parallel array (in the same allocation)
+// so that the search does not have to touch each child.
+struct sub0_node {
+	sub0_node * parent;
+	uint8_t *   prefix; // edge label
+	size_t      plen;
+	bool        member;
+	sub0_node **kids;
+	uint8_t *   keys; // first byte of each child's edge
+	size_t      nkids;
+	size_t      kidcap;
 };
 
+#define SUB0_KIDSZ(cap) ((cap) * (sizeof(sub0_node *) + sizeof(uint8_t)))
+
 // sub0_sock is our per-socket protocol private structure.
 struct sub0_sock {
-	nni_list  topics;
+	sub0_node topics; // root of tree
 	nni_msgq *urq;
 	int       raw;
 	nni_mtx   lk;
@@ -65,7 +81,6 @@ sub0_sock_init(void **sp, nni_sock *sock)
 		return (NNG_ENOMEM);
 	}
 	nni_mtx_init(&s->lk);
-	NNI_LIST_INIT(&s->topics, sub0_topic, node);
 	s->raw = 0;
 
 	s->urq = nni_sock_recvq(sock);
@@ -73,17 +88,14 @@ sub0_sock_init(void **sp, nni_sock *sock)
 	return (0);
 }
 
+static void sub0_node_fini(sub0_node *);
+
 static void
 sub0_sock_fini(void *arg)
 {
-	sub0_sock * s = arg;
-	sub0_topic *topic;
+	sub0_sock *s = arg;
 
-	while ((topic = nni_list_first(&s->topics)) != NULL) {
-		nni_list_remove(&s->topics, topic);
-		nni_free(topic->buf, topic->len);
-		NNI_FREE_STRUCT(topic);
-	}
+	sub0_node_fini(&s->topics);
 	nni_mtx_fini(&s->lk);
 	NNI_FREE_STRUCT(s);
 }
@@ -165,6 +177,7 @@ sub0_recv_cb(void *arg)
 	msg = nni_aio_get_msg(p->aio_recv);
 	nni_aio_set_msg(p->aio_recv, NULL);
 	nni_msg_set_pipe(msg, nni_pipe_id(p->pipe));
+	nni_pipe_bump_rx(p->pipe, nni_msg_len(msg));
 	nni_aio_set_msg(p->aio_putq, msg);
 	nni_msgq_aio_put(urq, p->aio_putq);
 }
@@ -184,95 +197,283 @@ sub0_putq_cb(void *arg)
 	nni_pipe_recv(p->pipe, p->aio_recv);
 }
 
-// For now we maintain subscriptions on a sorted linked list.  As we do not
-// expect to have huge numbers of subscriptions, and as the operation is
-// really O(n), we think this is acceptable.  In the future we might decide
-// to replace this with a patricia trie, like old nanomsg had.
+// Subscription tree management.  Matching a message against the tree
+// costs time proportional to the length of the topic, independent of the
+// number of subscriptions.  Subscribing and unsubscribing are similarly
+// cheap, apart from the occasional growth of a child array.
 
-static int
-sub0_subscribe(void *arg, const void *buf, size_t sz)
+// sub0_node_alloc allocates a new node, with a copy of the (non-empty)
+// edge label.
+static sub0_node *
+sub0_node_alloc(const uint8_t *prefix, size_t plen)
 {
-	sub0_sock * s = arg;
-	sub0_topic *topic;
-	sub0_topic *newtopic;
+	sub0_node *n;
 
-	nni_mtx_lock(&s->lk);
-	NNI_LIST_FOREACH (&s->topics, topic) {
-		int rv;
+	if ((n = NNI_ALLOC_STRUCT(n)) == NULL) {
+		return (NULL);
+	}
+	if ((n->prefix = nni_alloc(plen)) == NULL) {
+		NNI_FREE_STRUCT(n);
+		return (NULL);
+	}
+	memcpy(n->prefix, prefix, plen);
+	n->plen = plen;
+	return (n);
+}
 
-		if (topic->len >= sz) {
-			rv = memcmp(topic->buf, buf, sz);
-		} else {
-			rv = memcmp(topic->buf, buf, topic->len);
+// sub0_node_fini releases everything below the node, and the node's own
+// edge label, but not the node itself (the root is embedded in the socket).
+static void
+sub0_node_fini(sub0_node *n)
+{
+	for (size_t i = 0; i < n->nkids; i++) {
+		sub0_node_fini(n->kids[i]);
+		NNI_FREE_STRUCT(n->kids[i]);
+	}
+	if (n->kidcap > 0) {
+		nni_free(n->kids, SUB0_KIDSZ(n->kidcap));
+	}
+	if (n->plen > 0) {
+		nni_free(n->prefix, n->plen);
+	}
+	n->kids   = NULL;
+	n->keys   = NULL;
+	n->nkids  = 0;
+	n->kidcap = 0;
+	n->prefix = NULL;
+	n->plen   = 0;
+}
+
+// sub0_node_find looks for the child whose edge starts with the given
+// byte.  If there is none, the index where it would be inserted is
+// returned through idxp.
+static sub0_node *
+sub0_node_find(sub0_node *n, uint8_t b, size_t *idxp)
+{
+	size_t lo = 0;
+	size_t hi = n->nkids;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (n->keys[mid] == b) {
+			*idxp = mid;
+			return (n->kids[mid]);
 		}
-		if (rv == 0) {
-			if (topic->len == sz) {
-				// Already inserted.
-				nni_mtx_unlock(&s->lk);
-				return (0);
-			}
-			if (topic->len > sz) {
-				break;
-			}
-		} else if (rv > 0) {
-			break;
+		if (n->keys[mid] < b) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
+	*idxp = lo;
+	return (NULL);
+}
 
-	if ((newtopic = NNI_ALLOC_STRUCT(newtopic)) == NULL) {
-		nni_mtx_unlock(&s->lk);
+static int
+sub0_node_grow(sub0_node *n, size_t cap)
+{
+	sub0_node **kids;
+	uint8_t *   keys;
+
+	if ((kids = nni_alloc(SUB0_KIDSZ(cap))) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	if ((newtopic->buf = nni_alloc(sz)) == NULL) {
-		nni_mtx_unlock(&s->lk);
-		return (NNG_ENOMEM);
+	keys = (uint8_t *) (kids + cap);
+	if (n->kidcap > 0) {
+		memcpy(kids, n->kids, n->nkids * sizeof(sub0_node *));
+		memcpy(keys, n->keys, n->nkids);
+		nni_free(n->kids, SUB0_KIDSZ(n->kidcap));
 	}
-	NNI_LIST_NODE_INIT(&newtopic->node);
-	newtopic->len = sz;
-	memcpy(newtopic->buf, buf, sz);
-	if (topic != NULL) {
-		nni_list_insert_before(&s->topics, newtopic, topic);
-	} else {
-		nni_list_append(&s->topics, newtopic);
+	n->kids   = kids;
+	n->keys   = keys;
+	n->kidcap = cap;
+	return (0);
+}
+
+static int
+sub0_node_add(sub0_node *n, sub0_node *k, size_t idx)
+{
+	int rv;
+
+	// There can never be more than 256 children.
+	if ((n->nkids == n->kidcap) &&
+	    ((rv = sub0_node_grow(n, n->kidcap ? n->kidcap * 2 : 2)) != 0)) {
+		return (rv);
 	}
-	nni_mtx_unlock(&s->lk);
+	memmove(&n->kids[idx + 1], &n->kids[idx],
+	    (n->nkids - idx) * sizeof(sub0_node *));
+	memmove(&n->keys[idx + 1], &n->keys[idx], n->nkids - idx);
+	n->kids[idx] = k;
+	n->keys[idx] = k->prefix[0];
+	n->nkids++;
+	k->parent = n;
 	return (0);
 }
 
+static void
+sub0_node_del(sub0_node *n, size_t idx)
+{
+	n->nkids--;
+	memmove(&n->kids[idx], &n->kids[idx + 1],
+	    (n->nkids - idx) * sizeof(sub0_node *));
+	memmove(&n->keys[idx], &n->keys[idx + 1], n->nkids - idx);
+}
+
+// sub0_node_split splits the edge leading to node k (the child of n at
+// index idx) after the first len bytes, by inserting a new node there.
+// The new node is returned.
+static sub0_node *
+sub0_node_split(sub0_node *n, size_t idx, size_t len)
+{
+	sub0_node *k = n->kids[idx];
+	sub0_node *mid;
+	uint8_t *  rest;
+	size_t     rlen = k->plen - len;
+
+	if ((mid = sub0_node_alloc(k->prefix, len)) == NULL) {
+		return (NULL);
+	}
+	if (sub0_node_grow(mid, 2) != 0) {
+		sub0_node_fini(mid);
+		NNI_FREE_STRUCT(mid);
+		return (NULL);
+	}
+	if ((rest = nni_alloc(rlen)) == NULL) {
+		sub0_node_fini(mid);
+		NNI_FREE_STRUCT(mid);
+		return (NULL);
+	}
+	memcpy(rest, k->prefix + len, rlen);
+	nni_free(k->prefix, k->plen);
+	k->prefix = rest;
+	k->plen   = rlen;
+
+	mid->kids[0] = k;
+	mid->keys[0] = rest[0];
+	mid->nkids   = 1;
+	mid->parent  = n;
+	k->parent    = mid;
+	n->kids[idx] = mid;
+	return (mid);
+}
+
 static int
-sub0_unsubscribe(void *arg, const void *buf, size_t sz)
+sub0_subscribe(void *arg, const void *buf, size_t sz)
 {
-	sub0_sock * s = arg;
-	sub0_topic *topic;
-	int         rv;
+	sub0_sock *    s     = arg;
+	const uint8_t *topic = buf;
+	sub0_node *    n;
+	int            rv = 0;
 
 	nni_mtx_lock(&s->lk);
-	NNI_LIST_FOREACH (&s->topics, topic) {
-		if (topic->len >= sz) {
-			rv = memcmp(topic->buf, buf, sz);
-		} else {
-			rv = memcmp(topic->buf, buf, topic->len);
+	n = &s->topics;
+	for (;;) {
+		sub0_node *k;
+		size_t     idx;
+		size_t     i;
+
+		if (sz == 0) {
+			// Subscribing twice is harmless.
+			n->member = true;
+			break;
 		}
-		if (rv == 0) {
-			if (topic->len == sz) {
-				nni_list_remove(&s->topics, topic);
-				nni_mtx_unlock(&s->lk);
-				nni_free(topic->buf, topic->len);
-				NNI_FREE_STRUCT(topic);
-				return (0);
+		if ((k = sub0_node_find(n, topic[0], &idx)) == NULL) {
+			// Nothing shares this byte; just hang a new leaf.
+			if ((k = sub0_node_alloc(topic, sz)) == NULL) {
+				rv = NNG_ENOMEM;
+				break;
 			}
-			if (topic->len > sz) {
-				nni_mtx_unlock(&s->lk);
-				return (NNG_ENOENT);
+			if ((rv = sub0_node_add(n, k, idx)) != 0) {
+				sub0_node_fini(k);
+				NNI_FREE_STRUCT(k);
+				break;
 			}
+			k->member = true;
+			break;
 		}
-		if (rv > 0) {
+		for (i = 1; (i < k->plen) && (i < sz); i++) {
+			if (k->prefix[i] != topic[i]) {
+				break;
+			}
+		}
+		if ((i < k->plen) && ((k = sub0_node_split(n, idx, i)) == NULL)) {
+			rv = NNG_ENOMEM;
+			break;
+		}
+		n = k;
+		topic += i;
+		sz -= i;
+	}
+	nni_mtx_unlock(&s->lk);
+	return (rv);
+}
+
+static int
+sub0_unsubscribe(void *arg, const void *buf, size_t sz)
+{
+	sub0_sock *    s     = arg;
+	const uint8_t *topic = buf;
+	sub0_node *    n;
+	sub0_node *    k;
+	size_t         idx;
+
+	nni_mtx_lock(&s->lk);
+	n = &s->topics;
+	while (sz > 0) {
+		if (((k = sub0_node_find(n, topic[0], &idx)) == NULL) ||
+		    (k->plen > sz) || (memcmp(k->prefix, topic, k->plen) != 0)) {
 			nni_mtx_unlock(&s->lk);
 			return (NNG_ENOENT);
 		}
+		n = k;
+		topic += k->plen;
+		sz -= k->plen;
+	}
+	if (!n->member) {
+		nni_mtx_unlock(&s->lk);
+		return (NNG_ENOENT);
+	}
+	n->member = false;
+
+	// Prune any leaves that no longer lead to a subscription.
+	while ((n != &s->topics) && (!n->member) && (n->nkids == 0)) {
+		sub0_node *p = n->parent;
+
+		(void) sub0_node_find(p, n->prefix[0], &idx);
+		sub0_node_del(p, idx);
+		sub0_node_fini(n);
+		NNI_FREE_STRUCT(n);
+		n = p;
+	}
+
+	// And if that leaves a node with only a single child, merge the
+	// two to keep the tree compact.  If we can't get the memory for
+	// that, the tree is still correct, just a little less tidy.
+	if ((n != &s->topics) && (!n->member) && (n->nkids == 1)) {
+		sub0_node *p = n->parent;
+		uint8_t *  pfx;
+		size_t     plen;
+
+		k    = n->kids[0];
+		plen = n->plen + k->plen;
+		if ((pfx = nni_alloc(plen)) != NULL) {
+			memcpy(pfx, n->prefix, n->plen);
+			memcpy(pfx + n->plen, k->prefix, k->plen);
+			nni_free(k->prefix, k->plen);
+			k->prefix = pfx;
+			k->plen   = plen;
+
+			(void) sub0_node_find(p, pfx[0], &idx);
+			p->kids[idx] = k;
+			k->parent    = p;
+			n->nkids     = 0;
+			sub0_node_fini(n);
+			NNI_FREE_STRUCT(n);
+		}
 	}
 	nni_mtx_unlock(&s->lk);
-	return (NNG_ENOENT);
+	return (0);
 }
 
 static int
@@ -293,7 +494,9 @@ static void
 sub0_sock_send(void *arg, nni_aio *aio)
 {
 	NNI_ARG_UNUSED(arg);
-	nni_aio_finish_error(aio, NNG_ENOTSUP);
+	if (nni_aio_begin(aio) == 0) {
+		nni_aio_finish_error(aio, NNG_ENOTSUP);
+	}
 }
 
 static void
@@ -307,11 +510,11 @@ sub0_sock_recv(void *arg, nni_aio *aio)
 static nni_msg *
 sub0_sock_filter(void *arg, nni_msg *msg)
 {
-	sub0_sock * s = arg;
-	sub0_topic *topic;
-	char *      body;
-	size_t      len;
-	int         match;
+	sub0_sock *    s = arg;
+	sub0_node *    n;
+	const uint8_t *body;
+	size_t         len;
+	bool           match;
 
 	nni_mtx_lock(&s->lk);
 	if (s->raw) {
@@ -322,24 +525,21 @@ sub0_sock_filter(void *arg, nni_msg *msg)
 	body = nni_msg_body(msg);
 	len  = nni_msg_len(msg);
 
-	match = 0;
-	// Check to see if the message matches one of our subscriptions.
-	NNI_LIST_FOREACH (&s->topics, topic) {
-		if (len >= topic->len) {
-			int rv = memcmp(topic->buf, body, topic->len);
-			if (rv == 0) {
-				// Matched!
-				match = 1;
-				break;
-			}
-			if (rv > 0) {
-				match = 0;
-				break;
-			}
-		} else if (memcmp(topic->buf, body, len) >= 0) {
-			match = 0;
+	// Walk down the tree as far as the message takes us.  Any
+	// subscription along the way is a prefix of the message, and
+	// hence a match.
+	n     = &s->topics;
+	match = n->member;
+	while ((!match) && (len > 0)) {
+		size_t idx;
+
+		if (((n = sub0_node_find(n, body[0], &idx)) == NULL) ||
+		    (n->plen > len) || (memcmp(n->prefix, body, n->plen) != 0)) {
 			break;
 		}
+		body += n->plen;
+		len -= n->plen;
+		match = n->member;
 	}
 	nni_mtx_unlock(&s->lk);
 	if (!match) {
@@ -393,7 +593,7 @@ static nni_proto sub0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_SUB_V0, "sub" },
 	.proto_peer     = { NNI_PROTO_PUB_V0, "pub" },
-	.proto_flags    = NNI_PROTO_FLAG_RCV,
+	.proto_flags    = NNI_PROTO_FLAG_RCV | NNI_PROTO_FLAG_RCVQ,
 	.proto_sock_ops = &sub0_sock_ops,
 	.proto_pipe_ops = &sub0_pipe_ops,
 };
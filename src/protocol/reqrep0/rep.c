@@ -28,6 +28,7 @@
 
 typedef struct rep0_pipe rep0_pipe;
 typedef struct rep0_sock rep0_sock;
+typedef struct rep0_ctx  rep0_ctx;
 
 static void rep0_sock_getq_cb(void *);
 static void rep0_pipe_getq_cb(void *);
@@ -36,6 +37,17 @@ static void rep0_pipe_send_cb(void *);
 static void rep0_pipe_recv_cb(void *);
 static void rep0_pipe_fini(void *);
 
+// rep0_ctx holds the backtrace of the request being answered.  The
+// socket has one built in, for ordinary sends and receives on the socket,
+// and applications can open more to answer many requests at once.
+struct rep0_ctx {
+	rep0_sock *   sock;
+	nni_list_node rqnode; // on the socket's list of waiting receivers
+	char *        btrace;
+	size_t        btrace_len;
+	nni_aio *     raio; // receive waiting for a request
+};
+
 // rep0_sock is our per-socket protocol private structure.
 struct rep0_sock {
 	nni_msgq *  uwq;
@@ -44,22 +56,66 @@ struct rep0_sock {
 	int         raw;
 	int         ttl;
 	nni_idhash *pipes;
-	char *      btrace;
-	size_t      btrace_len;
+	rep0_ctx    ctx; // built in context, used by the socket itself
+	int         nctxs;
+	nni_list    recvq;     // contexts waiting for requests
+	nni_list    recvpipes; // pipes holding requests for contexts
 	nni_aio *   aio_getq;
 };
 
 // rep0_pipe is our per-pipe protocol private structure.
 struct rep0_pipe {
-	nni_pipe * pipe;
-	rep0_sock *rep;
-	nni_msgq * sendq;
-	nni_aio *  aio_getq;
-	nni_aio *  aio_send;
-	nni_aio *  aio_recv;
-	nni_aio *  aio_putq;
+	nni_pipe *    pipe;
+	rep0_sock *   rep;
+	nni_msgq *    sendq;
+	nni_list_node rnode; // on the socket's recvpipes list
+	nni_msg *     rmsg;  // request waiting for a context
+	nni_aio *     aio_getq;
+	nni_aio *     aio_send;
+	nni_aio *     aio_recv;
+	nni_aio *     aio_putq;
 };
 
+static void
+rep0_ctx_setup(rep0_ctx *ctx, rep0_sock *s)
+{
+	NNI_LIST_NODE_INIT(&ctx->rqnode);
+	ctx->sock       = s;
+	ctx->btrace     = NULL;
+	ctx->btrace_len = 0;
+	ctx->raio       = NULL;
+}
+
+static void
+rep0_ctx_clear(rep0_ctx *ctx)
+{
+	if (ctx->btrace != NULL) {
+		nni_free(ctx->btrace, ctx->btrace_len);
+		ctx->btrace     = NULL;
+		ctx->btrace_len = 0;
+	}
+}
+
+// rep0_ctx_save_btrace moves the backtrace from the request's header to
+// the context, for use by the reply.  This must be called with the socket
+// lock held.
+static int
+rep0_ctx_save_btrace(rep0_ctx *ctx, nni_msg *msg)
+{
+	size_t len = nni_msg_header_len(msg);
+	char * btrace;
+
+	if ((btrace = nni_alloc(len)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	memcpy(btrace, nni_msg_header(msg), len);
+	rep0_ctx_clear(ctx);
+	ctx->btrace     = btrace;
+	ctx->btrace_len = len;
+	nni_msg_header_clear(msg);
+	return (0);
+}
+
 static void
 rep0_sock_fini(void *arg)
 {
@@ -68,9 +124,7 @@ rep0_sock_fini(void *arg)
 	nni_aio_stop(s->aio_getq);
 	nni_aio_fini(s->aio_getq);
 	nni_idhash_fini(s->pipes);
-	if (s->btrace != NULL) {
-		nni_free(s->btrace, s->btrace_len);
-	}
+	rep0_ctx_clear(&s->ctx);
 	nni_mtx_fini(&s->lk);
 	NNI_FREE_STRUCT(s);
 }
@@ -91,12 +145,15 @@ rep0_sock_init(void **sp, nni_sock *sock)
 		return (rv);
 	}
 
-	s->ttl        = 8; // Per RFC
-	s->raw        = 0;
-	s->btrace     = NULL;
-	s->btrace_len = 0;
-	s->uwq        = nni_sock_sendq(sock);
-	s->urq        = nni_sock_recvq(sock);
+	NNI_LIST_INIT(&s->recvq, rep0_ctx, rqnode);
+	NNI_LIST_INIT(&s->recvpipes, rep0_pipe, rnode);
+	rep0_ctx_setup(&s->ctx, s);
+
+	s->ttl   = 8; // Per RFC
+	s->raw   = 0;
+	s->nctxs = 0;
+	s->uwq   = nni_sock_sendq(sock);
+	s->urq   = nni_sock_recvq(sock);
 
 	*sp = s;
 
@@ -150,6 +207,8 @@ rep0_pipe_init(void **pp, nni_pipe *pipe, void *s)
 		return (rv);
 	}
 
+	NNI_LIST_NODE_INIT(&p->rnode);
+	p->rmsg = NULL;
 	p->pipe = pipe;
 	p->rep  = s;
 	*pp     = p;
@@ -163,7 +222,10 @@ rep0_pipe_start(void *arg)
 	rep0_sock *s = p->rep;
 	int        rv;
 
-	if ((rv = nni_idhash_insert(s->pipes, nni_pipe_id(p->pipe), p)) != 0) {
+	nni_mtx_lock(&s->lk);
+	rv = nni_idhash_insert(s->pipes, nni_pipe_id(p->pipe), p);
+	nni_mtx_unlock(&s->lk);
+	if (rv != 0) {
 		return (rv);
 	}
 
@@ -184,7 +246,16 @@ rep0_pipe_stop(void *arg)
 	nni_aio_stop(p->aio_recv);
 	nni_aio_stop(p->aio_putq);
 
+	nni_mtx_lock(&s->lk);
+	if (nni_list_node_active(&p->rnode)) {
+		nni_list_node_remove(&p->rnode);
+	}
+	if (p->rmsg != NULL) {
+		nni_msg_free(p->rmsg);
+		p->rmsg = NULL;
+	}
 	nni_idhash_remove(s->pipes, nni_pipe_id(p->pipe));
+	nni_mtx_unlock(&s->lk);
 }
 
 static void
@@ -223,11 +294,14 @@ rep0_sock_getq_cb(void *arg)
 
 	// Look for the pipe, and attempt to put the message there
 	// (nonblocking) if we can.  If we can't for any reason, then we
-	// free the message.
-	// XXX: LOCKING?!?!
+	// free the message.  (Only raw mode sends come this way.)
+	nni_mtx_lock(&s->lk);
 	if ((rv = nni_idhash_find(s->pipes, id, (void **) &p)) == 0) {
-		rv = nni_msgq_tryput(p->sendq, msg);
+		if ((rv = nni_msgq_tryput(p->sendq, msg)) != 0) {
+			nni_pipe_bump_drop(p->pipe);
+		}
 	}
+	nni_mtx_unlock(&s->lk);
 	if (rv != 0) {
 		nni_msg_free(msg);
 	}
@@ -272,6 +346,8 @@ rep0_pipe_recv_cb(void *arg)
 {
 	rep0_pipe *p = arg;
 	rep0_sock *s = p->rep;
+	rep0_ctx * ctx;
+	nni_aio *  aio;
 	nni_msg *  msg;
 	int        rv;
 	uint8_t *  body;
@@ -286,6 +362,7 @@ rep0_pipe_recv_cb(void *arg)
 	nni_aio_set_msg(p->aio_recv, NULL);
 
 	nni_msg_set_pipe(msg, nni_pipe_id(p->pipe));
+	nni_pipe_bump_rx(p->pipe, nni_msg_len(msg));
 
 	// Store the pipe id in the header, first thing.
 	rv = nni_msg_header_append_u32(msg, nni_pipe_id(p->pipe));
@@ -327,6 +404,31 @@ rep0_pipe_recv_cb(void *arg)
 		}
 	}
 
+	// Once contexts are in use, requests go to them rather than to the
+	// socket.  If none is waiting, we stop reading from the pipe until
+	// one is.
+	nni_mtx_lock(&s->lk);
+	if ((!s->raw) && (s->nctxs > 0)) {
+		if ((ctx = nni_list_first(&s->recvq)) == NULL) {
+			p->rmsg = msg;
+			nni_list_append(&s->recvpipes, p);
+			nni_mtx_unlock(&s->lk);
+			return;
+		}
+		if (rep0_ctx_save_btrace(ctx, msg) != 0) {
+			nni_mtx_unlock(&s->lk);
+			goto drop;
+		}
+		nni_list_remove(&s->recvq, ctx);
+		aio       = ctx->raio;
+		ctx->raio = NULL;
+		nni_mtx_unlock(&s->lk);
+		nni_aio_finish_msg(aio, msg);
+		nni_pipe_recv(p->pipe, p->aio_recv);
+		return;
+	}
+	nni_mtx_unlock(&s->lk);
+
 	// Go ahead and send it up.
 	nni_aio_set_msg(p->aio_putq, msg);
 	nni_msgq_aio_put(s->urq, p->aio_putq);
@@ -389,48 +491,88 @@ static nni_msg *
 rep0_sock_filter(void *arg, nni_msg *msg)
 {
 	rep0_sock *s = arg;
-	char *     header;
-	size_t     len;
 
 	nni_mtx_lock(&s->lk);
 	if (s->raw) {
 		nni_mtx_unlock(&s->lk);
 		return (msg);
 	}
-
-	len    = nni_msg_header_len(msg);
-	header = nni_msg_header(msg);
-	if (s->btrace != NULL) {
-		nni_free(s->btrace, s->btrace_len);
-		s->btrace     = NULL;
-		s->btrace_len = 0;
-	}
-	if ((s->btrace = nni_alloc(len)) == NULL) {
+	if (rep0_ctx_save_btrace(&s->ctx, msg) != 0) {
+		nni_mtx_unlock(&s->lk);
 		nni_msg_free(msg);
 		return (NULL);
 	}
-	s->btrace_len = len;
-	memcpy(s->btrace, header, len);
-	nni_msg_header_clear(msg);
 	nni_mtx_unlock(&s->lk);
 	return (msg);
 }
 
-static void
-rep0_sock_send(void *arg, nni_aio *aio)
+static int
+rep0_ctx_init(void **cpp, void *arg)
 {
 	rep0_sock *s = arg;
-	int        rv;
-	nni_msg *  msg;
+	rep0_ctx * ctx;
 
+	if ((ctx = NNI_ALLOC_STRUCT(ctx)) == NULL) {
+		return (NNG_ENOMEM);
+	}
 	nni_mtx_lock(&s->lk);
 	if (s->raw) {
-		// Pass thru
+		// Raw mode has no notion of a request being answered.
 		nni_mtx_unlock(&s->lk);
-		nni_msgq_aio_put(s->uwq, aio);
+		NNI_FREE_STRUCT(ctx);
+		return (NNG_ENOTSUP);
+	}
+	rep0_ctx_setup(ctx, s);
+	s->nctxs++;
+	nni_mtx_unlock(&s->lk);
+	*cpp = ctx;
+	return (0);
+}
+
+static void
+rep0_ctx_fini(void *arg)
+{
+	rep0_ctx * ctx = arg;
+	rep0_sock *s   = ctx->sock;
+	rep0_pipe *p;
+	nni_aio *  aio;
+
+	nni_mtx_lock(&s->lk);
+	if ((aio = ctx->raio) != NULL) {
+		nni_list_remove(&s->recvq, ctx);
+		ctx->raio = NULL;
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+	}
+	rep0_ctx_clear(ctx);
+	if (--s->nctxs == 0) {
+		// With no contexts left, requests held for them go to
+		// the socket instead.
+		while ((p = nni_list_first(&s->recvpipes)) != NULL) {
+			nni_list_remove(&s->recvpipes, p);
+			nni_aio_set_msg(p->aio_putq, p->rmsg);
+			p->rmsg = NULL;
+			nni_msgq_aio_put(s->urq, p->aio_putq);
+		}
+	}
+	nni_mtx_unlock(&s->lk);
+	NNI_FREE_STRUCT(ctx);
+}
+
+static void
+rep0_ctx_send(void *arg, nni_aio *aio)
+{
+	rep0_ctx * ctx = arg;
+	rep0_sock *s   = ctx->sock;
+	rep0_pipe *p;
+	uint32_t   id;
+	int        rv;
+	nni_msg *  msg;
+
+	if (nni_aio_begin(aio) != 0) {
 		return;
 	}
-	if (s->btrace == NULL) {
+	nni_mtx_lock(&s->lk);
+	if (ctx->btrace == NULL) {
 		nni_mtx_unlock(&s->lk);
 		nni_aio_finish_error(aio, NNG_ESTATE);
 		return;
@@ -442,18 +584,104 @@ rep0_sock_send(void *arg, nni_aio *aio)
 	// empty, but there can be stale backtrace info there.)
 	nni_msg_header_clear(msg);
 
-	if ((rv = nni_msg_header_append(msg, s->btrace, s->btrace_len)) != 0) {
+	if ((rv = nni_msg_header_append(msg, ctx->btrace, ctx->btrace_len)) !=
+	    0) {
 		nni_mtx_unlock(&s->lk);
 		nni_aio_finish_error(aio, rv);
 		return;
 	}
+	rep0_ctx_clear(ctx);
+
+	// The reply goes straight to the pipe the request arrived on, and
+	// waits there if that pipe is busy.  (Going by way of the socket's
+	// queue would mean dropping replies to busy pipes, so that one slow
+	// peer cannot hold up replies to the others.)  If the pipe has gone
+	// away, there is nobody to reply to, so the reply is discarded.
+	id = nni_msg_header_trim_u32(msg);
+	if (nni_idhash_find(s->pipes, id, (void **) &p) != 0) {
+		nni_mtx_unlock(&s->lk);
+		if (nni_aio_begin(aio) == 0) {
+			nni_aio_set_msg(aio, NULL);
+			nni_aio_finish(aio, 0, nni_msg_len(msg));
+			nni_msg_free(msg);
+		}
+		return;
+	}
+	nni_msgq_aio_put(p->sendq, aio);
+	nni_mtx_unlock(&s->lk);
+}
 
-	nni_free(s->btrace, s->btrace_len);
-	s->btrace     = NULL;
-	s->btrace_len = 0;
+static void
+rep0_ctx_cancel_recv(nni_aio *aio, int rv)
+{
+	rep0_ctx * ctx = nni_aio_get_prov_data(aio);
+	rep0_sock *s   = ctx->sock;
 
+	nni_mtx_lock(&s->lk);
+	if (ctx->raio == aio) {
+		nni_list_remove(&s->recvq, ctx);
+		ctx->raio = NULL;
+		nni_aio_finish_error(aio, rv);
+	}
 	nni_mtx_unlock(&s->lk);
-	nni_msgq_aio_put(s->uwq, aio);
+}
+
+static void
+rep0_ctx_recv(void *arg, nni_aio *aio)
+{
+	rep0_ctx * ctx = arg;
+	rep0_sock *s   = ctx->sock;
+	rep0_pipe *p;
+	nni_msg *  msg;
+
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
+	nni_mtx_lock(&s->lk);
+	if (ctx->raio != NULL) {
+		// Only one receive at a time.
+		nni_mtx_unlock(&s->lk);
+		nni_aio_finish_error(aio, NNG_EBUSY);
+		return;
+	}
+	while ((p = nni_list_first(&s->recvpipes)) != NULL) {
+		nni_list_remove(&s->recvpipes, p);
+		msg     = p->rmsg;
+		p->rmsg = NULL;
+		nni_pipe_recv(p->pipe, p->aio_recv);
+		if (rep0_ctx_save_btrace(ctx, msg) != 0) {
+			nni_msg_free(msg);
+			continue;
+		}
+		nni_mtx_unlock(&s->lk);
+		nni_aio_finish_msg(aio, msg);
+		return;
+	}
+	if (nni_aio_schedule(aio, rep0_ctx_cancel_recv, ctx) != 0) {
+		nni_mtx_unlock(&s->lk);
+		return;
+	}
+	ctx->raio = aio;
+	nni_list_append(&s->recvq, ctx);
+	nni_mtx_unlock(&s->lk);
+}
+
+static void
+rep0_sock_send(void *arg, nni_aio *aio)
+{
+	rep0_sock *s = arg;
+	int        raw;
+
+	nni_mtx_lock(&s->lk);
+	raw = s->raw;
+	nni_mtx_unlock(&s->lk);
+
+	if (raw) {
+		// Pass thru
+		nni_msgq_aio_put(s->uwq, aio);
+	} else {
+		rep0_ctx_send(&s->ctx, aio);
+	}
 }
 
 static void
@@ -488,6 +716,19 @@ static nni_proto_sock_option rep0_sock_options[] = {
 	{ NULL, NULL, NULL },
 };
 
+static nni_proto_ctx_option rep0_ctx_options[] = {
+	// terminate list
+	{ NULL, NULL, NULL },
+};
+
+static nni_proto_ctx_ops rep0_ctx_ops = {
+	.ctx_init    = rep0_ctx_init,
+	.ctx_fini    = rep0_ctx_fini,
+	.ctx_send    = rep0_ctx_send,
+	.ctx_recv    = rep0_ctx_recv,
+	.ctx_options = rep0_ctx_options,
+};
+
 static nni_proto_sock_ops rep0_sock_ops = {
 	.sock_init    = rep0_sock_init,
 	.sock_fini    = rep0_sock_fini,
@@ -503,9 +744,10 @@ static nni_proto rep0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_REP_V0, "rep" },
 	.proto_peer     = { NNI_PROTO_REQ_V0, "req" },
-	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
+	.proto_flags    = NNI_PROTO_FLAG_SNDRCV | NNI_PROTO_FLAG_RCVQ,
 	.proto_sock_ops = &rep0_sock_ops,
 	.proto_pipe_ops = &rep0_pipe_ops,
+	.proto_ctx_ops  = &rep0_ctx_ops,
 };
 
 int
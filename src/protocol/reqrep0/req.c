@@ -28,34 +28,46 @@
 
 typedef struct req0_pipe req0_pipe;
 typedef struct req0_sock req0_sock;
+typedef struct req0_ctx  req0_ctx;
 
-static void req0_resend(req0_sock *);
-static void req0_timeout(void *);
+static void req0_run_sendq(req0_sock *);
+static void req0_ctx_reset(req0_ctx *);
+static void req0_ctx_timeout(void *);
 static void req0_pipe_fini(void *);
 
+// A req0_ctx holds the state for a single outstanding request: its ID,
+// the request itself (kept for resends), and the resend timer.  The
+// socket has one built in, for ordinary sends and receives on the socket,
+// and applications can open as many more as they like.
+struct req0_ctx {
+	req0_sock *    sock;
+	nni_list_node  sqnode; // on the socket's send queue
+	nni_list_node  pnode;  // on the list of the pipe it was sent on
+	uint32_t       reqid;  // request ID, or zero if none
+	nni_msg *      reqmsg; // outstanding request
+	nni_msg *      repmsg; // reply not yet received (not for the socket)
+	nni_aio *      raio;   // receive waiting for a reply
+	nni_duration   retry;
+	nni_timer_node timer;
+};
+
 // A req0_sock is our per-socket protocol private structure.
 struct req0_sock {
 	nni_msgq *   uwq;
 	nni_msgq *   urq;
 	nni_duration retry;
-	nni_time     resend;
 	int          raw;
-	int          wantw;
 	int          closed;
 	int          ttl;
-	nni_msg *    reqmsg;
-
-	req0_pipe *pendpipe;
+	req0_ctx     ctx;      // built in context, used by the socket itself
+	nni_idhash * requests; // outstanding requests, by request ID
 
 	nni_list readypipes;
 	nni_list busypipes;
+	nni_list sendq; // contexts with requests waiting for a pipe
 
-	nni_timer_node timer;
-
-	uint32_t nextid;   // next id
-	uint8_t  reqid[4]; // outstanding request ID (big endian)
-	nni_mtx  mtx;
-	nni_cv   cv;
+	nni_mtx mtx;
+	nni_cv  cv;
 };
 
 // A req0_pipe is our per-pipe protocol private structure.
@@ -63,6 +75,7 @@ struct req0_pipe {
 	nni_pipe *    pipe;
 	req0_sock *   req;
 	nni_list_node node;
+	nni_list      ctxs;           // requests last sent on this pipe
 	nni_aio *     aio_getq;       // raw mode only
 	nni_aio *     aio_sendraw;    // raw mode only
 	nni_aio *     aio_sendcooked; // cooked mode only
@@ -77,32 +90,53 @@ static void req0_sendcooked_cb(void *);
 static void req0_recv_cb(void *);
 static void req0_putq_cb(void *);
 
+static void
+req0_ctx_setup(req0_ctx *ctx, req0_sock *s)
+{
+	NNI_LIST_NODE_INIT(&ctx->sqnode);
+	NNI_LIST_NODE_INIT(&ctx->pnode);
+	nni_timer_init(&ctx->timer, req0_ctx_timeout, ctx);
+	ctx->sock   = s;
+	ctx->reqid  = 0;
+	ctx->reqmsg = NULL;
+	ctx->repmsg = NULL;
+	ctx->raio   = NULL;
+	ctx->retry  = s->retry;
+}
+
 static int
 req0_sock_init(void **sp, nni_sock *sock)
 {
 	req0_sock *s;
+	int        rv;
 
 	if ((s = NNI_ALLOC_STRUCT(s)) == NULL) {
 		return (NNG_ENOMEM);
 	}
+	if ((rv = nni_idhash_init(&s->requests)) != 0) {
+		NNI_FREE_STRUCT(s);
+		return (rv);
+	}
+	// Request IDs always have the high order bit set, so that the
+	// peer can locate the end of the backtrace.  (Pipe IDs have the
+	// high order bit clear.)  We start at a "semi random" point.
+	nni_idhash_set_limits(s->requests, 0x80000000u, 0xffffffffu,
+	    nni_random() | 0x80000000u);
+
 	nni_mtx_init(&s->mtx);
 	nni_cv_init(&s->cv, &s->mtx);
 
 	NNI_LIST_INIT(&s->readypipes, req0_pipe, node);
 	NNI_LIST_INIT(&s->busypipes, req0_pipe, node);
-	nni_timer_init(&s->timer, req0_timeout, s);
-
-	// this is "semi random" start for request IDs.
-	s->nextid = nni_random();
-	s->retry  = NNI_SECOND * 60;
-	s->reqmsg = NULL;
-	s->raw    = 0;
-	s->wantw  = 0;
-	s->resend = NNI_TIME_ZERO;
-	s->ttl    = 8;
-	s->uwq    = nni_sock_sendq(sock);
-	s->urq    = nni_sock_recvq(sock);
-	*sp       = s;
+	NNI_LIST_INIT(&s->sendq, req0_ctx, sqnode);
+
+	s->retry = NNI_SECOND * 60;
+	s->raw   = 0;
+	s->ttl   = 8;
+	s->uwq   = nni_sock_sendq(sock);
+	s->urq   = nni_sock_recvq(sock);
+	req0_ctx_setup(&s->ctx, s);
+	*sp = s;
 
 	return (0);
 }
@@ -122,7 +156,7 @@ req0_sock_close(void *arg)
 	s->closed = 1;
 	nni_mtx_unlock(&s->mtx);
 
-	nni_timer_cancel(&s->timer);
+	nni_timer_cancel(&s->ctx.timer);
 }
 
 static void
@@ -135,15 +169,60 @@ req0_sock_fini(void *arg)
 	    (!nni_list_empty(&s->busypipes))) {
 		nni_cv_wait(&s->cv);
 	}
-	if (s->reqmsg != NULL) {
-		nni_msg_free(s->reqmsg);
-	}
+	req0_ctx_reset(&s->ctx);
 	nni_mtx_unlock(&s->mtx);
+	nni_timer_cancel(&s->ctx.timer);
+	nni_timer_fini(&s->ctx.timer);
+	nni_idhash_fini(s->requests);
 	nni_cv_fini(&s->cv);
 	nni_mtx_fini(&s->mtx);
 	NNI_FREE_STRUCT(s);
 }
 
+static int
+req0_ctx_init(void **cpp, void *arg)
+{
+	req0_sock *s = arg;
+	req0_ctx * ctx;
+
+	if ((ctx = NNI_ALLOC_STRUCT(ctx)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_lock(&s->mtx);
+	if (s->raw) {
+		// Raw mode has no notion of outstanding requests.
+		nni_mtx_unlock(&s->mtx);
+		NNI_FREE_STRUCT(ctx);
+		return (NNG_ENOTSUP);
+	}
+	req0_ctx_setup(ctx, s);
+	nni_mtx_unlock(&s->mtx);
+	*cpp = ctx;
+	return (0);
+}
+
+static void
+req0_ctx_fini(void *arg)
+{
+	req0_ctx * ctx = arg;
+	req0_sock *s   = ctx->sock;
+	nni_aio *  aio;
+
+	nni_mtx_lock(&s->mtx);
+	if ((aio = ctx->raio) != NULL) {
+		ctx->raio = NULL;
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+	}
+	req0_ctx_reset(ctx);
+	nni_mtx_unlock(&s->mtx);
+
+	// The timer must not be canceled with the lock held, as it may be
+	// waiting for the lock.  With the request gone, it does nothing.
+	nni_timer_cancel(&ctx->timer);
+	nni_timer_fini(&ctx->timer);
+	NNI_FREE_STRUCT(ctx);
+}
+
 static void
 req0_pipe_fini(void *arg)
 {
@@ -179,6 +258,7 @@ req0_pipe_init(void **pp, nni_pipe *pipe, void *s)
 	}
 
 	NNI_LIST_NODE_INIT(&p->node);
+	NNI_LIST_INIT(&p->ctxs, req0_ctx, pnode);
 	p->pipe = pipe;
 	p->req  = s;
 	*pp     = p;
@@ -201,11 +281,9 @@ req0_pipe_start(void *arg)
 		return (NNG_ECLOSED);
 	}
 	nni_list_append(&s->readypipes, p);
-	// If sock was waiting for somewhere to send data, go ahead and
-	// send it to this pipe.
-	if (s->wantw) {
-		req0_resend(s);
-	}
+	// If requests were waiting for somewhere to go, send the first
+	// of them to this pipe.
+	req0_run_sendq(s);
 	nni_mtx_unlock(&s->mtx);
 
 	nni_msgq_aio_get(s->uwq, p->aio_getq);
@@ -218,6 +296,7 @@ req0_pipe_stop(void *arg)
 {
 	req0_pipe *p = arg;
 	req0_sock *s = p->req;
+	req0_ctx * ctx;
 
 	nni_aio_stop(p->aio_getq);
 	nni_aio_stop(p->aio_putq);
@@ -238,14 +317,13 @@ req0_pipe_stop(void *arg)
 		}
 	}
 
-	if ((p == s->pendpipe) && (s->reqmsg != NULL)) {
-		// removing the pipe we sent the last request on...
-		// schedule immediate resend.
-		s->pendpipe = NULL;
-		s->resend   = NNI_TIME_ZERO;
-		s->wantw    = 1;
-		req0_resend(s);
+	// Requests we sent on this pipe will get no reply; resend them
+	// elsewhere right away.
+	while ((ctx = nni_list_first(&p->ctxs)) != NULL) {
+		nni_list_remove(&p->ctxs, ctx);
+		nni_list_append(&s->sendq, ctx);
 	}
+	req0_run_sendq(s);
 	nni_mtx_unlock(&s->mtx);
 }
 
@@ -281,7 +359,16 @@ static int
 req0_sock_setopt_resendtime(void *arg, const void *buf, size_t sz)
 {
 	req0_sock *s = arg;
-	return (nni_setopt_ms(&s->retry, buf, sz));
+	int        rv;
+
+	// This is the default for new contexts, as well as the value
+	// for the socket's own.
+	nni_mtx_lock(&s->mtx);
+	if ((rv = nni_setopt_ms(&s->retry, buf, sz)) == 0) {
+		s->ctx.retry = s->retry;
+	}
+	nni_mtx_unlock(&s->mtx);
+	return (rv);
 }
 
 static int
@@ -291,15 +378,34 @@ req0_sock_getopt_resendtime(void *arg, void *buf, size_t *szp)
 	return (nni_getopt_ms(s->retry, buf, szp));
 }
 
+static int
+req0_ctx_setopt_resendtime(void *arg, const void *buf, size_t sz)
+{
+	req0_ctx * ctx = arg;
+	req0_sock *s   = ctx->sock;
+	int        rv;
+
+	nni_mtx_lock(&s->mtx);
+	rv = nni_setopt_ms(&ctx->retry, buf, sz);
+	nni_mtx_unlock(&s->mtx);
+	return (rv);
+}
+
+static int
+req0_ctx_getopt_resendtime(void *arg, void *buf, size_t *szp)
+{
+	req0_ctx *ctx = arg;
+	return (nni_getopt_ms(ctx->retry, buf, szp));
+}
+
 // Raw and cooked mode differ in the way they send messages out.
 //
-// For cooked mdes, we have a getq callback on the upper write queue, which
-// when it finds a message, cancels any current processing, and saves a copy
-// of the message, and then tries to "resend" the message, looking for a
-// suitable available outgoing pipe.  If no suitable pipe is available,
-// a flag is set, so that as soon as such a pipe is available we trigger
-// a resend attempt.  We also trigger the attempt on either timeout, or if
-// the underlying pipe we chose disconnects.
+// For cooked mode, requests bypass the upper write queue.  Each request
+// is saved on its context, which is placed on the socket's send queue.
+// Whenever a pipe is ready, it takes a copy of the first request on the
+// send queue.  A request goes back on the send queue if its resend timer
+// expires, or if the pipe it was sent on disconnects.  Replies are matched
+// to their contexts by request ID.
 //
 // For raw mode we can just let the pipes "contend" via getq to get a
 // message from the upper write queue.  The msgqueue implementation
@@ -370,7 +476,7 @@ req0_sendcooked_cb(void *arg)
 	if (nni_list_active(&s->busypipes, p)) {
 		nni_list_remove(&s->busypipes, p);
 		nni_list_append(&s->readypipes, p);
-		req0_resend(s);
+		req0_run_sendq(s);
 	} else {
 		// We wind up here if stop was called from the reader
 		// side while we were waiting to be scheduled to run for the
@@ -401,7 +507,11 @@ static void
 req0_recv_cb(void *arg)
 {
 	req0_pipe *p = arg;
+	req0_sock *s = p->req;
+	req0_ctx * ctx;
 	nni_msg *  msg;
+	nni_aio *  aio;
+	uint32_t   id;
 
 	if (nni_aio_result(p->aio_recv) != 0) {
 		nni_pipe_stop(p->pipe);
@@ -411,6 +521,7 @@ req0_recv_cb(void *arg)
 	msg = nni_aio_get_msg(p->aio_recv);
 	nni_aio_set_msg(p->aio_recv, NULL);
 	nni_msg_set_pipe(msg, nni_pipe_id(p->pipe));
+	nni_pipe_bump_rx(p->pipe, nni_msg_len(msg));
 
 	// We yank 4 bytes of body, and move them to the header.
 	if (nni_msg_len(msg) < 4) {
@@ -425,9 +536,39 @@ req0_recv_cb(void *arg)
 		goto malformed;
 	}
 	(void) nni_msg_trim(msg, 4); // Cannot fail
+	NNI_GET32((uint8_t *) nni_msg_header(msg), id);
 
-	nni_aio_set_msg(p->aio_putq, msg);
-	nni_msgq_aio_put(p->req->urq, p->aio_putq);
+	nni_mtx_lock(&s->mtx);
+	if ((!s->raw) &&
+	    (nni_idhash_find(s->requests, id, (void **) &ctx) != 0)) {
+		// No such request.  (Perhaps canceled, or a duplicate
+		// reply.)
+		nni_mtx_unlock(&s->mtx);
+		nni_msg_free(msg);
+		nni_pipe_recv(p->pipe, p->aio_recv);
+		return;
+	}
+	if (s->raw || (ctx == &s->ctx)) {
+		// Replies for the socket itself go through the upper read
+		// queue; the filter checks them again on the way out, as
+		// the request may be replaced while they wait there.
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_set_msg(p->aio_putq, msg);
+		nni_msgq_aio_put(s->urq, p->aio_putq);
+		return;
+	}
+
+	// A reply for one of the contexts.  Hand it straight to the
+	// waiting receiver if there is one, otherwise hold on to it.
+	req0_ctx_reset(ctx);
+	if ((aio = ctx->raio) != NULL) {
+		ctx->raio = NULL;
+		nni_aio_finish_msg(aio, msg);
+	} else {
+		ctx->repmsg = msg;
+	}
+	nni_mtx_unlock(&s->mtx);
+	nni_pipe_recv(p->pipe, p->aio_recv);
 	return;
 
 malformed:
@@ -436,134 +577,225 @@ malformed:
 }
 
 static void
-req0_timeout(void *arg)
+req0_ctx_timeout(void *arg)
 {
-	req0_sock *s = arg;
+	req0_ctx * ctx = arg;
+	req0_sock *s   = ctx->sock;
 
 	nni_mtx_lock(&s->mtx);
-	if (s->reqmsg != NULL) {
-		s->wantw = 1;
-		req0_resend(s);
+	if ((ctx->reqmsg != NULL) && (!nni_list_node_active(&ctx->sqnode))) {
+		// No reply in time, so send it again.
+		if (nni_list_node_active(&ctx->pnode)) {
+			nni_list_node_remove(&ctx->pnode);
+		}
+		nni_list_append(&s->sendq, ctx);
+		req0_run_sendq(s);
 	}
 	nni_mtx_unlock(&s->mtx);
 }
 
+// req0_ctx_reset discards the context's outstanding request, and any
+// reply not yet received.  A waiting receive is left alone.  This must be
+// called with the socket lock held.
 static void
-req0_resend(req0_sock *s)
+req0_ctx_reset(req0_ctx *ctx)
 {
-	req0_pipe *p;
-	nni_msg *  msg;
+	req0_sock *s = ctx->sock;
 
-	// Note: This routine should be called with the socket lock held.
-	// Also, this should only be called while handling cooked mode
-	// requests.
-	if ((msg = s->reqmsg) == NULL) {
-		return;
+	if (ctx->reqid != 0) {
+		nni_idhash_remove(s->requests, ctx->reqid);
+		ctx->reqid = 0;
 	}
-
-	if (s->closed) {
-		s->reqmsg = NULL;
-		nni_msg_free(msg);
+	if (nni_list_node_active(&ctx->sqnode)) {
+		nni_list_node_remove(&ctx->sqnode);
 	}
+	if (nni_list_node_active(&ctx->pnode)) {
+		nni_list_node_remove(&ctx->pnode);
+	}
+	if (ctx->reqmsg != NULL) {
+		nni_msg_free(ctx->reqmsg);
+		ctx->reqmsg = NULL;
+	}
+	if (ctx->repmsg != NULL) {
+		nni_msg_free(ctx->repmsg);
+		ctx->repmsg = NULL;
+	}
+}
 
-	if (s->wantw) {
-		s->wantw = 0;
-
-		if (nni_msg_dup(&msg, s->reqmsg) != 0) {
-			// Failed to alloc message, reschedule it. Also,
-			// mark that we have a message we want to resend,
-			// in case something comes available.
-			s->wantw = 1;
-			nni_timer_schedule(&s->timer, nni_clock() + s->retry);
-			return;
-		}
+// req0_run_sendq hands requests waiting on the send queue to ready pipes,
+// for as long as there are both.  This must be called with the socket
+// lock held, and only for cooked mode requests.
+static void
+req0_run_sendq(req0_sock *s)
+{
+	req0_ctx * ctx;
+	req0_pipe *p;
+	nni_msg *  msg;
 
-		// Now we iterate across all possible outpipes, until
-		// one accepts it.
-		if ((p = nni_list_first(&s->readypipes)) == NULL) {
-			// No pipes ready to process us.  Note that we have
-			// something to send, and schedule it.
-			nni_msg_free(msg);
-			s->wantw = 1;
-			return;
+	if (s->closed) {
+		return;
+	}
+	while (((ctx = nni_list_first(&s->sendq)) != NULL) &&
+	    ((p = nni_list_first(&s->readypipes)) != NULL)) {
+		nni_list_remove(&s->sendq, ctx);
+
+		// The resend timer runs even if we fail to make a copy of
+		// the message (for lack of memory) to send now.
+		nni_timer_schedule(&ctx->timer, nni_clock() + ctx->retry);
+		if (nni_msg_dup(&msg, ctx->reqmsg) != 0) {
+			continue;
 		}
 
 		nni_list_remove(&s->readypipes, p);
 		nni_list_append(&s->busypipes, p);
-
-		s->pendpipe = p;
-		s->resend   = nni_clock() + s->retry;
-		nni_aio_set_msg(p->aio_sendcooked, msg);
+		nni_list_append(&p->ctxs, ctx);
 
 		// Note that because we were ready rather than busy, we
 		// should not have any I/O oustanding and hence the aio
 		// object will be available for our use.
+		nni_aio_set_msg(p->aio_sendcooked, msg);
 		nni_pipe_send(p->pipe, p->aio_sendcooked);
-		nni_timer_schedule(&s->timer, s->resend);
 	}
 }
 
 static void
-req0_sock_send(void *arg, nni_aio *aio)
+req0_ctx_send(void *arg, nni_aio *aio)
 {
-	req0_sock *s = arg;
-	uint32_t   id;
-	size_t     len;
+	req0_ctx * ctx = arg;
+	req0_sock *s   = ctx->sock;
+	nni_aio *  raio;
 	nni_msg *  msg;
+	uint64_t   id;
+	size_t     len;
 	int        rv;
 
-	nni_mtx_lock(&s->mtx);
-	if (s->raw) {
-		nni_mtx_unlock(&s->mtx);
-		nni_msgq_aio_put(s->uwq, aio);
+	if (nni_aio_begin(aio) != 0) {
 		return;
 	}
-
 	msg = nni_aio_get_msg(aio);
 	len = nni_msg_len(msg);
 
-	// In cooked mode, because we need to manage our own resend logic,
-	// we bypass the upper writeq entirely.
+	nni_mtx_lock(&s->mtx);
+	if (s->closed) {
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+		return;
+	}
 
-	// Generate a new request ID.  We always set the high
-	// order bit so that the peer can locate the end of the
-	// backtrace.  (Pipe IDs have the high order bit clear.)
-	id = (s->nextid++) | 0x80000000u;
-	// Request ID is in big endian format.
-	NNI_PUT32(s->reqid, id);
+	// If another request is outstanding, this cancels it, along with
+	// any receive waiting for its reply.
+	req0_ctx_reset(ctx);
+	if ((raio = ctx->raio) != NULL) {
+		ctx->raio = NULL;
+		nni_aio_finish_error(raio, NNG_ECANCELED);
+	}
 
-	if ((rv = nni_msg_header_append(msg, s->reqid, 4)) != 0) {
+	// Generate a new request ID.  The high order bit is always set.
+	if ((rv = nni_idhash_alloc(s->requests, &id, ctx)) != 0) {
 		nni_mtx_unlock(&s->mtx);
 		nni_aio_finish_error(aio, rv);
 		return;
 	}
+	// Request ID is in big endian format.
+	if ((rv = nni_msg_header_append_u32(msg, (uint32_t) id)) != 0) {
+		nni_idhash_remove(s->requests, id);
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_aio_set_msg(aio, NULL);
+
+	// Save the message, for retries, and schedule it for immediate
+	// sending.
+	ctx->reqid  = (uint32_t) id;
+	ctx->reqmsg = msg;
+	nni_list_append(&s->sendq, ctx);
+	req0_run_sendq(s);
+
+	nni_mtx_unlock(&s->mtx);
+
+	nni_aio_finish(aio, 0, len);
+}
 
-	// If another message is there, this cancels it.
-	if (s->reqmsg != NULL) {
-		nni_msg_free(s->reqmsg);
-		s->reqmsg = NULL;
+static void
+req0_ctx_cancel_recv(nni_aio *aio, int rv)
+{
+	req0_ctx * ctx = nni_aio_get_prov_data(aio);
+	req0_sock *s   = ctx->sock;
+
+	nni_mtx_lock(&s->mtx);
+	if (ctx->raio == aio) {
+		// The request stays outstanding; a later receive may
+		// still get the reply.
+		ctx->raio = NULL;
+		nni_aio_finish_error(aio, rv);
 	}
+	nni_mtx_unlock(&s->mtx);
+}
 
-	nni_aio_set_msg(aio, NULL);
+static void
+req0_ctx_recv(void *arg, nni_aio *aio)
+{
+	req0_ctx * ctx = arg;
+	req0_sock *s   = ctx->sock;
+	nni_msg *  msg;
 
-	// Make a duplicate message... for retries.
-	s->reqmsg = msg;
-	// Schedule for immediate send
-	s->resend = NNI_TIME_ZERO;
-	s->wantw  = 1;
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
+	nni_mtx_lock(&s->mtx);
+	if (s->closed) {
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+		return;
+	}
+	if ((msg = ctx->repmsg) != NULL) {
+		ctx->repmsg = NULL;
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_msg(aio, msg);
+		return;
+	}
+	if (ctx->reqmsg == NULL) {
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_error(aio, NNG_ESTATE);
+		return;
+	}
+	if (ctx->raio != NULL) {
+		// Only one receive at a time.
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_error(aio, NNG_EBUSY);
+		return;
+	}
+	if (nni_aio_schedule(aio, req0_ctx_cancel_recv, ctx) != 0) {
+		nni_mtx_unlock(&s->mtx);
+		return;
+	}
+	ctx->raio = aio;
+	nni_mtx_unlock(&s->mtx);
+}
 
-	req0_resend(s);
+static void
+req0_sock_send(void *arg, nni_aio *aio)
+{
+	req0_sock *s = arg;
+	int        raw;
 
+	nni_mtx_lock(&s->mtx);
+	raw = s->raw;
 	nni_mtx_unlock(&s->mtx);
 
-	nni_aio_finish(aio, 0, len);
+	if (raw) {
+		nni_msgq_aio_put(s->uwq, aio);
+	} else {
+		req0_ctx_send(&s->ctx, aio);
+	}
 }
 
 static nni_msg *
 req0_sock_filter(void *arg, nni_msg *msg)
 {
 	req0_sock *s = arg;
-	nni_msg *  rmsg;
+	uint32_t   id;
 
 	nni_mtx_lock(&s->mtx);
 	if (s->raw) {
@@ -578,27 +810,18 @@ req0_sock_filter(void *arg, nni_msg *msg)
 		return (NULL);
 	}
 
-	if ((rmsg = s->reqmsg) == NULL) {
-		// We had no outstanding request.  (Perhaps canceled,
-		// or duplicate response.)
-		nni_mtx_unlock(&s->mtx);
-		nni_msg_free(msg);
-		return (NULL);
-	}
-
-	if (memcmp(nni_msg_header(msg), s->reqid, 4) != 0) {
-		// Wrong request id.
+	NNI_GET32((uint8_t *) nni_msg_header(msg), id);
+	if ((s->ctx.reqmsg == NULL) || (id != s->ctx.reqid)) {
+		// No outstanding request, or the wrong one.  (Perhaps
+		// canceled, or a duplicate response.)
 		nni_mtx_unlock(&s->mtx);
 		nni_msg_free(msg);
 		return (NULL);
 	}
 
-	s->reqmsg   = NULL;
-	s->pendpipe = NULL;
+	req0_ctx_reset(&s->ctx);
 	nni_mtx_unlock(&s->mtx);
 
-	nni_msg_free(rmsg);
-
 	return (msg);
 }
 
@@ -609,9 +832,11 @@ req0_sock_recv(void *arg, nni_aio *aio)
 
 	nni_mtx_lock(&s->mtx);
 	if (!s->raw) {
-		if (s->reqmsg == NULL) {
+		if (s->ctx.reqmsg == NULL) {
 			nni_mtx_unlock(&s->mtx);
-			nni_aio_finish_error(aio, NNG_ESTATE);
+			if (nni_aio_begin(aio) == 0) {
+				nni_aio_finish_error(aio, NNG_ESTATE);
+			}
 			return;
 		}
 	}
@@ -646,6 +871,24 @@ static nni_proto_sock_option req0_sock_options[] = {
 	{ NULL, NULL, NULL },
 };
 
+static nni_proto_ctx_option req0_ctx_options[] = {
+	{
+	    .co_name   = NNG_OPT_REQ_RESENDTIME,
+	    .co_getopt = req0_ctx_getopt_resendtime,
+	    .co_setopt = req0_ctx_setopt_resendtime,
+	},
+	// terminate list
+	{ NULL, NULL, NULL },
+};
+
+static nni_proto_ctx_ops req0_ctx_ops = {
+	.ctx_init    = req0_ctx_init,
+	.ctx_fini    = req0_ctx_fini,
+	.ctx_send    = req0_ctx_send,
+	.ctx_recv    = req0_ctx_recv,
+	.ctx_options = req0_ctx_options,
+};
+
 static nni_proto_sock_ops req0_sock_ops = {
 	.sock_init    = req0_sock_init,
 	.sock_fini    = req0_sock_fini,
@@ -664,6 +907,7 @@ static nni_proto req0_proto = {
 	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
 	.proto_sock_ops = &req0_sock_ops,
 	.proto_pipe_ops = &req0_pipe_ops,
+	.proto_ctx_ops  = &req0_ctx_ops,
 };
 
 int
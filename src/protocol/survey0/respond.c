@@ -141,7 +141,9 @@ resp0_pipe_init(void **pp, nni_pipe *npipe, void *s)
 	if ((p = NNI_ALLOC_STRUCT(p)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	if (((rv = nni_msgq_init(&p->sendq, 2)) != 0) ||
+	// Surveyors may have many surveys running at once, so we need
+	// room for a burst of responses.  This depth could be tunable.
+	if (((rv = nni_msgq_init(&p->sendq, 16)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_putq, resp0_putq_cb, p)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_recv, resp0_recv_cb, p)) != 0) ||
 	    ((rv = nni_aio_init(&p->aio_getq, resp0_getq_cb, p)) != 0) ||
@@ -234,6 +236,7 @@ resp0_sock_getq_cb(void *arg)
 	} else {
 		// Non-blocking put.
 		if (nni_msgq_tryput(p->sendq, msg) != 0) {
+			nni_pipe_bump_drop(p->npipe);
 			nni_msg_free(msg);
 		}
 	}
@@ -289,6 +292,7 @@ resp0_recv_cb(void *arg)
 	msg = nni_aio_get_msg(p->aio_recv);
 	nni_aio_set_msg(p->aio_recv, NULL);
 	nni_msg_set_pipe(msg, p->id);
+	nni_pipe_bump_rx(p->npipe, nni_msg_len(msg));
 
 	// Store the pipe id in the header, first thing.
 	if (nni_msg_header_append_u32(msg, p->id) != 0) {
@@ -386,6 +390,9 @@ resp0_sock_send(void *arg, nni_aio *aio)
 	nni_msg *   msg;
 	int         rv;
 
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
 	nni_mtx_lock(&s->mtx);
 	if (s->raw) {
 		nni_mtx_unlock(&s->mtx);
@@ -497,7 +504,7 @@ static nni_proto resp0_proto = {
 	.proto_version  = NNI_PROTOCOL_VERSION,
 	.proto_self     = { NNI_PROTO_RESPONDENT_V0, "respondent" },
 	.proto_peer     = { NNI_PROTO_SURVEYOR_V0, "surveyor" },
-	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
+	.proto_flags    = NNI_PROTO_FLAG_SNDRCV | NNI_PROTO_FLAG_RCVQ,
 	.proto_sock_ops = &resp0_sock_ops,
 	.proto_pipe_ops = &resp0_pipe_ops,
 };
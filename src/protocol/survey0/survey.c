@@ -27,29 +27,40 @@
 
 typedef struct surv0_pipe surv0_pipe;
 typedef struct surv0_sock surv0_sock;
+typedef struct surv0_ctx  surv0_ctx;
 
 static void surv0_sock_getq_cb(void *);
 static void surv0_getq_cb(void *);
 static void surv0_putq_cb(void *);
 static void surv0_send_cb(void *);
 static void surv0_recv_cb(void *);
-static void surv0_timeout(void *);
+static void surv0_ctx_timeout(void *);
+
+// A surv0_ctx holds the state for a single survey: its ID, its deadline,
+// and the responses collected so far.  The socket has one built in, whose
+// responses go to the upper read queue, and applications can open as
+// many more as they like, each with its own queue of responses.
+struct surv0_ctx {
+	surv0_sock *   sock;
+	uint32_t       survid; // survey ID, or zero if none
+	nni_time       expire;
+	nni_duration   survtime;
+	nni_timer_node timer;
+	nni_msgq *     rq; // responses (the urq for the built in context)
+};
 
 // surv0_sock is our per-socket protocol private structure.
 struct surv0_sock {
-	nni_duration   survtime;
-	nni_time       expire;
-	int            raw;
-	int            ttl;
-	int            closing;
-	uint32_t       nextid; // next id
-	uint32_t       survid; // outstanding request ID (big endian)
-	nni_list       pipes;
-	nni_aio *      aio_getq;
-	nni_timer_node timer;
-	nni_msgq *     uwq;
-	nni_msgq *     urq;
-	nni_mtx        mtx;
+	nni_duration survtime;
+	int          raw;
+	int          ttl;
+	surv0_ctx    ctx;     // built in context, used by the socket itself
+	nni_idhash * surveys; // outstanding surveys, by survey ID
+	nni_list     pipes;
+	nni_aio *    aio_getq;
+	nni_msgq *   uwq;
+	nni_msgq *   urq;
+	nni_mtx      mtx;
 };
 
 // surv0_pipe is our per-pipe protocol private structure.
@@ -64,6 +75,32 @@ struct surv0_pipe {
 	nni_aio *     aio_recv;
 };
 
+// Responses for contexts (other than the socket's own) are queued on the
+// context, up to this many.  This depth could be tunable.
+#define SURV0_CTX_RECVQ 128
+
+static void
+surv0_ctx_setup(surv0_ctx *ctx, surv0_sock *s)
+{
+	nni_timer_init(&ctx->timer, surv0_ctx_timeout, ctx);
+	ctx->sock     = s;
+	ctx->survid   = 0;
+	ctx->expire   = NNI_TIME_ZERO;
+	ctx->survtime = s->survtime;
+}
+
+// surv0_ctx_reset ends the context's survey, if it has one.  Responses
+// that arrive for it later are discarded.  This must be called with the
+// socket lock held.
+static void
+surv0_ctx_reset(surv0_ctx *ctx)
+{
+	if (ctx->survid != 0) {
+		nni_idhash_remove(ctx->sock->surveys, ctx->survid);
+		ctx->survid = 0;
+	}
+}
+
 static void
 surv0_sock_fini(void *arg)
 {
@@ -71,6 +108,8 @@ surv0_sock_fini(void *arg)
 
 	nni_aio_stop(s->aio_getq);
 	nni_aio_fini(s->aio_getq);
+	nni_timer_fini(&s->ctx.timer);
+	nni_idhash_fini(s->surveys);
 	nni_mtx_fini(&s->mtx);
 	NNI_FREE_STRUCT(s);
 }
@@ -84,26 +123,87 @@ surv0_sock_init(void **sp, nni_sock *nsock)
 	if ((s = NNI_ALLOC_STRUCT(s)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	if ((rv = nni_aio_init(&s->aio_getq, surv0_sock_getq_cb, s)) != 0) {
-		surv0_sock_fini(s);
+	if ((rv = nni_idhash_init(&s->surveys)) != 0) {
+		NNI_FREE_STRUCT(s);
 		return (rv);
 	}
+	// Survey IDs always have the high order bit set, so that the
+	// peer can locate the end of the backtrace.  (Pipe IDs have the
+	// high order bit clear.)  We start at a "semi random" point.
+	nni_idhash_set_limits(s->surveys, 0x80000000u, 0xffffffffu,
+	    nni_random() | 0x80000000u);
+
 	NNI_LIST_INIT(&s->pipes, surv0_pipe, node);
 	nni_mtx_init(&s->mtx);
-	nni_timer_init(&s->timer, surv0_timeout, s);
 
-	s->nextid   = nni_random();
 	s->raw      = 0;
 	s->survtime = NNI_SECOND;
-	s->expire   = NNI_TIME_ZERO;
 	s->uwq      = nni_sock_sendq(nsock);
 	s->urq      = nni_sock_recvq(nsock);
 	s->ttl      = 8;
 
+	surv0_ctx_setup(&s->ctx, s);
+	s->ctx.rq = s->urq;
+
+	if ((rv = nni_aio_init(&s->aio_getq, surv0_sock_getq_cb, s)) != 0) {
+		surv0_sock_fini(s);
+		return (rv);
+	}
+
 	*sp = s;
 	return (0);
 }
 
+static int
+surv0_ctx_init(void **cpp, void *arg)
+{
+	surv0_sock *s = arg;
+	surv0_ctx * ctx;
+	int         rv;
+
+	if ((ctx = NNI_ALLOC_STRUCT(ctx)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_msgq_init(&ctx->rq, SURV0_CTX_RECVQ)) != 0) {
+		NNI_FREE_STRUCT(ctx);
+		return (rv);
+	}
+	nni_mtx_lock(&s->mtx);
+	if (s->raw) {
+		// Raw mode has no notion of outstanding surveys.
+		nni_mtx_unlock(&s->mtx);
+		nni_msgq_fini(ctx->rq);
+		NNI_FREE_STRUCT(ctx);
+		return (NNG_ENOTSUP);
+	}
+	surv0_ctx_setup(ctx, s);
+	nni_mtx_unlock(&s->mtx);
+	*cpp = ctx;
+	return (0);
+}
+
+static void
+surv0_ctx_fini(void *arg)
+{
+	surv0_ctx * ctx = arg;
+	surv0_sock *s   = ctx->sock;
+
+	nni_mtx_lock(&s->mtx);
+	surv0_ctx_reset(ctx);
+	nni_mtx_unlock(&s->mtx);
+
+	// The timer must not be canceled with the lock held, as it may be
+	// waiting for the lock.  With the survey gone, it does nothing.
+	nni_timer_cancel(&ctx->timer);
+	nni_timer_fini(&ctx->timer);
+
+	// Nothing can find the context any more, so closing the queue
+	// fails any waiting receive.
+	nni_msgq_close(ctx->rq);
+	nni_msgq_fini(ctx->rq);
+	NNI_FREE_STRUCT(ctx);
+}
+
 static void
 surv0_sock_open(void *arg)
 {
@@ -117,7 +217,7 @@ surv0_sock_close(void *arg)
 {
 	surv0_sock *s = arg;
 
-	nni_timer_cancel(&s->timer);
+	nni_timer_cancel(&s->ctx.timer);
 	nni_aio_abort(s->aio_getq, NNG_ECLOSED);
 }
 
@@ -244,7 +344,10 @@ static void
 surv0_recv_cb(void *arg)
 {
 	surv0_pipe *p = arg;
+	surv0_sock *s = p->psock;
+	surv0_ctx * ctx;
 	nni_msg *   msg;
+	uint32_t    id;
 
 	if (nni_aio_result(p->aio_recv) != 0) {
 		goto failed;
@@ -253,22 +356,54 @@ surv0_recv_cb(void *arg)
 	msg = nni_aio_get_msg(p->aio_recv);
 	nni_aio_set_msg(p->aio_recv, NULL);
 	nni_msg_set_pipe(msg, nni_pipe_id(p->npipe));
+	nni_pipe_bump_rx(p->npipe, nni_msg_len(msg));
 
-	// We yank 4 bytes of body, and move them to the header.
+	// The survey ID is the first 4 bytes of the body.
 	if (nni_msg_len(msg) < 4) {
 		// Not enough data, just toss it.
 		nni_msg_free(msg);
 		goto failed;
 	}
-	if (nni_msg_header_append(msg, nni_msg_body(msg), 4) != 0) {
-		// Should be NNG_ENOMEM
+	NNI_GET32((uint8_t *) nni_msg_body(msg), id);
+
+	nni_mtx_lock(&s->mtx);
+	if (s->raw) {
+		ctx = NULL;
+	} else if (nni_idhash_find(s->surveys, id, (void **) &ctx) != 0) {
+		// Not a survey we are running (perhaps it already finished),
+		// so discard it.
+		nni_mtx_unlock(&s->mtx);
 		nni_msg_free(msg);
-		goto failed;
+		nni_pipe_recv(p->npipe, p->aio_recv);
+		return;
+	}
+
+	if ((ctx == NULL) || (ctx == &s->ctx)) {
+		// Raw mode, and the socket's own survey, use the upper read
+		// queue; the survey ID is checked again on the way out.
+		nni_mtx_unlock(&s->mtx);
+		if (nni_msg_header_append(msg, nni_msg_body(msg), 4) != 0) {
+			// Should be NNG_ENOMEM
+			nni_msg_free(msg);
+			goto failed;
+		}
+		(void) nni_msg_trim(msg, 4);
+
+		nni_aio_set_msg(p->aio_putq, msg);
+		nni_msgq_aio_put(s->urq, p->aio_putq);
+		return;
 	}
+
+	// Contexts are not allowed to hold up the pipe; if the context
+	// already has as many responses as it can hold, this one is dropped.
 	(void) nni_msg_trim(msg, 4);
+	if (nni_msgq_tryput(ctx->rq, msg) != 0) {
+		nni_pipe_bump_drop(p->npipe);
+		nni_msg_free(msg);
+	}
+	nni_mtx_unlock(&s->mtx);
 
-	nni_aio_set_msg(p->aio_putq, msg);
-	nni_msgq_aio_put(p->psock->urq, p->aio_putq);
+	nni_pipe_recv(p->npipe, p->aio_recv);
 	return;
 
 failed:
@@ -283,8 +418,7 @@ surv0_sock_setopt_raw(void *arg, const void *buf, size_t sz)
 
 	nni_mtx_lock(&s->mtx);
 	if ((rv = nni_setopt_int(&s->raw, buf, sz, 0, 1)) == 0) {
-		s->survid = 0;
-		nni_timer_cancel(&s->timer);
+		surv0_ctx_reset(&s->ctx);
 	}
 	nni_mtx_unlock(&s->mtx);
 	return (rv);
@@ -315,7 +449,16 @@ static int
 surv0_sock_setopt_surveytime(void *arg, const void *buf, size_t sz)
 {
 	surv0_sock *s = arg;
-	return (nni_setopt_ms(&s->survtime, buf, sz));
+	int         rv;
+
+	// This is the default for new contexts, as well as the setting
+	// for the socket itself.
+	nni_mtx_lock(&s->mtx);
+	if ((rv = nni_setopt_ms(&s->survtime, buf, sz)) == 0) {
+		s->ctx.survtime = s->survtime;
+	}
+	nni_mtx_unlock(&s->mtx);
+	return (rv);
 }
 
 static int
@@ -325,6 +468,26 @@ surv0_sock_getopt_surveytime(void *arg, void *buf, size_t *szp)
 	return (nni_getopt_ms(s->survtime, buf, szp));
 }
 
+static int
+surv0_ctx_setopt_surveytime(void *arg, const void *buf, size_t sz)
+{
+	surv0_ctx * ctx = arg;
+	surv0_sock *s   = ctx->sock;
+	int         rv;
+
+	nni_mtx_lock(&s->mtx);
+	rv = nni_setopt_ms(&ctx->survtime, buf, sz);
+	nni_mtx_unlock(&s->mtx);
+	return (rv);
+}
+
+static int
+surv0_ctx_getopt_surveytime(void *arg, void *buf, size_t *szp)
+{
+	surv0_ctx *ctx = arg;
+	return (nni_getopt_ms(ctx->survtime, buf, szp));
+}
+
 static void
 surv0_sock_getq_cb(void *arg)
 {
@@ -351,6 +514,7 @@ surv0_sock_getq_cb(void *arg)
 			dup = msg;
 		}
 		if (nni_msgq_tryput(p->sendq, dup) != 0) {
+			nni_pipe_bump_drop(p->npipe);
 			nni_msg_free(dup);
 		}
 	}
@@ -365,71 +529,129 @@ surv0_sock_getq_cb(void *arg)
 }
 
 static void
-surv0_timeout(void *arg)
+surv0_ctx_timeout(void *arg)
 {
-	surv0_sock *s = arg;
+	surv0_ctx * ctx = arg;
+	surv0_sock *s   = ctx->sock;
 
 	nni_mtx_lock(&s->mtx);
-	s->survid = 0;
+	// A new survey may have been started while we waited for the lock,
+	// in which case its own deadline applies.
+	if ((ctx->survid != 0) && (nni_clock() >= ctx->expire)) {
+		surv0_ctx_reset(ctx);
+		nni_msgq_set_get_error(ctx->rq, NNG_ETIMEDOUT);
+	}
 	nni_mtx_unlock(&s->mtx);
-
-	nni_msgq_set_get_error(s->urq, NNG_ETIMEDOUT);
 }
 
 static void
-surv0_sock_recv(void *arg, nni_aio *aio)
+surv0_ctx_send(void *arg, nni_aio *aio)
 {
-	surv0_sock *s = arg;
+	surv0_ctx * ctx = arg;
+	surv0_sock *s   = ctx->sock;
+	nni_msg *   msg;
+	nni_msgq *  rq;
+	uint64_t    id;
+	int         rv;
 
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
 	nni_mtx_lock(&s->mtx);
-	if (s->survid == 0) {
+
+	msg = nni_aio_get_msg(aio);
+
+	// If another survey is running, this cancels it.
+	surv0_ctx_reset(ctx);
+
+	// Generate a new survey ID.  The high order bit is always set.
+	if ((rv = nni_idhash_alloc(s->surveys, &id, ctx)) != 0) {
 		nni_mtx_unlock(&s->mtx);
-		nni_aio_finish_error(aio, NNG_ESTATE);
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_msg_header_clear(msg);
+	if ((rv = nni_msg_header_append_u32(msg, (uint32_t) id)) != 0) {
+		nni_idhash_remove(s->surveys, id);
+		nni_mtx_unlock(&s->mtx);
+		nni_aio_finish_error(aio, rv);
 		return;
 	}
+
+	// Responses to an earlier survey may still be queued on the
+	// context; these are simply thrown away with their queue.  (The
+	// socket's own queue filters them out instead.)
+	if ((ctx != &s->ctx) && (nni_msgq_len(ctx->rq) != 0) &&
+	    (nni_msgq_init(&rq, SURV0_CTX_RECVQ) == 0)) {
+		nni_msgq_fini(ctx->rq);
+		ctx->rq = rq;
+	}
+
+	ctx->survid = (uint32_t) id;
+	ctx->expire = nni_clock() + ctx->survtime;
+	nni_msgq_set_get_error(ctx->rq, 0);
+	nni_timer_schedule(&ctx->timer, ctx->expire);
+
 	nni_mtx_unlock(&s->mtx);
-	nni_msgq_aio_get(s->urq, aio);
+
+	nni_msgq_aio_put(s->uwq, aio);
 }
 
 static void
-surv0_sock_send(void *arg, nni_aio *aio)
+surv0_ctx_recv(void *arg, nni_aio *aio)
 {
-	surv0_sock *s = arg;
-	nni_msg *   msg;
-	int         rv;
+	surv0_ctx * ctx = arg;
+	surv0_sock *s   = ctx->sock;
 
+	if (nni_aio_begin(aio) != 0) {
+		return;
+	}
 	nni_mtx_lock(&s->mtx);
-	if (s->raw) {
-		// No automatic retry, and the request ID must
-		// be in the header coming down.
+	if (ctx->survid == 0) {
 		nni_mtx_unlock(&s->mtx);
-		nni_msgq_aio_put(s->uwq, aio);
+		nni_aio_finish_error(aio, NNG_ESTATE);
 		return;
 	}
+	// The queue is only ever replaced with the lock held, so we must
+	// hold it here too.  (Context queues have no filter.)
+	nni_msgq_aio_get(ctx->rq, aio);
+	nni_mtx_unlock(&s->mtx);
+}
 
-	// Generate a new request ID.  We always set the high
-	// order bit so that the peer can locate the end of the
-	// backtrace.  (Pipe IDs have the high order bit clear.)
-	s->survid = (s->nextid++) | 0x80000000u;
+static void
+surv0_sock_recv(void *arg, nni_aio *aio)
+{
+	surv0_sock *s = arg;
 
-	msg = nni_aio_get_msg(aio);
-	nni_msg_header_clear(msg);
-	if ((rv = nni_msg_header_append_u32(msg, s->survid)) != 0) {
+	nni_mtx_lock(&s->mtx);
+	if ((!s->raw) && (s->ctx.survid == 0)) {
 		nni_mtx_unlock(&s->mtx);
-		nni_aio_finish_error(aio, rv);
+		if (nni_aio_begin(aio) == 0) {
+			nni_aio_finish_error(aio, NNG_ESTATE);
+		}
 		return;
 	}
+	nni_mtx_unlock(&s->mtx);
+	nni_msgq_aio_get(s->urq, aio);
+}
 
-	// If another message is there, this cancels it.  We move the
-	// survey expiration out.  The timeout thread will wake up in
-	// the wake below, and reschedule itself appropriately.
-	nni_msgq_set_get_error(s->urq, 0);
-	s->expire = nni_clock() + s->survtime;
-	nni_timer_schedule(&s->timer, s->expire);
+static void
+surv0_sock_send(void *arg, nni_aio *aio)
+{
+	surv0_sock *s = arg;
+	int         raw;
 
+	nni_mtx_lock(&s->mtx);
+	raw = s->raw;
 	nni_mtx_unlock(&s->mtx);
 
-	nni_msgq_aio_put(s->uwq, aio);
+	if (raw) {
+		// No automatic retry, and the request ID must
+		// be in the header coming down.
+		nni_msgq_aio_put(s->uwq, aio);
+	} else {
+		surv0_ctx_send(&s->ctx, aio);
+	}
 }
 
 static nni_msg *
@@ -445,7 +667,7 @@ surv0_sock_filter(void *arg, nni_msg *msg)
 	}
 
 	if ((nni_msg_header_len(msg) < sizeof(uint32_t)) ||
-	    (nni_msg_header_trim_u32(msg) != s->survid)) {
+	    (nni_msg_header_trim_u32(msg) != s->ctx.survid)) {
 		// Wrong request id
 		nni_mtx_unlock(&s->mtx);
 		nni_msg_free(msg);
@@ -483,6 +705,24 @@ static nni_proto_sock_option surv0_sock_options[] = {
 	{ NULL, NULL, NULL },
 };
 
+static nni_proto_ctx_option surv0_ctx_options[] = {
+	{
+	    .co_name   = NNG_OPT_SURVEYOR_SURVEYTIME,
+	    .co_getopt = surv0_ctx_getopt_surveytime,
+	    .co_setopt = surv0_ctx_setopt_surveytime,
+	},
+	// terminate list
+	{ NULL, NULL, NULL },
+};
+
+static nni_proto_ctx_ops surv0_ctx_ops = {
+	.ctx_init    = surv0_ctx_init,
+	.ctx_fini    = surv0_ctx_fini,
+	.ctx_send    = surv0_ctx_send,
+	.ctx_recv    = surv0_ctx_recv,
+	.ctx_options = surv0_ctx_options,
+};
+
 static nni_proto_sock_ops surv0_sock_ops = {
 	.sock_init    = surv0_sock_init,
 	.sock_fini    = surv0_sock_fini,
@@ -501,6 +741,7 @@ static nni_proto surv0_proto = {
 	.proto_flags    = NNI_PROTO_FLAG_SNDRCV,
 	.proto_sock_ops = &surv0_sock_ops,
 	.proto_pipe_ops = &surv0_pipe_ops,
+	.proto_ctx_ops  = &surv0_ctx_ops,
 };
 
 int
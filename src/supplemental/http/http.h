@@ -403,6 +403,13 @@ NNG_DECL int nng_http_server_set_tls(nng_http_server *, nng_tls_config *);
 // nng_http_server_set_tls function is called, so be careful.
 NNG_DECL int nng_http_server_get_tls(nng_http_server *, nng_tls_config **);
 
+// nng_http_server_set_cache enables a cache of static content, used by
+// the file and directory handlers to keep recently used files in memory
+// as complete responses.  The first size is the limit on the memory used
+// by the cache, and the second is the size of the largest file to cache.
+// A limit of zero (the default) disables the cache.
+NNG_DECL int nng_http_server_set_cache(nng_http_server *, size_t, size_t);
+
 // nng_http_hijack is intended to be called by a handler that wishes to
 // take over the processing of the HTTP session -- usually to change protocols
 // (such as in the case of websocket).  The caller is responsible for the
@@ -160,6 +160,12 @@ extern int nni_http_server_set_tls(nni_http_server *, nng_tls_config *);
 // nni_http_server_set_tls function is called, so be careful.
 extern int nni_http_server_get_tls(nni_http_server *, nng_tls_config **);
 
+// nni_http_server_set_cache configures the static content cache, used
+// by the file and directory handlers.  The first size limits the memory
+// used by the cache (zero, the default, disables it), and the second is
+// the largest file that will be cached.
+extern int nni_http_server_set_cache(nni_http_server *, size_t, size_t);
+
 // nni_http_server_start starts listening on the supplied port.
 extern int nni_http_server_start(nni_http_server *);
 
@@ -330,8 +330,9 @@ http_entity_copy_data(nni_http_entity *entity, const void *data, size_t size)
 static int
 http_set_content_length(nni_http_entity *entity, nni_list *hdrs)
 {
-	char buf[16];
-	(void) snprintf(buf, sizeof(buf), "%u", (unsigned) entity->size);
+	char buf[24];
+	(void) snprintf(
+	    buf, sizeof(buf), "%llu", (unsigned long long) entity->size);
 	return (http_set_header(hdrs, "Content-Length", buf));
 }
 
@@ -574,6 +574,17 @@ nng_http_handler_set_host(nng_http_handler *h, const char *host)
 #endif
 }
 
+int
+nng_http_handler_set_tree(nng_http_handler *h)
+{
+#ifdef NNG_SUPP_HTTP
+	return (nni_http_handler_set_tree(h));
+#else
+	NNI_ARG_UNUSED(h);
+	return (NNG_ENOTSUP);
+#endif
+}
+
 int
 nng_http_handler_set_data(nng_http_handler *h, void *dat, void (*dtor)(void *))
 {
@@ -676,6 +687,19 @@ nng_http_server_set_tls(nng_http_server *srv, nng_tls_config *cfg)
 #endif
 }
 
+int
+nng_http_server_set_cache(nng_http_server *srv, size_t limit, size_t maxfile)
+{
+#ifdef NNG_SUPP_HTTP
+	return (nni_http_server_set_cache(srv, limit, maxfile));
+#else
+	NNI_ARG_UNUSED(srv);
+	NNI_ARG_UNUSED(limit);
+	NNI_ARG_UNUSED(maxfile);
+	return (NNG_ENOTSUP);
+#endif
+}
+
 int
 nng_http_server_get_tls(nng_http_server *srv, nng_tls_config **cfgp)
 {
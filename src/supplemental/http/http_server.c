@@ -28,8 +28,13 @@ static nni_initializer http_server_initializer = {
 	.i_once = 0,
 };
 
+typedef struct http_route http_route;
+
 struct nng_http_handler {
 	nni_list_node node;
+	nni_list_node rnode; // on the route node for our path
+	http_route *  route;
+	uint64_t      seq; // registration order
 	char *        path;
 	char *        method;
 	char *        host;
@@ -40,6 +45,102 @@ struct nng_http_handler {
 	void (*cb)(nni_aio *);
 };
 
+// Handlers are indexed by path in a radix tree (a trie where chains of
+// nodes with only a single child are collapsed), so that finding the
+// handlers for a request costs time proportional to the length of the
+// path, rather than to the number of handlers.  Each node carries the
+// bytes on the edge leading to it from its parent; the root's edge is
+// empty.  Handlers hang off the node for their path, less any trailing
+// '/' characters.  Children are kept sorted by the first byte of their
+// edge (no two children share one), with those bytes in a parallel
+// array, so that lookup is a binary search.
+//
+// The tree only narrows down the candidates; the full matching rules
+// (for host, method, trailing '/', and trees) are applied to each
+// handler found along the way, exactly as for a list of handlers.
+struct http_route {
+	http_route * parent;
+	char *       prefix; // edge label
+	size_t       plen;
+	nni_list     handlers;
+	http_route **kids;
+	uint8_t *    keys; // first byte of each child's edge
+	size_t       nkids;
+	size_t       kidcap;
+};
+
+#define HTTP_ROUTE_KIDSZ(cap) \
+	((cap) * (sizeof(http_route *) + sizeof(uint8_t)))
+
+// Files are sent a piece at a time, using a buffer no larger than this,
+// so that the memory used by each connection is bounded no matter how
+// large the file is.
+#define HTTP_FILE_CHUNK (64 * 1024)
+
+// http_fbody is a file, or a range of one, that is to be sent as the
+// body of a response, following the header.  Handlers supply one as the
+// second output of their aio.
+typedef struct http_fbody {
+	nni_file_reader *file;
+	uint64_t         off; // file offset of the next byte to send
+	uint64_t         len; // number of bytes still to send
+	uint8_t *        buf;
+	size_t           bufsz;
+} http_fbody;
+
+// The static content cache holds recently served files in memory as
+// complete responses (header and body), so that they can be sent again
+// with a single write, and without allocating anything.  Entries are
+// keyed by file name, are checked against the file's size and
+// modification time on each use, and are evicted least recently used
+// first.  A precompressed copy of the file (the same name with ".gz"
+// appended) is cached alongside it, and sent to clients that accept
+// gzip encoding.
+typedef struct http_cache  http_cache;
+typedef struct http_centry http_centry;
+
+// http_cresp is a cached response.  The header is hlen bytes long, and
+// is followed by the blank line ending the header, and then the body.
+// (This lets us insert a Connection: close header when needed.)
+typedef struct http_cresp {
+	http_centry *entry;
+	uint8_t *    data;
+	size_t       size;
+	size_t       hlen;
+} http_cresp;
+
+// http_cvar is one variant (identity or gzip encoded) of a cached file.
+typedef struct http_cvar {
+	http_cresp ok;     // 200, with the content
+	http_cresp notmod; // 304, for conditional requests
+	char       etag[48];
+	uint64_t   fsize; // size of the file on disk
+	uint64_t   mtime; // modification time of the file on disk
+} http_cvar;
+
+struct http_centry {
+	nni_list_node node;
+	http_centry * next; // for names whose keys collide
+	http_cache *  cache;
+	uint64_t      key;
+	char *        path;
+	char *        gzpath; // NULL if there is no gzip variant
+	http_cvar     plain;
+	http_cvar     gzip;
+	size_t        size; // memory charged against the cache
+	int           refcnt;
+	bool          stale; // no longer in the cache
+};
+
+struct http_cache {
+	nni_mtx     mtx;
+	nni_idhash *hash;
+	nni_list    lru; // most recently used first
+	size_t      size;
+	size_t      limit; // zero disables the cache
+	size_t      maxfile;
+};
+
 typedef struct nni_http_ctx {
 	nni_list_node    node;
 	nni_http_conn *  conn;
@@ -53,6 +154,8 @@ typedef struct nni_http_ctx {
 	nni_aio *        rxaio;
 	nni_aio *        txaio;
 	nni_aio *        txdataio;
+	http_fbody *     fbody; // file body still to be sent
+	http_cresp *     cresp; // cached response being sent
 	nni_reap_item    reap;
 } http_sconn;
 
@@ -62,6 +165,8 @@ struct nng_http_server {
 	int              refcnt;
 	int              starts;
 	nni_list         handlers;
+	http_route       routes; // root of handler index
+	uint64_t         nextseq;
 	nni_list         conns;
 	nni_mtx          mtx;
 	nni_cv           cv;
@@ -71,6 +176,7 @@ struct nng_http_server {
 	nni_plat_tcp_ep *tep;
 	char *           port;
 	char *           hostname;
+	http_cache       cache;
 };
 
 int
@@ -88,6 +194,7 @@ nni_http_handler_init(
 		return (NNG_ENOMEM);
 	}
 	NNI_LIST_NODE_INIT(&h->node);
+	NNI_LIST_NODE_INIT(&h->rnode);
 	h->cb     = cb;
 	h->data   = NULL;
 	h->dtor   = NULL;
@@ -186,9 +293,537 @@ nni_http_handler_set_method(nni_http_handler *h, const char *method)
 	return (0);
 }
 
+// Handler index management.  All of this is done with the server lock
+// held.
+
+// http_route_alloc allocates a new node, with a copy of the (non-empty)
+// edge label.
+static http_route *
+http_route_alloc(const char *prefix, size_t plen)
+{
+	http_route *n;
+
+	if ((n = NNI_ALLOC_STRUCT(n)) == NULL) {
+		return (NULL);
+	}
+	if ((n->prefix = nni_alloc(plen)) == NULL) {
+		NNI_FREE_STRUCT(n);
+		return (NULL);
+	}
+	memcpy(n->prefix, prefix, plen);
+	n->plen = plen;
+	NNI_LIST_INIT(&n->handlers, nni_http_handler, rnode);
+	return (n);
+}
+
+// http_route_fini releases everything below the node, and the node's own
+// edge label, but not the node itself (the root is embedded in the
+// server).  Handlers are not touched.
+static void
+http_route_fini(http_route *n)
+{
+	for (size_t i = 0; i < n->nkids; i++) {
+		http_route_fini(n->kids[i]);
+		NNI_FREE_STRUCT(n->kids[i]);
+	}
+	if (n->kidcap > 0) {
+		nni_free(n->kids, HTTP_ROUTE_KIDSZ(n->kidcap));
+	}
+	if (n->plen > 0) {
+		nni_free(n->prefix, n->plen);
+	}
+	n->kids   = NULL;
+	n->keys   = NULL;
+	n->nkids  = 0;
+	n->kidcap = 0;
+	n->prefix = NULL;
+	n->plen   = 0;
+}
+
+// http_route_find looks for the child whose edge starts with the given
+// byte.  If there is none, the index where it would be inserted is
+// returned through idxp.
+static http_route *
+http_route_find(http_route *n, uint8_t b, size_t *idxp)
+{
+	size_t lo = 0;
+	size_t hi = n->nkids;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (n->keys[mid] == b) {
+			*idxp = mid;
+			return (n->kids[mid]);
+		}
+		if (n->keys[mid] < b) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*idxp = lo;
+	return (NULL);
+}
+
+static int
+http_route_grow(http_route *n, size_t cap)
+{
+	http_route **kids;
+	uint8_t *    keys;
+
+	if ((kids = nni_alloc(HTTP_ROUTE_KIDSZ(cap))) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	keys = (uint8_t *) (kids + cap);
+	if (n->kidcap > 0) {
+		memcpy(kids, n->kids, n->nkids * sizeof(http_route *));
+		memcpy(keys, n->keys, n->nkids);
+		nni_free(n->kids, HTTP_ROUTE_KIDSZ(n->kidcap));
+	}
+	n->kids   = kids;
+	n->keys   = keys;
+	n->kidcap = cap;
+	return (0);
+}
+
+static int
+http_route_add(http_route *n, http_route *k, size_t idx)
+{
+	int rv;
+
+	if ((n->nkids == n->kidcap) &&
+	    ((rv = http_route_grow(n, n->kidcap ? n->kidcap * 2 : 2)) != 0)) {
+		return (rv);
+	}
+	memmove(&n->kids[idx + 1], &n->kids[idx],
+	    (n->nkids - idx) * sizeof(http_route *));
+	memmove(&n->keys[idx + 1], &n->keys[idx], n->nkids - idx);
+	n->kids[idx] = k;
+	n->keys[idx] = (uint8_t) k->prefix[0];
+	n->nkids++;
+	k->parent = n;
+	return (0);
+}
+
+static void
+http_route_del(http_route *n, size_t idx)
+{
+	n->nkids--;
+	memmove(&n->kids[idx], &n->kids[idx + 1],
+	    (n->nkids - idx) * sizeof(http_route *));
+	memmove(&n->keys[idx], &n->keys[idx + 1], n->nkids - idx);
+}
+
+// http_route_split splits the edge leading to node k (the child of n at
+// index idx) after the first len bytes, by inserting a new node there.
+// The new node is returned.
+static http_route *
+http_route_split(http_route *n, size_t idx, size_t len)
+{
+	http_route *k = n->kids[idx];
+	http_route *mid;
+	char *      rest;
+	size_t      rlen = k->plen - len;
+
+	if ((mid = http_route_alloc(k->prefix, len)) == NULL) {
+		return (NULL);
+	}
+	if (http_route_grow(mid, 2) != 0) {
+		http_route_fini(mid);
+		NNI_FREE_STRUCT(mid);
+		return (NULL);
+	}
+	if ((rest = nni_alloc(rlen)) == NULL) {
+		http_route_fini(mid);
+		NNI_FREE_STRUCT(mid);
+		return (NULL);
+	}
+	memcpy(rest, k->prefix + len, rlen);
+	nni_free(k->prefix, k->plen);
+	k->prefix = rest;
+	k->plen   = rlen;
+
+	mid->kids[0] = k;
+	mid->keys[0] = (uint8_t) rest[0];
+	mid->nkids   = 1;
+	mid->parent  = n;
+	k->parent    = mid;
+	n->kids[idx] = mid;
+	return (mid);
+}
+
+// http_route_insert finds the node for the given key, creating it if
+// necessary.
+static int
+http_route_insert(
+    http_route *n, const char *key, size_t len, http_route **np)
+{
+	for (;;) {
+		http_route *k;
+		size_t      idx;
+		size_t      i;
+		int         rv;
+
+		if (len == 0) {
+			*np = n;
+			return (0);
+		}
+		if ((k = http_route_find(n, (uint8_t) key[0], &idx)) == NULL) {
+			if ((k = http_route_alloc(key, len)) == NULL) {
+				return (NNG_ENOMEM);
+			}
+			if ((rv = http_route_add(n, k, idx)) != 0) {
+				http_route_fini(k);
+				NNI_FREE_STRUCT(k);
+				return (rv);
+			}
+			*np = k;
+			return (0);
+		}
+		for (i = 1; (i < k->plen) && (i < len); i++) {
+			if (k->prefix[i] != key[i]) {
+				break;
+			}
+		}
+		if ((i < k->plen) &&
+		    ((k = http_route_split(n, idx, i)) == NULL)) {
+			return (NNG_ENOMEM);
+		}
+		n   = k;
+		key += i;
+		len -= i;
+	}
+}
+
+// http_route_prune removes the node if nothing is registered at or below
+// it any longer, and works back up the tree doing the same.  A node left
+// with only a single child is merged with it, to keep the tree compact.
+// If we can't get the memory for that, the tree is still correct, just a
+// little less tidy.
+static void
+http_route_prune(http_route *root, http_route *n)
+{
+	http_route *k;
+	size_t      idx;
+
+	while ((n != root) && nni_list_empty(&n->handlers) &&
+	    (n->nkids == 0)) {
+		http_route *p = n->parent;
+
+		(void) http_route_find(p, (uint8_t) n->prefix[0], &idx);
+		http_route_del(p, idx);
+		http_route_fini(n);
+		NNI_FREE_STRUCT(n);
+		n = p;
+	}
+	if ((n != root) && nni_list_empty(&n->handlers) && (n->nkids == 1)) {
+		http_route *p = n->parent;
+		char *      pfx;
+		size_t      plen;
+
+		k    = n->kids[0];
+		plen = n->plen + k->plen;
+		if ((pfx = nni_alloc(plen)) != NULL) {
+			memcpy(pfx, n->prefix, n->plen);
+			memcpy(pfx + n->plen, k->prefix, k->plen);
+			nni_free(k->prefix, k->plen);
+			k->prefix = pfx;
+			k->plen   = plen;
+
+			(void) http_route_find(p, (uint8_t) pfx[0], &idx);
+			p->kids[idx] = k;
+			k->parent    = p;
+			n->nkids     = 0;
+			http_route_fini(n);
+			NNI_FREE_STRUCT(n);
+		}
+	}
+}
+
+// http_path_keylen returns the length of the path, less any trailing
+// '/' characters.  This is the key for the handler index.
+static size_t
+http_path_keylen(const char *path)
+{
+	size_t len = strlen(path);
+
+	while ((len > 0) && (path[len - 1] == '/')) {
+		len--;
+	}
+	return (len);
+}
+
+enum http_match {
+	HTTP_MATCH_NONE,
+	HTTP_MATCH_METHOD, // everything but the method
+	HTTP_MATCH_HEAD,   // GET handler, usable for HEAD
+	HTTP_MATCH_FULL,
+};
+
+// http_handler_match checks whether the handler is suitable for a request
+// with the given host (which may be NULL), canonical path, and method.
+static enum http_match
+http_handler_match(nni_http_handler *h, const char *host, const char *path,
+    const char *method)
+{
+	size_t len;
+
+	if (h->host != NULL) {
+		if (host == NULL) {
+			// HTTP/1.0 cannot access virtual hosts.
+			return (HTTP_MATCH_NONE);
+		}
+
+		len = strlen(h->host);
+		if ((nni_strncasecmp(host, h->host, len) != 0)) {
+			return (HTTP_MATCH_NONE);
+		}
+
+		// At least the first part matches.  If the ending
+		// part is a lone "." (legal in DNS), or a port
+		// number, we match it.  (We do not validate the
+		// port number.)  Note that there may be false matches
+		// with IPv6 addresses, but addresses shouldn't be
+		// used with virtual hosts anyway.  With both addresses
+		// and ports, a false match would be unlikely since
+		// they'd still have to *connect* using that info.
+		if ((host[len] != '\0') && (host[len] != ':') &&
+		    ((host[len] != '.') || (host[len + 1] != '\0'))) {
+			return (HTTP_MATCH_NONE);
+		}
+	}
+
+	len = strlen(h->path);
+	if (strncmp(path, h->path, len) != 0) {
+		return (HTTP_MATCH_NONE);
+	}
+	switch (path[len]) {
+	case '\0':
+		break;
+	case '/':
+		if ((path[len + 1] != '\0') && (!h->tree)) {
+			// Trailing component and not a directory.
+			return (HTTP_MATCH_NONE);
+		}
+		break;
+	default:
+		return (HTTP_MATCH_NONE); // Some other substring, not matched.
+	}
+
+	if ((h->method == NULL) || (h->method[0] == '\0')) {
+		// Handler wants to process *all* methods.
+		return (HTTP_MATCH_FULL);
+	}
+	// So, what about the method?
+	if (strcmp(method, h->method) == 0) {
+		return (HTTP_MATCH_FULL);
+	}
+	// HEAD is remapped to GET, but only if no HEAD specific
+	// handler registered.
+	if ((strcmp(method, "HEAD") == 0) && (strcmp(h->method, "GET") == 0)) {
+		return (HTTP_MATCH_HEAD);
+	}
+	return (HTTP_MATCH_METHOD);
+}
+
+// http_handler_conflict checks whether two handlers would claim some of
+// the same requests.  The length is that of the first handler's path,
+// less trailing '/' characters.
+static bool
+http_handler_conflict(nni_http_handler *h, size_t len, nni_http_handler *h2)
+{
+	size_t len2;
+
+	// General rule for finding a conflict is that if either string
+	// is a strict substring of the other, then we have a
+	// collision.  (But only if the methods match, and the host
+	// matches.)  Note that a wild card host matches both.
+	if ((h2->host != NULL) && (h->host != NULL) &&
+	    (nni_strcasecmp(h2->host, h->host) != 0)) {
+		// Hosts don't match, so we are safe.
+		return (false);
+	}
+	if (((h2->host == NULL) && (h->host != NULL)) ||
+	    ((h->host == NULL) && (h2->host != NULL))) {
+		return (false); // Host specified for just one.
+	}
+	if (((h->method == NULL) && (h2->method != NULL)) ||
+	    ((h2->method == NULL) && (h->method != NULL))) {
+		return (false); // Method specified for just one.
+	}
+	if ((h->method != NULL) && (strcmp(h2->method, h->method) != 0)) {
+		// Different methods, so again we are fine.
+		return (false);
+	}
+
+	len2 = http_path_keylen(h2->path);
+	if (strncmp(h->path, h2->path, len > len2 ? len2 : len) != 0) {
+		return (false); // prefixes don't match.
+	}
+
+	if (len2 > len) {
+		return ((h2->path[len] == '/') && (h->tree));
+	}
+	if (len > len2) {
+		return ((h->path[len2] == '/') && (h2->tree));
+	}
+	return (true);
+}
+
+// http_route_conflict checks the handlers at and below the node for
+// conflicts with the handler.
+static bool
+http_route_conflict(http_route *n, nni_http_handler *h, size_t len)
+{
+	nni_http_handler *h2;
+
+	NNI_LIST_FOREACH (&n->handlers, h2) {
+		if (http_handler_conflict(h, len, h2)) {
+			return (true);
+		}
+	}
+	for (size_t i = 0; i < n->nkids; i++) {
+		if (http_route_conflict(n->kids[i], h, len)) {
+			return (true);
+		}
+	}
+	return (false);
+}
+
 static nni_list http_servers;
 static nni_mtx  http_servers_lk;
 
+static void
+http_fbody_free(http_fbody *fb)
+{
+	if (fb != NULL) {
+		if (fb->file != NULL) {
+			nni_file_close(fb->file);
+		}
+		if (fb->buf != NULL) {
+			nni_free(fb->buf, fb->bufsz);
+		}
+		NNI_FREE_STRUCT(fb);
+	}
+}
+
+static void
+http_centry_free(http_centry *e)
+{
+	http_cvar *vars[2] = { &e->plain, &e->gzip };
+
+	for (int i = 0; i < 2; i++) {
+		if (vars[i]->ok.data != NULL) {
+			nni_free(vars[i]->ok.data, vars[i]->ok.size);
+		}
+		if (vars[i]->notmod.data != NULL) {
+			nni_free(vars[i]->notmod.data, vars[i]->notmod.size);
+		}
+	}
+	nni_strfree(e->path);
+	nni_strfree(e->gzpath);
+	NNI_FREE_STRUCT(e);
+}
+
+// http_cache_key hashes a file name (FNV-1a) to find it in the cache.
+static uint64_t
+http_cache_key(const char *path)
+{
+	uint64_t key = 14695981039346656037ULL;
+
+	while (*path != '\0') {
+		key ^= (uint8_t) *path++;
+		key *= 1099511628211ULL;
+	}
+	return (key);
+}
+
+static http_centry *
+http_cache_find(http_cache *c, uint64_t key, const char *path)
+{
+	http_centry *e;
+
+	if (nni_idhash_find(c->hash, key, (void **) &e) != 0) {
+		return (NULL);
+	}
+	while ((e != NULL) && (strcmp(e->path, path) != 0)) {
+		e = e->next;
+	}
+	return (e);
+}
+
+// http_cache_remove removes the entry from the cache.  It is freed
+// once the last response using it has been sent.  Cache lock held.
+static void
+http_cache_remove(http_cache *c, http_centry *e)
+{
+	http_centry *head = NULL;
+
+	if ((nni_idhash_find(c->hash, e->key, (void **) &head) == 0) &&
+	    (head == e)) {
+		(void) nni_idhash_remove(c->hash, e->key);
+		if ((e->next != NULL) &&
+		    (nni_idhash_insert(c->hash, e->key, e->next) != 0)) {
+			// Out of memory; drop the others from the cache too.
+			head = e->next;
+			e->next = NULL;
+			while (head != NULL) {
+				http_centry *next = head->next;
+				head->next        = NULL;
+				http_cache_remove(c, head);
+				head = next;
+			}
+		}
+	} else {
+		while ((head != NULL) && (head->next != e)) {
+			head = head->next;
+		}
+		if (head != NULL) {
+			head->next = e->next;
+		}
+	}
+	e->next  = NULL;
+	e->stale = true;
+	nni_list_remove(&c->lru, e);
+	c->size -= e->size;
+	if (e->refcnt == 0) {
+		http_centry_free(e);
+	}
+}
+
+// http_cache_trim evicts entries, least recently used first, until the
+// cache fits within its limit, less the given room.  Cache lock held.
+static void
+http_cache_trim(http_cache *c, size_t room)
+{
+	http_centry *e;
+
+	while (((c->size + room) > c->limit) &&
+	    ((e = nni_list_last(&c->lru)) != NULL)) {
+		http_cache_remove(c, e);
+	}
+}
+
+static void
+http_cresp_release(http_cresp *cr)
+{
+	http_centry *e;
+	http_cache * c;
+
+	if (cr == NULL) {
+		return;
+	}
+	e = cr->entry;
+	c = e->cache;
+	nni_mtx_lock(&c->mtx);
+	e->refcnt--;
+	if ((e->refcnt == 0) && (e->stale)) {
+		http_centry_free(e);
+	}
+	nni_mtx_unlock(&c->mtx);
+}
+
 static void
 http_sconn_reap(void *arg)
 {
@@ -210,6 +845,8 @@ http_sconn_reap(void *arg)
 	if (sc->res != NULL) {
 		nni_http_res_free(sc->res);
 	}
+	http_fbody_free(sc->fbody);
+	http_cresp_release(sc->cresp);
 	nni_aio_fini(sc->rxaio);
 	nni_aio_fini(sc->txaio);
 	nni_aio_fini(sc->txdataio);
@@ -267,6 +904,65 @@ http_sconn_close(http_sconn *sc)
 	nni_mtx_unlock(&s->mtx);
 }
 
+// http_sconn_send_file sends the next piece of the file body.  The file
+// is read synchronously; reads of local files are not expected to block
+// for long, and this keeps only one buffer per connection.
+static void
+http_sconn_send_file(http_sconn *sc)
+{
+	http_fbody *fb = sc->fbody;
+	size_t      n;
+	nni_iov     iov;
+
+	n = fb->len < fb->bufsz ? (size_t) fb->len : fb->bufsz;
+	if ((nni_file_read(fb->file, fb->buf, n, fb->off, &n) != 0) ||
+	    (n == 0)) {
+		// The file was truncated underneath us, or failed.  We have
+		// already promised a length, so all we can do is close.
+		http_sconn_close(sc);
+		return;
+	}
+	fb->off += n;
+	fb->len -= n;
+	iov.iov_buf = fb->buf;
+	iov.iov_len = n;
+	nni_aio_set_iov(sc->txdataio, 1, &iov);
+	nni_http_write_full(sc->conn, sc->txdataio);
+}
+
+// http_sconn_send_cached sends a response from the cache.  This is
+// normally a single write straight from the cache; a Connection: close
+// header is spliced in ahead of the end of the header if needed.
+static void
+http_sconn_send_cached(http_sconn *sc, http_cresp *cr)
+{
+	static char close_hdr[] = "Connection: close\r\n";
+	nni_iov     iov[3];
+	unsigned    niov;
+	size_t      len;
+
+	len = cr->size;
+	if (strcmp(nni_http_req_get_method(sc->req), "HEAD") == 0) {
+		len = cr->hlen + 2;
+	}
+	if (sc->close) {
+		iov[0].iov_buf = cr->data;
+		iov[0].iov_len = cr->hlen;
+		iov[1].iov_buf = close_hdr;
+		iov[1].iov_len = sizeof(close_hdr) - 1;
+		iov[2].iov_buf = cr->data + cr->hlen;
+		iov[2].iov_len = len - cr->hlen;
+		niov           = 3;
+	} else {
+		iov[0].iov_buf = cr->data;
+		iov[0].iov_len = len;
+		niov           = 1;
+	}
+	sc->cresp = cr;
+	nni_aio_set_iov(sc->txdataio, niov, iov);
+	nni_http_write_full(sc->conn, sc->txdataio);
+}
+
 static void
 http_sconn_txdatdone(void *arg)
 {
@@ -278,6 +974,19 @@ http_sconn_txdatdone(void *arg)
 		return;
 	}
 
+	if (sc->fbody != NULL) {
+		if (sc->fbody->len > 0) {
+			http_sconn_send_file(sc);
+			return;
+		}
+		http_fbody_free(sc->fbody);
+		sc->fbody = NULL;
+	}
+	if (sc->cresp != NULL) {
+		http_cresp_release(sc->cresp);
+		sc->cresp = NULL;
+	}
+
 	if (sc->res != NULL) {
 		nni_http_res_free(sc->res);
 		sc->res = NULL;
@@ -303,6 +1012,12 @@ http_sconn_txdone(void *arg)
 		return;
 	}
 
+	// The header is out; now send the body from the file.
+	if (sc->fbody != NULL) {
+		http_sconn_send_file(sc);
+		return;
+	}
+
 	if (sc->close) {
 		http_sconn_close(sc);
 		return;
@@ -439,10 +1154,14 @@ http_sconn_rxdone(void *arg)
 	int               rv;
 	nni_http_handler *h    = NULL;
 	nni_http_handler *head = NULL;
+	http_route *      n;
+	const char *      key;
+	const char *      method;
 	const char *      val;
 	nni_http_req *    req = sc->req;
 	char *            uri;
 	size_t            urisz;
+	char              uribuf[256];
 	char *            path;
 	bool              badmeth  = false;
 	bool              needhost = false;
@@ -490,7 +1209,9 @@ http_sconn_rxdone(void *arg)
 
 	val   = nni_http_req_get_uri(req);
 	urisz = strlen(val) + 1;
-	if ((uri = nni_alloc(urisz)) == NULL) {
+	if (urisz <= sizeof(uribuf)) {
+		uri = uribuf;
+	} else if ((uri = nni_alloc(urisz)) == NULL) {
 		http_sconn_close(sc); // out of memory
 		return;
 	}
@@ -501,78 +1222,57 @@ http_sconn_rxdone(void *arg)
 	if ((host == NULL) && (needhost)) {
 		// Per RFC 2616 14.23 we have to send 400 status here.
 		http_sconn_error(sc, NNG_HTTP_STATUS_BAD_REQUEST);
-		nni_free(uri, urisz);
+		if (uri != uribuf) {
+			nni_free(uri, urisz);
+		}
 		return;
 	}
 
+	// Walk down the handler index, following the path.  Every node we
+	// pass holds handlers for a leading part of the path; the first
+	// registered that fully matches wins.  Failing that, the last GET
+	// handler registered can serve HEAD.
+	method = nni_http_req_get_method(req);
 	nni_mtx_lock(&s->mtx);
-	NNI_LIST_FOREACH (&s->handlers, h) {
-		size_t len;
-		if (h->host != NULL) {
-			if (host == NULL) {
-				// HTTP/1.0 cannot access virtual hosts.
-				continue;
+	n   = &s->routes;
+	key = path;
+	for (;;) {
+		nni_http_handler *h2;
+		size_t            idx;
+
+		NNI_LIST_FOREACH (&n->handlers, h2) {
+			switch (http_handler_match(h2, host, path, method)) {
+			case HTTP_MATCH_FULL:
+				if ((h == NULL) || (h2->seq < h->seq)) {
+					h = h2;
+				}
+				break;
+			case HTTP_MATCH_HEAD:
+				if ((head == NULL) || (h2->seq > head->seq)) {
+					head = h2;
+				}
+				break;
+			case HTTP_MATCH_METHOD:
+				badmeth = true;
+				break;
+			default:
+				break;
 			}
-
-			len = strlen(h->host);
-			if ((nni_strncasecmp(host, h->host, len) != 0)) {
-				continue;
-			}
-
-			// At least the first part matches.  If the ending
-			// part is a lone "." (legal in DNS), or a port
-			// number, we match it.  (We do not validate the
-			// port number.)  Note that there may be false matches
-			// with IPv6 addresses, but addresses shouldn't be
-			// used with virtual hosts anyway.  With both addresses
-			// and ports, a false match would be unlikely since
-			// they'd still have to *connect* using that info.
-			if ((host[len] != '\0') && (host[len] != ':') &&
-			    ((host[len] != '.') || (host[len + 1] != '\0'))) {
-				continue;
-			}
-		}
-
-		len = strlen(h->path);
-		if (strncmp(path, h->path, len) != 0) {
-			continue;
 		}
-		switch (path[len]) {
-		case '\0':
+		if ((*key == '\0') ||
+		    ((n = http_route_find(n, (uint8_t) *key, &idx)) == NULL) ||
+		    (strncmp(key, n->prefix, n->plen) != 0)) {
 			break;
-		case '/':
-			if ((path[len + 1] != '\0') && (!h->tree)) {
-				// Trailing component and not a directory.
-				continue;
-			}
-			break;
-		default:
-			continue; // Some other substring, not matched.
 		}
-
-		if ((h->method == NULL) || (h->method[0] == '\0')) {
-			// Handler wants to process *all* methods.
-			break;
-		}
-		// So, what about the method?
-		val = nni_http_req_get_method(req);
-		if (strcmp(val, h->method) == 0) {
-			break;
-		}
-		// HEAD is remapped to GET, but only if no HEAD specific
-		// handler registered.
-		if ((strcmp(val, "HEAD") == 0) &&
-		    (strcmp(h->method, "GET") == 0)) {
-			head = h;
-			continue;
-		}
-		badmeth = 1;
+		key += n->plen;
 	}
 
 	if ((h == NULL) && (head != NULL)) {
 		h = head;
 	}
-	nni_free(uri, urisz);
+	if (uri != uribuf) {
+		nni_free(uri, urisz);
+	}
 	if (h == NULL) {
 		nni_mtx_unlock(&s->mtx);
 		if (badmeth) {
@@ -607,6 +1307,8 @@ http_sconn_cbdone(void *arg)
 	http_sconn *      sc  = arg;
 	nni_aio *         aio = sc->cbaio;
 	nni_http_res *    res;
+	http_fbody *      fb;
+	http_cresp *      cr;
 	nni_http_handler *h;
 	nni_http_server * s = sc->server;
 
@@ -618,6 +1320,8 @@ http_sconn_cbdone(void *arg)
 
 	h   = nni_aio_get_data(aio, 1);
 	res = nni_aio_get_output(aio, 0);
+	fb  = nni_aio_get_output(aio, 1);
+	cr  = nni_aio_get_output(aio, 2);
 
 	nni_mtx_lock(&s->mtx);
 	h->refcnt--;
@@ -632,9 +1336,20 @@ http_sconn_cbdone(void *arg)
 	if (sc->conn == NULL) {
 		// If this happens, then the session was hijacked.
 		// We close the context, but the http channel stays up.
+		http_fbody_free(fb);
+		http_cresp_release(cr);
 		http_sconn_close(sc);
 		return;
 	}
+	if (cr != NULL) {
+		http_sconn_send_cached(sc, cr);
+		return;
+	}
+	if ((res == NULL) ||
+	    (strcmp(nni_http_req_get_method(sc->req), "HEAD") == 0)) {
+		http_fbody_free(fb);
+		fb = NULL;
+	}
 	if (res != NULL) {
 		const char *val;
 		val = nni_http_res_get_header(res, "Connection");
@@ -655,6 +1370,7 @@ http_sconn_cbdone(void *arg)
 			nni_http_res_get_data(res, &data, &size);
 			nni_http_res_set_data(res, NULL, size);
 		}
+		sc->fbody = fb;
 		nni_http_write_res(sc->conn, res, sc->txaio);
 	} else if (sc->close) {
 		http_sconn_close(sc);
@@ -758,10 +1474,21 @@ http_server_fini(nni_http_server *s)
 	}
 	while ((h = nni_list_first(&s->handlers)) != NULL) {
 		nni_list_remove(&s->handlers, h);
+		nni_list_remove(&h->route->handlers, h);
+		h->route = NULL;
 		h->refcnt--;
 		nni_http_handler_fini(h);
 	}
+	http_route_fini(&s->routes);
 	nni_mtx_unlock(&s->mtx);
+	if (s->cache.hash != NULL) {
+		nni_mtx_lock(&s->cache.mtx);
+		s->cache.limit = 0;
+		http_cache_trim(&s->cache, 0);
+		nni_mtx_unlock(&s->cache.mtx);
+		nni_idhash_fini(s->cache.hash);
+	}
+	nni_mtx_fini(&s->cache.mtx);
 #ifdef NNG_SUPP_TLS
 	if (s->tls != NULL) {
 		nni_tls_config_fini(s->tls);
@@ -808,8 +1535,12 @@ http_server_init(nni_http_server **serverp, const nni_url *url)
 	nni_mtx_init(&s->mtx);
 	nni_cv_init(&s->cv, &s->mtx);
 	NNI_LIST_INIT(&s->handlers, nni_http_handler, node);
+	NNI_LIST_INIT(&s->routes.handlers, nni_http_handler, rnode);
 	NNI_LIST_INIT(&s->conns, http_sconn, node);
-	if ((rv = nni_aio_init(&s->accaio, http_server_acccb, s)) != 0) {
+	nni_mtx_init(&s->cache.mtx);
+	NNI_LIST_INIT(&s->cache.lru, http_centry, node);
+	if (((rv = nni_idhash_init(&s->cache.hash)) != 0) ||
+	    ((rv = nni_aio_init(&s->accaio, http_server_acccb, s)) != 0)) {
 		http_server_fini(s);
 		return (rv);
 	}
@@ -958,71 +1689,84 @@ int
 nni_http_server_add_handler(nni_http_server *s, nni_http_handler *h)
 {
 	nni_http_handler *h2;
+	http_route *      n;
+	http_route *      k;
+	const char *      key;
 	size_t            len;
+	size_t            rem;
+	size_t            idx;
+	int               rv;
 
 	// Must have a legal method (and not one that is HEAD), path,
 	// and handler.  (The reason HEAD is verboten is that we supply
 	// it automatically as part of GET support.)
-	if (((len = strlen(h->path)) == 0) || (h->path[0] != '/') ||
-	    (h->cb == NULL)) {
+	if ((strlen(h->path) == 0) || (h->path[0] != '/') || (h->cb == NULL)) {
 		return (NNG_EINVAL);
 	}
-	while ((len > 0) && (h->path[len - 1] == '/')) {
-		len--; // ignore trailing '/' (this collapses them)
-	}
+	len = http_path_keylen(h->path); // ignore trailing '/'
 
 	nni_mtx_lock(&s->mtx);
-	// General rule for finding a conflict is that if either string
-	// is a strict substring of the other, then we have a
-	// collision.  (But only if the methods match, and the host
-	// matches.)  Note that a wild card host matches both.
-	NNI_LIST_FOREACH (&s->handlers, h2) {
-		size_t len2;
-
-		if ((h2->host != NULL) && (h->host != NULL) &&
-		    (nni_strcasecmp(h2->host, h->host) != 0)) {
-			// Hosts don't match, so we are safe.
-			continue;
-		}
-		if (((h2->host == NULL) && (h->host != NULL)) ||
-		    ((h->host == NULL) && (h2->host != NULL))) {
-			continue; // Host specified for just one.
-		}
-		if (((h->method == NULL) && (h2->method != NULL)) ||
-		    ((h2->method == NULL) && (h->method != NULL))) {
-			continue; // Method specified for just one.
-		}
-		if ((h->method != NULL) &&
-		    (strcmp(h2->method, h->method) != 0)) {
-			// Different methods, so again we are fine.
-			continue;
-		}
-
-		len2 = strlen(h2->path);
-
-		while ((len2 > 0) && (h2->path[len2 - 1] == '/')) {
-			len2--; // ignore trailing '/'
-		}
-		if (strncmp(h->path, h2->path, len > len2 ? len2 : len) != 0) {
-			continue; // prefixes don't match.
-		}
 
-		if (len2 > len) {
-			if ((h2->path[len] == '/') && (h->tree)) {
+	// Any handler registered for a leading part of our path (or for
+	// the same path) might conflict with us, so check each of those
+	// on the way down.
+	n   = &s->routes;
+	key = h->path;
+	rem = len;
+	for (;;) {
+		NNI_LIST_FOREACH (&n->handlers, h2) {
+			if (http_handler_conflict(h, len, h2)) {
 				nni_mtx_unlock(&s->mtx);
 				return (NNG_EADDRINUSE);
 			}
-		} else if (len > len2) {
-			if ((h->path[len2] == '/') && (h2->tree)) {
-				nni_mtx_unlock(&s->mtx);
-				return (NNG_EADDRINUSE);
+		}
+		if (rem == 0) {
+			break;
+		}
+		k = http_route_find(n, (uint8_t) key[0], &idx);
+		if ((k == NULL) || (k->plen > rem) ||
+		    (memcmp(k->prefix, key, k->plen) != 0)) {
+			// We have no node yet.  Longer paths can still
+			// be below an edge that starts with the rest of ours.
+			if ((k != NULL) && (k->plen > rem) &&
+			    (memcmp(k->prefix, key, rem) == 0)) {
+				n = k;
+			} else {
+				n = NULL;
 			}
+			break;
+		}
+		n = k;
+		key += k->plen;
+		rem -= k->plen;
+	}
+
+	// If we are a tree, then handlers for longer paths below ours
+	// conflict as well.
+	if ((n != NULL) && (h->tree)) {
+		bool conflict = false;
+		if (rem > 0) {
+			conflict = http_route_conflict(n, h, len);
 		} else {
+			for (idx = 0; (idx < n->nkids) && (!conflict); idx++) {
+				conflict =
+				    http_route_conflict(n->kids[idx], h, len);
+			}
+		}
+		if (conflict) {
 			nni_mtx_unlock(&s->mtx);
 			return (NNG_EADDRINUSE);
 		}
 	}
+
+	if ((rv = http_route_insert(&s->routes, h->path, len, &n)) != 0) {
+		nni_mtx_unlock(&s->mtx);
+		return (rv);
+	}
 	h->refcnt = 1;
+	h->route  = n;
+	h->seq    = s->nextseq++;
+	nni_list_append(&n->handlers, h);
 	nni_list_append(&s->handlers, h);
 	nni_mtx_unlock(&s->mtx);
 	return (0);
@@ -1031,19 +1775,28 @@ nni_http_server_add_handler(nni_http_server *s, nni_http_handler *h)
 int
 nni_http_server_del_handler(nni_http_server *s, nni_http_handler *h)
 {
-	int               rv = NNG_ENOENT;
-	nni_http_handler *srch;
+	http_route *n;
+
 	nni_mtx_lock(&s->mtx);
-	NNI_LIST_FOREACH (&s->handlers, srch) {
-		if (srch == h) {
-			nni_list_remove(&s->handlers, h);
-			h->refcnt--;
-			rv = 0;
-			break;
-		}
+	// Make sure that the handler is registered with this server.
+	if ((n = h->route) == NULL) {
+		nni_mtx_unlock(&s->mtx);
+		return (NNG_ENOENT);
 	}
+	while (n->parent != NULL) {
+		n = n->parent;
+	}
+	if (n != &s->routes) {
+		nni_mtx_unlock(&s->mtx);
+		return (NNG_ENOENT);
+	}
+	nni_list_remove(&s->handlers, h);
+	nni_list_remove(&h->route->handlers, h);
+	http_route_prune(&s->routes, h->route);
+	h->route = NULL;
+	h->refcnt--;
 	nni_mtx_unlock(&s->mtx);
-	return (rv);
+	return (0);
 }
 
 // Very limited MIME type map.  Used only if the handler does not
@@ -1109,43 +1862,581 @@ typedef struct http_file {
 	char *ctype;
 } http_file;
 
+static const char *http_wdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
+	"Fri", "Sat" };
+
+static const char *http_months[] = { "Jan", "Feb", "Mar", "Apr", "May",
+	"Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// http_format_date formats a time (seconds since the UNIX epoch) as an
+// HTTP date (RFC 7231 IMF-fixdate).  We do the calendar arithmetic
+// ourselves (using the well known days-from-civil algorithm), as gmtime()
+// is not thread safe, and its safe variants vary by platform.
 static void
-http_handle_file(nni_aio *aio)
+http_format_date(uint64_t t, char *buf, size_t sz)
 {
-	nni_http_handler *h   = nni_aio_get_input(aio, 1);
-	nni_http_res *    res = NULL;
-	void *            data;
-	size_t            size;
-	int               rv;
-	http_file *       hf = nni_http_handler_get_data(h);
-	const char *      ctype;
+	uint64_t days = t / 86400;
+	uint64_t secs = t % 86400;
+	uint64_t z    = days + 719468;
+	uint64_t era  = z / 146097;
+	uint64_t doe  = z - era * 146097;
+	uint64_t yoe  = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	uint64_t doy  = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	uint64_t mp   = (5 * doy + 2) / 153;
+	unsigned mday = (unsigned) (doy - (153 * mp + 2) / 5 + 1);
+	unsigned mon  = (unsigned) (mp < 10 ? mp + 2 : mp - 10); // 0 = Jan
+	unsigned year = (unsigned) (yoe + era * 400 + (mon < 2 ? 1 : 0));
+
+	(void) snprintf(buf, sz, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+	    http_wdays[(days + 4) % 7], mday, http_months[mon], year,
+	    (unsigned) (secs / 3600), (unsigned) ((secs / 60) % 60),
+	    (unsigned) (secs % 60));
+}
 
-	if ((ctype = hf->ctype) == NULL) {
-		ctype = "application/octet-stream";
+// http_parse_date parses an HTTP date, as formatted by http_format_date.
+// (The obsolete RFC 850 and asctime() forms are not understood; clients
+// send back the value we gave them, so they are not needed here.)
+static bool
+http_parse_date(const char *s, uint64_t *tp)
+{
+	char     wday[4];
+	char     mname[4];
+	unsigned mday, year, hh, mm, ss;
+	int      mon;
+	uint64_t y, era, yoe, doy, doe;
+
+	if ((sscanf(s, "%3s, %u %3s %u %u:%u:%u GMT", wday, &mday, mname,
+	         &year, &hh, &mm, &ss) != 7) ||
+	    (year < 1970) || (mday < 1) || (mday > 31) || (hh > 23) ||
+	    (mm > 59) || (ss > 60)) {
+		return (false);
+	}
+	for (mon = 0; mon < 12; mon++) {
+		if (strcmp(mname, http_months[mon]) == 0) {
+			break;
+		}
+	}
+	if (mon == 12) {
+		return (false);
 	}
+	y   = year - (mon < 2 ? 1 : 0);
+	era = y / 400;
+	yoe = y - era * 400;
+	doy = (153 * (mon < 2 ? mon + 10 : mon - 2) + 2) / 5 + mday - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	*tp = (era * 146097 + doe - 719468) * 86400 + hh * 3600 + mm * 60 + ss;
+	return (true);
+}
 
-	// This is a very simplistic file server, suitable only for small
-	// files.  In the future we can use an AIO based file read, where
-	// we read files a bit at a time, or even mmap them, and serve
-	// them up chunkwise.  Applications could even come up with their own
-	// caching version of the http handler.
-	if ((rv = nni_file_get(hf->path, &data, &size)) != 0) {
-		uint16_t status;
-		switch (rv) {
-		case NNG_ENOMEM:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
-		case NNG_ENOENT:
-			status = NNG_HTTP_STATUS_NOT_FOUND;
-			break;
-		case NNG_EPERM:
-			status = NNG_HTTP_STATUS_FORBIDDEN;
-			break;
-		default:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
+// http_etag_match checks if the entity tag is present in the list of
+// tags from an If-None-Match header.  This uses weak comparison, as
+// required for If-None-Match.
+static bool
+http_etag_match(const char *list, const char *etag)
+{
+	size_t len = strlen(etag);
+
+	while (*list != '\0') {
+		while ((*list == ' ') || (*list == ',')) {
+			list++;
+		}
+		if (*list == '*') {
+			return (true);
+		}
+		if (strncmp(list, "W/", 2) == 0) {
+			list += 2;
 		}
-		if ((rv = nni_http_res_alloc_error(&res, status)) != 0) {
+		if ((strncmp(list, etag, len) == 0) &&
+		    ((list[len] == '\0') || (list[len] == ',') ||
+		        (list[len] == ' '))) {
+			return (true);
+		}
+		while ((*list != '\0') && (*list != ',')) {
+			list++;
+		}
+	}
+	return (false);
+}
+
+static bool
+http_parse_u64(const char **sp, uint64_t *vp)
+{
+	const char *s = *sp;
+	uint64_t    v = 0;
+
+	if (!isdigit((unsigned char) *s)) {
+		return (false);
+	}
+	while (isdigit((unsigned char) *s)) {
+		if (v > (UINT64_MAX - 9) / 10) {
+			return (false);
+		}
+		v = (v * 10) + (uint64_t)(*s - '0');
+		s++;
+	}
+	*sp = s;
+	*vp = v;
+	return (true);
+}
+
+// http_parse_range parses a Range header against a file of the given size,
+// returning the status to reply with.  Only a single byte range is
+// supported; for anything else we return OK, which means to ignore the
+// header and send the whole file (as RFC 7233 permits).
+static uint16_t
+http_parse_range(const char *s, uint64_t size, uint64_t *offp, uint64_t *lenp)
+{
+	uint64_t first;
+	uint64_t last;
+
+	if ((strncmp(s, "bytes=", 6) != 0) || (strchr(s, ',') != NULL)) {
+		return (NNG_HTTP_STATUS_OK);
+	}
+	s += 6;
+	while (*s == ' ') {
+		s++;
+	}
+	if (*s == '-') {
+		// Suffix range, for the last N bytes.
+		s++;
+		if (!http_parse_u64(&s, &last)) {
+			return (NNG_HTTP_STATUS_OK);
+		}
+		if ((last == 0) || (size == 0)) {
+			return (NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE);
+		}
+		first = last > size ? 0 : size - last;
+		last  = size - 1;
+	} else {
+		if ((!http_parse_u64(&s, &first)) || (*s != '-')) {
+			return (NNG_HTTP_STATUS_OK);
+		}
+		s++;
+		if (isdigit((unsigned char) *s)) {
+			if ((!http_parse_u64(&s, &last)) || (last < first)) {
+				return (NNG_HTTP_STATUS_OK);
+			}
+		} else {
+			last = UINT64_MAX;
+		}
+		if (first >= size) {
+			return (NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE);
+		}
+		if (last >= size) {
+			last = size - 1;
+		}
+	}
+	while (*s == ' ') {
+		s++;
+	}
+	if (*s != '\0') {
+		return (NNG_HTTP_STATUS_OK);
+	}
+	*offp = first;
+	*lenp = (last - first) + 1;
+	return (NNG_HTTP_STATUS_PARTIAL_CONTENT);
+}
+
+static void
+http_file_error(nni_aio *aio, int rv)
+{
+	nni_http_res *res;
+	uint16_t      status;
+
+	switch (rv) {
+	case NNG_ENOMEM:
+		status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
+		break;
+	case NNG_ENOENT:
+		status = NNG_HTTP_STATUS_NOT_FOUND;
+		break;
+	case NNG_EPERM:
+		status = NNG_HTTP_STATUS_FORBIDDEN;
+		break;
+	default:
+		status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
+		break;
+	}
+	if ((rv = nni_http_res_alloc_error(&res, status)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		return;
+	}
+	nni_aio_set_output(aio, 0, res);
+	nni_aio_finish(aio, 0, 0);
+}
+
+// http_accepts_gzip checks an Accept-Encoding header for gzip, taking
+// care to notice an explicit refusal (a quality value of zero).
+static bool
+http_accepts_gzip(const char *s)
+{
+	while (*s != '\0') {
+		const char *tok;
+		size_t      len;
+		bool        refused = false;
+
+		while ((*s == ' ') || (*s == ',')) {
+			s++;
+		}
+		tok = s;
+		while ((*s != '\0') && (*s != ',') && (*s != ';') &&
+		    (*s != ' ')) {
+			s++;
+		}
+		len = (size_t)(s - tok);
+
+		// Parameters; the only one we care about is q.
+		while ((*s != '\0') && (*s != ',')) {
+			if ((s[0] == ';') && ((s[1] == 'q') || (s[1] == 'Q')) &&
+			    (s[2] == '=')) {
+				const char *q = s + 3;
+				refused       = false;
+				if (*q == '0') {
+					q++;
+					if (*q == '.') {
+						q++;
+						while (*q == '0') {
+							q++;
+						}
+					}
+					refused = !isdigit((unsigned char) *q);
+				}
+			}
+			s++;
+		}
+		if (((len == 4) && (nni_strncasecmp(tok, "gzip", 4) == 0)) ||
+		    ((len == 6) && (nni_strncasecmp(tok, "x-gzip", 6) == 0))) {
+			return (!refused);
+		}
+	}
+	return (false);
+}
+
+// http_cresp_init allocates room for a cached response with the given
+// header, returning where the body should be stored.
+static uint8_t *
+http_cresp_init(
+    http_cresp *cr, http_centry *e, const char *hdr, uint64_t bodysz)
+{
+	cr->entry = e;
+	cr->hlen  = strlen(hdr);
+	cr->size  = cr->hlen + 2 + (size_t) bodysz;
+	if ((cr->data = nni_alloc(cr->size)) == NULL) {
+		return (NULL);
+	}
+	memcpy(cr->data, hdr, cr->hlen);
+	memcpy(cr->data + cr->hlen, "\r\n", 2);
+	return (cr->data + cr->hlen + 2);
+}
+
+// http_cvar_load loads one variant of a file into a cache entry,
+// preparing both the full response and the 304 response for it.
+static int
+http_cvar_load(http_centry *e, http_cvar *cv, const char *path,
+    const char *ctype, size_t maxfile, bool gzip)
+{
+	nni_file_reader *f;
+	char *           hdr;
+	char             lastmod[40];
+	const char *     vary;
+	uint8_t *        body;
+	size_t           n;
+	int              rv;
+
+	if ((rv = nni_file_open(path, &f, &cv->fsize, &cv->mtime)) != 0) {
+		return (rv);
+	}
+	if (cv->fsize > maxfile) {
+		nni_file_close(f);
+		return (NNG_EMSGSIZE);
+	}
+	(void) snprintf(cv->etag, sizeof(cv->etag), "\"%llx-%llx%s\"",
+	    (unsigned long long) cv->mtime, (unsigned long long) cv->fsize,
+	    gzip ? "-gz" : "");
+	http_format_date(cv->mtime, lastmod, sizeof(lastmod));
+	vary = (e->gzpath != NULL) ? "Vary: Accept-Encoding\r\n" : "";
+
+	if ((rv = nni_asprintf(&hdr,
+	         "HTTP/1.1 304 Not Modified\r\n"
+	         "ETag: %s\r\nLast-Modified: %s\r\n%s",
+	         cv->etag, lastmod, vary)) != 0) {
+		goto done;
+	}
+	body = http_cresp_init(&cv->notmod, e, hdr, 0);
+	nni_strfree(hdr);
+	if (body == NULL) {
+		rv = NNG_ENOMEM;
+		goto done;
+	}
+
+	if ((rv = nni_asprintf(&hdr,
+	         "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+	         "Content-Length: %llu\r\nETag: %s\r\nLast-Modified: %s\r\n"
+	         "%s%s",
+	         ctype, (unsigned long long) cv->fsize, cv->etag, lastmod,
+	         gzip ? "Content-Encoding: gzip\r\n" : "Accept-Ranges: bytes\r\n",
+	         vary)) != 0) {
+		goto done;
+	}
+	body = http_cresp_init(&cv->ok, e, hdr, cv->fsize);
+	nni_strfree(hdr);
+	if (body == NULL) {
+		rv = NNG_ENOMEM;
+		goto done;
+	}
+	rv = nni_file_read(f, body, (size_t) cv->fsize, 0, &n);
+	if ((rv == 0) && (n != cv->fsize)) {
+		rv = NNG_EINVAL; // truncated while we were reading it
+	}
+
+done:
+	nni_file_close(f);
+	return (rv);
+}
+
+// http_cache_load reads a file, and its gzip variant if there is one,
+// into a new cache entry.
+static int
+http_cache_load(http_cache *c, const char *path, const char *ctype,
+    size_t maxfile, http_centry **ep)
+{
+	http_centry *e;
+	uint64_t     size;
+	uint64_t     mtime;
+	int          rv;
+
+	if ((e = NNI_ALLOC_STRUCT(e)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	NNI_LIST_NODE_INIT(&e->node);
+	e->cache = c;
+	e->key   = http_cache_key(path);
+	if (((e->path = nni_strdup(path)) == NULL) ||
+	    (nni_asprintf(&e->gzpath, "%s.gz", path) != 0)) {
+		http_centry_free(e);
+		return (NNG_ENOMEM);
+	}
+	if ((nni_file_stat(e->gzpath, &size, &mtime) != 0) ||
+	    (size > maxfile)) {
+		nni_strfree(e->gzpath);
+		e->gzpath = NULL;
+	}
+	if (((rv = http_cvar_load(e, &e->plain, path, ctype, maxfile,
+	          false)) != 0) ||
+	    ((e->gzpath != NULL) &&
+	        ((rv = http_cvar_load(e, &e->gzip, e->gzpath, ctype, maxfile,
+	              true)) != 0))) {
+		http_centry_free(e);
+		return (rv);
+	}
+	e->size = sizeof(*e) + strlen(path) + e->plain.ok.size +
+	    e->plain.notmod.size + e->gzip.ok.size + e->gzip.notmod.size;
+	*ep = e;
+	return (0);
+}
+
+// http_cache_insert adds a newly loaded entry to the cache, replacing
+// any older copy of the same file.  The caller gets a hold on the entry.
+// If it cannot be kept in the cache, it is still usable for this one
+// response.  Cache lock held.
+static void
+http_cache_insert(http_cache *c, http_centry *e)
+{
+	http_centry *head;
+
+	e->refcnt = 1;
+	if ((head = http_cache_find(c, e->key, e->path)) != NULL) {
+		http_cache_remove(c, head);
+	}
+	if (e->size > c->limit) {
+		e->stale = true;
+		return;
+	}
+	http_cache_trim(c, e->size);
+	if (nni_idhash_find(c->hash, e->key, (void **) &head) == 0) {
+		e->next    = head->next;
+		head->next = e;
+	} else if (nni_idhash_insert(c->hash, e->key, e) != 0) {
+		e->stale = true;
+		return;
+	}
+	nni_list_prepend(&c->lru, e);
+	c->size += e->size;
+}
+
+// http_centry_current checks that the files an entry was loaded from
+// have not changed since.
+static bool
+http_centry_current(http_centry *e, bool gzip)
+{
+	uint64_t size;
+	uint64_t mtime;
+
+	if ((nni_file_stat(e->path, &size, &mtime) != 0) ||
+	    (size != e->plain.fsize) || (mtime != e->plain.mtime)) {
+		return (false);
+	}
+	if (gzip && (e->gzpath != NULL) &&
+	    ((nni_file_stat(e->gzpath, &size, &mtime) != 0) ||
+	        (size != e->gzip.fsize) || (mtime != e->gzip.mtime))) {
+		return (false);
+	}
+	return (true);
+}
+
+// http_cache_serve tries to answer the request from the static content
+// cache, loading the file into the cache first if needed.  It returns
+// false if the request has to be served from the file itself instead;
+// this is the case for Range requests, and for files that are too large.
+static bool
+http_cache_serve(
+    nni_aio *aio, nni_http_req *req, const char *path, const char *ctype)
+{
+	http_sconn * sc;
+	http_cache * c;
+	http_centry *e;
+	http_cvar *  cv;
+	const char * method;
+	const char * val;
+	uint64_t     key;
+	uint64_t     since;
+	size_t       maxfile;
+	bool         gzip;
+	bool         notmod;
+
+	sc     = nni_http_conn_get_ctx(nni_aio_get_input(aio, 2));
+	method = nni_http_req_get_method(req);
+	if ((sc == NULL) || (nni_http_req_get_header(req, "Range") != NULL) ||
+	    ((strcmp(method, "GET") != 0) && (strcmp(method, "HEAD") != 0))) {
+		return (false);
+	}
+	gzip = ((val = nni_http_req_get_header(req, "Accept-Encoding")) !=
+	           NULL) &&
+	    http_accepts_gzip(val);
+	c   = &sc->server->cache;
+	key = http_cache_key(path);
+
+	nni_mtx_lock(&c->mtx);
+	if (c->limit == 0) {
+		nni_mtx_unlock(&c->mtx);
+		return (false);
+	}
+	maxfile = c->maxfile;
+	if ((e = http_cache_find(c, key, path)) != NULL) {
+		e->refcnt++;
+		nni_list_remove(&c->lru, e);
+		nni_list_prepend(&c->lru, e);
+	}
+	nni_mtx_unlock(&c->mtx);
+
+	if ((e != NULL) && (!http_centry_current(e, gzip))) {
+		nni_mtx_lock(&c->mtx);
+		if (!e->stale) {
+			http_cache_remove(c, e);
+		}
+		e->refcnt--;
+		if (e->refcnt == 0) {
+			http_centry_free(e);
+		}
+		nni_mtx_unlock(&c->mtx);
+		e = NULL;
+	}
+	if (e == NULL) {
+		if (http_cache_load(c, path, ctype, maxfile, &e) != 0) {
+			return (false);
+		}
+		nni_mtx_lock(&c->mtx);
+		http_cache_insert(c, e);
+		nni_mtx_unlock(&c->mtx);
+	}
+
+	cv = (gzip && (e->gzpath != NULL)) ? &e->gzip : &e->plain;
+
+	// RFC 7232: If-None-Match takes precedence over If-Modified-Since.
+	if ((val = nni_http_req_get_header(req, "If-None-Match")) != NULL) {
+		notmod = http_etag_match(val, cv->etag);
+	} else {
+		notmod = ((val = nni_http_req_get_header(
+		               req, "If-Modified-Since")) != NULL) &&
+		    http_parse_date(val, &since) && (cv->mtime <= since);
+	}
+	nni_aio_set_output(aio, 2, notmod ? &cv->notmod : &cv->ok);
+	nni_aio_finish(aio, 0, 0);
+	return (true);
+}
+
+// http_serve_file replies to a request with the contents of a file.  The
+// file is not loaded into memory; instead it is handed back to the server
+// to send a piece at a time.  Entity tags (derived from the size and
+// modification time) and modification times are supplied, so that
+// conditional requests for unchanged files can be answered with just a
+// 304, and single byte ranges are supported.
+static void
+http_serve_file(
+    nni_aio *aio, nni_http_req *req, const char *path, const char *ctype)
+{
+	nni_http_res *   res = NULL;
+	nni_file_reader *file;
+	http_fbody *     fb;
+	uint64_t         size;
+	uint64_t         mtime;
+	uint64_t         off;
+	uint64_t         len;
+	uint64_t         since;
+	uint16_t         status;
+	const char *     val;
+	char             etag[40];
+	char             lastmod[40];
+	char             crange[64];
+	int              rv;
+
+	if (http_cache_serve(aio, req, path, ctype)) {
+		return;
+	}
+	if ((rv = nni_file_open(path, &file, &size, &mtime)) != 0) {
+		http_file_error(aio, rv);
+		return;
+	}
+	(void) snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+	    (unsigned long long) mtime, (unsigned long long) size);
+	http_format_date(mtime, lastmod, sizeof(lastmod));
+
+	// RFC 7232: If-None-Match takes precedence over If-Modified-Since.
+	status = NNG_HTTP_STATUS_OK;
+	off    = 0;
+	len    = size;
+	if ((val = nni_http_req_get_header(req, "If-None-Match")) != NULL) {
+		if (http_etag_match(val, etag)) {
+			status = NNG_HTTP_STATUS_NOT_MODIFIED;
+		}
+	} else if (((val = nni_http_req_get_header(
+	                 req, "If-Modified-Since")) != NULL) &&
+	    http_parse_date(val, &since) && (mtime <= since)) {
+		status = NNG_HTTP_STATUS_NOT_MODIFIED;
+	}
+
+	// A Range only applies if any If-Range still matches; otherwise
+	// the client's partial copy is stale, and needs the whole thing.
+	if ((status == NNG_HTTP_STATUS_OK) &&
+	    (strcmp(nni_http_req_get_method(req), "GET") == 0) &&
+	    ((val = nni_http_req_get_header(req, "Range")) != NULL)) {
+		const char *ifr = nni_http_req_get_header(req, "If-Range");
+		if ((ifr == NULL) || (strcmp(ifr, etag) == 0) ||
+		    (strcmp(ifr, lastmod) == 0)) {
+			status = http_parse_range(val, size, &off, &len);
+		}
+	}
+
+	if (status == NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE) {
+		nni_file_close(file);
+		(void) snprintf(crange, sizeof(crange), "bytes */%llu",
+		    (unsigned long long) size);
+		if (((rv = nni_http_res_alloc_error(&res, status)) != 0) ||
+		    ((rv = nni_http_res_set_header(
+		          res, "Content-Range", crange)) != 0)) {
+			if (res != NULL) {
+				nni_http_res_free(res);
+			}
 			nni_aio_finish_error(aio, rv);
 			return;
 		}
@@ -1153,22 +2444,83 @@ http_handle_file(nni_aio *aio)
 		nni_aio_finish(aio, 0, 0);
 		return;
 	}
+
 	if (((rv = nni_http_res_alloc(&res)) != 0) ||
-	    ((rv = nni_http_res_set_status(res, NNG_HTTP_STATUS_OK)) != 0) ||
-	    ((rv = nni_http_res_set_header(res, "Content-Type", ctype)) !=
-	        0) ||
-	    ((rv = nni_http_res_copy_data(res, data, size)) != 0)) {
-		if (res != NULL) {
-			nni_http_res_free(res);
+	    ((rv = nni_http_res_set_status(res, status)) != 0) ||
+	    ((rv = nni_http_res_set_header(res, "ETag", etag)) != 0) ||
+	    ((rv = nni_http_res_set_header(res, "Last-Modified", lastmod)) !=
+	        0)) {
+		goto fail;
+	}
+	if (status == NNG_HTTP_STATUS_NOT_MODIFIED) {
+		nni_file_close(file);
+		nni_aio_set_output(aio, 0, res);
+		nni_aio_finish(aio, 0, 0);
+		return;
+	}
+	if (status == NNG_HTTP_STATUS_PARTIAL_CONTENT) {
+		(void) snprintf(crange, sizeof(crange), "bytes %llu-%llu/%llu",
+		    (unsigned long long) off,
+		    (unsigned long long) (off + len - 1),
+		    (unsigned long long) size);
+		if ((rv = nni_http_res_set_header(
+		         res, "Content-Range", crange)) != 0) {
+			goto fail;
 		}
-		nni_free(data, size);
-		nni_aio_finish_error(aio, rv);
+	}
+	if (((rv = nni_http_res_set_header(res, "Content-Type", ctype)) !=
+	        0) ||
+	    ((rv = nni_http_res_set_header(res, "Accept-Ranges", "bytes")) !=
+	        0) ||
+	    ((rv = nni_http_res_set_data(res, NULL, (size_t) len)) != 0)) {
+		goto fail;
+	}
+	if (len == 0) {
+		nni_file_close(file);
+		nni_aio_set_output(aio, 0, res);
+		nni_aio_finish(aio, 0, 0);
 		return;
 	}
 
-	nni_free(data, size);
+	if ((fb = NNI_ALLOC_STRUCT(fb)) == NULL) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	fb->file  = file;
+	fb->off   = off;
+	fb->len   = len;
+	fb->bufsz = len < HTTP_FILE_CHUNK ? (size_t) len : HTTP_FILE_CHUNK;
+	if ((fb->buf = nni_alloc(fb->bufsz)) == NULL) {
+		http_fbody_free(fb);
+		nni_http_res_free(res);
+		nni_aio_finish_error(aio, NNG_ENOMEM);
+		return;
+	}
 	nni_aio_set_output(aio, 0, res);
+	nni_aio_set_output(aio, 1, fb);
 	nni_aio_finish(aio, 0, 0);
+	return;
+
+fail:
+	nni_file_close(file);
+	if (res != NULL) {
+		nni_http_res_free(res);
+	}
+	nni_aio_finish_error(aio, rv);
+}
+
+static void
+http_handle_file(nni_aio *aio)
+{
+	nni_http_req *    req = nni_aio_get_input(aio, 0);
+	nni_http_handler *h   = nni_aio_get_input(aio, 1);
+	http_file *       hf  = nni_http_handler_get_data(h);
+	const char *      ctype;
+
+	if ((ctype = hf->ctype) == NULL) {
+		ctype = "application/octet-stream";
+	}
+	http_serve_file(aio, req, hf->path, ctype);
 }
 
 static void
@@ -1235,9 +2587,6 @@ http_handle_dir(nni_aio *aio)
 {
 	nni_http_req *    req = nni_aio_get_input(aio, 0);
 	nni_http_handler *h   = nni_aio_get_input(aio, 1);
-	nni_http_res *    res = NULL;
-	void *            data;
-	size_t            size;
 	int               rv;
 	http_file *       hf   = nni_http_handler_get_data(h);
 	const char *      path = hf->path;
@@ -1248,6 +2597,7 @@ http_handle_dir(nni_aio *aio)
 	size_t            len;
 	size_t            pnsz;
 	char *            pn;
+	char              pnbuf[256];
 
 	len = strlen(base);
 	if ((strncmp(uri, base, len) != 0) ||
@@ -1262,7 +2612,10 @@ http_handle_dir(nni_aio *aio)
 	pnsz = (strlen(path) + strlen(uri) + 2) * strlen(NNG_PLATFORM_DIR_SEP);
 	pnsz += strlen("index.html") + 1; // +1 for term nul
 
-	if ((pn = nni_alloc(pnsz)) == NULL) {
+	// Most names fit on the stack, sparing an allocation per request.
+	if (pnsz <= sizeof(pnbuf)) {
+		pn = pnbuf;
+	} else if ((pn = nni_alloc(pnsz)) == NULL) {
 		nni_aio_finish_error(aio, NNG_ENOMEM);
 		return;
 	}
@@ -1286,12 +2639,6 @@ http_handle_dir(nni_aio *aio)
 
 	*dst = '\0';
 
-	// This is a very simplistic file server, suitable only for small
-	// files.  In the future we can use an AIO based file read, where
-	// we read files a bit at a time, or even mmap them, and serve
-	// them up chunkwise.  Applications could even come up with their
-	// own caching version of the http handler.
-
 	rv = 0;
 	if (nni_file_is_dir(pn)) {
 		sprintf(dst, "%s%s", NNG_PLATFORM_DIR_SEP, "index.html");
@@ -1304,59 +2651,16 @@ http_handle_dir(nni_aio *aio)
 	}
 
 	if (rv == 0) {
-		rv = nni_file_get(pn, &data, &size);
-	} else {
-		data = NULL;
-		size = 0;
-	}
-	ctype = http_lookup_type(pn);
-	if (ctype == NULL) {
-		ctype = "application/octet-stream";
-	}
-
-	nni_free(pn, pnsz);
-	if (rv != 0) {
-		uint16_t status;
-
-		switch (rv) {
-		case NNG_ENOMEM:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
-		case NNG_ENOENT:
-			status = NNG_HTTP_STATUS_NOT_FOUND;
-			break;
-		case NNG_EPERM:
-			status = NNG_HTTP_STATUS_FORBIDDEN;
-			break;
-		default:
-			status = NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR;
-			break;
-		}
-		if ((rv = nni_http_res_alloc_error(&res, status)) != 0) {
-			nni_aio_finish_error(aio, rv);
-			return;
+		if ((ctype = http_lookup_type(pn)) == NULL) {
+			ctype = "application/octet-stream";
 		}
-		nni_aio_set_output(aio, 0, res);
-		nni_aio_finish(aio, 0, 0);
-		return;
+		http_serve_file(aio, req, pn, ctype);
+	} else {
+		http_file_error(aio, rv);
 	}
-
-	if (((rv = nni_http_res_alloc(&res)) != 0) ||
-	    ((rv = nni_http_res_set_status(res, NNG_HTTP_STATUS_OK)) != 0) ||
-	    ((rv = nni_http_res_set_header(res, "Content-Type", ctype)) !=
-	        0) ||
-	    ((rv = nni_http_res_copy_data(res, data, size)) != 0)) {
-		if (res != NULL) {
-			nni_http_res_free(res);
-		}
-		nni_free(data, size);
-		nni_aio_finish_error(aio, rv);
-		return;
+	if (pn != pnbuf) {
+		nni_free(pn, pnsz);
 	}
-
-	nni_free(data, size);
-	nni_aio_set_output(aio, 0, res);
-	nni_aio_finish(aio, 0, 0);
 }
 
 int
@@ -1520,6 +2824,19 @@ nni_http_server_get_tls(nni_http_server *s, nng_tls_config **tp)
 #endif
 }
 
+int
+nni_http_server_set_cache(nni_http_server *s, size_t limit, size_t maxfile)
+{
+	http_cache *c = &s->cache;
+
+	nni_mtx_lock(&c->mtx);
+	c->limit   = limit;
+	c->maxfile = maxfile;
+	http_cache_trim(c, 0);
+	nni_mtx_unlock(&c->mtx);
+	return (0);
+}
+
 static int
 http_server_sys_init(void)
 {
@@ -19,6 +19,19 @@
 
 #include "websocket.h"
 
+// The masking and UTF-8 kernels use vector instructions when the compiler
+// is targeting a CPU that has them.  (SSE2 is part of the x86-64 baseline;
+// AVX2 needs -mavx2 or similar.)  Otherwise plain 64-bit words are used.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WS_HAVE_AVX2
+#define WS_HAVE_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define WS_HAVE_SSE2
+#endif
+
 // Pre-defined types for some prototypes.  These are from other subsystems.
 typedef struct ws_frame ws_frame;
 typedef struct ws_msg   ws_msg;
@@ -54,6 +67,8 @@ struct nni_ws {
 	char *           reshdrs;
 	size_t           maxframe;
 	size_t           fragsize;
+	bool             sendtext; // send TEXT frames instead of BINARY
+	bool             recvtext; // accept (validated) TEXT frames
 	nni_ws_listener *listener;
 	nni_ws_dialer *  dialer;
 };
@@ -220,19 +235,155 @@ ws_msg_fini(ws_msg *wm)
 	NNI_FREE_STRUCT(wm);
 }
 
+// Client frames are masked with random keys, which are generated for up
+// to this many frames of a message at a time.
+#define WS_MASK_BATCH 16
+
+void
+nni_ws_mask(uint8_t *buf, size_t len, const uint8_t *mask)
+{
+	size_t   i = 0;
+	uint8_t  phased[8];
+	uint64_t m64;
+
+	// Walk up to an 8 byte boundary, so that the word loop below
+	// is aligned.  The vector loops use unaligned access anyway.
+	while ((i < len) && (((uintptr_t)(buf + i) & 7) != 0)) {
+		buf[i] ^= mask[i & 3];
+		i++;
+	}
+	if (i == len) {
+		return;
+	}
+
+	// Every stride below is a multiple of 4, so a mask word that is
+	// in phase with buf[i] stays in phase for the rest of the buffer.
+	for (int j = 0; j < 8; j++) {
+		phased[j] = mask[(i + j) & 3];
+	}
+	memcpy(&m64, phased, sizeof(m64));
+
+#if defined(WS_HAVE_AVX2)
+	{
+		__m256i m = _mm256_set1_epi64x((long long) m64);
+		for (; (len - i) >= 64; i += 64) {
+			__m256i *p = (__m256i *) (buf + i);
+			__m256i  a = _mm256_loadu_si256(p);
+			__m256i  b = _mm256_loadu_si256(p + 1);
+			_mm256_storeu_si256(p, _mm256_xor_si256(a, m));
+			_mm256_storeu_si256(p + 1, _mm256_xor_si256(b, m));
+		}
+	}
+#endif
+#if defined(WS_HAVE_SSE2)
+	{
+		__m128i m = _mm_set1_epi64x((long long) m64);
+		for (; (len - i) >= 16; i += 16) {
+			__m128i *p = (__m128i *) (buf + i);
+			__m128i  a = _mm_loadu_si128(p);
+			_mm_storeu_si128(p, _mm_xor_si128(a, m));
+		}
+	}
+#endif
+	for (; (len - i) >= 8; i += 8) {
+		uint64_t w;
+		memcpy(&w, buf + i, sizeof(w));
+		w ^= m64;
+		memcpy(buf + i, &w, sizeof(w));
+	}
+	for (; i < len; i++) {
+		buf[i] ^= mask[i & 3];
+	}
+}
+
+bool
+nni_ws_utf8_valid(const uint8_t *buf, size_t len)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		uint8_t c = buf[i];
+		uint8_t lo; // permitted range of the first continuation byte
+		uint8_t hi;
+		size_t  n; // number of continuation bytes
+
+		if (c < 0x80) {
+			// Text is mostly ASCII, so skip over runs of it
+			// as many bytes at a time as we can.
+#if defined(WS_HAVE_SSE2)
+			while ((len - i) >= 16) {
+				const __m128i *p = (const __m128i *) (buf + i);
+				__m128i        v = _mm_loadu_si128(p);
+				if (_mm_movemask_epi8(v) != 0) {
+					break; // some byte has the high bit set
+				}
+				i += 16;
+			}
+#endif
+			while ((len - i) >= 8) {
+				uint64_t w;
+				memcpy(&w, buf + i, sizeof(w));
+				if ((w & 0x8080808080808080ull) != 0) {
+					break;
+				}
+				i += 8;
+			}
+			while ((i < len) && (buf[i] < 0x80)) {
+				i++;
+			}
+			continue;
+		}
+
+		// RFC 3629: no overlong forms, no surrogates (U+D800 to
+		// U+DFFF), and nothing above U+10FFFF.
+		lo = 0x80;
+		hi = 0xbf;
+		if ((c >= 0xc2) && (c <= 0xdf)) {
+			n = 1;
+		} else if (c == 0xe0) {
+			n  = 2;
+			lo = 0xa0;
+		} else if (c == 0xed) {
+			n  = 2;
+			hi = 0x9f;
+		} else if ((c >= 0xe1) && (c <= 0xef)) {
+			n = 2;
+		} else if (c == 0xf0) {
+			n  = 3;
+			lo = 0x90;
+		} else if (c == 0xf4) {
+			n  = 3;
+			hi = 0x8f;
+		} else if ((c >= 0xf1) && (c <= 0xf3)) {
+			n = 3;
+		} else {
+			return (false);
+		}
+		if ((len - i) <= n) {
+			return (false); // truncated sequence
+		}
+		if ((buf[i + 1] < lo) || (buf[i + 1] > hi)) {
+			return (false);
+		}
+		for (size_t j = 2; j <= n; j++) {
+			if ((buf[i + j] & 0xc0) != 0x80) {
+				return (false);
+			}
+		}
+		i += n + 1;
+	}
+	return (true);
+}
+
 static void
-ws_mask_frame(ws_frame *frame)
+ws_mask_frame(ws_frame *frame, const uint8_t *mask)
 {
-	uint32_t r;
 	// frames sent by client need mask.
 	if (frame->masked) {
 		return;
 	}
-	r = nni_random();
-	NNI_PUT32(frame->mask, r);
-	for (size_t i = 0; i < frame->len; i++) {
-		frame->buf[i] ^= frame->mask[i % 4];
-	}
+	memcpy(frame->mask, mask, 4);
+	nni_ws_mask(frame->buf, frame->len, frame->mask);
 	memcpy(frame->head + frame->hlen, frame->mask, 4);
 	frame->hlen += 4;
 	frame->head[1] |= 0x80; // set masked bit
@@ -246,9 +397,7 @@ ws_unmask_frame(ws_frame *frame)
 	if (!frame->masked) {
 		return;
 	}
-	for (size_t i = 0; i < frame->len; i++) {
-		frame->buf[i] ^= frame->mask[i % 4];
-	}
+	nni_ws_mask(frame->buf, frame->len, frame->mask);
 	frame->hlen -= 4;
 	frame->head[1] &= 0x7f; // clear masked bit
 	frame->masked = false;
@@ -289,7 +438,9 @@ ws_msg_init_control(
 	frame->bufsz   = 0;
 
 	if (ws->mode == NNI_EP_MODE_DIAL) {
-		ws_mask_frame(frame);
+		uint8_t mask[4];
+		nni_random_fill(mask, sizeof(mask));
+		ws_mask_frame(frame, mask);
 	} else {
 		frame->masked = false;
 	}
@@ -308,6 +459,9 @@ ws_msg_init_tx(ws_msg **wmp, nni_ws *ws, nni_msg *msg, nni_aio *aio)
 	size_t   maxfrag = ws->fragsize; // make this tunable. (1MB default)
 	uint8_t *buf;
 	uint8_t  op;
+	uint8_t  masks[4 * WS_MASK_BATCH];
+	size_t   nmasks = 0; // unused masks left in masks[]
+	size_t   nframes;    // frames still to be masked
 
 	// If the message has a header, move it to front of body.  Most of
 	// the time this will not cause a reallocation (there should be
@@ -327,9 +481,20 @@ ws_msg_init_tx(ws_msg **wmp, nni_ws *ws, nni_msg *msg, nni_aio *aio)
 	}
 	NNI_LIST_INIT(&wm->frames, ws_frame, node);
 
-	len = nni_msg_len(msg);
-	buf = nni_msg_body(msg);
-	op  = WS_BINARY; // to start -- no support for sending TEXT frames
+	// Clients mask the payload in place, so they must not scribble
+	// on a body that is shared with other messages.
+	if (ws->mode == NNI_EP_MODE_DIAL) {
+		int rv;
+		if ((rv = nni_msg_unshare(msg)) != 0) {
+			ws_msg_fini(wm);
+			return (rv);
+		}
+	}
+
+	len     = nni_msg_len(msg);
+	buf     = nni_msg_body(msg);
+	op      = ws->sendtext ? WS_TEXT : WS_BINARY; // to start
+	nframes = len > maxfrag ? (len + maxfrag - 1) / maxfrag : 1;
 
 	// do ... while because we want at least one frame (even for empty
 	// messages.)   Headers get their own frame, if present.  Best bet
@@ -372,7 +537,17 @@ ws_msg_init_tx(ws_msg **wmp, nni_ws *ws, nni_msg *msg, nni_aio *aio)
 		}
 
 		if (ws->mode == NNI_EP_MODE_DIAL) {
-			ws_mask_frame(frame);
+			// Masks are generated for several frames at a time.
+			if (nmasks == 0) {
+				nmasks = nframes;
+				if (nmasks > WS_MASK_BATCH) {
+					nmasks = WS_MASK_BATCH;
+				}
+				nni_random_fill(masks, nmasks * 4);
+			}
+			nmasks--;
+			nframes--;
+			ws_mask_frame(frame, &masks[nmasks * 4]);
 		} else {
 			frame->masked = false;
 		}
@@ -785,6 +960,12 @@ ws_read_frame_cb(nni_ws *ws, ws_frame *frame)
 		ws->rxframe = NULL;
 		nni_list_append(&wm->frames, frame);
 		break;
+	case WS_TEXT:
+		if (!ws->recvtext) {
+			ws_close(ws, WS_CLOSE_UNSUPP_FORMAT);
+			return;
+		}
+		// FALLTHROUGH
 	case WS_BINARY:
 		if (wm == NULL) {
 			ws_close(ws, WS_CLOSE_GOING_AWAY);
@@ -797,11 +978,6 @@ ws_read_frame_cb(nni_ws *ws, ws_frame *frame)
 		ws->rxframe = NULL;
 		nni_list_append(&wm->frames, frame);
 		break;
-	case WS_TEXT:
-		// No support for text mode at present.
-		ws_close(ws, WS_CLOSE_UNSUPP_FORMAT);
-		return;
-
 	case WS_PING:
 		if (frame->len > 125) {
 			ws_close(ws, WS_CLOSE_PROTOCOL_ERR);
@@ -833,15 +1009,18 @@ ws_read_frame_cb(nni_ws *ws, ws_frame *frame)
 	// control frame.
 	if (((frame = nni_list_last(&wm->frames)) != NULL) && frame->final) {
 		size_t   len = 0;
+		bool     text;
 		nni_msg *msg;
 		uint8_t *body;
 		int      rv;
 
 		nni_list_remove(&ws->rxmsgs, wm);
+		frame = nni_list_first(&wm->frames);
+		text  = (frame->op == WS_TEXT);
 		NNI_LIST_FOREACH (&wm->frames, frame) {
 			len += frame->len;
 		}
-		if ((rv = nni_msg_alloc(&msg, len)) != 0) {
+		if ((rv = nni_msg_alloc_nz(&msg, len)) != 0) {
 			nni_aio_finish_error(wm->aio, rv);
 			ws_msg_fini(wm);
 			ws_close(ws, WS_CLOSE_INTERNAL);
@@ -852,6 +1031,15 @@ ws_read_frame_cb(nni_ws *ws, ws_frame *frame)
 			memcpy(body, frame->buf, frame->len);
 			body += frame->len;
 		}
+		// Characters may be split across frames, so validate the
+		// message as a whole.
+		if (text && !nni_ws_utf8_valid(nni_msg_body(msg), len)) {
+			nni_msg_free(msg);
+			nni_aio_finish_error(wm->aio, NNG_EPROTO);
+			ws_msg_fini(wm);
+			ws_close(ws, WS_CLOSE_INVALID_DATA);
+			return;
+		}
 		nni_aio_finish_msg(wm->aio, msg);
 		wm->aio = NULL;
 		ws_msg_fini(wm);
@@ -1090,6 +1278,22 @@ nni_ws_tls_verified(nni_ws *ws)
 	return (rv);
 }
 
+void
+nni_ws_set_send_text(nni_ws *ws, bool text)
+{
+	nni_mtx_lock(&ws->mtx);
+	ws->sendtext = text;
+	nni_mtx_unlock(&ws->mtx);
+}
+
+void
+nni_ws_set_recv_text(nni_ws *ws, bool text)
+{
+	nni_mtx_lock(&ws->mtx);
+	ws->recvtext = text;
+	nni_mtx_unlock(&ws->mtx);
+}
+
 static void
 ws_fini(void *arg)
 {
@@ -1767,9 +1971,7 @@ ws_conn_cb(void *arg)
 		return;
 	}
 
-	for (int i = 0; i < 16; i++) {
-		raw[i] = (uint8_t) nni_random();
-	}
+	nni_random_fill(raw, 16);
 	nni_base64_encode(raw, 16, wskey, 24);
 	wskey[24] = '\0';
 
@@ -63,6 +63,21 @@ extern const char *  nni_ws_response_headers(nni_ws *);
 extern const char *  nni_ws_request_headers(nni_ws *);
 extern bool          nni_ws_tls_verified(nni_ws *);
 
+// By default messages are sent as BINARY frames, and TEXT frames from the
+// peer are refused.  These allow TEXT to be used instead.  Received text
+// messages are checked to be valid UTF-8, and the connection is closed
+// if they are not.
+extern void nni_ws_set_send_text(nni_ws *, bool);
+extern void nni_ws_set_recv_text(nni_ws *, bool);
+
+// nni_ws_mask applies (or removes) a websocket masking key to a buffer,
+// in place.  The first byte of the buffer is XOR'd with the first byte
+// of the 4 byte mask.
+extern void nni_ws_mask(uint8_t *, size_t, const uint8_t *);
+
+// nni_ws_utf8_valid returns true if the buffer is well-formed UTF-8.
+extern bool nni_ws_utf8_valid(const uint8_t *, size_t);
+
 // The implementation will send periodic PINGs, and respond with PONGs.
 
 #endif // NNG_SUPPLEMENTAL_WEBSOCKET_WEBSOCKET_H
@@ -22,6 +22,21 @@
 typedef struct nni_ipc_pipe nni_ipc_pipe;
 typedef struct nni_ipc_ep   nni_ipc_ep;
 
+// Received data is read into a per-pipe buffer, and messages are carved
+// out of it, so that one read can pick up many small messages.  The
+// buffer starts small on the first read, and grows when reads fill it.
+#define NNI_IPC_RXBUFMIN 4096
+#define NNI_IPC_RXBUFSZ 65536
+
+// Several small messages waiting to be sent are copied into a buffer of
+// up to this many bytes (NNG_OPT_SENDCOALESCE), allocated when first
+// needed, and go out in one write.  A message on its own is written in
+// place.  Protocols may keep up to NNI_IPC_TXWIN sends outstanding on a
+// pipe that coalesces, so that there is something to gather.
+#define NNI_IPC_TXCOALESCE 32768
+#define NNI_IPC_TXCOALESCE_MAX (1024 * 1024)
+#define NNI_IPC_TXWIN 32
+
 // nni_ipc_pipe is one end of an IPC connection.
 struct nni_ipc_pipe {
 	nni_plat_ipc_pipe *ipp;
@@ -37,14 +52,30 @@ struct nni_ipc_pipe {
 	size_t  wanttxhead;
 	size_t  wantrxhead;
 
-	nni_aio *user_txaio;
 	nni_aio *user_rxaio;
 	nni_aio *user_negaio;
 	nni_aio *txaio;
 	nni_aio *rxaio;
 	nni_aio *negaio;
+	nni_list txq;    // sends waiting to be written
+	nni_list txsent; // sends in the write in progress
+	uint8_t *txbuf;  // coalescing buffer, allocated on first use
+	size_t   txsize; // size of txbuf, 0 if not coalescing
+	bool     txbusy; // a write is in progress
+	int      txerr;
 	nni_msg *rxmsg;
+	size_t   rxgot;    // bytes of rxmsg body filled in so far
+	size_t   rxdirect; // bytes of current read going into rxmsg
+	uint8_t *rxbuf;
+	size_t   rxsize; // size of rxbuf, 0 until the first read
+	size_t   rxoff;  // start of unconsumed data in rxbuf
+	size_t   rxend;  // end of unconsumed data in rxbuf
+	bool     rxfull; // last read filled rxbuf, so grow it
+	bool     rxbusy;
+	int      rxerr;
 	nni_mtx  mtx;
+
+	nni_stat_item txwrites;
 };
 
 struct nni_ipc_ep {
@@ -52,6 +83,7 @@ struct nni_ipc_ep {
 	nni_plat_ipc_ep *iep;
 	uint16_t         proto;
 	size_t           rcvmax;
+	size_t           txcoalesce;
 	nni_aio *        aio;
 	nni_aio *        user_aio;
 	nni_mtx          mtx;
@@ -99,6 +131,12 @@ nni_ipc_pipe_fini(void *arg)
 	if (pipe->rxmsg) {
 		nni_msg_free(pipe->rxmsg);
 	}
+	if (pipe->rxbuf != NULL) {
+		nni_free(pipe->rxbuf, pipe->rxsize);
+	}
+	if (pipe->txbuf != NULL) {
+		nni_free(pipe->txbuf, pipe->txsize);
+	}
 	nni_mtx_fini(&pipe->mtx);
 	NNI_FREE_STRUCT(pipe);
 }
@@ -119,7 +157,12 @@ nni_ipc_pipe_init(nni_ipc_pipe **pipep, nni_ipc_ep *ep, void *ipp)
 		nni_ipc_pipe_fini(p);
 		return (rv);
 	}
+	nni_aio_list_init(&p->txq);
+	nni_aio_list_init(&p->txsent);
+	nni_stat_init(&p->txwrites, "tx_writes", "writes of sent messages",
+	    NNG_STAT_COUNTER, NNG_UNIT_EVENTS);
 
+	p->txsize                   = ep->txcoalesce;
 	p->proto                    = ep->proto;
 	p->rcvmax                   = ep->rcvmax;
 	p->ipp                      = ipp;
@@ -204,29 +247,120 @@ done:
 	nni_mtx_unlock(&pipe->mtx);
 }
 
+// nni_ipc_pipe_txstart starts a write of whatever sends are waiting.  If
+// there are several small ones, as many as fit are copied into the
+// coalescing buffer and go out together.  Otherwise the first message
+// is written in place.  The sends complete once the write is done.
+static void
+nni_ipc_pipe_txstart(nni_ipc_pipe *pipe)
+{
+	nni_iov  iov[3];
+	int      niov = 0;
+	nni_aio *aio;
+	nni_msg *msg;
+	size_t   len;
+
+	if (pipe->txbusy || ((aio = nni_list_first(&pipe->txq)) == NULL)) {
+		return;
+	}
+	msg = nni_aio_get_msg(aio);
+	len = sizeof(pipe->txhead) + nni_msg_header_len(msg) +
+	    nni_msg_len(msg);
+
+	if ((nni_list_next(&pipe->txq, aio) != NULL) &&
+	    (len <= pipe->txsize) &&
+	    ((pipe->txbuf != NULL) ||
+	        ((pipe->txbuf = nni_alloc(pipe->txsize)) != NULL))) {
+		size_t fill = 0;
+
+		while ((aio = nni_list_first(&pipe->txq)) != NULL) {
+			uint8_t *buf = pipe->txbuf + fill;
+			size_t   hlen;
+
+			msg  = nni_aio_get_msg(aio);
+			hlen = nni_msg_header_len(msg);
+			len  = nni_msg_len(msg);
+			if (fill + sizeof(pipe->txhead) + hlen + len >
+			    pipe->txsize) {
+				break;
+			}
+			buf[0] = 1; // message type, 1.
+			NNI_PUT64(buf + 1, (uint64_t)(hlen + len));
+			buf += sizeof(pipe->txhead);
+			memcpy(buf, nni_msg_header(msg), hlen);
+			memcpy(buf + hlen, nni_msg_body(msg), len);
+			fill += sizeof(pipe->txhead) + hlen + len;
+			nni_aio_list_remove(aio);
+			nni_list_append(&pipe->txsent, aio);
+		}
+		iov[niov].iov_buf = pipe->txbuf;
+		iov[niov].iov_len = fill;
+		niov++;
+	} else {
+		nni_aio_list_remove(aio);
+		nni_list_append(&pipe->txsent, aio);
+
+		pipe->txhead[0] = 1; // message type, 1.
+		NNI_PUT64(pipe->txhead + 1, len - sizeof(pipe->txhead));
+		iov[niov].iov_buf = pipe->txhead;
+		iov[niov].iov_len = sizeof(pipe->txhead);
+		niov++;
+		if (nni_msg_header_len(msg) > 0) {
+			iov[niov].iov_buf = nni_msg_header(msg);
+			iov[niov].iov_len = nni_msg_header_len(msg);
+			niov++;
+		}
+		if (nni_msg_len(msg) > 0) {
+			iov[niov].iov_buf = nni_msg_body(msg);
+			iov[niov].iov_len = nni_msg_len(msg);
+			niov++;
+		}
+	}
+	pipe->txbusy = true;
+	nni_stat_inc(&pipe->txwrites, 1);
+	nni_aio_set_iov(pipe->txaio, niov, iov);
+	nni_plat_ipc_pipe_send(pipe->ipp, pipe->txaio);
+}
+
+// nni_ipc_pipe_txfinish completes the sends on the list, failing them
+// if rv is non-zero.  The caller holds the lock.
+static void
+nni_ipc_pipe_txfinish(nni_list *list, int rv)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(list)) != NULL) {
+		nni_msg *msg = nni_aio_get_msg(aio);
+		size_t   n   = nni_msg_len(msg);
+
+		nni_aio_list_remove(aio);
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(msg);
+		if (rv != 0) {
+			nni_aio_finish_error(aio, rv);
+		} else {
+			nni_aio_finish(aio, 0, n);
+		}
+	}
+}
+
 static void
 nni_ipc_pipe_send_cb(void *arg)
 {
-	nni_ipc_pipe *pipe = arg;
-	nni_aio *     aio;
+	nni_ipc_pipe *pipe  = arg;
 	nni_aio *     txaio = pipe->txaio;
-	nni_msg *     msg;
 	int           rv;
 	size_t        n;
 
 	nni_mtx_lock(&pipe->mtx);
-	if ((aio = pipe->user_txaio) == NULL) {
-		nni_mtx_unlock(&pipe->mtx);
-		return;
-	}
-
 	if ((rv = nni_aio_result(txaio)) != 0) {
-		pipe->user_txaio = NULL;
+		// The stream is broken, and the pipe with it, so everything
+		// that has not been written fails.
+		pipe->txbusy = false;
+		pipe->txerr  = rv;
+		nni_ipc_pipe_txfinish(&pipe->txsent, rv);
+		nni_ipc_pipe_txfinish(&pipe->txq, rv);
 		nni_mtx_unlock(&pipe->mtx);
-		msg = nni_aio_get_msg(aio);
-		nni_aio_set_msg(aio, NULL);
-		nni_msg_free(msg);
-		nni_aio_finish_error(aio, rv);
 		return;
 	}
 
@@ -238,67 +372,44 @@ nni_ipc_pipe_send_cb(void *arg)
 		return;
 	}
 
+	pipe->txbusy = false;
+	nni_ipc_pipe_txfinish(&pipe->txsent, 0);
+	nni_ipc_pipe_txstart(pipe);
 	nni_mtx_unlock(&pipe->mtx);
-	msg = nni_aio_get_msg(aio);
-	n   = nni_msg_len(msg);
-	nni_aio_set_msg(aio, NULL);
-	nni_msg_free(msg);
-	nni_aio_finish(aio, 0, n);
 }
 
-static void
-nni_ipc_pipe_recv_cb(void *arg)
+// nni_ipc_pipe_rxparse tries to complete a message using only data that
+// has already been buffered.  On success, *msgp is set to the message, or
+// to NULL if more data must be read first.
+static int
+nni_ipc_pipe_rxparse(nni_ipc_pipe *pipe, nni_msg **msgp)
 {
-	nni_ipc_pipe *pipe = arg;
-	nni_aio *     aio;
-	int           rv;
-	size_t        n;
-	nni_msg *     msg;
-	nni_aio *     rxaio = pipe->rxaio;
-
-	nni_mtx_lock(&pipe->mtx);
-	if ((aio = pipe->user_rxaio) == NULL) {
-		// aio was canceled
-		nni_mtx_unlock(&pipe->mtx);
-		return;
-	}
+	size_t avail = pipe->rxend - pipe->rxoff;
+	size_t len;
+	size_t n;
+	int    rv;
 
-	if ((rv = nni_aio_result(rxaio)) != 0) {
-		// Error on receive.  This has to cause an error back
-		// to the user.  Also, if we had allocated an rxmsg, lets
-		// toss it.
-		goto recv_error;
-	}
-
-	n = nni_aio_count(rxaio);
-	nni_aio_iov_advance(rxaio, n);
-	if (nni_aio_iov_count(rxaio) != 0) {
-		// Was this a partial read?  If so then resubmit for the rest.
-		nni_plat_ipc_pipe_recv(pipe->ipp, rxaio);
-		nni_mtx_unlock(&pipe->mtx);
-		return;
-	}
-
-	// If we don't have a message yet, we were reading the message
-	// header, which is just the length.  This tells us the size of the
-	// message to allocate and how much more to expect.
+	*msgp = NULL;
 	if (pipe->rxmsg == NULL) {
-		uint64_t len;
+		uint8_t *hdr = pipe->rxbuf + pipe->rxoff;
+		uint64_t hdrlen;
 
-		// Check to make sure we got msg type 1.
-		if (pipe->rxhead[0] != 1) {
-			rv = NNG_EPROTO;
-			goto recv_error;
+		// The header is a one byte message type, followed by the
+		// length.  We need all of it to know what to allocate.
+		if (avail < sizeof(pipe->rxhead)) {
+			return (0);
 		}
 
-		// We should have gotten a message header.
-		NNI_GET64(pipe->rxhead + 1, len);
+		// Check to make sure we got msg type 1.
+		if (hdr[0] != 1) {
+			return (NNG_EPROTO);
+		}
+		NNI_GET64(hdr + 1, hdrlen);
 
 		// Make sure the message payload is not too big.  If it is
 		// the caller will shut down the pipe.
-		if (len > pipe->rcvmax) {
-			rv = NNG_EMSGSIZE;
-			goto recv_error;
+		if (hdrlen > pipe->rcvmax) {
+			return (NNG_EMSGSIZE);
 		}
 
 		// Note that all IO on this pipe is blocked behind this
@@ -306,100 +417,187 @@ nni_ipc_pipe_recv_cb(void *arg)
 		// lock for the read side in the future, so that we allow
 		// transmits to proceed normally.  In practice this is
 		// unlikely to be much of an issue though.
-		if ((rv = nni_msg_alloc(&pipe->rxmsg, (size_t) len)) != 0) {
-			goto recv_error;
+		rv = nni_msg_alloc_nz(&pipe->rxmsg, (size_t) hdrlen);
+		if (rv != 0) {
+			return (rv);
 		}
+		pipe->rxoff += sizeof(pipe->rxhead);
+		pipe->rxgot = 0;
+		avail -= sizeof(pipe->rxhead);
+	}
 
-		if (len != 0) {
-			nni_iov iov;
-			// Submit the rest of the data for a read -- we want to
-			// read the entire message now.
-			iov.iov_buf = nni_msg_body(pipe->rxmsg);
-			iov.iov_len = (size_t) len;
-			nni_aio_set_iov(rxaio, 1, &iov);
-			nni_plat_ipc_pipe_recv(pipe->ipp, rxaio);
-			nni_mtx_unlock(&pipe->mtx);
-			return;
+	len = nni_msg_len(pipe->rxmsg);
+	if ((n = len - pipe->rxgot) > avail) {
+		n = avail;
+	}
+	if (n > 0) {
+		uint8_t *body = nni_msg_body(pipe->rxmsg);
+		memcpy(body + pipe->rxgot, pipe->rxbuf + pipe->rxoff, n);
+		pipe->rxgot += n;
+		pipe->rxoff += n;
+	}
+	if (pipe->rxoff == pipe->rxend) {
+		pipe->rxoff = 0;
+		pipe->rxend = 0;
+	}
+	if (pipe->rxgot == len) {
+		*msgp       = pipe->rxmsg;
+		pipe->rxmsg = NULL;
+	}
+	return (0);
+}
+
+// nni_ipc_pipe_rxstart starts a read for more data.  Any partial message
+// body is read in place, and whatever follows it goes into the buffer.
+static int
+nni_ipc_pipe_rxstart(nni_ipc_pipe *pipe)
+{
+	nni_iov  iov[2];
+	int      niov = 0;
+	uint8_t *buf;
+	size_t   sz;
+
+	// Allocate the buffer on first use, and grow it while reads keep
+	// filling it.  What is left over is at most part of a header.
+	if ((pipe->rxbuf == NULL) ||
+	    (pipe->rxfull && (pipe->rxsize < NNI_IPC_RXBUFSZ))) {
+		sz = (pipe->rxbuf == NULL) ? NNI_IPC_RXBUFMIN
+		                           : pipe->rxsize * 2;
+		if ((buf = nni_alloc(sz)) != NULL) {
+			if (pipe->rxbuf != NULL) {
+				memcpy(buf, pipe->rxbuf + pipe->rxoff,
+				    pipe->rxend - pipe->rxoff);
+				nni_free(pipe->rxbuf, pipe->rxsize);
+			}
+			pipe->rxend -= pipe->rxoff;
+			pipe->rxoff  = 0;
+			pipe->rxbuf  = buf;
+			pipe->rxsize = sz;
+		} else if (pipe->rxbuf == NULL) {
+			return (pipe->rxerr = NNG_ENOMEM);
 		}
 	}
+	pipe->rxfull = false;
+	if (pipe->rxoff > 0) {
+		memmove(pipe->rxbuf, pipe->rxbuf + pipe->rxoff,
+		    pipe->rxend - pipe->rxoff);
+		pipe->rxend -= pipe->rxoff;
+		pipe->rxoff = 0;
+	}
 
-	// Otherwise we got a message read completely.  Let the user know the
-	// good news.
-	pipe->user_rxaio = NULL;
-	msg              = pipe->rxmsg;
-	pipe->rxmsg      = NULL;
-	nni_mtx_unlock(&pipe->mtx);
+	pipe->rxdirect = 0;
+	if (pipe->rxmsg != NULL) {
+		uint8_t *body = nni_msg_body(pipe->rxmsg);
+
+		pipe->rxdirect    = nni_msg_len(pipe->rxmsg) - pipe->rxgot;
+		iov[niov].iov_buf = body + pipe->rxgot;
+		iov[niov].iov_len = pipe->rxdirect;
+		niov++;
+	}
+	iov[niov].iov_buf = pipe->rxbuf + pipe->rxend;
+	iov[niov].iov_len = pipe->rxsize - pipe->rxend;
+	niov++;
 
-	nni_aio_finish_msg(aio, msg);
-	return;
+	pipe->rxbusy = true;
+	nni_aio_set_iov(pipe->rxaio, niov, iov);
+	nni_plat_ipc_pipe_recv(pipe->ipp, pipe->rxaio);
+	return (0);
+}
+
+static void
+nni_ipc_pipe_recv_cb(void *arg)
+{
+	nni_ipc_pipe *pipe = arg;
+	nni_aio *     aio;
+	int           rv;
+	size_t        n;
+	nni_msg *     msg;
+	nni_aio *     rxaio = pipe->rxaio;
+
+	nni_mtx_lock(&pipe->mtx);
+	pipe->rxbusy = false;
+	if ((rv = nni_aio_result(rxaio)) != 0) {
+		// Error on receive.  The pipe is no good after this, so
+		// remember it for any later receives too.
+		pipe->rxerr = rv;
+	} else {
+		n = nni_aio_count(rxaio);
+		if (n > pipe->rxdirect) {
+			pipe->rxend += n - pipe->rxdirect;
+			pipe->rxfull = (pipe->rxend == pipe->rxsize);
+			n            = pipe->rxdirect;
+		}
+		pipe->rxgot += n;
+	}
+
+	if ((aio = pipe->user_rxaio) == NULL) {
+		// aio was canceled; keep what we read for the next one
+		nni_mtx_unlock(&pipe->mtx);
+		return;
+	}
+
+	if (((rv = pipe->rxerr) == 0) &&
+	    ((rv = pipe->rxerr = nni_ipc_pipe_rxparse(pipe, &msg)) == 0) &&
+	    (msg == NULL) && ((rv = nni_ipc_pipe_rxstart(pipe)) == 0)) {
+		nni_mtx_unlock(&pipe->mtx);
+		return;
+	}
 
-recv_error:
 	pipe->user_rxaio = NULL;
-	msg              = pipe->rxmsg;
-	pipe->rxmsg      = NULL;
 	nni_mtx_unlock(&pipe->mtx);
-	nni_msg_free(msg);
-	nni_aio_finish_error(aio, rv);
+	if (rv != 0) {
+		nni_aio_finish_error(aio, rv);
+	} else {
+		nni_aio_finish_msg(aio, msg);
+	}
 }
 
 static void
 nni_ipc_cancel_tx(nni_aio *aio, int rv)
 {
 	nni_ipc_pipe *pipe = nni_aio_get_prov_data(aio);
+	nni_aio *     a;
 
 	nni_mtx_lock(&pipe->mtx);
-	if (pipe->user_txaio != aio) {
+	if (!nni_aio_list_active(aio)) {
 		nni_mtx_unlock(&pipe->mtx);
 		return;
 	}
-	pipe->user_txaio = NULL;
+	NNI_LIST_FOREACH (&pipe->txq, a) {
+		if (a == aio) {
+			// Not written yet, so it can just be dropped.
+			nni_aio_list_remove(aio);
+			nni_mtx_unlock(&pipe->mtx);
+			nni_aio_finish_error(aio, rv);
+			return;
+		}
+	}
 	nni_mtx_unlock(&pipe->mtx);
 
+	// Already being written, so the write has to be stopped.  The
+	// error from that will fail the aio.
 	nni_aio_abort(pipe->txaio, rv);
-	nni_aio_finish_error(aio, rv);
 }
 
 static void
 nni_ipc_pipe_send(void *arg, nni_aio *aio)
 {
 	nni_ipc_pipe *pipe = arg;
-	nni_msg *     msg  = nni_aio_get_msg(aio);
-	uint64_t      len;
-	nni_aio *     txaio;
-	int           niov;
-	nni_iov       iov[3];
-
-	len = nni_msg_len(msg) + nni_msg_header_len(msg);
+	int           rv;
 
 	nni_mtx_lock(&pipe->mtx);
 	if (nni_aio_start(aio, nni_ipc_cancel_tx, pipe) != 0) {
 		nni_mtx_unlock(&pipe->mtx);
 		return;
 	}
-
-	pipe->user_txaio = aio;
-
-	pipe->txhead[0] = 1; // message type, 1.
-	NNI_PUT64(pipe->txhead + 1, len);
-
-	txaio          = pipe->txaio;
-	niov           = 0;
-	iov[0].iov_buf = pipe->txhead;
-	iov[0].iov_len = sizeof(pipe->txhead);
-	niov++;
-	if (nni_msg_header_len(msg) > 0) {
-		iov[niov].iov_buf = nni_msg_header(msg);
-		iov[niov].iov_len = nni_msg_header_len(msg);
-		niov++;
-	}
-	if (nni_msg_len(msg) > 0) {
-		iov[niov].iov_buf = nni_msg_body(msg);
-		iov[niov].iov_len = nni_msg_len(msg);
-		niov++;
+	if ((rv = pipe->txerr) != 0) {
+		nni_mtx_unlock(&pipe->mtx);
+		nni_aio_finish_error(aio, rv);
+		return;
 	}
-	nni_aio_set_iov(txaio, niov, iov);
 
-	nni_plat_ipc_pipe_send(pipe->ipp, txaio);
+	nni_aio_list_append(&pipe->txq, aio);
+	nni_ipc_pipe_txstart(pipe);
 	nni_mtx_unlock(&pipe->mtx);
 }
 
@@ -416,7 +614,7 @@ nni_ipc_cancel_rx(nni_aio *aio, int rv)
 	pipe->user_rxaio = NULL;
 	nni_mtx_unlock(&pipe->mtx);
 
-	nni_aio_abort(pipe->rxaio, rv);
+	// Any underlying read is left running; it only fills our buffer.
 	nni_aio_finish_error(aio, rv);
 }
 
@@ -424,8 +622,8 @@ static void
 nni_ipc_pipe_recv(void *arg, nni_aio *aio)
 {
 	nni_ipc_pipe *pipe = arg;
-	nni_aio *     rxaio;
-	nni_iov       iov;
+	nni_msg *     msg;
+	int           rv;
 
 	nni_mtx_lock(&pipe->mtx);
 
@@ -434,17 +632,23 @@ nni_ipc_pipe_recv(void *arg, nni_aio *aio)
 		return;
 	}
 
-	pipe->user_rxaio = aio;
-	NNI_ASSERT(pipe->rxmsg == NULL);
-
-	// Schedule a read of the IPC header.
-	rxaio       = pipe->rxaio;
-	iov.iov_buf = pipe->rxhead;
-	iov.iov_len = sizeof(pipe->rxhead);
-	nni_aio_set_iov(rxaio, 1, &iov);
-
-	nni_plat_ipc_pipe_recv(pipe->ipp, rxaio);
+	// An earlier read may already have brought in this message, in
+	// which case we can finish without doing any I/O at all.
+	if (((rv = pipe->rxerr) == 0) &&
+	    ((rv = pipe->rxerr = nni_ipc_pipe_rxparse(pipe, &msg)) == 0) &&
+	    (msg == NULL) &&
+	    (pipe->rxbusy || ((rv = nni_ipc_pipe_rxstart(pipe)) == 0))) {
+		pipe->user_rxaio = aio;
+		nni_mtx_unlock(&pipe->mtx);
+		return;
+	}
 	nni_mtx_unlock(&pipe->mtx);
+
+	if (rv != 0) {
+		nni_aio_finish_error(aio, rv);
+	} else {
+		nni_aio_finish_msg(aio, msg);
+	}
 }
 
 static void
@@ -489,6 +693,22 @@ nni_ipc_pipe_peer(void *arg)
 	return (pipe->peer);
 }
 
+static int
+nni_ipc_pipe_sendwin(void *arg)
+{
+	nni_ipc_pipe *pipe = arg;
+
+	return (pipe->txsize > 0 ? NNI_IPC_TXWIN : 1);
+}
+
+static void
+nni_ipc_pipe_stats(void *arg, nni_stat_item *group)
+{
+	nni_ipc_pipe *pipe = arg;
+
+	nni_stat_append(group, &pipe->txwrites);
+}
+
 static int
 nni_ipc_pipe_get_addr(void *arg, void *buf, size_t *szp)
 {
@@ -541,7 +761,8 @@ nni_ipc_ep_init(void **epp, nni_url *url, nni_sock *sock, int mode)
 		nni_ipc_ep_fini(ep);
 		return (rv);
 	}
-	ep->proto = nni_sock_proto(sock);
+	ep->proto      = nni_sock_proto(sock);
+	ep->txcoalesce = NNI_IPC_TXCOALESCE;
 
 	*epp = ep;
 	return (0);
@@ -695,6 +916,25 @@ nni_ipc_ep_getopt_recvmaxsz(void *arg, void *data, size_t *szp)
 	return (nni_getopt_size(ep->rcvmax, data, szp));
 }
 
+static int
+nni_ipc_ep_setopt_sendcoalesce(void *arg, const void *data, size_t sz)
+{
+	nni_ipc_ep *ep = arg;
+
+	if (ep == NULL) {
+		return (nni_chkopt_size(data, sz, 0, NNI_IPC_TXCOALESCE_MAX));
+	}
+	return (nni_setopt_size(
+	    &ep->txcoalesce, data, sz, 0, NNI_IPC_TXCOALESCE_MAX));
+}
+
+static int
+nni_ipc_ep_getopt_sendcoalesce(void *arg, void *data, size_t *szp)
+{
+	nni_ipc_ep *ep = arg;
+	return (nni_getopt_size(ep->txcoalesce, data, szp));
+}
+
 static int
 nni_ipc_ep_get_addr(void *arg, void *data, size_t *szp)
 {
@@ -713,10 +953,12 @@ static nni_tran_pipe nni_ipc_pipe_ops = {
 	.p_fini    = nni_ipc_pipe_fini,
 	.p_start   = nni_ipc_pipe_start,
 	.p_send    = nni_ipc_pipe_send,
+	.p_sendwin = nni_ipc_pipe_sendwin,
 	.p_recv    = nni_ipc_pipe_recv,
 	.p_close   = nni_ipc_pipe_close,
 	.p_peer    = nni_ipc_pipe_peer,
 	.p_options = nni_ipc_pipe_options,
+	.p_stats   = nni_ipc_pipe_stats,
 };
 
 static nni_tran_ep_option nni_ipc_ep_options[] = {
@@ -730,6 +972,11 @@ static nni_tran_ep_option nni_ipc_ep_options[] = {
 	    .eo_getopt = nni_ipc_ep_get_addr,
 	    .eo_setopt = NULL,
 	},
+	{
+	    .eo_name   = NNG_OPT_SENDCOALESCE,
+	    .eo_getopt = nni_ipc_ep_getopt_sendcoalesce,
+	    .eo_setopt = nni_ipc_ep_setopt_sendcoalesce,
+	},
 	// terminate list
 	{ NULL, NULL, NULL },
 };
@@ -20,14 +20,42 @@
 typedef struct nni_tcp_pipe nni_tcp_pipe;
 typedef struct nni_tcp_ep   nni_tcp_ep;
 
+// Received data is read into a per-pipe buffer, and messages are carved
+// out of it.  This lets a single read pick up many small messages at
+// once.  The remainder of a message body that did not fit is read
+// directly into the message.  The buffer is allocated at the smaller
+// size on the first read, and only grows when a read fills it.
+#define NNI_TCP_RXBUFMIN 4096
+#define NNI_TCP_RXBUFSZ 65536
+
+// When several small messages are waiting to be sent, they are copied
+// into a buffer of up to this many bytes (NNG_OPT_SENDCOALESCE), and go
+// out in a single write.  The buffer is only allocated the first time
+// that happens.  A message on its own is written in place.  So that
+// messages can wait, protocols may keep up to NNI_TCP_TXWIN sends
+// outstanding on a pipe that coalesces, rather than just one.
+#define NNI_TCP_TXCOALESCE 32768
+#define NNI_TCP_TXCOALESCE_MAX (1024 * 1024)
+#define NNI_TCP_TXWIN 32
+
+// Largest kernel socket buffer we will ask for (setsockopt takes an int).
+#define NNI_TCP_SOCKBUF_MAX 0x7fffffff
+
+// Listen backlog (NNG_OPT_TCP_LISTEN_BACKLOG), and the limits for it and
+// for the number of listening sockets (NNG_OPT_TCP_LISTEN_SHARDS).  The
+// system may cap the backlog further (e.g. net.core.somaxconn on Linux).
+#define NNI_TCP_BACKLOG 128
+#define NNI_TCP_BACKLOG_MAX 65535
+#define NNI_TCP_SHARDS_MAX 64
+
 // nni_tcp_pipe is one end of a TCP connection.
 struct nni_tcp_pipe {
 	nni_plat_tcp_pipe *tpp;
 	uint16_t           peer;
 	uint16_t           proto;
 	size_t             rcvmax;
+	nni_plat_tcp_opts  tcpopts;
 
-	nni_aio *user_txaio;
 	nni_aio *user_rxaio;
 	nni_aio *user_negaio;
 
@@ -40,22 +68,43 @@ struct nni_tcp_pipe {
 	nni_aio *txaio;
 	nni_aio *rxaio;
 	nni_aio *negaio;
+	nni_list txq;    // sends waiting to be written
+	nni_list txsent; // sends in the write in progress
+	uint8_t *txbuf;  // coalescing buffer, allocated on first use
+	size_t   txsize; // size of txbuf, 0 if not coalescing
+	bool     txbusy; // a write is in progress
+	int      txerr;
 	nni_msg *rxmsg;
+	size_t   rxgot;    // bytes of rxmsg body filled in so far
+	size_t   rxdirect; // bytes of current read going into rxmsg
+	uint8_t *rxbuf;
+	size_t   rxsize; // size of rxbuf, 0 until the first read
+	size_t   rxoff;  // start of unconsumed data in rxbuf
+	size_t   rxend;  // end of unconsumed data in rxbuf
+	bool     rxfull; // last read filled rxbuf, so grow it
+	bool     rxbusy;
+	int      rxerr;
 	nni_mtx  mtx;
+
+	nni_stat_item txwrites;
 };
 
 struct nni_tcp_ep {
-	nni_plat_tcp_ep *tep;
-	uint16_t         proto;
-	size_t           rcvmax;
-	nni_duration     linger;
-	int              ipv4only;
-	nni_aio *        aio;
-	nni_aio *        user_aio;
-	nni_url *        url;
-	nng_sockaddr     bsa; // bound addr
-	int              mode;
-	nni_mtx          mtx;
+	nni_plat_tcp_ep * tep;
+	uint16_t          proto;
+	size_t            rcvmax;
+	size_t            txcoalesce;
+	nni_plat_tcp_opts tcpopts; // applied to each new connection
+	int               backlog;
+	int               nshards;
+	nni_duration      linger;
+	int               ipv4only;
+	nni_aio *         aio;
+	nni_aio *         user_aio;
+	nni_url *         url;
+	nng_sockaddr      bsa; // bound addr
+	int               mode;
+	nni_mtx           mtx;
 };
 
 static void nni_tcp_pipe_send_cb(void *);
@@ -100,6 +149,12 @@ nni_tcp_pipe_fini(void *arg)
 	if (p->rxmsg) {
 		nni_msg_free(p->rxmsg);
 	}
+	if (p->rxbuf != NULL) {
+		nni_free(p->rxbuf, p->rxsize);
+	}
+	if (p->txbuf != NULL) {
+		nni_free(p->txbuf, p->txsize);
+	}
 
 	NNI_FREE_STRUCT(p);
 }
@@ -120,10 +175,17 @@ nni_tcp_pipe_init(nni_tcp_pipe **pipep, nni_tcp_ep *ep, void *tpp)
 		nni_tcp_pipe_fini(p);
 		return (rv);
 	}
-
-	p->proto  = ep->proto;
-	p->rcvmax = ep->rcvmax;
-	p->tpp    = tpp;
+	nni_aio_list_init(&p->txq);
+	nni_aio_list_init(&p->txsent);
+	nni_stat_init(&p->txwrites, "tx_writes", "writes of sent messages",
+	    NNG_STAT_COUNTER, NNG_UNIT_EVENTS);
+
+	p->txsize  = ep->txcoalesce;
+	p->proto   = ep->proto;
+	p->rcvmax  = ep->rcvmax;
+	p->tcpopts = ep->tcpopts;
+	p->tpp     = tpp;
+	nni_plat_tcp_pipe_setopts(tpp, &p->tcpopts);
 
 	*pipep = p;
 	return (0);
@@ -203,29 +265,115 @@ done:
 	nni_mtx_unlock(&p->mtx);
 }
 
+// nni_tcp_pipe_txstart starts a write of whatever sends are waiting.  If
+// there are several small ones, as many as fit are copied into the
+// coalescing buffer and go out together.  Otherwise the first message
+// is written in place.  The sends complete once the write is done.
+static void
+nni_tcp_pipe_txstart(nni_tcp_pipe *p)
+{
+	nni_iov  iov[3];
+	int      niov = 0;
+	nni_aio *aio;
+	nni_msg *msg;
+	size_t   len;
+
+	if (p->txbusy || ((aio = nni_list_first(&p->txq)) == NULL)) {
+		return;
+	}
+	msg = nni_aio_get_msg(aio);
+	len = sizeof(p->txlen) + nni_msg_header_len(msg) + nni_msg_len(msg);
+
+	if ((nni_list_next(&p->txq, aio) != NULL) && (len <= p->txsize) &&
+	    ((p->txbuf != NULL) ||
+	        ((p->txbuf = nni_alloc(p->txsize)) != NULL))) {
+		size_t fill = 0;
+
+		while ((aio = nni_list_first(&p->txq)) != NULL) {
+			uint8_t *buf = p->txbuf + fill;
+			size_t   hlen;
+
+			msg  = nni_aio_get_msg(aio);
+			hlen = nni_msg_header_len(msg);
+			len  = nni_msg_len(msg);
+			if (fill + sizeof(p->txlen) + hlen + len > p->txsize) {
+				break;
+			}
+			NNI_PUT64(buf, (uint64_t)(hlen + len));
+			buf += sizeof(p->txlen);
+			memcpy(buf, nni_msg_header(msg), hlen);
+			memcpy(buf + hlen, nni_msg_body(msg), len);
+			fill += sizeof(p->txlen) + hlen + len;
+			nni_aio_list_remove(aio);
+			nni_list_append(&p->txsent, aio);
+		}
+		iov[niov].iov_buf = p->txbuf;
+		iov[niov].iov_len = fill;
+		niov++;
+	} else {
+		nni_aio_list_remove(aio);
+		nni_list_append(&p->txsent, aio);
+
+		NNI_PUT64(p->txlen, len - sizeof(p->txlen));
+		iov[niov].iov_buf = p->txlen;
+		iov[niov].iov_len = sizeof(p->txlen);
+		niov++;
+		if (nni_msg_header_len(msg) > 0) {
+			iov[niov].iov_buf = nni_msg_header(msg);
+			iov[niov].iov_len = nni_msg_header_len(msg);
+			niov++;
+		}
+		if (nni_msg_len(msg) > 0) {
+			iov[niov].iov_buf = nni_msg_body(msg);
+			iov[niov].iov_len = nni_msg_len(msg);
+			niov++;
+		}
+	}
+	p->txbusy = true;
+	nni_stat_inc(&p->txwrites, 1);
+	nni_aio_set_iov(p->txaio, niov, iov);
+	nni_plat_tcp_pipe_send(p->tpp, p->txaio);
+}
+
+// nni_tcp_pipe_txfinish completes the sends on the list, failing them
+// if rv is non-zero.  The caller holds the lock.
+static void
+nni_tcp_pipe_txfinish(nni_list *list, int rv)
+{
+	nni_aio *aio;
+
+	while ((aio = nni_list_first(list)) != NULL) {
+		nni_msg *msg = nni_aio_get_msg(aio);
+		size_t   n   = nni_msg_len(msg);
+
+		nni_aio_list_remove(aio);
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(msg);
+		if (rv != 0) {
+			nni_aio_finish_error(aio, rv);
+		} else {
+			nni_aio_finish(aio, 0, n);
+		}
+	}
+}
+
 static void
 nni_tcp_pipe_send_cb(void *arg)
 {
 	nni_tcp_pipe *p = arg;
 	int           rv;
-	nni_aio *     aio;
 	size_t        n;
-	nni_msg *     msg;
 	nni_aio *     txaio = p->txaio;
 
 	nni_mtx_lock(&p->mtx);
-	if ((aio = p->user_txaio) == NULL) {
-		nni_mtx_unlock(&p->mtx);
-		return;
-	}
-
 	if ((rv = nni_aio_result(txaio)) != 0) {
-		p->user_txaio = NULL;
+		// The stream is broken, and the pipe with it, so everything
+		// that has not been written fails.
+		p->txbusy = false;
+		p->txerr  = rv;
+		nni_tcp_pipe_txfinish(&p->txsent, rv);
+		nni_tcp_pipe_txfinish(&p->txq, rv);
 		nni_mtx_unlock(&p->mtx);
-		msg = nni_aio_get_msg(aio);
-		nni_aio_set_msg(aio, NULL);
-		nni_msg_free(msg);
-		nni_aio_finish_error(aio, rv);
 		return;
 	}
 
@@ -237,12 +385,121 @@ nni_tcp_pipe_send_cb(void *arg)
 		return;
 	}
 
+	p->txbusy = false;
+	nni_tcp_pipe_txfinish(&p->txsent, 0);
+	nni_tcp_pipe_txstart(p);
 	nni_mtx_unlock(&p->mtx);
-	msg = nni_aio_get_msg(aio);
-	n   = nni_msg_len(msg);
-	nni_aio_set_msg(aio, NULL);
-	nni_msg_free(msg);
-	nni_aio_finish(aio, 0, n);
+}
+
+// nni_tcp_pipe_rxparse tries to complete a message using only data that
+// has already been buffered.  On success, *msgp is set to the message, or
+// to NULL if more data must be read first.
+static int
+nni_tcp_pipe_rxparse(nni_tcp_pipe *p, nni_msg **msgp)
+{
+	size_t avail = p->rxend - p->rxoff;
+	size_t len;
+	size_t n;
+	int    rv;
+
+	*msgp = NULL;
+	if (p->rxmsg == NULL) {
+		uint64_t hdr;
+
+		// We need the header, which is just the length, before we
+		// know how big a message to allocate.
+		if (avail < sizeof(hdr)) {
+			return (0);
+		}
+		NNI_GET64(p->rxbuf + p->rxoff, hdr);
+
+		// Make sure the message payload is not too big.  If it is
+		// the caller will shut down the pipe.
+		if (hdr > p->rcvmax) {
+			return (NNG_EMSGSIZE);
+		}
+		if ((rv = nni_msg_alloc_nz(&p->rxmsg, (size_t) hdr)) != 0) {
+			return (rv);
+		}
+		p->rxoff += sizeof(hdr);
+		p->rxgot = 0;
+		avail -= sizeof(hdr);
+	}
+
+	len = nni_msg_len(p->rxmsg);
+	if ((n = len - p->rxgot) > avail) {
+		n = avail;
+	}
+	if (n > 0) {
+		uint8_t *body = nni_msg_body(p->rxmsg);
+		memcpy(body + p->rxgot, p->rxbuf + p->rxoff, n);
+		p->rxgot += n;
+		p->rxoff += n;
+	}
+	if (p->rxoff == p->rxend) {
+		p->rxoff = 0;
+		p->rxend = 0;
+	}
+	if (p->rxgot == len) {
+		*msgp    = p->rxmsg;
+		p->rxmsg = NULL;
+	}
+	return (0);
+}
+
+// nni_tcp_pipe_rxstart starts a read for more data.  Any partial message
+// body is read in place, and whatever follows it goes into the buffer.
+static int
+nni_tcp_pipe_rxstart(nni_tcp_pipe *p)
+{
+	nni_iov  iov[2];
+	int      niov = 0;
+	uint8_t *buf;
+	size_t   sz;
+
+	// Allocate the buffer on first use, and grow it while reads keep
+	// filling it.  What is left over is at most part of a header.
+	if ((p->rxbuf == NULL) ||
+	    (p->rxfull && (p->rxsize < NNI_TCP_RXBUFSZ))) {
+		sz = (p->rxbuf == NULL) ? NNI_TCP_RXBUFMIN : p->rxsize * 2;
+		if ((buf = nni_alloc(sz)) != NULL) {
+			if (p->rxbuf != NULL) {
+				memcpy(buf, p->rxbuf + p->rxoff,
+				    p->rxend - p->rxoff);
+				nni_free(p->rxbuf, p->rxsize);
+			}
+			p->rxend -= p->rxoff;
+			p->rxoff  = 0;
+			p->rxbuf  = buf;
+			p->rxsize = sz;
+		} else if (p->rxbuf == NULL) {
+			return (p->rxerr = NNG_ENOMEM);
+		}
+	}
+	p->rxfull = false;
+	if (p->rxoff > 0) {
+		memmove(p->rxbuf, p->rxbuf + p->rxoff, p->rxend - p->rxoff);
+		p->rxend -= p->rxoff;
+		p->rxoff = 0;
+	}
+
+	p->rxdirect = 0;
+	if (p->rxmsg != NULL) {
+		uint8_t *body = nni_msg_body(p->rxmsg);
+
+		p->rxdirect       = nni_msg_len(p->rxmsg) - p->rxgot;
+		iov[niov].iov_buf = body + p->rxgot;
+		iov[niov].iov_len = p->rxdirect;
+		niov++;
+	}
+	iov[niov].iov_buf = p->rxbuf + p->rxend;
+	iov[niov].iov_len = p->rxsize - p->rxend;
+	niov++;
+
+	p->rxbusy = true;
+	nni_aio_set_iov(p->rxaio, niov, iov);
+	nni_plat_tcp_pipe_recv(p->tpp, p->rxaio);
+	return (0);
 }
 
 static void
@@ -253,109 +510,75 @@ nni_tcp_pipe_recv_cb(void *arg)
 	int           rv;
 	size_t        n;
 	nni_msg *     msg;
-	nni_aio *     rxaio;
 
 	nni_mtx_lock(&p->mtx);
+	p->rxbusy = false;
+	if ((rv = nni_aio_result(p->rxaio)) != 0) {
+		p->rxerr = rv;
+	} else {
+		n = nni_aio_count(p->rxaio);
+		if (n > p->rxdirect) {
+			p->rxend += n - p->rxdirect;
+			p->rxfull = (p->rxend == p->rxsize);
+			n         = p->rxdirect;
+		}
+		p->rxgot += n;
+	}
 
 	if ((aio = p->user_rxaio) == NULL) {
-		// Canceled.
+		// Canceled.  Anything we read is kept for the next receive.
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
-	rxaio = p->rxaio;
-
-	if ((rv = nni_aio_result(rxaio)) != 0) {
-		goto recv_error;
-	}
-
-	n = nni_aio_count(rxaio);
-	nni_aio_iov_advance(rxaio, n);
-	if (nni_aio_iov_count(rxaio) > 0) {
-		nni_plat_tcp_pipe_recv(p->tpp, rxaio);
+	if (((rv = p->rxerr) == 0) &&
+	    ((rv = p->rxerr = nni_tcp_pipe_rxparse(p, &msg)) == 0) &&
+	    (msg == NULL) && ((rv = nni_tcp_pipe_rxstart(p)) == 0)) {
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
 
-	// If we don't have a message yet, we were reading the TCP message
-	// header, which is just the length.  This tells us the size of the
-	// message to allocate and how much more to expect.
-	if (p->rxmsg == NULL) {
-		uint64_t len;
-		// We should have gotten a message header.
-		NNI_GET64(p->rxlen, len);
-
-		// Make sure the message payload is not too big.  If it is
-		// the caller will shut down the pipe.
-		if (len > p->rcvmax) {
-			rv = NNG_EMSGSIZE;
-			goto recv_error;
-		}
-
-		if ((rv = nni_msg_alloc(&p->rxmsg, (size_t) len)) != 0) {
-			goto recv_error;
-		}
-
-		// Submit the rest of the data for a read -- we want to
-		// read the entire message now.
-		if (len != 0) {
-			nni_iov iov;
-			iov.iov_buf = nni_msg_body(p->rxmsg);
-			iov.iov_len = (size_t) len;
-
-			nni_aio_set_iov(rxaio, 1, &iov);
-			nni_plat_tcp_pipe_recv(p->tpp, rxaio);
-			nni_mtx_unlock(&p->mtx);
-			return;
-		}
-	}
-
-	// We read a message completely.  Let the user know the good news.
-	p->user_rxaio = NULL;
-	msg           = p->rxmsg;
-	p->rxmsg      = NULL;
-	nni_mtx_unlock(&p->mtx);
-	nni_aio_finish_msg(aio, msg);
-	return;
-
-recv_error:
 	p->user_rxaio = NULL;
-	msg           = p->rxmsg;
-	p->rxmsg      = NULL;
 	nni_mtx_unlock(&p->mtx);
-	nni_msg_free(msg);
-	nni_aio_finish_error(aio, rv);
+	if (rv != 0) {
+		nni_aio_finish_error(aio, rv);
+	} else {
+		nni_aio_finish_msg(aio, msg);
+	}
 }
 
 static void
 nni_tcp_cancel_tx(nni_aio *aio, int rv)
 {
 	nni_tcp_pipe *p = nni_aio_get_prov_data(aio);
+	nni_aio *     a;
 
 	nni_mtx_lock(&p->mtx);
-	if (p->user_txaio != aio) {
+	if (!nni_aio_list_active(aio)) {
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
-	p->user_txaio = NULL;
+	NNI_LIST_FOREACH (&p->txq, a) {
+		if (a == aio) {
+			// Not written yet, so we can just drop it.
+			nni_aio_list_remove(aio);
+			nni_mtx_unlock(&p->mtx);
+			nni_aio_finish_error(aio, rv);
+			return;
+		}
+	}
 	nni_mtx_unlock(&p->mtx);
 
-	// cancel the underlying operation.
+	// Already being written, so we have to stop the write.  The error
+	// from that will fail the aio.
 	nni_aio_abort(p->txaio, rv);
-	nni_aio_finish_error(aio, rv);
 }
 
 static void
 nni_tcp_pipe_send(void *arg, nni_aio *aio)
 {
-	nni_tcp_pipe *p   = arg;
-	nni_msg *     msg = nni_aio_get_msg(aio);
-	uint64_t      len;
-	nni_aio *     txaio;
-	int           niov;
-	nni_iov       iov[3];
-
-	len = nni_msg_len(msg) + nni_msg_header_len(msg);
+	nni_tcp_pipe *p = arg;
+	int           rv;
 
 	nni_mtx_lock(&p->mtx);
 
@@ -363,29 +586,14 @@ nni_tcp_pipe_send(void *arg, nni_aio *aio)
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
-
-	p->user_txaio = aio;
-
-	NNI_PUT64(p->txlen, len);
-
-	niov              = 0;
-	txaio             = p->txaio;
-	iov[niov].iov_buf = p->txlen;
-	iov[niov].iov_len = sizeof(p->txlen);
-	niov++;
-	if (nni_msg_header_len(msg) > 0) {
-		iov[niov].iov_buf = nni_msg_header(msg);
-		iov[niov].iov_len = nni_msg_header_len(msg);
-		niov++;
-	}
-	if (nni_msg_len(msg) > 0) {
-		iov[niov].iov_buf = nni_msg_body(msg);
-		iov[niov].iov_len = nni_msg_len(msg);
-		niov++;
+	if ((rv = p->txerr) != 0) {
+		nni_mtx_unlock(&p->mtx);
+		nni_aio_finish_error(aio, rv);
+		return;
 	}
-	nni_aio_set_iov(txaio, niov, iov);
 
-	nni_plat_tcp_pipe_send(p->tpp, txaio);
+	nni_aio_list_append(&p->txq, aio);
+	nni_tcp_pipe_txstart(p);
 	nni_mtx_unlock(&p->mtx);
 }
 
@@ -402,8 +610,8 @@ nni_tcp_cancel_rx(nni_aio *aio, int rv)
 	p->user_rxaio = NULL;
 	nni_mtx_unlock(&p->mtx);
 
-	// cancel the underlying operation.
-	nni_aio_abort(p->rxaio, rv);
+	// We leave any underlying read running; it only fills our buffer,
+	// and the data will be there for the next receive.
 	nni_aio_finish_error(aio, rv);
 }
 
@@ -411,8 +619,8 @@ static void
 nni_tcp_pipe_recv(void *arg, nni_aio *aio)
 {
 	nni_tcp_pipe *p = arg;
-	nni_aio *     rxaio;
-	nni_iov       iov;
+	nni_msg *     msg;
+	int           rv;
 
 	nni_mtx_lock(&p->mtx);
 
@@ -420,18 +628,24 @@ nni_tcp_pipe_recv(void *arg, nni_aio *aio)
 		nni_mtx_unlock(&p->mtx);
 		return;
 	}
-	p->user_rxaio = aio;
-
-	NNI_ASSERT(p->rxmsg == NULL);
-
-	// Schedule a read of the TCP header.
-	rxaio       = p->rxaio;
-	iov.iov_buf = p->rxlen;
-	iov.iov_len = sizeof(p->rxlen);
-	nni_aio_set_iov(rxaio, 1, &iov);
 
-	nni_plat_tcp_pipe_recv(p->tpp, rxaio);
+	// An earlier read may already have brought in this message, in
+	// which case we can finish without doing any I/O at all.
+	if (((rv = p->rxerr) == 0) &&
+	    ((rv = p->rxerr = nni_tcp_pipe_rxparse(p, &msg)) == 0) &&
+	    (msg == NULL) &&
+	    (p->rxbusy || ((rv = nni_tcp_pipe_rxstart(p)) == 0))) {
+		p->user_rxaio = aio;
+		nni_mtx_unlock(&p->mtx);
+		return;
+	}
 	nni_mtx_unlock(&p->mtx);
+
+	if (rv != 0) {
+		nni_aio_finish_error(aio, rv);
+	} else {
+		nni_aio_finish_msg(aio, msg);
+	}
 }
 
 static uint16_t
@@ -442,6 +656,22 @@ nni_tcp_pipe_peer(void *arg)
 	return (p->peer);
 }
 
+static int
+nni_tcp_pipe_sendwin(void *arg)
+{
+	nni_tcp_pipe *p = arg;
+
+	return (p->txsize > 0 ? NNI_TCP_TXWIN : 1);
+}
+
+static void
+nni_tcp_pipe_stats(void *arg, nni_stat_item *group)
+{
+	nni_tcp_pipe *p = arg;
+
+	nni_stat_append(group, &p->txwrites);
+}
+
 static int
 nni_tcp_pipe_getopt_locaddr(void *arg, void *v, size_t *szp)
 {
@@ -470,6 +700,20 @@ nni_tcp_pipe_getopt_remaddr(void *arg, void *v, size_t *szp)
 	return (rv);
 }
 
+static int
+nni_tcp_pipe_getopt_nodelay(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_pipe *p = arg;
+	return (nni_getopt_int(p->tcpopts.nodelay, v, szp));
+}
+
+static int
+nni_tcp_pipe_getopt_keepalive(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_pipe *p = arg;
+	return (nni_getopt_int(p->tcpopts.keepalive, v, szp));
+}
+
 // Note that the url *must* be in a modifiable buffer.
 static void
 nni_tcp_pipe_start(void *arg, nni_aio *aio)
@@ -592,8 +836,13 @@ nni_tcp_ep_init(void **epp, nni_url *url, nni_sock *sock, int mode)
 		nni_tcp_ep_fini(ep);
 		return (rv);
 	}
-	ep->proto = nni_sock_proto(sock);
-	ep->mode  = mode;
+	ep->proto      = nni_sock_proto(sock);
+	ep->mode       = mode;
+	ep->txcoalesce = NNI_TCP_TXCOALESCE;
+
+	ep->tcpopts.nodelay = true;
+	ep->backlog         = NNI_TCP_BACKLOG;
+	ep->nshards         = 1;
 
 	*epp = ep;
 	return (0);
@@ -618,6 +867,7 @@ nni_tcp_ep_bind(void *arg)
 	int         rv;
 
 	nni_mtx_lock(&ep->mtx);
+	nni_plat_tcp_ep_set_listen(ep->tep, ep->backlog, ep->nshards);
 	rv = nni_plat_tcp_ep_listen(ep->tep, &ep->bsa);
 	nni_mtx_unlock(&ep->mtx);
 
@@ -759,6 +1009,24 @@ nni_tcp_ep_getopt_recvmaxsz(void *arg, void *v, size_t *szp)
 	return (nni_getopt_size(ep->rcvmax, v, szp));
 }
 
+static int
+nni_tcp_ep_setopt_sendcoalesce(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	if (ep == NULL) {
+		return (nni_chkopt_size(v, sz, 0, NNI_TCP_TXCOALESCE_MAX));
+	}
+	return (nni_setopt_size(
+	    &ep->txcoalesce, v, sz, 0, NNI_TCP_TXCOALESCE_MAX));
+}
+
+static int
+nni_tcp_ep_getopt_sendcoalesce(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_size(ep->txcoalesce, v, szp));
+}
+
 static int
 nni_tcp_ep_setopt_linger(void *arg, const void *v, size_t sz)
 {
@@ -776,9 +1044,204 @@ nni_tcp_ep_getopt_linger(void *arg, void *v, size_t *szp)
 	return (nni_getopt_ms(ep->linger, v, szp));
 }
 
+static int
+nni_tcp_ep_setopt_flag(nni_tcp_ep *ep, bool *flagp, const void *v, size_t sz)
+{
+	int val;
+	int rv;
+
+	if (ep == NULL) {
+		return (nni_chkopt_int(v, sz, 0, 1));
+	}
+	if ((rv = nni_setopt_int(&val, v, sz, 0, 1)) == 0) {
+		*flagp = (val != 0);
+	}
+	return (rv);
+}
+
+static int
+nni_tcp_ep_setopt_nodelay(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_tcp_ep_setopt_flag(
+	    ep, ep != NULL ? &ep->tcpopts.nodelay : NULL, v, sz));
+}
+
+static int
+nni_tcp_ep_getopt_nodelay(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_int(ep->tcpopts.nodelay, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_quickack(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_tcp_ep_setopt_flag(
+	    ep, ep != NULL ? &ep->tcpopts.quickack : NULL, v, sz));
+}
+
+static int
+nni_tcp_ep_getopt_quickack(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_int(ep->tcpopts.quickack, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_keepalive(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_tcp_ep_setopt_flag(
+	    ep, ep != NULL ? &ep->tcpopts.keepalive : NULL, v, sz));
+}
+
+static int
+nni_tcp_ep_getopt_keepalive(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_int(ep->tcpopts.keepalive, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_keepidle(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	if (ep == NULL) {
+		return (nni_chkopt_ms(v, sz));
+	}
+	return (nni_setopt_ms(&ep->tcpopts.keepidle, v, sz));
+}
+
+static int
+nni_tcp_ep_getopt_keepidle(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_ms(ep->tcpopts.keepidle, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_keepintvl(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	if (ep == NULL) {
+		return (nni_chkopt_ms(v, sz));
+	}
+	return (nni_setopt_ms(&ep->tcpopts.keepintvl, v, sz));
+}
+
+static int
+nni_tcp_ep_getopt_keepintvl(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_ms(ep->tcpopts.keepintvl, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_keepcnt(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	if (ep == NULL) {
+		return (nni_chkopt_int(v, sz, 0, 255));
+	}
+	return (nni_setopt_int(&ep->tcpopts.keepcnt, v, sz, 0, 255));
+}
+
+static int
+nni_tcp_ep_getopt_keepcnt(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_int(ep->tcpopts.keepcnt, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_sndbuf(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	if (ep == NULL) {
+		return (nni_chkopt_size(v, sz, 0, NNI_TCP_SOCKBUF_MAX));
+	}
+	return (nni_setopt_size(
+	    &ep->tcpopts.sndbuf, v, sz, 0, NNI_TCP_SOCKBUF_MAX));
+}
+
+static int
+nni_tcp_ep_getopt_sndbuf(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_size(ep->tcpopts.sndbuf, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_rcvbuf(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	if (ep == NULL) {
+		return (nni_chkopt_size(v, sz, 0, NNI_TCP_SOCKBUF_MAX));
+	}
+	return (nni_setopt_size(
+	    &ep->tcpopts.rcvbuf, v, sz, 0, NNI_TCP_SOCKBUF_MAX));
+}
+
+static int
+nni_tcp_ep_getopt_rcvbuf(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_size(ep->tcpopts.rcvbuf, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_backlog(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	int         val;
+	int         rv;
+
+	rv = nni_setopt_int(&val, v, sz, 1, NNI_TCP_BACKLOG_MAX);
+	if ((rv == 0) && (ep != NULL)) {
+		nni_mtx_lock(&ep->mtx);
+		ep->backlog = val;
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
+static int
+nni_tcp_ep_getopt_backlog(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_int(ep->backlog, v, szp));
+}
+
+static int
+nni_tcp_ep_setopt_shards(void *arg, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+	int         val;
+	int         rv;
+
+	rv = nni_setopt_int(&val, v, sz, 1, NNI_TCP_SHARDS_MAX);
+	if ((rv == 0) && (ep != NULL)) {
+		nni_mtx_lock(&ep->mtx);
+		ep->nshards = val;
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
+static int
+nni_tcp_ep_getopt_shards(void *arg, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+	return (nni_getopt_int(ep->nshards, v, szp));
+}
+
 static nni_tran_pipe_option nni_tcp_pipe_options[] = {
 	{ NNG_OPT_LOCADDR, nni_tcp_pipe_getopt_locaddr },
 	{ NNG_OPT_REMADDR, nni_tcp_pipe_getopt_remaddr },
+	{ NNG_OPT_TCP_NODELAY, nni_tcp_pipe_getopt_nodelay },
+	{ NNG_OPT_TCP_KEEPALIVE, nni_tcp_pipe_getopt_keepalive },
 	// terminate list
 	{ NULL, NULL }
 };
@@ -787,10 +1250,12 @@ static nni_tran_pipe nni_tcp_pipe_ops = {
 	.p_fini    = nni_tcp_pipe_fini,
 	.p_start   = nni_tcp_pipe_start,
 	.p_send    = nni_tcp_pipe_send,
+	.p_sendwin = nni_tcp_pipe_sendwin,
 	.p_recv    = nni_tcp_pipe_recv,
 	.p_close   = nni_tcp_pipe_close,
 	.p_peer    = nni_tcp_pipe_peer,
 	.p_options = nni_tcp_pipe_options,
+	.p_stats   = nni_tcp_pipe_stats,
 };
 
 static nni_tran_ep_option nni_tcp_ep_options[] = {
@@ -809,6 +1274,61 @@ static nni_tran_ep_option nni_tcp_ep_options[] = {
 	    .eo_getopt = nni_tcp_ep_getopt_linger,
 	    .eo_setopt = nni_tcp_ep_setopt_linger,
 	},
+	{
+	    .eo_name   = NNG_OPT_SENDCOALESCE,
+	    .eo_getopt = nni_tcp_ep_getopt_sendcoalesce,
+	    .eo_setopt = nni_tcp_ep_setopt_sendcoalesce,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_NODELAY,
+	    .eo_getopt = nni_tcp_ep_getopt_nodelay,
+	    .eo_setopt = nni_tcp_ep_setopt_nodelay,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_QUICKACK,
+	    .eo_getopt = nni_tcp_ep_getopt_quickack,
+	    .eo_setopt = nni_tcp_ep_setopt_quickack,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_KEEPALIVE,
+	    .eo_getopt = nni_tcp_ep_getopt_keepalive,
+	    .eo_setopt = nni_tcp_ep_setopt_keepalive,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_KEEPALIVE_IDLE,
+	    .eo_getopt = nni_tcp_ep_getopt_keepidle,
+	    .eo_setopt = nni_tcp_ep_setopt_keepidle,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_KEEPALIVE_INTERVAL,
+	    .eo_getopt = nni_tcp_ep_getopt_keepintvl,
+	    .eo_setopt = nni_tcp_ep_setopt_keepintvl,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_KEEPALIVE_COUNT,
+	    .eo_getopt = nni_tcp_ep_getopt_keepcnt,
+	    .eo_setopt = nni_tcp_ep_setopt_keepcnt,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_SENDBUF,
+	    .eo_getopt = nni_tcp_ep_getopt_sndbuf,
+	    .eo_setopt = nni_tcp_ep_setopt_sndbuf,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_RECVBUF,
+	    .eo_getopt = nni_tcp_ep_getopt_rcvbuf,
+	    .eo_setopt = nni_tcp_ep_setopt_rcvbuf,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_LISTEN_BACKLOG,
+	    .eo_getopt = nni_tcp_ep_getopt_backlog,
+	    .eo_setopt = nni_tcp_ep_setopt_backlog,
+	},
+	{
+	    .eo_name   = NNG_OPT_TCP_LISTEN_SHARDS,
+	    .eo_getopt = nni_tcp_ep_getopt_shards,
+	    .eo_setopt = nni_tcp_ep_setopt_shards,
+	},
 	// terminate list
 	{ NULL, NULL, NULL },
 };
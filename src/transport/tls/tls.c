@@ -302,7 +302,7 @@ nni_tls_pipe_recv_cb(void *arg)
 			goto recv_error;
 		}
 
-		if ((rv = nni_msg_alloc(&p->rxmsg, (size_t) len)) != 0) {
+		if ((rv = nni_msg_alloc_nz(&p->rxmsg, (size_t) len)) != 0) {
 			goto recv_error;
 		}
 
@@ -0,0 +1,1957 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core/nng_impl.h"
+#include "udp.h"
+
+// UDP Transport.  UDP is connectionless, and unreliable, but nng is
+// designed around connection oriented paradigms.  So, just as the
+// ZeroTier transport does, we create an "unreliable" connection on top
+// using our own small network protocol, which is the ZeroTier one with
+// the ZeroTier addressing replaced by 32-bit session IDs.  A handshake
+// (a connection request, answered by an acknowledgement) establishes a
+// session between a pair of IDs, every datagram carries the IDs of both
+// ends, and idle sessions are kept alive with pings.  Messages larger
+// than a datagram are split into fragments, and reassembled by the
+// receiver.  Nothing is ever retransmitted, so a message is lost if any
+// of its fragments is.
+//
+// A listener has a single UDP socket, which is shared by all the pipes
+// it accepts; arriving datagrams are passed to pipes by their destination
+// session ID.  A dialer opens a new socket for each connection, and
+// connects it to the peer.  That way an ICMP port unreachable is reported
+// to us, so that dialing a port nobody is listening on fails at once
+// (with NNG_ECONNREFUSED), rather than when the handshake times out.
+
+typedef struct udp_pipe     udp_pipe;
+typedef struct udp_ep       udp_ep;
+typedef struct udp_sock     udp_sock;
+typedef struct udp_fraglist udp_fraglist;
+typedef struct udp_creq     udp_creq;
+typedef struct udp_rxbuf    udp_rxbuf;
+typedef struct udp_txbuf    udp_txbuf;
+
+static const uint8_t      udp_version    = 0x01;
+static const int          udp_conn_tries = 20;   // max connect attempts
+static const nng_duration udp_conn_time  = 500;  // between attempts (msec)
+static const int          udp_ping_tries = 6;    // max keepalive attempts
+static const nng_duration udp_ping_time  = 5000; // keepalive time (msec)
+
+// These are compile time tunables for now.
+enum udp_tunables {
+	udp_listenq       = 128,   // backlog queue length
+	udp_listen_expire = 10000, // maximum time in backlog (msec)
+	udp_rxq           = 16,    // receives posted (per socket)
+	udp_ctlq          = 8,     // control datagrams in flight (per socket)
+	udp_txq           = 16,    // data datagrams in flight (per pipe)
+	udp_recvq         = 4,     // messages being reassembled (per pipe)
+	udp_readyq        = 64,    // messages waiting for receive (per pipe)
+	udp_recv_stale    = 1000,  // frags older than are stale (msec)
+	udp_ctl_size      = 64,    // largest control datagram
+	udp_min_mtu       = 256,   // smallest MTU we allow
+	udp_max_mtu       = 65000, // largest MTU we allow
+	udp_def_mtu       = 1452,  // fits Ethernet, with IPv6 headers
+};
+
+enum udp_op_codes {
+	udp_op_data     = 0x00, // data, final fragment
+	udp_op_conn_req = 0x10, // connect request
+	udp_op_conn_ack = 0x12, // connect accepted
+	udp_op_disc_req = 0x20, // disconnect request (no ack)
+	udp_op_ping     = 0x30, // ping request
+	udp_op_pong     = 0x32, // ping response
+	udp_op_error    = 0x40, // error response
+};
+
+enum udp_offsets {
+	udp_offset_op          = 0x00,
+	udp_offset_flags       = 0x01,
+	udp_offset_version     = 0x02, // protocol version number (2 bytes)
+	udp_offset_dst_id      = 0x04, // destination session (4 bytes)
+	udp_offset_src_id      = 0x08, // source session (4 bytes)
+	udp_offset_creq_proto  = 0x0C, // SP protocol number (2 bytes)
+	udp_offset_creq_mtu    = 0x0E, // MTU of the requester (2 bytes)
+	udp_offset_cack_proto  = 0x0C, // SP protocol number (2 bytes)
+	udp_offset_cack_mtu    = 0x0E, // MTU of the session (2 bytes)
+	udp_offset_err_code    = 0x0C, // error code (1 byte)
+	udp_offset_err_msg     = 0x0D, // error message (string)
+	udp_offset_data_id     = 0x0C, // message ID (2 bytes)
+	udp_offset_data_fragsz = 0x0E, // fragment size
+	udp_offset_data_frag   = 0x10, // fragment number, first is 0 (2 bytes)
+	udp_offset_data_nfrag  = 0x12, // total fragments (2 bytes)
+	udp_offset_data_data   = 0x14, // user payload
+	udp_size_headers       = 0x0C, // size of headers
+	udp_size_conn_req      = 0x10, // size of conn_req (connect request)
+	udp_size_conn_ack      = 0x10, // size of conn_ack (connect reply)
+	udp_size_disc_req      = 0x0C, // size of disc_req (disconnect)
+	udp_size_ping          = 0x0C, // size of ping request
+	udp_size_pong          = 0x0C, // size of ping reply
+	udp_size_data          = 0x14, // size of data message (w/o payload)
+};
+
+enum udp_errors {
+	udp_err_refused = 0x01, // Connection refused
+	udp_err_notconn = 0x02, // Connection does not exist
+	udp_err_wrongsp = 0x03, // SP protocol mismatch
+	udp_err_proto   = 0x04, // Other protocol error
+	udp_err_msgsize = 0x05, // Message too large
+	udp_err_unknown = 0x06, // Other errors
+};
+
+// The fragment list is used to keep track of incoming received
+// fragments for reassembly into a complete message.
+struct udp_fraglist {
+	nni_time fl_time;  // time first frag was received
+	uint16_t fl_msgid; // message id
+	unsigned fl_fragsz;
+	unsigned fl_nfrags;
+	unsigned fl_nmissing; // fragments still to come
+	uint8_t *fl_missing;  // bitmap of fragments still to come
+	size_t   fl_missingsz;
+	nni_msg *fl_msg;
+};
+
+// A receive posted on a socket.
+struct udp_rxbuf {
+	udp_sock *   rx_sock;
+	nni_aio *    rx_aio;
+	uint8_t *    rx_buf;
+	nng_sockaddr rx_sa;
+};
+
+// A datagram being sent.  Pipes have their own for data, while each
+// socket has a few small ones for control messages.
+struct udp_txbuf {
+	udp_sock *   tx_sock;
+	udp_pipe *   tx_pipe; // NULL for control messages
+	nni_aio *    tx_aio;
+	uint8_t *    tx_buf;
+	size_t       tx_bufsz;
+	nng_sockaddr tx_sa;
+	uint16_t     tx_msgid;
+};
+
+struct udp_creq {
+	nni_time     cr_expire;
+	nng_sockaddr cr_sa;
+	uint32_t     cr_peer_id;
+	uint16_t     cr_proto;
+	uint16_t     cr_mtu;
+};
+
+// A udp_sock is one UDP socket, along with the pipes using it.  It is
+// reference counted, as the pipes a listener accepts outlive it, and
+// a dialer's socket is handed over to its pipe.  The lock protects
+// everything here, including the pipes.
+struct udp_sock {
+	nni_mtx       s_mtx;
+	nni_plat_udp *s_udp;
+	int           s_refcnt;
+	bool          s_closed;
+	bool          s_dialer;
+	bool          s_listening;
+	uint16_t      s_proto;
+	size_t        s_mtu;
+	size_t        s_rcvmax;
+	nni_idhash *  s_ids; // pipes, by local session ID
+	nni_list      s_pipes;
+	udp_rxbuf     s_rx[udp_rxq];
+	udp_txbuf     s_ctl[udp_ctlq];
+	udp_txbuf *   s_ctlfree[udp_ctlq];
+	int           s_nctlfree;
+	nni_reap_item s_reap;
+
+	// Incoming connection requests (listener only).
+	nni_list s_aios;
+	udp_creq s_creqs[udp_listenq];
+	int      s_creq_head;
+	int      s_creq_tail;
+
+	// Outgoing connection request (dialer only).
+	nni_aio *    s_user_aio;
+	nni_aio *    s_creq_aio;
+	bool         s_creq_active;
+	int          s_creq_try;
+	uint32_t     s_dial_id;
+	nng_sockaddr s_raddr;
+};
+
+struct udp_pipe {
+	nni_list_node p_link;
+	udp_sock *    p_sock;
+	uint32_t      p_id;
+	uint32_t      p_peer_id;
+	nng_sockaddr  p_sa;
+	uint16_t      p_proto;
+	uint16_t      p_peer;
+	size_t        p_mtu;
+	size_t        p_rcvmax;
+	bool          p_closed;
+	nni_time      p_last_recv;
+
+	nni_aio *    p_user_rxaio;
+	udp_fraglist p_recvq[udp_recvq];
+	nni_msg *    p_ready[udp_readyq];
+	int          p_ready_head;
+	int          p_ready_len;
+	uint16_t     p_rx_next; // next message ID expected
+	uint64_t     p_rx_lost;
+
+	nni_list   p_user_txaios;
+	uint16_t   p_tx_next; // next message ID to send
+	uint16_t   p_tx_id;   // message ID being sent
+	uint16_t   p_tx_frag; // next fragment of it to send
+	uint16_t   p_tx_nfrags;
+	udp_txbuf  p_tx[udp_txq];
+	udp_txbuf *p_txfree[udp_txq];
+	int        p_ntxfree;
+	uint64_t   p_tx_lost;
+	uint16_t   p_tx_lost_id; // last message counted in p_tx_lost
+
+	nni_aio *    p_ping_aio;
+	bool         p_ping_active;
+	int          p_ping_try;
+	int          p_ping_tries;
+	nni_duration p_ping_time;
+};
+
+struct udp_ep {
+	nni_mtx      ep_mtx;
+	int          ep_mode;
+	nni_url *    ep_url;
+	nng_sockaddr ep_sa;  // remote address to dial, or local to listen
+	nng_sockaddr ep_bsa; // bound address
+	uint16_t     ep_proto;
+	size_t       ep_mtu;
+	size_t       ep_rcvmax;
+	udp_sock *   ep_sock;
+};
+
+static void udp_sock_rele(udp_sock *);
+static void udp_sock_rx_cb(void *);
+static void udp_sock_ctl_cb(void *);
+static void udp_sock_creq_cb(void *);
+static void udp_pipe_tx_cb(void *);
+static void udp_pipe_ping_cb(void *);
+static void udp_pipe_dosend(udp_pipe *);
+static void udp_fraglist_clear(udp_fraglist *);
+
+static bool
+udp_sa_equal(const nng_sockaddr *sa1, const nng_sockaddr *sa2)
+{
+	if (sa1->s_un.s_family != sa2->s_un.s_family) {
+		return (false);
+	}
+	switch (sa1->s_un.s_family) {
+	case NNG_AF_INET:
+		return ((sa1->s_un.s_in.sa_port == sa2->s_un.s_in.sa_port) &&
+		    (sa1->s_un.s_in.sa_addr == sa2->s_un.s_in.sa_addr));
+	case NNG_AF_INET6:
+		return ((sa1->s_un.s_in6.sa_port == sa2->s_un.s_in6.sa_port) &&
+		    (memcmp(sa1->s_un.s_in6.sa_addr, sa2->s_un.s_in6.sa_addr,
+		         sizeof(sa1->s_un.s_in6.sa_addr)) == 0));
+	}
+	return (false);
+}
+
+static int
+udp_err_to_nng(uint8_t code)
+{
+	switch (code) {
+	case udp_err_refused:
+		return (NNG_ECONNREFUSED);
+	case udp_err_notconn:
+		return (NNG_ECLOSED);
+	case udp_err_wrongsp:
+		return (NNG_EPROTO);
+	default:
+		return (NNG_ETRANERR);
+	}
+}
+
+static void
+udp_txbuf_start(udp_sock *s, udp_txbuf *tx, nng_sockaddr *sa, size_t len)
+{
+	nni_iov iov;
+
+	iov.iov_buf = tx->tx_buf;
+	iov.iov_len = len;
+	nni_aio_set_iov(tx->tx_aio, 1, &iov);
+	nni_aio_set_input(tx->tx_aio, 0, sa);
+	nni_plat_udp_send(s->s_udp, tx->tx_aio);
+}
+
+static void
+udp_put_headers(uint8_t *data, uint8_t op, uint32_t dst, uint32_t src)
+{
+	data[udp_offset_op]    = op;
+	data[udp_offset_flags] = 0;
+	NNI_PUT16(data + udp_offset_version, udp_version);
+	NNI_PUT32(data + udp_offset_dst_id, dst);
+	NNI_PUT32(data + udp_offset_src_id, src);
+}
+
+// udp_send modifies the start of the supplied buffer to fill in the
+// headers, and then sends it.  This is only for control messages, which
+// are small; if too many are already in flight, the message is dropped,
+// just as the network might have done.
+static void
+udp_send(udp_sock *s, nng_sockaddr *sa, uint8_t op, uint32_t dst,
+    uint32_t src, uint8_t *data, size_t len)
+{
+	udp_txbuf *tx;
+
+	NNI_ASSERT(len >= udp_size_headers);
+	NNI_ASSERT(len <= udp_ctl_size);
+	if (s->s_closed || (s->s_nctlfree == 0)) {
+		return;
+	}
+	udp_put_headers(data, op, dst, src);
+	tx = s->s_ctlfree[--s->s_nctlfree];
+	memcpy(tx->tx_buf, data, len);
+	tx->tx_sa = *sa;
+	udp_txbuf_start(s, tx, &tx->tx_sa, len);
+}
+
+static void
+udp_send_err(udp_sock *s, nng_sockaddr *sa, uint32_t dst, uint32_t src,
+    uint8_t err, const char *msg)
+{
+	uint8_t data[udp_ctl_size];
+
+	NNI_ASSERT((strlen(msg) + udp_offset_err_msg) < sizeof(data));
+
+	data[udp_offset_err_code] = err;
+	nni_strlcpy((char *) data + udp_offset_err_msg, msg,
+	    sizeof(data) - udp_offset_err_msg);
+
+	udp_send(s, sa, udp_op_error, dst, src, data,
+	    strlen(msg) + udp_offset_err_msg);
+}
+
+static void
+udp_pipe_send_err(udp_pipe *p, uint8_t err, const char *msg)
+{
+	udp_send_err(p->p_sock, &p->p_sa, p->p_peer_id, p->p_id, err, msg);
+}
+
+static void
+udp_pipe_send_disc_req(udp_pipe *p)
+{
+	uint8_t data[udp_size_disc_req];
+
+	udp_send(p->p_sock, &p->p_sa, udp_op_disc_req, p->p_peer_id, p->p_id,
+	    data, sizeof(data));
+}
+
+static void
+udp_pipe_send_ping(udp_pipe *p)
+{
+	uint8_t data[udp_size_ping];
+
+	udp_send(p->p_sock, &p->p_sa, udp_op_ping, p->p_peer_id, p->p_id,
+	    data, sizeof(data));
+}
+
+static void
+udp_pipe_send_pong(udp_pipe *p)
+{
+	uint8_t data[udp_size_pong];
+
+	udp_send(p->p_sock, &p->p_sa, udp_op_pong, p->p_peer_id, p->p_id,
+	    data, sizeof(data));
+}
+
+static void
+udp_pipe_send_conn_ack(udp_pipe *p)
+{
+	uint8_t data[udp_size_conn_ack];
+
+	NNI_PUT16(data + udp_offset_cack_proto, p->p_proto);
+	NNI_PUT16(data + udp_offset_cack_mtu, p->p_mtu);
+	udp_send(p->p_sock, &p->p_sa, udp_op_conn_ack, p->p_peer_id, p->p_id,
+	    data, sizeof(data));
+}
+
+static void
+udp_sock_creq_cancel(nni_aio *aio, int rv)
+{
+	udp_sock *s = nni_aio_get_prov_data(aio);
+
+	nni_mtx_lock(&s->s_mtx);
+	if (s->s_creq_active) {
+		s->s_creq_active = false;
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_sock_send_conn_req(udp_sock *s)
+{
+	uint8_t data[udp_size_conn_req];
+
+	nni_aio_set_timeout(s->s_creq_aio, udp_conn_time);
+	if (nni_aio_start(s->s_creq_aio, udp_sock_creq_cancel, s) == 0) {
+		s->s_creq_active = true;
+	}
+	s->s_creq_try++;
+
+	NNI_PUT16(data + udp_offset_creq_proto, s->s_proto);
+	NNI_PUT16(data + udp_offset_creq_mtu, s->s_mtu);
+	udp_send(s, &s->s_raddr, udp_op_conn_req, 0, s->s_dial_id, data,
+	    sizeof(data));
+}
+
+static void
+udp_fraglist_clear(udp_fraglist *fl)
+{
+	nni_msg *msg;
+
+	fl->fl_msgid    = 0;
+	fl->fl_time     = NNI_TIME_ZERO;
+	fl->fl_nmissing = 0;
+	if ((msg = fl->fl_msg) != NULL) {
+		fl->fl_msg = NULL;
+		nni_msg_free(msg);
+	}
+}
+
+static void
+udp_fraglist_free(udp_fraglist *fl)
+{
+	udp_fraglist_clear(fl);
+	if (fl->fl_missingsz != 0) {
+		nni_free(fl->fl_missing, fl->fl_missingsz);
+	}
+	fl->fl_missing   = NULL;
+	fl->fl_missingsz = 0;
+}
+
+// udp_pipe_free releases the pipe's resources.  The pipe must not be
+// known to its socket, and nothing may be running on its aios.
+static void
+udp_pipe_free(udp_pipe *p)
+{
+	for (int i = 0; i < udp_txq; i++) {
+		udp_txbuf *tx = &p->p_tx[i];
+		nni_aio_fini(tx->tx_aio);
+		if (tx->tx_buf != NULL) {
+			nni_free(tx->tx_buf, tx->tx_bufsz);
+		}
+	}
+	nni_aio_fini(p->p_ping_aio);
+	for (int i = 0; i < udp_recvq; i++) {
+		udp_fraglist_free(&p->p_recvq[i]);
+	}
+	while (p->p_ready_len > 0) {
+		nni_msg_free(p->p_ready[p->p_ready_head]);
+		p->p_ready_head = (p->p_ready_head + 1) % udp_readyq;
+		p->p_ready_len--;
+	}
+	NNI_FREE_STRUCT(p);
+}
+
+// udp_pipe_init creates a pipe on the socket, which must be locked.
+// If the ID is zero, a new one is allocated.
+static int
+udp_pipe_init(udp_pipe **pipep, udp_sock *s, uint32_t id, uint32_t peer_id,
+    nng_sockaddr *sa, size_t mtu)
+{
+	udp_pipe *p;
+	uint64_t  id64;
+	int       rv;
+
+	if ((p = NNI_ALLOC_STRUCT(p)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	p->p_sock       = s;
+	p->p_peer_id    = peer_id;
+	p->p_sa         = *sa;
+	p->p_proto      = s->s_proto;
+	p->p_mtu        = mtu;
+	p->p_rcvmax     = s->s_rcvmax;
+	p->p_ping_tries = udp_ping_tries;
+	p->p_ping_time  = udp_ping_time;
+	p->p_last_recv  = nni_clock();
+	p->p_tx_lost_id = (uint16_t)(p->p_tx_next - 1);
+	nni_aio_list_init(&p->p_user_txaios);
+
+	for (int i = 0; i < udp_txq; i++) {
+		udp_txbuf *tx = &p->p_tx[i];
+		tx->tx_sock   = s;
+		tx->tx_pipe   = p;
+		tx->tx_bufsz  = mtu;
+		if (((tx->tx_buf = nni_alloc(mtu)) == NULL) ||
+		    ((rv = nni_aio_init(&tx->tx_aio, udp_pipe_tx_cb, tx)) !=
+		        0)) {
+			udp_pipe_free(p);
+			return (NNG_ENOMEM);
+		}
+		p->p_txfree[p->p_ntxfree++] = tx;
+	}
+	if ((rv = nni_aio_init(&p->p_ping_aio, udp_pipe_ping_cb, p)) != 0) {
+		udp_pipe_free(p);
+		return (rv);
+	}
+
+	if (id == 0) {
+		rv = nni_idhash_alloc(s->s_ids, &id64, p);
+		id = (uint32_t) id64;
+	} else {
+		rv = nni_idhash_insert(s->s_ids, id, p);
+	}
+	if (rv != 0) {
+		udp_pipe_free(p);
+		return (rv);
+	}
+	p->p_id = id;
+	nni_list_append(&s->s_pipes, p);
+	s->s_refcnt++;
+
+	*pipep = p;
+	return (0);
+}
+
+static void
+udp_pipe_close_err(udp_pipe *p, int err, uint8_t code, const char *msg)
+{
+	nni_aio *aio;
+
+	p->p_closed = true;
+	if ((aio = p->p_user_rxaio) != NULL) {
+		p->p_user_rxaio = NULL;
+		nni_aio_finish_error(aio, err);
+	}
+	while ((aio = nni_list_first(&p->p_user_txaios)) != NULL) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, err);
+	}
+	if (p->p_ping_active) {
+		p->p_ping_active = false;
+		nni_aio_finish_error(p->p_ping_aio, NNG_ECLOSED);
+	}
+	if (msg != NULL) {
+		udp_pipe_send_err(p, code, msg);
+	}
+}
+
+// udp_sock_error handles an error reported by the network, such as an
+// ICMP port unreachable.  Only connected (dialer) sockets are told about
+// these, and they have at most one peer, so the error is its.
+static void
+udp_sock_error(udp_sock *s, int rv)
+{
+	udp_pipe *p;
+	nni_aio * aio;
+
+	if (rv == NNG_ECONNRESET) {
+		// This is how Windows reports a port unreachable.
+		rv = NNG_ECONNREFUSED;
+	}
+	if ((!s->s_dialer) || (rv != NNG_ECONNREFUSED)) {
+		return;
+	}
+	if ((aio = s->s_user_aio) != NULL) {
+		s->s_user_aio = NULL;
+		nni_aio_finish_error(aio, rv);
+	}
+	NNI_LIST_FOREACH (&s->s_pipes, p) {
+		if (!p->p_closed) {
+			udp_pipe_close_err(p, rv, 0, NULL);
+		}
+	}
+}
+
+static void
+udp_pipe_rx_done(udp_pipe *p, uint16_t msgid, nni_msg *msg)
+{
+	nni_aio *aio;
+	uint16_t gap;
+
+	// Message IDs are sequential, so a gap means that messages were
+	// lost.  If a message arrives late, we will have counted it lost
+	// when the one after it arrived, so take it back off.
+	gap = (uint16_t)(msgid - p->p_rx_next);
+	if (gap < 0x8000) {
+		p->p_rx_lost += gap;
+		p->p_rx_next = (uint16_t)(msgid + 1);
+	} else if (p->p_rx_lost > 0) {
+		p->p_rx_lost--;
+	}
+
+	if ((aio = p->p_user_rxaio) != NULL) {
+		p->p_user_rxaio = NULL;
+		nni_aio_finish_msg(aio, msg);
+		return;
+	}
+	if (p->p_ready_len == udp_readyq) {
+		// The application is not keeping up.  As we cannot push
+		// back on the sender, this message is lost too.
+		nni_msg_free(msg);
+		p->p_rx_lost++;
+		return;
+	}
+	p->p_ready[(p->p_ready_head + p->p_ready_len) % udp_readyq] = msg;
+	p->p_ready_len++;
+}
+
+static void
+udp_pipe_recv_data(udp_pipe *p, const uint8_t *data, size_t len)
+{
+	uint16_t      msgid;
+	uint16_t      fragno;
+	uint16_t      nfrags;
+	uint16_t      fragsz;
+	udp_fraglist *fl;
+	nni_time      now;
+	uint8_t       bit;
+	uint8_t *     body;
+	nni_msg *     msg;
+
+	if (len < udp_size_data) {
+		// Runt frame.  Drop it and close pipe with a protocol error.
+		udp_pipe_close_err(p, NNG_EPROTO, udp_err_proto, "Runt frame");
+		return;
+	}
+
+	NNI_GET16(data + udp_offset_data_id, msgid);
+	NNI_GET16(data + udp_offset_data_fragsz, fragsz);
+	NNI_GET16(data + udp_offset_data_frag, fragno);
+	NNI_GET16(data + udp_offset_data_nfrag, nfrags);
+	len -= udp_offset_data_data;
+	data += udp_offset_data_data;
+
+	if ((fragsz == 0) || (nfrags == 0) || (fragno >= nfrags) ||
+	    (len > fragsz) || ((fragno != (nfrags - 1)) && (len != fragsz))) {
+		udp_pipe_close_err(
+		    p, NNG_EPROTO, udp_err_proto, "Invalid message parameters");
+		return;
+	}
+
+	// Check for cases where message size is clearly too large.  Note
+	// that we only can catch the case where a message is larger by
+	// more than a fragment, since the final fragment may be shorter,
+	// and we won't know that until we receive it.  We just discard it,
+	// as the sender might be on the other side of a device; the gap it
+	// leaves will show up as a lost message.
+	if ((p->p_rcvmax > 0) &&
+	    (((size_t) nfrags * fragsz) >= (p->p_rcvmax + fragsz))) {
+		return;
+	}
+
+	// Find the slot for this message.  If it is a new one, use an
+	// empty slot if there is one, and otherwise reuse the oldest.
+	// Whatever was being reassembled there is lost.
+	fl  = NULL;
+	now = nni_clock();
+	for (int i = 0; i < udp_recvq; i++) {
+		udp_fraglist *f = &p->p_recvq[i];
+
+		if ((f->fl_msg != NULL) &&
+		    (now > (f->fl_time + udp_recv_stale))) {
+			udp_fraglist_clear(f);
+		}
+		if (f->fl_msg == NULL) {
+			if ((fl == NULL) || (fl->fl_msg != NULL)) {
+				fl = f;
+			}
+			continue;
+		}
+		if (f->fl_msgid == msgid) {
+			fl = f;
+			break;
+		}
+		if ((fl == NULL) ||
+		    ((fl->fl_msg != NULL) && (f->fl_time < fl->fl_time))) {
+			fl = f;
+		}
+	}
+
+	if ((fl->fl_msg == NULL) || (fl->fl_msgid != msgid)) {
+		size_t need = (nfrags + 7) / 8;
+
+		// First fragment we've received for this message (but might
+		// not be first fragment for message!)
+		udp_fraglist_clear(fl);
+		if (need > fl->fl_missingsz) {
+			uint8_t *missing;
+			if ((missing = nni_alloc(need)) == NULL) {
+				return;
+			}
+			if (fl->fl_missingsz != 0) {
+				nni_free(fl->fl_missing, fl->fl_missingsz);
+			}
+			fl->fl_missing   = missing;
+			fl->fl_missingsz = need;
+		}
+		if (nni_msg_alloc(&fl->fl_msg, (size_t) nfrags * fragsz) != 0) {
+			// Out of memory.  We don't close the pipe, but
+			// just fail to receive the message.
+			return;
+		}
+
+		fl->fl_nfrags   = nfrags;
+		fl->fl_fragsz   = fragsz;
+		fl->fl_msgid    = msgid;
+		fl->fl_time     = now;
+		fl->fl_nmissing = nfrags;
+
+		// Set the missing mask.
+		memset(fl->fl_missing, 0xff, nfrags / 8);
+		if ((nfrags % 8) != 0) {
+			fl->fl_missing[nfrags / 8] = (1 << (nfrags % 8)) - 1;
+		}
+	}
+	if ((nfrags != fl->fl_nfrags) || (fragsz != fl->fl_fragsz)) {
+		// Protocol error, message parameters changed.
+		udp_pipe_close_err(
+		    p, NNG_EPROTO, udp_err_proto, "Invalid message parameters");
+		udp_fraglist_clear(fl);
+		return;
+	}
+
+	bit = (uint8_t)(1 << (fragno % 8));
+	if ((fl->fl_missing[fragno / 8] & bit) == 0) {
+		// We've already got this fragment, ignore it.  We don't
+		// bother to check for changed data.
+		return;
+	}
+
+	fl->fl_missing[fragno / 8] &= ~(bit);
+	body = nni_msg_body(fl->fl_msg);
+	body += (size_t) fragno * fragsz;
+	memcpy(body, data, len);
+	if (fragno == (nfrags - 1)) {
+		// Last frag, maybe shorten the message.
+		nni_msg_chop(fl->fl_msg, (fragsz - len));
+	}
+	if (--fl->fl_nmissing != 0) {
+		return;
+	}
+
+	// We got all fragments... try to send it up.
+	msg        = fl->fl_msg;
+	fl->fl_msg = NULL;
+	udp_fraglist_clear(fl);
+	if ((p->p_rcvmax > 0) && (nni_msg_len(msg) > p->p_rcvmax)) {
+		// Strict enforcement of max recv.
+		nni_msg_free(msg);
+		return;
+	}
+	udp_pipe_rx_done(p, msgid, msg);
+}
+
+// udp_pipe_recv handles a datagram that has arrived for the pipe.  The
+// address and session IDs were matched by the caller.
+static void
+udp_pipe_recv(udp_pipe *p, uint8_t op, const uint8_t *data, size_t len)
+{
+	if (p->p_closed) {
+		return;
+	}
+
+	// We got data, so update our recv time.
+	p->p_last_recv = nni_clock();
+	p->p_ping_try  = 0;
+
+	switch (op) {
+	case udp_op_data:
+		udp_pipe_recv_data(p, data, len);
+		return;
+	case udp_op_disc_req:
+		udp_pipe_close_err(p, NNG_ECLOSED, 0, NULL);
+		return;
+	case udp_op_ping:
+		udp_pipe_send_pong(p);
+		return;
+	case udp_op_error:
+		if (len > udp_offset_err_code) {
+			udp_pipe_close_err(p,
+			    udp_err_to_nng(data[udp_offset_err_code]), 0, NULL);
+		}
+		return;
+	default:
+		// Pongs need nothing more, and a repeated conn_ack (if our
+		// request was resent) is harmless.
+		return;
+	}
+}
+
+// udp_sock_recv_dial handles a reply to our connection request.
+static void
+udp_sock_recv_dial(udp_sock *s, nng_sockaddr *sa, uint8_t op, uint32_t src,
+    const uint8_t *data, size_t len)
+{
+	nni_aio * aio = s->s_user_aio;
+	udp_pipe *p;
+	uint16_t  mtu;
+	int       rv;
+
+	switch (op) {
+	case udp_op_conn_ack:
+		if ((len != udp_size_conn_ack) || (src == 0)) {
+			return;
+		}
+		NNI_GET16(data + udp_offset_cack_mtu, mtu);
+		if ((mtu < udp_min_mtu) || (mtu > s->s_mtu)) {
+			udp_send_err(s, sa, src, s->s_dial_id, udp_err_proto,
+			    "Bad MTU");
+			rv = NNG_EPROTO;
+			break;
+		}
+		if ((rv = udp_pipe_init(&p, s, s->s_dial_id, src, sa, mtu)) !=
+		    0) {
+			udp_send_err(s, sa, src, s->s_dial_id, udp_err_unknown,
+			    "Failed creating pipe");
+			break;
+		}
+		NNI_GET16(data + udp_offset_cack_proto, p->p_peer);
+		s->s_user_aio = NULL;
+		nni_aio_set_output(aio, 0, p);
+		nni_aio_finish(aio, 0, 0);
+		return;
+
+	case udp_op_error:
+		if (len <= udp_offset_err_code) {
+			return;
+		}
+		rv = udp_err_to_nng(data[udp_offset_err_code]);
+		break;
+
+	default:
+		// The listener may send before our ack arrives; those
+		// messages are lost, but the session is fine.
+		return;
+	}
+	s->s_user_aio = NULL;
+	nni_aio_finish_error(aio, rv);
+}
+
+static void
+udp_sock_doaccept(udp_sock *s)
+{
+	nni_time now;
+	udp_pipe *p;
+	int      rv;
+
+	now = nni_clock();
+	// Consume any timedout connect requests.
+	while (s->s_creq_tail != s->s_creq_head) {
+		udp_creq *cr;
+		nni_aio * aio;
+		size_t    mtu;
+
+		cr = &s->s_creqs[s->s_creq_tail % udp_listenq];
+		// Discard old connection requests.
+		if (cr->cr_expire < now) {
+			s->s_creq_tail++;
+			continue;
+		}
+
+		if ((aio = nni_list_first(&s->s_aios)) == NULL) {
+			// No outstanding accept.  We're done.
+			break;
+		}
+
+		// We have both conn request, and a place to accept it.
+		s->s_creq_tail++;
+		nni_aio_list_remove(aio);
+
+		mtu = cr->cr_mtu < s->s_mtu ? cr->cr_mtu : s->s_mtu;
+		rv  = udp_pipe_init(&p, s, 0, cr->cr_peer_id, &cr->cr_sa, mtu);
+		if (rv != 0) {
+			udp_send_err(s, &cr->cr_sa, cr->cr_peer_id, 0,
+			    udp_err_unknown, "Failed creating pipe");
+			nni_aio_finish_error(aio, rv);
+			continue;
+		}
+		p->p_peer = cr->cr_proto;
+		udp_pipe_send_conn_ack(p);
+		nni_aio_set_output(aio, 0, p);
+		nni_aio_finish(aio, 0, 0);
+	}
+}
+
+static void
+udp_sock_recv_conn_req(udp_sock *s, nng_sockaddr *sa, uint32_t src,
+    const uint8_t *data, size_t len)
+{
+	udp_pipe *p;
+	udp_creq *cr;
+	uint16_t  mtu;
+
+	if (!s->s_listening) {
+		if (!s->s_dialer) {
+			udp_send_err(s, sa, src, 0, udp_err_refused,
+			    "Connection refused");
+		}
+		return;
+	}
+	if ((len != udp_size_conn_req) || (src == 0)) {
+		udp_send_err(
+		    s, sa, src, 0, udp_err_proto, "Bad message length");
+		return;
+	}
+	NNI_GET16(data + udp_offset_creq_mtu, mtu);
+	if (mtu < udp_min_mtu) {
+		udp_send_err(s, sa, src, 0, udp_err_proto, "Bad MTU");
+		return;
+	}
+
+	// If we already have created a pipe for this connection
+	// then our ack was lost, so just send it again.
+	NNI_LIST_FOREACH (&s->s_pipes, p) {
+		if ((p->p_peer_id == src) && udp_sa_equal(&p->p_sa, sa)) {
+			udp_pipe_send_conn_ack(p);
+			return;
+		}
+	}
+
+	// We may already have a connection request queued (if this was
+	// a resend for example); if that's the case we just ignore
+	// this one.
+	for (int i = s->s_creq_tail; i != s->s_creq_head; i++) {
+		cr = &s->s_creqs[i % udp_listenq];
+		if ((cr->cr_peer_id == src) && udp_sa_equal(&cr->cr_sa, sa)) {
+			return;
+		}
+	}
+	// We may already have filled our listenq, in which case we just drop.
+	if ((s->s_creq_tail + udp_listenq) == s->s_creq_head) {
+		return;
+	}
+
+	// Record the connection request, and then process any
+	// pending acceptors.
+	cr = &s->s_creqs[s->s_creq_head % udp_listenq];
+	NNI_GET16(data + udp_offset_creq_proto, cr->cr_proto);
+	cr->cr_mtu     = mtu;
+	cr->cr_sa      = *sa;
+	cr->cr_peer_id = src;
+	cr->cr_expire  = nni_clock() + udp_listen_expire;
+	s->s_creq_head++;
+
+	udp_sock_doaccept(s);
+}
+
+// udp_sock_recv is called with each datagram arriving on the socket.
+static void
+udp_sock_recv(udp_sock *s, nng_sockaddr *sa, const uint8_t *data, size_t len)
+{
+	uint8_t   op;
+	uint16_t  version;
+	uint32_t  dst;
+	uint32_t  src;
+	udp_pipe *p;
+
+	if (len < udp_size_headers) {
+		return;
+	}
+	op = data[udp_offset_op];
+	NNI_GET16(data + udp_offset_version, version);
+	NNI_GET32(data + udp_offset_dst_id, dst);
+	NNI_GET32(data + udp_offset_src_id, src);
+	if ((version != udp_version) || (data[udp_offset_flags] != 0)) {
+		// Not ours, or from a version we don't understand.
+		return;
+	}
+
+	if (dst == 0) {
+		// Connection requests are the only thing not addressed
+		// to a session.
+		if (op == udp_op_conn_req) {
+			udp_sock_recv_conn_req(s, sa, src, data, len);
+		}
+		return;
+	}
+	if (nni_idhash_find(s->s_ids, dst, (void **) &p) == 0) {
+		if ((p->p_peer_id == src) && udp_sa_equal(&p->p_sa, sa)) {
+			udp_pipe_recv(p, op, data, len);
+		}
+		return;
+	}
+	if ((s->s_user_aio != NULL) && (dst == s->s_dial_id)) {
+		udp_sock_recv_dial(s, sa, op, src, data, len);
+		return;
+	}
+
+	// Nobody here by that name (perhaps we restarted).  Tell the
+	// sender, so that it can give up, unless that would start a loop.
+	if ((op != udp_op_error) && (op != udp_op_disc_req)) {
+		udp_send_err(s, sa, src, dst, udp_err_notconn, "Not connected");
+	}
+}
+
+static void
+udp_sock_rx_cb(void *arg)
+{
+	udp_rxbuf *rx  = arg;
+	udp_sock * s   = rx->rx_sock;
+	nni_aio *  aio = rx->rx_aio;
+	int        rv;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (s->s_closed) {
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	switch ((rv = nni_aio_result(aio))) {
+	case 0:
+		udp_sock_recv(s, &rx->rx_sa, rx->rx_buf, nni_aio_count(aio));
+		break;
+	case NNG_ECLOSED:
+	case NNG_ECANCELED:
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	default:
+		udp_sock_error(s, rv);
+		break;
+	}
+	nni_plat_udp_recv(s->s_udp, aio);
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_sock_ctl_cb(void *arg)
+{
+	udp_txbuf *tx = arg;
+	udp_sock * s  = tx->tx_sock;
+	int        rv;
+
+	nni_mtx_lock(&s->s_mtx);
+	s->s_ctlfree[s->s_nctlfree++] = tx;
+	if ((rv = nni_aio_result(tx->tx_aio)) != 0) {
+		udp_sock_error(s, rv);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_sock_creq_cb(void *arg)
+{
+	udp_sock *s   = arg;
+	nni_aio * aio = s->s_creq_aio;
+	nni_aio * uaio;
+
+	nni_mtx_lock(&s->s_mtx);
+	s->s_creq_active = false;
+	if (((uaio = s->s_user_aio) == NULL) ||
+	    (nni_aio_result(aio) != NNG_ETIMEDOUT)) {
+		// Either done, or canceled.
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	if (s->s_creq_try >= udp_conn_tries) {
+		// Nobody is answering.
+		s->s_user_aio = NULL;
+		nni_aio_finish_error(uaio, NNG_ETIMEDOUT);
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	udp_sock_send_conn_req(s);
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_sock_fini(void *arg)
+{
+	udp_sock *s = arg;
+
+	nni_mtx_lock(&s->s_mtx);
+	s->s_closed = true;
+	nni_mtx_unlock(&s->s_mtx);
+
+	// Nothing gets restarted now that we are closed.
+	for (int i = 0; i < udp_rxq; i++) {
+		nni_aio_stop(s->s_rx[i].rx_aio);
+	}
+	for (int i = 0; i < udp_ctlq; i++) {
+		nni_aio_stop(s->s_ctl[i].tx_aio);
+	}
+	nni_aio_stop(s->s_creq_aio);
+	if (s->s_udp != NULL) {
+		nni_plat_udp_close(s->s_udp);
+	}
+
+	for (int i = 0; i < udp_rxq; i++) {
+		nni_aio_fini(s->s_rx[i].rx_aio);
+		if (s->s_rx[i].rx_buf != NULL) {
+			nni_free(s->s_rx[i].rx_buf, s->s_mtu);
+		}
+	}
+	for (int i = 0; i < udp_ctlq; i++) {
+		nni_aio_fini(s->s_ctl[i].tx_aio);
+		if (s->s_ctl[i].tx_buf != NULL) {
+			nni_free(s->s_ctl[i].tx_buf, udp_ctl_size);
+		}
+	}
+	nni_aio_fini(s->s_creq_aio);
+	if (s->s_ids != NULL) {
+		nni_idhash_fini(s->s_ids);
+	}
+	nni_mtx_fini(&s->s_mtx);
+	NNI_FREE_STRUCT(s);
+}
+
+static void
+udp_sock_rele(udp_sock *s)
+{
+	nni_mtx_lock(&s->s_mtx);
+	s->s_refcnt--;
+	if (s->s_refcnt == 0) {
+		nni_mtx_unlock(&s->s_mtx);
+		// We may be called from one of our own callbacks, which
+		// cannot wait for itself, so let the reaper finish us.
+		nni_reap(&s->s_reap, udp_sock_fini, s);
+		return;
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+// udp_sock_init opens a socket bound to the address.  Receives are
+// not posted until udp_sock_start is called.
+static int
+udp_sock_init(udp_sock **sp, nng_sockaddr *sa, udp_ep *ep)
+{
+	udp_sock *s;
+	int       rv;
+
+	if ((s = NNI_ALLOC_STRUCT(s)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_init(&s->s_mtx);
+	NNI_LIST_INIT(&s->s_pipes, udp_pipe, p_link);
+	nni_aio_list_init(&s->s_aios);
+	s->s_refcnt = 1;
+	s->s_proto  = ep->ep_proto;
+	s->s_mtu    = ep->ep_mtu;
+	s->s_rcvmax = ep->ep_rcvmax;
+
+	if (((rv = nni_idhash_init(&s->s_ids)) != 0) ||
+	    ((rv = nni_aio_init(&s->s_creq_aio, udp_sock_creq_cb, s)) != 0)) {
+		udp_sock_fini(s);
+		return (rv);
+	}
+	// Session IDs are 32 bits, but never zero, and we start at a
+	// random place so that a restarted peer will not reuse them.
+	nni_idhash_set_limits(
+	    s->s_ids, 1, 0xffffffffu, (nni_random() & 0x7fffffffu) + 1);
+
+	for (int i = 0; i < udp_rxq; i++) {
+		udp_rxbuf *rx = &s->s_rx[i];
+		nni_iov    iov;
+
+		rx->rx_sock = s;
+		if (((rx->rx_buf = nni_alloc(s->s_mtu)) == NULL) ||
+		    ((rv = nni_aio_init(&rx->rx_aio, udp_sock_rx_cb, rx)) !=
+		        0)) {
+			udp_sock_fini(s);
+			return (NNG_ENOMEM);
+		}
+		iov.iov_buf = rx->rx_buf;
+		iov.iov_len = s->s_mtu;
+		nni_aio_set_iov(rx->rx_aio, 1, &iov);
+		nni_aio_set_input(rx->rx_aio, 0, &rx->rx_sa);
+	}
+	for (int i = 0; i < udp_ctlq; i++) {
+		udp_txbuf *tx = &s->s_ctl[i];
+
+		tx->tx_sock  = s;
+		tx->tx_bufsz = udp_ctl_size;
+		if (((tx->tx_buf = nni_alloc(udp_ctl_size)) == NULL) ||
+		    ((rv = nni_aio_init(&tx->tx_aio, udp_sock_ctl_cb, tx)) !=
+		        0)) {
+			udp_sock_fini(s);
+			return (NNG_ENOMEM);
+		}
+		s->s_ctlfree[s->s_nctlfree++] = tx;
+	}
+
+	if ((rv = nni_plat_udp_open(&s->s_udp, sa)) != 0) {
+		udp_sock_fini(s);
+		return (rv);
+	}
+
+	*sp = s;
+	return (0);
+}
+
+static void
+udp_sock_start(udp_sock *s)
+{
+	for (int i = 0; i < udp_rxq; i++) {
+		nni_plat_udp_recv(s->s_udp, s->s_rx[i].rx_aio);
+	}
+}
+
+static int
+udp_tran_init(void)
+{
+	return (0);
+}
+
+static void
+udp_tran_fini(void)
+{
+}
+
+static void
+udp_pipe_close(void *arg)
+{
+	udp_pipe *p = arg;
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (!p->p_closed) {
+		udp_pipe_send_disc_req(p);
+	}
+	udp_pipe_close_err(p, NNG_ECLOSED, 0, NULL);
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_fini(void *arg)
+{
+	udp_pipe *p = arg;
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	p->p_closed = true;
+	nni_mtx_unlock(&s->s_mtx);
+
+	nni_aio_stop(p->p_ping_aio);
+	for (int i = 0; i < udp_txq; i++) {
+		nni_aio_stop(p->p_tx[i].tx_aio);
+	}
+
+	// This tosses the connection details and all state.
+	nni_mtx_lock(&s->s_mtx);
+	nni_idhash_remove(s->s_ids, p->p_id);
+	nni_list_remove(&s->s_pipes, p);
+	nni_mtx_unlock(&s->s_mtx);
+
+	udp_pipe_free(p);
+	udp_sock_rele(s);
+}
+
+// udp_copy_msg copies part of the message, header first, to the buffer.
+static void
+udp_copy_msg(uint8_t *dst, nni_msg *m, size_t off, size_t len)
+{
+	size_t hlen = nni_msg_header_len(m);
+
+	if (off < hlen) {
+		size_t n = hlen - off;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(dst, ((uint8_t *) nni_msg_header(m)) + off, n);
+		dst += n;
+		off += n;
+		len -= n;
+	}
+	memcpy(dst, ((uint8_t *) nni_msg_body(m)) + (off - hlen), len);
+}
+
+// udp_pipe_dosend copies fragments of the waiting messages into free
+// datagrams, and sends them.  Each send completes once the last of its
+// fragments has been handed on, so that sends can be pipelined.
+static void
+udp_pipe_dosend(udp_pipe *p)
+{
+	nni_aio *aio;
+	size_t   fragsz = p->p_mtu - udp_size_data;
+
+	while ((!p->p_closed) &&
+	    ((aio = nni_list_first(&p->p_user_txaios)) != NULL)) {
+		nni_msg *m = nni_aio_get_msg(aio);
+		size_t   total;
+
+		total = nni_msg_header_len(m) + nni_msg_len(m);
+		if (p->p_tx_nfrags == 0) {
+			// Starting a new message; the length was checked
+			// when it was queued.  Empty messages still need
+			// one (empty) fragment.
+			p->p_tx_nfrags =
+			    (uint16_t)((total + fragsz - 1) / fragsz);
+			if (p->p_tx_nfrags == 0) {
+				p->p_tx_nfrags = 1;
+			}
+			p->p_tx_frag = 0;
+			p->p_tx_id   = p->p_tx_next++;
+		}
+		while (p->p_tx_frag < p->p_tx_nfrags) {
+			udp_txbuf *tx;
+			uint8_t *  data;
+			size_t     off;
+			size_t     len;
+
+			if (p->p_ntxfree == 0) {
+				// We carry on when a send completes.
+				return;
+			}
+			tx   = p->p_txfree[--p->p_ntxfree];
+			data = tx->tx_buf;
+			off  = (size_t) p->p_tx_frag * fragsz;
+			len  = (total - off) < fragsz ? (total - off) : fragsz;
+
+			udp_put_headers(
+			    data, udp_op_data, p->p_peer_id, p->p_id);
+			NNI_PUT16(data + udp_offset_data_id, p->p_tx_id);
+			NNI_PUT16(data + udp_offset_data_fragsz, fragsz);
+			NNI_PUT16(data + udp_offset_data_frag, p->p_tx_frag);
+			NNI_PUT16(data + udp_offset_data_nfrag, p->p_tx_nfrags);
+			udp_copy_msg(data + udp_offset_data_data, m, off, len);
+			tx->tx_msgid = p->p_tx_id;
+			udp_txbuf_start(
+			    p->p_sock, tx, &p->p_sa, len + udp_size_data);
+			p->p_tx_frag++;
+		}
+
+		p->p_tx_nfrags = 0;
+		nni_aio_list_remove(aio);
+		nni_aio_set_msg(aio, NULL);
+		nni_msg_free(m);
+		nni_aio_finish(aio, 0, total);
+	}
+}
+
+static void
+udp_pipe_tx_cb(void *arg)
+{
+	udp_txbuf *tx = arg;
+	udp_pipe * p  = tx->tx_pipe;
+	udp_sock * s  = tx->tx_sock;
+	int        rv;
+
+	nni_mtx_lock(&s->s_mtx);
+	p->p_txfree[p->p_ntxfree++] = tx;
+	switch ((rv = nni_aio_result(tx->tx_aio))) {
+	case 0:
+	case NNG_ECLOSED:
+	case NNG_ECANCELED:
+		break;
+	default:
+		// Count each message once, however many of its fragments
+		// were not sent.
+		if (tx->tx_msgid != p->p_tx_lost_id) {
+			p->p_tx_lost_id = tx->tx_msgid;
+			p->p_tx_lost++;
+		}
+		udp_sock_error(s, rv);
+		break;
+	}
+	udp_pipe_dosend(p);
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_cancel_send(nni_aio *aio, int rv)
+{
+	udp_pipe *p = nni_aio_get_prov_data(aio);
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (nni_aio_list_active(aio)) {
+		if (aio == nni_list_first(&p->p_user_txaios)) {
+			// Any fragments already sent will simply never
+			// be reassembled.
+			p->p_tx_nfrags = 0;
+		}
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, rv);
+		udp_pipe_dosend(p);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_send(void *arg, nni_aio *aio)
+{
+	udp_pipe *p = arg;
+	udp_sock *s = p->p_sock;
+	nni_msg * m;
+	size_t    fragsz;
+	size_t    bytes;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (nni_aio_start(aio, udp_pipe_cancel_send, p) != 0) {
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	if (p->p_closed) {
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	if ((m = nni_aio_get_msg(aio)) == NULL) {
+		nni_aio_finish_error(aio, NNG_EINVAL);
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+
+	// The fragment count must fit in 16 bits.
+	fragsz = p->p_mtu - udp_size_data;
+	bytes  = nni_msg_header_len(m) + nni_msg_len(m);
+	if (bytes > (0xffff * fragsz)) {
+		nni_aio_finish_error(aio, NNG_EMSGSIZE);
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	nni_aio_list_append(&p->p_user_txaios, aio);
+	udp_pipe_dosend(p);
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_cancel_recv(nni_aio *aio, int rv)
+{
+	udp_pipe *p = nni_aio_get_prov_data(aio);
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (p->p_user_rxaio == aio) {
+		p->p_user_rxaio = NULL;
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_recv_user(void *arg, nni_aio *aio)
+{
+	udp_pipe *p = arg;
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (nni_aio_start(aio, udp_pipe_cancel_recv, p) != 0) {
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	if (p->p_ready_len > 0) {
+		nni_msg *msg = p->p_ready[p->p_ready_head];
+		p->p_ready_head = (p->p_ready_head + 1) % udp_readyq;
+		p->p_ready_len--;
+		nni_aio_finish_msg(aio, msg);
+	} else if (p->p_closed) {
+		nni_aio_finish_error(aio, NNG_ECLOSED);
+	} else {
+		p->p_user_rxaio = aio;
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static uint16_t
+udp_pipe_peer(void *arg)
+{
+	udp_pipe *p = arg;
+
+	return (p->p_peer);
+}
+
+static void
+udp_pipe_cancel_ping(nni_aio *aio, int rv)
+{
+	udp_pipe *p = nni_aio_get_prov_data(aio);
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (p->p_ping_active) {
+		p->p_ping_active = false;
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_ping_cb(void *arg)
+{
+	udp_pipe *p   = arg;
+	udp_sock *s   = p->p_sock;
+	nni_aio * aio = p->p_ping_aio;
+
+	nni_mtx_lock(&s->s_mtx);
+	if (p->p_closed || (nni_aio_result(aio) != NNG_ETIMEDOUT)) {
+		nni_mtx_unlock(&s->s_mtx);
+		return;
+	}
+	if (p->p_ping_try < p->p_ping_tries) {
+		nni_time now = nni_clock();
+		nni_aio_set_timeout(aio, p->p_ping_time);
+		// We want pings.  We only send one if needed, but we
+		// use the the timer to wake us up even if we aren't
+		// going to send a ping.  (We don't increment the try count
+		// unless we actually do send one though.)
+		if (nni_aio_start(aio, udp_pipe_cancel_ping, p) == 0) {
+			p->p_ping_active = true;
+			if (now > (p->p_last_recv + p->p_ping_time)) {
+				// We have to send a ping to keep the session
+				// up.
+				p->p_ping_try++;
+				udp_pipe_send_ping(p);
+			}
+		}
+	} else {
+		// Ping count exceeded; the other side is AFK.
+		// Close the pipe, but no need to send a reason to the peer.
+		udp_pipe_close_err(p, NNG_ECLOSED, 0, NULL);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_pipe_start(void *arg, nni_aio *aio)
+{
+	udp_pipe *p = arg;
+	udp_sock *s = p->p_sock;
+
+	nni_mtx_lock(&s->s_mtx);
+	// Send a gratuitous ping, and start the ping interval timer.
+	if ((p->p_ping_tries > 0) && (p->p_ping_time != NNG_DURATION_ZERO) &&
+	    (p->p_ping_time != NNG_DURATION_INFINITE)) {
+		p->p_ping_try = 0;
+		nni_aio_set_timeout(p->p_ping_aio, p->p_ping_time);
+		if (nni_aio_start(p->p_ping_aio, udp_pipe_cancel_ping, p) ==
+		    0) {
+			p->p_ping_active = true;
+			udp_pipe_send_ping(p);
+		}
+	}
+	nni_aio_finish(aio, 0, 0);
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_ep_fini(void *arg)
+{
+	udp_ep *ep = arg;
+
+	if (ep->ep_sock != NULL) {
+		udp_sock_rele(ep->ep_sock);
+	}
+	nni_mtx_fini(&ep->ep_mtx);
+	NNI_FREE_STRUCT(ep);
+}
+
+static int
+udp_ep_init(void **epp, nni_url *url, nni_sock *sock, int mode)
+{
+	udp_ep *     ep;
+	int          rv;
+	char *       host;
+	char *       serv;
+	nni_sockaddr sa;
+	nni_aio *    aio;
+
+	// Check for invalid URL components.
+	if ((strlen(url->u_path) != 0) && (strcmp(url->u_path, "/") != 0)) {
+		return (NNG_EADDRINVAL);
+	}
+	if ((url->u_fragment != NULL) || (url->u_userinfo != NULL) ||
+	    (url->u_query != NULL)) {
+		return (NNG_EADDRINVAL);
+	}
+
+	host = strlen(url->u_hostname) == 0 ? NULL : url->u_hostname;
+	serv = strlen(url->u_port) == 0 ? NULL : url->u_port;
+	if ((mode == NNI_EP_MODE_DIAL) && ((host == NULL) || (serv == NULL))) {
+		return (NNG_EADDRINVAL);
+	}
+
+	if ((rv = nni_aio_init(&aio, NULL, NULL)) != 0) {
+		return (rv);
+	}
+	nni_aio_set_input(aio, 0, &sa);
+	nni_plat_udp_resolv(
+	    host, serv, NNG_AF_UNSPEC, mode == NNI_EP_MODE_LISTEN, aio);
+	nni_aio_wait(aio);
+	rv = nni_aio_result(aio);
+	nni_aio_fini(aio);
+	if (rv != 0) {
+		return (rv);
+	}
+
+	if ((ep = NNI_ALLOC_STRUCT(ep)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	nni_mtx_init(&ep->ep_mtx);
+	ep->ep_url   = url;
+	ep->ep_mode  = mode;
+	ep->ep_sa    = sa;
+	ep->ep_proto = nni_sock_proto(sock);
+	ep->ep_mtu   = udp_def_mtu;
+
+	*epp = ep;
+	return (0);
+}
+
+static void
+udp_ep_close(void *arg)
+{
+	udp_ep *  ep = arg;
+	udp_sock *s;
+	nni_aio * aio;
+
+	nni_mtx_lock(&ep->ep_mtx);
+	if ((s = ep->ep_sock) != NULL) {
+		nni_mtx_lock(&s->s_mtx);
+		s->s_listening = false;
+		while ((aio = nni_list_first(&s->s_aios)) != NULL) {
+			nni_aio_list_remove(aio);
+			nni_aio_finish_error(aio, NNG_ECLOSED);
+		}
+		if ((aio = s->s_user_aio) != NULL) {
+			s->s_user_aio = NULL;
+			nni_aio_finish_error(aio, NNG_ECLOSED);
+		}
+		nni_mtx_unlock(&s->s_mtx);
+	}
+	nni_mtx_unlock(&ep->ep_mtx);
+}
+
+static int
+udp_ep_bind(void *arg)
+{
+	udp_ep *  ep = arg;
+	udp_sock *s;
+	int       rv;
+
+	nni_mtx_lock(&ep->ep_mtx);
+	if (ep->ep_sock != NULL) {
+		nni_mtx_unlock(&ep->ep_mtx);
+		return (NNG_ESTATE);
+	}
+	if ((rv = udp_sock_init(&s, &ep->ep_sa, ep)) != 0) {
+		nni_mtx_unlock(&ep->ep_mtx);
+		return (rv);
+	}
+	if ((rv = nni_plat_udp_sockname(s->s_udp, &ep->ep_bsa)) != 0) {
+		udp_sock_rele(s);
+		nni_mtx_unlock(&ep->ep_mtx);
+		return (rv);
+	}
+	s->s_listening = true;
+	ep->ep_sock    = s;
+	udp_sock_start(s);
+	nni_mtx_unlock(&ep->ep_mtx);
+	return (0);
+}
+
+static void
+udp_ep_cancel_accept(nni_aio *aio, int rv)
+{
+	udp_sock *s = nni_aio_get_prov_data(aio);
+
+	nni_mtx_lock(&s->s_mtx);
+	if (nni_aio_list_active(aio)) {
+		nni_aio_list_remove(aio);
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_ep_accept(void *arg, nni_aio *aio)
+{
+	udp_ep *  ep = arg;
+	udp_sock *s;
+
+	nni_mtx_lock(&ep->ep_mtx);
+	if ((s = ep->ep_sock) == NULL) {
+		nni_mtx_unlock(&ep->ep_mtx);
+		if (nni_aio_start(aio, NULL, NULL) == 0) {
+			nni_aio_finish_error(aio, NNG_ESTATE);
+		}
+		return;
+	}
+	nni_mtx_lock(&s->s_mtx);
+	if (nni_aio_start(aio, udp_ep_cancel_accept, s) == 0) {
+		if (!s->s_listening) {
+			nni_aio_finish_error(aio, NNG_ECLOSED);
+		} else {
+			nni_aio_list_append(&s->s_aios, aio);
+			udp_sock_doaccept(s);
+		}
+	}
+	nni_mtx_unlock(&s->s_mtx);
+	nni_mtx_unlock(&ep->ep_mtx);
+}
+
+static void
+udp_ep_cancel_connect(nni_aio *aio, int rv)
+{
+	udp_sock *s = nni_aio_get_prov_data(aio);
+
+	nni_mtx_lock(&s->s_mtx);
+	if (s->s_user_aio == aio) {
+		// The retry timer notices this when it next fires.
+		s->s_user_aio = NULL;
+		nni_aio_finish_error(aio, rv);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+}
+
+static void
+udp_ep_connect(void *arg, nni_aio *aio)
+{
+	udp_ep *     ep = arg;
+	udp_sock *   s;
+	nng_sockaddr lsa;
+	int          rv;
+
+	// Each connection gets its own socket, bound to an ephemeral
+	// port, and connected to the peer.
+	memset(&lsa, 0, sizeof(lsa));
+	lsa.s_un.s_family = ep->ep_sa.s_un.s_family;
+
+	nni_mtx_lock(&ep->ep_mtx);
+	if (nni_aio_start(aio, NULL, NULL) != 0) {
+		nni_mtx_unlock(&ep->ep_mtx);
+		return;
+	}
+	if ((rv = udp_sock_init(&s, &lsa, ep)) != 0) {
+		nni_aio_finish_error(aio, rv);
+		nni_mtx_unlock(&ep->ep_mtx);
+		return;
+	}
+	if ((rv = nni_plat_udp_connect(s->s_udp, &ep->ep_sa)) != 0) {
+		udp_sock_rele(s);
+		nni_aio_finish_error(aio, rv);
+		nni_mtx_unlock(&ep->ep_mtx);
+		return;
+	}
+
+	// The previous socket, if any, now belongs to its pipe.
+	if (ep->ep_sock != NULL) {
+		udp_sock_rele(ep->ep_sock);
+	}
+	ep->ep_sock = s;
+
+	nni_mtx_lock(&s->s_mtx);
+	s->s_dialer = true;
+	s->s_raddr  = ep->ep_sa;
+	if ((s->s_dial_id = nni_random()) == 0) {
+		s->s_dial_id = 1;
+	}
+	// Now that we have somewhere to put it, arrange for cancellation.
+	if (nni_aio_start(aio, udp_ep_cancel_connect, s) == 0) {
+		s->s_user_aio = aio;
+		s->s_creq_try = 0;
+		udp_sock_start(s);
+		udp_sock_send_conn_req(s);
+	}
+	nni_mtx_unlock(&s->s_mtx);
+	nni_mtx_unlock(&ep->ep_mtx);
+}
+
+static int
+udp_ep_setopt_recvmaxsz(void *arg, const void *data, size_t sz)
+{
+	udp_ep *ep = arg;
+	int     rv;
+
+	if (ep == NULL) {
+		return (nni_chkopt_size(data, sz, 0, NNI_MAXSZ));
+	}
+	nni_mtx_lock(&ep->ep_mtx);
+	rv = nni_setopt_size(&ep->ep_rcvmax, data, sz, 0, NNI_MAXSZ);
+	if ((rv == 0) && (ep->ep_sock != NULL)) {
+		// New pipes get the new value.
+		nni_mtx_lock(&ep->ep_sock->s_mtx);
+		ep->ep_sock->s_rcvmax = ep->ep_rcvmax;
+		nni_mtx_unlock(&ep->ep_sock->s_mtx);
+	}
+	nni_mtx_unlock(&ep->ep_mtx);
+	return (rv);
+}
+
+static int
+udp_ep_getopt_recvmaxsz(void *arg, void *data, size_t *szp)
+{
+	udp_ep *ep = arg;
+	return (nni_getopt_size(ep->ep_rcvmax, data, szp));
+}
+
+static int
+udp_ep_setopt_mtu(void *arg, const void *data, size_t sz)
+{
+	udp_ep *ep = arg;
+	int     rv;
+
+	if (ep == NULL) {
+		return (nni_chkopt_size(data, sz, udp_min_mtu, udp_max_mtu));
+	}
+	nni_mtx_lock(&ep->ep_mtx);
+	if ((ep->ep_mode == NNI_EP_MODE_LISTEN) && (ep->ep_sock != NULL)) {
+		// The receive buffers are already sized.
+		rv = NNG_ESTATE;
+	} else {
+		rv = nni_setopt_size(
+		    &ep->ep_mtu, data, sz, udp_min_mtu, udp_max_mtu);
+	}
+	nni_mtx_unlock(&ep->ep_mtx);
+	return (rv);
+}
+
+static int
+udp_ep_getopt_mtu(void *arg, void *data, size_t *szp)
+{
+	udp_ep *ep = arg;
+	return (nni_getopt_size(ep->ep_mtu, data, szp));
+}
+
+static int
+udp_ep_getopt_url(void *arg, void *data, size_t *szp)
+{
+	udp_ep *ep = arg;
+	char    ustr[128];
+	char    ipstr[48];  // max for IPv6 addresses including []
+	char    portstr[6]; // max for 16-bit port
+
+	if ((ep->ep_mode == NNI_EP_MODE_DIAL) || (ep->ep_sock == NULL)) {
+		return (nni_getopt_str(ep->ep_url->u_rawurl, data, szp));
+	}
+	// Report the port we were given, if we asked for port zero.
+	nni_plat_tcp_ntop(&ep->ep_bsa, ipstr, portstr);
+	snprintf(ustr, sizeof(ustr), "udp://%s:%s", ipstr, portstr);
+	return (nni_getopt_str(ustr, data, szp));
+}
+
+static int
+udp_pipe_getopt_locaddr(void *arg, void *data, size_t *szp)
+{
+	udp_pipe *   p = arg;
+	nng_sockaddr sa;
+	int          rv;
+
+	memset(&sa, 0, sizeof(sa));
+	if ((rv = nni_plat_udp_sockname(p->p_sock->s_udp, &sa)) != 0) {
+		return (rv);
+	}
+	return (nni_getopt_sockaddr(&sa, data, szp));
+}
+
+static int
+udp_pipe_getopt_remaddr(void *arg, void *data, size_t *szp)
+{
+	udp_pipe *p = arg;
+	return (nni_getopt_sockaddr(&p->p_sa, data, szp));
+}
+
+static int
+udp_pipe_getopt_mtu(void *arg, void *data, size_t *szp)
+{
+	udp_pipe *p = arg;
+	return (nni_getopt_size(p->p_mtu, data, szp));
+}
+
+static int
+udp_pipe_getopt_recvmaxsz(void *arg, void *data, size_t *szp)
+{
+	udp_pipe *p = arg;
+	return (nni_getopt_size(p->p_rcvmax, data, szp));
+}
+
+static int
+udp_pipe_getopt_recv_lost(void *arg, void *data, size_t *szp)
+{
+	udp_pipe *p = arg;
+	uint64_t  v;
+
+	nni_mtx_lock(&p->p_sock->s_mtx);
+	v = p->p_rx_lost;
+	nni_mtx_unlock(&p->p_sock->s_mtx);
+	return (nni_getopt_u64(v, data, szp));
+}
+
+static int
+udp_pipe_getopt_send_lost(void *arg, void *data, size_t *szp)
+{
+	udp_pipe *p = arg;
+	uint64_t  v;
+
+	nni_mtx_lock(&p->p_sock->s_mtx);
+	v = p->p_tx_lost;
+	nni_mtx_unlock(&p->p_sock->s_mtx);
+	return (nni_getopt_u64(v, data, szp));
+}
+
+static nni_tran_pipe_option udp_pipe_options[] = {
+	{ NNG_OPT_LOCADDR, udp_pipe_getopt_locaddr },
+	{ NNG_OPT_REMADDR, udp_pipe_getopt_remaddr },
+	{ NNG_OPT_RECVMAXSZ, udp_pipe_getopt_recvmaxsz },
+	{ NNG_OPT_UDP_MTU, udp_pipe_getopt_mtu },
+	{ NNG_OPT_UDP_RECV_LOST, udp_pipe_getopt_recv_lost },
+	{ NNG_OPT_UDP_SEND_LOST, udp_pipe_getopt_send_lost },
+	// terminate list
+	{ NULL, NULL },
+};
+
+static nni_tran_pipe udp_pipe_ops = {
+	.p_fini    = udp_pipe_fini,
+	.p_start   = udp_pipe_start,
+	.p_send    = udp_pipe_send,
+	.p_recv    = udp_pipe_recv_user,
+	.p_close   = udp_pipe_close,
+	.p_peer    = udp_pipe_peer,
+	.p_options = udp_pipe_options,
+};
+
+static nni_tran_ep_option udp_ep_options[] = {
+	{
+	    .eo_name   = NNG_OPT_RECVMAXSZ,
+	    .eo_getopt = udp_ep_getopt_recvmaxsz,
+	    .eo_setopt = udp_ep_setopt_recvmaxsz,
+	},
+	{
+	    .eo_name   = NNG_OPT_URL,
+	    .eo_getopt = udp_ep_getopt_url,
+	    .eo_setopt = NULL,
+	},
+	{
+	    .eo_name   = NNG_OPT_UDP_MTU,
+	    .eo_getopt = udp_ep_getopt_mtu,
+	    .eo_setopt = udp_ep_setopt_mtu,
+	},
+	// terminate list
+	{ NULL, NULL, NULL },
+};
+
+static nni_tran_ep udp_ep_ops = {
+	.ep_init    = udp_ep_init,
+	.ep_fini    = udp_ep_fini,
+	.ep_connect = udp_ep_connect,
+	.ep_bind    = udp_ep_bind,
+	.ep_accept  = udp_ep_accept,
+	.ep_close   = udp_ep_close,
+	.ep_options = udp_ep_options,
+};
+
+// This is the UDP transport linkage, and should be the only global
+// symbol in this entire file.
+static struct nni_tran udp_tran = {
+	.tran_version = NNI_TRANSPORT_VERSION,
+	.tran_scheme  = "udp",
+	.tran_ep      = &udp_ep_ops,
+	.tran_pipe    = &udp_pipe_ops,
+	.tran_init    = udp_tran_init,
+	.tran_fini    = udp_tran_fini,
+};
+
+int
+nng_udp_register(void)
+{
+	return (nni_tran_register(&udp_tran));
+}
@@ -0,0 +1,44 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef NNG_TRANSPORT_UDP_UDP_H
+#define NNG_TRANSPORT_UDP_UDP_H
+
+// UDP transport.  This carries messages directly in UDP datagrams, with
+// no retransmission, so messages may be lost or arrive out of order, but
+// a lost message never holds up the ones behind it.  It suits telemetry
+// and similar traffic, using protocols such as PUB/SUB or PAIR, where a
+// late message is worth no more than a lost one.
+//
+// The URL format is udp://<host>:<port>, just like tcp://.
+
+// NNG_OPT_UDP_MTU is the largest datagram (UDP payload, including our
+// own 20 byte header) that will be sent, as a size_t.  Larger messages
+// are split into fragments, and reassembled by the receiver; a message
+// is lost if any of its fragments is.  Peers use the smaller of their
+// two values.  This must be set before the endpoint is started, and may
+// be read from pipes to learn the value agreed with the peer.
+#define NNG_OPT_UDP_MTU "udp:mtu"
+
+// NNG_OPT_UDP_RECV_LOST is a read-only uint64_t, available on pipes,
+// counting the messages sent by the peer that were not received.  This
+// is inferred from gaps in the message sequence numbers, so a loss is
+// only noticed when a later message arrives.  Messages discarded because
+// the application was not receiving them quickly enough are included.
+#define NNG_OPT_UDP_RECV_LOST "udp:recv-lost"
+
+// NNG_OPT_UDP_SEND_LOST is a read-only uint64_t, available on pipes,
+// counting the messages that could not be handed to the network in
+// full, for example because the system was out of buffers.
+#define NNG_OPT_UDP_SEND_LOST "udp:send-lost"
+
+NNG_DECL int nng_udp_register(void);
+
+#endif // NNG_TRANSPORT_UDP_UDP_H
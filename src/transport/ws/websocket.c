@@ -35,6 +35,8 @@ struct ws_ep {
 	uint16_t         lproto; // local protocol
 	uint16_t         rproto; // remote protocol
 	size_t           rcvmax;
+	bool             sendtext;
+	bool             recvtext;
 	char *           protoname;
 	nni_list         aios;
 	nni_mtx          mtx;
@@ -225,6 +227,9 @@ ws_pipe_init(ws_pipe **pipep, ws_ep *ep, void *ws)
 	p->lproto = ep->lproto;
 	p->ws     = ws;
 
+	nni_ws_set_send_text(ws, ep->sendtext);
+	nni_ws_set_recv_text(ws, ep->recvtext);
+
 	*pipep = p;
 	return (0);
 }
@@ -348,6 +353,53 @@ ws_ep_setopt_recvmaxsz(void *arg, const void *v, size_t sz)
 	return (nni_setopt_size(&ep->rcvmax, v, sz, 0, NNI_MAXSZ));
 }
 
+static int
+ws_ep_setopt_flag(ws_ep *ep, bool *flagp, const void *v, size_t sz)
+{
+	int val;
+	int rv;
+
+	if (ep == NULL) {
+		return (nni_chkopt_int(v, sz, 0, 1));
+	}
+	if ((rv = nni_setopt_int(&val, v, sz, 0, 1)) == 0) {
+		nni_mtx_lock(&ep->mtx);
+		*flagp = (val != 0);
+		nni_mtx_unlock(&ep->mtx);
+	}
+	return (rv);
+}
+
+static int
+ws_ep_setopt_sendtext(void *arg, const void *v, size_t sz)
+{
+	ws_ep *ep = arg;
+	return (
+	    ws_ep_setopt_flag(ep, ep != NULL ? &ep->sendtext : NULL, v, sz));
+}
+
+static int
+ws_ep_getopt_sendtext(void *arg, void *v, size_t *szp)
+{
+	ws_ep *ep = arg;
+	return (nni_getopt_int(ep->sendtext, v, szp));
+}
+
+static int
+ws_ep_setopt_recvtext(void *arg, const void *v, size_t sz)
+{
+	ws_ep *ep = arg;
+	return (
+	    ws_ep_setopt_flag(ep, ep != NULL ? &ep->recvtext : NULL, v, sz));
+}
+
+static int
+ws_ep_getopt_recvtext(void *arg, void *v, size_t *szp)
+{
+	ws_ep *ep = arg;
+	return (nni_getopt_int(ep->recvtext, v, szp));
+}
+
 static int
 ws_ep_setopt_headers(ws_ep *ep, const void *v, size_t sz)
 {
@@ -574,6 +626,16 @@ static nni_tran_ep_option ws_ep_options[] = {
 	    .eo_getopt = NULL,
 	    .eo_setopt = ws_ep_setopt_reshdrs,
 	},
+	{
+	    .eo_name   = NNG_OPT_WS_SEND_TEXT,
+	    .eo_getopt = ws_ep_getopt_sendtext,
+	    .eo_setopt = ws_ep_setopt_sendtext,
+	},
+	{
+	    .eo_name   = NNG_OPT_WS_RECV_TEXT,
+	    .eo_getopt = ws_ep_getopt_recvtext,
+	    .eo_setopt = ws_ep_setopt_recvtext,
+	},
 
 	// terminate list
 	{ NULL, NULL, NULL },
@@ -923,6 +985,16 @@ static nni_tran_ep_option wss_ep_options[] = {
 	    .eo_getopt = NULL,
 	    .eo_setopt = ws_ep_setopt_reshdrs,
 	},
+	{
+	    .eo_name   = NNG_OPT_WS_SEND_TEXT,
+	    .eo_getopt = ws_ep_getopt_sendtext,
+	    .eo_setopt = ws_ep_setopt_sendtext,
+	},
+	{
+	    .eo_name   = NNG_OPT_WS_RECV_TEXT,
+	    .eo_getopt = ws_ep_getopt_recvtext,
+	    .eo_setopt = ws_ep_setopt_recvtext,
+	},
 	{
 	    .eo_name   = NNG_OPT_TLS_CONFIG,
 	    .eo_getopt = wss_ep_getopt_tlsconfig,
@@ -23,6 +23,16 @@ NNG_DECL int nng_ws_register(void);
 // response headers, formatted as CRLF terminated lines.
 #define NNG_OPT_WS_RESPONSE_HEADERS "ws:response-headers"
 
+// NNG_OPT_WS_SEND_TEXT is a boolean; when set, messages are sent as
+// TEXT frames rather than BINARY frames.  This is for interoperating
+// with peers (such as browsers) that expect text.
+#define NNG_OPT_WS_SEND_TEXT "ws:send-text"
+
+// NNG_OPT_WS_RECV_TEXT is a boolean; when set, TEXT frames from the peer
+// are accepted, instead of closing the connection.  Text messages must be
+// valid UTF-8, or the connection is closed.
+#define NNG_OPT_WS_RECV_TEXT "ws:recv-text"
+
 // These aliases are for WSS naming consistency.
 #define NNG_OPT_WSS_REQUEST_HEADERS NNG_OPT_WS_REQUEST_HEADERS
 #define NNG_OPT_WSS_RESPONSE_HEADERS NNG_OPT_WS_RESPONSE_HEADERS
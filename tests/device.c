@@ -36,6 +36,27 @@ dodev(void *arg)
 
 #define SECOND(x) ((x) *1000)
 
+static int64_t
+statval(nng_socket s, const char *name)
+{
+	nng_snapshot *snap;
+	nng_stat *    stat = NULL;
+	int64_t       val  = -1;
+
+	if ((nng_snapshot_create(s, &snap) != 0) ||
+	    (nng_snapshot_update(snap) != 0)) {
+		return (-1);
+	}
+	while ((nng_snapshot_next(snap, &stat) == 0) && (stat != NULL)) {
+		if (strcmp(nng_stat_name(stat), name) == 0) {
+			val = nng_stat_value(stat);
+			break;
+		}
+	}
+	nng_snapshot_free(snap);
+	return (val);
+}
+
 Main({
 
 	Test("PAIRv1 device", {
@@ -101,6 +122,80 @@ Main({
 				nng_msg_free(msg);
 			});
 		});
+
+		Convey("A device window keeps messages in order", {
+			nng_socket   dev1;
+			nng_socket   dev2;
+			nng_socket   end1;
+			nng_socket   end2;
+			nng_msg *    msg;
+			nng_thread * thr;
+			int          win;
+			int          n = 200;
+
+			So(nng_pair1_open(&dev1) == 0);
+			So(nng_pair1_open(&dev2) == 0);
+			So(nng_setopt_int(dev1, NNG_OPT_RAW, 1) == 0);
+			So(nng_setopt_int(dev2, NNG_OPT_RAW, 1) == 0);
+
+			So(nng_getopt_int(dev1, NNG_OPT_DEVICE_WINDOW, &win) ==
+			    0);
+			So(win == 8);
+			So(nng_setopt_int(dev1, NNG_OPT_DEVICE_WINDOW, 0) ==
+			    NNG_EINVAL);
+			So(nng_setopt_int(dev1, NNG_OPT_DEVICE_WINDOW, 32) ==
+			    0);
+			So(nng_setopt_int(dev2, NNG_OPT_DEVICE_WINDOW, 1) == 0);
+
+			struct dev_data ddata;
+			ddata.s1 = dev1;
+			ddata.s2 = dev2;
+
+			So(nng_thread_create(&thr, dodev, &ddata) == 0);
+			Reset({
+				nng_close(end1);
+				nng_close(end2);
+				nng_close(dev1);
+				nng_close(dev2);
+				nng_thread_destroy(thr);
+			});
+
+			So(nng_listen(dev1, "inproc://devwin1", NULL, 0) == 0);
+			So(nng_listen(dev2, "inproc://devwin2", NULL, 0) == 0);
+			So(nng_pair1_open(&end1) == 0);
+			So(nng_pair1_open(&end2) == 0);
+			So(nng_setopt_ms(end2, NNG_OPT_RECVTIMEO, SECOND(1)) ==
+			    0);
+			// Room for everything, as we send it all first.
+			So(nng_setopt_int(end2, NNG_OPT_RECVBUF, n) == 0);
+			So(nng_setopt_ms(end1, NNG_OPT_RECVTIMEO, SECOND(1)) ==
+			    0);
+			So(nng_dial(end1, "inproc://devwin1", NULL, 0) == 0);
+			So(nng_dial(end2, "inproc://devwin2", NULL, 0) == 0);
+			nng_msleep(100);
+
+			for (uint32_t i = 0; i < (uint32_t) n; i++) {
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_msg_append_u32(msg, i) == 0);
+				So(nng_sendmsg(end1, msg, 0) == 0);
+			}
+			for (uint32_t i = 0; i < (uint32_t) n; i++) {
+				uint32_t v;
+				So(nng_recvmsg(end2, &msg, 0) == 0);
+				So(nng_msg_trim_u32(msg, &v) == 0);
+				So(v == i);
+				nng_msg_free(msg);
+			}
+			So(nng_send(end2, "back", 5, 0) == 0);
+			So(nng_recvmsg(end1, &msg, 0) == 0);
+			nng_msg_free(msg);
+
+			So(statval(dev1, "device.fwd_msgs") == n);
+			// Bytes include the (raw) protocol headers.
+			So(statval(dev1, "device.fwd_bytes") >= n * 4);
+			So(statval(dev1, "device.drops") == 0);
+			So(statval(dev2, "device.fwd_msgs") == 1);
+		});
 	});
 
 	nng_fini();
@@ -0,0 +1,245 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+
+#include "core/nng_impl.h"
+
+#include <string.h>
+
+typedef struct {
+	uint64_t       id;
+	nni_atomic_u64 refs;
+	int            closed;
+} hdl_obj;
+
+static int
+hdl_hold(void *arg)
+{
+	hdl_obj *o = arg;
+
+	if (o->closed) {
+		return (NNG_ECLOSED);
+	}
+	nni_atomic_inc64(&o->refs);
+	return (0);
+}
+
+#define HDL_NOBJS 64
+
+typedef struct {
+	nni_hdltab *tab;
+	hdl_obj *   objs;
+	uint64_t    finds;
+	int         bad;
+	int         stop;
+	nni_thr     thr;
+} hdl_reader;
+
+static void
+hdl_reader_main(void *arg)
+{
+	hdl_reader *r = arg;
+
+	while (!r->stop) {
+		for (int i = 0; i < HDL_NOBJS; i++) {
+			hdl_obj *o;
+			if (nni_hdltab_find(r->tab, r->objs[i].id, hdl_hold,
+			        (void **) &o) != 0) {
+				continue;
+			}
+			if (o != &r->objs[i]) {
+				r->bad++;
+			}
+			(void) nni_atomic_dec64_nv(&o->refs);
+			r->finds++;
+		}
+	}
+}
+
+Main({
+	nni_init();
+	atexit(nni_fini);
+	Test("Handle tables", {
+		Convey("Given a handle table", {
+			nni_hdltab *h = NULL;
+
+			So(nni_hdltab_init(&h) == 0);
+			So(h != NULL);
+			So(nni_hdltab_count(h) == 0);
+			nni_hdltab_set_limits(h, 1, 0x7fffffff, 100);
+
+			Reset({ nni_hdltab_fini(h); });
+
+			Convey("We can allocate and find", {
+				hdl_obj  o;
+				hdl_obj *p = NULL;
+
+				memset(&o, 0, sizeof(o));
+				nni_atomic_init64(&o.refs);
+				So(nni_hdltab_alloc(h, &o.id, &o) == 0);
+				So(o.id == 100);
+				So(nni_hdltab_count(h) == 1);
+				So(nni_hdltab_find(h, o.id, hdl_hold,
+				       (void **) &p) == 0);
+				So(p == &o);
+				So(nni_atomic_get64(&o.refs) == 1);
+
+				Convey("Hold can refuse", {
+					o.closed = 1;
+					So(nni_hdltab_find(h, o.id, hdl_hold,
+					       (void **) &p) == NNG_ECLOSED);
+					So(nni_atomic_get64(&o.refs) == 1);
+				});
+
+				Convey("Removed IDs are not found", {
+					So(nni_hdltab_remove(h, o.id) == 0);
+					So(nni_hdltab_count(h) == 0);
+					So(nni_hdltab_find(h, o.id, NULL,
+					       (void **) &p) == NNG_ENOENT);
+					So(nni_hdltab_remove(h, o.id) ==
+					    NNG_ENOENT);
+				});
+			});
+
+			Convey("Unknown IDs are not found", {
+				void *p;
+				So(nni_hdltab_find(h, 1, NULL, &p) ==
+				    NNG_ENOENT);
+			});
+
+			Convey("Allocation wraps and skips IDs in use", {
+				char     a;
+				char     b;
+				char     c;
+				uint64_t ida;
+				uint64_t idb;
+				uint64_t idc;
+				void *   p;
+
+				nni_hdltab_set_limits(h, 1, 3, 3);
+				So(nni_hdltab_alloc(h, &ida, &a) == 0);
+				So(nni_hdltab_alloc(h, &idb, &b) == 0);
+				So(ida == 3);
+				So(idb == 1);
+				So(nni_hdltab_remove(h, ida) == 0);
+				So(nni_hdltab_alloc(h, &idc, &c) == 0);
+				So(idc == 2);
+				So(nni_hdltab_alloc(h, &ida, &a) == 0);
+				So(ida == 3);
+				So(nni_hdltab_alloc(h, &ida, &a) == NNG_ENOMEM);
+				So(nni_hdltab_find(h, 1, NULL, &p) == 0);
+				So(p == &b);
+				So(nni_hdltab_find(h, 2, NULL, &p) == 0);
+				So(p == &c);
+			});
+
+			Convey("Many entries grow and shrink the table", {
+				int      n = 1000;
+				hdl_obj *objs;
+
+				objs = nni_alloc(sizeof(hdl_obj) * n);
+				So(objs != NULL);
+				Reset({ nni_free(objs, sizeof(hdl_obj) * n); });
+
+				for (int i = 0; i < n; i++) {
+					So(nni_hdltab_alloc(
+					       h, &objs[i].id, &objs[i]) == 0);
+				}
+				So(nni_hdltab_count(h) == (size_t) n);
+				for (int i = 0; i < n; i++) {
+					hdl_obj *p;
+					So(nni_hdltab_find(h, objs[i].id, NULL,
+					       (void **) &p) == 0);
+					So(p == &objs[i]);
+				}
+				for (int i = 0; i < n; i += 2) {
+					So(nni_hdltab_remove(
+					       h, objs[i].id) == 0);
+				}
+				for (int i = 0; i < n - 10; i++) {
+					if ((i % 2) == 1) {
+						So(nni_hdltab_remove(
+						       h, objs[i].id) == 0);
+					}
+				}
+				So(nni_hdltab_count(h) == 5);
+				for (int i = 0; i < n; i++) {
+					hdl_obj *p;
+					int      rv;
+					rv = nni_hdltab_find(
+					    h, objs[i].id, NULL, (void **) &p);
+					if ((i >= n - 10) && ((i % 2) == 1)) {
+						So(rv == 0);
+						So(p == &objs[i]);
+					} else {
+						So(rv == NNG_ENOENT);
+					}
+				}
+			});
+
+			Convey("Removal waits for concurrent lookups", {
+				hdl_reader rdrs[4];
+				hdl_obj *  objs;
+				size_t     sz = sizeof(hdl_obj) * HDL_NOBJS;
+				uint64_t   finds;
+				int        bad;
+
+				objs = nni_alloc(sz);
+				So(objs != NULL);
+				for (int i = 0; i < HDL_NOBJS; i++) {
+					nni_atomic_init64(&objs[i].refs);
+					So(nni_hdltab_alloc(
+					       h, &objs[i].id, &objs[i]) == 0);
+				}
+				for (int i = 0; i < 4; i++) {
+					rdrs[i].tab   = h;
+					rdrs[i].objs  = objs;
+					rdrs[i].finds = 0;
+					rdrs[i].bad   = 0;
+					rdrs[i].stop  = 0;
+					So(nni_thr_init(&rdrs[i].thr,
+					       hdl_reader_main, &rdrs[i]) == 0);
+					nni_thr_run(&rdrs[i].thr);
+				}
+				nni_msleep(20);
+
+				// Remove each object in turn, and put it back
+				// under a new ID, as closing sockets do.  Once
+				// removed, nobody may take a new reference.
+				for (int i = 0; i < HDL_NOBJS; i++) {
+					uint64_t refs;
+					objs[i].closed = 1;
+					So(nni_hdltab_remove(
+					       h, objs[i].id) == 0);
+					refs = nni_atomic_get64(&objs[i].refs);
+					nni_msleep(1);
+					So(nni_atomic_get64(&objs[i].refs) <=
+					    refs);
+					objs[i].closed = 0;
+					So(nni_hdltab_alloc(
+					       h, &objs[i].id, &objs[i]) == 0);
+				}
+
+				finds = 0;
+				bad   = 0;
+				for (int i = 0; i < 4; i++) {
+					rdrs[i].stop = 1;
+					nni_thr_fini(&rdrs[i].thr);
+					finds += rdrs[i].finds;
+					bad += rdrs[i].bad;
+				}
+				So(finds > 0);
+				So(bad == 0);
+				nni_free(objs, sz);
+			});
+		});
+	});
+})
@@ -24,6 +24,10 @@ const char *doc1 = "<html><body>Someone <b>is</b> home!</body</html>";
 const char *doc2 = "This is a text file.";
 const char *doc3 = "<html><body>This is doc number 3.</body></html>";
 
+// doc4 is large enough that the server has to send it in several pieces.
+#define DOC4_SIZE 200000
+static uint8_t doc4[DOC4_SIZE];
+
 void
 cleanup(void)
 {
@@ -66,7 +70,9 @@ httpdo(nng_url *url, nng_http_req *req, nng_http_res *res, void **datap,
 	}
 
 	clen = 0;
-	if ((nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK) &&
+	if (((nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK) ||
+	        (nng_http_res_get_status(res) ==
+	            NNG_HTTP_STATUS_PARTIAL_CONTENT)) &&
 	    ((ptr = nng_http_res_get_header(res, "Content-Length")) != NULL)) {
 		clen = atoi(ptr);
 	}
@@ -101,6 +107,35 @@ fail:
 	return (rv);
 }
 
+// httpfetch does a GET of the URL, with an optional extra request header.
+static int
+httpfetch(const char *addr, const char *hdr, const char *val,
+    nng_http_res *res, void **datap, size_t *sizep)
+{
+	int           rv;
+	nng_http_req *req = NULL;
+	nng_url *     url = NULL;
+
+	if (((rv = nng_url_parse(&url, addr)) != 0) ||
+	    ((rv = nng_http_req_alloc(&req, url)) != 0)) {
+		goto fail;
+	}
+	if ((hdr != NULL) &&
+	    ((rv = nng_http_req_set_header(req, hdr, val)) != 0)) {
+		goto fail;
+	}
+	rv = httpdo(url, req, res, datap, sizep);
+
+fail:
+	if (url != NULL) {
+		nni_url_free(url);
+	}
+	if (req != NULL) {
+		nng_http_req_free(req);
+	}
+	return (rv);
+}
+
 static int
 httpget(const char *addr, void **datap, size_t *sizep, uint16_t *statp,
     char **ctypep)
@@ -262,6 +297,165 @@ TestMain("HTTP Server", {
 			});
 		});
 	});
+	Convey("Handler routing works", {
+		char              urlstr[32];
+		char              fullurl[256];
+		char              name[32];
+		nng_url *         url;
+		nng_http_handler *h2;
+		nng_http_res *    res;
+		nng_http_req *    req;
+		nng_url *         curl;
+		void *            data;
+		size_t            size;
+
+		trantest_next_address(urlstr, "http://127.0.0.1:%u");
+		So(nng_url_parse(&url, urlstr) == 0);
+		So(nng_http_server_hold(&s, url) == 0);
+		So(nng_http_res_alloc(&res) == 0);
+		Reset({
+			nng_http_server_release(s);
+			nng_http_res_free(res);
+			nng_url_free(url);
+		});
+
+		// Lots of handlers sharing long common prefixes.
+		for (int i = 0; i < 1000; i++) {
+			snprintf(name, sizeof(name), "/api/item%d", i);
+			So(nng_http_handler_alloc_static(&h, name, name,
+			       strlen(name), "text/plain") == 0);
+			So(nng_http_server_add_handler(s, h) == 0);
+		}
+		So(nng_http_handler_alloc_static(
+		       &h, "/api/tree", "tree", 4, "text/plain") == 0);
+		So(nng_http_handler_set_tree(h) == 0);
+		So(nng_http_server_add_handler(s, h) == 0);
+		So(nng_http_handler_alloc_static(
+		       &h2, "/api/item5", "post", 4, "text/plain") == 0);
+		So(nng_http_handler_set_method(h2, "POST") == 0);
+		So(nng_http_server_add_handler(s, h2) == 0);
+		So(nng_http_server_start(s) == 0);
+
+		Convey("Conflicts are detected", {
+			So(nng_http_handler_alloc_static(&h, "/api/item5/",
+			       "x", 1, "text/plain") == 0);
+			So(nng_http_server_add_handler(s, h) ==
+			    NNG_EADDRINUSE);
+			nng_http_handler_free(h);
+
+			So(nng_http_handler_alloc_static(
+			       &h, "/api", "x", 1, "text/plain") == 0);
+			So(nng_http_handler_set_tree(h) == 0);
+			So(nng_http_server_add_handler(s, h) ==
+			    NNG_EADDRINUSE);
+			nng_http_handler_free(h);
+
+			So(nng_http_handler_alloc_static(
+			       &h, "/api/tree/x/y", "x", 1, "text/plain") == 0);
+			So(nng_http_server_add_handler(s, h) ==
+			    NNG_EADDRINUSE);
+			nng_http_handler_free(h);
+
+			// Not a conflict: different path component.
+			So(nng_http_handler_alloc_static(
+			       &h, "/api/tre", "x", 1, "text/plain") == 0);
+			So(nng_http_handler_set_tree(h) == 0);
+			So(nng_http_server_add_handler(s, h) == 0);
+		});
+
+		Convey("Requests find their handlers", {
+			snprintf(fullurl, sizeof(fullurl), "%s/api/item512",
+			    urlstr);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK);
+			So(size == strlen("/api/item512"));
+			So(memcmp(data, "/api/item512", size) == 0);
+			nng_free(data, size);
+
+			snprintf(fullurl, sizeof(fullurl), "%s/api/tree/a/b",
+			    urlstr);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK);
+			So(size == 4);
+			So(memcmp(data, "tree", size) == 0);
+			nng_free(data, size);
+
+			snprintf(fullurl, sizeof(fullurl), "%s/api/item51x",
+			    urlstr);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_NOT_FOUND);
+
+			snprintf(fullurl, sizeof(fullurl), "%s/api/item5/x",
+			    urlstr);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_NOT_FOUND);
+		});
+
+		Convey("Methods are honored", {
+			snprintf(fullurl, sizeof(fullurl), "%s/api/item5",
+			    urlstr);
+			So(nng_url_parse(&curl, fullurl) == 0);
+			So(nng_http_req_alloc(&req, curl) == 0);
+			Reset({
+				nng_http_req_free(req);
+				nng_url_free(curl);
+			});
+
+			So(nng_http_req_set_method(req, "POST") == 0);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpdo(curl, req, res, &data, &size) == 0);
+			So(nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK);
+			So(size == 4);
+			So(memcmp(data, "post", size) == 0);
+			nng_free(data, size);
+
+			nng_http_req_free(req);
+			So(nng_http_req_alloc(&req, curl) == 0);
+			So(nng_http_req_set_method(req, "PUT") == 0);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpdo(curl, req, res, &data, &size) == 0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_METHOD_NOT_ALLOWED);
+		});
+
+		Convey("Deleted handlers are gone", {
+			So(nng_http_server_del_handler(s, h2) == 0);
+			So(nng_http_server_del_handler(s, h2) == NNG_ENOENT);
+			nng_http_handler_free(h2);
+
+			snprintf(fullurl, sizeof(fullurl), "%s/api/item5",
+			    urlstr);
+			So(nng_url_parse(&curl, fullurl) == 0);
+			So(nng_http_req_alloc(&req, curl) == 0);
+			Reset({
+				nng_http_req_free(req);
+				nng_url_free(curl);
+			});
+			So(nng_http_req_set_method(req, "POST") == 0);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpdo(curl, req, res, &data, &size) == 0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_METHOD_NOT_ALLOWED);
+		});
+	});
+
 	Convey("Directory serving works", {
 		char     urlstr[32];
 		nng_url *url;
@@ -270,6 +464,7 @@ TestMain("HTTP Server", {
 		char *   file1;
 		char *   file2;
 		char *   file3;
+		char *   file4;
 		char *   subdir1;
 		char *   subdir2;
 
@@ -283,10 +478,15 @@ TestMain("HTTP Server", {
 		So((file1 = nni_file_join(subdir1, "index.html")) != NULL);
 		So((file2 = nni_file_join(workdir, "file.txt")) != NULL);
 		So((file3 = nni_file_join(subdir2, "index.htm")) != NULL);
+		So((file4 = nni_file_join(workdir, "big.bin")) != NULL);
 
+		for (int i = 0; i < DOC4_SIZE; i++) {
+			doc4[i] = (uint8_t)((i * 7) + (i >> 8));
+		}
 		So(nni_file_put(file1, doc1, strlen(doc1)) == 0);
 		So(nni_file_put(file2, doc2, strlen(doc2)) == 0);
 		So(nni_file_put(file3, doc3, strlen(doc3)) == 0);
+		So(nni_file_put(file4, doc4, DOC4_SIZE) == 0);
 
 		Reset({
 			nng_http_server_release(s);
@@ -294,6 +494,7 @@ TestMain("HTTP Server", {
 			nni_file_delete(file1);
 			nni_file_delete(file2);
 			nni_file_delete(file3);
+			nni_file_delete(file4);
 			nni_file_delete(subdir1);
 			nni_file_delete(subdir2);
 			nni_file_delete(workdir);
@@ -301,6 +502,7 @@ TestMain("HTTP Server", {
 			nni_strfree(file1);
 			nni_strfree(file2);
 			nni_strfree(file3);
+			nni_strfree(file4);
 			nni_strfree(subdir1);
 			nni_strfree(subdir2);
 			nng_url_free(url);
@@ -366,6 +568,213 @@ TestMain("HTTP Server", {
 			nng_free(data, size);
 		});
 
+		Convey("Large files are streamed", {
+			char          fullurl[256];
+			void *        data;
+			size_t        size;
+			nng_http_res *res;
+			const char *  ptr;
+
+			snprintf(fullurl, sizeof(fullurl), "%s/docs/big.bin",
+			    urlstr);
+			So(nng_http_res_alloc(&res) == 0);
+			Reset({ nng_http_res_free(res); });
+
+			// The whole file.
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(nng_http_res_get_status(res) == NNG_HTTP_STATUS_OK);
+			So(size == DOC4_SIZE);
+			So(memcmp(data, doc4, size) == 0);
+			nng_free(data, size);
+			ptr = nng_http_res_get_header(res, "Accept-Ranges");
+			So(ptr != NULL);
+			So(strcmp(ptr, "bytes") == 0);
+
+			// A byte range.
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, "Range", "bytes=1000-70999", res,
+			       &data, &size) == 0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_PARTIAL_CONTENT);
+			So(size == 70000);
+			So(memcmp(data, doc4 + 1000, size) == 0);
+			nng_free(data, size);
+			ptr = nng_http_res_get_header(res, "Content-Range");
+			So(ptr != NULL);
+			So(strcmp(ptr, "bytes 1000-70999/200000") == 0);
+
+			// A suffix range.
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, "Range", "bytes=-100", res, &data,
+			       &size) == 0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_PARTIAL_CONTENT);
+			So(size == 100);
+			So(memcmp(data, doc4 + DOC4_SIZE - 100, size) == 0);
+			nng_free(data, size);
+
+			// A range past the end.
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, "Range", "bytes=300000-", res,
+			       &data, &size) == 0);
+			So(nng_http_res_get_status(res) ==
+			    NNG_HTTP_STATUS_RANGE_NOT_SATISFIABLE);
+			So(size == 0);
+			ptr = nng_http_res_get_header(res, "Content-Range");
+			So(ptr != NULL);
+			So(strcmp(ptr, "bytes */200000") == 0);
+		});
+
+		Convey("Conditional requests give 304", {
+			char          fullurl[256];
+			void *        data;
+			size_t        size;
+			nng_http_res *res;
+			nng_http_res *res2;
+			const char *  etag;
+			const char *  lastmod;
+
+			snprintf(fullurl, sizeof(fullurl), "%s/docs/big.bin",
+			    urlstr);
+			So(nng_http_res_alloc(&res) == 0);
+			So(nng_http_res_alloc(&res2) == 0);
+			Reset({
+				nng_http_res_free(res);
+				nng_http_res_free(res2);
+			});
+
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			nng_free(data, size);
+			etag = nng_http_res_get_header(res, "ETag");
+			So(etag != NULL);
+			lastmod = nng_http_res_get_header(res, "Last-Modified");
+			So(lastmod != NULL);
+
+			So(httpfetch(fullurl, "If-None-Match", etag, res2,
+			       &data, &size) == 0);
+			So(nng_http_res_get_status(res2) ==
+			    NNG_HTTP_STATUS_NOT_MODIFIED);
+			So(size == 0);
+
+			nng_http_res_free(res2);
+			So(nng_http_res_alloc(&res2) == 0);
+			So(httpfetch(fullurl, "If-Modified-Since", lastmod,
+			       res2, &data, &size) == 0);
+			So(nng_http_res_get_status(res2) ==
+			    NNG_HTTP_STATUS_NOT_MODIFIED);
+			So(size == 0);
+
+			// A stale tag gets the whole file.
+			nng_http_res_free(res2);
+			So(nng_http_res_alloc(&res2) == 0);
+			So(httpfetch(fullurl, "If-None-Match", "\"stale\"",
+			       res2, &data, &size) == 0);
+			So(nng_http_res_get_status(res2) == NNG_HTTP_STATUS_OK);
+			So(size == DOC4_SIZE);
+			nng_free(data, size);
+		});
+
+		Convey("Cached content is served", {
+			char          fullurl[256];
+			void *        data;
+			size_t        size;
+			nng_http_res *res;
+			const char *  ptr;
+			char *        gzfile;
+			const char *  doc2b = "This text file has changed.";
+			const char *  gzdoc = "(pretend this is compressed)";
+
+			snprintf(fullurl, sizeof(fullurl), "%s/docs/file.txt",
+			    urlstr);
+			So((gzfile = nni_file_join(workdir, "file.txt.gz")) !=
+			    NULL);
+			So(nng_http_res_alloc(&res) == 0);
+			Reset({
+				nng_http_res_free(res);
+				nni_file_delete(gzfile);
+				nni_strfree(gzfile);
+			});
+			So(nng_http_server_set_cache(s, 1024 * 1024, 65536) ==
+			    0);
+
+			for (int i = 0; i < 2; i++) {
+				nng_http_res_free(res);
+				So(nng_http_res_alloc(&res) == 0);
+				So(httpfetch(fullurl, NULL, NULL, res, &data,
+				       &size) == 0);
+				So(nng_http_res_get_status(res) ==
+				    NNG_HTTP_STATUS_OK);
+				So(size == strlen(doc2));
+				So(memcmp(data, doc2, size) == 0);
+				nng_free(data, size);
+				ptr = nng_http_res_get_header(res, "Content-Type");
+				So(ptr != NULL);
+				So(strcmp(ptr, "text/plain") == 0);
+			}
+
+			// Conditional requests are answered from the cache too.
+			ptr = nng_http_res_get_header(res, "ETag");
+			So(ptr != NULL);
+			{
+				nng_http_res *res2;
+				So(nng_http_res_alloc(&res2) == 0);
+				So(httpfetch(fullurl, "If-None-Match", ptr, res2,
+				       &data, &size) == 0);
+				So(nng_http_res_get_status(res2) ==
+				    NNG_HTTP_STATUS_NOT_MODIFIED);
+				So(size == 0);
+				nng_http_res_free(res2);
+			}
+
+			// Changing the file is noticed, and with it, the
+			// precompressed variant.
+			So(nni_file_put(gzfile, gzdoc, strlen(gzdoc)) == 0);
+			So(nni_file_put(file2, doc2b, strlen(doc2b)) == 0);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(size == strlen(doc2b));
+			So(memcmp(data, doc2b, size) == 0);
+			nng_free(data, size);
+			So(nng_http_res_get_header(res, "Content-Encoding") ==
+			    NULL);
+
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, "Accept-Encoding", "deflate, gzip",
+			       res, &data, &size) == 0);
+			So(size == strlen(gzdoc));
+			So(memcmp(data, gzdoc, size) == 0);
+			nng_free(data, size);
+			ptr = nng_http_res_get_header(res, "Content-Encoding");
+			So(ptr != NULL);
+			So(strcmp(ptr, "gzip") == 0);
+
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, "Accept-Encoding", "gzip;q=0", res,
+			       &data, &size) == 0);
+			So(size == strlen(doc2b));
+			nng_free(data, size);
+
+			// Files too large for the cache are still served.
+			snprintf(fullurl, sizeof(fullurl), "%s/docs/big.bin",
+			    urlstr);
+			nng_http_res_free(res);
+			So(nng_http_res_alloc(&res) == 0);
+			So(httpfetch(fullurl, NULL, NULL, res, &data, &size) ==
+			    0);
+			So(size == DOC4_SIZE);
+			So(memcmp(data, doc4, size) == 0);
+			nng_free(data, size);
+		});
+
 		Convey("Missing index gives 404", {
 			char     fullurl[256];
 			void *   data;
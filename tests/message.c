@@ -177,6 +177,35 @@ TestMain("Message Tests", {
 			So(strcmp(nng_msg_body(m2), "back2basics") == 0);
 		});
 
+		Convey("Dup bodies are copied on write", {
+			nng_msg *m2;
+			nng_msg *m3;
+			char *   body;
+
+			So(nng_msg_append(msg, "shared", strlen("shared") + 1) ==
+			    0);
+			So(nng_msg_dup(&m2, msg) == 0);
+			So(nng_msg_dup(&m3, m2) == 0);
+
+			body = nng_msg_body(m2);
+			So(body != NULL);
+			body[0] = 'S';
+			So(strcmp(nng_msg_body(m2), "Shared") == 0);
+			So(strcmp(nng_msg_body(msg), "shared") == 0);
+			So(strcmp(nng_msg_body(m3), "shared") == 0);
+
+			// Once the others are gone, m3 has it to itself.
+			nng_msg_free(m2);
+			So(nng_msg_trim(msg, 1) == 0);
+			So(strcmp(nng_msg_body(msg), "hared") == 0);
+			So(strcmp(nng_msg_body(m3), "shared") == 0);
+			So(nng_msg_chop(m3, 1) == 0);
+			So(nng_msg_append(m3, "!", 2) == 0);
+			So(strcmp(nng_msg_body(m3), "shared!") == 0);
+			So(strcmp(nng_msg_body(msg), "hared") == 0);
+			nng_msg_free(m3);
+		});
+
 		Convey("Missing option fails properly", {
 			char   buf[128];
 			size_t sz = sizeof(buf);
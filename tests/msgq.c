@@ -0,0 +1,236 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "core/nng_impl.h"
+
+#include <string.h>
+
+#define NPRODUCERS 4
+#define NCONSUMERS 2
+#define NMSGS 5000
+#define NTOTAL (NPRODUCERS * NMSGS)
+
+static nni_msg *
+mkmsg(uint32_t a, uint32_t b)
+{
+	nni_msg *msg;
+	uint32_t v[2];
+
+	v[0] = a;
+	v[1] = b;
+	if (nni_msg_alloc(&msg, 0) != 0) {
+		return (NULL);
+	}
+	if (nni_msg_append(msg, v, sizeof(v)) != 0) {
+		nni_msg_free(msg);
+		return (NULL);
+	}
+	return (msg);
+}
+
+static uint32_t
+msgval(nni_msg *msg, int i)
+{
+	uint32_t v[2];
+
+	memcpy(v, nni_msg_body(msg), sizeof(v));
+	return (v[i]);
+}
+
+static nni_msg *
+getmsg(nni_msgq *mq, nni_aio *aio)
+{
+	nni_msgq_aio_get(mq, aio);
+	nni_aio_wait(aio);
+	if (nni_aio_result(aio) != 0) {
+		return (NULL);
+	}
+	return (nni_aio_get_msg(aio));
+}
+
+typedef struct {
+	nni_thr         thr;
+	nni_msgq *      mq;
+	uint32_t        id;
+	nni_atomic_u64 *count;
+	bool            ordered;
+} worker;
+
+static void
+producer(void *arg)
+{
+	worker *w = arg;
+
+	for (uint32_t i = 0; i < NMSGS; i++) {
+		nni_msg *msg = mkmsg(w->id, i);
+		while (nni_msgq_tryput(w->mq, msg) != 0) {
+			nni_msleep(0);
+		}
+	}
+}
+
+static void
+consumer(void *arg)
+{
+	worker * w = arg;
+	nni_aio *aio;
+	nni_msg *msg;
+	uint32_t next[NPRODUCERS];
+
+	memset(next, 0, sizeof(next));
+	w->ordered = true;
+	if (nni_aio_init(&aio, NULL, NULL) != 0) {
+		return;
+	}
+	nni_aio_set_timeout(aio, NNG_DURATION_INFINITE);
+	while ((msg = getmsg(w->mq, aio)) != NULL) {
+		uint32_t p = msgval(msg, 0);
+		uint32_t i = msgval(msg, 1);
+		// Each producer's messages must come out in order, though
+		// they are shared out between the consumers.
+		if ((p >= NPRODUCERS) || (i < next[p])) {
+			w->ordered = false;
+		} else {
+			next[p] = i + 1;
+		}
+		nni_msg_free(msg);
+		nni_atomic_inc64(w->count);
+	}
+	nni_aio_fini(aio);
+}
+
+Main({
+	nni_init();
+	atexit(nni_fini);
+
+	Test("Message queues", {
+		Convey("Given an aio", {
+			nni_msgq *mq;
+			nni_aio * aio;
+
+			So(nni_aio_init(&aio, NULL, NULL) == 0);
+			nni_aio_set_timeout(aio, NNG_DURATION_INFINITE);
+			Reset({ nni_aio_fini(aio); });
+
+			Convey("Buffered queues work", {
+				nni_msg *msg;
+
+				So(nni_msgq_init(&mq, 4) == 0);
+				Reset({ nni_msgq_fini(mq); });
+
+				for (uint32_t i = 0; i < 4; i++) {
+					So(nni_msgq_tryput(mq, mkmsg(0, i)) ==
+					    0);
+				}
+				So(nni_msgq_len(mq) == 4);
+				msg = mkmsg(0, 4);
+				So(nni_msgq_tryput(mq, msg) == NNG_EAGAIN);
+				nni_msg_free(msg);
+
+				for (uint32_t i = 0; i < 4; i++) {
+					So((msg = getmsg(mq, aio)) != NULL);
+					So(msgval(msg, 1) == i);
+					nni_msg_free(msg);
+				}
+				So(nni_msgq_len(mq) == 0);
+			});
+
+			Convey("Waiting readers get messages", {
+				nni_msg *msg;
+
+				So(nni_msgq_init(&mq, 0) == 0);
+				Reset({ nni_msgq_fini(mq); });
+
+				msg = mkmsg(0, 1);
+				So(nni_msgq_tryput(mq, msg) == NNG_EAGAIN);
+
+				nni_msgq_aio_get(mq, aio);
+				So(nni_msgq_tryput(mq, msg) == 0);
+				nni_aio_wait(aio);
+				So(nni_aio_result(aio) == 0);
+				So(nni_aio_get_msg(aio) == msg);
+				nni_msg_free(msg);
+			});
+
+			Convey("Closing fails waiters and frees messages", {
+				So(nni_msgq_init(&mq, 2) == 0);
+				Reset({ nni_msgq_fini(mq); });
+
+				So(nni_msgq_tryput(mq, mkmsg(0, 0)) == 0);
+				nni_msgq_close(mq);
+				So(nni_msgq_len(mq) == 0);
+				nni_msgq_aio_get(mq, aio);
+				nni_aio_wait(aio);
+				So(nni_aio_result(aio) == NNG_ECLOSED);
+			});
+
+			Convey("Resizing keeps messages in order", {
+				nni_msg *msg;
+
+				So(nni_msgq_init(&mq, 2) == 0);
+				Reset({ nni_msgq_fini(mq); });
+
+				So(nni_msgq_tryput(mq, mkmsg(0, 0)) == 0);
+				So(nni_msgq_tryput(mq, mkmsg(0, 1)) == 0);
+				So(nni_msgq_resize(mq, 8) == 0);
+				So(nni_msgq_cap(mq) == 8);
+				for (uint32_t i = 2; i < 8; i++) {
+					So(nni_msgq_tryput(mq, mkmsg(0, i)) ==
+					    0);
+				}
+				for (uint32_t i = 0; i < 8; i++) {
+					So((msg = getmsg(mq, aio)) != NULL);
+					So(msgval(msg, 1) == i);
+					nni_msg_free(msg);
+				}
+			});
+
+			Convey("Concurrent producers and consumers", {
+				worker         prods[NPRODUCERS];
+				worker         cons[NCONSUMERS];
+				nni_atomic_u64 count;
+
+				So(nni_msgq_init(&mq, 16) == 0);
+				Reset({ nni_msgq_fini(mq); });
+				nni_atomic_init64(&count);
+
+				for (int i = 0; i < NCONSUMERS; i++) {
+					worker *w = &cons[i];
+					w->mq     = mq;
+					w->count  = &count;
+					So(nni_thr_init(&w->thr, consumer, w) ==
+					    0);
+					nni_thr_run(&w->thr);
+				}
+				for (int i = 0; i < NPRODUCERS; i++) {
+					worker *w = &prods[i];
+					w->mq     = mq;
+					w->id     = (uint32_t) i;
+					So(nni_thr_init(&w->thr, producer, w) ==
+					    0);
+					nni_thr_run(&w->thr);
+				}
+				for (int i = 0; i < NPRODUCERS; i++) {
+					nni_thr_fini(&prods[i].thr);
+				}
+				while (nni_atomic_get64(&count) < NTOTAL) {
+					nni_msleep(1);
+				}
+				nni_msgq_close(mq);
+				for (int i = 0; i < NCONSUMERS; i++) {
+					nni_thr_fini(&cons[i].thr);
+					So(cons[i].ordered);
+				}
+				So(nni_atomic_get64(&count) == NTOTAL);
+			});
+		});
+	});
+})
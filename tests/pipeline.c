@@ -90,6 +90,39 @@ TestMain("PIPELINE (PUSH/PULL) pattern", {
 			CHECKSTR(msg, "hello");
 			nng_msg_free(msg);
 		});
+
+		Convey("Large allocated buffers are not copied", {
+			size_t len = 1024 * 1024 + 7;
+			size_t sz;
+			char * buf;
+			char * rbuf;
+
+			So((buf = nng_alloc(len)) != NULL);
+			for (size_t i = 0; i < len; i++) {
+				buf[i] = (char) i;
+			}
+			// Inproc passes the message along as it is, and PUSH
+			// adds no header, so we get back the same buffer.
+			So(nng_send(push, buf, len, NNG_FLAG_ALLOC) == 0);
+			So(nng_recv(pull, &rbuf, &sz, NNG_FLAG_ALLOC) == 0);
+			So(rbuf == buf);
+			So(sz == len);
+			So(rbuf[len - 1] == (char) (len - 1));
+
+			// A received buffer may be sent on in turn.
+			So(nng_send(push, rbuf, sz, NNG_FLAG_ALLOC) == 0);
+			So(nng_recv(pull, &buf, &sz, NNG_FLAG_ALLOC) == 0);
+			So(buf == rbuf);
+
+			// Bodies with headroom in front are given out too.
+			So(nng_send(push, buf + 1, sz - 1, 0) == 0);
+			nng_free(buf, sz);
+			So(nng_recv(pull, &rbuf, &sz, NNG_FLAG_ALLOC) == 0);
+			So(sz == len - 1);
+			So(rbuf[0] == (char) 1);
+			So(rbuf[sz - 1] == (char) (len - 1));
+			nng_free(rbuf, sz);
+		});
 	});
 
 	Convey("Load balancing", {
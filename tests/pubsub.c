@@ -135,6 +135,58 @@ TestMain("PUB/SUB pattern", {
 			nng_msg_free(msg);
 		});
 
+		Convey("Overlapping subscriptions work", {
+			nng_msg *msg;
+
+			So(nng_setopt(sub, NNG_OPT_SUB_SUBSCRIBE, "/a/b/c", 6) ==
+			    0);
+			So(nng_setopt(sub, NNG_OPT_SUB_SUBSCRIBE, "/a/x", 4) ==
+			    0);
+			So(nng_setopt(sub, NNG_OPT_SUB_SUBSCRIBE, "/a/", 3) == 0);
+			So(nng_setopt_ms(sub, NNG_OPT_RECVTIMEO, 90) == 0);
+
+			So(nng_msg_alloc(&msg, 0) == 0);
+			APPENDSTR(msg, "/a/b/d");
+			So(nng_sendmsg(pub, msg, 0) == 0);
+			So(nng_recvmsg(sub, &msg, 0) == 0);
+			CHECKSTR(msg, "/a/b/d");
+			nng_msg_free(msg);
+
+			So(nng_setopt(sub, NNG_OPT_SUB_UNSUBSCRIBE, "/a/b", 4) ==
+			    NNG_ENOENT);
+			So(nng_setopt(sub, NNG_OPT_SUB_UNSUBSCRIBE, "/a/", 3) ==
+			    0);
+			So(nng_setopt(sub, NNG_OPT_SUB_UNSUBSCRIBE, "/a/", 3) ==
+			    NNG_ENOENT);
+
+			So(nng_msg_alloc(&msg, 0) == 0);
+			APPENDSTR(msg, "/a/b/d");
+			So(nng_sendmsg(pub, msg, 0) == 0);
+			So(nng_recvmsg(sub, &msg, 0) == NNG_ETIMEDOUT);
+
+			So(nng_msg_alloc(&msg, 0) == 0);
+			APPENDSTR(msg, "/a/b/cde");
+			So(nng_sendmsg(pub, msg, 0) == 0);
+			So(nng_recvmsg(sub, &msg, 0) == 0);
+			CHECKSTR(msg, "/a/b/cde");
+			nng_msg_free(msg);
+
+			So(nng_setopt(sub, NNG_OPT_SUB_UNSUBSCRIBE, "/a/b/c", 6) ==
+			    0);
+
+			So(nng_msg_alloc(&msg, 0) == 0);
+			APPENDSTR(msg, "/a/xyz");
+			So(nng_sendmsg(pub, msg, 0) == 0);
+			So(nng_recvmsg(sub, &msg, 0) == 0);
+			CHECKSTR(msg, "/a/xyz");
+			nng_msg_free(msg);
+
+			So(nng_msg_alloc(&msg, 0) == 0);
+			APPENDSTR(msg, "/a/b/cde");
+			So(nng_sendmsg(pub, msg, 0) == 0);
+			So(nng_recvmsg(sub, &msg, 0) == NNG_ETIMEDOUT);
+		});
+
 		Convey("Subs without subsciptions don't receive", {
 
 			nng_msg *msg;
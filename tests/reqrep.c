@@ -16,6 +16,59 @@
 
 #include <string.h>
 
+#define NCTX 100
+
+static nng_aio *
+mkaio(void)
+{
+	nng_aio *aio;
+
+	if (nng_aio_alloc(&aio, NULL, NULL) != 0) {
+		return (NULL);
+	}
+	nng_aio_set_timeout(aio, 5000);
+	return (aio);
+}
+
+static int
+ctx_sendnum(nng_ctx ctx, nng_aio *aio, uint32_t num)
+{
+	nng_msg *msg;
+	int      rv;
+
+	if ((rv = nng_msg_alloc(&msg, 0)) != 0) {
+		return (rv);
+	}
+	if ((rv = nng_msg_append_u32(msg, num)) != 0) {
+		nng_msg_free(msg);
+		return (rv);
+	}
+	nng_aio_set_msg(aio, msg);
+	nng_ctx_send(ctx, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		nng_msg_free(msg);
+	}
+	return (rv);
+}
+
+static int
+ctx_recvnum(nng_ctx ctx, nng_aio *aio, uint32_t *nump)
+{
+	nng_msg *msg;
+	int      rv;
+
+	nng_ctx_recv(ctx, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		return (rv);
+	}
+	msg = nng_aio_get_msg(aio);
+	rv  = nng_msg_trim_u32(msg, nump);
+	nng_msg_free(msg);
+	return (rv);
+}
+
 TestMain("REQ/REP pattern", {
 	int         rv;
 	const char *addr = "inproc://test";
@@ -149,5 +202,125 @@ TestMain("REQ/REP pattern", {
 		So(memcmp(nng_msg_body(cmd), "def", 4) == 0);
 		nng_msg_free(cmd);
 	});
+	Convey("Contexts can be used", {
+		nng_socket req;
+		nng_socket rep;
+		nng_ctx    reqctx[NCTX];
+		nng_ctx    repctx[NCTX];
+		nng_aio *  aio;
+
+		So(nng_rep_open(&rep) == 0);
+		So(nng_req_open(&req) == 0);
+		So((aio = mkaio()) != NULL);
+
+		Reset({
+			nng_close(rep);
+			nng_close(req);
+			nng_aio_free(aio);
+		});
+
+		So(nng_listen(rep, addr, NULL, 0) == 0);
+		So(nng_dial(req, addr, NULL, 0) == 0);
+
+		for (int i = 0; i < NCTX; i++) {
+			So(nng_ctx_open(&reqctx[i], req) == 0);
+			So(nng_ctx_open(&repctx[i], rep) == 0);
+		}
+
+		Convey("Context options work", {
+			nng_duration d;
+
+			So(nng_ctx_setopt_ms(
+			       reqctx[0], NNG_OPT_REQ_RESENDTIME, 1234) == 0);
+			So(nng_ctx_getopt_ms(
+			       reqctx[0], NNG_OPT_REQ_RESENDTIME, &d) == 0);
+			So(d == 1234);
+			So(nng_getopt_ms(req, NNG_OPT_REQ_RESENDTIME, &d) == 0);
+			So(d != 1234);
+			So(nng_ctx_setopt_ms(reqctx[0], NNG_OPT_RECVTIMEO, 10) ==
+			    0);
+			So(nng_ctx_getopt_ms(reqctx[0], NNG_OPT_RECVTIMEO, &d) ==
+			    0);
+			So(d == 10);
+			So(nng_ctx_setopt_ms(repctx[0], NNG_OPT_REQ_RESENDTIME,
+			       10) == NNG_ENOTSUP);
+		});
+
+		Convey("Receive before send fails", {
+			uint32_t num;
+			So(ctx_recvnum(reqctx[0], aio, &num) == NNG_ESTATE);
+		});
+
+		Convey("Requests are matched to their contexts", {
+			uint32_t num;
+			uint32_t got[NCTX];
+
+			// All the requests are outstanding at once, and the
+			// replies come back in the reverse order.
+			for (uint32_t i = 0; i < NCTX; i++) {
+				So(ctx_sendnum(reqctx[i], aio, i) == 0);
+			}
+			for (int i = 0; i < NCTX; i++) {
+				So(ctx_recvnum(repctx[i], aio, &got[i]) == 0);
+			}
+			for (int i = NCTX - 1; i >= 0; i--) {
+				So(ctx_sendnum(repctx[i], aio, got[i]) == 0);
+			}
+			for (uint32_t i = 0; i < NCTX; i++) {
+				So(ctx_recvnum(reqctx[i], aio, &num) == 0);
+				So(num == i);
+			}
+		});
+
+		Convey("Contexts and the socket work side by side", {
+			uint32_t num;
+			nng_msg *msg;
+
+			So(ctx_sendnum(reqctx[0], aio, 1) == 0);
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_msg_append_u32(msg, 2) == 0);
+			So(nng_sendmsg(req, msg, 0) == 0);
+
+			for (int i = 0; i < 2; i++) {
+				So(ctx_recvnum(repctx[i], aio, &num) == 0);
+				So(ctx_sendnum(repctx[i], aio, num + 10) == 0);
+			}
+
+			So(nng_recvmsg(req, &msg, 0) == 0);
+			So(nng_msg_trim_u32(msg, &num) == 0);
+			So(num == 12);
+			nng_msg_free(msg);
+			So(ctx_recvnum(reqctx[0], aio, &num) == 0);
+			So(num == 11);
+		});
+
+		Convey("Closing a context aborts its receive", {
+			So(ctx_sendnum(reqctx[0], aio, 1) == 0);
+			nng_ctx_recv(reqctx[0], aio);
+			So(nng_ctx_close(reqctx[0]) == 0);
+			nng_aio_wait(aio);
+			So(nng_aio_result(aio) == NNG_ECLOSED);
+			So(nng_ctx_close(reqctx[0]) == NNG_ECLOSED);
+		});
+
+		Convey("Closing the socket aborts context receives", {
+			nng_ctx_recv(repctx[0], aio);
+			nng_close(rep);
+			nng_aio_wait(aio);
+			So(nng_aio_result(aio) == NNG_ECLOSED);
+			So(nng_ctx_close(repctx[0]) == NNG_ECLOSED);
+		});
+	});
+
+	Convey("Raw sockets have no contexts", {
+		nng_socket req;
+		nng_ctx    ctx;
+
+		So(nng_req_open(&req) == 0);
+		Reset({ nng_close(req); });
+		So(nng_setopt_int(req, NNG_OPT_RAW, 1) == 0);
+		So(nng_ctx_open(&ctx, req) == NNG_ENOTSUP);
+	});
+
 	nng_fini();
 })
@@ -20,10 +20,36 @@
 
 #include "stubs.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #define SECONDS(x) ((x) *1000)
 
+// Lookup threads keep finding the socket, listener, and pipe by handle
+// while the socket is closed underneath them.
+typedef struct {
+	nng_socket   s;
+	nng_listener l;
+	nng_pipe     p;
+	int          stop;
+	int          finds;
+} lookup_arg;
+
+static void
+lookup_main(void *arg)
+{
+	lookup_arg *la = arg;
+	size_t      sz;
+	int         v;
+
+	while (!la->stop) {
+		(void) nng_getopt_int(la->s, NNG_OPT_RECVBUF, &v);
+		(void) nng_listener_getopt_size(la->l, NNG_OPT_RECVMAXSZ, &sz);
+		(void) nng_pipe_getopt_size(la->p, NNG_OPT_RECVMAXSZ, &sz);
+		la->finds++;
+	}
+}
+
 TestMain("Socket Operations", {
 
 	atexit(nng_fini);
@@ -450,6 +476,43 @@ TestMain("Socket Operations", {
 
 		});
 
+		Convey("Close waits for lookups in flight", {
+			for (int i = 0; i < 20; i++) {
+				nng_socket   s2;
+				nng_thread * thrs[4];
+				lookup_arg   la;
+				nng_msg *    msg;
+				char         addr[64];
+
+				(void) snprintf(addr, sizeof(addr),
+				    "inproc://lookup%d", i);
+				So(nng_pair_open(&la.s) == 0);
+				So(nng_pair_open(&s2) == 0);
+				So(nng_listen(la.s, addr, &la.l, 0) == 0);
+				So(nng_dial(s2, addr, NULL, 0) == 0);
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_sendmsg(s2, msg, 0) == 0);
+				So(nng_recvmsg(la.s, &msg, 0) == 0);
+				la.p     = nng_msg_get_pipe(msg);
+				la.stop  = 0;
+				la.finds = 0;
+				nng_msg_free(msg);
+
+				for (int j = 0; j < 4; j++) {
+					So(nng_thread_create(&thrs[j],
+					       lookup_main, &la) == 0);
+				}
+				nng_msleep(1);
+				So(nng_close(la.s) == 0);
+				So(nng_close(s2) == 0);
+				la.stop = 1;
+				for (int j = 0; j < 4; j++) {
+					nng_thread_destroy(thrs[j]);
+				}
+				So(nng_close(la.s) == NNG_ECLOSED);
+			}
+		});
+
 		Convey("We can send and receive messages", {
 			nng_socket   s2;
 			int          len;
@@ -0,0 +1,158 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "nng.h"
+#include "protocol/pair1/pair.h"
+#include "supplemental/util/platform.h"
+#include "stubs.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static nng_stat *
+findstat(nng_snapshot *snap, const char *name)
+{
+	nng_stat *stat = NULL;
+
+	for (;;) {
+		if ((nng_snapshot_next(snap, &stat) != 0) || (stat == NULL)) {
+			return (NULL);
+		}
+		if (strcmp(nng_stat_name(stat), name) == 0) {
+			return (stat);
+		}
+	}
+}
+
+static int64_t
+statval(nng_snapshot *snap, const char *name)
+{
+	nng_stat *stat;
+	if ((stat = findstat(snap, name)) == NULL) {
+		return (-1);
+	}
+	return (nng_stat_value(stat));
+}
+
+TestMain("Statistics", {
+	const char *addr = "inproc://stats";
+
+	Convey("Snapshots of a bad socket fail", {
+		nng_snapshot *snap;
+		So(nng_snapshot_create(12345, &snap) == NNG_ECLOSED);
+	});
+
+	Convey("We can snapshot a socket", {
+		nng_socket    s1;
+		nng_snapshot *snap;
+		nng_stat *    stat;
+
+		So(nng_pair1_open(&s1) == 0);
+		So(nng_snapshot_create(s1, &snap) == 0);
+		Reset({
+			nng_snapshot_free(snap);
+			nng_close(s1);
+		});
+
+		Convey("Snapshot is empty before update", {
+			stat = NULL;
+			So(nng_snapshot_next(snap, &stat) == 0);
+			So(stat == NULL);
+		});
+
+		Convey("Socket statistics are present", {
+			So(nng_snapshot_update(snap) == 0);
+			stat = findstat(snap, "tx_msgs");
+			So(stat != NULL);
+			So(nng_stat_type(stat) == NNG_STAT_COUNTER);
+			So(nng_stat_unit(stat) == NNG_UNIT_MESSAGES);
+			So(nng_stat_value(stat) == 0);
+
+			stat = findstat(snap, "pipes");
+			So(stat != NULL);
+			So(nng_stat_type(stat) == NNG_STAT_LEVEL);
+			So(nng_stat_value(stat) == 0);
+		});
+
+		Convey("Message pool statistics are present", {
+			nng_msg *msg;
+			for (int i = 0; i < 100; i++) {
+				So(nng_msg_alloc(&msg, 100) == 0);
+				nng_msg_free(msg);
+			}
+			So(nng_snapshot_update(snap) == 0);
+			So(statval(snap, "msgpool.misses") >= 0);
+			So(statval(snap, "msgpool.hits") > 0);
+		});
+
+		Convey("Update fails after close", {
+			nng_close(s1);
+			So(nng_snapshot_update(snap) == NNG_ECLOSED);
+		});
+	});
+
+	Convey("Traffic is counted", {
+		nng_socket    s1;
+		nng_socket    s2;
+		nng_snapshot *snap1;
+		nng_snapshot *snap2;
+		nng_msg *     msg;
+		nng_pipe      p;
+		char          name[64];
+
+		So(nng_pair1_open(&s1) == 0);
+		So(nng_pair1_open(&s2) == 0);
+		So(nng_snapshot_create(s1, &snap1) == 0);
+		So(nng_snapshot_create(s2, &snap2) == 0);
+		Reset({
+			nng_snapshot_free(snap1);
+			nng_snapshot_free(snap2);
+			nng_close(s1);
+			nng_close(s2);
+		});
+
+		So(nng_listen(s1, addr, NULL, 0) == 0);
+		So(nng_dial(s2, addr, NULL, 0) == 0);
+		nng_msleep(20);
+
+		So(nng_msg_alloc(&msg, 0) == 0);
+		So(nng_msg_append(msg, "hello", 5) == 0);
+		So(nng_sendmsg(s2, msg, 0) == 0);
+		So(nng_recvmsg(s1, &msg, 0) == 0);
+		p = nng_msg_get_pipe(msg);
+		nng_msg_free(msg);
+
+		So(nng_snapshot_update(snap1) == 0);
+		So(nng_snapshot_update(snap2) == 0);
+
+		So(statval(snap1, "pipes") == 1);
+		So(statval(snap1, "endpoints") == 1);
+		So(statval(snap1, "rx_msgs") == 1);
+		So(statval(snap1, "rx_bytes") >= 5);
+		So(statval(snap1, "tx_msgs") == 0);
+		So(statval(snap2, "tx_msgs") == 1);
+		So(statval(snap2, "tx_bytes") >= 5);
+
+		(void) snprintf(name, sizeof(name), "pipe.%u.rx_msgs",
+		    (unsigned) p);
+		So(statval(snap1, name) == 1);
+
+		Convey("Pipe statistics go away with the pipe", {
+			nng_close(s2);
+			nng_msleep(50);
+			So(nng_snapshot_update(snap1) == 0);
+			So(statval(snap1, "pipes") == 0);
+			So(findstat(snap1, name) == NULL);
+			// Totals survive.
+			So(statval(snap1, "rx_msgs") == 1);
+		});
+	});
+});
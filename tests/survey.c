@@ -13,6 +13,7 @@
 #include "nng.h"
 #include "protocol/survey0/respond.h"
 #include "protocol/survey0/survey.h"
+#include "supplemental/util/platform.h"
 #include "stubs.h"
 
 #include <string.h>
@@ -22,6 +23,48 @@
 	So(nng_msg_len(m) == strlen(s)); \
 	So(memcmp(nng_msg_body(m), s, strlen(s)) == 0)
 
+#define NCTX 10
+#define NRESP 3
+
+static int
+ctx_survey(nng_ctx ctx, nng_aio *aio, uint32_t num)
+{
+	nng_msg *msg;
+	int      rv;
+
+	if ((rv = nng_msg_alloc(&msg, 0)) != 0) {
+		return (rv);
+	}
+	if ((rv = nng_msg_append_u32(msg, num)) != 0) {
+		nng_msg_free(msg);
+		return (rv);
+	}
+	nng_aio_set_msg(aio, msg);
+	nng_ctx_send(ctx, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		nng_msg_free(msg);
+	}
+	return (rv);
+}
+
+static int
+ctx_response(nng_ctx ctx, nng_aio *aio, uint32_t *nump)
+{
+	nng_msg *msg;
+	int      rv;
+
+	nng_ctx_recv(ctx, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		return (rv);
+	}
+	msg = nng_aio_get_msg(aio);
+	rv  = nng_msg_trim_u32(msg, nump);
+	nng_msg_free(msg);
+	return (rv);
+}
+
 TestMain("SURVEY pattern", {
 	const char *addr = "inproc://test";
 
@@ -115,4 +158,121 @@ TestMain("SURVEY pattern", {
 			});
 		});
 	});
+
+	Convey("Surveys can run concurrently in contexts", {
+		nng_socket surv;
+		nng_socket resp[NRESP];
+		nng_ctx    ctx[NCTX];
+		nng_aio *  aio;
+
+		So(nng_surveyor_open(&surv) == 0);
+		So(nng_aio_alloc(&aio, NULL, NULL) == 0);
+		nng_aio_set_timeout(aio, 5000);
+		for (int i = 0; i < NRESP; i++) {
+			So(nng_respondent_open(&resp[i]) == 0);
+		}
+
+		Reset({
+			nng_close(surv);
+			for (int i = 0; i < NRESP; i++) {
+				nng_close(resp[i]);
+			}
+			nng_aio_free(aio);
+		});
+
+		So(nng_listen(surv, addr, NULL, 0) == 0);
+		for (int i = 0; i < NRESP; i++) {
+			So(nng_setopt_ms(resp[i], NNG_OPT_RECVTIMEO, 1000) ==
+			    0);
+			So(nng_dial(resp[i], addr, NULL, 0) == 0);
+		}
+		nng_msleep(100);
+
+		for (int i = 0; i < NCTX; i++) {
+			So(nng_ctx_open(&ctx[i], surv) == 0);
+		}
+
+		Convey("Context options work", {
+			nng_duration d;
+
+			So(nng_ctx_getopt_ms(
+			       ctx[0], NNG_OPT_SURVEYOR_SURVEYTIME, &d) == 0);
+			So(d == 1000);
+			So(nng_ctx_setopt_ms(
+			       ctx[0], NNG_OPT_SURVEYOR_SURVEYTIME, 100) == 0);
+			So(nng_ctx_getopt_ms(
+			       ctx[0], NNG_OPT_SURVEYOR_SURVEYTIME, &d) == 0);
+			So(d == 100);
+			So(nng_getopt_ms(
+			       surv, NNG_OPT_SURVEYOR_SURVEYTIME, &d) == 0);
+			So(d == 1000);
+		});
+
+		Convey("Recv with no survey fails", {
+			uint32_t num;
+			So(ctx_response(ctx[0], aio, &num) == NNG_ESTATE);
+		});
+
+		Convey("Responses go to the right survey", {
+			uint32_t num;
+
+			for (int i = 0; i < NCTX; i++) {
+				So(nng_ctx_setopt_ms(ctx[i],
+				       NNG_OPT_SURVEYOR_SURVEYTIME, 500) == 0);
+				So(ctx_survey(ctx[i], aio, (uint32_t) i) == 0);
+			}
+			// Each respondent echoes every survey back.
+			for (int r = 0; r < NRESP; r++) {
+				for (int i = 0; i < NCTX; i++) {
+					nng_msg *msg;
+					So(nng_recvmsg(resp[r], &msg, 0) == 0);
+					So(nng_sendmsg(resp[r], msg, 0) == 0);
+				}
+			}
+			// Collect them in the opposite order.
+			for (int i = NCTX - 1; i >= 0; i--) {
+				for (int r = 0; r < NRESP; r++) {
+					So(ctx_response(ctx[i], aio, &num) == 0);
+					So(num == (uint32_t) i);
+				}
+			}
+			// Nothing more comes, and the survey ends.
+			So(ctx_response(ctx[0], aio, &num) == NNG_ETIMEDOUT);
+			So(ctx_response(ctx[0], aio, &num) == NNG_ESTATE);
+		});
+
+		Convey("A new survey discards old responses", {
+			nng_msg *msg;
+			uint32_t num;
+
+			So(ctx_survey(ctx[0], aio, 1) == 0);
+			So(nng_recvmsg(resp[0], &msg, 0) == 0);
+			So(nng_sendmsg(resp[0], msg, 0) == 0);
+			nng_msleep(100);
+
+			So(ctx_survey(ctx[0], aio, 2) == 0);
+			So(nng_recvmsg(resp[0], &msg, 0) == 0);
+			So(nng_sendmsg(resp[0], msg, 0) == 0);
+			So(ctx_response(ctx[0], aio, &num) == 0);
+			So(num == 2);
+		});
+
+		Convey("Closing a context aborts its receive", {
+			So(ctx_survey(ctx[0], aio, 0) == 0);
+			nng_ctx_recv(ctx[0], aio);
+			So(nng_ctx_close(ctx[0]) == 0);
+			nng_aio_wait(aio);
+			So(nng_aio_result(aio) == NNG_ECLOSED);
+		});
+	});
+
+	Convey("Raw surveyors do not support contexts", {
+		nng_socket surv;
+		nng_ctx    ctx;
+
+		So(nng_surveyor_open(&surv) == 0);
+		Reset({ nng_close(surv); });
+		So(nng_setopt_int(surv, NNG_OPT_RAW, 1) == 0);
+		So(nng_ctx_open(&ctx, surv) == NNG_ENOTSUP);
+	});
 });
@@ -13,9 +13,14 @@
 #include "protocol/pair1/pair.h"
 #include "trantest.h"
 
+#include <string.h>
+
 #include "stubs.h"
 // TCP tests.
 
+#define NDIALERS 32
+#define NCOALESCE 64
+
 #ifndef _WIN32
 #include <arpa/inet.h>
 #endif
@@ -48,6 +53,58 @@ check_props_v4(nng_msg *msg)
 	return (0);
 }
 
+// recv_in_order receives n messages, which must carry the numbers 0 to
+// n - 1 in order.
+static int
+recv_in_order(nng_socket s, int n)
+{
+	for (uint32_t i = 0; i < (uint32_t) n; i++) {
+		nng_msg *msg;
+		uint32_t v;
+		int      rv;
+
+		if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
+			return (rv);
+		}
+		rv = nng_msg_trim_u32(msg, &v);
+		nng_msg_free(msg);
+		if ((rv != 0) || (v != i)) {
+			return (NNG_EPROTO);
+		}
+	}
+	return (0);
+}
+
+// tx_writes returns the number of writes made by the socket's pipe, or
+// -1 if it cannot be found.
+static int64_t
+tx_writes(nng_socket s)
+{
+	nng_snapshot *snap;
+	nng_stat *    stat = NULL;
+	int64_t       val  = -1;
+	const char *  sfx  = ".tx_writes";
+
+	if (nng_snapshot_create(s, &snap) != 0) {
+		return (-1);
+	}
+	if (nng_snapshot_update(snap) == 0) {
+		while ((nng_snapshot_next(snap, &stat) == 0) &&
+		    (stat != NULL)) {
+			const char *name = nng_stat_name(stat);
+			size_t      len  = strlen(name);
+
+			if ((len > strlen(sfx)) &&
+			    (strcmp(name + len - strlen(sfx), sfx) == 0)) {
+				val = nng_stat_value(stat);
+				break;
+			}
+		}
+	}
+	nng_snapshot_free(snap);
+	return (val);
+}
+
 TestMain("TCP Transport", {
 
 	trantest_test_extended("tcp://127.0.0.1:%u", check_props_v4);
@@ -99,6 +156,167 @@ TestMain("TCP Transport", {
 		So(nng_dial(s2, addr, NULL, 0) == 0);
 	});
 
+	Convey("Small messages are coalesced into fewer writes", {
+		nng_socket   s1;
+		nng_socket   s2;
+		nng_listener l;
+		nng_msg *    msg;
+		char         addr[NNG_MAXADDRLEN];
+		size_t       sz;
+
+		So(nng_pair_open(&s1) == 0);
+		So(nng_pair_open(&s2) == 0);
+		Reset({
+			nng_close(s2);
+			nng_close(s1);
+		});
+		So(nng_setopt_size(s1, NNG_OPT_SENDCOALESCE, 1U << 30) ==
+		    NNG_EINVAL);
+		So(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 5000) == 0);
+		So(nng_listen(s1, "tcp://127.0.0.1:0", &l, 0) == 0);
+		So(nng_listener_getopt_size(l, NNG_OPT_SENDCOALESCE, &sz) == 0);
+		So(sz == 32768);
+		sz = sizeof(addr);
+		So(nng_listener_getopt(l, NNG_OPT_URL, addr, &sz) == 0);
+
+		// The messages are queued before there is a pipe, so that
+		// they are all waiting to be sent when it starts.
+		So(nng_setopt_int(s2, NNG_OPT_SENDBUF, NCOALESCE) == 0);
+		for (int i = 0; i < NCOALESCE; i++) {
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_msg_append_u32(msg, i) == 0);
+			So(nng_sendmsg(s2, msg, NNG_FLAG_NONBLOCK) == 0);
+		}
+
+		Convey("Several messages go out in each write", {
+			So(nng_dial(s2, addr, NULL, 0) == 0);
+			So(recv_in_order(s1, NCOALESCE) == 0);
+			So(tx_writes(s2) > 0);
+			So(tx_writes(s2) < NCOALESCE);
+		});
+
+		Convey("Each message is written by itself when disabled", {
+			So(nng_setopt_size(s2, NNG_OPT_SENDCOALESCE, 0) == 0);
+			So(nng_dial(s2, addr, NULL, 0) == 0);
+			So(recv_in_order(s1, NCOALESCE) == 0);
+			So(tx_writes(s2) == NCOALESCE);
+		});
+	});
+
+	Convey("TCP socket options can be configured", {
+		nng_socket   s1;
+		nng_socket   s2;
+		nng_listener l;
+		nng_msg *    msg;
+		nng_pipe     p;
+		char         addr[NNG_MAXADDRLEN];
+		size_t       sz;
+		nng_duration d;
+		int          v;
+
+		So(nng_pair_open(&s1) == 0);
+		So(nng_pair_open(&s2) == 0);
+		Reset({
+			nng_close(s2);
+			nng_close(s1);
+		});
+		So(nng_setopt_int(s1, NNG_OPT_TCP_NODELAY, 2) == NNG_EINVAL);
+		So(nng_setopt_int(s1, NNG_OPT_TCP_KEEPALIVE_COUNT, -1) ==
+		    NNG_EINVAL);
+		So(nng_setopt_int(s1, NNG_OPT_TCP_KEEPALIVE, 1) == 0);
+		So(nng_setopt_ms(s1, NNG_OPT_TCP_KEEPALIVE_IDLE, 10000) == 0);
+		So(nng_listen(s1, "tcp://127.0.0.1:0", &l, 0) == 0);
+
+		So(nng_listener_getopt_int(l, NNG_OPT_TCP_NODELAY, &v) == 0);
+		So(v == 1);
+		So(nng_listener_getopt_int(l, NNG_OPT_TCP_KEEPALIVE, &v) == 0);
+		So(v == 1);
+		So(nng_listener_getopt_ms(l, NNG_OPT_TCP_KEEPALIVE_IDLE, &d) ==
+		    0);
+		So(d == 10000);
+		So(nng_listener_setopt_ms(
+		       l, NNG_OPT_TCP_KEEPALIVE_INTERVAL, 2000) == 0);
+		So(nng_listener_setopt_int(l, NNG_OPT_TCP_KEEPALIVE_COUNT, 3) ==
+		    0);
+		So(nng_listener_setopt_int(l, NNG_OPT_TCP_QUICKACK, 1) == 0);
+		So(nng_listener_setopt_size(l, NNG_OPT_TCP_SENDBUF, 65536) ==
+		    0);
+		So(nng_listener_getopt_size(l, NNG_OPT_TCP_SENDBUF, &sz) == 0);
+		So(sz == 65536);
+		So(nng_listener_getopt_size(l, NNG_OPT_TCP_RECVBUF, &sz) == 0);
+		So(sz == 0);
+
+		So(nng_setopt_int(s2, NNG_OPT_TCP_NODELAY, 0) == 0);
+		So(nng_setopt_size(s2, NNG_OPT_TCP_RECVBUF, 65536) == 0);
+		sz = sizeof(addr);
+		So(nng_listener_getopt(l, NNG_OPT_URL, addr, &sz) == 0);
+		So(nng_dial(s2, addr, NULL, 0) == 0);
+
+		// The pipes report what was applied, and messages still flow.
+		So(nng_send(s2, "ping", 5, 0) == 0);
+		So(nng_recvmsg(s1, &msg, 0) == 0);
+		p = nng_msg_get_pipe(msg);
+		So(nng_pipe_getopt_int(p, NNG_OPT_TCP_NODELAY, &v) == 0);
+		So(v == 1);
+		So(nng_pipe_getopt_int(p, NNG_OPT_TCP_KEEPALIVE, &v) == 0);
+		So(v == 1);
+		So(nng_sendmsg(s1, msg, 0) == 0);
+		So(nng_recvmsg(s2, &msg, 0) == 0);
+		p = nng_msg_get_pipe(msg);
+		So(nng_pipe_getopt_int(p, NNG_OPT_TCP_NODELAY, &v) == 0);
+		So(v == 0);
+		So(nng_pipe_getopt_int(p, NNG_OPT_TCP_KEEPALIVE, &v) == 0);
+		So(v == 0);
+		So(strcmp(nng_msg_body(msg), "ping") == 0);
+		nng_msg_free(msg);
+	});
+
+	Convey("Listeners can share the port across sockets", {
+		nng_socket   s1;
+		nng_socket   cs[NDIALERS];
+		nng_listener l;
+		char         addr[NNG_MAXADDRLEN];
+		size_t       sz;
+		int          v;
+
+		So(nng_pair1_open(&s1) == 0);
+		Reset({ nng_close(s1); });
+		So(nng_setopt_int(s1, NNG_OPT_TCP_LISTEN_BACKLOG, 0) ==
+		    NNG_EINVAL);
+		So(nng_setopt_int(s1, NNG_OPT_TCP_LISTEN_SHARDS, 0) ==
+		    NNG_EINVAL);
+		So(nng_setopt_int(s1, NNG_OPT_TCP_LISTEN_BACKLOG, 1024) == 0);
+		So(nng_setopt_int(s1, NNG_OPT_TCP_LISTEN_SHARDS, 4) == 0);
+		So(nng_setopt_int(s1, NNG_OPT_PAIR1_POLY, 1) == 0);
+		So(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 5000) == 0);
+		So(nng_listen(s1, "tcp://127.0.0.1:0", &l, 0) == 0);
+		So(nng_listener_getopt_int(l, NNG_OPT_TCP_LISTEN_SHARDS, &v) ==
+		    0);
+		So(v == 4);
+		So(nng_listener_getopt_int(l, NNG_OPT_TCP_LISTEN_BACKLOG, &v) ==
+		    0);
+		So(v == 1024);
+		sz = sizeof(addr);
+		So(nng_listener_getopt(l, NNG_OPT_URL, addr, &sz) == 0);
+
+		// Every connection is accepted, whichever socket it lands on.
+		for (int i = 0; i < NDIALERS; i++) {
+			So(nng_pair1_open(&cs[i]) == 0);
+			So(nng_dial(cs[i], addr, NULL, 0) == 0);
+		}
+		for (int i = 0; i < NDIALERS; i++) {
+			So(nng_send(cs[i], &i, sizeof(i), 0) == 0);
+		}
+		for (int i = 0; i < NDIALERS; i++) {
+			nng_msg *msg;
+			So(nng_recvmsg(s1, &msg, 0) == 0);
+			nng_msg_free(msg);
+		}
+		for (int i = 0; i < NDIALERS; i++) {
+			nng_close(cs[i]);
+		}
+	});
+
 	Convey("Malformed TCP addresses do not panic", {
 		nng_socket s1;
 
@@ -0,0 +1,178 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "core/nng_impl.h"
+
+#include <stdlib.h>
+
+typedef struct {
+	nni_wheel_node node;
+	nni_time       expire;
+	nni_time       fired;
+	bool           removed;
+} witem;
+
+#define NITEMS 2000
+
+static nni_wheel wheel;
+static witem     items[NITEMS];
+
+// run_wheel drives the wheel the same way the timer thread does, jumping
+// straight to each time the wheel asks for, and records when each item
+// comes back.  It returns the number of items expired.
+static int
+run_wheel(nni_wheel *w, nni_time start)
+{
+	nni_time now = start;
+	witem *  item;
+	int      n = 0;
+
+	for (;;) {
+		if ((item = nni_wheel_expire(w, now)) != NULL) {
+			item->fired = now;
+			n++;
+			continue;
+		}
+		if ((now = nni_wheel_next(w)) == NNI_TIME_NEVER) {
+			break;
+		}
+	}
+	return (n);
+}
+
+static uint64_t
+rand64(void)
+{
+	return (((uint64_t) nni_random() << 32) | nni_random());
+}
+
+static void
+fired_cb(void *arg)
+{
+	nni_time *tp = arg;
+	*tp          = nni_clock();
+}
+
+Main({
+	nni_init();
+	atexit(nni_fini);
+
+	Test("Timing wheels", {
+		Convey("Items expire exactly on time", {
+			nni_time start = 0x3fffff00; // near the end of a turn
+			int      n;
+
+			NNI_WHEEL_INIT(&wheel, witem, node, start);
+			for (int i = 0; i < NITEMS; i++) {
+				witem *item = &items[i];
+				switch (i % 4) {
+				case 0: // near
+					item->expire = start + (rand64() % 5000);
+					break;
+				case 1: // far
+					item->expire = start + (rand64() >> 28);
+					break;
+				case 2: // way beyond the top level
+					item->expire =
+					    start + (1ULL << 31) + (rand64() >> 32);
+					break;
+				default: // already due
+					item->expire = start - (rand64() % 100);
+					break;
+				}
+				item->fired   = NNI_TIME_NEVER;
+				item->removed = false;
+				nni_wheel_add(&wheel, item, item->expire);
+				So(nni_wheel_active(&wheel, item));
+			}
+
+			n = run_wheel(&wheel, start);
+			So(n == NITEMS);
+			for (int i = 0; i < NITEMS; i++) {
+				witem *  item = &items[i];
+				nni_time want = item->expire;
+
+				if (want < start) {
+					want = start;
+				}
+				if (item->fired != want) {
+					So(item->fired == want);
+				}
+				So(!nni_wheel_active(&wheel, item));
+			}
+			So(nni_wheel_next(&wheel) == NNI_TIME_NEVER);
+		});
+
+		Convey("Removed and rescheduled items are honored", {
+			nni_time start = 1000;
+			int      n;
+
+			NNI_WHEEL_INIT(&wheel, witem, node, start);
+			for (int i = 0; i < NITEMS; i++) {
+				witem *item   = &items[i];
+				item->expire  = start + (rand64() % 100000);
+				item->fired   = NNI_TIME_NEVER;
+				item->removed = false;
+				nni_wheel_add(&wheel, item, item->expire);
+			}
+			for (int i = 0; i < NITEMS; i += 3) {
+				nni_wheel_remove(&wheel, &items[i]);
+				items[i].removed = true;
+			}
+			for (int i = 1; i < NITEMS; i += 3) {
+				items[i].expire = start + (rand64() % 1000);
+				nni_wheel_add(&wheel, &items[i], items[i].expire);
+			}
+
+			n = run_wheel(&wheel, start);
+			So(n == NITEMS - ((NITEMS + 2) / 3));
+			for (int i = 0; i < NITEMS; i++) {
+				witem *item = &items[i];
+				if (item->removed) {
+					So(item->fired == NNI_TIME_NEVER);
+				} else if (item->fired != item->expire) {
+					So(item->fired == item->expire);
+				}
+			}
+		});
+	});
+
+	Test("Timers", {
+		Convey("Timers fire in order", {
+			nni_timer_node t1;
+			nni_timer_node t2;
+			nni_timer_node t3;
+			nni_time       f1    = 0;
+			nni_time       f2    = 0;
+			nni_time       f3    = 0;
+			nni_time       start = nni_clock();
+
+			nni_timer_init(&t1, fired_cb, &f1);
+			nni_timer_init(&t2, fired_cb, &f2);
+			nni_timer_init(&t3, fired_cb, &f3);
+
+			nni_timer_schedule(&t1, start + 150);
+			nni_timer_schedule(&t2, start + 50);
+			nni_timer_schedule(&t3, start + 100);
+			nni_timer_cancel(&t3);
+
+			nni_msleep(300);
+			So(f2 >= start + 50);
+			So(f1 >= start + 150);
+			So(f1 >= f2);
+			So(f3 == 0);
+
+			nni_timer_fini(&t1);
+			nni_timer_fini(&t2);
+			nni_timer_fini(&t3);
+		});
+	});
+})
@@ -74,6 +74,9 @@ extern void trantest_test_all(const char *addr);
 #ifndef NNG_TRANSPORT_WSS
 #define nng_wss_register notransport
 #endif
+#ifndef NNG_TRANSPORT_UDP
+#define nng_udp_register notransport
+#endif
 
 int
 notransport(void)
@@ -110,6 +113,9 @@ trantest_checktran(const char *url)
 #ifndef NNG_TRANSPORT_ZEROTIER
 	CHKTRAN(url, "zt:");
 #endif
+#ifndef NNG_TRANSPORT_UDP
+	CHKTRAN(url, "udp:");
+#endif
 
 	(void) url;
 }
@@ -311,7 +317,7 @@ trantest_send_recv(trantest *tt)
 		So(nng_recvmsg(tt->reqsock, &recv, 0) == 0);
 		So(recv != NULL);
 		So(nng_msg_len(recv) == strlen("acknowledge"));
-		So(strcmp(nng_msg_body(recv), "acknowledge") == 0);
+		So(memcmp(nng_msg_body(recv), "acknowledge", len) == 0);
 		p = nng_msg_get_pipe(recv);
 		So(p != 0);
 		sz = sizeof(url);
@@ -405,7 +411,7 @@ trantest_check_properties(trantest *tt, trantest_proptest_t f)
 		So(nng_recvmsg(tt->repsock, &recv, 0) == 0);
 		So(recv != NULL);
 		So(nng_msg_len(recv) == 5);
-		So(strcmp(nng_msg_body(recv), "props") == 0);
+		So(memcmp(nng_msg_body(recv), "props", 5) == 0);
 		rv = f(recv);
 		nng_msg_free(recv);
 		So(rv == 0);
@@ -465,6 +471,54 @@ trantest_send_recv_large(trantest *tt)
 	})
 }
 
+void
+trantest_send_recv_burst(trantest *tt)
+{
+	Convey("Send and recv burst", {
+		nng_listener l;
+		nng_dialer   d;
+		nng_msg *    msg;
+		int          i;
+
+		// A raw requester lets us have many requests in flight, so
+		// the far side receives a stream of small messages back to
+		// back, of varying sizes.  The buffers are big enough to
+		// hold them all, so we can send them all before receiving.
+		So(nng_setopt_int(tt->reqsock, NNG_OPT_RAW, 1) == 0);
+		So(nng_setopt_int(tt->reqsock, NNG_OPT_SENDBUF, 500) == 0);
+		So(nng_setopt_int(tt->repsock, NNG_OPT_RECVBUF, 500) == 0);
+		So(trantest_listen(tt, &l) == 0);
+		So(l != 0);
+		So(trantest_dial(tt, &d) == 0);
+		So(d != 0);
+
+		nng_msleep(200); // listener may be behind slightly
+
+		for (i = 0; i < 500; i++) {
+			size_t len = (i * 37) % 256;
+			So(nng_msg_alloc(&msg, len) == 0);
+			memset(nng_msg_body(msg), i & 0xff, len);
+			So(nng_msg_header_append_u32(msg, 0x80000000u | i) ==
+			    0);
+			So(nng_sendmsg(tt->reqsock, msg, 0) == 0);
+		}
+		for (i = 0; i < 500; i++) {
+			size_t   len = (i * 37) % 256;
+			uint8_t *body;
+
+			So(nng_recvmsg(tt->repsock, &msg, 0) == 0);
+			body = nng_msg_body(msg);
+			So(nng_msg_len(msg) == len);
+			if ((len > 0) &&
+			    ((body[0] != (i & 0xff)) ||
+			        (body[len - 1] != (i & 0xff)))) {
+				So(body[len - 1] == (i & 0xff));
+			}
+			nng_msg_free(msg);
+		}
+	});
+}
+
 void
 trantest_test_all(const char *addr)
 {
@@ -483,6 +537,7 @@ trantest_test_all(const char *addr)
 		trantest_send_recv(&tt);
 		trantest_send_recv_large(&tt);
 		trantest_send_recv_multi(&tt);
+		trantest_send_recv_burst(&tt);
 	})
 }
 
@@ -533,6 +588,7 @@ trantest_test(trantest *tt)
 		trantest_send_recv(tt);
 		trantest_send_recv_large(tt);
 		trantest_send_recv_multi(tt);
+		trantest_send_recv_burst(tt);
 		if (tt->proptest != NULL) {
 			trantest_check_properties(tt, tt->proptest);
 		}
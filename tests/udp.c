@@ -18,6 +18,16 @@
 // Basic UDP tests.
 #include "core/nng_impl.h"
 
+#define UDP_NDGRAM 48 // datagrams in the batching test
+#define UDP_DGSZ 1200 // largest of them
+
+// The batching test sends datagrams all the same size, but for the last.
+static size_t
+udp_dgram_size(int i)
+{
+	return (i == UDP_NDGRAM - 1 ? 100 : UDP_DGSZ);
+}
+
 TestMain("UDP support", {
 
 	nni_init();
@@ -103,6 +113,118 @@ TestMain("UDP support", {
 			nng_aio_free(aio2);
 		});
 
+		Convey("Many datagrams are batched", {
+			// Queueing all of these up at once lets the platform
+			// send them together, in one call, and if it can,
+			// as one segmented buffer.  The last one is short.
+			nng_aio *    saios[UDP_NDGRAM];
+			nng_aio *    raios[UDP_NDGRAM];
+			nng_sockaddr to;
+			nng_sockaddr froms[UDP_NDGRAM];
+			char *       sbuf;
+			char *       rbuf;
+			int          seen[UDP_NDGRAM];
+
+			sbuf = nng_alloc(UDP_NDGRAM * UDP_DGSZ);
+			rbuf = nng_alloc(UDP_NDGRAM * UDP_DGSZ);
+			So(sbuf != NULL);
+			So(rbuf != NULL);
+			memset(seen, 0, sizeof(seen));
+			to = sa2;
+
+			for (int i = 0; i < UDP_NDGRAM; i++) {
+				nng_iov iov;
+				memset(sbuf + i * UDP_DGSZ, i, UDP_DGSZ);
+				So(nng_aio_alloc(&saios[i], NULL, NULL) == 0);
+				So(nng_aio_alloc(&raios[i], NULL, NULL) == 0);
+				iov.iov_buf = sbuf + i * UDP_DGSZ;
+				iov.iov_len = udp_dgram_size(i);
+				So(nng_aio_set_iov(saios[i], 1, &iov) == 0);
+				nng_aio_set_input(saios[i], 0, &to);
+				iov.iov_buf = rbuf + i * UDP_DGSZ;
+				iov.iov_len = UDP_DGSZ;
+				So(nng_aio_set_iov(raios[i], 1, &iov) == 0);
+				nng_aio_set_input(raios[i], 0, &froms[i]);
+				nni_plat_udp_recv(u2, raios[i]);
+			}
+			for (int i = 0; i < UDP_NDGRAM; i++) {
+				nni_plat_udp_send(u1, saios[i]);
+			}
+			for (int i = 0; i < UDP_NDGRAM; i++) {
+				nng_aio_wait(saios[i]);
+				So(nng_aio_result(saios[i]) == 0);
+				So(nng_aio_count(saios[i]) ==
+				    udp_dgram_size(i));
+			}
+			for (int i = 0; i < UDP_NDGRAM; i++) {
+				char * buf = rbuf + i * UDP_DGSZ;
+				size_t len;
+				int    id;
+
+				nng_aio_wait(raios[i]);
+				So(nng_aio_result(raios[i]) == 0);
+				len = nng_aio_count(raios[i]);
+				id  = (uint8_t) buf[0];
+				So(id < UDP_NDGRAM);
+				So(len == udp_dgram_size(id));
+				for (size_t j = 0; j < len; j++) {
+					if (buf[j] != (char) id) {
+						So(buf[j] == (char) id);
+						break;
+					}
+				}
+				So(froms[i].s_un.s_in.sa_port ==
+				    sa1.s_un.s_in.sa_port);
+				seen[id]++;
+			}
+			for (int i = 0; i < UDP_NDGRAM; i++) {
+				So(seen[i] == 1);
+				nng_aio_free(saios[i]);
+				nng_aio_free(raios[i]);
+			}
+			nng_free(sbuf, UDP_NDGRAM * UDP_DGSZ);
+			nng_free(rbuf, UDP_NDGRAM * UDP_DGSZ);
+		});
+
+		Convey("We can scatter into many iovs", {
+			char         msg[] = "scatter gather";
+			char         rbuf[6][4];
+			nng_iov      iovs[6];
+			nng_iov      iov;
+			nng_sockaddr to;
+			nng_sockaddr from;
+			nng_aio *    aio1;
+			nng_aio *    aio2;
+
+			So(nng_aio_alloc(&aio1, NULL, NULL) == 0);
+			So(nng_aio_alloc(&aio2, NULL, NULL) == 0);
+
+			to          = sa2;
+			iov.iov_buf = msg;
+			iov.iov_len = sizeof(msg) - 1;
+			So(nng_aio_set_iov(aio1, 1, &iov) == 0);
+			nng_aio_set_input(aio1, 0, &to);
+
+			for (int i = 0; i < 6; i++) {
+				iovs[i].iov_buf = rbuf[i];
+				iovs[i].iov_len = sizeof(rbuf[i]);
+			}
+			So(nng_aio_set_iov(aio2, 6, iovs) == 0);
+			nng_aio_set_input(aio2, 0, &from);
+
+			nni_plat_udp_recv(u2, aio2);
+			nni_plat_udp_send(u1, aio1);
+			nng_aio_wait(aio1);
+			nng_aio_wait(aio2);
+			So(nng_aio_result(aio1) == 0);
+			So(nng_aio_result(aio2) == 0);
+			So(nng_aio_count(aio2) == sizeof(msg) - 1);
+			So(memcmp(rbuf, msg, sizeof(msg) - 1) == 0);
+
+			nng_aio_free(aio1);
+			nng_aio_free(aio2);
+		});
+
 		Convey("Sending without an address fails", {
 			nng_aio *aio1;
 			char *   msg = "nope";
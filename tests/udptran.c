@@ -0,0 +1,174 @@
+//
+// Copyright 2018 Staysail Systems, Inc. <info@staysail.tech>
+// Copyright 2018 Capitar IT Group BV <info@capitar.com>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "nng.h"
+#include "protocol/pair1/pair.h"
+#include "transport/udp/udp.h"
+#include "trantest.h"
+
+#include <string.h>
+
+#include "stubs.h"
+// UDP transport tests.  (The platform UDP tests are in udp.c.)
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+static int
+check_props_v4(nng_msg *msg)
+{
+	nng_pipe     p;
+	size_t       z;
+	nng_sockaddr la;
+	nng_sockaddr ra;
+	uint64_t     lost;
+
+	p = nng_msg_get_pipe(msg);
+	So(p > 0);
+	z = sizeof(nng_sockaddr);
+	So(nng_pipe_getopt(p, NNG_OPT_LOCADDR, &la, &z) == 0);
+	So(z == sizeof(la));
+	So(la.s_un.s_family == NNG_AF_INET);
+	So(la.s_un.s_in.sa_port == htons(trantest_port - 1));
+	So(la.s_un.s_in.sa_addr == htonl(0x7f000001));
+
+	z = sizeof(nng_sockaddr);
+	So(nng_pipe_getopt(p, NNG_OPT_REMADDR, &ra, &z) == 0);
+	So(z == sizeof(ra));
+	So(ra.s_un.s_family == NNG_AF_INET);
+	So(ra.s_un.s_in.sa_port != 0);
+	So(ra.s_un.s_in.sa_addr == htonl(0x7f000001));
+
+	So(nng_pipe_getopt_size(p, NNG_OPT_UDP_MTU, &z) == 0);
+	So(z == 1452);
+	So(nng_pipe_getopt_uint64(p, NNG_OPT_UDP_RECV_LOST, &lost) == 0);
+	So(lost == 0);
+	So(nng_pipe_getopt_uint64(p, NNG_OPT_UDP_SEND_LOST, &lost) == 0);
+	So(lost == 0);
+
+	return (0);
+}
+
+TestMain("UDP Transport", {
+
+	trantest_test_extended("udp://127.0.0.1:%u", check_props_v4);
+
+	Convey("We cannot connect to wild cards", {
+		nng_socket s;
+		char       addr[NNG_MAXADDRLEN];
+
+		So(nng_pair_open(&s) == 0);
+		Reset({ nng_close(s); });
+		trantest_next_address(addr, "udp://*:%u");
+		So(nng_dial(s, addr, NULL, 0) == NNG_EADDRINVAL);
+	});
+
+	Convey("We can bind to port zero", {
+		nng_socket   s1;
+		nng_socket   s2;
+		nng_listener l;
+		char         addr[NNG_MAXADDRLEN];
+		size_t       sz;
+
+		So(nng_pair_open(&s1) == 0);
+		So(nng_pair_open(&s2) == 0);
+		Reset({
+			nng_close(s2);
+			nng_close(s1);
+		});
+		So(nng_listen(s1, "udp://127.0.0.1:0", &l, 0) == 0);
+		sz = NNG_MAXADDRLEN;
+		So(nng_listener_getopt(l, NNG_OPT_URL, addr, &sz) == 0);
+		So(nng_dial(s2, addr, NULL, 0) == 0);
+	});
+
+	Convey("The MTU can be configured", {
+		nng_socket   s1;
+		nng_socket   s2;
+		nng_listener l;
+		nng_dialer   d;
+		nng_msg *    msg;
+		nng_pipe     p;
+		char         addr[NNG_MAXADDRLEN];
+		size_t       sz;
+
+		So(nng_pair_open(&s1) == 0);
+		So(nng_pair_open(&s2) == 0);
+		Reset({
+			nng_close(s2);
+			nng_close(s1);
+		});
+		So(nng_setopt_size(s1, NNG_OPT_UDP_MTU, 100) == NNG_EINVAL);
+		So(nng_setopt_size(s1, NNG_OPT_UDP_MTU, 100000) == NNG_EINVAL);
+		So(nng_setopt_size(s1, NNG_OPT_UDP_MTU, 8000) == 0);
+
+		trantest_next_address(addr, "udp://127.0.0.1:%u");
+		So(nng_listener_create(&l, s1, addr) == 0);
+		So(nng_listener_getopt_size(l, NNG_OPT_UDP_MTU, &sz) == 0);
+		So(sz == 8000);
+		So(nng_listener_start(l, 0) == 0);
+		So(nng_listener_setopt_size(l, NNG_OPT_UDP_MTU, 4000) ==
+		    NNG_ESTATE);
+
+		// The peers agree on the smaller of the two.
+		So(nng_dialer_create(&d, s2, addr) == 0);
+		So(nng_dialer_setopt_size(d, NNG_OPT_UDP_MTU, 512) == 0);
+		So(nng_dialer_start(d, 0) == 0);
+
+		// Small MTUs mean lots of fragments.
+		So(nng_msg_alloc(&msg, 10000) == 0);
+		memset(nng_msg_body(msg), 'x', 10000);
+		So(nng_sendmsg(s2, msg, 0) == 0);
+		So(nng_recvmsg(s1, &msg, 0) == 0);
+		So(nng_msg_len(msg) == 10000);
+		p = nng_msg_get_pipe(msg);
+		nng_msg_free(msg);
+		So(nng_pipe_getopt_size(p, NNG_OPT_UDP_MTU, &sz) == 0);
+		So(sz == 512);
+	});
+
+	Convey("Messages after a loss are counted", {
+		nng_socket   s1;
+		nng_socket   s2;
+		nng_listener l;
+		nng_msg *    msg;
+		nng_pipe     p;
+		char         addr[NNG_MAXADDRLEN];
+		uint64_t     lost;
+
+		So(nng_pair_open(&s1) == 0);
+		So(nng_pair_open(&s2) == 0);
+		Reset({
+			nng_close(s2);
+			nng_close(s1);
+		});
+		So(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 1000) == 0);
+		trantest_next_address(addr, "udp://127.0.0.1:%u");
+		So(nng_listen(s1, addr, &l, 0) == 0);
+		// The receiver enforces its own limit, and so loses this.
+		So(nng_listener_setopt_size(l, NNG_OPT_RECVMAXSZ, 100) == 0);
+		So(nng_dial(s2, addr, NULL, 0) == 0);
+
+		So(nng_msg_alloc(&msg, 200) == 0);
+		So(nng_sendmsg(s2, msg, 0) == 0);
+		So(nng_send(s2, "ok", 3, 0) == 0);
+		So(nng_recvmsg(s1, &msg, 0) == 0);
+		So(nng_msg_len(msg) == 3);
+		p = nng_msg_get_pipe(msg);
+		nng_msg_free(msg);
+		So(nng_pipe_getopt_uint64(p, NNG_OPT_UDP_RECV_LOST, &lost) ==
+		    0);
+		So(lost == 1);
+	});
+
+	nng_fini();
+})
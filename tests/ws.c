@@ -14,6 +14,10 @@
 #include "transport/ws/websocket.h"
 #include "trantest.h"
 
+#include "supplemental/http/http_api.h"
+#include "supplemental/tls/tls_api.h"
+#include "supplemental/websocket/websocket.h"
+
 #include "stubs.h"
 // TCP tests.
 
@@ -76,6 +80,31 @@ check_props_v4(nng_msg *msg)
 	return (0);
 }
 
+static const uint8_t test_mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+static const struct {
+	const char *str;
+	bool        valid;
+} utf8_cases[] = {
+	{ "", true },
+	{ "plain ascii text that is longer than sixteen bytes", true },
+	{ "caf\xc3\xa9", true },                 // U+00E9
+	{ "\xe2\x82\xac and more ascii after", true }, // U+20AC
+	{ "\xf0\x9f\x98\x80", true },            // U+1F600
+	{ "\xf4\x8f\xbf\xbf", true },            // U+10FFFF
+	{ "\xed\x9f\xbf", true },                // U+D7FF
+	{ "\xc0\xaf", false },                    // overlong '/'
+	{ "\xe0\x9f\xbf", false },               // overlong U+07FF
+	{ "\xf0\x8f\xbf\xbf", false },           // overlong U+FFFF
+	{ "\xed\xa0\x80", false },               // surrogate U+D800
+	{ "\xf4\x90\x80\x80", false },           // U+110000
+	{ "\xf5\x80\x80\x80", false },           // bad lead byte
+	{ "\x80", false },                        // stray continuation
+	{ "sixteen bytes ok\xe2\x82", false },    // truncated
+	{ "\xc3\x28", false },                    // bad continuation
+	{ NULL, false },
+};
+
 TestMain("WebSocket Transport", {
 
 	trantest_test_extended("ws://127.0.0.1:%u/test", check_props_v4);
@@ -117,5 +146,90 @@ TestMain("WebSocket Transport", {
 		So(nng_dial(s2, addr, NULL, 0) == NNG_ECONNREFUSED);
 	});
 
+	Convey("Masking matches the byte-wise definition", {
+		uint8_t buf[300];
+		uint8_t want[300];
+
+		// Try every alignment and every tail length, to exercise
+		// each of the vector, word, and byte loops.
+		for (size_t off = 0; off < 32; off++) {
+			for (size_t len = 0; len < sizeof(buf) - off; len++) {
+				for (size_t i = 0; i < sizeof(buf); i++) {
+					buf[i]  = (uint8_t)(i * 7 + 3);
+					want[i] = buf[i];
+				}
+				for (size_t i = 0; i < len; i++) {
+					want[off + i] ^= test_mask[i % 4];
+				}
+				nni_ws_mask(buf + off, len, test_mask);
+				if (memcmp(buf, want, sizeof(buf)) != 0) {
+					So(memcmp(buf, want, sizeof(buf)) == 0);
+				}
+			}
+		}
+		So(true);
+	});
+
+	Convey("UTF-8 validation works", {
+		for (int i = 0; utf8_cases[i].str != NULL; i++) {
+			const uint8_t *b = (const uint8_t *) utf8_cases[i].str;
+			size_t         l = strlen(utf8_cases[i].str);
+			So(nni_ws_utf8_valid(b, l) == utf8_cases[i].valid);
+		}
+	});
+
+	Convey("Text messages can be exchanged", {
+		nng_socket   s1;
+		nng_socket   s2;
+		nng_listener l;
+		nng_dialer   d;
+		char         addr[NNG_MAXADDRLEN];
+		char         buf[64];
+		size_t       sz;
+
+		So(nng_pair_open(&s1) == 0);
+		So(nng_pair_open(&s2) == 0);
+		Reset({
+			nng_close(s2);
+			nng_close(s1);
+		});
+		So(nng_setopt_ms(s1, NNG_OPT_RECVTIMEO, 1000) == 0);
+		trantest_next_address(addr, "ws://127.0.0.1:%u/text");
+		So(nng_listener_create(&l, s1, addr) == 0);
+		So(nng_dialer_create(&d, s2, addr) == 0);
+		So(nng_dialer_setopt_int(d, NNG_OPT_WS_SEND_TEXT, 1) == 0);
+
+		Convey("Text is refused by default", {
+			So(nng_listener_start(l, 0) == 0);
+			So(nng_dialer_start(d, 0) == 0);
+			So(nng_send(s2, "hello", 6, 0) == 0);
+			sz = sizeof(buf);
+			So(nng_recv(s1, buf, &sz, 0) == NNG_ETIMEDOUT);
+		});
+
+		Convey("Valid UTF-8 is received", {
+			const char *msg = "caf\xc3\xa9 \xe2\x82\xac";
+			So(nng_listener_setopt_int(
+			       l, NNG_OPT_WS_RECV_TEXT, 1) == 0);
+			So(nng_listener_start(l, 0) == 0);
+			So(nng_dialer_start(d, 0) == 0);
+			So(nng_send(s2, (void *) msg, strlen(msg) + 1, 0) == 0);
+			sz = sizeof(buf);
+			So(nng_recv(s1, buf, &sz, 0) == 0);
+			So(sz == strlen(msg) + 1);
+			So(strcmp(buf, msg) == 0);
+		});
+
+		Convey("Invalid UTF-8 is rejected", {
+			So(nng_listener_setopt_int(
+			       l, NNG_OPT_WS_RECV_TEXT, 1) == 0);
+			So(nng_listener_start(l, 0) == 0);
+			So(nng_dialer_start(d, 0) == 0);
+			So(nng_send(s2, "\xc0\xaf", 3, 0) == 0);
+			sz = sizeof(buf);
+			So(nng_recv(s1, buf, &sz, 0) == NNG_ETIMEDOUT);
+		});
+	});
+
 	nng_fini();
 })